@@ -260,7 +260,7 @@ _pacmd() {
     local comps
     local flags='-h --help --version'
     local commands=(exit help list-modules list-cards list-sinks list-sources list-clients
-                    list-samples list-sink-inputs list-source-outputs stat info
+                    list-samples list-sink-inputs list-source-outputs list-threads stat info
                     load-module unload-module describe-module set-sink-volume
                     set-source-volume set-sink-input-volume set-source-output-volume
                     set-sink-mute set-source-mut set-sink-input-mute
@@ -268,7 +268,7 @@ _pacmd() {
                     update-sink-input-proplist update-source-output-proplist
                     set-default-sink set-default-source kill-client kill-sink-input
                     kill-source-output play-sample remove-sample load-sample
-                    load-sample-lazy load-sample-dir-lazy play-file dump
+                    load-sample-lazy load-sample-dir-lazy play-file dump dump-trace
                     move-sink-input move-source-output suspend-sink suspend-source
                     suspend set-card-profile set-sink-port set-source-port
                     set-port-latency-offset set-log-target set-log-level set-log-meta
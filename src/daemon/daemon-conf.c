@@ -80,6 +80,7 @@ static const pa_daemon_conf default_conf = {
     .log_target = NULL,
     .log_level = PA_LOG_NOTICE,
     .log_backtrace = 0,
+    .trace_buffer_size = 0,
     .log_meta = FALSE,
     .log_time = FALSE,
     .resample_method = PA_RESAMPLER_AUTO,
@@ -490,6 +491,21 @@ static int parse_rtprio(pa_config_parser_state *state) {
     return 0;
 }
 
+static int parse_cpu_affinity(pa_config_parser_state *state) {
+    pa_cpu_set *cpus;
+
+    pa_assert(state);
+
+    cpus = state->data;
+
+    if (pa_cpu_set_parse(cpus, state->rvalue) < 0) {
+        pa_log(_("[%s:%u] Invalid CPU list '%s'."), state->filename, state->lineno, state->rvalue);
+        return -1;
+    }
+
+    return 0;
+}
+
 #ifdef HAVE_DBUS
 static int parse_server_type(pa_config_parser_state *state) {
     pa_daemon_conf *c;
@@ -535,6 +551,8 @@ int pa_daemon_conf_load(pa_daemon_conf *c, const char *filename) {
         { "exit-idle-time",             pa_config_parse_int,      &c->exit_idle_time, NULL },
         { "scache-idle-time",           pa_config_parse_int,      &c->scache_idle_time, NULL },
         { "realtime-priority",          parse_rtprio,             c, NULL },
+        { "io-thread-cpu-affinity",     parse_cpu_affinity,       &c->io_thread_affinity, NULL },
+        { "main-thread-cpu-affinity",   parse_cpu_affinity,       &c->main_thread_affinity, NULL },
         { "dl-search-path",             pa_config_parse_string,   &c->dl_search_path, NULL },
         { "default-script-file",        pa_config_parse_string,   &c->default_script_file, NULL },
         { "log-target",                 parse_log_target,         c, NULL },
@@ -562,6 +580,7 @@ int pa_daemon_conf_load(pa_daemon_conf *c, const char *filename) {
         { "log-meta",                   pa_config_parse_bool,     &c->log_meta, NULL },
         { "log-time",                   pa_config_parse_bool,     &c->log_time, NULL },
         { "log-backtrace",              pa_config_parse_unsigned, &c->log_backtrace, NULL },
+        { "trace-buffer-size",          pa_config_parse_unsigned, &c->trace_buffer_size, NULL },
 #ifdef HAVE_SYS_RESOURCE_H
         { "rlimit-fsize",               parse_rlimit,             &c->rlimit_fsize, NULL },
         { "rlimit-data",                parse_rlimit,             &c->rlimit_data, NULL },
@@ -708,6 +727,7 @@ char *pa_daemon_conf_dump(pa_daemon_conf *c) {
 
     pa_strbuf *s;
     char cm[PA_CHANNEL_MAP_SNPRINT_MAX];
+    char cpus[PA_CPU_SET_SNPRINT_MAX];
     char *log_target = NULL;
 
     pa_assert(c);
@@ -728,6 +748,8 @@ char *pa_daemon_conf_dump(pa_daemon_conf *c) {
     pa_strbuf_printf(s, "nice-level = %i\n", c->nice_level);
     pa_strbuf_printf(s, "realtime-scheduling = %s\n", pa_yes_no(c->realtime_scheduling));
     pa_strbuf_printf(s, "realtime-priority = %i\n", c->realtime_priority);
+    pa_strbuf_printf(s, "io-thread-cpu-affinity = %s\n", pa_cpu_set_snprint(cpus, sizeof(cpus), &c->io_thread_affinity));
+    pa_strbuf_printf(s, "main-thread-cpu-affinity = %s\n", pa_cpu_set_snprint(cpus, sizeof(cpus), &c->main_thread_affinity));
     pa_strbuf_printf(s, "allow-module-loading = %s\n", pa_yes_no(!c->disallow_module_loading));
     pa_strbuf_printf(s, "allow-exit = %s\n", pa_yes_no(!c->disallow_exit));
     pa_strbuf_printf(s, "use-pid-file = %s\n", pa_yes_no(c->use_pid_file));
@@ -763,6 +785,7 @@ char *pa_daemon_conf_dump(pa_daemon_conf *c) {
     pa_strbuf_printf(s, "log-meta = %s\n", pa_yes_no(c->log_meta));
     pa_strbuf_printf(s, "log-time = %s\n", pa_yes_no(c->log_time));
     pa_strbuf_printf(s, "log-backtrace = %u\n", c->log_backtrace);
+    pa_strbuf_printf(s, "trace-buffer-size = %u\n", c->trace_buffer_size);
 #ifdef HAVE_SYS_RESOURCE_H
     pa_strbuf_printf(s, "rlimit-fsize = %li\n", c->rlimit_fsize.is_set ? (long int) c->rlimit_fsize.value : -1);
     pa_strbuf_printf(s, "rlimit-data = %li\n", c->rlimit_data.is_set ? (long int) c->rlimit_data.value : -1);
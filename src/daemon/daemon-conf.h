@@ -30,6 +30,7 @@
 #include <pulsecore/macro.h>
 #include <pulsecore/core.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/cpu-set.h>
 
 #ifdef HAVE_SYS_RESOURCE_H
 #include <sys/resource.h>
@@ -87,6 +88,7 @@ typedef struct pa_daemon_conf {
     pa_log_target *log_target;
     pa_log_level_t log_level;
     unsigned log_backtrace;
+    unsigned trace_buffer_size;
     char *config_file;
 
 #ifdef HAVE_SYS_RESOURCE_H
@@ -133,6 +135,7 @@ typedef struct pa_daemon_conf {
     uint32_t alternate_sample_rate;
     pa_channel_map default_channel_map;
     size_t shm_size;
+    pa_cpu_set io_thread_affinity, main_thread_affinity;
 } pa_daemon_conf;
 
 /* Allocate a new structure and fill it with sane defaults */
@@ -86,6 +86,8 @@
 #include <pulsecore/shm.h>
 #include <pulsecore/memtrap.h>
 #include <pulsecore/strlist.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/trace.h>
 #ifdef HAVE_DBUS
 #include <pulsecore/dbus-shared.h>
 #endif
@@ -156,6 +158,12 @@ static void signal_callback(pa_mainloop_api*m, pa_signal_event *e, int sig, void
             char *c = pa_full_status_string(userdata);
             pa_log_notice("%s", c);
             pa_xfree(c);
+
+            if (pa_trace_get_size() > 0 && (c = pa_runtime_path("trace.json"))) {
+                if (pa_trace_dump(c) >= 0)
+                    pa_log_notice(_("Wrote IO thread trace to %s."), c);
+                pa_xfree(c);
+            }
             return;
         }
 #endif
@@ -512,6 +520,7 @@ int main(int argc, char *argv[]) {
     if (conf->log_time)
         pa_log_set_flags(PA_LOG_PRINT_TIME, PA_LOG_SET);
     pa_log_set_show_backtrace(conf->log_backtrace);
+    pa_trace_set_size(conf->trace_buffer_size);
 
 #ifdef HAVE_DBUS
     /* conf->system_instance and conf->local_server_type control almost the
@@ -1044,6 +1053,32 @@ int main(int argc, char *argv[]) {
     c->server_type = conf->local_server_type;
 #endif
 
+    c->io_thread_affinity = conf->io_thread_affinity;
+    c->main_thread_affinity = conf->main_thread_affinity;
+
+    /* Keep the main thread off the CPUs reserved for IO threads, unless
+     * the user told us explicitly where it should go */
+    if (pa_cpu_set_is_empty(&c->main_thread_affinity) && !pa_cpu_set_is_empty(&c->io_thread_affinity)) {
+        unsigned i, n = PA_MIN(pa_ncpus(), PA_CPU_SET_MAX);
+
+        for (i = 0; i < n; i++)
+            if (!pa_cpu_set_contains(&c->io_thread_affinity, i))
+                pa_cpu_set_add(&c->main_thread_affinity, i);
+
+        if (pa_cpu_set_is_empty(&c->main_thread_affinity))
+            pa_log_warn(_("IO threads are pinned to all CPUs, not confining the main thread."));
+    }
+
+    if (!pa_cpu_set_is_empty(&c->main_thread_affinity)) {
+        char t[PA_CPU_SET_SNPRINT_MAX];
+
+        if (pa_thread_set_affinity(pa_thread_self(), &c->main_thread_affinity) < 0) {
+            pa_log_warn(_("Failed to set CPU affinity of main thread: %s"), pa_cstrerror(errno));
+            pa_cpu_set_clear(&c->main_thread_affinity);
+        } else
+            pa_log_info(_("Main thread runs on CPUs %s."), pa_cpu_set_snprint(t, sizeof(t), &c->main_thread_affinity));
+    }
+
     c->cpu_info.cpu_type = PA_CPU_UNDEFINED;
     if (!getenv("PULSE_NO_SIMD")) {
         if (pa_cpu_init_x86(&(c->cpu_info.flags.x86)))
@@ -54,6 +54,7 @@
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/time-smoother.h>
+#include <pulsecore/trace.h>
 
 #include <modules/reserve-wrap.h>
 
@@ -138,6 +139,8 @@ struct userdata {
 
     pa_bool_t use_mmap:1, use_tsched:1, deferred_volume:1, fixed_latency_range:1;
 
+    pa_cpu_set thread_cpu_affinity;
+
     pa_bool_t first, after_rewind;
 
     pa_rtpoll_item *alsa_rtpoll_item;
@@ -431,6 +434,7 @@ static int try_recover(struct userdata *u, const char *call, int err) {
     pa_assert(err < 0);
 
     pa_log_debug("%s: %s", call, pa_alsa_strerror(err));
+    pa_trace_record(PA_TRACE_XRUN, err);
 
     pa_assert(err != -EAGAIN);
 
@@ -661,6 +665,7 @@ static int mmap_write(struct userdata *u, pa_usec_t *sleep_usec, pa_bool_t polle
 
             u->write_count += written;
             u->since_start += written;
+            pa_trace_record(PA_TRACE_WRITE, (int64_t) written);
 
 #ifdef DEBUG_TIMING
             pa_log_debug("Wrote %lu bytes (of possible %lu bytes)", (unsigned long) written, (unsigned long) n_bytes);
@@ -817,6 +822,7 @@ static int unix_write(struct userdata *u, pa_usec_t *sleep_usec, pa_bool_t polle
 
             u->write_count += written;
             u->since_start += written;
+            pa_trace_record(PA_TRACE_WRITE, (int64_t) written);
 
 /*         pa_log_debug("wrote %lu frames", (unsigned long) frames); */
 
@@ -1708,6 +1714,8 @@ static void thread_func(void *userdata) {
     if (u->core->realtime_scheduling)
         pa_make_realtime(u->core->realtime_priority);
 
+    pa_core_set_io_thread_affinity(u->core, &u->thread_cpu_affinity);
+
     pa_thread_mq_install(&u->thread_mq);
 
     for (;;) {
@@ -2029,6 +2037,8 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
     snd_pcm_uframes_t period_frames, buffer_frames, tsched_frames;
     size_t frame_size;
     pa_bool_t use_mmap = TRUE, b, use_tsched = TRUE, d, ignore_dB = FALSE, namereg_fail = FALSE, deferred_volume = FALSE, set_formats = FALSE, fixed_latency_range = FALSE;
+    pa_cpu_set thread_cpu_affinity;
+    const char *affinity;
     pa_sink_new_data data;
     pa_alsa_profile_set *profile_set = NULL;
     void *state = NULL;
@@ -2104,6 +2114,13 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
         goto fail;
     }
 
+    pa_cpu_set_clear(&thread_cpu_affinity);
+    if ((affinity = pa_modargs_get_value(ma, "thread_cpu_affinity", NULL)) &&
+        pa_cpu_set_parse(&thread_cpu_affinity, affinity) < 0) {
+        pa_log("Failed to parse thread_cpu_affinity argument.");
+        goto fail;
+    }
+
     use_tsched = pa_alsa_may_tsched(use_tsched);
 
     u = pa_xnew0(struct userdata, 1);
@@ -2113,6 +2130,7 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
     u->use_tsched = use_tsched;
     u->deferred_volume = deferred_volume;
     u->fixed_latency_range = fixed_latency_range;
+    u->thread_cpu_affinity = thread_cpu_affinity;
     u->first = TRUE;
     u->rewind_safeguard = rewind_safeguard;
     u->rtpoll = pa_rtpoll_new();
@@ -49,6 +49,7 @@
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/time-smoother.h>
+#include <pulsecore/trace.h>
 
 #include <modules/reserve-wrap.h>
 
@@ -125,6 +126,8 @@ struct userdata {
 
     pa_bool_t use_mmap:1, use_tsched:1, deferred_volume:1, fixed_latency_range:1;
 
+    pa_cpu_set thread_cpu_affinity;
+
     pa_bool_t first;
 
     pa_rtpoll_item *alsa_rtpoll_item;
@@ -406,6 +409,7 @@ static int try_recover(struct userdata *u, const char *call, int err) {
     pa_assert(err < 0);
 
     pa_log_debug("%s: %s", call, pa_alsa_strerror(err));
+    pa_trace_record(PA_TRACE_XRUN, err);
 
     pa_assert(err != -EAGAIN);
 
@@ -613,6 +617,7 @@ static int mmap_read(struct userdata *u, pa_usec_t *sleep_usec, pa_bool_t polled
             work_done = TRUE;
 
             u->read_count += frames * u->frame_size;
+            pa_trace_record(PA_TRACE_READ, (int64_t) (frames * u->frame_size));
 
 #ifdef DEBUG_TIMING
             pa_log_debug("Read %lu bytes (of possible %lu bytes)", (unsigned long) (frames * u->frame_size), (unsigned long) n_bytes);
@@ -745,6 +750,7 @@ static int unix_read(struct userdata *u, pa_usec_t *sleep_usec, pa_bool_t polled
             work_done = TRUE;
 
             u->read_count += frames * u->frame_size;
+            pa_trace_record(PA_TRACE_READ, (int64_t) (frames * u->frame_size));
 
 /*             pa_log_debug("read %lu frames", (unsigned long) frames); */
 
@@ -1448,6 +1454,8 @@ static void thread_func(void *userdata) {
     if (u->core->realtime_scheduling)
         pa_make_realtime(u->core->realtime_priority);
 
+    pa_core_set_io_thread_affinity(u->core, &u->thread_cpu_affinity);
+
     pa_thread_mq_install(&u->thread_mq);
 
     for (;;) {
@@ -1739,6 +1747,8 @@ pa_source *pa_alsa_source_new(pa_module *m, pa_modargs *ma, const char*driver, p
     snd_pcm_uframes_t period_frames, buffer_frames, tsched_frames;
     size_t frame_size;
     pa_bool_t use_mmap = TRUE, b, use_tsched = TRUE, d, ignore_dB = FALSE, namereg_fail = FALSE, deferred_volume = FALSE, fixed_latency_range = FALSE;
+    pa_cpu_set thread_cpu_affinity;
+    const char *affinity;
     pa_source_new_data data;
     pa_alsa_profile_set *profile_set = NULL;
     void *state = NULL;
@@ -1808,6 +1818,13 @@ pa_source *pa_alsa_source_new(pa_module *m, pa_modargs *ma, const char*driver, p
         goto fail;
     }
 
+    pa_cpu_set_clear(&thread_cpu_affinity);
+    if ((affinity = pa_modargs_get_value(ma, "thread_cpu_affinity", NULL)) &&
+        pa_cpu_set_parse(&thread_cpu_affinity, affinity) < 0) {
+        pa_log("Failed to parse thread_cpu_affinity argument.");
+        goto fail;
+    }
+
     use_tsched = pa_alsa_may_tsched(use_tsched);
 
     u = pa_xnew0(struct userdata, 1);
@@ -1817,6 +1834,7 @@ pa_source *pa_alsa_source_new(pa_module *m, pa_modargs *ma, const char*driver, p
     u->use_tsched = use_tsched;
     u->deferred_volume = deferred_volume;
     u->fixed_latency_range = fixed_latency_range;
+    u->thread_cpu_affinity = thread_cpu_affinity;
     u->first = TRUE;
     u->rtpoll = pa_rtpoll_new();
     pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll);
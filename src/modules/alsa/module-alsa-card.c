@@ -71,6 +71,7 @@ PA_MODULE_USAGE(
         "profile_set=<profile set configuration file> "
         "paths_dir=<directory containing the path configuration files> "
         "use_ucm=<load use case manager> "
+        "thread_cpu_affinity=<list of CPUs to run the IO threads on> "
 );
 
 static const char* const valid_modargs[] = {
@@ -98,6 +99,7 @@ static const char* const valid_modargs[] = {
     "profile_set",
     "paths_dir",
     "use_ucm",
+    "thread_cpu_affinity",
     NULL
 };
 
@@ -224,6 +224,8 @@ static void thread_func(void *userdata) {
     if (u->core->realtime_scheduling)
         pa_make_realtime(u->core->realtime_priority);
 
+    pa_core_set_io_thread_affinity(u->core, NULL);
+
     pa_thread_mq_install(&u->thread_mq);
 
     for (;;) {
@@ -667,6 +667,8 @@ static void thread_func(void *userdata) {
     if (u->module->core->realtime_scheduling)
         pa_make_realtime(u->module->core->realtime_priority);
 
+    pa_core_set_io_thread_affinity(u->module->core, NULL);
+
     pa_thread_mq_install(&u->thread_mq);
 
     for (;;) {
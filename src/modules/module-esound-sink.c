@@ -206,6 +206,8 @@ static void thread_func(void *userdata) {
 
     pa_log_debug("Thread starting up");
 
+    pa_core_set_io_thread_affinity(u->core, NULL);
+
     pa_thread_mq_install(&u->thread_mq);
 
     pa_smoother_set_time_offset(u->smoother, pa_rtclock_now());
@@ -35,6 +35,8 @@
 #include <pulsecore/sink.h>
 #include <pulsecore/modargs.h>
 #include <pulsecore/log.h>
+#include <pulsecore/llist.h>
+#include <pulsecore/shared.h>
 #include <pulsecore/thread.h>
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/rtpoll.h>
@@ -52,10 +54,15 @@ PA_MODULE_USAGE(_("sink_name=<name of sink>"));
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 
+/* How often the latency of all streams of a connection is queried */
+#define TIMING_INTERVAL (1*PA_USEC_PER_SEC)
+
 /* libpulse callbacks */
 static void stream_state_callback(pa_stream *stream, void *userdata);
 static void context_state_callback(pa_context *c, void *userdata);
 
+struct tunnel_connection;
+
 struct userdata {
     pa_module *module;
 
@@ -72,11 +79,36 @@ struct userdata {
     pa_usec_t block_usec;
     pa_usec_t timestamp;
 
-    // libpulse context
-    pa_context *context;
+    // libpulse context, shared with the other tunnels to the server
+    struct tunnel_connection *connection;
+    PA_LLIST_FIELDS(struct userdata);
     pa_stream *stream;
 
-    bool connected;
+    /* Bytes the IO thread was asked to render, but that weren't
+     * written to the stream yet */
+    size_t pending_bytes;
+
+    /* Only accessed from the IO thread */
+    struct {
+        size_t requested_bytes;
+        pa_usec_t latency;
+        pa_usec_t latency_timestamp;
+        size_t rendered_bytes;
+    } thread_info;
+};
+
+/* All tunnels to the same server share one context, and with it one
+ * connection, one authentication and one timer for the timing
+ * queries. Only accessed from the main thread. */
+struct tunnel_connection {
+    unsigned n_ref;
+    pa_core *core;
+    char *name;
+
+    pa_context *context;
+    pa_time_event *timing_event;
+
+    PA_LLIST_HEAD(struct userdata, tunnels);
 };
 
 static const char* const valid_modargs[] = {
@@ -87,10 +119,30 @@ static const char* const valid_modargs[] = {
 };
 
 enum {
-    SINK_MESSAGE_PASS_SOCKET = PA_SINK_MESSAGE_MAX,
-    SINK_MESSAGE_RIP_SOCKET
+    SINK_MESSAGE_REQUEST = PA_SINK_MESSAGE_MAX,
+    SINK_MESSAGE_UPDATE_LATENCY,
+    SINK_MESSAGE_POST
 };
 
+/* Called from IO thread context */
+static void send_data(struct userdata *u) {
+    pa_assert(u);
+
+    while (u->thread_info.requested_bytes > 0) {
+        pa_memchunk memchunk;
+
+        pa_sink_render(u->sink, u->thread_info.requested_bytes, &memchunk);
+
+        /* libpulse isn't thread safe, so the stream is written to
+         * from the main thread */
+        pa_asyncmsgq_post(u->thread_mq.outq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_POST, NULL, 0, &memchunk, NULL);
+        pa_memblock_unref(memchunk.memblock);
+
+        u->thread_info.requested_bytes -= PA_MIN(memchunk.length, u->thread_info.requested_bytes);
+        u->thread_info.rendered_bytes += memchunk.length;
+    }
+}
+
 static void thread_func(void *userdata) {
     struct userdata *u = userdata;
 
@@ -98,6 +150,8 @@ static void thread_func(void *userdata) {
 
     pa_log_debug("Tunnelstream: Thread starting up");
 
+    pa_core_set_io_thread_affinity(u->module->core, NULL);
+
     pa_thread_mq_install(&u->thread_mq);
 
     u->timestamp = pa_rtclock_now();
@@ -105,53 +159,10 @@ static void thread_func(void *userdata) {
     for(;;)
     {
         int ret;
-        const void *p;
-        pa_usec_t now = 0;
-
-        size_t writeable = 0;
 
         if (PA_UNLIKELY(u->sink->thread_info.rewind_requested))
             pa_sink_process_rewind(u->sink, 0);
 
-        if (PA_SINK_IS_OPENED(u->sink->thread_info.state))
-            now = pa_rtclock_now();
-
-        if (u->connected &&
-                PA_STREAM_IS_GOOD(pa_stream_get_state(u->stream)) &&
-                PA_SINK_IS_OPENED(u->sink->thread_info.state)) {
-            /* TODO: use IS_RUNNING + cork stream */
-
-            if (pa_stream_is_corked(u->stream)) {
-                pa_stream_cork(u->stream, 0, NULL, NULL);
-            } else {
-                writeable = pa_stream_writable_size(u->stream);
-                if (writeable > 0) {
-                    if (u->memchunk.length <= 0)
-                        pa_sink_render(u->sink, writeable, &u->memchunk);
-
-                    pa_assert(u->memchunk.length > 0);
-
-
-                    /* we have new data to write */
-                    p = (const uint8_t *) pa_memblock_acquire(u->memchunk.memblock);
-                    ret = pa_stream_write(u->stream,
-                                        ((uint8_t*) p + u->memchunk.index),         /**< The data to write */
-                                        u->memchunk.length,            /**< The length of the data to write in bytes */
-                                        NULL,     /**< A cleanup routine for the data or NULL to request an internal copy */
-                                        0,          /**< Offset for seeking, must be 0 for upload streams */
-                                        PA_SEEK_RELATIVE      /**< Seek mode, must be PA_SEEK_RELATIVE for upload streams */
-                                        );
-                    pa_memblock_release(u->memchunk.memblock);
-                    pa_memblock_unref(u->memchunk.memblock);
-                    pa_memchunk_reset(&u->memchunk);
-
-                    if (ret != 0) {
-                        /* TODO: we should consider a state change or is that already done ? */
-                        pa_log_warn("Could not write data into the stream ... ret = %i", ret);
-                    }
-                }
-            }
-        }
         if ((ret = pa_rtpoll_run(u->rtpoll, TRUE)) < 0)
             goto fail;
 
@@ -169,6 +180,54 @@ finish:
     pa_log_debug("Thread shutting down");
 }
 
+/* Called from main context */
+static void stream_write_callback(pa_stream *stream, size_t nbytes, void *userdata) {
+    struct userdata *u = userdata;
+
+    pa_assert(u);
+    pa_assert(stream == u->stream);
+
+    /* nbytes is everything the server wants, including what the IO
+     * thread is still rendering */
+    if (nbytes <= u->pending_bytes)
+        return;
+
+    nbytes -= u->pending_bytes;
+    u->pending_bytes += nbytes;
+
+    pa_asyncmsgq_post(u->sink->asyncmsgq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_REQUEST, NULL, (int64_t) nbytes, NULL, NULL);
+}
+
+/* Called from main context */
+static void stream_timing_callback(pa_stream *stream, int success, void *userdata) {
+    struct userdata *u = userdata;
+    pa_usec_t latency;
+    int negative;
+
+    pa_assert(u);
+
+    if (!success || stream != u->stream)
+        return;
+
+    if (pa_stream_get_latency(stream, &latency, &negative) < 0)
+        return;
+
+    pa_asyncmsgq_post(u->sink->asyncmsgq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_UPDATE_LATENCY, NULL, negative ? 0 : (int64_t) latency, NULL, NULL);
+}
+
+/* Called from main context */
+static void stream_update_timing(struct userdata *u) {
+    pa_operation *o;
+
+    pa_assert(u);
+
+    if (!u->stream || pa_stream_get_state(u->stream) != PA_STREAM_READY)
+        return;
+
+    if ((o = pa_stream_update_timing_info(u->stream, stream_timing_callback, u)))
+        pa_operation_unref(o);
+}
+
 static void stream_state_callback(pa_stream *stream, void *userdata) {
     struct userdata *u = userdata;
 
@@ -176,14 +235,22 @@ static void stream_state_callback(pa_stream *stream, void *userdata) {
     pa_assert(stream == u->stream);
 
     switch(pa_stream_get_state(stream)) {
+        case PA_STREAM_READY:
+            pa_log_debug("Stream ready.");
+
+            if (PA_SINK_IS_OPENED(pa_sink_get_state(u->sink)))
+                pa_operation_unref(pa_stream_cork(stream, 0, NULL, NULL));
+
+            stream_update_timing(u);
+            break;
         case PA_STREAM_FAILED:
-            pa_log_debug("Context failed.");
+            pa_log_debug("Stream failed.");
             pa_stream_unref(stream);
             u->stream = NULL;
             /* TODO: think about killing the context or should we just try again a creationg of a stream ? */
             break;
         case PA_STREAM_TERMINATED:
-            pa_log_debug("Context terminated.");
+            pa_log_debug("Stream terminated.");
             pa_stream_unref(stream);
             u->stream = NULL;
             break;
@@ -192,116 +259,354 @@ static void stream_state_callback(pa_stream *stream, void *userdata) {
     }
 }
 
-static void context_state_callback(pa_context *c, void *userdata) {
-    struct userdata *u = userdata;
+/* Called from main context */
+static void stream_create(struct userdata *u) {
+    pa_proplist *proplist;
+    pa_buffer_attr bufferattr;
 
     pa_assert(u);
-    pa_assert(u->context == c);
+    pa_assert(!u->stream);
+
+    proplist = pa_proplist_new();
+    pa_assert(proplist);
+
+    u->stream = pa_stream_new_with_proplist(u->connection->context,
+                                            u->sink->name,
+                                            &u->sink->sample_spec,
+                                            &u->sink->channel_map,
+                                            proplist);
+
+    pa_proplist_free(proplist);
+
+    memset(&bufferattr, 0, sizeof(pa_buffer_attr));
+
+    bufferattr.maxlength = (uint32_t) - 1;
+    bufferattr.minreq = (uint32_t) - 1;
+    bufferattr.prebuf = (uint32_t) - 1;
+    bufferattr.tlength = (uint32_t) - 1;
+
+    u->pending_bytes = 0;
+
+    pa_stream_set_state_callback(u->stream, stream_state_callback, u);
+    pa_stream_set_write_callback(u->stream, stream_write_callback, u);
+
+    /* No automatic timing updates, the connection asks for all
+     * streams at once */
+    pa_stream_connect_playback(u->stream,
+                               NULL,
+                               &bufferattr,
+                               PA_STREAM_START_CORKED,
+                               NULL,
+                               NULL);
+}
+
+/* Called from main context */
+static void stream_free(struct userdata *u) {
+    pa_assert(u);
+
+    if (!u->stream)
+        return;
+
+    pa_stream_set_state_callback(u->stream, NULL, NULL);
+    pa_stream_set_write_callback(u->stream, NULL, NULL);
+    pa_stream_disconnect(u->stream);
+    pa_stream_unref(u->stream);
+    u->stream = NULL;
+}
+
+static void timing_event_cb(pa_mainloop_api *m, pa_time_event *e, const struct timeval *t, void *userdata) {
+    struct tunnel_connection *c = userdata;
+    struct userdata *u;
+
+    pa_assert(c);
+
+    /* All queries go out in one go and share the trip over the
+     * network */
+    PA_LLIST_FOREACH(u, c->tunnels)
+        stream_update_timing(u);
+
+    pa_core_rttime_restart(c->core, e, pa_rtclock_now() + TIMING_INTERVAL);
+}
+
+static void context_state_callback(pa_context *context, void *userdata) {
+    struct tunnel_connection *c = userdata;
+    struct userdata *u;
+
+    pa_assert(c);
+    pa_assert(c->context == context);
 
-    switch(pa_context_get_state(c)) {
+    switch(pa_context_get_state(context)) {
         case PA_CONTEXT_UNCONNECTED:
         case PA_CONTEXT_CONNECTING:
         case PA_CONTEXT_AUTHORIZING:
         case PA_CONTEXT_SETTING_NAME:
             pa_log_debug("Connection unconnected");
             break;
-        case PA_CONTEXT_READY: {
-            pa_proplist *proplist;
-            pa_buffer_attr bufferattr;
+        case PA_CONTEXT_READY:
+            pa_log_debug("Connection successful. Creating streams.");
 
-            pa_log_debug("Connection successful. Creating stream.");
-            pa_assert(!u->stream);
+            PA_LLIST_FOREACH(u, c->tunnels)
+                stream_create(u);
 
-            proplist = pa_proplist_new();
-            pa_assert(proplist);
+            pa_assert(!c->timing_event);
+            c->timing_event = pa_core_rttime_new(c->core, pa_rtclock_now() + TIMING_INTERVAL, timing_event_cb, c);
+            break;
+        case PA_CONTEXT_FAILED:
+        case PA_CONTEXT_TERMINATED:
+            pa_log_debug("Context failed or terminated.");
 
+            /* Everybody loses their stream */
+            PA_LLIST_FOREACH(u, c->tunnels) {
+                stream_free(u);
+                pa_module_unload_request(u->module, TRUE);
+            }
 
-            u->stream = pa_stream_new_with_proplist(u->context,
-                                                    "mod-tunnelstream",
-                                                    &u->sink->sample_spec,
-                                                    &u->sink->channel_map,
-                                                    proplist);
+            if (c->timing_event) {
+                c->core->mainloop->time_free(c->timing_event);
+                c->timing_event = NULL;
+            }
 
-            pa_proplist_free(proplist);
+            pa_context_unref(c->context);
+            c->context = NULL;
+            break;
+        default:
+            break;
+    }
+}
 
+/* Called from main context */
+static struct tunnel_connection *tunnel_connection_get(pa_core *core, const char *server) {
+    struct tunnel_connection *c;
+    pa_proplist *proplist;
+    char *t;
 
-            memset(&bufferattr, 0, sizeof(pa_buffer_attr));
+    pa_assert(core);
+    pa_assert(server);
 
-            bufferattr.maxlength = (uint32_t) - 1;
-            bufferattr.minreq = (uint32_t) - 1;
-            bufferattr.prebuf = (uint32_t) - 1;
-            bufferattr.tlength = (uint32_t) - 1;
+    t = pa_sprintf_malloc("tunnel-connection@%s", server);
 
-            pa_stream_set_state_callback(u->stream, stream_state_callback, userdata);
-            pa_stream_connect_playback(u->stream,
-                                       NULL,
-                                       &bufferattr,
-                                       PA_STREAM_START_CORKED | PA_STREAM_AUTO_TIMING_UPDATE,
-                                       NULL,
-                                       NULL);
+    if ((c = pa_shared_get(core, t))) {
+        pa_xfree(t);
 
-            pa_asyncmsgq_post(u->thread_mq.inq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_PASS_SOCKET, NULL, 0, NULL, NULL);
-            break;
-        }
-        case PA_CONTEXT_FAILED:
-            pa_log_debug("Context failed.");
-            pa_context_unref(u->context);
-            u->context = NULL;
-            u->connected = false;
-            break;
+        /* A connection that failed stays dead */
+        if (!c->context)
+            return NULL;
 
-        case PA_CONTEXT_TERMINATED:
-            pa_log_debug("Context terminated.");
-            pa_context_unref(u->context);
-            u->context = NULL;
-            u->connected = false;
-            break;
-        default:
-            break;
+        c->n_ref++;
+        return c;
     }
+
+    c = pa_xnew0(struct tunnel_connection, 1);
+    c->n_ref = 1;
+    c->core = core;
+    c->name = t;
+    PA_LLIST_HEAD_INIT(struct userdata, c->tunnels);
+
+    /* TODO: think about volume stuff remote<--stream--source */
+    proplist = pa_proplist_new();
+    pa_proplist_sets(proplist, PA_PROP_APPLICATION_NAME, _("PulseAudio mod-tunnelstream"));
+    pa_proplist_sets(proplist, PA_PROP_APPLICATION_ID, "mod-tunnelstream");
+    pa_proplist_sets(proplist, PA_PROP_APPLICATION_ICON_NAME, "audio-card");
+    pa_proplist_sets(proplist, PA_PROP_APPLICATION_VERSION, PACKAGE_VERSION);
+
+    /* init libpulse */
+    c->context = pa_context_new_with_proplist(core->mainloop, "tunnelstream", proplist);
+    pa_proplist_free(proplist);
+
+    if (!c->context) {
+        pa_log("Failed to create libpulse context");
+        goto fail;
+    }
+
+    pa_context_set_state_callback(c->context, context_state_callback, c);
+    if (pa_context_connect(c->context,
+                          server,
+                          PA_CONTEXT_NOFAIL | PA_CONTEXT_NOAUTOSPAWN,
+                          NULL) < 0) {
+        pa_log("Failed to connect libpulse context");
+        goto fail;
+    }
+
+    pa_assert_se(pa_shared_set(core, c->name, c) >= 0);
+
+    return c;
+
+fail:
+    if (c->context) {
+        pa_context_set_state_callback(c->context, NULL, NULL);
+        pa_context_unref(c->context);
+    }
+
+    pa_xfree(c->name);
+    pa_xfree(c);
+
+    return NULL;
+}
+
+/* Called from main context */
+static void tunnel_connection_unref(struct tunnel_connection *c) {
+    pa_assert(c);
+    pa_assert(c->n_ref >= 1);
+
+    if (--c->n_ref > 0)
+        return;
+
+    pa_assert(!c->tunnels);
+    pa_assert_se(pa_shared_remove(c->core, c->name) >= 0);
+
+    if (c->timing_event)
+        c->core->mainloop->time_free(c->timing_event);
+
+    if (c->context) {
+        pa_context_set_state_callback(c->context, NULL, NULL);
+        pa_context_disconnect(c->context);
+        pa_context_unref(c->context);
+    }
+
+    pa_xfree(c->name);
+    pa_xfree(c);
 }
 
+/* Called from main context */
+static void tunnel_connection_attach(struct tunnel_connection *c, struct userdata *u) {
+    pa_assert(c);
+    pa_assert(u);
+
+    u->connection = c;
+    PA_LLIST_PREPEND(struct userdata, c->tunnels, u);
+
+    /* Otherwise the stream is created once the context is ready */
+    if (pa_context_get_state(c->context) == PA_CONTEXT_READY)
+        stream_create(u);
+}
+
+/* Called from main context */
+static void tunnel_connection_detach(struct userdata *u) {
+    pa_assert(u);
+    pa_assert(u->connection);
+
+    stream_free(u);
+    PA_LLIST_REMOVE(struct userdata, u->connection->tunnels, u);
+
+    tunnel_connection_unref(u->connection);
+    u->connection = NULL;
+}
+
+/* This function is called from IO context -- except when it is not. */
 static int sink_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
     struct userdata *u = PA_SINK(o)->userdata;
 
     switch (code) {
 
+        case PA_SINK_MESSAGE_SET_STATE: {
+            int r;
+
+            /* First, change the state, because otherwise pa_sink_render() would fail */
+            if ((r = pa_sink_process_msg(o, code, data, offset, chunk)) >= 0)
+                if (PA_SINK_IS_OPENED(u->sink->thread_info.state))
+                    send_data(u);
+
+            return r;
+        }
+
         case PA_SINK_MESSAGE_GET_LATENCY: {
-            int negative;
-            pa_usec_t remote_latency;
+            pa_usec_t latency, elapsed;
 
             if (!PA_SINK_IS_LINKED(u->sink->thread_info.state)) {
                 *((pa_usec_t*) data) = 0;
                 return 0;
             }
 
-            if(pa_stream_get_latency(u->stream, &remote_latency, &negative) < 0) {
-                *((pa_usec_t*) data) = 0;
-                return 0;
-            }
+            /* What was queued remotely at the last timing update,
+             * plus what we sent since, minus what was played since */
+            latency = u->thread_info.latency + pa_bytes_to_usec(u->thread_info.rendered_bytes, &u->sink->sample_spec);
+            elapsed = pa_rtclock_now() - u->thread_info.latency_timestamp;
 
-            *((pa_usec_t*) data) =
-                /* Add the latency from libpulse */
-                remote_latency;
-                /* do we have to add more latency here ? */
+            *((pa_usec_t*) data) = latency > elapsed ? latency - elapsed : 0;
             return 0;
         }
-        case SINK_MESSAGE_PASS_SOCKET: {
-            u->connected = true;
+
+        case SINK_MESSAGE_REQUEST:
+            pa_assert(offset > 0);
+            u->thread_info.requested_bytes += (size_t) offset;
+
+            if (PA_SINK_IS_OPENED(u->sink->thread_info.state))
+                send_data(u);
+
+            return 0;
+
+        case SINK_MESSAGE_UPDATE_LATENCY:
+            u->thread_info.latency = (pa_usec_t) offset;
+            u->thread_info.latency_timestamp = pa_rtclock_now();
+            u->thread_info.rendered_bytes = 0;
+            return 0;
+
+        case SINK_MESSAGE_POST:
+
+            /* This message is delivered to us from the main context
+             * -- NOT from the IO thread context where the rest of the
+             * messages are dispatched. */
+            pa_assert(chunk);
+
+            u->pending_bytes -= PA_MIN(chunk->length, u->pending_bytes);
+
+            if (u->stream && pa_stream_get_state(u->stream) == PA_STREAM_READY) {
+                const void *p;
+                int ret;
+
+                p = (const uint8_t *) pa_memblock_acquire(chunk->memblock) + chunk->index;
+                ret = pa_stream_write(u->stream, p, chunk->length, NULL, 0, PA_SEEK_RELATIVE);
+                pa_memblock_release(chunk->memblock);
+
+                if (ret != 0)
+                    pa_log_warn("Could not write data into the stream ... ret = %i", ret);
+            }
+
             return 0;
-        }
     }
     return pa_sink_process_msg(o, code, data, offset, chunk);
 }
 
+/* Called from main context */
+static int sink_set_state_cb(pa_sink *s, pa_sink_state_t state) {
+    struct userdata *u;
+
+    pa_sink_assert_ref(s);
+    pa_assert_se(u = s->userdata);
+
+    if (!u->stream || pa_stream_get_state(u->stream) != PA_STREAM_READY)
+        return 0;
+
+    switch ((pa_sink_state_t) state) {
+
+        case PA_SINK_SUSPENDED:
+            pa_assert(PA_SINK_IS_OPENED(s->state));
+            pa_operation_unref(pa_stream_cork(u->stream, 1, NULL, NULL));
+            break;
+
+        case PA_SINK_IDLE:
+        case PA_SINK_RUNNING:
+            if (s->state == PA_SINK_SUSPENDED)
+                pa_operation_unref(pa_stream_cork(u->stream, 0, NULL, NULL));
+            break;
+
+        case PA_SINK_UNLINKED:
+        case PA_SINK_INIT:
+        case PA_SINK_INVALID_STATE:
+            ;
+    }
+
+    return 0;
+}
+
 int pa__init(pa_module*m) {
     struct userdata *u = NULL;
     pa_modargs *ma = NULL;
     pa_sink_new_data sink_data;
     pa_sample_spec ss;
     pa_channel_map map;
-    pa_proplist *proplist = NULL;
     const char *remote_server = NULL;
+    struct tunnel_connection *connection;
 
     pa_assert(m);
 
@@ -360,6 +665,7 @@ int pa__init(pa_module*m) {
 
     /* callbacks */
     u->sink->parent.process_msg = sink_process_msg_cb;
+    u->sink->set_state = sink_set_state_cb;
 
 
     /* set thread queue */
@@ -374,31 +680,10 @@ int pa__init(pa_module*m) {
     pa_sink_set_max_request(u->sink, nbytes);
     pa_sink_set_latency_range(u->sink, 0, BLOCK_USEC); */
 
-    /* TODO: think about volume stuff remote<--stream--source */
-    proplist = pa_proplist_new();
-    pa_proplist_sets(proplist, PA_PROP_APPLICATION_NAME, _("PulseAudio mod-tunnelstream"));
-    pa_proplist_sets(proplist, PA_PROP_APPLICATION_ID, "mod-tunnelstream");
-    pa_proplist_sets(proplist, PA_PROP_APPLICATION_ICON_NAME, "audio-card");
-    pa_proplist_sets(proplist, PA_PROP_APPLICATION_VERSION, PACKAGE_VERSION);
-
-    /* init libpulse */
-    if (!(u->context = pa_context_new_with_proplist(m->core->mainloop,
-                                              "tunnelstream",
-                                              proplist))) {
-        pa_log("Failed to create libpulse context");
+    if (!(connection = tunnel_connection_get(m->core, remote_server)))
         goto fail;
-    }
-
-    pa_proplist_free(proplist);
 
-    pa_context_set_state_callback(u->context, context_state_callback, u);
-    if (pa_context_connect(u->context,
-                          remote_server,
-                          PA_CONTEXT_NOFAIL | PA_CONTEXT_NOAUTOSPAWN,
-                          NULL) < 0) {
-        pa_log("Failed to connect libpulse context");
-        goto fail;
-    }
+    tunnel_connection_attach(connection, u);
 
     if (!(u->thread = pa_thread_new("tunnelstream-sink", thread_func, u))) {
         pa_log("Failed to create thread.");
@@ -414,9 +699,6 @@ fail:
     if (ma)
         pa_modargs_free(ma);
 
-    if (proplist)
-        pa_proplist_free(proplist);
-
     pa__done(m);
 
     return -1;
@@ -438,13 +720,10 @@ void pa__done(pa_module*m) {
         pa_thread_free(u->thread);
     }
 
-    pa_thread_mq_done(&u->thread_mq);
-
-    if (u->stream)
-        pa_stream_disconnect(u->stream);
+    if (u->connection)
+        tunnel_connection_detach(u);
 
-    if (u->context)
-        pa_context_disconnect(u->context);
+    pa_thread_mq_done(&u->thread_mq);
 
     if (u->rtpoll)
         pa_rtpoll_free(u->rtpoll);
@@ -54,6 +54,7 @@
 #include <pulsecore/proplist-util.h>
 #include <pulsecore/auth-cookie.h>
 #include <pulsecore/mcalign.h>
+#include <pulsecore/codec.h>
 
 #ifdef TUNNEL_SINK
 #include "module-tunnel-sink-symdef.h"
@@ -72,7 +73,11 @@ PA_MODULE_USAGE(
         "format=<sample format> "
         "channels=<number of channels> "
         "rate=<sample rate> "
-        "channel_map=<channel map>");
+        "channel_map=<channel map> "
+        "compression=<none, pcm-lossless or opus> "
+        "compression_quality=<0 to 10> "
+        "adaptive=<adapt the remote buffer to the network?> "
+        "on_demand=<connect only when the sink is used?>");
 #else
 PA_MODULE_DESCRIPTION("Tunnel module for sources");
 PA_MODULE_USAGE(
@@ -84,7 +89,10 @@ PA_MODULE_USAGE(
         "format=<sample format> "
         "channels=<number of channels> "
         "rate=<sample rate> "
-        "channel_map=<channel map>");
+        "channel_map=<channel map> "
+        "compression=<none, pcm-lossless or opus> "
+        "compression_quality=<0 to 10> "
+        "on_demand=<connect only when the source is used?>");
 #endif
 
 PA_MODULE_AUTHOR("Lennart Poettering");
@@ -101,18 +109,24 @@ static const char* const valid_modargs[] = {
     "sink_name",
     "sink_properties",
     "sink",
+    "adaptive",
 #else
     "source_name",
     "source_properties",
     "source",
 #endif
     "channel_map",
+    "compression",
+    "compression_quality",
+    "on_demand",
     NULL,
 };
 
 #define DEFAULT_TIMEOUT 5
 
 #define LATENCY_INTERVAL (10*PA_USEC_PER_SEC)
+#define ADAPTIVE_LATENCY_INTERVAL (1*PA_USEC_PER_SEC)
+#define STATS_INTERVAL (5*PA_USEC_PER_SEC)
 
 #define MIN_NETWORK_LATENCY_USEC (8*PA_USEC_PER_MSEC)
 
@@ -128,6 +142,13 @@ enum {
 #define DEFAULT_TLENGTH_MSEC 150
 #define DEFAULT_MINREQ_MSEC 25
 
+/* Limits for the adaptive mode */
+#define MIN_TLENGTH_USEC (40*PA_USEC_PER_MSEC)
+#define MAX_TLENGTH_USEC (2*PA_USEC_PER_SEC)
+#define UNDERRUN_BOOST_USEC (50*PA_USEC_PER_MSEC)
+#define UNDERRUN_BOOST_DECAY (300*PA_USEC_PER_SEC)
+#define SHRINK_HOLDOFF (30*PA_USEC_PER_SEC)
+
 #else
 
 enum {
@@ -151,6 +172,7 @@ static void command_suspended(pa_pdispatch *pd, uint32_t command, uint32_t tag,
 static void command_moved(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_stream_or_client_event(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_stream_buffer_attr_changed(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+static void command_enable_srbchannel(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 
 static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
 #ifdef TUNNEL_SINK
@@ -170,7 +192,8 @@ static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
     [PA_COMMAND_RECORD_STREAM_EVENT] = command_stream_or_client_event,
     [PA_COMMAND_CLIENT_EVENT] = command_stream_or_client_event,
     [PA_COMMAND_PLAYBACK_BUFFER_ATTR_CHANGED] = command_stream_buffer_attr_changed,
-    [PA_COMMAND_RECORD_BUFFER_ATTR_CHANGED] = command_stream_buffer_attr_changed
+    [PA_COMMAND_RECORD_BUFFER_ATTR_CHANGED] = command_stream_buffer_attr_changed,
+    [PA_COMMAND_ENABLE_SRBCHANNEL] = command_enable_srbchannel
 };
 
 struct userdata {
@@ -185,6 +208,9 @@ struct userdata {
     pa_pstream *pstream;
     pa_pdispatch *pdispatch;
 
+    /* We haven't connected yet, and won't before the device is used */
+    pa_bool_t on_demand;
+
     char *server_name;
 #ifdef TUNNEL_SINK
     char *sink_name;
@@ -229,9 +255,32 @@ struct userdata {
 #else
     uint32_t fragsize;
 #endif
+
+    pa_encoding_t compression;
+    uint32_t compression_quality;
+
+    /* Network statistics from the latency requests */
+    pa_bool_t have_rtt;
+    pa_usec_t rtt, rtt_jitter;
+    pa_usec_t last_stats_update;
+
+#ifdef TUNNEL_SINK
+    uint64_t n_underruns;
+
+    /* Adaptive mode: the remote buffer follows the network */
+    pa_bool_t adaptive;
+    pa_bool_t buffer_attr_pending;
+    pa_usec_t underrun_boost;
+    pa_usec_t last_underrun;
+    pa_usec_t last_buffer_attr_change;
+#endif
 };
 
 static void request_latency(struct userdata *u);
+static int connect_server(struct userdata *u);
+#ifdef TUNNEL_SINK
+static void adapt_buffer_attr(struct userdata *u);
+#endif
 
 /* Called from main context */
 static void command_stream_or_client_event(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
@@ -261,6 +310,29 @@ static void command_overflow_or_underflow(pa_pdispatch *pd,  uint32_t command,
     pa_assert(u->pdispatch == pd);
 
     pa_log_info("Server signalled buffer overrun/underrun.");
+
+#ifdef TUNNEL_SINK
+    if (command == PA_COMMAND_UNDERFLOW) {
+        pa_usec_t now = pa_rtclock_now();
+
+        u->n_underruns++;
+
+        /* The network was worse than we measured, so keep more
+         * buffered for a while */
+        if (u->adaptive) {
+            if (u->last_underrun + UNDERRUN_BOOST_DECAY > now)
+                u->underrun_boost -= u->underrun_boost * (now - u->last_underrun) / UNDERRUN_BOOST_DECAY;
+            else
+                u->underrun_boost = 0;
+
+            u->underrun_boost += UNDERRUN_BOOST_USEC;
+            u->last_underrun = now;
+
+            adapt_buffer_attr(u);
+        }
+    }
+#endif
+
     request_latency(u);
 }
 
@@ -328,6 +400,17 @@ static void command_moved(pa_pdispatch *pd,  uint32_t command,  uint32_t tag, pa
     request_latency(u);
 }
 
+/* We don't do SHM, so we shouldn't be offered this anyway */
+static void command_enable_srbchannel(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    struct userdata *u = userdata;
+
+    pa_assert(pd);
+    pa_assert(u);
+    pa_assert(u->pdispatch == pd);
+
+    pa_pstream_send_error(u->pstream, tag, PA_ERR_NOTSUPPORTED);
+}
+
 static void command_stream_buffer_attr_changed(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     struct userdata *u = userdata;
     uint32_t channel, maxlength, tlength = 0, fragsize, prebuf, minreq;
@@ -432,6 +515,10 @@ static void stream_cork(struct userdata *u, pa_bool_t cork) {
     if (!u->pstream)
         return;
 
+#ifdef TUNNEL_SINK
+    pa_pstream_flush_encoder(u->pstream, u->channel);
+#endif
+
     t = pa_tagstruct_new(NULL, 0);
 #ifdef TUNNEL_SINK
     pa_tagstruct_putu32(t, PA_COMMAND_CORK_PLAYBACK_STREAM);
@@ -563,6 +650,15 @@ static int sink_set_state(pa_sink *s, pa_sink_state_t state) {
     pa_sink_assert_ref(s);
     u = s->userdata;
 
+    if (state == PA_SINK_RUNNING && u->on_demand) {
+        pa_log_debug("Sink is used for the first time, connecting.");
+
+        if (connect_server(u) < 0)
+            return -1;
+
+        u->on_demand = FALSE;
+    }
+
     switch ((pa_sink_state_t) state) {
 
         case PA_SINK_SUSPENDED:
@@ -659,6 +755,15 @@ static int source_set_state(pa_source *s, pa_source_state_t state) {
     pa_source_assert_ref(s);
     u = s->userdata;
 
+    if (state == PA_SOURCE_RUNNING && u->on_demand) {
+        pa_log_debug("Source is used for the first time, connecting.");
+
+        if (connect_server(u) < 0)
+            return -1;
+
+        u->on_demand = FALSE;
+    }
+
     switch ((pa_source_state_t) state) {
 
         case PA_SOURCE_SUSPENDED:
@@ -690,6 +795,8 @@ static void thread_func(void *userdata) {
 
     pa_log_debug("Thread starting up");
 
+    pa_core_set_io_thread_affinity(u->core, NULL);
+
     pa_thread_mq_install(&u->thread_mq);
 
     for (;;) {
@@ -749,6 +856,184 @@ fail:
 
 #endif
 
+/* Called from main context */
+static void update_network_stats(struct userdata *u, pa_usec_t rtt) {
+    pa_usec_t d;
+
+    pa_assert(u);
+
+    /* Smoothed round trip time and its variation, like TCP does for
+     * its retransmission timer (RFC 6298) */
+    if (!u->have_rtt) {
+        u->rtt = rtt;
+        u->rtt_jitter = rtt / 2;
+        u->have_rtt = TRUE;
+        return;
+    }
+
+    d = rtt > u->rtt ? rtt - u->rtt : u->rtt - rtt;
+    u->rtt_jitter = (3 * u->rtt_jitter + d) / 4;
+    u->rtt = (7 * u->rtt + rtt) / 8;
+}
+
+/* Called from main context */
+static void update_network_properties(struct userdata *u) {
+    pa_proplist *pl;
+
+    pa_assert(u);
+
+    if (!u->have_rtt)
+        return;
+
+    pl = pa_proplist_new();
+    pa_proplist_setf(pl, "tunnel.network.rtt_usec", "%llu", (unsigned long long) u->rtt);
+    pa_proplist_setf(pl, "tunnel.network.jitter_usec", "%llu", (unsigned long long) u->rtt_jitter);
+
+#ifdef TUNNEL_SINK
+    pa_proplist_setf(pl, "tunnel.network.underruns", "%llu", (unsigned long long) u->n_underruns);
+
+    if (u->tlength != (uint32_t) -1)
+        pa_proplist_setf(pl, "tunnel.remote.buffer_usec", "%llu", (unsigned long long) pa_bytes_to_usec(u->tlength, &u->sink->sample_spec));
+
+    pa_sink_update_proplist(u->sink, PA_UPDATE_REPLACE, pl);
+#else
+    pa_source_update_proplist(u->source, PA_UPDATE_REPLACE, pl);
+#endif
+
+    pa_proplist_free(pl);
+
+    u->last_stats_update = pa_rtclock_now();
+}
+
+#ifdef TUNNEL_SINK
+
+/* Called from main context */
+static void set_buffer_attr_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    struct userdata *u = userdata;
+
+    pa_assert(pd);
+    pa_assert(u);
+    pa_assert(u->pdispatch == pd);
+
+    u->buffer_attr_pending = FALSE;
+
+    if (command == PA_COMMAND_ERROR) {
+        pa_log_warn("Server refused to change buffer attributes, not adapting them.");
+        u->adaptive = FALSE;
+        return;
+    }
+
+    if (command != PA_COMMAND_REPLY) {
+        pa_log("Protocol error.");
+        goto fail;
+    }
+
+    if (pa_tagstruct_getu32(t, &u->maxlength) < 0 ||
+        pa_tagstruct_getu32(t, &u->tlength) < 0 ||
+        pa_tagstruct_getu32(t, &u->prebuf) < 0 ||
+        pa_tagstruct_getu32(t, &u->minreq) < 0)
+        goto parse_error;
+
+    if (u->version >= 13) {
+        pa_usec_t usec;
+
+        if (pa_tagstruct_get_usec(t, &usec) < 0)
+            goto parse_error;
+    }
+
+    if (!pa_tagstruct_eof(t))
+        goto parse_error;
+
+    pa_log_info("Remote buffer is now %0.1f ms (round trip %0.1f ms, jitter %0.1f ms).",
+                (double) pa_bytes_to_usec(u->tlength, &u->sink->sample_spec) / PA_USEC_PER_MSEC,
+                (double) u->rtt / PA_USEC_PER_MSEC,
+                (double) u->rtt_jitter / PA_USEC_PER_MSEC);
+
+    u->last_buffer_attr_change = pa_rtclock_now();
+    update_network_properties(u);
+
+    /* The indexes might have moved */
+    request_latency(u);
+    return;
+
+parse_error:
+    pa_log("Invalid reply. (Set buffer attributes)");
+
+fail:
+    pa_module_unload_request(u->module, TRUE);
+}
+
+/* Called from main context */
+static void set_buffer_attr(struct userdata *u, uint32_t tlength) {
+    pa_tagstruct *t;
+    uint32_t tag;
+
+    pa_assert(u);
+
+    t = pa_tagstruct_new(NULL, 0);
+    pa_tagstruct_putu32(t, PA_COMMAND_SET_PLAYBACK_STREAM_BUFFER_ATTR);
+    pa_tagstruct_putu32(t, tag = u->ctag++);
+    pa_tagstruct_putu32(t, u->channel);
+    pa_tagstruct_putu32(t, u->maxlength);
+    pa_tagstruct_putu32(t, tlength);
+    pa_tagstruct_putu32(t, tlength); /* prebuf */
+    pa_tagstruct_putu32(t, u->minreq);
+
+    if (u->version >= 13)
+        pa_tagstruct_put_boolean(t, TRUE); /* adjust_latency */
+
+    if (u->version >= 14)
+        pa_tagstruct_put_boolean(t, TRUE); /* early requests */
+
+    pa_pstream_send_tagstruct(u->pstream, t);
+    pa_pdispatch_register_reply(u->pdispatch, tag, DEFAULT_TIMEOUT, set_buffer_attr_callback, u, NULL);
+
+    u->buffer_attr_pending = TRUE;
+}
+
+/* Called from main context */
+static void adapt_buffer_attr(struct userdata *u) {
+    pa_usec_t now, boost = 0, target, current;
+
+    pa_assert(u);
+
+    if (!u->adaptive || !u->have_rtt || !u->pstream || u->channel == PA_INVALID_INDEX ||
+        u->tlength == (uint32_t) -1 || u->minreq == (uint32_t) -1 || u->version < 12 ||
+        u->buffer_attr_pending)
+        return;
+
+    now = pa_rtclock_now();
+
+    if (u->last_underrun + UNDERRUN_BOOST_DECAY > now)
+        boost = u->underrun_boost - u->underrun_boost * (now - u->last_underrun) / UNDERRUN_BOOST_DECAY;
+
+    /* The server asks for more when minreq is free, and what we send
+     * takes a trip through the network to get there, which now and
+     * then takes a lot longer than usual */
+    target = pa_bytes_to_usec(u->minreq, &u->sink->sample_spec) + u->rtt + 4 * u->rtt_jitter + boost;
+    target = PA_CLAMP(target, MIN_TLENGTH_USEC, MAX_TLENGTH_USEC);
+
+    current = pa_bytes_to_usec(u->tlength, &u->sink->sample_spec);
+
+    /* Grow right away, but shrink only slowly once the network has
+     * been fine for a while, so that we don't oscillate */
+    if (target <= current + current / 10) {
+        if (target + current / 4 >= current ||
+            now <= u->last_underrun + SHRINK_HOLDOFF ||
+            now <= u->last_buffer_attr_change + SHRINK_HOLDOFF)
+            return;
+
+        target = (target + current) / 2;
+    }
+
+    pa_log_debug("Changing remote buffer from %0.1f ms to %0.1f ms.",
+                 (double) current / PA_USEC_PER_MSEC, (double) target / PA_USEC_PER_MSEC);
+
+    set_buffer_attr(u, (uint32_t) pa_usec_to_bytes(target, &u->sink->sample_spec));
+}
+
+#endif
+
 /* Called from main context */
 static void stream_get_latency_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     struct userdata *u = userdata;
@@ -804,6 +1089,8 @@ static void stream_get_latency_callback(pa_pdispatch *pd, uint32_t command, uint
 
     pa_gettimeofday(&now);
 
+    update_network_stats(u, pa_timeval_diff(&now, &local));
+
     /* Calculate transport usec */
     if (pa_timeval_cmp(&local, &remote) < 0 && pa_timeval_cmp(&remote, &now)) {
         /* local and remote seem to have synchronized clocks */
@@ -847,6 +1134,8 @@ static void stream_get_latency_callback(pa_pdispatch *pd, uint32_t command, uint
 
 #ifdef TUNNEL_SINK
     pa_asyncmsgq_send(u->sink->asyncmsgq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_UPDATE_LATENCY, 0, delay, NULL);
+
+    adapt_buffer_attr(u);
 #else
     pa_asyncmsgq_send(u->source->asyncmsgq, PA_MSGOBJECT(u->source), SOURCE_MESSAGE_UPDATE_LATENCY, 0, delay, NULL);
 #endif
@@ -883,6 +1172,35 @@ static void request_latency(struct userdata *u) {
     u->counter_delta = 0;
 }
 
+/* Called from main context */
+static void log_compression(struct userdata *u, pa_log_level_t level) {
+    uint64_t pcm_bytes, encoded_bytes;
+
+    pa_assert(u);
+
+    if (!u->pstream || u->channel == PA_INVALID_INDEX)
+        return;
+
+    if (!pa_pstream_get_codec_stats(u->pstream, u->channel, &pcm_bytes, &encoded_bytes) || pcm_bytes <= 0)
+        return;
+
+    pa_logl(level, "%s compressed %llu bytes to %llu bytes (%0.1f%%).",
+            pa_encoding_to_string(u->compression),
+            (unsigned long long) pcm_bytes,
+            (unsigned long long) encoded_bytes,
+            (double) encoded_bytes * 100.0 / (double) pcm_bytes);
+}
+
+static pa_usec_t latency_interval(struct userdata *u) {
+#ifdef TUNNEL_SINK
+    /* The adaptive mode needs more samples of the round trip time */
+    if (u->adaptive)
+        return ADAPTIVE_LATENCY_INTERVAL;
+#endif
+
+    return LATENCY_INTERVAL;
+}
+
 /* Called from main context */
 static void timeout_callback(pa_mainloop_api *m, pa_time_event *e, const struct timeval *t, void *userdata) {
     struct userdata *u = userdata;
@@ -892,8 +1210,12 @@ static void timeout_callback(pa_mainloop_api *m, pa_time_event *e, const struct
     pa_assert(u);
 
     request_latency(u);
+    log_compression(u, PA_LOG_DEBUG);
+
+    if (pa_rtclock_now() >= u->last_stats_update + STATS_INTERVAL)
+        update_network_properties(u);
 
-    pa_core_rttime_restart(u->core, e, pa_rtclock_now() + LATENCY_INTERVAL);
+    pa_core_rttime_restart(u->core, e, pa_rtclock_now() + latency_interval(u));
 }
 
 /* Called from main context */
@@ -1121,6 +1443,17 @@ static void sink_info_cb(pa_pdispatch *pd, uint32_t command,  uint32_t tag, pa_t
     if (u->version >= 21 && read_formats(u, t) < 0)
         goto fail;
 
+    if (u->version >= 29) {
+        pa_usec_t cost_avg, cost_max;
+
+        if (pa_tagstruct_get_usec(t, &cost_avg) < 0 ||
+            pa_tagstruct_get_usec(t, &cost_max) < 0) {
+
+            pa_log("Parse failure");
+            goto fail;
+        }
+    }
+
     if (!pa_tagstruct_eof(t)) {
         pa_log("Packet too long");
         goto fail;
@@ -1224,6 +1557,22 @@ static void sink_input_info_cb(pa_pdispatch *pd, uint32_t command,  uint32_t tag
         pa_format_info_free(format);
     }
 
+    if (u->version >= 29) {
+        pa_usec_t cost;
+
+        /* Render, pop and resample cost, average and maximum each */
+        if (pa_tagstruct_get_usec(t, &cost) < 0 ||
+            pa_tagstruct_get_usec(t, &cost) < 0 ||
+            pa_tagstruct_get_usec(t, &cost) < 0 ||
+            pa_tagstruct_get_usec(t, &cost) < 0 ||
+            pa_tagstruct_get_usec(t, &cost) < 0 ||
+            pa_tagstruct_get_usec(t, &cost) < 0) {
+
+            pa_log("Parse failure");
+            goto fail;
+        }
+    }
+
     if (!pa_tagstruct_eof(t)) {
         pa_log("Packet too long");
         goto fail;
@@ -1430,6 +1779,10 @@ static void start_subscribe(struct userdata *u) {
 #endif
                         );
 
+    /* We query what changed anyway */
+    if (u->version >= 31)
+        pa_tagstruct_put_boolean(t, FALSE);
+
     pa_pstream_send_tagstruct(u->pstream, t);
 }
 
@@ -1521,6 +1874,38 @@ static void create_stream_callback(pa_pdispatch *pd, uint32_t command,  uint32_t
         pa_format_info_free(format);
     }
 
+    if (u->version >= 32) {
+        pa_format_info *codec = pa_format_info_new();
+
+        if (pa_tagstruct_get_format_info(t, codec) < 0) {
+            pa_format_info_free(codec);
+            goto parse_error;
+        }
+
+        if (!pa_format_info_is_pcm(codec)) {
+            pa_encoding_t e = codec->encoding;
+
+            pa_format_info_free(codec);
+
+            if (e != u->compression) {
+                pa_log("Server picked a codec we didn't offer.");
+                goto fail;
+            }
+
+#ifdef TUNNEL_SINK
+            pa_pstream_set_encoder(u->pstream, u->channel, pa_codec_new_encoder(e, &u->sink->sample_spec, u->compression_quality));
+#else
+            pa_pstream_set_decoder(u->pstream, u->channel, pa_codec_new_decoder(e, &u->source->sample_spec));
+#endif
+            pa_log_info("Stream is compressed with %s.", pa_encoding_to_string(e));
+        } else {
+            pa_format_info_free(codec);
+
+            if (u->compression != PA_ENCODING_PCM)
+                pa_log_info("Server doesn't support %s, stream is not compressed.", pa_encoding_to_string(u->compression));
+        }
+    }
+
     if (!pa_tagstruct_eof(t))
         goto parse_error;
 
@@ -1528,7 +1913,7 @@ static void create_stream_callback(pa_pdispatch *pd, uint32_t command,  uint32_t
     request_info(u);
 
     pa_assert(!u->time_event);
-    u->time_event = pa_core_rttime_new(u->core, pa_rtclock_now() + LATENCY_INTERVAL, timeout_callback, u);
+    u->time_event = pa_core_rttime_new(u->core, pa_rtclock_now() + latency_interval(u), timeout_callback, u);
 
     request_latency(u);
 
@@ -1740,6 +2125,20 @@ static void setup_complete_callback(pa_pdispatch *pd, uint32_t command, uint32_t
     }
 #endif
 
+    if (u->version >= 32) {
+        if (u->compression != PA_ENCODING_PCM) {
+            pa_format_info *codec = pa_format_info_new();
+
+            codec->encoding = u->compression;
+            pa_format_info_set_prop_int(codec, PA_CODEC_PROP_QUALITY, (int) u->compression_quality);
+
+            pa_tagstruct_putu8(reply, 1);
+            pa_tagstruct_put_format_info(reply, codec);
+            pa_format_info_free(codec);
+        } else
+            pa_tagstruct_putu8(reply, 0);
+    }
+
     pa_pstream_send_tagstruct(u->pstream, reply);
     pa_pdispatch_register_reply(u->pdispatch, tag, DEFAULT_TIMEOUT, create_stream_callback, u, NULL);
 
@@ -1763,14 +2162,14 @@ static void pstream_die_callback(pa_pstream *p, void *userdata) {
 }
 
 /* Called from main context */
-static void pstream_packet_callback(pa_pstream *p, pa_packet *packet, const pa_creds *creds, void *userdata) {
+static void pstream_packet_callback(pa_pstream *p, pa_packet *packet, const pa_cmsg_ancil_data *ancil_data, void *userdata) {
     struct userdata *u = userdata;
 
     pa_assert(p);
     pa_assert(packet);
     pa_assert(u);
 
-    if (pa_pdispatch_run(u->pdispatch, packet, creds, u) < 0) {
+    if (pa_pdispatch_run(u->pdispatch, packet, ancil_data, u) < 0) {
         pa_log("Invalid packet");
         pa_module_unload_request(u->module, TRUE);
         return;
@@ -1854,6 +2253,22 @@ static void on_connection(pa_socket_client *sc, pa_iochannel *io, void *userdata
     pa_log_debug("Connection established, authenticating ...");
 }
 
+/* Called from main context */
+static int connect_server(struct userdata *u) {
+    pa_assert(u);
+    pa_assert(!u->client);
+    pa_assert(!u->pstream);
+
+    if (!(u->client = pa_socket_client_new_string(u->core->mainloop, TRUE, u->server_name, PA_NATIVE_DEFAULT_PORT))) {
+        pa_log("Failed to connect to server '%s'", u->server_name);
+        return -1;
+    }
+
+    pa_socket_client_set_callback(u->client, on_connection, u);
+
+    return 0;
+}
+
 #ifdef TUNNEL_SINK
 
 /* Called from main context */
@@ -1865,6 +2280,10 @@ static void sink_set_volume(pa_sink *sink) {
     u = sink->userdata;
     pa_assert(u);
 
+    /* Not connected yet; we take the remote volume once we are */
+    if (!u->pstream)
+        return;
+
     t = pa_tagstruct_new(NULL, 0);
     pa_tagstruct_putu32(t, PA_COMMAND_SET_SINK_INPUT_VOLUME);
     pa_tagstruct_putu32(t, u->ctag++);
@@ -1882,7 +2301,7 @@ static void sink_set_mute(pa_sink *sink) {
     u = sink->userdata;
     pa_assert(u);
 
-    if (u->version < 11)
+    if (!u->pstream || u->version < 11)
         return;
 
     t = pa_tagstruct_new(NULL, 0);
@@ -1901,6 +2320,8 @@ int pa__init(pa_module*m) {
     pa_sample_spec ss;
     pa_channel_map map;
     char *dn = NULL;
+    const char *compression;
+    char st[PA_SAMPLE_SPEC_SNPRINT_MAX];
 #ifdef TUNNEL_SINK
     pa_sink_new_data data;
 #else
@@ -1925,6 +2346,11 @@ int pa__init(pa_module*m) {
     u->sink_name = pa_xstrdup(pa_modargs_get_value(ma, "sink", NULL));;
     u->sink = NULL;
     u->requested_bytes = 0;
+
+    if (pa_modargs_get_value_boolean(ma, "adaptive", &u->adaptive) < 0) {
+        pa_log("Failed to parse \"adaptive\" parameter.");
+        goto fail;
+    }
 #else
     u->source_name = pa_xstrdup(pa_modargs_get_value(ma, "source", NULL));;
     u->source = NULL;
@@ -1963,12 +2389,44 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
-    if (!(u->client = pa_socket_client_new_string(m->core->mainloop, TRUE, u->server_name, PA_NATIVE_DEFAULT_PORT))) {
-        pa_log("Failed to connect to server '%s'", u->server_name);
+    u->compression = PA_ENCODING_PCM;
+    u->compression_quality = PA_CODEC_QUALITY_DEFAULT;
+
+    if ((compression = pa_modargs_get_value(ma, "compression", NULL)) && !pa_streq(compression, "none")) {
+        u->compression = pa_encoding_from_string(compression);
+
+        if (u->compression == PA_ENCODING_PCM || u->compression == PA_ENCODING_INVALID) {
+            pa_log("Invalid compression '%s'", compression);
+            goto fail;
+        }
+
+        if (pa_modargs_get_value_u32(ma, "compression_quality", &u->compression_quality) < 0 ||
+            u->compression_quality > PA_CODEC_QUALITY_MAX) {
+            pa_log("Invalid compression quality");
+            goto fail;
+        }
+
+        /* Codecs only take some sample specs, so unless the user
+         * asked for something else explicitly we pick one that fits */
+        if (!pa_codec_supported(u->compression, &ss) && !pa_modargs_get_value(ma, "format", NULL))
+            ss.format = PA_SAMPLE_S16NE;
+
+        if (!pa_codec_supported(u->compression, &ss) && !pa_modargs_get_value(ma, "rate", NULL))
+            ss.rate = 48000;
+
+        if (!pa_codec_supported(u->compression, &ss)) {
+            pa_log("%s is not available for %s.", compression, pa_sample_spec_snprint(st, sizeof(st), &ss));
+            goto fail;
+        }
+    }
+
+    if (pa_modargs_get_value_boolean(ma, "on_demand", &u->on_demand) < 0) {
+        pa_log("Failed to parse \"on_demand\" parameter.");
         goto fail;
     }
 
-    pa_socket_client_set_callback(u->client, on_connection, u);
+    if (!u->on_demand && connect_server(u) < 0)
+        goto fail;
 
 #ifdef TUNNEL_SINK
 
@@ -2129,6 +2587,7 @@ void pa__done(pa_module*m) {
         pa_rtpoll_free(u->rtpoll);
 
     if (u->pstream) {
+        log_compression(u, PA_LOG_INFO);
         pa_pstream_unlink(u->pstream);
         pa_pstream_unref(u->pstream);
     }
@@ -39,11 +39,12 @@
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/core-util.h>
+#include <pulsecore/core-subscribe.h>
 #include <pulsecore/log.h>
-#include <pulsecore/hashmap.h>
 #include <pulsecore/modargs.h>
 #include <pulsecore/namereg.h>
 #include <pulsecore/avahi-wrap.h>
+#include <pulsecore/discover-cache.h>
 
 #include "module-raop-discover-symdef.h"
 
@@ -51,19 +52,25 @@ PA_MODULE_AUTHOR("Colin Guthrie");
 PA_MODULE_DESCRIPTION("mDNS/DNS-SD Service Discovery of RAOP devices");
 PA_MODULE_VERSION(PACKAGE_VERSION);
 PA_MODULE_LOAD_ONCE(TRUE);
+PA_MODULE_USAGE(
+        "cache_ttl=<seconds to keep the sinks of devices that went away> "
+        "load_interval_msec=<time between loading batches of sinks> "
+        "load_batch=<number of sinks to load at once> "
+        "on_demand=<connect sinks only when they are used?>");
 
 #define SERVICE_TYPE_SINK "_raop._tcp"
 
 static const char* const valid_modargs[] = {
+    "cache_ttl",
+    "load_interval_msec",
+    "load_batch",
+    "on_demand",
     NULL
 };
 
-struct tunnel {
-    AvahiIfIndex interface;
-    AvahiProtocol protocol;
-    char *name, *type, *domain;
-    uint32_t module_index;
-};
+#define DEFAULT_CACHE_TTL 30
+#define DEFAULT_LOAD_INTERVAL_MSEC 100
+#define DEFAULT_LOAD_BATCH 4
 
 struct userdata {
     pa_core *core;
@@ -72,59 +79,48 @@ struct userdata {
     AvahiClient *client;
     AvahiServiceBrowser *sink_browser;
 
-    pa_hashmap *tunnels;
+    pa_discover_cache *cache;
+    pa_subscription *subscription;
+    pa_bool_t on_demand;
 };
 
-static unsigned tunnel_hash(const void *p) {
-    const struct tunnel *t = p;
-
-    return
-        (unsigned) t->interface +
-        (unsigned) t->protocol +
-        pa_idxset_string_hash_func(t->name) +
-        pa_idxset_string_hash_func(t->type) +
-        pa_idxset_string_hash_func(t->domain);
+/* A service is the same on all interfaces and protocols */
+static char *service_key(const char *name, const char *type, const char *domain) {
+    return pa_sprintf_malloc("%s\n%s\n%s", name, type, domain);
 }
 
-static int tunnel_compare(const void *a, const void *b) {
-    const struct tunnel *ta = a, *tb = b;
-    int r;
-
-    if (ta->interface != tb->interface)
-        return 1;
-    if (ta->protocol != tb->protocol)
-        return 1;
-    if ((r = strcmp(ta->name, tb->name)))
-        return r;
-    if ((r = strcmp(ta->type, tb->type)))
-        return r;
-    if ((r = strcmp(ta->domain, tb->domain)))
-        return r;
+/* Called from main context */
+static uint32_t load_cb(pa_discover_cache *c, const char *module_name, const char *args, void *userdata) {
+    struct userdata *u = userdata;
+    pa_module *m;
+
+    pa_assert(u);
 
-    return 0;
+    pa_log_debug("Loading %s with arguments '%s'", module_name, args);
+
+    if (!(m = pa_module_load(u->core, module_name, args)))
+        return PA_INVALID_INDEX;
+
+    return m->index;
 }
 
-static struct tunnel *tunnel_new(
-        AvahiIfIndex interface, AvahiProtocol protocol,
-        const char *name, const char *type, const char *domain) {
-
-    struct tunnel *t;
-    t = pa_xnew(struct tunnel, 1);
-    t->interface = interface;
-    t->protocol = protocol;
-    t->name = pa_xstrdup(name);
-    t->type = pa_xstrdup(type);
-    t->domain = pa_xstrdup(domain);
-    t->module_index = PA_IDXSET_INVALID;
-    return t;
+/* Called from main context */
+static void unload_cb(pa_discover_cache *c, uint32_t module_index, void *userdata) {
+    struct userdata *u = userdata;
+
+    pa_assert(u);
+
+    pa_module_unload_request_by_index(u->core, module_index, TRUE);
 }
 
-static void tunnel_free(struct tunnel *t) {
-    pa_assert(t);
-    pa_xfree(t->name);
-    pa_xfree(t->type);
-    pa_xfree(t->domain);
-    pa_xfree(t);
+/* Called from main context */
+static void subscribe_cb(pa_core *c, pa_subscription_event_type_t t, uint32_t idx, void *userdata) {
+    struct userdata *u = userdata;
+
+    pa_assert(u);
+
+    if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_REMOVE)
+        pa_discover_cache_module_unloaded(u->cache, idx);
 }
 
 static void resolver_cb(
@@ -138,19 +134,19 @@ static void resolver_cb(
         void *userdata) {
 
     struct userdata *u = userdata;
-    struct tunnel *tnl;
+    char *key;
 
     pa_assert(u);
 
-    tnl = tunnel_new(interface, protocol, name, type, domain);
+    key = service_key(name, type, domain);
 
-    if (event != AVAHI_RESOLVER_FOUND)
+    if (event != AVAHI_RESOLVER_FOUND) {
         pa_log("Resolving of '%s' failed: %s", name, avahi_strerror(avahi_client_errno(u->client)));
-    else {
+        pa_discover_cache_failed(u->cache, key);
+    } else {
         char *device = NULL, *nicename, *dname, *vname, *args;
         char at[AVAHI_ADDRESS_STR_MAX];
         AvahiStringList *l;
-        pa_module *m;
 
         if ((nicename = strstr(name, "@"))) {
             ++nicename;
@@ -182,6 +178,8 @@ static void resolver_cb(
 
         if (!(vname = pa_namereg_make_valid_name(dname))) {
             pa_log("Cannot construct valid device name from '%s'.", dname);
+            pa_discover_cache_failed(u->cache, key);
+            pa_xfree(nicename);
             avahi_free(device);
             pa_xfree(dname);
             goto finish;
@@ -191,25 +189,25 @@ static void resolver_cb(
         if (nicename) {
             args = pa_sprintf_malloc("server=[%s]:%u "
                                      "sink_name=%s "
-                                     "sink_properties='device.description=\"%s\"'",
+                                     "sink_properties='device.description=\"%s\"' "
+                                     "on_demand=%s",
                                      avahi_address_snprint(at, sizeof(at), a), port,
                                      vname,
-                                     nicename);
+                                     nicename,
+                                     pa_yes_no(u->on_demand));
             pa_xfree(nicename);
         } else {
             args = pa_sprintf_malloc("server=[%s]:%u "
-                                     "sink_name=%s",
+                                     "sink_name=%s "
+                                     "on_demand=%s",
                                      avahi_address_snprint(at, sizeof(at), a), port,
-                                     vname);
+                                     vname,
+                                     pa_yes_no(u->on_demand));
         }
 
-        pa_log_debug("Loading module-raop-sink with arguments '%s'", args);
-
-        if ((m = pa_module_load(u->core, "module-raop-sink", args))) {
-            tnl->module_index = m->index;
-            pa_hashmap_put(u->tunnels, tnl, tnl);
-            tnl = NULL;
-        }
+        /* The module is loaded later, together with others that are
+         * found at about the same time */
+        pa_discover_cache_resolved(u->cache, key, "module-raop-sink", args);
 
         pa_xfree(vname);
         pa_xfree(args);
@@ -219,9 +217,7 @@ static void resolver_cb(
 finish:
 
     avahi_service_resolver_free(r);
-
-    if (tnl)
-        tunnel_free(tnl);
+    pa_xfree(key);
 }
 
 static void browser_cb(
@@ -233,36 +229,33 @@ static void browser_cb(
         void *userdata) {
 
     struct userdata *u = userdata;
-    struct tunnel *t;
+    char *key;
 
     pa_assert(u);
 
     if (flags & AVAHI_LOOKUP_RESULT_LOCAL)
         return;
 
-    t = tunnel_new(interface, protocol, name, type, domain);
+    key = service_key(name, type, domain);
 
     if (event == AVAHI_BROWSER_NEW) {
 
-        if (!pa_hashmap_get(u->tunnels, t))
-            if (!(avahi_service_resolver_new(u->client, interface, protocol, name, type, domain, AVAHI_PROTO_UNSPEC, 0, resolver_cb, u)))
+        /* Services are announced once per interface and protocol, but
+         * we only need to resolve them once */
+        if (pa_discover_cache_announce(u->cache, key))
+            if (!(avahi_service_resolver_new(u->client, interface, protocol, name, type, domain, AVAHI_PROTO_UNSPEC, 0, resolver_cb, u))) {
                 pa_log("avahi_service_resolver_new() failed: %s", avahi_strerror(avahi_client_errno(u->client)));
+                pa_discover_cache_failed(u->cache, key);
+            }
 
         /* We ignore the returned resolver object here, since the we don't
          * need to attach any special data to it, and we can still destroy
          * it from the callback */
 
-    } else if (event == AVAHI_BROWSER_REMOVE) {
-        struct tunnel *t2;
-
-        if ((t2 = pa_hashmap_get(u->tunnels, t))) {
-            pa_module_unload_request_by_index(u->core, t2->module_index, TRUE);
-            pa_hashmap_remove(u->tunnels, t2);
-            tunnel_free(t2);
-        }
-    }
+    } else if (event == AVAHI_BROWSER_REMOVE)
+        pa_discover_cache_withdraw(u->cache, key);
 
-    tunnel_free(t);
+    pa_xfree(key);
 }
 
 static void client_callback(AvahiClient *c, AvahiClientState state, void *userdata) {
@@ -311,6 +304,10 @@ static void client_callback(AvahiClient *c, AvahiClientState state, void *userda
 
         case AVAHI_CLIENT_CONNECTING:
 
+            /* We won't hear of the services going away now. If they are
+             * still there when we are back, they keep their modules. */
+            pa_discover_cache_withdraw_all(u->cache);
+
             if (u->sink_browser) {
                 avahi_service_browser_free(u->sink_browser);
                 u->sink_browser = NULL;
@@ -326,6 +323,9 @@ int pa__init(pa_module*m) {
 
     struct userdata *u;
     pa_modargs *ma = NULL;
+    uint32_t cache_ttl = DEFAULT_CACHE_TTL;
+    uint32_t load_interval_msec = DEFAULT_LOAD_INTERVAL_MSEC;
+    uint32_t load_batch = DEFAULT_LOAD_BATCH;
     int error;
 
     if (!(ma = pa_modargs_new(m->argument, valid_modargs))) {
@@ -333,12 +333,36 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
-    m->userdata = u = pa_xnew(struct userdata, 1);
+    m->userdata = u = pa_xnew0(struct userdata, 1);
     u->core = m->core;
     u->module = m;
     u->sink_browser = NULL;
+    u->on_demand = TRUE;
+
+    if (pa_modargs_get_value_u32(ma, "cache_ttl", &cache_ttl) < 0 ||
+        pa_modargs_get_value_u32(ma, "load_interval_msec", &load_interval_msec) < 0) {
+        pa_log("Failed to parse cache_ttl or load_interval_msec.");
+        goto fail;
+    }
 
-    u->tunnels = pa_hashmap_new(tunnel_hash, tunnel_compare);
+    if (pa_modargs_get_value_u32(ma, "load_batch", &load_batch) < 0 || load_batch <= 0) {
+        pa_log("Invalid load_batch.");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_boolean(ma, "on_demand", &u->on_demand) < 0) {
+        pa_log("Failed to parse on_demand.");
+        goto fail;
+    }
+
+    u->cache = pa_discover_cache_new(m->core->mainloop,
+                                     (pa_usec_t) cache_ttl * PA_USEC_PER_SEC,
+                                     (pa_usec_t) load_interval_msec * PA_USEC_PER_MSEC,
+                                     load_batch,
+                                     load_cb, unload_cb, u);
+
+    /* Sinks unload themselves when their connection fails */
+    u->subscription = pa_subscription_new(m->core, PA_SUBSCRIPTION_MASK_MODULE, subscribe_cb, u);
 
     u->avahi_poll = pa_avahi_poll_new(m->core->mainloop);
 
@@ -373,16 +397,11 @@ void pa__done(pa_module*m) {
     if (u->avahi_poll)
         pa_avahi_poll_free(u->avahi_poll);
 
-    if (u->tunnels) {
-        struct tunnel *t;
+    if (u->subscription)
+        pa_subscription_free(u->subscription);
 
-        while ((t = pa_hashmap_steal_first(u->tunnels))) {
-            pa_module_unload_request_by_index(u->core, t->module_index, TRUE);
-            tunnel_free(t);
-        }
-
-        pa_hashmap_free(u->tunnels, NULL);
-    }
+    if (u->cache)
+        pa_discover_cache_free(u->cache);
 
     pa_xfree(u);
 }
@@ -53,12 +53,14 @@
 #include <pulsecore/thread.h>
 #include <pulsecore/time-smoother.h>
 #include <pulsecore/poll.h>
+#include <pulsecore/queue.h>
 
 #include "module-raop-sink-symdef.h"
 #include "rtp.h"
 #include "sdp.h"
 #include "sap.h"
 #include "raop_client.h"
+#include "raop_udp.h"
 
 PA_MODULE_AUTHOR("Colin Guthrie");
 PA_MODULE_DESCRIPTION("RAOP Sink");
@@ -70,10 +72,23 @@ PA_MODULE_USAGE(
         "server=<address>  "
         "format=<sample format> "
         "rate=<sample rate> "
-        "channels=<number of channels>");
+        "channels=<number of channels> "
+        "protocol=<tcp or udp> "
+        "latency_msec=<how long the receiver buffers, udp only> "
+        "on_demand=<connect only when the sink is used?>");
 
 #define DEFAULT_SINK_NAME "raop"
 
+/* With UDP we tell the receiver how much to buffer, instead of having
+ * the socket buffers and the receiver's fixed buffer add up */
+#define DEFAULT_UDP_LATENCY_MSEC 500
+
+/* How often the receiver is told which timestamp is played when */
+#define UDP_SYNC_INTERVAL PA_USEC_PER_SEC
+
+/* If we fall behind by this much, we don't try to catch up */
+#define UDP_MAX_LAG (200*PA_USEC_PER_MSEC)
+
 struct userdata {
     pa_core *core;
     pa_module *module;
@@ -84,8 +99,15 @@ struct userdata {
     pa_rtpoll_item *rtpoll_item;
     pa_thread *thread;
 
-    pa_memchunk raw_memchunk;
+    /* Encoding and encryption run in a thread of their own, one block
+     * ahead of what is written to the socket */
+    pa_thread *encoder_thread;
+    pa_asyncmsgq *encoder_q;
+    pa_queue *encoded_q;
+    size_t encoding, encoded_length;
+
     pa_memchunk encoded_memchunk;
+    size_t encoded_raw_length, encoded_written;
 
     void *write_data;
     size_t write_length, write_index;
@@ -101,14 +123,23 @@ struct userdata {
     pa_smoother *smoother;
     int fd;
 
+    /* Raw audio rendered, and how much of it was written */
+    int64_t rendered;
     int64_t offset;
-    int64_t encoding_overhead;
-    int32_t next_encoding_overhead;
     double encoding_ratio;
 
     pa_raop_client *raop;
+    pa_raop_protocol_t protocol;
+
+    /* We haven't connected yet, and won't before the sink is used */
+    pa_bool_t on_demand;
 
     size_t block_size;
+
+    /* UDP only: audio packets are sent at the rate they are played */
+    int control_fd, timing_fd;
+    pa_raop_packet_buffer *packet_buffer;
+    pa_raop_udp_pacer *pacer;
 };
 
 static const char* const valid_modargs[] = {
@@ -118,14 +149,34 @@ static const char* const valid_modargs[] = {
     "format",
     "rate",
     "channels",
+    "protocol",
+    "latency_msec",
+    "on_demand",
     NULL
 };
 
 enum {
     SINK_MESSAGE_PASS_SOCKET = PA_SINK_MESSAGE_MAX,
-    SINK_MESSAGE_RIP_SOCKET
+    SINK_MESSAGE_RIP_SOCKET,
+    SINK_MESSAGE_ENCODED
+};
+
+enum {
+    ENCODER_MESSAGE_ENCODE
+};
+
+struct encoded_chunk {
+    pa_memchunk memchunk;
+    size_t raw_length;
 };
 
+static void encoded_chunk_free(void *p) {
+    struct encoded_chunk *e = p;
+
+    pa_memblock_unref(e->memchunk.memblock);
+    pa_xfree(e);
+}
+
 /* Forward declaration */
 static void sink_set_volume_cb(pa_sink *);
 
@@ -138,7 +189,10 @@ static void on_connection(int fd, void*userdata) {
     pa_assert(u->fd < 0);
     u->fd = fd;
 
-    if (getsockopt(u->fd, SOL_SOCKET, SO_SNDBUF, &so_sndbuf, &sl) < 0)
+    if (u->protocol == PA_RAOP_PROTOCOL_UDP) {
+        pa_raop_client_take_udp_fds(u->raop, &u->control_fd, &u->timing_fd);
+        pa_sink_set_max_request(u->sink, u->block_size);
+    } else if (getsockopt(u->fd, SOL_SOCKET, SO_SNDBUF, &so_sndbuf, &sl) < 0)
         pa_log_warn("getsockopt(SO_SNDBUF) failed: %s", pa_cstrerror(errno));
     else {
         pa_log_debug("SO_SNDBUF is %zu.", (size_t) so_sndbuf);
@@ -162,6 +216,27 @@ static void on_close(void*userdata) {
     pa_asyncmsgq_post(u->thread_mq.inq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_RIP_SOCKET, NULL, 0, NULL, NULL);
 }
 
+/* Called from main context */
+static int sink_set_state(pa_sink *s, pa_sink_state_t state) {
+    struct userdata *u;
+
+    pa_sink_assert_ref(s);
+    pa_assert_se(u = s->userdata);
+
+    if (state == PA_SINK_RUNNING && u->on_demand) {
+        pa_log_debug("Sink is used for the first time, connecting.");
+
+        if (pa_raop_connect(u->raop) < 0) {
+            pa_log("Failed to connect to server.");
+            return -1;
+        }
+
+        u->on_demand = FALSE;
+    }
+
+    return 0;
+}
+
 static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
     struct userdata *u = PA_SINK(o)->userdata;
 
@@ -180,6 +255,9 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
                     if (u->fd >= 0) {
                         pa_raop_flush(u->raop);
                     }
+
+                    if (u->pacer)
+                        pa_raop_udp_pacer_reset(u->pacer);
                     break;
 
                 case PA_SINK_IDLE:
@@ -190,10 +268,13 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
 
                         /* The connection can be closed when idle, so check to
                            see if we need to reestablish it */
-                        if (u->fd < 0)
+                        if (u->fd < 0 && !u->on_demand)
                             pa_raop_connect(u->raop);
                         else
                             pa_raop_flush(u->raop);
+
+                        if (u->pacer)
+                            pa_raop_udp_pacer_reset(u->pacer);
                     }
 
                     break;
@@ -210,7 +291,7 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
             pa_usec_t w, r;
 
             r = pa_smoother_get(u->smoother, pa_rtclock_now());
-            w = pa_bytes_to_usec((u->offset - u->encoding_overhead + (u->encoded_memchunk.length / u->encoding_ratio)), &u->sink->sample_spec);
+            w = pa_bytes_to_usec(u->rendered, &u->sink->sample_spec);
 
             *((pa_usec_t*) data) = w > r ? w - r : 0;
             return 0;
@@ -221,11 +302,28 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
 
             pa_assert(!u->rtpoll_item);
 
-            u->rtpoll_item = pa_rtpoll_item_new(u->rtpoll, PA_RTPOLL_NEVER, 1);
-            pollfd = pa_rtpoll_item_get_pollfd(u->rtpoll_item, NULL);
-            pollfd->fd = u->fd;
-            pollfd->events = POLLOUT;
-            /*pollfd->events = */pollfd->revents = 0;
+            if (u->protocol == PA_RAOP_PROTOCOL_UDP) {
+                /* We wait for the audio socket only when it is full,
+                 * and for requests on the control and timing channels */
+                u->rtpoll_item = pa_rtpoll_item_new(u->rtpoll, PA_RTPOLL_NEVER, 3);
+                pollfd = pa_rtpoll_item_get_pollfd(u->rtpoll_item, NULL);
+                pollfd[0].fd = u->fd;
+                pollfd[0].events = 0;
+                pollfd[1].fd = u->control_fd;
+                pollfd[1].events = POLLIN;
+                pollfd[2].fd = u->timing_fd;
+                pollfd[2].events = POLLIN;
+                pollfd[0].revents = pollfd[1].revents = pollfd[2].revents = 0;
+
+                pa_raop_packet_buffer_reset(u->packet_buffer);
+                pa_raop_udp_pacer_reset(u->pacer);
+            } else {
+                u->rtpoll_item = pa_rtpoll_item_new(u->rtpoll, PA_RTPOLL_NEVER, 1);
+                pollfd = pa_rtpoll_item_get_pollfd(u->rtpoll_item, NULL);
+                pollfd->fd = u->fd;
+                pollfd->events = POLLOUT;
+                /*pollfd->events = */pollfd->revents = 0;
+            }
 
             if (u->sink->thread_info.state == PA_SINK_SUSPENDED) {
                 /* Our stream has been suspended so we just flush it.... */
@@ -234,7 +332,51 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
             return 0;
         }
 
+        case SINK_MESSAGE_ENCODED: {
+            struct encoded_chunk *e;
+
+            pa_assert(u->encoding >= (size_t) offset);
+            u->encoding -= (size_t) offset;
+
+            /* Audio encrypted for a connection that is gone now is
+             * no use to the next one */
+            if (u->fd < 0) {
+                u->offset += offset;
+                return 0;
+            }
+
+            e = pa_xnew(struct encoded_chunk, 1);
+            e->memchunk = *chunk;
+            pa_memblock_ref(e->memchunk.memblock);
+            e->raw_length = (size_t) offset;
+
+            pa_queue_push(u->encoded_q, e);
+            u->encoded_length += e->raw_length;
+            return 0;
+        }
+
         case SINK_MESSAGE_RIP_SOCKET: {
+            struct encoded_chunk *e;
+
+            /* Count what we drop as played, to keep the latency right */
+            while ((e = pa_queue_pop(u->encoded_q))) {
+                u->offset += e->raw_length;
+                encoded_chunk_free(e);
+            }
+            u->encoded_length = 0;
+
+            if (u->encoded_memchunk.memblock) {
+                pa_memblock_unref(u->encoded_memchunk.memblock);
+                u->offset += u->encoded_raw_length;
+            }
+            pa_memchunk_reset(&u->encoded_memchunk);
+
+            if (u->control_fd >= 0)
+                pa_close(u->control_fd);
+            if (u->timing_fd >= 0)
+                pa_close(u->timing_fd);
+            u->control_fd = u->timing_fd = -1;
+
             if (u->fd >= 0) {
                 pa_close(u->fd);
                 u->fd = -1;
@@ -306,24 +448,182 @@ static void sink_set_mute_cb(pa_sink *s) {
     }
 }
 
+/* Called from encoder thread context */
+static void encoder_thread_func(void *userdata) {
+    struct userdata *u = userdata;
+
+    pa_assert(u);
+
+    pa_log_debug("Encoder thread starting up");
+
+    pa_core_set_io_thread_affinity(u->core, NULL);
+
+    for (;;) {
+        int code;
+        pa_memchunk raw, encoded;
+
+        if (pa_asyncmsgq_get(u->encoder_q, NULL, &code, NULL, NULL, &raw, TRUE) < 0)
+            break;
+
+        if (code == PA_MESSAGE_SHUTDOWN) {
+            pa_asyncmsgq_done(u->encoder_q, 0);
+            break;
+        }
+
+        pa_assert(code == ENCODER_MESSAGE_ENCODE);
+
+        /* Encrypting may take a while, but the IO thread carries on
+         * writing what we encoded before in the meantime. With UDP
+         * this makes one packet at a time. */
+        while (raw.length > 0) {
+            size_t l = raw.length;
+
+            if (pa_raop_client_encode_sample(u->raop, &raw, &encoded) < 0) {
+                pa_asyncmsgq_post(u->thread_mq.outq, PA_MSGOBJECT(u->core), PA_CORE_MESSAGE_UNLOAD_MODULE, u->module, 0, NULL, NULL);
+                break;
+            }
+
+            /* Bytes that don't make up a whole frame are dropped */
+            if (raw.length < 4)
+                raw.length = 0;
+
+            pa_asyncmsgq_post(u->thread_mq.inq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_ENCODED, NULL, (int64_t) (l - raw.length), &encoded, NULL);
+            pa_memblock_unref(encoded.memblock);
+        }
+
+        pa_asyncmsgq_done(u->encoder_q, 0);
+    }
+
+    pa_log_debug("Encoder thread shutting down");
+}
+
+/* Called from IO thread context */
+static void encode_block(struct userdata *u) {
+    pa_memchunk raw;
+
+    if (PA_SINK_IS_OPENED(u->sink->thread_info.state))
+        /* We render real data */
+        pa_sink_render_full(u->sink, u->block_size, &raw);
+    else {
+        /* We send silence to keep the connection alive */
+        pa_silence_memchunk_get(&u->core->silence_cache, u->core->mempool, &raw, &u->sink->sample_spec, u->block_size);
+    }
+
+    u->rendered += raw.length;
+    u->encoding += raw.length;
+
+    pa_asyncmsgq_post(u->encoder_q, NULL, ENCODER_MESSAGE_ENCODE, NULL, 0, &raw, NULL);
+    pa_memblock_unref(raw.memblock);
+}
+
+/* Called from IO thread context */
+static pa_bool_t next_encoded_chunk(struct userdata *u) {
+    struct encoded_chunk *e;
+
+    if (u->encoded_memchunk.length > 0)
+        return TRUE;
+
+    if (u->encoded_memchunk.memblock) {
+        pa_memblock_unref(u->encoded_memchunk.memblock);
+        pa_memchunk_reset(&u->encoded_memchunk);
+        u->offset += u->encoded_raw_length;
+    }
+
+    if (!(e = pa_queue_pop(u->encoded_q)))
+        return FALSE;
+
+    u->encoded_memchunk = e->memchunk;
+    u->encoded_raw_length = e->raw_length;
+    u->encoded_written = 0;
+    u->encoded_length -= e->raw_length;
+    pa_xfree(e);
+
+    if (u->encoded_raw_length > 0)
+        u->encoding_ratio = (double) u->encoded_memchunk.length / u->encoded_raw_length;
+
+    /* Packets are numbered here rather than by the encoder, in the
+     * order they are sent and in step with FLUSH */
+    if (u->protocol == PA_RAOP_PROTOCOL_UDP)
+        pa_raop_client_stamp_udp_packet(u->raop, &u->encoded_memchunk, u->encoded_raw_length / pa_frame_size(&u->sink->sample_spec));
+
+    return TRUE;
+}
+
+/* Called from IO thread context */
+static void udp_process(struct userdata *u, struct pollfd *pollfd) {
+    pa_usec_t now, due = 0, usec;
+
+    if (pollfd[1].revents & POLLIN)
+        pa_raop_udp_handle_control(u->control_fd, u->packet_buffer);
+
+    if (pollfd[2].revents & POLLIN)
+        pa_raop_udp_handle_timing(u->timing_fd);
+
+    pollfd[0].events = 0;
+    pollfd[0].revents = pollfd[1].revents = pollfd[2].revents = 0;
+
+    now = pa_rtclock_now();
+
+    while (next_encoded_chunk(u)) {
+        uint8_t *p;
+        uint32_t rtptime;
+        pa_bool_t first;
+        ssize_t l;
+
+        if ((due = pa_raop_udp_pacer_due(u->pacer, now, u->offset)) > now)
+            break;
+
+        p = (uint8_t*) pa_memblock_acquire(u->encoded_memchunk.memblock) + u->encoded_memchunk.index;
+        rtptime = ((uint32_t) p[4] << 24) | ((uint32_t) p[5] << 16) | ((uint32_t) p[6] << 8) | p[7];
+
+        if (pa_raop_udp_pacer_sync(u->pacer, now, &first))
+            pa_raop_udp_send_sync(u->control_fd, rtptime, (uint32_t) (pa_usec_to_bytes(u->latency, &u->sink->sample_spec) / pa_frame_size(&u->sink->sample_spec)), first);
+
+        l = send(u->fd, p, u->encoded_memchunk.length, MSG_DONTWAIT);
+        pa_memblock_release(u->encoded_memchunk.memblock);
+
+        if (l < 0 && errno == EAGAIN) {
+            /* Try again once there is room */
+            pollfd[0].events = POLLOUT;
+            break;
+        }
+
+        /* A lost packet is the receiver's to ask for again, so we
+         * keep it either way */
+        if (l < 0)
+            pa_log_debug("Failed to send audio packet: %s", pa_cstrerror(errno));
+
+        pa_raop_packet_buffer_write(u->packet_buffer, &u->encoded_memchunk);
+
+        u->encoded_written = u->encoded_memchunk.length;
+        u->encoded_memchunk.index += u->encoded_memchunk.length;
+        u->encoded_memchunk.length = 0;
+    }
+
+    /* The receiver plays what we send now after its latency */
+    usec = u->offset > 0 ? pa_bytes_to_usec((uint64_t) u->offset, &u->sink->sample_spec) : 0;
+    pa_smoother_put(u->smoother, now, usec > u->latency ? usec - u->latency : 0);
+
+    if (u->encoded_memchunk.length > 0 && pollfd[0].events == 0)
+        pa_rtpoll_set_timer_absolute(u->rtpoll, due);
+    else
+        pa_rtpoll_set_timer_disabled(u->rtpoll);
+}
+
 static void thread_func(void *userdata) {
     struct userdata *u = userdata;
     int write_type = 0;
-    pa_memchunk silence;
-    uint32_t silence_overhead = 0;
-    double silence_ratio = 0;
 
     pa_assert(u);
 
     pa_log_debug("Thread starting up");
 
+    pa_core_set_io_thread_affinity(u->core, NULL);
+
     pa_thread_mq_install(&u->thread_mq);
 
     pa_smoother_set_time_offset(u->smoother, pa_rtclock_now());
 
-    /* Create a chunk of memory that is our encoded silence sample. */
-    pa_memchunk_reset(&silence);
-
     for (;;) {
         int ret;
 
@@ -334,66 +634,18 @@ static void thread_func(void *userdata) {
             struct pollfd *pollfd;
             pollfd = pa_rtpoll_item_get_pollfd(u->rtpoll_item, NULL);
 
-            /* Render some data and write it to the fifo */
-            if (/*PA_SINK_IS_OPENED(u->sink->thread_info.state) && */pollfd->revents) {
+            /* Write what the encoder has done so far */
+            if (u->protocol == PA_RAOP_PROTOCOL_UDP)
+                udp_process(u, pollfd);
+
+            else if (/*PA_SINK_IS_OPENED(u->sink->thread_info.state) && */pollfd->revents & POLLOUT) {
                 pa_usec_t usec;
                 int64_t n;
                 void *p;
 
-                if (!silence.memblock) {
-                    pa_memchunk silence_tmp;
-
-                    pa_memchunk_reset(&silence_tmp);
-                    silence_tmp.memblock = pa_memblock_new(u->core->mempool, 4096);
-                    silence_tmp.length = 4096;
-                    p = pa_memblock_acquire(silence_tmp.memblock);
-                      memset(p, 0, 4096);
-                    pa_memblock_release(silence_tmp.memblock);
-                    pa_raop_client_encode_sample(u->raop, &silence_tmp, &silence);
-                    pa_assert(0 == silence_tmp.length);
-                    silence_overhead = silence_tmp.length - 4096;
-                    silence_ratio = silence_tmp.length / 4096;
-                    pa_memblock_unref(silence_tmp.memblock);
-                }
-
-                for (;;) {
+                while (next_encoded_chunk(u)) {
                     ssize_t l;
 
-                    if (u->encoded_memchunk.length <= 0) {
-                        if (u->encoded_memchunk.memblock)
-                            pa_memblock_unref(u->encoded_memchunk.memblock);
-                        if (PA_SINK_IS_OPENED(u->sink->thread_info.state)) {
-                            size_t rl;
-
-                            /* We render real data */
-                            if (u->raw_memchunk.length <= 0) {
-                                if (u->raw_memchunk.memblock)
-                                    pa_memblock_unref(u->raw_memchunk.memblock);
-                                pa_memchunk_reset(&u->raw_memchunk);
-
-                                /* Grab unencoded data */
-                                pa_sink_render(u->sink, u->block_size, &u->raw_memchunk);
-                            }
-                            pa_assert(u->raw_memchunk.length > 0);
-
-                            /* Encode it */
-                            rl = u->raw_memchunk.length;
-                            u->encoding_overhead += u->next_encoding_overhead;
-                            pa_raop_client_encode_sample(u->raop, &u->raw_memchunk, &u->encoded_memchunk);
-                            u->next_encoding_overhead = (u->encoded_memchunk.length - (rl - u->raw_memchunk.length));
-                            u->encoding_ratio = u->encoded_memchunk.length / (rl - u->raw_memchunk.length);
-                        } else {
-                            /* We render some silence into our memchunk */
-                            memcpy(&u->encoded_memchunk, &silence, sizeof(pa_memchunk));
-                            pa_memblock_ref(silence.memblock);
-
-                            /* Calculate/store some values to be used with the smoother */
-                            u->next_encoding_overhead = silence_overhead;
-                            u->encoding_ratio = silence_ratio;
-                        }
-                    }
-                    pa_assert(u->encoded_memchunk.length > 0);
-
                     p = pa_memblock_acquire(u->encoded_memchunk.memblock);
                     l = pa_write(u->fd, (uint8_t*) p + u->encoded_memchunk.index, u->encoded_memchunk.length, &write_type);
                     pa_memblock_release(u->encoded_memchunk.memblock);
@@ -408,7 +660,7 @@ static void thread_func(void *userdata) {
 
                             /* OK, we filled all socket buffers up
                              * now. */
-                            goto filled_up;
+                            break;
 
                         } else {
                             pa_log("Failed to write data to FIFO: %s", pa_cstrerror(errno));
@@ -416,32 +668,28 @@ static void thread_func(void *userdata) {
                         }
 
                     } else {
-                        u->offset += l;
-
                         u->encoded_memchunk.index += l;
                         u->encoded_memchunk.length -= l;
+                        u->encoded_written += l;
 
                         pollfd->revents = 0;
 
-                        if (u->encoded_memchunk.length > 0) {
-                            /* we've completely written the encoded data, so update our overhead */
-                            u->encoding_overhead += u->next_encoding_overhead;
-
+                        if (u->encoded_memchunk.length > 0)
                             /* OK, we wrote less that we asked for,
                              * hence we can assume that the socket
                              * buffers are full now */
-                            goto filled_up;
-                        }
+                            break;
                     }
                 }
 
-            filled_up:
-
                 /* At this spot we know that the socket buffers are
-                 * fully filled up. This is the best time to estimate
-                 * the playback position of the server */
+                 * fully filled up, or that we have nothing more to
+                 * write. This is the best time to estimate the
+                 * playback position of the server */
 
-                n = u->offset - u->encoding_overhead;
+                n = u->offset;
+                if (u->encoded_memchunk.memblock)
+                    n += (int64_t) (u->encoded_written / u->encoding_ratio);
 
 #ifdef SIOCOUTQ
                 {
@@ -451,7 +699,7 @@ static void thread_func(void *userdata) {
                 }
 #endif
 
-                usec = pa_bytes_to_usec(n, &u->sink->sample_spec);
+                usec = n > 0 ? pa_bytes_to_usec(n, &u->sink->sample_spec) : 0;
 
                 if (usec > u->latency)
                     usec -= u->latency;
@@ -461,8 +709,13 @@ static void thread_func(void *userdata) {
                 pa_smoother_put(u->smoother, pa_rtclock_now(), usec);
             }
 
-            /* Hmm, nothing to do. Let's sleep */
-            pollfd->events = POLLOUT; /*PA_SINK_IS_OPENED(u->sink->thread_info.state)  ? POLLOUT : 0;*/
+            /* Keep the encoder one block ahead of the socket */
+            if (u->encoding + u->encoded_length < u->block_size)
+                encode_block(u);
+
+            /* Only wait for the socket if we have something to write */
+            if (u->protocol == PA_RAOP_PROTOCOL_TCP)
+                pollfd->events = (short) (u->encoded_memchunk.length > 0 || !pa_queue_isempty(u->encoded_q) ? POLLOUT : 0);
         }
 
         if ((ret = pa_rtpoll_run(u->rtpoll, TRUE)) < 0)
@@ -476,6 +729,23 @@ static void thread_func(void *userdata) {
 
             pollfd = pa_rtpoll_item_get_pollfd(u->rtpoll_item, NULL);
 
+            if (u->protocol == PA_RAOP_PROTOCOL_UDP) {
+                unsigned i;
+
+                /* A receiver that doesn't listen on one of its ports
+                 * makes the kernel report an error on our end. That is
+                 * no reason to give up, so we just clear it. */
+                for (i = 0; i < 3; i++)
+                    if (pollfd[i].revents & POLLERR) {
+                        int err;
+                        socklen_t l = sizeof(err);
+
+                        if (getsockopt(pollfd[i].fd, SOL_SOCKET, SO_ERROR, &err, &l) >= 0 && err != 0)
+                            pa_log_debug("UDP socket error: %s", pa_cstrerror(err));
+                        pollfd[i].revents &= ~POLLERR;
+                    }
+            }
+
             if (pollfd->revents & ~POLLOUT) {
                 if (u->sink->thread_info.state != PA_SINK_SUSPENDED) {
                     pa_log("FIFO shutdown.");
@@ -498,8 +768,6 @@ fail:
     pa_asyncmsgq_wait_for(u->thread_mq.inq, PA_MESSAGE_SHUTDOWN);
 
 finish:
-    if (silence.memblock)
-        pa_memblock_unref(silence.memblock);
     pa_log_debug("Thread shutting down");
 }
 
@@ -507,7 +775,8 @@ int pa__init(pa_module*m) {
     struct userdata *u = NULL;
     pa_sample_spec ss;
     pa_modargs *ma = NULL;
-    const char *server;
+    const char *server, *protocol;
+    uint32_t latency_msec = DEFAULT_UDP_LATENCY_MSEC;
     pa_sink_new_data data;
 
     pa_assert(m);
@@ -534,6 +803,7 @@ int pa__init(pa_module*m) {
     u->module = m;
     m->userdata = u;
     u->fd = -1;
+    u->control_fd = u->timing_fd = -1;
     u->smoother = pa_smoother_new(
             PA_USEC_PER_SEC,
             PA_USEC_PER_SEC*2,
@@ -542,12 +812,12 @@ int pa__init(pa_module*m) {
             10,
             0,
             FALSE);
-    pa_memchunk_reset(&u->raw_memchunk);
     pa_memchunk_reset(&u->encoded_memchunk);
+    u->rendered = 0;
     u->offset = 0;
-    u->encoding_overhead = 0;
-    u->next_encoding_overhead = 0;
     u->encoding_ratio = 1.0;
+    u->encoder_q = pa_asyncmsgq_new(0);
+    u->encoded_q = pa_queue_new();
 
     u->rtpoll = pa_rtpoll_new();
     pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll);
@@ -565,6 +835,39 @@ int pa__init(pa_module*m) {
     /*u->state = STATE_AUTH;*/
     u->latency = 0;
 
+    protocol = pa_modargs_get_value(ma, "protocol", "tcp");
+    if (pa_streq(protocol, "tcp"))
+        u->protocol = PA_RAOP_PROTOCOL_TCP;
+    else if (pa_streq(protocol, "udp"))
+        u->protocol = PA_RAOP_PROTOCOL_UDP;
+    else {
+        pa_log("Invalid protocol %s, expected tcp or udp.", protocol);
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_u32(ma, "latency_msec", &latency_msec) < 0 || latency_msec <= 0) {
+        pa_log("Invalid latency specification.");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_boolean(ma, "on_demand", &u->on_demand) < 0) {
+        pa_log("Failed to parse on_demand.");
+        goto fail;
+    }
+
+    if (u->protocol == PA_RAOP_PROTOCOL_UDP) {
+        size_t packet_size = PA_RAOP_UDP_FRAMES_PER_PACKET * pa_frame_size(&ss);
+
+        /* Blocks are cut into packets, so make them fit exactly */
+        u->block_size = PA_MAX(u->block_size / packet_size, 1U) * packet_size;
+        u->latency = latency_msec * PA_USEC_PER_MSEC;
+
+        /* Keep what the receiver may still ask for, which is at most
+         * what it buffers */
+        u->packet_buffer = pa_raop_packet_buffer_new((unsigned) (pa_usec_to_bytes(u->latency, &ss) / packet_size) + 1);
+        u->pacer = pa_raop_udp_pacer_new(&ss, UDP_MAX_LAG, UDP_SYNC_INTERVAL);
+    }
+
     if (!(server = pa_modargs_get_value(ma, "server", NULL))) {
         pa_log("No server argument given.");
         goto fail;
@@ -594,6 +897,7 @@ int pa__init(pa_module*m) {
     }
 
     u->sink->parent.process_msg = sink_process_msg;
+    u->sink->set_state = sink_set_state;
     u->sink->userdata = u;
     pa_sink_set_set_volume_callback(u->sink, sink_set_volume_cb);
     pa_sink_set_set_mute_callback(u->sink, sink_set_mute_cb);
@@ -602,14 +906,24 @@ int pa__init(pa_module*m) {
     pa_sink_set_asyncmsgq(u->sink, u->thread_mq.inq);
     pa_sink_set_rtpoll(u->sink, u->rtpoll);
 
-    if (!(u->raop = pa_raop_client_new(u->core, server))) {
-        pa_log("Failed to connect to server.");
+    if (!(u->raop = pa_raop_client_new(u->core, server, u->protocol))) {
+        pa_log("Failed to set up RAOP client for %s.", server);
         goto fail;
     }
 
     pa_raop_client_set_callback(u->raop, on_connection, u);
     pa_raop_client_set_closed_callback(u->raop, on_close, u);
 
+    if (!u->on_demand && pa_raop_connect(u->raop) < 0) {
+        pa_log("Failed to connect to server.");
+        goto fail;
+    }
+
+    if (!(u->encoder_thread = pa_thread_new("raop-encoder", encoder_thread_func, u))) {
+        pa_log("Failed to create encoder thread.");
+        goto fail;
+    }
+
     if (!(u->thread = pa_thread_new("raop-sink", thread_func, u))) {
         pa_log("Failed to create thread.");
         goto fail;
@@ -649,6 +963,12 @@ void pa__done(pa_module*m) {
     if (u->sink)
         pa_sink_unlink(u->sink);
 
+    /* The encoder goes first, as it posts to the IO thread */
+    if (u->encoder_thread) {
+        pa_asyncmsgq_send(u->encoder_q, NULL, PA_MESSAGE_SHUTDOWN, NULL, 0, NULL);
+        pa_thread_free(u->encoder_thread);
+    }
+
     if (u->thread) {
         pa_asyncmsgq_send(u->thread_mq.inq, NULL, PA_MESSAGE_SHUTDOWN, NULL, 0, NULL);
         pa_thread_free(u->thread);
@@ -665,12 +985,27 @@ void pa__done(pa_module*m) {
     if (u->rtpoll)
         pa_rtpoll_free(u->rtpoll);
 
-    if (u->raw_memchunk.memblock)
-        pa_memblock_unref(u->raw_memchunk.memblock);
+    if (u->encoder_q)
+        pa_asyncmsgq_unref(u->encoder_q);
+
+    if (u->encoded_q)
+        pa_queue_free(u->encoded_q, encoded_chunk_free);
 
     if (u->encoded_memchunk.memblock)
         pa_memblock_unref(u->encoded_memchunk.memblock);
 
+    if (u->packet_buffer)
+        pa_raop_packet_buffer_free(u->packet_buffer);
+
+    if (u->pacer)
+        pa_raop_udp_pacer_free(u->pacer);
+
+    if (u->control_fd >= 0)
+        pa_close(u->control_fd);
+
+    if (u->timing_fd >= 0)
+        pa_close(u->timing_fd);
+
     if (u->raop)
         pa_raop_client_free(u->raop);
 
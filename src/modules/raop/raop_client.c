@@ -28,6 +28,9 @@
 #include <errno.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
 
 #ifdef HAVE_SYS_FILIO_H
 #include <sys/filio.h>
@@ -36,7 +39,6 @@
 /* TODO: Replace OpenSSL with NSS */
 #include <openssl/err.h>
 #include <openssl/rand.h>
-#include <openssl/aes.h>
 #include <openssl/rsa.h>
 #include <openssl/engine.h>
 
@@ -55,8 +57,10 @@
 #include "raop_client.h"
 #include "rtsp_client.h"
 #include "base64.h"
+#include "raop_encoder.h"
+#include "raop_udp.h"
 
-#define AES_CHUNKSIZE 16
+#define AES_CHUNKSIZE PA_RAOP_AES_KEY_SIZE
 
 #define JACK_STATUS_DISCONNECTED 0
 #define JACK_STATUS_CONNECTED 1
@@ -70,20 +74,25 @@
 
 #define RAOP_PORT 5000
 
+/* Frames per ALAC frame, as announced in the SDP */
+#define TCP_FRAMES_PER_PACKET 4096
+
+#define TCP_HEADER_SIZE 16
+
 struct pa_raop_client {
     pa_core *core;
     char *host;
     uint16_t port;
     char *sid;
     pa_rtsp_client *rtsp;
+    pa_raop_protocol_t protocol;
 
     uint8_t jack_type;
     uint8_t jack_status;
 
     /* Encryption Related bits */
-    AES_KEY aes;
+    pa_raop_encoder *encoder;
     uint8_t aes_iv[AES_CHUNKSIZE]; /* initialization vector for aes-cbc */
-    uint8_t aes_nv[AES_CHUNKSIZE]; /* next vector for aes-cbc */
     uint8_t aes_key[AES_CHUNKSIZE]; /* key for aes-cbc */
 
     pa_socket_client *sc;
@@ -92,64 +101,20 @@ struct pa_raop_client {
     uint16_t seq;
     uint32_t rtptime;
 
+    /* UDP only: our ends of the control and timing channels, until
+     * they are handed over, and the receiver's ports */
+    int family;
+    int udp_control_fd, udp_timing_fd;
+    uint16_t udp_control_port, udp_timing_port;
+    uint32_t ssrc;
+    pa_bool_t marker;
+
     pa_raop_client_cb_t callback;
     void* userdata;
     pa_raop_client_closed_cb_t closed_callback;
     void* closed_userdata;
 };
 
-/**
- * Function to write bits into a buffer.
- * @param buffer Handle to the buffer. It will be incremented if new data requires it.
- * @param bit_pos A pointer to a position buffer to keep track the current write location (0 for MSB, 7 for LSB)
- * @param size A pointer to the byte size currently written. This allows the calling function to do simple buffer overflow checks
- * @param data The data to write
- * @param data_bit_len The number of bits from data to write
- */
-static inline void bit_writer(uint8_t **buffer, uint8_t *bit_pos, int *size, uint8_t data, uint8_t data_bit_len) {
-    int bits_left, bit_overflow;
-    uint8_t bit_data;
-
-    if (!data_bit_len)
-        return;
-
-    /* If bit pos is zero, we will definately use at least one bit from the current byte so size increments. */
-    if (!*bit_pos)
-        *size += 1;
-
-    /* Calc the number of bits left in the current byte of buffer */
-    bits_left = 7 - *bit_pos  + 1;
-    /* Calc the overflow of bits in relation to how much space we have left... */
-    bit_overflow = bits_left - data_bit_len;
-    if (bit_overflow >= 0) {
-        /* We can fit the new data in our current byte */
-        /* As we write from MSB->LSB we need to left shift by the overflow amount */
-        bit_data = data << bit_overflow;
-        if (*bit_pos)
-            **buffer |= bit_data;
-        else
-            **buffer = bit_data;
-        /* If our data fits exactly into the current byte, we need to increment our pointer */
-        if (0 == bit_overflow) {
-            /* Do not increment size as it will be incremented on next call as bit_pos is zero */
-            *buffer += 1;
-            *bit_pos = 0;
-        } else {
-            *bit_pos += data_bit_len;
-        }
-    } else {
-        /* bit_overflow is negative, there for we will need a new byte from our buffer */
-        /* Firstly fill up what's left in the current byte */
-        bit_data = data >> -bit_overflow;
-        **buffer |= bit_data;
-        /* Increment our buffer pointer and size counter*/
-        *buffer += 1;
-        *size += 1;
-        **buffer = data << (8 + bit_overflow);
-        *bit_pos = -bit_overflow;
-    }
-}
-
 static int rsa_encrypt(uint8_t *text, int len, uint8_t *res) {
     const char n[] =
         "59dE8qLieItsH1WgjrcFRKj6eUWqi+bGLOX1HL3U3GhC/j0Qg90u3sG/1CUtwC"
@@ -175,25 +140,85 @@ static int rsa_encrypt(uint8_t *text, int len, uint8_t *res) {
     return size;
 }
 
-static int aes_encrypt(pa_raop_client* c, uint8_t *data, int size) {
-    uint8_t *buf;
-    int i=0, j;
+static int open_udp_socket(int family, uint16_t *port) {
+    union {
+        struct sockaddr sa;
+        struct sockaddr_in in;
+#ifdef HAVE_IPV6
+        struct sockaddr_in6 in6;
+#endif
+    } sa;
+    socklen_t salen;
+    int fd;
+
+    if ((fd = pa_socket_cloexec(family, SOCK_DGRAM, 0)) < 0) {
+        pa_log("socket() failed: %s", pa_cstrerror(errno));
+        return -1;
+    }
 
-    pa_assert(c);
+    /* Any port will do, the receiver learns it from the SETUP */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa.sa_family = (sa_family_t) family;
+#ifdef HAVE_IPV6
+    salen = family == AF_INET6 ? sizeof(sa.in6) : sizeof(sa.in);
+#else
+    salen = sizeof(sa.in);
+#endif
+
+    if (bind(fd, &sa.sa, salen) < 0 || getsockname(fd, &sa.sa, &salen) < 0) {
+        pa_log("Failed to bind UDP socket: %s", pa_cstrerror(errno));
+        pa_close(fd);
+        return -1;
+    }
+
+#ifdef HAVE_IPV6
+    *port = ntohs(family == AF_INET6 ? sa.in6.sin6_port : sa.in.sin_port);
+#else
+    *port = ntohs(sa.in.sin_port);
+#endif
+
+    pa_make_fd_nonblock(fd);
+    pa_make_udp_socket_low_delay(fd);
 
-    memcpy(c->aes_nv, c->aes_iv, AES_CHUNKSIZE);
-    while (i+AES_CHUNKSIZE <= size) {
-        buf = data + i;
-        for (j=0; j<AES_CHUNKSIZE; ++j)
-            buf[j] ^= c->aes_nv[j];
+    return fd;
+}
+
+static int connect_udp_socket(pa_raop_client *c, int fd, uint16_t port) {
+    struct addrinfo hints, *res = NULL;
+    char service[6];
+    int r;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = c->family;
+    hints.ai_socktype = SOCK_DGRAM;
+    pa_snprintf(service, sizeof(service), "%u", port);
+
+    if ((r = getaddrinfo(c->host, service, &hints, &res)) != 0 || !res) {
+        pa_log("Failed to resolve '%s': %s", c->host, gai_strerror(r));
+        return -1;
+    }
 
-        AES_encrypt(buf, buf, &c->aes);
-        memcpy(c->aes_nv, buf, AES_CHUNKSIZE);
-        i += AES_CHUNKSIZE;
+    r = connect(fd, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+
+    if (r < 0) {
+        pa_log("Failed to connect UDP socket to port %u: %s", port, pa_cstrerror(errno));
+        return -1;
     }
-    return i;
+
+    return 0;
+}
+
+static void close_udp_sockets(pa_raop_client *c) {
+    if (c->udp_control_fd >= 0)
+        pa_close(c->udp_control_fd);
+    if (c->udp_timing_fd >= 0)
+        pa_close(c->udp_timing_fd);
+
+    c->udp_control_fd = c->udp_timing_fd = -1;
 }
 
+/* Gets a port like control_port=6001 out of a Transport header */
 static inline void rtrimchar(char *str, char rc) {
     char *sp = str + strlen(str) - 1;
     while (sp >= str && *sp == rc) {
@@ -252,6 +277,17 @@ static void rtsp_cb(pa_rtsp_client *rtsp, pa_rtsp_state state, pa_headerlist* he
             pa_rtsp_set_url(c->rtsp, url);
             pa_xfree(url);
 
+            if (c->protocol == PA_RAOP_PROTOCOL_UDP) {
+                c->family = strchr(ip, ':') ? AF_INET6 : AF_INET;
+
+                close_udp_sockets(c);
+                if ((c->udp_control_fd = open_udp_socket(c->family, &c->udp_control_port)) < 0 ||
+                    (c->udp_timing_fd = open_udp_socket(c->family, &c->udp_timing_port)) < 0) {
+                    close_udp_sockets(c);
+                    return;
+                }
+            }
+
             /* Now encrypt our aes_public key to send to the device */
             i = rsa_encrypt(c->aes_key, AES_CHUNKSIZE, rsakey);
             pa_base64_encode(rsakey, i, &key);
@@ -271,10 +307,12 @@ static void rtsp_cb(pa_rtsp_client *rtsp, pa_rtsp_state state, pa_headerlist* he
                 "t=0 0\r\n"
                 "m=audio 0 RTP/AVP 96\r\n"
                 "a=rtpmap:96 AppleLossless\r\n"
-                "a=fmtp:96 4096 0 16 40 10 14 2 255 0 0 44100\r\n"
+                "a=fmtp:96 %u 0 16 40 10 14 2 255 0 0 44100\r\n"
                 "a=rsaaeskey:%s\r\n"
                 "a=aesiv:%s\r\n",
-                c->sid, ip, c->host, key, iv);
+                c->sid, ip, c->host,
+                c->protocol == PA_RAOP_PROTOCOL_UDP ? PA_RAOP_UDP_FRAMES_PER_PACKET : TCP_FRAMES_PER_PACKET,
+                key, iv);
             pa_rtsp_announce(c->rtsp, sdp);
             pa_xfree(key);
             pa_xfree(iv);
@@ -283,11 +321,20 @@ static void rtsp_cb(pa_rtsp_client *rtsp, pa_rtsp_state state, pa_headerlist* he
             break;
         }
 
-        case STATE_ANNOUNCE:
+        case STATE_ANNOUNCE: {
+            char *transport = NULL;
+
             pa_log_debug("RAOP: ANNOUNCED");
             pa_rtsp_remove_header(c->rtsp, "Apple-Challenge");
-            pa_rtsp_setup(c->rtsp);
+
+            if (c->protocol == PA_RAOP_PROTOCOL_UDP)
+                transport = pa_sprintf_malloc("RTP/AVP/UDP;unicast;interleaved=0-1;mode=record;control_port=%u;timing_port=%u",
+                                              c->udp_control_port, c->udp_timing_port);
+
+            pa_rtsp_setup(c->rtsp, transport);
+            pa_xfree(transport);
             break;
+        }
 
         case STATE_SETUP: {
             char *aj = pa_xstrdup(pa_headerlist_gets(headers, "Audio-Jack-Status"));
@@ -315,6 +362,18 @@ static void rtsp_cb(pa_rtsp_client *rtsp, pa_rtsp_state state, pa_headerlist* he
             } else {
                 pa_log_warn("Audio Jack Status missing");
             }
+
+            if (c->protocol == PA_RAOP_PROTOCOL_UDP) {
+                const char *transport = pa_headerlist_gets(headers, "Transport");
+
+                if (!transport ||
+                    pa_raop_udp_parse_transport_port(transport, "control_port", &c->udp_control_port) < 0 ||
+                    pa_raop_udp_parse_transport_port(transport, "timing_port", &c->udp_timing_port) < 0) {
+                    pa_log("Receiver didn't give us its control and timing ports.");
+                    return;
+                }
+            }
+
             pa_rtsp_record(c->rtsp, &c->seq, &c->rtptime);
             break;
         }
@@ -323,6 +382,29 @@ static void rtsp_cb(pa_rtsp_client *rtsp, pa_rtsp_state state, pa_headerlist* he
             uint32_t port = pa_rtsp_serverport(c->rtsp);
             pa_log_debug("RAOP: RECORDED");
 
+            if (c->protocol == PA_RAOP_PROTOCOL_UDP) {
+                uint16_t local_port;
+                int fd;
+
+                /* There is nothing to wait for, a datagram socket is
+                 * ready as soon as it is connected */
+                if ((fd = open_udp_socket(c->family, &local_port)) < 0)
+                    return;
+
+                if (connect_udp_socket(c, fd, (uint16_t) port) < 0 ||
+                    connect_udp_socket(c, c->udp_control_fd, c->udp_control_port) < 0) {
+                    pa_close(fd);
+                    return;
+                }
+
+                c->fd = fd;
+                c->marker = TRUE;
+
+                pa_log_debug("Sending audio to port %u, control to port %u", port, c->udp_control_port);
+                c->callback(c->fd, c->userdata);
+                return;
+            }
+
             if (!(c->sc = pa_socket_client_new_string(c->core->mainloop, TRUE, c->host, port))) {
                 pa_log("failed to connect to server '%s:%d'", c->host, port);
                 return;
@@ -358,6 +440,7 @@ static void rtsp_cb(pa_rtsp_client *rtsp, pa_rtsp_state state, pa_headerlist* he
                 pa_socket_client_unref(c->sc);
                 c->sc = NULL;
             }
+            close_udp_sockets(c);
             pa_xfree(c->sid);
             c->sid = NULL;
             c->closed_callback(c->closed_userdata);
@@ -365,7 +448,7 @@ static void rtsp_cb(pa_rtsp_client *rtsp, pa_rtsp_state state, pa_headerlist* he
     }
 }
 
-pa_raop_client* pa_raop_client_new(pa_core *core, const char* host) {
+pa_raop_client* pa_raop_client_new(pa_core *core, const char* host, pa_raop_protocol_t protocol) {
     pa_parsed_address a;
     pa_raop_client* c = pa_xnew0(pa_raop_client, 1);
 
@@ -377,6 +460,13 @@ pa_raop_client* pa_raop_client_new(pa_core *core, const char* host) {
 
     c->core = core;
     c->fd = -1;
+    c->protocol = protocol;
+    c->udp_control_fd = c->udp_timing_fd = -1;
+
+    if (!(c->encoder = pa_raop_encoder_new(core->mempool))) {
+        pa_xfree(c);
+        return NULL;
+    }
 
     c->host = pa_xstrdup(a.path_or_host);
     if (a.port)
@@ -384,10 +474,6 @@ pa_raop_client* pa_raop_client_new(pa_core *core, const char* host) {
     else
         c->port = RAOP_PORT;
 
-    if (pa_raop_connect(c)) {
-        pa_raop_client_free(c);
-        return NULL;
-    }
     return c;
 }
 
@@ -398,6 +484,9 @@ void pa_raop_client_free(pa_raop_client* c) {
         pa_rtsp_client_free(c->rtsp);
     if (c->sid)
         pa_xfree(c->sid);
+    if (c->encoder)
+        pa_raop_encoder_free(c->encoder);
+    close_udp_sockets(c);
     pa_xfree(c->host);
     pa_xfree(c);
 }
@@ -417,13 +506,15 @@ int pa_raop_connect(pa_raop_client* c) {
         return 0;
     }
 
-    c->rtsp = pa_rtsp_client_new(c->core->mainloop, c->host, c->port, "iTunes/4.6 (Macintosh; U; PPC Mac OS X 10.3)");
-
     /* Initialise the AES encryption system */
     pa_random(c->aes_iv, sizeof(c->aes_iv));
     pa_random(c->aes_key, sizeof(c->aes_key));
-    memcpy(c->aes_nv, c->aes_iv, sizeof(c->aes_nv));
-    AES_set_encrypt_key(c->aes_key, 128, &c->aes);
+    if (pa_raop_encoder_set_key(c->encoder, c->aes_key, c->aes_iv) < 0)
+        return -1;
+
+    c->rtsp = pa_rtsp_client_new(c->core->mainloop, c->host, c->port, "iTunes/4.6 (Macintosh; U; PPC Mac OS X 10.3)");
+
+    pa_random(&c->ssrc, sizeof(c->ssrc));
 
     /* Generate random instance id */
     pa_random(&rand_data, sizeof(rand_data));
@@ -439,6 +530,7 @@ int pa_raop_flush(pa_raop_client* c) {
     pa_assert(c);
 
     pa_rtsp_flush(c->rtsp, c->seq, c->rtptime);
+    c->marker = TRUE;
     return 0;
 }
 
@@ -449,6 +541,10 @@ int pa_raop_client_set_volume(pa_raop_client* c, pa_volume_t volume) {
 
     pa_assert(c);
 
+    /* Not connected; the volume is set again once we are */
+    if (!c->rtsp)
+        return 0;
+
     db = pa_sw_volume_to_dB(volume);
     if (db < VOLUME_MIN)
         db = VOLUME_MIN;
@@ -464,86 +560,54 @@ int pa_raop_client_set_volume(pa_raop_client* c, pa_volume_t volume) {
 }
 
 int pa_raop_client_encode_sample(pa_raop_client* c, pa_memchunk* raw, pa_memchunk* encoded) {
-    uint16_t len;
-    size_t bufmax;
-    uint8_t *bp, bpos;
-    uint8_t *ibp, *maxibp;
-    int size;
-    uint8_t *b, *p;
-    uint32_t bsize;
-    size_t length;
-    static uint8_t header[] = {
+    static const uint8_t tcp_header[TCP_HEADER_SIZE] = {
         0x24, 0x00, 0x00, 0x00,
         0xF0, 0xFF, 0x00, 0x00,
         0x00, 0x00, 0x00, 0x00,
         0x00, 0x00, 0x00, 0x00,
     };
-    int header_size = sizeof(header);
+    uint8_t *b;
 
     pa_assert(c);
-    pa_assert(c->fd > 0);
     pa_assert(raw);
-    pa_assert(raw->memblock);
-    pa_assert(raw->length > 0);
     pa_assert(encoded);
 
-    /* We have to send 4 byte chunks */
-    bsize = (int)(raw->length / 4);
-    length = bsize * 4;
+    /* The sequence number and timestamp belong to the sending side,
+     * which may have flushed in the meantime */
+    if (c->protocol == PA_RAOP_PROTOCOL_UDP)
+        return pa_raop_encoder_encode(c->encoder, raw, PA_RAOP_UDP_FRAMES_PER_PACKET * 4, PA_RAOP_UDP_HEADER_SIZE, encoded);
 
-    /* Leave 16 bytes extra to allow for the ALAC header which is about 55 bits */
-    bufmax = length + header_size + 16;
-    pa_memchunk_reset(encoded);
-    encoded->memblock = pa_memblock_new(c->core->mempool, bufmax);
-    b = pa_memblock_acquire(encoded->memblock);
-    memcpy(b, header, header_size);
-
-    /* Now write the actual samples */
-    bp = b + header_size;
-    size = bpos = 0;
-    bit_writer(&bp,&bpos,&size,1,3); /* channel=1, stereo */
-    bit_writer(&bp,&bpos,&size,0,4); /* unknown */
-    bit_writer(&bp,&bpos,&size,0,8); /* unknown */
-    bit_writer(&bp,&bpos,&size,0,4); /* unknown */
-    bit_writer(&bp,&bpos,&size,1,1); /* hassize */
-    bit_writer(&bp,&bpos,&size,0,2); /* unused */
-    bit_writer(&bp,&bpos,&size,1,1); /* is-not-compressed */
-
-    /* size of data, integer, big endian */
-    bit_writer(&bp,&bpos,&size,(bsize>>24)&0xff,8);
-    bit_writer(&bp,&bpos,&size,(bsize>>16)&0xff,8);
-    bit_writer(&bp,&bpos,&size,(bsize>>8)&0xff,8);
-    bit_writer(&bp,&bpos,&size,(bsize)&0xff,8);
-
-    ibp = p = pa_memblock_acquire(raw->memblock);
-    maxibp = p + raw->length - 4;
-    while (ibp <= maxibp) {
-        /* Byte swap stereo data */
-        bit_writer(&bp,&bpos,&size,*(ibp+1),8);
-        bit_writer(&bp,&bpos,&size,*(ibp+0),8);
-        bit_writer(&bp,&bpos,&size,*(ibp+3),8);
-        bit_writer(&bp,&bpos,&size,*(ibp+2),8);
-        ibp += 4;
-        raw->index += 4;
-        raw->length -= 4;
-    }
-    pa_memblock_release(raw->memblock);
-    encoded->length = header_size + size;
-
-    /* store the length (endian swapped: make this better) */
-    len = size + header_size - 4;
-    *(b + 2) = len >> 8;
-    *(b + 3) = len & 0xff;
+    if (pa_raop_encoder_encode(c->encoder, raw, (size_t) -1, TCP_HEADER_SIZE, encoded) < 0)
+        return -1;
 
-    /* encrypt our data */
-    aes_encrypt(c, (b + header_size), size);
+    b = pa_memblock_acquire(encoded->memblock);
+    memcpy(b, tcp_header, TCP_HEADER_SIZE);
 
-    /* We're done with the chunk */
+    /* Store the length, not counting the first 4 bytes */
+    b[2] = (uint8_t) ((encoded->length - 4) >> 8);
+    b[3] = (uint8_t) ((encoded->length - 4) & 0xff);
     pa_memblock_release(encoded->memblock);
 
     return 0;
 }
 
+void pa_raop_client_stamp_udp_packet(pa_raop_client* c, pa_memchunk* packet, size_t frames) {
+    uint8_t *b;
+
+    pa_assert(c);
+    pa_assert(c->protocol == PA_RAOP_PROTOCOL_UDP);
+    pa_assert(packet);
+    pa_assert(packet->length >= PA_RAOP_UDP_HEADER_SIZE);
+
+    b = pa_memblock_acquire(packet->memblock);
+    pa_raop_udp_write_header(b + packet->index, c->seq, c->rtptime, c->ssrc, c->marker);
+    pa_memblock_release(packet->memblock);
+
+    c->seq++;
+    c->rtptime += (uint32_t) frames;
+    c->marker = FALSE;
+}
+
 void pa_raop_client_set_callback(pa_raop_client* c, pa_raop_client_cb_t callback, void *userdata) {
     pa_assert(c);
 
@@ -551,6 +615,17 @@ void pa_raop_client_set_callback(pa_raop_client* c, pa_raop_client_cb_t callback
     c->userdata = userdata;
 }
 
+void pa_raop_client_take_udp_fds(pa_raop_client* c, int *control_fd, int *timing_fd) {
+    pa_assert(c);
+    pa_assert(c->protocol == PA_RAOP_PROTOCOL_UDP);
+    pa_assert(control_fd);
+    pa_assert(timing_fd);
+
+    *control_fd = c->udp_control_fd;
+    *timing_fd = c->udp_timing_fd;
+    c->udp_control_fd = c->udp_timing_fd = -1;
+}
+
 void pa_raop_client_set_closed_callback(pa_raop_client* c, pa_raop_client_closed_cb_t callback, void *userdata) {
     pa_assert(c);
 
@@ -26,18 +26,39 @@
 
 typedef struct pa_raop_client pa_raop_client;
 
-pa_raop_client* pa_raop_client_new(pa_core *core, const char* host);
+typedef enum pa_raop_protocol {
+    /* Audio interleaved with RTSP over TCP */
+    PA_RAOP_PROTOCOL_TCP,
+    /* Audio, control and timing channels over UDP, see raop_udp.h */
+    PA_RAOP_PROTOCOL_UDP
+} pa_raop_protocol_t;
+
+/* Doesn't connect yet, that is up to pa_raop_connect() */
+pa_raop_client* pa_raop_client_new(pa_core *core, const char* host, pa_raop_protocol_t protocol);
 void pa_raop_client_free(pa_raop_client* c);
 
 int pa_raop_connect(pa_raop_client* c);
 int pa_raop_flush(pa_raop_client* c);
 
 int pa_raop_client_set_volume(pa_raop_client* c, pa_volume_t volume);
+/* With TCP, encodes all of raw. With UDP, encodes one packet and
+ * leaves the rest of raw for the next ones, and its RTP header is left
+ * to pa_raop_client_stamp_udp_packet(). */
 int pa_raop_client_encode_sample(pa_raop_client* c, pa_memchunk* raw, pa_memchunk* encoded);
 
+/* UDP only: writes the RTP header of the next packet to send, which
+ * holds frames frames. Called from the thread that sends the audio and
+ * calls pa_raop_flush(), in the order the packets are sent. */
+void pa_raop_client_stamp_udp_packet(pa_raop_client* c, pa_memchunk* packet, size_t frames);
+
 typedef void (*pa_raop_client_cb_t)(int fd, void *userdata);
 void pa_raop_client_set_callback(pa_raop_client* c, pa_raop_client_cb_t callback, void *userdata);
 
+/* UDP only: hands over the control and timing channels of the
+ * connection that was passed to the callback last. Like the audio fd,
+ * they are the caller's to close then. */
+void pa_raop_client_take_udp_fds(pa_raop_client* c, int *control_fd, int *timing_fd);
+
 typedef void (*pa_raop_client_closed_cb_t)(void *userdata);
 void pa_raop_client_set_closed_callback(pa_raop_client* c, pa_raop_client_closed_cb_t callback, void *userdata);
 
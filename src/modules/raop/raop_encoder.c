@@ -0,0 +1,212 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <openssl/evp.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/mutex.h>
+
+#include "raop_encoder.h"
+
+/* The ALAC frame header is 55 bits long: the channel count, a few
+ * unused fields, the has-size and is-not-compressed flags and the
+ * 32 bit size. */
+#define ALAC_HEADER_BITS 55
+#define ALAC_HEADER_SIZE ((ALAC_HEADER_BITS + 7) / 8)
+
+struct pa_raop_encoder {
+    pa_mempool *mempool;
+
+    /* Only ever touched by the thread that encodes */
+    EVP_CIPHER_CTX *cipher;
+    uint8_t iv[PA_RAOP_AES_KEY_SIZE];
+
+    /* A new key is handed over here and picked up with the next
+     * frame, so that setting it doesn't pull the cipher context out
+     * from under a frame being encrypted */
+    pa_mutex *mutex;
+    uint8_t pending_key[PA_RAOP_AES_KEY_SIZE];
+    uint8_t pending_iv[PA_RAOP_AES_KEY_SIZE];
+    pa_bool_t key_pending;
+    pa_bool_t have_key;
+};
+
+pa_raop_encoder* pa_raop_encoder_new(pa_mempool *pool) {
+    pa_raop_encoder *e;
+
+    pa_assert(pool);
+
+    e = pa_xnew0(pa_raop_encoder, 1);
+    e->mempool = pool;
+
+    if (!(e->cipher = EVP_CIPHER_CTX_new())) {
+        pa_log("Failed to allocate cipher context.");
+        pa_xfree(e);
+        return NULL;
+    }
+
+    e->mutex = pa_mutex_new(FALSE, FALSE);
+
+    return e;
+}
+
+void pa_raop_encoder_free(pa_raop_encoder *e) {
+    pa_assert(e);
+
+    EVP_CIPHER_CTX_free(e->cipher);
+    pa_mutex_free(e->mutex);
+    pa_xfree(e);
+}
+
+int pa_raop_encoder_set_key(pa_raop_encoder *e, const uint8_t key[PA_RAOP_AES_KEY_SIZE], const uint8_t iv[PA_RAOP_AES_KEY_SIZE]) {
+    pa_assert(e);
+    pa_assert(key);
+    pa_assert(iv);
+
+    pa_mutex_lock(e->mutex);
+    memcpy(e->pending_key, key, sizeof(e->pending_key));
+    memcpy(e->pending_iv, iv, sizeof(e->pending_iv));
+    e->key_pending = TRUE;
+    e->have_key = TRUE;
+    pa_mutex_unlock(e->mutex);
+
+    return 0;
+}
+
+/* Called from the encoding thread */
+static int apply_pending_key(pa_raop_encoder *e) {
+    uint8_t key[PA_RAOP_AES_KEY_SIZE];
+    pa_bool_t pending;
+
+    pa_mutex_lock(e->mutex);
+    pa_assert(e->have_key);
+
+    if ((pending = e->key_pending)) {
+        memcpy(key, e->pending_key, sizeof(key));
+        memcpy(e->iv, e->pending_iv, sizeof(e->iv));
+        e->key_pending = FALSE;
+    }
+
+    pa_mutex_unlock(e->mutex);
+
+    if (!pending)
+        return 0;
+
+    /* The trailing partial block of a frame is sent in the clear, so
+     * there is never anything to pad */
+    if (!EVP_EncryptInit_ex(e->cipher, EVP_aes_128_cbc(), NULL, key, e->iv) ||
+        !EVP_CIPHER_CTX_set_padding(e->cipher, 0)) {
+        pa_log("Failed to set up AES encryption.");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int encrypt(pa_raop_encoder *e, uint8_t *data, size_t size) {
+    int l;
+
+    size -= size % PA_RAOP_AES_KEY_SIZE;
+    if (size <= 0)
+        return 0;
+
+    /* Each frame starts a new CBC chain from the same IV */
+    if (!EVP_EncryptInit_ex(e->cipher, NULL, NULL, NULL, e->iv) ||
+        !EVP_EncryptUpdate(e->cipher, data, &l, data, (int) size))
+        return -1;
+
+    pa_assert((size_t) l == size);
+    return 0;
+}
+
+int pa_raop_encoder_encode(pa_raop_encoder *e, pa_memchunk *raw, size_t max_length, size_t headroom, pa_memchunk *encoded) {
+    uint8_t *b, *bp;
+    const uint8_t *ibp;
+    uint32_t bsize, i;
+    uint64_t h;
+    size_t size;
+
+    pa_assert(e);
+    pa_assert(raw);
+    pa_assert(raw->memblock);
+    pa_assert(raw->length > 0);
+    pa_assert(encoded);
+
+    if (apply_pending_key(e) < 0)
+        return -1;
+
+    /* We have to send 4 byte chunks */
+    bsize = (uint32_t) (PA_MIN(raw->length, max_length) / 4);
+    size = ALAC_HEADER_SIZE + (size_t) bsize * 4;
+
+    pa_memchunk_reset(encoded);
+    encoded->memblock = pa_memblock_new(e->mempool, headroom + size);
+    b = pa_memblock_acquire(encoded->memblock);
+
+    /* 3 bits of channel=1 (stereo) at bit 52, 16 unknown bits (4+8+4),
+     * hassize at bit 35, 2 unused bits, is-not-compressed at bit 32,
+     * then the 32 bit size in big endian. That makes 55 bits, left
+     * aligned so that the first sample bit goes into the LSB of the
+     * last header byte. */
+    h = ((UINT64_C(1) << 52) | (UINT64_C(1) << 35) | (UINT64_C(1) << 32) | bsize) << 1;
+
+    bp = b + headroom;
+    for (i = 0; i < ALAC_HEADER_SIZE; i++)
+        bp[i] = (uint8_t) (h >> (8 * (ALAC_HEADER_SIZE - 1 - i)));
+
+    /* Since the header leaves us one bit short of a byte boundary,
+     * each output byte takes 7 bits from one sample byte and 1 bit
+     * from the next. The samples are byte swapped on the way. */
+    ibp = (const uint8_t*) pa_memblock_acquire(raw->memblock) + raw->index;
+    bp += ALAC_HEADER_SIZE - 1;
+
+    for (i = 0; i < bsize; i++, ibp += 4, bp += 4) {
+        bp[0] |= ibp[1] >> 7;
+        bp[1] = (uint8_t) (ibp[1] << 1) | (ibp[0] >> 7);
+        bp[2] = (uint8_t) (ibp[0] << 1) | (ibp[3] >> 7);
+        bp[3] = (uint8_t) (ibp[3] << 1) | (ibp[2] >> 7);
+        bp[4] = (uint8_t) (ibp[2] << 1);
+    }
+
+    pa_memblock_release(raw->memblock);
+    raw->index += (size_t) bsize * 4;
+    raw->length -= (size_t) bsize * 4;
+
+    if (encrypt(e, b + headroom, size) < 0) {
+        pa_log("Failed to encrypt audio data.");
+        pa_memblock_release(encoded->memblock);
+        pa_memblock_unref(encoded->memblock);
+        pa_memchunk_reset(encoded);
+        return -1;
+    }
+
+    pa_memblock_release(encoded->memblock);
+    encoded->length = headroom + size;
+
+    return 0;
+}
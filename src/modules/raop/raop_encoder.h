@@ -0,0 +1,53 @@
+#ifndef fooraopencoderfoo
+#define fooraopencoderfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <inttypes.h>
+
+#include <pulsecore/memblock.h>
+#include <pulsecore/memchunk.h>
+
+/* Packs 16 bit stereo PCM into uncompressed ALAC frames and encrypts
+ * them with AES-128-CBC, the way the RAOP audio stream carries them.
+ * Encryption goes through OpenSSL's EVP interface, which uses AES-NI
+ * and similar where the CPU has it. An encoder doesn't touch anything
+ * but itself, so it may be used from any one thread at a time, except
+ * for setting the key, which may happen from any thread. */
+
+#define PA_RAOP_AES_KEY_SIZE 16
+
+typedef struct pa_raop_encoder pa_raop_encoder;
+
+pa_raop_encoder* pa_raop_encoder_new(pa_mempool *pool);
+void pa_raop_encoder_free(pa_raop_encoder *e);
+
+/* Every frame is encrypted from the same initialization vector. The
+ * key takes effect with the next frame that is encoded, a frame being
+ * encoded at the same time still uses the old one. */
+int pa_raop_encoder_set_key(pa_raop_encoder *e, const uint8_t key[PA_RAOP_AES_KEY_SIZE], const uint8_t iv[PA_RAOP_AES_KEY_SIZE]);
+
+/* Encodes the whole frames of raw, but no more than max_length bytes
+ * of it, into one new memblock and drops them from raw. headroom bytes
+ * are left in front of the ALAC frame for the transport header, which
+ * the caller fills in. */
+int pa_raop_encoder_encode(pa_raop_encoder *e, pa_memchunk *raw, size_t max_length, size_t headroom, pa_memchunk *encoded);
+
+#endif
@@ -0,0 +1,401 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/memblock.h>
+
+#include "raop_udp.h"
+
+/* Payload types of the packets on the control and timing channels */
+#define PAYLOAD_TIMING_REQUEST 0x52
+#define PAYLOAD_TIMING_REPLY 0x53
+#define PAYLOAD_SYNC 0x54
+#define PAYLOAD_RETRANSMIT_REQUEST 0x55
+#define PAYLOAD_RETRANSMIT_REPLY 0x56
+
+#define PAYLOAD_AUDIO 0x60
+
+#define TIMING_PACKET_SIZE 32
+#define SYNC_PACKET_SIZE 20
+#define RETRANSMIT_REQUEST_SIZE 8
+
+/* Seconds from the NTP epoch (1900) to the Unix epoch (1970) */
+#define NTP_EPOCH_OFFSET 2208988800U
+
+struct packet_slot {
+    uint16_t seq;
+    pa_memchunk packet;
+};
+
+struct pa_raop_packet_buffer {
+    unsigned size;
+    struct packet_slot *slots;
+};
+
+struct pa_raop_udp_pacer {
+    pa_sample_spec sample_spec;
+    pa_usec_t max_lag, sync_interval;
+
+    /* The packet starting start_offset bytes into the stream was sent
+     * at start_time, 0 if we haven't started yet */
+    pa_usec_t start_time;
+    int64_t start_offset;
+
+    pa_usec_t next_sync;
+    pa_bool_t first_sync;
+};
+
+static void write_uint16(uint8_t *b, uint16_t v) {
+    b[0] = (uint8_t) (v >> 8);
+    b[1] = (uint8_t) v;
+}
+
+static void write_uint32(uint8_t *b, uint32_t v) {
+    b[0] = (uint8_t) (v >> 24);
+    b[1] = (uint8_t) (v >> 16);
+    b[2] = (uint8_t) (v >> 8);
+    b[3] = (uint8_t) v;
+}
+
+static uint16_t read_uint16(const uint8_t *b) {
+    return (uint16_t) ((b[0] << 8) | b[1]);
+}
+
+static void write_ntp_now(uint8_t *b) {
+    struct timeval now;
+
+    pa_gettimeofday(&now);
+    write_uint32(b, (uint32_t) now.tv_sec + NTP_EPOCH_OFFSET);
+    write_uint32(b + 4, (uint32_t) (((uint64_t) now.tv_usec << 32) / PA_USEC_PER_SEC));
+}
+
+pa_raop_packet_buffer* pa_raop_packet_buffer_new(unsigned size) {
+    pa_raop_packet_buffer *b;
+
+    pa_assert(size > 0);
+
+    b = pa_xnew(pa_raop_packet_buffer, 1);
+    b->size = size;
+    b->slots = pa_xnew0(struct packet_slot, size);
+
+    return b;
+}
+
+void pa_raop_packet_buffer_free(pa_raop_packet_buffer *b) {
+    pa_assert(b);
+
+    pa_raop_packet_buffer_reset(b);
+    pa_xfree(b->slots);
+    pa_xfree(b);
+}
+
+void pa_raop_packet_buffer_reset(pa_raop_packet_buffer *b) {
+    unsigned i;
+
+    pa_assert(b);
+
+    for (i = 0; i < b->size; i++)
+        if (b->slots[i].packet.memblock) {
+            pa_memblock_unref(b->slots[i].packet.memblock);
+            pa_memchunk_reset(&b->slots[i].packet);
+        }
+}
+
+void pa_raop_packet_buffer_write(pa_raop_packet_buffer *b, const pa_memchunk *packet) {
+    struct packet_slot *s;
+    const uint8_t *d;
+    uint16_t seq;
+
+    pa_assert(b);
+    pa_assert(packet);
+    pa_assert(packet->memblock);
+    pa_assert(packet->length >= PA_RAOP_UDP_HEADER_SIZE);
+
+    d = (const uint8_t*) pa_memblock_acquire(packet->memblock) + packet->index;
+    seq = read_uint16(d + 2);
+    pa_memblock_release(packet->memblock);
+
+    s = &b->slots[seq % b->size];
+
+    if (s->packet.memblock)
+        pa_memblock_unref(s->packet.memblock);
+
+    s->seq = seq;
+    s->packet = *packet;
+    pa_memblock_ref(s->packet.memblock);
+}
+
+const pa_memchunk* pa_raop_packet_buffer_read(pa_raop_packet_buffer *b, uint16_t seq) {
+    struct packet_slot *s;
+
+    pa_assert(b);
+
+    s = &b->slots[seq % b->size];
+
+    if (!s->packet.memblock || s->seq != seq)
+        return NULL;
+
+    return &s->packet;
+}
+
+pa_raop_udp_pacer* pa_raop_udp_pacer_new(const pa_sample_spec *ss, pa_usec_t max_lag, pa_usec_t sync_interval) {
+    pa_raop_udp_pacer *p;
+
+    pa_assert(ss);
+    pa_assert(pa_sample_spec_valid(ss));
+    pa_assert(sync_interval > 0);
+
+    p = pa_xnew0(pa_raop_udp_pacer, 1);
+    p->sample_spec = *ss;
+    p->max_lag = max_lag;
+    p->sync_interval = sync_interval;
+
+    return p;
+}
+
+void pa_raop_udp_pacer_free(pa_raop_udp_pacer *p) {
+    pa_assert(p);
+
+    pa_xfree(p);
+}
+
+void pa_raop_udp_pacer_reset(pa_raop_udp_pacer *p) {
+    pa_assert(p);
+
+    p->start_time = 0;
+}
+
+pa_usec_t pa_raop_udp_pacer_due(pa_raop_udp_pacer *p, pa_usec_t now, int64_t offset) {
+    pa_usec_t due;
+
+    pa_assert(p);
+    pa_assert(offset >= p->start_offset || p->start_time <= 0);
+
+    due = p->start_time + pa_bytes_to_usec((uint64_t) (offset - p->start_offset), &p->sample_spec);
+
+    if (p->start_time <= 0 || now > due + p->max_lag) {
+        /* Start over from the packet at hand */
+        if (p->start_time > 0)
+            pa_log_debug("Fell behind by %0.1f ms, starting over.", (double) (now - due) / PA_USEC_PER_MSEC);
+
+        p->first_sync = p->start_time <= 0;
+        p->start_time = due = now;
+        p->start_offset = offset;
+        p->next_sync = now;
+    }
+
+    return due;
+}
+
+pa_bool_t pa_raop_udp_pacer_sync(pa_raop_udp_pacer *p, pa_usec_t now, pa_bool_t *first) {
+    pa_assert(p);
+    pa_assert(p->start_time > 0);
+    pa_assert(first);
+
+    if (now < p->next_sync)
+        return FALSE;
+
+    *first = p->first_sync;
+    p->first_sync = FALSE;
+    p->next_sync += p->sync_interval;
+
+    return TRUE;
+}
+
+int pa_raop_udp_parse_transport_port(const char *transport, const char *name, uint16_t *port) {
+    const char *state = NULL;
+    size_t l;
+    char *token;
+    int r = -1;
+
+    pa_assert(transport);
+    pa_assert(name);
+    pa_assert(port);
+
+    l = strlen(name);
+
+    while ((token = pa_split(transport, ";", &state))) {
+        uint32_t v;
+
+        if (strncmp(token, name, l) == 0 && token[l] == '=' &&
+            pa_atou(token + l + 1, &v) >= 0 && v > 0 && v <= 0xffff) {
+            *port = (uint16_t) v;
+            r = 0;
+        }
+
+        pa_xfree(token);
+
+        if (r == 0)
+            break;
+    }
+
+    return r;
+}
+
+void pa_raop_udp_write_header(uint8_t *b, uint16_t seq, uint32_t rtptime, uint32_t ssrc, pa_bool_t marker) {
+    pa_assert(b);
+
+    b[0] = 0x80;
+    b[1] = (uint8_t) (PAYLOAD_AUDIO | (marker ? 0x80 : 0));
+    write_uint16(b + 2, seq);
+    write_uint32(b + 4, rtptime);
+    write_uint32(b + 8, ssrc);
+}
+
+int pa_raop_udp_send_sync(int fd, uint32_t rtptime, uint32_t latency, pa_bool_t first) {
+    uint8_t b[SYNC_PACKET_SIZE];
+
+    pa_assert(fd >= 0);
+
+    /* The extension bit marks the first one after RECORD or FLUSH */
+    b[0] = (uint8_t) (first ? 0x90 : 0x80);
+    b[1] = 0x80 | PAYLOAD_SYNC;
+    write_uint16(b + 2, 7);
+    write_uint32(b + 4, rtptime - latency);
+    write_ntp_now(b + 8);
+    write_uint32(b + 16, rtptime);
+
+    if (send(fd, b, sizeof(b), 0) != (ssize_t) sizeof(b)) {
+        pa_log_debug("Failed to send sync packet: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+int pa_raop_udp_handle_timing(int fd) {
+    uint8_t b[TIMING_PACKET_SIZE + 1];
+    struct sockaddr_storage sa;
+    socklen_t salen = sizeof(sa);
+    ssize_t r;
+
+    pa_assert(fd >= 0);
+
+    if ((r = recvfrom(fd, b, sizeof(b), 0, (struct sockaddr*) &sa, &salen)) < 0) {
+        if (errno == EAGAIN || errno == EINTR)
+            return 0;
+
+        pa_log_debug("Failed to receive timing packet: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    if (r != TIMING_PACKET_SIZE || (b[1] & 0x7f) != PAYLOAD_TIMING_REQUEST) {
+        pa_log_debug("Ignoring unexpected packet on the timing channel.");
+        return 0;
+    }
+
+    /* Our reply carries the time the request was sent at as origin,
+     * and our clock as the times we received it and sent the reply */
+    b[0] = 0x80;
+    b[1] = 0x80 | PAYLOAD_TIMING_REPLY;
+    write_uint16(b + 2, 7);
+    memset(b + 4, 0, 4);
+    memmove(b + 8, b + 24, 8);
+    write_ntp_now(b + 16);
+    memcpy(b + 24, b + 16, 8);
+
+    if (sendto(fd, b, TIMING_PACKET_SIZE, 0, (struct sockaddr*) &sa, salen) != TIMING_PACKET_SIZE) {
+        pa_log_debug("Failed to send timing packet: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    return 1;
+}
+
+int pa_raop_udp_handle_control(int fd, pa_raop_packet_buffer *b) {
+    uint8_t request[RETRANSMIT_REQUEST_SIZE + 1];
+    uint16_t seq, count, i;
+    int n = 0;
+    ssize_t r;
+
+    pa_assert(fd >= 0);
+    pa_assert(b);
+
+    if ((r = recv(fd, request, sizeof(request), 0)) < 0) {
+        if (errno == EAGAIN || errno == EINTR)
+            return 0;
+
+        pa_log_debug("Failed to receive control packet: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    if (r != RETRANSMIT_REQUEST_SIZE || (request[1] & 0x7f) != PAYLOAD_RETRANSMIT_REQUEST) {
+        pa_log_debug("Ignoring unexpected packet on the control channel.");
+        return 0;
+    }
+
+    seq = read_uint16(request + 4);
+    count = read_uint16(request + 6);
+
+    /* Nothing older than the buffer can be there anyway */
+    if (count > b->size)
+        count = (uint16_t) b->size;
+
+    for (i = 0; i < count; i++) {
+        const pa_memchunk *packet;
+        uint8_t header[4];
+        struct iovec iov[2];
+        struct msghdr m;
+
+        if (!(packet = pa_raop_packet_buffer_read(b, (uint16_t) (seq + i))))
+            continue;
+
+        header[0] = 0x80;
+        header[1] = 0x80 | PAYLOAD_RETRANSMIT_REPLY;
+        write_uint16(header + 2, (uint16_t) (seq + i));
+
+        iov[0].iov_base = header;
+        iov[0].iov_len = sizeof(header);
+        iov[1].iov_base = (uint8_t*) pa_memblock_acquire(packet->memblock) + packet->index;
+        iov[1].iov_len = packet->length;
+
+        memset(&m, 0, sizeof(m));
+        m.msg_iov = iov;
+        m.msg_iovlen = 2;
+
+        r = sendmsg(fd, &m, 0);
+        pa_memblock_release(packet->memblock);
+
+        if (r < 0) {
+            pa_log_debug("Failed to resend packet: %s", pa_cstrerror(errno));
+            return -1;
+        }
+
+        n++;
+    }
+
+    pa_log_debug("Resent %i of %u packets from %u on.", n, count, seq);
+
+    return n;
+}
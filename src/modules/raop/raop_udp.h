@@ -0,0 +1,105 @@
+#ifndef fooraopudpfoo
+#define fooraopudpfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <inttypes.h>
+
+#include <pulse/sample.h>
+
+#include <pulsecore/memchunk.h>
+
+/* The UDP variant of RAOP sends each audio packet as a datagram of
+ * its own, and uses two more channels next to it: on the control
+ * channel we announce which RTP timestamp is played when, and the
+ * receiver asks for packets it missed. On the timing channel the
+ * receiver asks for our clock, much like NTP. None of this keeps any
+ * state beyond the resend buffer and the pacer, so it is meant to be
+ * driven from the thread that sends the audio. */
+
+/* Frames per audio packet */
+#define PA_RAOP_UDP_FRAMES_PER_PACKET 352
+
+/* Bytes in front of the ALAC frame of an audio packet */
+#define PA_RAOP_UDP_HEADER_SIZE 12
+
+/* Keeps the audio packets sent last, so that they can be sent again
+ * when the receiver misses them */
+typedef struct pa_raop_packet_buffer pa_raop_packet_buffer;
+
+pa_raop_packet_buffer* pa_raop_packet_buffer_new(unsigned size);
+void pa_raop_packet_buffer_free(pa_raop_packet_buffer *b);
+
+/* Forgets everything, e.g. after a flush */
+void pa_raop_packet_buffer_reset(pa_raop_packet_buffer *b);
+
+/* The sequence number is taken from the packet */
+void pa_raop_packet_buffer_write(pa_raop_packet_buffer *b, const pa_memchunk *packet);
+
+/* Returns NULL if the packet has been overwritten since, or was never
+ * written. The chunk stays owned by the buffer. */
+const pa_memchunk* pa_raop_packet_buffer_read(pa_raop_packet_buffer *b, uint16_t seq);
+
+/* Sends the audio packets at the rate they are played: a packet is due
+ * once the audio in front of it has been played, counting from the
+ * packet we started with. When we fall behind by more than max_lag we
+ * don't try to catch up, but start over from the packet at hand. */
+typedef struct pa_raop_udp_pacer pa_raop_udp_pacer;
+
+pa_raop_udp_pacer* pa_raop_udp_pacer_new(const pa_sample_spec *ss, pa_usec_t max_lag, pa_usec_t sync_interval);
+void pa_raop_udp_pacer_free(pa_raop_udp_pacer *p);
+
+/* Starts over with the next packet, e.g. after a flush */
+void pa_raop_udp_pacer_reset(pa_raop_udp_pacer *p);
+
+/* Returns when the packet that starts offset bytes into the stream is
+ * due, which is now if we start over with it */
+pa_usec_t pa_raop_udp_pacer_due(pa_raop_udp_pacer *p, pa_usec_t now, int64_t offset);
+
+/* The packet at hand is being sent at now. Returns TRUE if a sync is
+ * to go out with it, which is every sync_interval. *first is set for
+ * the first sync after a reset. */
+pa_bool_t pa_raop_udp_pacer_sync(pa_raop_udp_pacer *p, pa_usec_t now, pa_bool_t *first);
+
+/* Finds name=port in the Transport header of the receiver's reply to
+ * SETUP. Returns a negative value if it isn't there or isn't a
+ * port. */
+int pa_raop_udp_parse_transport_port(const char *transport, const char *name, uint16_t *port);
+
+/* Writes the RTP header of an audio packet. marker is set on the first
+ * packet after RECORD or FLUSH. */
+void pa_raop_udp_write_header(uint8_t *b, uint16_t seq, uint32_t rtptime, uint32_t ssrc, pa_bool_t marker);
+
+/* Tells the receiver on the control channel that the audio with the
+ * RTP timestamp rtptime is being sent now, and is to be played latency
+ * frames later */
+int pa_raop_udp_send_sync(int fd, uint32_t rtptime, uint32_t latency, pa_bool_t first);
+
+/* Answers a timing request waiting on fd. Returns 0 if there was
+ * none, 1 if it was answered, or a negative value on error. */
+int pa_raop_udp_handle_timing(int fd);
+
+/* Sends the packets asked for in a retransmission request waiting on
+ * the control channel fd, as far as b still has them. Returns 0 if
+ * there was no request, the number of packets sent otherwise, or a
+ * negative value on error. */
+int pa_raop_udp_handle_control(int fd, pa_raop_packet_buffer *b);
+
+#endif
@@ -0,0 +1,825 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <math.h>
+
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/llist.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/memblockq.h>
+#include <pulsecore/sample-util.h>
+#include <pulsecore/endianmacros.h>
+#include <pulsecore/g711.h>
+
+#include "jitter-buffer.h"
+
+#define MEMBLOCKQ_MAXLENGTH (1024*1024*40)
+
+/* How far a sequence number may go back or jump ahead before we
+ * consider the sender to have restarted, see RFC 3550 A.1 */
+#define MAX_MISORDER 64
+#define MAX_DROPOUT 3000
+
+/* What we keep of the audio written last, to find the pitch period
+ * in when a packet is lost. Periods of up to half of it are found. */
+#define HISTORY_USEC (40*PA_USEC_PER_MSEC)
+#define PITCH_MIN_USEC (2500)
+
+/* Concealment is played at full level for a while, then faded out
+ * since repeating the same period for long sounds robotic */
+#define CONCEAL_FULL_USEC (10*PA_USEC_PER_MSEC)
+#define CONCEAL_FADE_USEC (50*PA_USEC_PER_MSEC)
+
+/* How long we crossfade from concealment back to real audio */
+#define CROSSFADE_USEC (5*PA_USEC_PER_MSEC)
+
+/* Late packets and underruns add to the target latency, which then
+ * decays by this factor with every packet */
+#define BOOST_DECAY 0.999
+
+struct packet {
+    PA_LLIST_FIELDS(struct packet);
+    int64_t sequence;
+    uint32_t timestamp;
+    pa_memchunk chunk;
+};
+
+struct pa_jitter_buffer {
+    pa_sample_spec sample_spec;
+    size_t frame_size;
+    pa_mempool *mempool;
+    pa_memblockq *memblockq;
+
+    pa_usec_t min_latency, max_latency;
+    pa_usec_t packet_usec;
+    pa_usec_t target;
+
+    pa_bool_t started;
+
+    /* Extended sequence number and timestamp of what is written to
+     * the queue next */
+    int64_t next_sequence;
+    uint32_t next_timestamp;
+
+    /* Which of the last MAX_MISORDER sequence numbers arrived */
+    uint64_t received_mask;
+    int32_t bad_sequence;
+
+    /* Packets waiting behind a gap, sorted by sequence number */
+    PA_LLIST_HEAD(struct packet, held);
+    size_t held_length;
+
+    pa_bool_t have_transit;
+    pa_usec_t last_arrival;
+    uint32_t last_timestamp;
+    double jitter;
+    double boost;
+
+    /* Whether something was played since we last ran dry */
+    pa_bool_t playing;
+
+    /* Decoded copy of the last audio written, NULL if we can't
+     * conceal in this format */
+    int16_t *history;
+    size_t history_frames;
+    float *mono;
+
+    pa_bool_t concealing;
+    int16_t *period;
+    size_t period_frames, period_index;
+    size_t concealed_frames;
+
+    int16_t *work;
+    size_t work_frames;
+
+    pa_jitter_buffer_stats stats;
+};
+
+static pa_bool_t format_can_conceal(pa_sample_format_t f) {
+    switch (f) {
+        case PA_SAMPLE_U8:
+        case PA_SAMPLE_ALAW:
+        case PA_SAMPLE_ULAW:
+        case PA_SAMPLE_S16LE:
+        case PA_SAMPLE_S16BE:
+        case PA_SAMPLE_S24LE:
+        case PA_SAMPLE_S24BE:
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
+static void to_linear(pa_sample_format_t f, const void *src, int16_t *dst, size_t n) {
+    const uint8_t *s8 = src;
+    const int16_t *s16 = src;
+    size_t i;
+
+    switch (f) {
+        case PA_SAMPLE_U8:
+            for (i = 0; i < n; i++)
+                dst[i] = (int16_t) (((int) s8[i] - 0x80) * 0x100);
+            break;
+        case PA_SAMPLE_ALAW:
+            for (i = 0; i < n; i++)
+                dst[i] = st_alaw2linear16(s8[i]);
+            break;
+        case PA_SAMPLE_ULAW:
+            for (i = 0; i < n; i++)
+                dst[i] = st_ulaw2linear16(s8[i]);
+            break;
+        case PA_SAMPLE_S16LE:
+            for (i = 0; i < n; i++)
+                dst[i] = PA_INT16_FROM_LE(s16[i]);
+            break;
+        case PA_SAMPLE_S16BE:
+            for (i = 0; i < n; i++)
+                dst[i] = PA_INT16_FROM_BE(s16[i]);
+            break;
+        case PA_SAMPLE_S24LE:
+            /* Concealment doesn't need more than the upper 16 bits */
+            for (i = 0; i < n; i++)
+                dst[i] = (int16_t) (PA_READ24LE(s8 + i * 3) >> 8);
+            break;
+        case PA_SAMPLE_S24BE:
+            for (i = 0; i < n; i++)
+                dst[i] = (int16_t) (PA_READ24BE(s8 + i * 3) >> 8);
+            break;
+        default:
+            pa_assert_not_reached();
+    }
+}
+
+static void from_linear(pa_sample_format_t f, const int16_t *src, void *dst, size_t n) {
+    uint8_t *d8 = dst;
+    int16_t *d16 = dst;
+    size_t i;
+
+    switch (f) {
+        case PA_SAMPLE_U8:
+            for (i = 0; i < n; i++)
+                d8[i] = (uint8_t) ((src[i] >> 8) + 0x80);
+            break;
+        case PA_SAMPLE_ALAW:
+            for (i = 0; i < n; i++)
+                d8[i] = (uint8_t) st_13linear2alaw(src[i] >> 3);
+            break;
+        case PA_SAMPLE_ULAW:
+            for (i = 0; i < n; i++)
+                d8[i] = (uint8_t) st_14linear2ulaw(src[i] >> 2);
+            break;
+        case PA_SAMPLE_S16LE:
+            for (i = 0; i < n; i++)
+                d16[i] = PA_INT16_TO_LE(src[i]);
+            break;
+        case PA_SAMPLE_S16BE:
+            for (i = 0; i < n; i++)
+                d16[i] = PA_INT16_TO_BE(src[i]);
+            break;
+        case PA_SAMPLE_S24LE:
+            for (i = 0; i < n; i++)
+                PA_WRITE24LE(d8 + i * 3, (uint32_t) src[i] << 8);
+            break;
+        case PA_SAMPLE_S24BE:
+            for (i = 0; i < n; i++)
+                PA_WRITE24BE(d8 + i * 3, (uint32_t) src[i] << 8);
+            break;
+        default:
+            pa_assert_not_reached();
+    }
+}
+
+static size_t usec_to_frames(pa_jitter_buffer *jb, pa_usec_t usec) {
+    return (size_t) (usec * jb->sample_spec.rate / PA_USEC_PER_SEC);
+}
+
+static pa_usec_t frames_to_usec(pa_jitter_buffer *jb, size_t frames) {
+    return (pa_usec_t) frames * PA_USEC_PER_SEC / jb->sample_spec.rate;
+}
+
+static int16_t *get_work(pa_jitter_buffer *jb, size_t frames) {
+    if (frames > jb->work_frames) {
+        jb->work = pa_xrealloc(jb->work, frames * jb->sample_spec.channels * sizeof(int16_t));
+        jb->work_frames = frames;
+    }
+
+    return jb->work;
+}
+
+static void update_target(pa_jitter_buffer *jb) {
+    double t;
+
+    t = 2.0 * (double) jb->packet_usec + 4.0 * jb->jitter + jb->boost;
+    jb->target = PA_CLAMP((pa_usec_t) t, jb->min_latency, jb->max_latency);
+
+    pa_memblockq_set_prebuf(jb->memblockq, pa_usec_to_bytes(jb->target, &jb->sample_spec));
+}
+
+static void add_boost(pa_jitter_buffer *jb) {
+    jb->boost = PA_MIN(jb->boost + (double) jb->packet_usec, (double) jb->max_latency);
+    update_target(jb);
+}
+
+/* RFC 3550 6.4.1 */
+static void update_jitter(pa_jitter_buffer *jb, uint32_t timestamp, pa_usec_t arrival) {
+
+    if (jb->have_transit) {
+        int32_t dts = (int32_t) (timestamp - jb->last_timestamp);
+        double d;
+
+        d = (double) arrival - (double) jb->last_arrival - (double) dts * PA_USEC_PER_SEC / jb->sample_spec.rate;
+
+        /* Ignore timestamp jumps of silence suppressing senders */
+        if (fabs(d) < (double) jb->max_latency)
+            jb->jitter += (fabs(d) - jb->jitter) / 16.0;
+    }
+
+    jb->have_transit = TRUE;
+    jb->last_arrival = arrival;
+    jb->last_timestamp = timestamp;
+}
+
+static void append_history(pa_jitter_buffer *jb, const int16_t *x, size_t frames) {
+    size_t h = jb->history_frames, c = jb->sample_spec.channels;
+
+    if (frames >= h)
+        memcpy(jb->history, x + (frames - h) * c, h * c * sizeof(int16_t));
+    else {
+        memmove(jb->history, jb->history + frames * c, (h - frames) * c * sizeof(int16_t));
+        memcpy(jb->history + (h - frames) * c, x, frames * c * sizeof(int16_t));
+    }
+}
+
+/* Finds the period at which the end of the history repeats itself
+ * best, by normalized autocorrelation over a mono mix */
+static size_t find_pitch(pa_jitter_buffer *jb) {
+    size_t n = jb->history_frames, c = jb->sample_spec.channels;
+    size_t min, max, p, i, k, best;
+    double best_score = 0;
+
+    for (i = 0; i < n; i++) {
+        int32_t sum = 0;
+
+        for (k = 0; k < c; k++)
+            sum += jb->history[i * c + k];
+
+        jb->mono[i] = (float) sum / (float) c;
+    }
+
+    max = n / 2;
+    min = PA_MAX(usec_to_frames(jb, PITCH_MIN_USEC), 1U);
+    min = PA_MIN(min, max);
+    best = max;
+
+    for (p = min; p <= max; p++) {
+        double corr = 0, energy = 0;
+
+        for (i = n - max; i < n; i++) {
+            corr += (double) jb->mono[i] * jb->mono[i - p];
+            energy += (double) jb->mono[i - p] * jb->mono[i - p];
+        }
+
+        if (energy > 0 && corr / sqrt(energy) > best_score) {
+            best_score = corr / sqrt(energy);
+            best = p;
+        }
+    }
+
+    return best;
+}
+
+static void start_concealment(pa_jitter_buffer *jb) {
+    size_t c = jb->sample_spec.channels;
+
+    pa_assert(!jb->concealing);
+
+    jb->concealing = TRUE;
+    jb->concealed_frames = 0;
+
+    if (!jb->history)
+        return;
+
+    jb->period_frames = find_pitch(jb);
+    jb->period_index = 0;
+    memcpy(jb->period, jb->history + (jb->history_frames - jb->period_frames) * c, jb->period_frames * c * sizeof(int16_t));
+}
+
+/* Continues the last pitch period, fading it out after a while */
+static void generate_concealment(pa_jitter_buffer *jb, int16_t *dst, size_t frames) {
+    size_t full, fade, i, k, c = jb->sample_spec.channels;
+
+    full = usec_to_frames(jb, CONCEAL_FULL_USEC);
+    fade = PA_MAX(usec_to_frames(jb, CONCEAL_FADE_USEC), 1U);
+
+    for (i = 0; i < frames; i++) {
+        size_t pos = jb->concealed_frames + i;
+        float gain;
+
+        if (pos < full)
+            gain = 1.0f;
+        else if (pos < full + fade)
+            gain = 1.0f - (float) (pos - full) / (float) fade;
+        else
+            gain = 0.0f;
+
+        for (k = 0; k < c; k++)
+            dst[i * c + k] = (int16_t) lrintf((float) jb->period[jb->period_index * c + k] * gain);
+
+        if (++jb->period_index >= jb->period_frames)
+            jb->period_index = 0;
+    }
+
+    jb->concealed_frames += frames;
+}
+
+static void push_to_queue(pa_jitter_buffer *jb, const pa_memchunk *chunk) {
+    if (pa_memblockq_push(jb->memblockq, chunk) < 0) {
+        pa_log_warn("Queue overrun");
+        pa_memblockq_seek(jb->memblockq, (int64_t) chunk->length, PA_SEEK_RELATIVE, TRUE);
+    }
+}
+
+static void write_concealment(pa_jitter_buffer *jb, size_t frames) {
+    pa_memchunk chunk;
+    int16_t *x;
+    void *d;
+
+    if (!jb->history) {
+        /* Silence is all we can do */
+        pa_memblockq_seek(jb->memblockq, (int64_t) (frames * jb->frame_size), PA_SEEK_RELATIVE, TRUE);
+        jb->concealed_frames += frames;
+        return;
+    }
+
+    x = get_work(jb, frames);
+    generate_concealment(jb, x, frames);
+    append_history(jb, x, frames);
+
+    chunk.memblock = pa_memblock_new(jb->mempool, frames * jb->frame_size);
+    chunk.index = 0;
+    chunk.length = frames * jb->frame_size;
+
+    d = pa_memblock_acquire(chunk.memblock);
+    from_linear(jb->sample_spec.format, x, d, frames * jb->sample_spec.channels);
+    pa_memblock_release(chunk.memblock);
+
+    push_to_queue(jb, &chunk);
+    pa_memblock_unref(chunk.memblock);
+}
+
+static void advance(pa_jitter_buffer *jb, pa_bool_t received) {
+    uint64_t bit = 1ULL << (jb->next_sequence & (MAX_MISORDER - 1));
+
+    if (received)
+        jb->received_mask |= bit;
+    else {
+        jb->received_mask &= ~bit;
+        jb->stats.lost++;
+    }
+
+    jb->next_sequence++;
+}
+
+static void write_packet(pa_jitter_buffer *jb, uint32_t timestamp, const pa_memchunk *chunk) {
+    int32_t delta = (int32_t) (timestamp - jb->next_timestamp);
+    pa_memchunk c = *chunk;
+    size_t frames, ch = jb->sample_spec.channels;
+
+    pa_memblock_ref(c.memblock);
+
+    if (delta < 0 && jb->concealing) {
+        /* The packet overlaps with what we already made up for it,
+         * use what is left of it */
+        size_t skip = PA_MIN((size_t) -delta * jb->frame_size, c.length);
+
+        c.index += skip;
+        c.length -= skip;
+        delta = 0;
+
+    } else if (delta != 0) {
+
+        if (frames_to_usec(jb, (size_t) (delta < 0 ? -delta : delta)) > jb->max_latency)
+            pa_log_debug("Timestamp jumped by %i frames, resyncing", delta);
+        else
+            pa_memblockq_seek(jb->memblockq, (int64_t) delta * (int64_t) jb->frame_size, PA_SEEK_RELATIVE, TRUE);
+
+        jb->concealing = FALSE;
+    }
+
+    frames = c.length / jb->frame_size;
+
+    if (frames > 0 && jb->history) {
+        uint8_t *d;
+        size_t n;
+
+        if (jb->concealing) {
+            /* Crossfade from the concealment into the real audio, on
+             * a copy since the block might be shared */
+            int16_t *x, *y;
+            pa_memchunk copy;
+            size_t i, k;
+
+            n = PA_MAX(usec_to_frames(jb, CROSSFADE_USEC), 1U);
+            n = PA_MIN(n, frames);
+            x = get_work(jb, 2 * n);
+            y = x + n * ch;
+
+            generate_concealment(jb, y, n);
+
+            copy.memblock = pa_memblock_new(jb->mempool, c.length);
+            copy.index = 0;
+            copy.length = c.length;
+            pa_memchunk_memcpy(&copy, &c);
+
+            d = pa_memblock_acquire(copy.memblock);
+            to_linear(jb->sample_spec.format, d, x, n * ch);
+
+            for (i = 0; i < n; i++) {
+                float w = (float) (i + 1) / (float) (n + 1);
+
+                for (k = 0; k < ch; k++)
+                    x[i * ch + k] = (int16_t) lrintf((float) y[i * ch + k] * (1.0f - w) + (float) x[i * ch + k] * w);
+            }
+
+            from_linear(jb->sample_spec.format, x, d, n * ch);
+            pa_memblock_release(copy.memblock);
+
+            pa_memblock_unref(c.memblock);
+            c = copy;
+        }
+
+        n = PA_MIN(frames, jb->history_frames);
+        d = pa_memblock_acquire(c.memblock);
+        to_linear(jb->sample_spec.format, d + c.index + (frames - n) * jb->frame_size, get_work(jb, n), n * ch);
+        pa_memblock_release(c.memblock);
+
+        append_history(jb, jb->work, n);
+    }
+
+    jb->concealing = FALSE;
+
+    if (c.length > 0)
+        push_to_queue(jb, &c);
+
+    pa_memblock_unref(c.memblock);
+
+    jb->next_timestamp = timestamp + (uint32_t) (chunk->length / jb->frame_size);
+    advance(jb, TRUE);
+}
+
+static void free_packet(pa_jitter_buffer *jb, struct packet *p) {
+    PA_LLIST_REMOVE(struct packet, jb->held, p);
+    jb->held_length -= p->chunk.length;
+
+    pa_memblock_unref(p->chunk.memblock);
+    pa_xfree(p);
+}
+
+/* Writes out the held packets that are next in line */
+static void write_ready(pa_jitter_buffer *jb) {
+    struct packet *p;
+
+    while ((p = jb->held) && p->sequence == jb->next_sequence) {
+        write_packet(jb, p->timestamp, &p->chunk);
+        free_packet(jb, p);
+    }
+}
+
+/* Gives up on the packets missing before the first held one */
+static void close_gap(pa_jitter_buffer *jb) {
+    pa_assert(jb->held);
+
+    while (jb->next_sequence < jb->held->sequence)
+        advance(jb, FALSE);
+
+    write_ready(jb);
+}
+
+static void conceal(pa_jitter_buffer *jb, size_t length) {
+    int32_t gap;
+    size_t frames;
+
+    pa_assert(jb->held);
+
+    gap = (int32_t) (jb->held->timestamp - jb->next_timestamp);
+
+    if (gap <= 0 || frames_to_usec(jb, (size_t) gap) > jb->max_latency) {
+        close_gap(jb);
+        return;
+    }
+
+    frames = PA_MAX(length / jb->frame_size, 1U);
+    frames = PA_MIN(frames, pa_mempool_block_size_max(jb->mempool) / jb->frame_size);
+    frames = PA_MIN(frames, (size_t) gap);
+
+    if (!jb->concealing)
+        start_concealment(jb);
+
+    write_concealment(jb, frames);
+
+    jb->next_timestamp += (uint32_t) frames;
+    jb->stats.concealed += frames_to_usec(jb, frames);
+
+    if (frames == (size_t) gap)
+        close_gap(jb);
+}
+
+static void free_held(pa_jitter_buffer *jb) {
+    while (jb->held)
+        free_packet(jb, jb->held);
+}
+
+static void resync(pa_jitter_buffer *jb, uint16_t sequence, uint32_t timestamp) {
+    free_held(jb);
+
+    jb->started = TRUE;
+    jb->next_sequence = sequence;
+    jb->next_timestamp = timestamp;
+    jb->received_mask = (uint64_t) -1;
+    jb->bad_sequence = -1;
+    jb->have_transit = FALSE;
+    jb->concealing = FALSE;
+}
+
+pa_jitter_buffer* pa_jitter_buffer_new(const pa_sample_spec *ss, pa_usec_t min_latency, pa_usec_t max_latency, pa_mempool *pool) {
+    pa_jitter_buffer *jb;
+    pa_memchunk silence;
+
+    pa_assert(ss);
+    pa_assert(pa_sample_spec_valid(ss));
+    pa_assert(min_latency <= max_latency);
+    pa_assert(pool);
+
+    jb = pa_xnew0(pa_jitter_buffer, 1);
+    jb->sample_spec = *ss;
+    jb->frame_size = pa_frame_size(ss);
+    jb->mempool = pool;
+    jb->min_latency = min_latency;
+    jb->max_latency = max_latency;
+    jb->bad_sequence = -1;
+
+    PA_LLIST_HEAD_INIT(struct packet, jb->held);
+
+    silence.memblock = pa_silence_memblock(pa_memblock_new(pool, pa_frame_align(pa_mempool_block_size_max(pool), ss)), ss);
+    silence.index = 0;
+    silence.length = pa_memblock_get_length(silence.memblock);
+
+    jb->memblockq = pa_memblockq_new(
+            "jitter buffer memblockq",
+            0,
+            MEMBLOCKQ_MAXLENGTH,
+            MEMBLOCKQ_MAXLENGTH,
+            ss,
+            0,
+            0,
+            0,
+            &silence);
+
+    pa_memblock_unref(silence.memblock);
+
+    if (format_can_conceal(ss->format)) {
+        jb->history_frames = PA_MAX(usec_to_frames(jb, HISTORY_USEC), 2U);
+        jb->history = pa_xnew0(int16_t, jb->history_frames * ss->channels);
+        jb->period = pa_xnew0(int16_t, jb->history_frames / 2 * ss->channels);
+        jb->mono = pa_xnew(float, jb->history_frames);
+    }
+
+    update_target(jb);
+
+    return jb;
+}
+
+void pa_jitter_buffer_free(pa_jitter_buffer *jb) {
+    pa_assert(jb);
+
+    free_held(jb);
+    pa_memblockq_free(jb->memblockq);
+
+    pa_xfree(jb->history);
+    pa_xfree(jb->period);
+    pa_xfree(jb->mono);
+    pa_xfree(jb->work);
+    pa_xfree(jb);
+}
+
+void pa_jitter_buffer_push(pa_jitter_buffer *jb, uint16_t sequence, uint32_t timestamp, pa_usec_t arrival, const pa_memchunk *chunk) {
+    struct packet *p, *prev = NULL;
+    int16_t d;
+    int64_t seq;
+
+    pa_assert(jb);
+    pa_assert(chunk);
+    pa_assert(chunk->memblock);
+    pa_assert(chunk->length % jb->frame_size == 0);
+
+    if (chunk->length == 0)
+        return;
+
+    if (!jb->started)
+        resync(jb, sequence, timestamp);
+
+    d = (int16_t) (sequence - (uint16_t) jb->next_sequence);
+
+    if (d < -MAX_MISORDER || d > MAX_DROPOUT) {
+
+        /* Either a stray packet or the sender restarted. Follow only
+         * if the next packet agrees. */
+        if (jb->bad_sequence != sequence) {
+            jb->bad_sequence = (uint16_t) (sequence + 1);
+            return;
+        }
+
+        pa_log_debug("Sequence number jumped from %u to %u, resyncing", (unsigned) (uint16_t) jb->next_sequence, (unsigned) sequence);
+        resync(jb, sequence, timestamp);
+        d = 0;
+    }
+
+    jb->bad_sequence = -1;
+    seq = jb->next_sequence + d;
+
+    if (d < 0) {
+        uint64_t bit = 1ULL << (seq & (MAX_MISORDER - 1));
+
+        if (jb->received_mask & bit) {
+            jb->stats.duplicates++;
+            return;
+        }
+
+        /* We already gave up on this one */
+        jb->received_mask |= bit;
+        jb->stats.received++;
+        jb->stats.late++;
+        jb->stats.lost--;
+
+        update_jitter(jb, timestamp, arrival);
+        add_boost(jb);
+        return;
+    }
+
+    for (p = jb->held; p && p->sequence < seq; p = p->next)
+        prev = p;
+
+    if (p && p->sequence == seq) {
+        jb->stats.duplicates++;
+        return;
+    }
+
+    jb->stats.received++;
+    jb->packet_usec = pa_bytes_to_usec(chunk->length, &jb->sample_spec);
+    jb->boost *= BOOST_DECAY;
+    update_jitter(jb, timestamp, arrival);
+    update_target(jb);
+
+    if (d == 0) {
+        write_packet(jb, timestamp, chunk);
+        write_ready(jb);
+        return;
+    }
+
+    p = pa_xnew(struct packet, 1);
+    p->sequence = seq;
+    p->timestamp = timestamp;
+    p->chunk = *chunk;
+    pa_memblock_ref(p->chunk.memblock);
+
+    PA_LLIST_INSERT_AFTER(struct packet, jb->held, prev, p);
+    jb->held_length += chunk->length;
+
+    /* Don't wait for ever if nobody plays the gap */
+    while (jb->held && pa_bytes_to_usec(jb->held_length, &jb->sample_spec) > jb->max_latency)
+        conceal(jb, jb->held_length);
+}
+
+int pa_jitter_buffer_peek(pa_jitter_buffer *jb, size_t length, pa_memchunk *chunk) {
+    pa_assert(jb);
+    pa_assert(chunk);
+
+    if (jb->held) {
+        size_t l = pa_memblockq_get_length(jb->memblockq);
+        pa_bool_t enough = l + jb->held_length >= pa_usec_to_bytes(jb->target, &jb->sample_spec);
+
+        if (l == 0) {
+            /* We're at the gap, so the missing packet is late */
+            if (jb->playing || enough) {
+                conceal(jb, length);
+                pa_memblockq_prebuf_disable(jb->memblockq);
+            }
+
+        } else if (enough)
+            pa_memblockq_prebuf_disable(jb->memblockq);
+    }
+
+    if (pa_memblockq_peek(jb->memblockq, chunk) < 0) {
+
+        if (jb->playing) {
+            jb->playing = FALSE;
+            jb->stats.underruns++;
+            add_boost(jb);
+        }
+
+        return -1;
+    }
+
+    jb->playing = TRUE;
+    return 0;
+}
+
+void pa_jitter_buffer_drop(pa_jitter_buffer *jb, size_t length) {
+    pa_assert(jb);
+
+    pa_memblockq_drop(jb->memblockq, length);
+}
+
+void pa_jitter_buffer_rewind(pa_jitter_buffer *jb, size_t length) {
+    pa_assert(jb);
+
+    pa_memblockq_rewind(jb->memblockq, length);
+}
+
+void pa_jitter_buffer_set_maxrewind(pa_jitter_buffer *jb, size_t length) {
+    pa_assert(jb);
+
+    pa_memblockq_set_maxrewind(jb->memblockq, length);
+}
+
+void pa_jitter_buffer_flush(pa_jitter_buffer *jb) {
+    pa_assert(jb);
+
+    free_held(jb);
+    pa_memblockq_flush_read(jb->memblockq);
+
+    jb->started = FALSE;
+    jb->concealing = FALSE;
+    jb->playing = FALSE;
+    jb->have_transit = FALSE;
+}
+
+pa_bool_t pa_jitter_buffer_is_readable(pa_jitter_buffer *jb) {
+    pa_assert(jb);
+
+    return pa_memblockq_is_readable(jb->memblockq) ||
+        (jb->held && pa_memblockq_get_length(jb->memblockq) + jb->held_length >= pa_usec_to_bytes(jb->target, &jb->sample_spec));
+}
+
+size_t pa_jitter_buffer_get_length(pa_jitter_buffer *jb) {
+    pa_assert(jb);
+
+    return pa_memblockq_get_length(jb->memblockq) + jb->held_length;
+}
+
+pa_usec_t pa_jitter_buffer_get_target(pa_jitter_buffer *jb) {
+    pa_assert(jb);
+
+    return jb->target;
+}
+
+pa_bool_t pa_jitter_buffer_get_read_timestamp(pa_jitter_buffer *jb, uint32_t *timestamp) {
+    int64_t frames;
+
+    pa_assert(jb);
+    pa_assert(timestamp);
+
+    if (!jb->started)
+        return FALSE;
+
+    /* The write index is where next_timestamp goes. After an underrun
+     * the read index is ahead of it. */
+    frames = (pa_memblockq_get_write_index(jb->memblockq) - pa_memblockq_get_read_index(jb->memblockq)) / (int64_t) jb->frame_size;
+    *timestamp = jb->next_timestamp - (uint32_t) frames;
+
+    return TRUE;
+}
+
+void pa_jitter_buffer_get_stats(pa_jitter_buffer *jb, pa_jitter_buffer_stats *stats) {
+    pa_assert(jb);
+    pa_assert(stats);
+
+    *stats = jb->stats;
+    stats->jitter = (pa_usec_t) jb->jitter;
+    stats->target = jb->target;
+    stats->depth = pa_bytes_to_usec(pa_jitter_buffer_get_length(jb), &jb->sample_spec);
+}
@@ -0,0 +1,82 @@
+#ifndef foortpjitterbufferhfoo
+#define foortpjitterbufferhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <inttypes.h>
+
+#include <pulse/sample.h>
+
+#include <pulsecore/memchunk.h>
+
+/* Puts received RTP packets back in order by their sequence number
+ * and plays them out by their timestamp. Packets that are still
+ * missing when it's their turn are concealed by repeating the last
+ * pitch period of what was played before. How much is buffered
+ * follows the inter-arrival jitter measured as in RFC 3550, and grows
+ * when packets turn up too late. Not thread safe, all functions are
+ * meant to be called from the IO thread. */
+
+typedef struct pa_jitter_buffer pa_jitter_buffer;
+
+typedef struct pa_jitter_buffer_stats {
+    uint64_t received;      /* Packets received, including late ones */
+    uint64_t lost;          /* Packets that never arrived */
+    uint64_t late;          /* Packets that arrived after their turn */
+    uint64_t duplicates;
+    uint64_t underruns;
+    pa_usec_t concealed;    /* Audio made up for lost packets */
+    pa_usec_t jitter;       /* Inter-arrival jitter */
+    pa_usec_t target;       /* How much we try to keep buffered */
+    pa_usec_t depth;        /* How much is buffered now */
+} pa_jitter_buffer_stats;
+
+/* The target latency is kept between min_latency and max_latency */
+pa_jitter_buffer* pa_jitter_buffer_new(const pa_sample_spec *ss, pa_usec_t min_latency, pa_usec_t max_latency, pa_mempool *pool);
+void pa_jitter_buffer_free(pa_jitter_buffer *jb);
+
+/* arrival is when the packet was received, in any monotonic time
+ * base. The chunk has to be a multiple of the frame size. */
+void pa_jitter_buffer_push(pa_jitter_buffer *jb, uint16_t sequence, uint32_t timestamp, pa_usec_t arrival, const pa_memchunk *chunk);
+
+/* Like pa_memblockq_peek(), but conceals lost packets when the play
+ * position reaches them. Returns a negative value on underrun. */
+int pa_jitter_buffer_peek(pa_jitter_buffer *jb, size_t length, pa_memchunk *chunk);
+void pa_jitter_buffer_drop(pa_jitter_buffer *jb, size_t length);
+void pa_jitter_buffer_rewind(pa_jitter_buffer *jb, size_t length);
+void pa_jitter_buffer_set_maxrewind(pa_jitter_buffer *jb, size_t length);
+
+/* Throws away everything and starts over with the next packet */
+void pa_jitter_buffer_flush(pa_jitter_buffer *jb);
+
+/* Whether pa_jitter_buffer_peek() would return data */
+pa_bool_t pa_jitter_buffer_is_readable(pa_jitter_buffer *jb);
+
+/* Everything buffered, including packets held back behind a gap */
+size_t pa_jitter_buffer_get_length(pa_jitter_buffer *jb);
+pa_usec_t pa_jitter_buffer_get_target(pa_jitter_buffer *jb);
+
+/* The RTP timestamp of what pa_jitter_buffer_peek() returns next.
+ * Returns FALSE if no packet was received yet. */
+pa_bool_t pa_jitter_buffer_get_read_timestamp(pa_jitter_buffer *jb, uint32_t *timestamp);
+
+void pa_jitter_buffer_get_stats(pa_jitter_buffer *jb, pa_jitter_buffer_stats *stats);
+
+#endif
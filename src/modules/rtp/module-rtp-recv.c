@@ -54,12 +54,20 @@
 #include <pulsecore/once.h>
 #include <pulsecore/poll.h>
 #include <pulsecore/arpa-inet.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/thread-mq.h>
+#include <pulsecore/rtpoll.h>
+#include <pulsecore/idxset.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/codec.h>
 
 #include "module-rtp-recv-symdef.h"
 
 #include "rtp.h"
 #include "sdp.h"
 #include "sap.h"
+#include "jitter-buffer.h"
+#include "playout-sync.h"
 
 PA_MODULE_AUTHOR("Lennart Poettering");
 PA_MODULE_DESCRIPTION("Receive data from a network via RTP/SAP/SDP");
@@ -68,38 +76,104 @@ PA_MODULE_LOAD_ONCE(FALSE);
 PA_MODULE_USAGE(
         "sink=<name of the sink> "
         "sap_address=<multicast address to listen on> "
+        "min_latency_msec=<least latency to buffer for jitter> "
+        "max_latency_msec=<most latency to buffer for jitter> "
+        "playout_delay_msec=<play in sync with other receivers this long after capture, 0 to disable> "
 );
 
 #define SAP_PORT 9875
 #define DEFAULT_SAP_ADDRESS "224.0.0.56"
-#define MEMBLOCKQ_MAXLENGTH (1024*1024*40)
-#define MAX_SESSIONS 16
+#define MAX_SESSIONS 64
 #define DEATH_TIMEOUT 20
 #define RATE_UPDATE_INTERVAL (5*PA_USEC_PER_SEC)
-#define LATENCY_USEC (500*PA_USEC_PER_MSEC)
+#define STATS_INTERVAL (5*PA_USEC_PER_SEC)
+#define DEFAULT_MIN_LATENCY_MSEC 20
+#define DEFAULT_MAX_LATENCY_MSEC 500
+#define SYNC_UPDATE_INTERVAL (1*PA_USEC_PER_SEC)
 
 static const char* const valid_modargs[] = {
     "sink",
     "sap_address",
+    "min_latency_msec",
+    "max_latency_msec",
+    "playout_delay_msec",
     NULL
 };
 
+enum {
+    SINK_INPUT_MESSAGE_GET_STATS = PA_SINK_INPUT_MESSAGE_MAX,
+    SINK_INPUT_MESSAGE_POST_DATA,
+    SINK_INPUT_MESSAGE_SENDER_REPORT
+};
+
+enum {
+    RECEIVER_MESSAGE_ADD_SOCKET,
+    RECEIVER_MESSAGE_REMOVE_SOCKET,
+    RECEIVER_MESSAGE_ADD_SESSION,
+    RECEIVER_MESSAGE_REMOVE_SESSION
+};
+
+struct receiver_msg {
+    pa_msgobject parent;
+};
+
+typedef struct receiver_msg receiver_msg;
+PA_DEFINE_PRIVATE_CLASS(receiver_msg, pa_msgobject);
+
+/* What the receiver thread knows about a packet besides its payload */
+struct packet_info {
+    uint16_t sequence;
+    uint32_t timestamp;
+    pa_usec_t arrival;
+};
+
+/* What an RTCP sender report says: the sample with the RTP timestamp
+ * timestamp was captured at the wall clock time when */
+struct sender_report {
+    pa_usec_t when;
+    uint32_t timestamp;
+};
+
+/* What SINK_INPUT_MESSAGE_GET_STATS returns */
+struct session_stats {
+    pa_jitter_buffer_stats jitter_buffer;
+    pa_bool_t synced;
+    int64_t sync_offset;
+};
+
+/* One multicast group and port, shared by all sessions announced for
+ * it. Sessions are told apart by the SSRC of their packets. */
+struct rtp_socket {
+    struct userdata *userdata;
+    PA_LLIST_FIELDS(struct rtp_socket);
+
+    unsigned n_ref;
+
+    struct sockaddr_storage sa;
+    socklen_t salen;
+
+    /* Only accessed from the receiver thread */
+    pa_rtp_context rtp_context;
+    int rtcp_fd;
+    pa_rtpoll_item *rtpoll_item;
+    pa_hashmap *by_ssrc;
+    pa_idxset *unbound;
+};
+
 struct session {
     struct userdata *userdata;
     PA_LLIST_FIELDS(struct session);
 
     pa_sink_input *sink_input;
-    pa_memblockq *memblockq;
-
-    pa_bool_t first_packet;
-    uint32_t ssrc;
-    uint32_t offset;
+    pa_jitter_buffer *jitter_buffer;
 
     struct pa_sdp_info sdp_info;
 
-    pa_rtp_context rtp_context;
+    struct rtp_socket *socket;
 
-    pa_rtpoll_item *rtpoll_item;
+    /* Packets from the receiver thread to the sink's IO thread */
+    pa_asyncmsgq *asyncmsgq;
+    pa_rtpoll_item *rtpoll_item_read;
 
     pa_atomic_t timestamp;
 
@@ -110,6 +184,20 @@ struct session {
     pa_usec_t last_latency;
     double estimated_rate;
     double avg_estimated_rate;
+
+    /* Synchronized playback from the sender reports */
+    pa_playout_sync *playout_sync;
+    pa_usec_t last_sync;
+    int64_t sync_offset;
+    pa_bool_t sync_warned;
+
+    /* Only accessed from the receiver thread */
+    struct {
+        pa_bool_t bound;
+        uint32_t ssrc;
+        pa_rtpoll_item *rtpoll_item_write;
+        pa_codec *decoder;
+    } thread_info;
 };
 
 struct userdata {
@@ -120,9 +208,20 @@ struct userdata {
     pa_io_event* sap_event;
 
     pa_time_event *check_death_event;
+    pa_time_event *update_stats_event;
 
     char *sink_name;
+    pa_usec_t min_latency, max_latency;
+    pa_usec_t playout_delay;
+
+    /* All sockets are polled from this one thread, which hands the
+     * packets on to the sink inputs */
+    pa_thread *thread;
+    pa_thread_mq thread_mq;
+    pa_rtpoll *rtpoll;
+    receiver_msg *msg;
 
+    PA_LLIST_HEAD(struct rtp_socket, sockets);
     PA_LLIST_HEAD(struct session, sessions);
     pa_hashmap *by_origin;
     int n_sessions;
@@ -130,17 +229,200 @@ struct userdata {
 
 static void session_free(struct session *s);
 
+/* Called from I/O thread context */
+static void update_rate(struct session *s, pa_usec_t now) {
+    pa_usec_t render_delay, sink_delay = 0, latency;
+    uint32_t base_rate = s->sink_input->sink->sample_spec.rate;
+    uint32_t current_rate = s->sink_input->sample_spec.rate;
+    uint32_t new_rate;
+    double estimated_rate, alpha = 0.02;
+
+    if (s->last_rate_update + RATE_UPDATE_INTERVAL >= now)
+        return;
+
+    pa_log_debug("Updating sample rate");
+
+    sink_delay = pa_sink_get_latency_within_thread(s->sink_input->sink);
+    render_delay = pa_bytes_to_usec(pa_memblockq_get_length(s->sink_input->thread_info.render_memblockq), &s->sink_input->sink->sample_spec);
+
+    latency = pa_bytes_to_usec(pa_jitter_buffer_get_length(s->jitter_buffer), &s->sink_input->sample_spec) + render_delay + sink_delay;
+
+    /* The jitter buffer decides how much it needs */
+    s->intended_latency = pa_jitter_buffer_get_target(s->jitter_buffer) + s->sink_latency;
+
+    pa_log_debug("Write index deviates by %0.2f ms, expected %0.2f ms", (double) latency/PA_USEC_PER_MSEC, (double) s->intended_latency/PA_USEC_PER_MSEC);
+
+    /* The buffer is filling with some unknown rate R̂ samples/second. If the rate of reading in
+     * the last T seconds was Rⁿ, then the increase in buffer latency ΔLⁿ = Lⁿ - Lⁿ⁻ⁱ in that
+     * same period is ΔLⁿ = (TR̂ - TRⁿ) / R̂, giving the estimated target rate
+     *                                           T
+     *                                 R̂ = ─────────────── Rⁿ .                             (1)
+     *                                     T - (Lⁿ - Lⁿ⁻ⁱ)
+     *
+     * Setting the sample rate to R̂ results in the latency being constant (if the estimate of R̂
+     * is correct).  But there is also the requirement to keep the buffer at a predefined target
+     * latency L̂.  So instead of setting Rⁿ⁺ⁱ to R̂ immediately, the strategy will be to reduce R
+     * from Rⁿ⁺ⁱ to R̂ in a steps of T seconds, where Rⁿ⁺ⁱ is chosen such that in the total time
+     * aT the latency is reduced from Lⁿ to L̂.  This strategy translates to the requirements
+     *            ₐ      R̂ - Rⁿ⁺ʲ                            a-j+1         j-1
+     *            Σ  T ────────── = L̂ - Lⁿ    with    Rⁿ⁺ʲ = ───── Rⁿ⁺ⁱ + ───── R̂ .
+     *           ʲ⁼ⁱ        R̂                                  a            a
+     * Solving for Rⁿ⁺ⁱ gives
+     *                                     T - ²∕ₐ₊₁(L̂ - Lⁿ)
+     *                              Rⁿ⁺ⁱ = ───────────────── R̂ .                            (2)
+     *                                            T
+     * In the code below a = 7 is used.
+     *
+     * Equation (1) is not directly used in (2), but instead an exponentially weighted average
+     * of the estimated rate R̂ is used.  This average R̅ is defined as
+     *                                R̅ⁿ = α R̂ⁿ + (1-α) R̅ⁿ⁻ⁱ .
+     * Because it is difficult to find a fixed value for the coefficient α such that the
+     * averaging is without significant lag but oscillations are filtered out, a heuristic is
+     * used.  When the successive estimates R̂ⁿ do not change much then α→1, but when there is a
+     * sudden spike in the estimated rate α→0, such that the deviation is given little weight.
+     */
+    estimated_rate = (double) current_rate * (double) RATE_UPDATE_INTERVAL / (double) (RATE_UPDATE_INTERVAL + s->last_latency - latency);
+    if (fabs(s->estimated_rate - s->avg_estimated_rate) > 1) {
+      double ratio = (estimated_rate + s->estimated_rate - 2*s->avg_estimated_rate) / (s->estimated_rate - s->avg_estimated_rate);
+      alpha = PA_CLAMP(2 * (ratio + fabs(ratio)) / (4 + ratio*ratio), 0.02, 0.8);
+    }
+    s->avg_estimated_rate = alpha * estimated_rate + (1-alpha) * s->avg_estimated_rate;
+    s->estimated_rate = estimated_rate;
+    pa_log_debug("Estimated target rate: %.0f Hz, using average of %.0f Hz  (α=%.3f)", estimated_rate, s->avg_estimated_rate, alpha);
+    new_rate = (uint32_t) ((double) (RATE_UPDATE_INTERVAL + latency/4 - s->intended_latency/4) / (double) RATE_UPDATE_INTERVAL * s->avg_estimated_rate);
+    s->last_latency = latency;
+
+    if (new_rate < (uint32_t) (base_rate*0.8) || new_rate > (uint32_t) (base_rate*1.25)) {
+        pa_log_warn("Sample rates too different, not adjusting (%u vs. %u).", base_rate, new_rate);
+        new_rate = base_rate;
+    } else {
+        if (base_rate < new_rate + 20 && new_rate < base_rate + 20)
+          new_rate = base_rate;
+        /* Do the adjustment in small steps; 2‰ can be considered inaudible */
+        if (new_rate < (uint32_t) (current_rate*0.998) || new_rate > (uint32_t) (current_rate*1.002)) {
+            pa_log_info("New rate of %u Hz not within 2‰ of %u Hz, forcing smaller adjustment", new_rate, current_rate);
+            new_rate = PA_CLAMP(new_rate, (uint32_t) (current_rate*0.998), (uint32_t) (current_rate*1.002));
+        }
+    }
+    s->sink_input->sample_spec.rate = new_rate;
+
+    pa_assert(pa_sample_spec_valid(&s->sink_input->sample_spec));
+
+    pa_resampler_set_input_rate(s->sink_input->thread_info.resampler, s->sink_input->sample_spec.rate);
+
+    pa_log_debug("Updated sampling rate to %lu Hz.", (unsigned long) s->sink_input->sample_spec.rate);
+
+    s->last_rate_update = now;
+}
+
+/* Called from I/O thread context */
+static void update_sync(struct session *s, pa_usec_t now) {
+    pa_usec_t render_delay, sink_delay, playout_delay = s->userdata->playout_delay;
+    struct timeval tv;
+    uint32_t timestamp, rate;
+    size_t drop;
+
+    if (s->last_sync + SYNC_UPDATE_INTERVAL >= now)
+        return;
+
+    if (!pa_jitter_buffer_get_read_timestamp(s->jitter_buffer, &timestamp))
+        return;
+
+    s->last_sync = now;
+
+    sink_delay = pa_sink_get_latency_within_thread(s->sink_input->sink);
+    render_delay = pa_bytes_to_usec(pa_memblockq_get_length(s->sink_input->thread_info.render_memblockq), &s->sink_input->sink->sample_spec);
+
+    /* When the sample we read next comes out of the speaker, in wall
+     * clock time */
+    pa_gettimeofday(&tv);
+    s->sync_offset = pa_playout_sync_update(s->playout_sync, pa_timeval_load(&tv) + sink_delay + render_delay, timestamp, &drop, &rate);
+
+    if (drop > 0) {
+        pa_jitter_buffer_drop(s->jitter_buffer, drop);
+
+        if (!s->sync_warned && s->sink_latency + pa_jitter_buffer_get_target(s->jitter_buffer) > playout_delay) {
+            pa_log_warn("Playout delay of %0.2f ms is too short for session '%s', it needs at least %0.2f ms",
+                        (double) playout_delay / PA_USEC_PER_MSEC, s->sdp_info.session_name,
+                        (double) (s->sink_latency + pa_jitter_buffer_get_target(s->jitter_buffer)) / PA_USEC_PER_MSEC);
+            s->sync_warned = TRUE;
+        }
+    }
+
+    if (rate == s->sink_input->sample_spec.rate)
+        return;
+
+    s->sink_input->sample_spec.rate = rate;
+
+    pa_assert(pa_sample_spec_valid(&s->sink_input->sample_spec));
+
+    pa_resampler_set_input_rate(s->sink_input->thread_info.resampler, s->sink_input->sample_spec.rate);
+
+    pa_log_debug("Updated sampling rate to %lu Hz.", (unsigned long) s->sink_input->sample_spec.rate);
+}
+
+/* Called from I/O thread context */
+static void push_packet(struct session *s, const struct packet_info *info, const pa_memchunk *chunk) {
+
+    /* The jitter buffer puts the packet in order and tracks how
+     * irregularly packets arrive, which is why the kernel's receive
+     * time is used rather than ours */
+    pa_jitter_buffer_push(s->jitter_buffer, info->sequence, info->timestamp, info->arrival, chunk);
+
+    /* Once the sender tells us when it captured what, play it in sync
+     * with the other receivers, otherwise just keep the buffer level */
+    if (s->userdata->playout_delay > 0 && pa_playout_sync_is_ready(s->playout_sync))
+        update_sync(s, info->arrival);
+    else
+        update_rate(s, info->arrival);
+
+    if (pa_jitter_buffer_is_readable(s->jitter_buffer) &&
+        s->sink_input->thread_info.underrun_for > 0) {
+        pa_log_debug("Requesting rewind due to end of underrun");
+        pa_sink_input_request_rewind(s->sink_input,
+                                     (size_t) (s->sink_input->thread_info.underrun_for == (uint64_t) -1 ? 0 : s->sink_input->thread_info.underrun_for),
+                                     FALSE, TRUE, FALSE);
+    }
+}
+
 /* Called from I/O thread context */
 static int sink_input_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
     struct session *s = PA_SINK_INPUT(o)->userdata;
 
     switch (code) {
         case PA_SINK_INPUT_MESSAGE_GET_LATENCY:
-            *((pa_usec_t*) data) = pa_bytes_to_usec(pa_memblockq_get_length(s->memblockq), &s->sink_input->sample_spec);
+            /* The silence still held back delays the stream as much as
+             * what is buffered */
+            *((pa_usec_t*) data) = pa_bytes_to_usec(pa_jitter_buffer_get_length(s->jitter_buffer) + pa_playout_sync_get_hold(s->playout_sync),
+                                                    &s->sink_input->sample_spec);
 
             /* Fall through, the default handler will add in the extra
              * latency added by the resampler */
             break;
+
+        case SINK_INPUT_MESSAGE_GET_STATS: {
+            struct session_stats *stats = data;
+
+            pa_jitter_buffer_get_stats(s->jitter_buffer, &stats->jitter_buffer);
+            stats->synced = s->userdata->playout_delay > 0 && pa_playout_sync_is_ready(s->playout_sync);
+            stats->sync_offset = s->sync_offset;
+            return 0;
+        }
+
+        case SINK_INPUT_MESSAGE_POST_DATA:
+            pa_assert(chunk);
+
+            if (PA_SINK_IS_OPENED(s->sink_input->sink->thread_info.state))
+                push_packet(s, data, chunk);
+
+            return 0;
+
+        case SINK_INPUT_MESSAGE_SENDER_REPORT: {
+            const struct sender_report *report = data;
+
+            pa_playout_sync_report(s->playout_sync, report->when, report->timestamp);
+            return 0;
+        }
     }
 
     return pa_sink_input_process_msg(o, code, data, offset, chunk);
@@ -152,10 +434,18 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t length, pa_memchunk *chunk
     pa_sink_input_assert_ref(i);
     pa_assert_se(s = i->userdata);
 
-    if (pa_memblockq_peek(s->memblockq, chunk) < 0)
+    /* We're early, so wait before playing on */
+    if (pa_playout_sync_get_hold(s->playout_sync) > 0) {
+        pa_silence_memchunk_get(&i->core->silence_cache, i->core->mempool, chunk, &i->sample_spec, PA_MIN(length, pa_playout_sync_get_hold(s->playout_sync)));
+        chunk->length = pa_playout_sync_hold(s->playout_sync, chunk->length);
+        return 0;
+    }
+
+    if (pa_jitter_buffer_peek(s->jitter_buffer, length, chunk) < 0)
         return -1;
 
-    pa_memblockq_drop(s->memblockq, chunk->length);
+    pa_jitter_buffer_drop(s->jitter_buffer, chunk->length);
+    pa_playout_sync_played(s->playout_sync, chunk->length);
 
     return 0;
 }
@@ -167,7 +457,8 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
     pa_sink_input_assert_ref(i);
     pa_assert_se(s = i->userdata);
 
-    pa_memblockq_rewind(s->memblockq, nbytes);
+    /* What was played as silence is held back again instead */
+    pa_jitter_buffer_rewind(s->jitter_buffer, pa_playout_sync_rewind(s->playout_sync, nbytes));
 }
 
 /* Called from I/O thread context */
@@ -177,7 +468,8 @@ static void sink_input_update_max_rewind_cb(pa_sink_input *i, size_t nbytes) {
     pa_sink_input_assert_ref(i);
     pa_assert_se(s = i->userdata);
 
-    pa_memblockq_set_maxrewind(s->memblockq, nbytes);
+    pa_jitter_buffer_set_maxrewind(s->jitter_buffer, nbytes);
+    pa_playout_sync_set_maxrewind(s->playout_sync, nbytes);
 }
 
 /* Called from main context */
@@ -196,223 +488,333 @@ static void sink_input_suspend_within_thread(pa_sink_input* i, pa_bool_t b) {
     pa_sink_input_assert_ref(i);
     pa_assert_se(s = i->userdata);
 
-    if (b)
-        pa_memblockq_flush_read(s->memblockq);
-    else
-        s->first_packet = FALSE;
+    if (b) {
+        pa_jitter_buffer_flush(s->jitter_buffer);
+        pa_playout_sync_reset(s->playout_sync);
+    }
+}
+
+/* Called from I/O thread context */
+static void sink_input_attach(pa_sink_input *i) {
+    struct session *s;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(s = i->userdata);
+
+    /* Packets that queued up while the sink input was being moved are
+     * picked up by the new sink's thread */
+    pa_assert(!s->rtpoll_item_read);
+    s->rtpoll_item_read = pa_rtpoll_item_new_asyncmsgq_read(i->sink->thread_info.rtpoll, PA_RTPOLL_LATE, s->asyncmsgq);
 }
 
 /* Called from I/O thread context */
+static void sink_input_detach(pa_sink_input *i) {
+    struct session *s;
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(s = i->userdata);
+
+    pa_assert(s->rtpoll_item_read);
+    pa_rtpoll_item_free(s->rtpoll_item_read);
+    s->rtpoll_item_read = NULL;
+}
+
+static pa_bool_t same_host(const struct sockaddr *a, socklen_t alen, const struct sockaddr *b, socklen_t blen) {
+
+    if (alen <= 0 || blen <= 0 || a->sa_family != b->sa_family)
+        return FALSE;
+
+    if (a->sa_family == AF_INET)
+        return ((const struct sockaddr_in*) a)->sin_addr.s_addr == ((const struct sockaddr_in*) b)->sin_addr.s_addr;
+#ifdef HAVE_IPV6
+    if (a->sa_family == AF_INET6)
+        return memcmp(&((const struct sockaddr_in6*) a)->sin6_addr, &((const struct sockaddr_in6*) b)->sin6_addr, sizeof(struct in6_addr)) == 0;
+#endif
+
+    return FALSE;
+}
+
+/* Whether the last packet on the socket may be from the sender of the
+ * session: it has to come from the host the SDP names as origin or,
+ * for unicast sessions, as connection address. If the origin isn't a
+ * numerical address there is nothing to check against. */
+static pa_bool_t is_from_sender(struct session *s, struct rtp_socket *sk) {
+    const struct sockaddr *from = (const struct sockaddr*) &sk->rtp_context.sa;
+
+    if (s->sdp_info.origin_salen <= 0)
+        return TRUE;
+
+    return
+        same_host(from, sk->rtp_context.salen, (const struct sockaddr*) &s->sdp_info.origin_sa, s->sdp_info.origin_salen) ||
+        same_host(from, sk->rtp_context.salen, (const struct sockaddr*) &s->sdp_info.sa, s->sdp_info.salen);
+}
+
+/* Called from receiver thread context */
+static struct session *demux_packet(struct rtp_socket *sk) {
+    struct session *s;
+    uint32_t idx;
+
+    if ((s = pa_hashmap_get(sk->by_ssrc, PA_UINT32_TO_PTR(sk->rtp_context.ssrc))))
+        return s->sdp_info.payload == sk->rtp_context.payload ? s : NULL;
+
+    /* SAP doesn't tell us the SSRC, so the first new source that
+     * matches an announced payload type and sender is taken to be
+     * that session */
+    PA_IDXSET_FOREACH(s, sk->unbound, idx) {
+        if (s->sdp_info.payload != sk->rtp_context.payload)
+            continue;
+
+        if (!is_from_sender(s, sk))
+            continue;
+
+        pa_assert_se(pa_idxset_remove_by_data(sk->unbound, s, NULL) == s);
+
+        s->thread_info.bound = TRUE;
+        s->thread_info.ssrc = sk->rtp_context.ssrc;
+        pa_assert_se(pa_hashmap_put(sk->by_ssrc, PA_UINT32_TO_PTR(s->thread_info.ssrc), s) >= 0);
+
+        if (s->thread_info.ssrc == sk->userdata->core->cookie)
+            pa_log_warn("Detected RTP packet loop!");
+
+        pa_log_debug("Session '%s' has SSRC %08x", s->sdp_info.session_name, s->thread_info.ssrc);
+
+        return s;
+    }
+
+    return NULL;
+}
+
+/* Called from receiver thread context */
+static int decode_packet(struct session *s, const pa_memchunk *chunk, pa_memchunk *decoded) {
+    const uint8_t *src;
+    size_t n;
+    int r = -1;
+
+    src = (const uint8_t*) pa_memblock_acquire(chunk->memblock) + chunk->index;
+
+    if ((n = pa_codec_frame_decoded_size(s->thread_info.decoder, src, chunk->length)) > 0) {
+        decoded->memblock = pa_memblock_new(s->userdata->core->mempool, n);
+        decoded->index = 0;
+        decoded->length = n;
+
+        if ((r = pa_codec_decode_frame(s->thread_info.decoder, src, chunk->length, pa_memblock_acquire(decoded->memblock), n)) < 0) {
+            pa_memblock_release(decoded->memblock);
+            pa_memblock_unref(decoded->memblock);
+        } else
+            pa_memblock_release(decoded->memblock);
+    }
+
+    pa_memblock_release(chunk->memblock);
+
+    return r;
+}
+
+/* Called from receiver thread context */
+static void receive_rtcp(struct rtp_socket *sk) {
+    uint8_t buf[1500];
+    ssize_t r;
+
+    while ((r = recv(sk->rtcp_fd, buf, sizeof(buf), MSG_DONTWAIT)) >= 0) {
+        struct session *s;
+        struct sender_report *report;
+        struct timeval when;
+        uint32_t ssrc, timestamp;
+
+        if (pa_rtcp_parse_sender_report(buf, (size_t) r, &ssrc, &when, &timestamp) < 0)
+            continue;
+
+        /* Reports only count once we know which session the SSRC is */
+        if (!(s = pa_hashmap_get(sk->by_ssrc, PA_UINT32_TO_PTR(ssrc))))
+            continue;
+
+        report = pa_xnew(struct sender_report, 1);
+        report->when = pa_timeval_load(&when);
+        report->timestamp = timestamp;
+
+        pa_asyncmsgq_post(s->asyncmsgq, PA_MSGOBJECT(s->sink_input), SINK_INPUT_MESSAGE_SENDER_REPORT, report, 0, NULL, pa_xfree);
+    }
+
+    if (errno != EAGAIN && errno != EINTR)
+        pa_log_warn("recv() failed: %s", pa_cstrerror(errno));
+}
+
+/* Called from receiver thread context */
 static int rtpoll_work_cb(pa_rtpoll_item *i) {
     pa_memchunk chunk;
-    int64_t k, j, delta;
-    struct timeval now = { 0, 0 };
-    struct session *s;
+    struct timeval tstamp;
+    struct rtp_socket *sk;
     struct pollfd *p;
+    unsigned n;
 
-    pa_assert_se(s = pa_rtpoll_item_get_userdata(i));
+    pa_assert_se(sk = pa_rtpoll_item_get_userdata(i));
 
-    p = pa_rtpoll_item_get_pollfd(i, NULL);
+    p = pa_rtpoll_item_get_pollfd(i, &n);
 
-    if (p->revents & (POLLERR|POLLNVAL|POLLHUP|POLLOUT)) {
+    if ((p[0].revents | (n > 1 ? p[1].revents : 0)) & (POLLERR|POLLNVAL|POLLHUP|POLLOUT)) {
         pa_log("poll() signalled bad revents.");
         return -1;
     }
 
-    if ((p->revents & POLLIN) == 0)
-        return 0;
-
-    p->revents = 0;
+    if (n > 1 && (p[1].revents & POLLIN)) {
+        p[1].revents = 0;
+        receive_rtcp(sk);
+    }
 
-    if (pa_rtp_recv(&s->rtp_context, &chunk, s->userdata->module->core->mempool, &now) < 0)
+    if ((p[0].revents & POLLIN) == 0)
         return 0;
 
-    if (s->sdp_info.payload != s->rtp_context.payload ||
-        !PA_SINK_IS_OPENED(s->sink_input->sink->thread_info.state)) {
-        pa_memblock_unref(chunk.memblock);
-        return 0;
-    }
+    p[0].revents = 0;
+
+    /* Packets are read in batches, take all there are */
+    while (pa_rtp_recv(&sk->rtp_context, &chunk, sk->userdata->core->mempool, &tstamp) > 0) {
+        struct session *s;
+        struct packet_info *info;
 
-    if (!s->first_packet) {
-        s->first_packet = TRUE;
+        if (!(s = demux_packet(sk))) {
+            pa_memblock_unref(chunk.memblock);
+            continue;
+        }
 
-        s->ssrc = s->rtp_context.ssrc;
-        s->offset = s->rtp_context.timestamp;
+        /* Compressed packets are decoded in the order they arrive in,
+         * which only hurts when they're reordered, and that's rare on
+         * the networks multicast is used on */
+        if (s->thread_info.decoder) {
+            pa_memchunk decoded;
+            int r;
 
-        if (s->ssrc == s->userdata->module->core->cookie)
-            pa_log_warn("Detected RTP packet loop!");
-    } else {
-        if (s->ssrc != s->rtp_context.ssrc) {
+            r = decode_packet(s, &chunk, &decoded);
             pa_memblock_unref(chunk.memblock);
-            return 0;
+
+            if (r < 0) {
+                pa_log_debug("Failed to decode RTP packet.");
+                continue;
+            }
+
+            chunk = decoded;
         }
-    }
 
-    /* Check whether there was a timestamp overflow */
-    k = (int64_t) s->rtp_context.timestamp - (int64_t) s->offset;
-    j = (int64_t) 0x100000000LL - (int64_t) s->offset + (int64_t) s->rtp_context.timestamp;
+        if (chunk.length % pa_frame_size(&s->sdp_info.sample_spec) != 0) {
+            pa_log_warn("Bad RTP packet size.");
+            pa_memblock_unref(chunk.memblock);
+            continue;
+        }
 
-    if ((k < 0 ? -k : k) < (j < 0 ? -j : j))
-        delta = k;
-    else
-        delta = j;
+        if (tstamp.tv_sec == 0) {
+            PA_ONCE_BEGIN {
+                pa_log_warn("Using artificial time instead of timestamp");
+            } PA_ONCE_END;
+            pa_rtclock_get(&tstamp);
+        } else
+            pa_rtclock_from_wallclock(&tstamp);
 
-    pa_memblockq_seek(s->memblockq, delta * (int64_t) s->rtp_context.frame_size, PA_SEEK_RELATIVE, TRUE);
+        pa_atomic_store(&s->timestamp, (int) tstamp.tv_sec);
 
-    if (now.tv_sec == 0) {
-        PA_ONCE_BEGIN {
-            pa_log_warn("Using artificial time instead of timestamp");
-        } PA_ONCE_END;
-        pa_rtclock_get(&now);
-    } else
-        pa_rtclock_from_wallclock(&now);
+        info = pa_xnew(struct packet_info, 1);
+        info->sequence = sk->rtp_context.sequence;
+        info->timestamp = sk->rtp_context.timestamp;
+        info->arrival = pa_timeval_load(&tstamp);
 
-    if (pa_memblockq_push(s->memblockq, &chunk) < 0) {
-        pa_log_warn("Queue overrun");
-        pa_memblockq_seek(s->memblockq, (int64_t) chunk.length, PA_SEEK_RELATIVE, TRUE);
+        /* The jitter buffer lives in the sink's IO thread, hand the
+         * packet over to it */
+        pa_asyncmsgq_post(s->asyncmsgq, PA_MSGOBJECT(s->sink_input), SINK_INPUT_MESSAGE_POST_DATA, info, 0, &chunk, pa_xfree);
+        pa_memblock_unref(chunk.memblock);
     }
 
-/*     pa_log("blocks in q: %u", pa_memblockq_get_nblocks(s->memblockq)); */
-
-    pa_memblock_unref(chunk.memblock);
+    return 0;
+}
 
-    /* The next timestamp we expect */
-    s->offset = s->rtp_context.timestamp + (uint32_t) (chunk.length / s->rtp_context.frame_size);
+/* Called from receiver thread context */
+static int receiver_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
 
-    pa_atomic_store(&s->timestamp, (int) now.tv_sec);
+    switch (code) {
+        case RECEIVER_MESSAGE_ADD_SOCKET: {
+            struct rtp_socket *sk = data;
+            struct pollfd *p;
+
+            pa_assert(!sk->rtpoll_item);
+            sk->rtpoll_item = pa_rtpoll_item_new(sk->userdata->rtpoll, PA_RTPOLL_NORMAL, sk->rtcp_fd >= 0 ? 2 : 1);
+
+            p = pa_rtpoll_item_get_pollfd(sk->rtpoll_item, NULL);
+            p[0].fd = sk->rtp_context.fd;
+            p[0].events = POLLIN;
+            p[0].revents = 0;
+
+            if (sk->rtcp_fd >= 0) {
+                p[1].fd = sk->rtcp_fd;
+                p[1].events = POLLIN;
+                p[1].revents = 0;
+            }
 
-    if (s->last_rate_update + RATE_UPDATE_INTERVAL < pa_timeval_load(&now)) {
-        pa_usec_t wi, ri, render_delay, sink_delay = 0, latency;
-        uint32_t base_rate = s->sink_input->sink->sample_spec.rate;
-        uint32_t current_rate = s->sink_input->sample_spec.rate;
-        uint32_t new_rate;
-        double estimated_rate, alpha = 0.02;
-
-        pa_log_debug("Updating sample rate");
-
-        wi = pa_bytes_to_usec((uint64_t) pa_memblockq_get_write_index(s->memblockq), &s->sink_input->sample_spec);
-        ri = pa_bytes_to_usec((uint64_t) pa_memblockq_get_read_index(s->memblockq), &s->sink_input->sample_spec);
-
-        pa_log_debug("wi=%lu ri=%lu", (unsigned long) wi, (unsigned long) ri);
-
-        sink_delay = pa_sink_get_latency_within_thread(s->sink_input->sink);
-        render_delay = pa_bytes_to_usec(pa_memblockq_get_length(s->sink_input->thread_info.render_memblockq), &s->sink_input->sink->sample_spec);
-
-        if (ri > render_delay+sink_delay)
-            ri -= render_delay+sink_delay;
-        else
-            ri = 0;
-
-        if (wi < ri)
-            latency = 0;
-        else
-            latency = wi - ri;
-
-        pa_log_debug("Write index deviates by %0.2f ms, expected %0.2f ms", (double) latency/PA_USEC_PER_MSEC, (double) s->intended_latency/PA_USEC_PER_MSEC);
-
-        /* The buffer is filling with some unknown rate R̂ samples/second. If the rate of reading in
-         * the last T seconds was Rⁿ, then the increase in buffer latency ΔLⁿ = Lⁿ - Lⁿ⁻ⁱ in that
-         * same period is ΔLⁿ = (TR̂ - TRⁿ) / R̂, giving the estimated target rate
-         *                                           T
-         *                                 R̂ = ─────────────── Rⁿ .                             (1)
-         *                                     T - (Lⁿ - Lⁿ⁻ⁱ)
-         *
-         * Setting the sample rate to R̂ results in the latency being constant (if the estimate of R̂
-         * is correct).  But there is also the requirement to keep the buffer at a predefined target
-         * latency L̂.  So instead of setting Rⁿ⁺ⁱ to R̂ immediately, the strategy will be to reduce R
-         * from Rⁿ⁺ⁱ to R̂ in a steps of T seconds, where Rⁿ⁺ⁱ is chosen such that in the total time
-         * aT the latency is reduced from Lⁿ to L̂.  This strategy translates to the requirements
-         *            ₐ      R̂ - Rⁿ⁺ʲ                            a-j+1         j-1
-         *            Σ  T ────────── = L̂ - Lⁿ    with    Rⁿ⁺ʲ = ───── Rⁿ⁺ⁱ + ───── R̂ .
-         *           ʲ⁼ⁱ        R̂                                  a            a
-         * Solving for Rⁿ⁺ⁱ gives
-         *                                     T - ²∕ₐ₊₁(L̂ - Lⁿ)
-         *                              Rⁿ⁺ⁱ = ───────────────── R̂ .                            (2)
-         *                                            T
-         * In the code below a = 7 is used.
-         *
-         * Equation (1) is not directly used in (2), but instead an exponentially weighted average
-         * of the estimated rate R̂ is used.  This average R̅ is defined as
-         *                                R̅ⁿ = α R̂ⁿ + (1-α) R̅ⁿ⁻ⁱ .
-         * Because it is difficult to find a fixed value for the coefficient α such that the
-         * averaging is without significant lag but oscillations are filtered out, a heuristic is
-         * used.  When the successive estimates R̂ⁿ do not change much then α→1, but when there is a
-         * sudden spike in the estimated rate α→0, such that the deviation is given little weight.
-         */
-        estimated_rate = (double) current_rate * (double) RATE_UPDATE_INTERVAL / (double) (RATE_UPDATE_INTERVAL + s->last_latency - latency);
-        if (fabs(s->estimated_rate - s->avg_estimated_rate) > 1) {
-          double ratio = (estimated_rate + s->estimated_rate - 2*s->avg_estimated_rate) / (s->estimated_rate - s->avg_estimated_rate);
-          alpha = PA_CLAMP(2 * (ratio + fabs(ratio)) / (4 + ratio*ratio), 0.02, 0.8);
+            pa_rtpoll_item_set_work_callback(sk->rtpoll_item, rtpoll_work_cb);
+            pa_rtpoll_item_set_userdata(sk->rtpoll_item, sk);
+            return 0;
         }
-        s->avg_estimated_rate = alpha * estimated_rate + (1-alpha) * s->avg_estimated_rate;
-        s->estimated_rate = estimated_rate;
-        pa_log_debug("Estimated target rate: %.0f Hz, using average of %.0f Hz  (α=%.3f)", estimated_rate, s->avg_estimated_rate, alpha);
-        new_rate = (uint32_t) ((double) (RATE_UPDATE_INTERVAL + latency/4 - s->intended_latency/4) / (double) RATE_UPDATE_INTERVAL * s->avg_estimated_rate);
-        s->last_latency = latency;
-
-        if (new_rate < (uint32_t) (base_rate*0.8) || new_rate > (uint32_t) (base_rate*1.25)) {
-            pa_log_warn("Sample rates too different, not adjusting (%u vs. %u).", base_rate, new_rate);
-            new_rate = base_rate;
-        } else {
-            if (base_rate < new_rate + 20 && new_rate < base_rate + 20)
-              new_rate = base_rate;
-            /* Do the adjustment in small steps; 2‰ can be considered inaudible */
-            if (new_rate < (uint32_t) (current_rate*0.998) || new_rate > (uint32_t) (current_rate*1.002)) {
-                pa_log_info("New rate of %u Hz not within 2‰ of %u Hz, forcing smaller adjustment", new_rate, current_rate);
-                new_rate = PA_CLAMP(new_rate, (uint32_t) (current_rate*0.998), (uint32_t) (current_rate*1.002));
-            }
+
+        case RECEIVER_MESSAGE_REMOVE_SOCKET: {
+            struct rtp_socket *sk = data;
+
+            pa_assert(sk->rtpoll_item);
+            pa_rtpoll_item_free(sk->rtpoll_item);
+            sk->rtpoll_item = NULL;
+            return 0;
         }
-        s->sink_input->sample_spec.rate = new_rate;
 
-        pa_assert(pa_sample_spec_valid(&s->sink_input->sample_spec));
+        case RECEIVER_MESSAGE_ADD_SESSION: {
+            struct session *s = data;
 
-        pa_resampler_set_input_rate(s->sink_input->thread_info.resampler, s->sink_input->sample_spec.rate);
+            pa_assert_se(pa_idxset_put(s->socket->unbound, s, NULL) >= 0);
 
-        pa_log_debug("Updated sampling rate to %lu Hz.", (unsigned long) s->sink_input->sample_spec.rate);
+            pa_assert(!s->thread_info.rtpoll_item_write);
+            s->thread_info.rtpoll_item_write = pa_rtpoll_item_new_asyncmsgq_write(s->userdata->rtpoll, PA_RTPOLL_EARLY, s->asyncmsgq);
+            return 0;
+        }
 
-        s->last_rate_update = pa_timeval_load(&now);
-    }
+        case RECEIVER_MESSAGE_REMOVE_SESSION: {
+            struct session *s = data;
 
-    if (pa_memblockq_is_readable(s->memblockq) &&
-        s->sink_input->thread_info.underrun_for > 0) {
-        pa_log_debug("Requesting rewind due to end of underrun");
-        pa_sink_input_request_rewind(s->sink_input,
-                                     (size_t) (s->sink_input->thread_info.underrun_for == (uint64_t) -1 ? 0 : s->sink_input->thread_info.underrun_for),
-                                     FALSE, TRUE, FALSE);
+            if (s->thread_info.bound)
+                pa_assert_se(pa_hashmap_remove(s->socket->by_ssrc, PA_UINT32_TO_PTR(s->thread_info.ssrc)) == s);
+            else
+                pa_assert_se(pa_idxset_remove_by_data(s->socket->unbound, s, NULL) == s);
+
+            pa_assert(s->thread_info.rtpoll_item_write);
+            pa_rtpoll_item_free(s->thread_info.rtpoll_item_write);
+            s->thread_info.rtpoll_item_write = NULL;
+            return 0;
+        }
     }
 
-    return 1;
+    return 0;
 }
 
-/* Called from I/O thread context */
-static void sink_input_attach(pa_sink_input *i) {
-    struct session *s;
-    struct pollfd *p;
+static void thread_func(void *userdata) {
+    struct userdata *u = userdata;
 
-    pa_sink_input_assert_ref(i);
-    pa_assert_se(s = i->userdata);
+    pa_assert(u);
 
-    pa_assert(!s->rtpoll_item);
-    s->rtpoll_item = pa_rtpoll_item_new(i->sink->thread_info.rtpoll, PA_RTPOLL_LATE, 1);
+    pa_log_debug("Thread starting up");
 
-    p = pa_rtpoll_item_get_pollfd(s->rtpoll_item, NULL);
-    p->fd = s->rtp_context.fd;
-    p->events = POLLIN;
-    p->revents = 0;
+    pa_core_set_io_thread_affinity(u->core, NULL);
 
-    pa_rtpoll_item_set_work_callback(s->rtpoll_item, rtpoll_work_cb);
-    pa_rtpoll_item_set_userdata(s->rtpoll_item, s);
-}
+    pa_thread_mq_install(&u->thread_mq);
 
-/* Called from I/O thread context */
-static void sink_input_detach(pa_sink_input *i) {
-    struct session *s;
-    pa_sink_input_assert_ref(i);
-    pa_assert_se(s = i->userdata);
+    for (;;) {
+        int ret;
 
-    pa_assert(s->rtpoll_item);
-    pa_rtpoll_item_free(s->rtpoll_item);
-    s->rtpoll_item = NULL;
+        if ((ret = pa_rtpoll_run(u->rtpoll, TRUE)) < 0)
+            goto fail;
+
+        if (ret == 0)
+            goto finish;
+    }
+
+fail:
+    /* If this was no regular exit from the loop we have to continue
+     * processing messages until we received PA_MESSAGE_SHUTDOWN */
+    pa_asyncmsgq_post(u->thread_mq.outq, PA_MSGOBJECT(u->core), PA_CORE_MESSAGE_UNLOAD_MODULE, u->module, 0, NULL, NULL);
+    pa_asyncmsgq_wait_for(u->thread_mq.inq, PA_MESSAGE_SHUTDOWN);
+
+finish:
+    pa_log_debug("Thread shutting down");
 }
 
 static int mcast_socket(const struct sockaddr* sa, socklen_t salen) {
@@ -429,7 +831,13 @@ static int mcast_socket(const struct sockaddr* sa, socklen_t salen) {
 
     pa_make_udp_socket_low_delay(fd);
 
-#ifdef SO_TIMESTAMP
+#if defined(SO_TIMESTAMPNS)
+    one = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one)) < 0) {
+        pa_log("SO_TIMESTAMPNS failed: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+#elif defined(SO_TIMESTAMP)
     one = 1;
     if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, &one, sizeof(one)) < 0) {
         pa_log("SO_TIMESTAMP failed: %s", pa_cstrerror(errno));
@@ -480,11 +888,107 @@ fail:
     return -1;
 }
 
+static pa_bool_t sockaddr_equal(const struct sockaddr *a, const struct sockaddr *b) {
+
+    if (a->sa_family != b->sa_family)
+        return FALSE;
+
+    if (a->sa_family == AF_INET) {
+        const struct sockaddr_in *a4 = (const struct sockaddr_in*) a, *b4 = (const struct sockaddr_in*) b;
+        return a4->sin_port == b4->sin_port && a4->sin_addr.s_addr == b4->sin_addr.s_addr;
+#ifdef HAVE_IPV6
+    } else if (a->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *a6 = (const struct sockaddr_in6*) a, *b6 = (const struct sockaddr_in6*) b;
+        return a6->sin6_port == b6->sin6_port && memcmp(&a6->sin6_addr, &b6->sin6_addr, sizeof(a6->sin6_addr)) == 0;
+#endif
+    }
+
+    return FALSE;
+}
+
+/* Sessions announced for the same group and port share the socket */
+static struct rtp_socket *rtp_socket_get(struct userdata *u, const pa_sdp_info *sdp_info) {
+    struct rtp_socket *sk;
+    struct sockaddr_storage rtcp_sa;
+    int fd, rtcp_fd = -1;
+
+    pa_assert(u);
+    pa_assert(sdp_info);
+
+    PA_LLIST_FOREACH(sk, u->sockets)
+        if (sockaddr_equal((const struct sockaddr*) &sk->sa, (const struct sockaddr*) &sdp_info->sa)) {
+            sk->n_ref++;
+            return sk;
+        }
+
+    if ((fd = mcast_socket((const struct sockaddr*) &sdp_info->sa, sdp_info->salen)) < 0)
+        return NULL;
+
+    /* Sender reports come in on the next port. Without them the
+     * sessions still play, just not in sync. */
+    memcpy(&rtcp_sa, &sdp_info->sa, sdp_info->salen);
+
+    if (rtcp_sa.ss_family == AF_INET)
+        ((struct sockaddr_in*) &rtcp_sa)->sin_port = htons((uint16_t) (ntohs(((struct sockaddr_in*) &rtcp_sa)->sin_port) + 1));
+#ifdef HAVE_IPV6
+    else if (rtcp_sa.ss_family == AF_INET6)
+        ((struct sockaddr_in6*) &rtcp_sa)->sin6_port = htons((uint16_t) (ntohs(((struct sockaddr_in6*) &rtcp_sa)->sin6_port) + 1));
+#endif
+
+    if ((rtcp_fd = mcast_socket((const struct sockaddr*) &rtcp_sa, sdp_info->salen)) < 0)
+        pa_log_info("Not receiving RTCP, playback won't be synchronized.");
+
+    sk = pa_xnew0(struct rtp_socket, 1);
+    sk->userdata = u;
+    sk->n_ref = 1;
+    memcpy(&sk->sa, &sdp_info->sa, sdp_info->salen);
+    sk->salen = sdp_info->salen;
+
+    /* The frame size depends on the session, which is only known
+     * after the packet is parsed */
+    pa_rtp_context_init_recv(&sk->rtp_context, fd, 1);
+    sk->rtcp_fd = rtcp_fd;
+    sk->by_ssrc = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+    sk->unbound = pa_idxset_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+
+    PA_LLIST_PREPEND(struct rtp_socket, u->sockets, sk);
+
+    pa_assert_se(pa_asyncmsgq_send(u->thread_mq.inq, PA_MSGOBJECT(u->msg), RECEIVER_MESSAGE_ADD_SOCKET, sk, 0, NULL) == 0);
+
+    return sk;
+}
+
+static void rtp_socket_unref(struct rtp_socket *sk) {
+    struct userdata *u;
+
+    pa_assert(sk);
+    pa_assert(sk->n_ref >= 1);
+
+    if (--sk->n_ref > 0)
+        return;
+
+    u = sk->userdata;
+
+    pa_assert_se(pa_asyncmsgq_send(u->thread_mq.inq, PA_MSGOBJECT(u->msg), RECEIVER_MESSAGE_REMOVE_SOCKET, sk, 0, NULL) == 0);
+
+    PA_LLIST_REMOVE(struct rtp_socket, u->sockets, sk);
+
+    pa_assert(pa_hashmap_isempty(sk->by_ssrc));
+    pa_hashmap_free(sk->by_ssrc, NULL);
+    pa_assert(pa_idxset_isempty(sk->unbound));
+    pa_idxset_free(sk->unbound, NULL);
+
+    pa_rtp_context_destroy(&sk->rtp_context);
+
+    if (sk->rtcp_fd >= 0)
+        pa_close(sk->rtcp_fd);
+
+    pa_xfree(sk);
+}
+
 static struct session *session_new(struct userdata *u, const pa_sdp_info *sdp_info) {
     struct session *s = NULL;
     pa_sink *sink;
-    int fd = -1;
-    pa_memchunk silence;
     pa_sink_input_new_data data;
     struct timeval now;
 
@@ -505,17 +1009,19 @@ static struct session *session_new(struct userdata *u, const pa_sdp_info *sdp_in
 
     s = pa_xnew0(struct session, 1);
     s->userdata = u;
-    s->first_packet = FALSE;
     s->sdp_info = *sdp_info;
-    s->rtpoll_item = NULL;
-    s->intended_latency = LATENCY_USEC;
     s->last_rate_update = pa_timeval_load(&now);
-    s->last_latency = LATENCY_USEC;
     s->estimated_rate = (double) sink->sample_spec.rate;
     s->avg_estimated_rate = (double) sink->sample_spec.rate;
     pa_atomic_store(&s->timestamp, (int) now.tv_sec);
 
-    if ((fd = mcast_socket((const struct sockaddr*) &sdp_info->sa, sdp_info->salen)) < 0)
+    if (sdp_info->encoding != PA_ENCODING_PCM &&
+        !(s->thread_info.decoder = pa_codec_new_decoder(sdp_info->encoding, &sdp_info->sample_spec))) {
+        pa_log("Can't decode %s streams.", pa_encoding_to_string(sdp_info->encoding));
+        goto fail;
+    }
+
+    if (!(s->socket = rtp_socket_get(u, sdp_info)))
         goto fail;
 
     pa_sink_input_new_data_init(&data);
@@ -532,6 +1038,8 @@ static struct session *session_new(struct userdata *u, const pa_sdp_info *sdp_in
         pa_proplist_sets(data.proplist, "rtp.session", sdp_info->session_name);
     pa_proplist_sets(data.proplist, "rtp.origin", sdp_info->origin);
     pa_proplist_setf(data.proplist, "rtp.payload", "%u", (unsigned) sdp_info->payload);
+    if (sdp_info->encoding != PA_ENCODING_PCM)
+        pa_proplist_sets(data.proplist, "rtp.encoding", pa_encoding_to_string(sdp_info->encoding));
     data.module = u->module;
     pa_sink_input_new_data_set_sample_spec(&data, &sdp_info->sample_spec);
     data.flags = PA_SINK_INPUT_VARIABLE_RATE;
@@ -555,27 +1063,15 @@ static struct session *session_new(struct userdata *u, const pa_sdp_info *sdp_in
     s->sink_input->detach = sink_input_detach;
     s->sink_input->suspend_within_thread = sink_input_suspend_within_thread;
 
-    pa_sink_input_get_silence(s->sink_input, &silence);
+    s->sink_latency = pa_sink_input_set_requested_latency(s->sink_input, u->min_latency);
 
-    s->sink_latency = pa_sink_input_set_requested_latency(s->sink_input, s->intended_latency/2);
+    s->jitter_buffer = pa_jitter_buffer_new(&s->sink_input->sample_spec, u->min_latency, u->max_latency, u->module->core->mempool);
+    s->playout_sync = pa_playout_sync_new(&s->sink_input->sample_spec, u->playout_delay);
 
-    if (s->intended_latency < s->sink_latency*2)
-        s->intended_latency = s->sink_latency*2;
+    s->intended_latency = pa_jitter_buffer_get_target(s->jitter_buffer) + s->sink_latency;
+    s->last_latency = s->intended_latency;
 
-    s->memblockq = pa_memblockq_new(
-            "module-rtp-recv memblockq",
-            0,
-            MEMBLOCKQ_MAXLENGTH,
-            MEMBLOCKQ_MAXLENGTH,
-            &s->sink_input->sample_spec,
-            pa_usec_to_bytes(s->intended_latency - s->sink_latency, &s->sink_input->sample_spec),
-            0,
-            0,
-            &silence);
-
-    pa_memblock_unref(silence.memblock);
-
-    pa_rtp_context_init_recv(&s->rtp_context, fd, pa_frame_size(&s->sdp_info.sample_spec));
+    s->asyncmsgq = pa_asyncmsgq_new(0);
 
     pa_hashmap_put(s->userdata->by_origin, s->sdp_info.origin, s);
     u->n_sessions++;
@@ -583,34 +1079,61 @@ static struct session *session_new(struct userdata *u, const pa_sdp_info *sdp_in
 
     pa_sink_input_put(s->sink_input);
 
+    pa_assert_se(pa_asyncmsgq_send(u->thread_mq.inq, PA_MSGOBJECT(u->msg), RECEIVER_MESSAGE_ADD_SESSION, s, 0, NULL) == 0);
+
     pa_log_info("New session '%s'", s->sdp_info.session_name);
 
     return s;
 
 fail:
-    pa_xfree(s);
+    if (s && s->socket)
+        rtp_socket_unref(s->socket);
 
-    if (fd >= 0)
-        pa_close(fd);
+    if (s && s->thread_info.decoder)
+        pa_codec_free(s->thread_info.decoder);
+
+    pa_xfree(s);
 
     return NULL;
 }
 
 static void session_free(struct session *s) {
+    pa_jitter_buffer_stats stats;
+
     pa_assert(s);
 
     pa_log_info("Freeing session '%s'", s->sdp_info.session_name);
 
+    /* Make sure no more packets are posted before the queue is emptied,
+     * the messages in it hold references to the sink input */
+    pa_assert_se(pa_asyncmsgq_send(s->userdata->thread_mq.inq, PA_MSGOBJECT(s->userdata->msg), RECEIVER_MESSAGE_REMOVE_SESSION, s, 0, NULL) == 0);
+
     pa_sink_input_unlink(s->sink_input);
+    pa_asyncmsgq_flush(s->asyncmsgq, FALSE);
     pa_sink_input_unref(s->sink_input);
 
     PA_LLIST_REMOVE(struct session, s->userdata->sessions, s);
     pa_assert(s->userdata->n_sessions >= 1);
     s->userdata->n_sessions--;
 
-    pa_memblockq_free(s->memblockq);
+    /* The IO thread is done with the jitter buffer now */
+    pa_jitter_buffer_get_stats(s->jitter_buffer, &stats);
+    pa_log_info("Session '%s' received %llu packets, %llu lost, %llu late, %0.2f ms concealed, %llu underruns",
+                s->sdp_info.session_name,
+                (unsigned long long) stats.received,
+                (unsigned long long) stats.lost,
+                (unsigned long long) stats.late,
+                (double) stats.concealed / PA_USEC_PER_MSEC,
+                (unsigned long long) stats.underruns);
+
+    pa_jitter_buffer_free(s->jitter_buffer);
+    pa_playout_sync_free(s->playout_sync);
+    pa_asyncmsgq_unref(s->asyncmsgq);
+    rtp_socket_unref(s->socket);
+
+    if (s->thread_info.decoder)
+        pa_codec_free(s->thread_info.decoder);
     pa_sdp_info_destroy(&s->sdp_info);
-    pa_rtp_context_destroy(&s->rtp_context);
 
     pa_xfree(s);
 }
@@ -684,6 +1207,40 @@ static void check_death_event_cb(pa_mainloop_api *m, pa_time_event *t, const str
     pa_core_rttime_restart(u->module->core, t, pa_rtclock_now() + DEATH_TIMEOUT * PA_USEC_PER_SEC);
 }
 
+static void update_stats_event_cb(pa_mainloop_api *m, pa_time_event *t, const struct timeval *tv, void *userdata) {
+    struct userdata *u = userdata;
+    struct session *s;
+
+    pa_assert(m);
+    pa_assert(t);
+    pa_assert(u);
+
+    PA_LLIST_FOREACH(s, u->sessions) {
+        struct session_stats stats;
+        pa_proplist *pl;
+
+        if (pa_asyncmsgq_send(s->sink_input->sink->asyncmsgq, PA_MSGOBJECT(s->sink_input), SINK_INPUT_MESSAGE_GET_STATS, &stats, 0, NULL) < 0)
+            continue;
+
+        pl = pa_proplist_new();
+        pa_proplist_setf(pl, "rtp.received", "%llu", (unsigned long long) stats.jitter_buffer.received);
+        pa_proplist_setf(pl, "rtp.lost", "%llu", (unsigned long long) stats.jitter_buffer.lost);
+        pa_proplist_setf(pl, "rtp.late", "%llu", (unsigned long long) stats.jitter_buffer.late);
+        pa_proplist_setf(pl, "rtp.concealed_usec", "%llu", (unsigned long long) stats.jitter_buffer.concealed);
+        pa_proplist_setf(pl, "rtp.jitter_usec", "%llu", (unsigned long long) stats.jitter_buffer.jitter);
+        pa_proplist_setf(pl, "rtp.buffer_target_usec", "%llu", (unsigned long long) stats.jitter_buffer.target);
+        pa_proplist_setf(pl, "rtp.buffer_usec", "%llu", (unsigned long long) stats.jitter_buffer.depth);
+
+        /* How far we are off the shared playout time, late if positive */
+        if (stats.synced)
+            pa_proplist_setf(pl, "rtp.sync_offset_usec", "%lli", (long long) stats.sync_offset);
+        pa_sink_input_update_proplist(s->sink_input, PA_UPDATE_REPLACE, pl);
+        pa_proplist_free(pl);
+    }
+
+    pa_core_rttime_restart(u->module->core, t, pa_rtclock_now() + STATS_INTERVAL);
+}
+
 int pa__init(pa_module*m) {
     struct userdata *u;
     pa_modargs *ma = NULL;
@@ -694,6 +1251,8 @@ int pa__init(pa_module*m) {
     struct sockaddr *sa;
     socklen_t salen;
     const char *sap_address;
+    uint32_t min_latency_msec = DEFAULT_MIN_LATENCY_MSEC, max_latency_msec = DEFAULT_MAX_LATENCY_MSEC;
+    uint32_t playout_delay_msec = 0;
     int fd = -1;
 
     pa_assert(m);
@@ -705,6 +1264,18 @@ int pa__init(pa_module*m) {
 
     sap_address = pa_modargs_get_value(ma, "sap_address", DEFAULT_SAP_ADDRESS);
 
+    if (pa_modargs_get_value_u32(ma, "min_latency_msec", &min_latency_msec) < 0 ||
+        pa_modargs_get_value_u32(ma, "max_latency_msec", &max_latency_msec) < 0 ||
+        min_latency_msec < 1 || min_latency_msec > max_latency_msec || max_latency_msec > 10000) {
+        pa_log("Invalid latency specification");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_u32(ma, "playout_delay_msec", &playout_delay_msec) < 0 || playout_delay_msec > 10000) {
+        pa_log("Invalid playout delay");
+        goto fail;
+    }
+
     if (inet_pton(AF_INET, sap_address, &sa4.sin_addr) > 0) {
         sa4.sin_family = AF_INET;
         sa4.sin_port = htons(SAP_PORT);
@@ -725,19 +1296,36 @@ int pa__init(pa_module*m) {
     if ((fd = mcast_socket(sa, salen)) < 0)
         goto fail;
 
-    m->userdata = u = pa_xnew(struct userdata, 1);
+    m->userdata = u = pa_xnew0(struct userdata, 1);
     u->module = m;
     u->core = m->core;
     u->sink_name = pa_xstrdup(pa_modargs_get_value(ma, "sink", NULL));
+    u->min_latency = min_latency_msec * PA_USEC_PER_MSEC;
+    u->max_latency = max_latency_msec * PA_USEC_PER_MSEC;
+    u->playout_delay = playout_delay_msec * PA_USEC_PER_MSEC;
 
     u->sap_event = m->core->mainloop->io_new(m->core->mainloop, fd, PA_IO_EVENT_INPUT, sap_event_cb, u);
     pa_sap_context_init_recv(&u->sap_context, fd);
+    fd = -1;
 
+    PA_LLIST_HEAD_INIT(struct rtp_socket, u->sockets);
     PA_LLIST_HEAD_INIT(struct session, u->sessions);
     u->n_sessions = 0;
     u->by_origin = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
 
+    u->rtpoll = pa_rtpoll_new();
+    pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll);
+
+    u->msg = pa_msgobject_new(receiver_msg);
+    u->msg->parent.process_msg = receiver_process_msg;
+
+    if (!(u->thread = pa_thread_new("rtp-recv", thread_func, u))) {
+        pa_log("Failed to create thread.");
+        goto fail;
+    }
+
     u->check_death_event = pa_core_rttime_new(m->core, pa_rtclock_now() + DEATH_TIMEOUT * PA_USEC_PER_SEC, check_death_event_cb, u);
+    u->update_stats_event = pa_core_rttime_new(m->core, pa_rtclock_now() + STATS_INTERVAL, update_stats_event_cb, u);
 
     pa_modargs_free(ma);
 
@@ -750,6 +1338,8 @@ fail:
     if (fd >= 0)
         pa_close(fd);
 
+    pa__done(m);
+
     return -1;
 }
 
@@ -767,11 +1357,31 @@ void pa__done(pa_module*m) {
     if (u->check_death_event)
         m->core->mainloop->time_free(u->check_death_event);
 
-    pa_sap_context_destroy(&u->sap_context);
+    if (u->update_stats_event)
+        m->core->mainloop->time_free(u->update_stats_event);
+
+    if (u->sap_event)
+        pa_sap_context_destroy(&u->sap_context);
 
+    /* The sessions need the thread to let go of their sockets */
     if (u->by_origin)
         pa_hashmap_free(u->by_origin, (pa_free_cb_t) session_free);
 
+    pa_assert(!u->sockets);
+
+    if (u->thread) {
+        pa_asyncmsgq_send(u->thread_mq.inq, NULL, PA_MESSAGE_SHUTDOWN, NULL, 0, NULL);
+        pa_thread_free(u->thread);
+    }
+
+    if (u->rtpoll) {
+        pa_thread_mq_done(&u->thread_mq);
+        pa_rtpoll_free(u->rtpoll);
+    }
+
+    if (u->msg)
+        pa_msgobject_unref(PA_MSGOBJECT(u->msg));
+
     pa_xfree(u->sink_name);
     pa_xfree(u);
 }
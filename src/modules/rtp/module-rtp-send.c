@@ -47,6 +47,7 @@
 #include <pulsecore/macro.h>
 #include <pulsecore/socket-util.h>
 #include <pulsecore/arpa-inet.h>
+#include <pulsecore/codec.h>
 
 #include "module-rtp-send-symdef.h"
 
@@ -60,7 +61,7 @@ PA_MODULE_VERSION(PACKAGE_VERSION);
 PA_MODULE_LOAD_ONCE(FALSE);
 PA_MODULE_USAGE(
         "source=<name of the source> "
-        "format=<sample format> "
+        "format=<sample format, s24be for L24> "
         "channels=<number of channels> "
         "rate=<sample rate> "
         "destination_ip=<destination IP address> "
@@ -68,7 +69,9 @@ PA_MODULE_USAGE(
         "port=<port number> "
         "mtu=<maximum transfer unit> "
         "loop=<loopback to local host?> "
-        "ttl=<ttl value>"
+        "ttl=<ttl value> "
+        "compression=<none or opus> "
+        "compression_quality=<0 to 10>"
 );
 
 #define DEFAULT_PORT 46000
@@ -79,6 +82,7 @@ PA_MODULE_USAGE(
 #define MEMBLOCKQ_MAXLENGTH (1024*170)
 #define DEFAULT_MTU 1280
 #define SAP_INTERVAL (5*PA_USEC_PER_SEC)
+#define RTCP_INTERVAL (1*PA_USEC_PER_SEC)
 
 static const char* const valid_modargs[] = {
     "source",
@@ -92,6 +96,8 @@ static const char* const valid_modargs[] = {
     "mtu" ,
     "loop",
     "ttl",
+    "compression",
+    "compression_quality",
     NULL
 };
 
@@ -105,7 +111,16 @@ struct userdata {
     pa_sap_context sap_context;
     size_t mtu;
 
+    /* Compressed streams are sent a frame per packet */
+    pa_codec *encoder;
+    uint8_t *buffer;
+
     pa_time_event *sap_event;
+
+    /* For RTCP sender reports, sent on the port after the RTP one */
+    int rtcp_fd;
+    char *cname;
+    pa_usec_t next_report;
 };
 
 /* Called from I/O thread context */
@@ -125,6 +140,54 @@ static int source_output_process_msg(pa_msgobject *o, int code, void *data, int6
     return pa_source_output_process_msg(o, code, data, offset, chunk);
 }
 
+/* Called from I/O thread context */
+static void send_encoded(struct userdata *u) {
+    size_t frame_size;
+    unsigned samples;
+
+    frame_size = pa_codec_get_frame_size(u->encoder);
+    samples = (unsigned) (frame_size / pa_frame_size(&u->source_output->sample_spec));
+
+    while (pa_memblockq_get_length(u->memblockq) >= frame_size) {
+        pa_memchunk chunk;
+        size_t n;
+
+        pa_assert_se(pa_memblockq_peek_fixed_size(u->memblockq, frame_size, &chunk) >= 0);
+
+        n = pa_codec_encode_frame(u->encoder, pa_memblock_acquire_chunk(&chunk), u->buffer, u->mtu);
+
+        pa_memblock_release(chunk.memblock);
+        pa_memblock_unref(chunk.memblock);
+        pa_memblockq_drop(u->memblockq, frame_size);
+
+        if (n == (size_t) -1) {
+            /* The receiver will see this as a lost packet */
+            u->rtp_context.sequence++;
+            u->rtp_context.timestamp += samples;
+            continue;
+        }
+
+        pa_rtp_send_frame(&u->rtp_context, u->buffer, n, samples);
+    }
+}
+
+/* Called from I/O thread context */
+static void send_report(struct userdata *u) {
+    struct timeval now;
+    pa_usec_t latency;
+    uint32_t timestamp;
+
+    /* The last sample we got from the source is the one the source
+     * latency ago, and it goes out after everything in the queue */
+    latency = pa_source_get_latency_within_thread(u->source_output->source);
+    timestamp = u->rtp_context.timestamp + (uint32_t) (pa_memblockq_get_length(u->memblockq) / pa_frame_size(&u->source_output->sample_spec));
+
+    pa_gettimeofday(&now);
+    pa_timeval_sub(&now, latency);
+
+    pa_rtcp_send_sender_report(&u->rtp_context, u->rtcp_fd, &now, timestamp, u->cname);
+}
+
 /* Called from I/O thread context */
 static void source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
     struct userdata *u;
@@ -136,7 +199,15 @@ static void source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
         return;
     }
 
-    pa_rtp_send(&u->rtp_context, u->mtu, u->memblockq);
+    if (u->encoder)
+        send_encoded(u);
+    else
+        pa_rtp_send(&u->rtp_context, u->mtu, u->memblockq);
+
+    if (u->rtcp_fd >= 0 && pa_rtclock_now() >= u->next_report) {
+        send_report(u);
+        u->next_report = pa_rtclock_now() + RTCP_INTERVAL;
+    }
 }
 
 /* Called from main context */
@@ -172,13 +243,13 @@ int pa__init(pa_module*m) {
     uint32_t port = DEFAULT_PORT, mtu;
     uint32_t ttl = DEFAULT_TTL;
     sa_family_t af;
-    int fd = -1, sap_fd = -1;
+    int fd = -1, sap_fd = -1, rtcp_fd = -1;
     pa_source *s;
     pa_sample_spec ss;
     pa_channel_map cm;
-    struct sockaddr_in dst_sa4, dst_sap_sa4, src_sa4, src_sap_sa4;
+    struct sockaddr_in dst_sa4, dst_sap_sa4, dst_rtcp_sa4, src_sa4, src_sap_sa4;
 #ifdef HAVE_IPV6
-    struct sockaddr_in6 dst_sa6, dst_sap_sa6, src_sa6, src_sap_sa6;
+    struct sockaddr_in6 dst_sa6, dst_sap_sa6, dst_rtcp_sa6, src_sa6, src_sap_sa6;
 #endif
     struct sockaddr_storage sa_dst;
     pa_source_output *o = NULL;
@@ -186,9 +257,14 @@ int pa__init(pa_module*m) {
     char *p;
     int r, j;
     socklen_t k;
-    char hn[128], *n;
+    char hn[128], un[128], *n;
     pa_bool_t loop = FALSE;
     pa_source_output_new_data data;
+    const char *compression;
+    pa_encoding_t encoding = PA_ENCODING_PCM;
+    uint32_t compression_quality = PA_CODEC_QUALITY_DEFAULT;
+    pa_codec *encoder = NULL;
+    char st[PA_SAMPLE_SPEC_SNPRINT_MAX];
 
     pa_assert(m);
 
@@ -215,16 +291,51 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
-    if (!pa_rtp_sample_spec_valid(&ss)) {
-        pa_log("Specified sample type not compatible with RTP");
-        goto fail;
+    if ((compression = pa_modargs_get_value(ma, "compression", NULL)) && !pa_streq(compression, "none")) {
+        encoding = pa_encoding_from_string(compression);
+
+        if (encoding != PA_ENCODING_OPUS) {
+            pa_log("Invalid compression '%s'", compression);
+            goto fail;
+        }
+
+        if (pa_modargs_get_value_u32(ma, "compression_quality", &compression_quality) < 0 ||
+            compression_quality > PA_CODEC_QUALITY_MAX) {
+            pa_log("Invalid compression quality");
+            goto fail;
+        }
+
+        /* The RTP clock for Opus is always 48 kHz (RFC 7587), and the
+         * codec only takes some sample formats */
+        if (!pa_modargs_get_value(ma, "format", NULL))
+            ss.format = PA_SAMPLE_S16NE;
+
+        if (!pa_modargs_get_value(ma, "rate", NULL))
+            ss.rate = 48000;
+
+        if (!pa_modargs_get_value(ma, "channels", NULL) && ss.channels > 2)
+            ss.channels = 2;
+
+        if (ss.rate != 48000 || !(encoder = pa_codec_new_encoder(encoding, &ss, compression_quality))) {
+            pa_log("%s is not available for %s.", compression, pa_sample_spec_snprint(st, sizeof(st), &ss));
+            goto fail;
+        }
+
+        /* Dynamic payload type */
+        payload = 127;
+
+    } else {
+        if (!pa_rtp_sample_spec_valid(&ss)) {
+            pa_log("Specified sample type not compatible with RTP");
+            goto fail;
+        }
+
+        payload = pa_rtp_payload_from_sample_spec(&ss);
     }
 
     if (ss.channels != cm.channels)
         pa_channel_map_init_auto(&cm, ss.channels, PA_CHANNEL_MAP_AIFF);
 
-    payload = pa_rtp_payload_from_sample_spec(&ss);
-
     mtu = (uint32_t) pa_frame_align(DEFAULT_MTU, &ss);
 
     if (pa_modargs_get_value_u32(ma, "mtu", &mtu) < 0 || mtu < 1 || mtu % pa_frame_size(&ss) != 0) {
@@ -272,12 +383,16 @@ int pa__init(pa_module*m) {
         dst_sa4.sin_port = htons((uint16_t) port);
         dst_sap_sa4 = dst_sa4;
         dst_sap_sa4.sin_port = htons(SAP_PORT);
+        dst_rtcp_sa4 = dst_sa4;
+        dst_rtcp_sa4.sin_port = htons((uint16_t) (port + 1));
 #ifdef HAVE_IPV6
     } else if (inet_pton(AF_INET6, dst_addr, &dst_sa6.sin6_addr) > 0) {
         dst_sa6.sin6_family = af = AF_INET6;
         dst_sa6.sin6_port = htons((uint16_t) port);
         dst_sap_sa6 = dst_sa6;
         dst_sap_sa6.sin6_port = htons(SAP_PORT);
+        dst_rtcp_sa6 = dst_sa6;
+        dst_rtcp_sa6.sin6_port = htons((uint16_t) (port + 1));
 #endif
     } else {
         pa_log("Invalid destination '%s'", dst_addr);
@@ -334,9 +449,29 @@ int pa__init(pa_module*m) {
 #endif
     }
 
+    /* RTCP goes from and to the port after the RTP one (RFC 3550 11).
+     * Without it receivers can't play in sync, but they still play. */
+    if (port >= 0xFFFF)
+        pa_log_warn("No port left for RTCP, not sending sender reports.");
+    else if ((rtcp_fd = pa_socket_cloexec(af, SOCK_DGRAM, 0)) < 0) {
+        pa_log("socket() failed: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    if (rtcp_fd >= 0 && af == AF_INET && connect(rtcp_fd, (struct sockaddr*) &dst_rtcp_sa4, sizeof(dst_rtcp_sa4)) < 0) {
+        pa_log("connect() failed: %s", pa_cstrerror(errno));
+        goto fail;
+#ifdef HAVE_IPV6
+    } else if (rtcp_fd >= 0 && af == AF_INET6 && connect(rtcp_fd, (struct sockaddr*) &dst_rtcp_sa6, sizeof(dst_rtcp_sa6)) < 0) {
+        pa_log("connect() failed: %s", pa_cstrerror(errno));
+        goto fail;
+#endif
+    }
+
     j = !!loop;
     if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &j, sizeof(j)) < 0 ||
-        setsockopt(sap_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &j, sizeof(j)) < 0) {
+        setsockopt(sap_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &j, sizeof(j)) < 0 ||
+        (rtcp_fd >= 0 && setsockopt(rtcp_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &j, sizeof(j)) < 0)) {
         pa_log("IP_MULTICAST_LOOP failed: %s", pa_cstrerror(errno));
         goto fail;
     }
@@ -353,12 +488,20 @@ int pa__init(pa_module*m) {
             pa_log("IP_MULTICAST_TTL (sap) failed: %s", pa_cstrerror(errno));
             goto fail;
         }
+
+        if (rtcp_fd >= 0 && setsockopt(rtcp_fd, IPPROTO_IP, IP_MULTICAST_TTL, &_ttl, sizeof(_ttl)) < 0) {
+            pa_log("IP_MULTICAST_TTL (rtcp) failed: %s", pa_cstrerror(errno));
+            goto fail;
+        }
     }
 
     /* If the socket queue is full, let's drop packets */
     pa_make_fd_nonblock(fd);
     pa_make_udp_socket_low_delay(fd);
 
+    if (rtcp_fd >= 0)
+        pa_make_fd_nonblock(rtcp_fd);
+
     pa_source_output_new_data_init(&data);
     pa_proplist_sets(data.proplist, PA_PROP_MEDIA_NAME, "RTP Monitor Stream");
     pa_proplist_sets(data.proplist, "rtp.source", src_addr);
@@ -366,6 +509,8 @@ int pa__init(pa_module*m) {
     pa_proplist_setf(data.proplist, "rtp.mtu", "%lu", (unsigned long) mtu);
     pa_proplist_setf(data.proplist, "rtp.port", "%lu", (unsigned long) port);
     pa_proplist_setf(data.proplist, "rtp.ttl", "%lu", (unsigned long) ttl);
+    if (encoder)
+        pa_proplist_sets(data.proplist, "rtp.encoding", pa_encoding_to_string(encoding));
     data.driver = __FILE__;
     data.module = m;
     pa_source_output_new_data_set_source(&data, s, FALSE);
@@ -386,11 +531,18 @@ int pa__init(pa_module*m) {
     o->kill = source_output_kill;
 
     pa_log_info("Configured source latency of %llu ms.",
-                (unsigned long long) pa_source_output_set_requested_latency(o, pa_bytes_to_usec(mtu, &o->sample_spec)) / PA_USEC_PER_MSEC);
+                (unsigned long long) pa_source_output_set_requested_latency(o, pa_bytes_to_usec(encoder ? pa_codec_get_frame_size(encoder) : mtu, &o->sample_spec)) / PA_USEC_PER_MSEC);
 
     m->userdata = o->userdata = u = pa_xnew(struct userdata, 1);
     u->module = m;
     u->source_output = o;
+    u->encoder = encoder;
+    u->buffer = encoder ? pa_xmalloc(mtu) : NULL;
+    encoder = NULL;
+    u->rtcp_fd = rtcp_fd;
+    rtcp_fd = -1;
+    u->cname = pa_sprintf_malloc("%s@%s", pa_get_user_name(un, sizeof(un)), pa_get_fqdn(hn, sizeof(hn)));
+    u->next_report = 0;
 
     u->memblockq = pa_memblockq_new(
             "module-rtp-send memblockq",
@@ -414,13 +566,13 @@ int pa__init(pa_module*m) {
         p = pa_sdp_build(af,
                      (void*) &((struct sockaddr_in*) &sa_dst)->sin_addr,
                      (void*) &dst_sa4.sin_addr,
-                     n, (uint16_t) port, payload, &ss);
+                     n, (uint16_t) port, payload, encoding, &ss);
 #ifdef HAVE_IPV6
     } else {
         p = pa_sdp_build(af,
                      (void*) &((struct sockaddr_in6*) &sa_dst)->sin6_addr,
                      (void*) &dst_sa6.sin6_addr,
-                     n, (uint16_t) port, payload, &ss);
+                     n, (uint16_t) port, payload, encoding, &ss);
 #endif
     }
 
@@ -452,6 +604,12 @@ fail:
     if (sap_fd >= 0)
         pa_close(sap_fd);
 
+    if (rtcp_fd >= 0)
+        pa_close(rtcp_fd);
+
+    if (encoder)
+        pa_codec_free(encoder);
+
     if (o) {
         pa_source_output_unlink(o);
         pa_source_output_unref(o);
@@ -483,5 +641,13 @@ void pa__done(pa_module*m) {
     if (u->memblockq)
         pa_memblockq_free(u->memblockq);
 
+    if (u->encoder)
+        pa_codec_free(u->encoder);
+
+    if (u->rtcp_fd >= 0)
+        pa_close(u->rtcp_fd);
+
+    pa_xfree(u->cname);
+    pa_xfree(u->buffer);
     pa_xfree(u);
 }
@@ -0,0 +1,288 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <string.h>
+
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "playout-sync.h"
+
+/* Differences bigger than this are not worth catching up with by
+ * resampling */
+#define STEP_THRESHOLD (20*PA_USEC_PER_MSEC)
+
+/* 2‰ can be considered inaudible */
+#define CORRECTION_MAX 0.002
+
+/* Silence and audio only alternate when a hold is started, which
+ * happens at most once per update, so a few segments cover max_rewind */
+#define HISTORY_MAX 16
+
+struct segment {
+    pa_bool_t silence;
+    size_t length;
+};
+
+struct pa_playout_sync {
+    pa_sample_spec sample_spec;
+    pa_usec_t playout_delay;
+
+    /* The last sender report, and the sender's sample clock as seen
+     * by the wall clock, which is what ties the receivers together */
+    pa_bool_t have_report;
+    pa_usec_t report_when;
+    uint32_t report_timestamp;
+    double sender_rate;
+
+    /* The play time the controller last ran with, for its integral
+     * term */
+    pa_usec_t last_update;
+    double integral;
+    uint32_t rate;
+
+    size_t hold;
+
+    /* What was played most recently, oldest first, so that a rewind
+     * knows how much of it was held back silence */
+    struct segment history[HISTORY_MAX];
+    unsigned n_history;
+    size_t history_length;
+    size_t max_rewind;
+};
+
+pa_playout_sync* pa_playout_sync_new(const pa_sample_spec *ss, pa_usec_t playout_delay) {
+    pa_playout_sync *ps;
+
+    pa_assert(ss);
+    pa_assert(pa_sample_spec_valid(ss));
+
+    ps = pa_xnew0(pa_playout_sync, 1);
+    ps->sample_spec = *ss;
+    ps->playout_delay = playout_delay;
+    ps->sender_rate = (double) ss->rate;
+    ps->rate = ss->rate;
+
+    return ps;
+}
+
+void pa_playout_sync_free(pa_playout_sync *ps) {
+    pa_assert(ps);
+
+    pa_xfree(ps);
+}
+
+void pa_playout_sync_report(pa_playout_sync *ps, pa_usec_t when, uint32_t timestamp) {
+    pa_assert(ps);
+
+    if (ps->have_report && when > ps->report_when) {
+        double rate = (double) (int32_t) (timestamp - ps->report_timestamp) * PA_USEC_PER_SEC / (double) (when - ps->report_when);
+
+        if (fabs(rate - ps->sample_spec.rate) < ps->sample_spec.rate * 0.01)
+            ps->sender_rate = 0.9 * ps->sender_rate + 0.1 * rate;
+        else
+            pa_log_debug("Ignoring sender report with a rate of %0.1f Hz", rate);
+    }
+
+    ps->report_when = when;
+    ps->report_timestamp = timestamp;
+    ps->have_report = TRUE;
+
+    pa_log_debug("Sender report: RTP timestamp %u, sender rate %0.2f Hz", timestamp, ps->sender_rate);
+}
+
+pa_bool_t pa_playout_sync_is_ready(pa_playout_sync *ps) {
+    pa_assert(ps);
+
+    return ps->have_report;
+}
+
+int64_t pa_playout_sync_update(pa_playout_sync *ps, pa_usec_t play_time, uint32_t timestamp, size_t *drop, uint32_t *rate) {
+    int64_t capture_time, offset;
+    double correction;
+
+    pa_assert(ps);
+    pa_assert(ps->have_report);
+    pa_assert(drop);
+    pa_assert(rate);
+
+    *drop = 0;
+
+    /* When the sample comes out of the speaker, and when it should */
+    capture_time = (int64_t) ps->report_when + (int64_t) ((double) (int32_t) (timestamp - ps->report_timestamp) * PA_USEC_PER_SEC / ps->sender_rate);
+    offset = (int64_t) (play_time + pa_bytes_to_usec(ps->hold, &ps->sample_spec)) - (capture_time + (int64_t) ps->playout_delay);
+
+    pa_log_debug("Playing %0.2f ms %s", (double) (offset < 0 ? -offset : offset) / PA_USEC_PER_MSEC, offset < 0 ? "early" : "late");
+
+    if (offset > (int64_t) STEP_THRESHOLD || offset < -(int64_t) STEP_THRESHOLD) {
+        size_t n;
+
+        /* Too far off to catch up by resampling, skip or wait */
+        n = pa_usec_to_bytes((pa_usec_t) (offset < 0 ? -offset : offset), &ps->sample_spec);
+
+        if (offset < 0)
+            ps->hold += n;
+        else if (ps->hold >= n)
+            ps->hold -= n;
+        else {
+            *drop = n - ps->hold;
+            ps->hold = 0;
+        }
+
+        ps->integral = 0;
+        ps->last_update = 0;
+
+    } else {
+        /* Otherwise steer the rate with a PI controller, which also
+         * takes care of the difference between the sink's and the wall
+         * clock */
+        if (ps->last_update > 0 && play_time > ps->last_update)
+            ps->integral += (double) offset / PA_USEC_PER_SEC * (double) (play_time - ps->last_update) / PA_USEC_PER_SEC;
+
+        ps->last_update = play_time;
+
+        correction = 0.1 * (double) offset / PA_USEC_PER_SEC + 0.01 * ps->integral;
+        correction = PA_CLAMP(correction, -CORRECTION_MAX, CORRECTION_MAX);
+
+        ps->rate = (uint32_t) (ps->sender_rate * (1 + correction) + 0.5);
+    }
+
+    *rate = ps->rate;
+
+    return offset;
+}
+
+static void history_drop_oldest(pa_playout_sync *ps) {
+    pa_assert(ps->n_history > 0);
+
+    ps->history_length -= ps->history[0].length;
+    ps->n_history--;
+    memmove(ps->history, ps->history + 1, ps->n_history * sizeof(struct segment));
+}
+
+/* Forgets what can't be rewound anymore */
+static void history_trim(pa_playout_sync *ps) {
+    while (ps->history_length > ps->max_rewind) {
+        size_t excess = ps->history_length - ps->max_rewind;
+
+        if (ps->history[0].length <= excess)
+            history_drop_oldest(ps);
+        else {
+            ps->history[0].length -= excess;
+            ps->history_length -= excess;
+        }
+    }
+}
+
+static void history_push(pa_playout_sync *ps, pa_bool_t silence, size_t length) {
+    if (length == 0)
+        return;
+
+    if (ps->n_history > 0 && ps->history[ps->n_history - 1].silence == silence)
+        ps->history[ps->n_history - 1].length += length;
+    else {
+        if (ps->n_history >= HISTORY_MAX)
+            history_drop_oldest(ps);
+
+        ps->history[ps->n_history].silence = silence;
+        ps->history[ps->n_history].length = length;
+        ps->n_history++;
+    }
+
+    ps->history_length += length;
+    history_trim(ps);
+}
+
+size_t pa_playout_sync_hold(pa_playout_sync *ps, size_t length) {
+    size_t n;
+
+    pa_assert(ps);
+
+    n = PA_MIN(length, ps->hold);
+    ps->hold -= n;
+
+    history_push(ps, TRUE, n);
+
+    return n;
+}
+
+void pa_playout_sync_played(pa_playout_sync *ps, size_t length) {
+    pa_assert(ps);
+
+    history_push(ps, FALSE, length);
+}
+
+size_t pa_playout_sync_rewind(pa_playout_sync *ps, size_t length) {
+    size_t audio = 0;
+
+    pa_assert(ps);
+
+    while (length > 0 && ps->n_history > 0) {
+        struct segment *seg = &ps->history[ps->n_history - 1];
+        size_t n = PA_MIN(length, seg->length);
+
+        /* Silence is played again, before whatever audio is rewound */
+        if (seg->silence)
+            ps->hold += n;
+        else
+            audio += n;
+
+        seg->length -= n;
+        ps->history_length -= n;
+        length -= n;
+
+        if (seg->length == 0)
+            ps->n_history--;
+    }
+
+    /* Whatever we don't remember anymore was audio */
+    return audio + length;
+}
+
+void pa_playout_sync_set_maxrewind(pa_playout_sync *ps, size_t length) {
+    pa_assert(ps);
+
+    ps->max_rewind = length;
+    history_trim(ps);
+}
+
+size_t pa_playout_sync_get_hold(pa_playout_sync *ps) {
+    pa_assert(ps);
+
+    return ps->hold;
+}
+
+void pa_playout_sync_reset(pa_playout_sync *ps) {
+    pa_assert(ps);
+
+    ps->hold = 0;
+    ps->integral = 0;
+    ps->last_update = 0;
+
+    ps->n_history = 0;
+    ps->history_length = 0;
+}
@@ -0,0 +1,81 @@
+#ifndef foortpplayoutsynchfoo
+#define foortpplayoutsynchfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <inttypes.h>
+
+#include <pulse/sample.h>
+
+#include <pulsecore/macro.h>
+
+/* Plays an RTP stream in sync with the other receivers of the same
+ * sender, going by the RTCP sender reports that tie its timestamps to
+ * the sender's wall clock. Small differences are steered away by
+ * resampling, big ones by holding playback back with silence or by
+ * dropping audio. Not thread safe, all functions are meant to be
+ * called from the IO thread. */
+
+typedef struct pa_playout_sync pa_playout_sync;
+
+/* ss is what the stream is played as, audio is to be played
+ * playout_delay after it was captured */
+pa_playout_sync* pa_playout_sync_new(const pa_sample_spec *ss, pa_usec_t playout_delay);
+void pa_playout_sync_free(pa_playout_sync *ps);
+
+/* The sender says that the sample with the RTP timestamp timestamp
+ * was captured at the wall clock time when */
+void pa_playout_sync_report(pa_playout_sync *ps, pa_usec_t when, uint32_t timestamp);
+
+/* Whether there was a sender report yet, without which there is
+ * nothing to sync to */
+pa_bool_t pa_playout_sync_is_ready(pa_playout_sync *ps);
+
+/* The sample with the RTP timestamp timestamp is played next, and
+ * without anything held back would come out of the speaker at the wall
+ * clock time play_time. Returns how late that is, negative if early.
+ * If audio has to be dropped to catch up, *drop is set to how many
+ * bytes, otherwise to 0. *rate is set to the rate to resample the
+ * stream from. */
+int64_t pa_playout_sync_update(pa_playout_sync *ps, pa_usec_t play_time, uint32_t timestamp, size_t *drop, uint32_t *rate);
+
+/* How much silence to play before the next length bytes of audio, at
+ * most length. It counts as played. */
+size_t pa_playout_sync_hold(pa_playout_sync *ps, size_t length);
+
+/* length bytes of the stream itself were played */
+void pa_playout_sync_played(pa_playout_sync *ps, size_t length);
+
+/* The last length bytes played are to be played again. The silence
+ * among them is held back once more, and the rest, which is returned,
+ * has to be rewound in the stream. */
+size_t pa_playout_sync_rewind(pa_playout_sync *ps, size_t length);
+
+/* How much of what was played is remembered for rewinding */
+void pa_playout_sync_set_maxrewind(pa_playout_sync *ps, size_t length);
+
+/* How much silence is still to be played */
+size_t pa_playout_sync_get_hold(pa_playout_sync *ps);
+
+/* Forgets what is held back and starts steering over, e.g. because
+ * the sink was suspended */
+void pa_playout_sync_reset(pa_playout_sync *ps);
+
+#endif
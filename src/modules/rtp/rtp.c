@@ -37,6 +37,9 @@
 #include <sys/uio.h>
 #endif
 
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
 #include <pulsecore/core-error.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
@@ -45,6 +48,52 @@
 
 #include "rtp.h"
 
+/* How many packets we move with a single sendmmsg()/recvmmsg() */
+#define MAX_BATCH 16
+
+/* RTCP packet types and the SDES item we send, RFC 3550 12.1 */
+#define RTCP_SR 200
+#define RTCP_SDES 202
+#define RTCP_SDES_CNAME 1
+
+/* Seconds from the NTP epoch (1900) to the Unix epoch (1970) */
+#define NTP_EPOCH_OFFSET 2208988800U
+
+/* Receive buffers start out big enough for a typical MTU and grow when
+ * a larger packet shows up */
+#define MIN_SLOT_SIZE 1536
+
+#ifdef HAVE_RECVMMSG
+typedef struct mmsghdr mmsghdr_t;
+#else
+typedef struct {
+    struct msghdr msg_hdr;
+    unsigned msg_len;
+} mmsghdr_t;
+#endif
+
+typedef union aux {
+    struct cmsghdr cm;
+    uint8_t data[CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(struct timeval))];
+} aux_t;
+
+struct pa_rtp_batch {
+    /* Packets received, and how many of them were handed out */
+    unsigned n, index;
+
+    /* Whether the last batch emptied the socket */
+    pa_bool_t drained;
+
+    size_t slot_size;
+    pa_memchunk chunks[MAX_BATCH];
+    struct timeval tstamps[MAX_BATCH];
+    struct sockaddr_storage names[MAX_BATCH];
+
+    mmsghdr_t msgs[MAX_BATCH];
+    struct iovec iov[MAX_BATCH];
+    aux_t aux[MAX_BATCH];
+};
+
 pa_rtp_context* pa_rtp_context_init_send(pa_rtp_context *c, int fd, uint32_t ssrc, uint8_t payload, size_t frame_size) {
     pa_assert(c);
     pa_assert(fd >= 0);
@@ -55,18 +104,39 @@ pa_rtp_context* pa_rtp_context_init_send(pa_rtp_context *c, int fd, uint32_t ssr
     c->ssrc = ssrc ? ssrc : (uint32_t) (rand()*rand());
     c->payload = (uint8_t) (payload & 127U);
     c->frame_size = frame_size;
+    c->batch = NULL;
+    c->packet_count = c->octet_count = 0;
+    c->salen = 0;
 
     pa_memchunk_reset(&c->memchunk);
 
     return c;
 }
 
+/* Returns how many of the messages were sent, or -1 if none was */
+static int send_many(int fd, mmsghdr_t *msgs, unsigned n) {
+#ifdef HAVE_SENDMMSG
+    return sendmmsg(fd, msgs, n, MSG_DONTWAIT);
+#else
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+        if (sendmsg(fd, &msgs[i].msg_hdr, MSG_DONTWAIT) < 0)
+            return i > 0 ? (int) i : -1;
+
+    return (int) n;
+#endif
+}
+
 #define MAX_IOVECS 16
 
 int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q) {
-    struct iovec iov[MAX_IOVECS];
-    pa_memblock* mb[MAX_IOVECS];
-    int iov_idx = 1;
+    struct iovec iov[MAX_BATCH][MAX_IOVECS];
+    pa_memblock* mb[MAX_BATCH][MAX_IOVECS];
+    uint32_t header[MAX_BATCH][3];
+    mmsghdr_t msgs[MAX_BATCH];
+    unsigned n_msgs = 0;
+    int iov_idx = 1, ret = 0;
     size_t n = 0;
 
     pa_assert(c);
@@ -79,6 +149,7 @@ int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q) {
     for (;;) {
         int r;
         pa_memchunk chunk;
+        pa_bool_t done;
 
         pa_memchunk_reset(&chunk);
 
@@ -88,9 +159,9 @@ int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q) {
 
             pa_assert(chunk.memblock);
 
-            iov[iov_idx].iov_base = pa_memblock_acquire_chunk(&chunk);
-            iov[iov_idx].iov_len = k;
-            mb[iov_idx] = chunk.memblock;
+            iov[n_msgs][iov_idx].iov_base = pa_memblock_acquire_chunk(&chunk);
+            iov[n_msgs][iov_idx].iov_len = k;
+            mb[n_msgs][iov_idx] = chunk.memblock;
             iov_idx ++;
 
             n += k;
@@ -99,139 +170,371 @@ int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q) {
 
         pa_assert(n % c->frame_size == 0);
 
-        if (r < 0 || n >= size || iov_idx >= MAX_IOVECS) {
-            uint32_t header[3];
-            struct msghdr m;
-            ssize_t k;
-            int i;
-
-            if (n > 0) {
-                header[0] = htonl(((uint32_t) 2 << 30) | ((uint32_t) c->payload << 16) | ((uint32_t) c->sequence));
-                header[1] = htonl(c->timestamp);
-                header[2] = htonl(c->ssrc);
-
-                iov[0].iov_base = (void*)header;
-                iov[0].iov_len = sizeof(header);
-
-                m.msg_name = NULL;
-                m.msg_namelen = 0;
-                m.msg_iov = iov;
-                m.msg_iovlen = (size_t) iov_idx;
-                m.msg_control = NULL;
-                m.msg_controllen = 0;
-                m.msg_flags = 0;
-
-                k = sendmsg(c->fd, &m, MSG_DONTWAIT);
-
-                for (i = 1; i < iov_idx; i++) {
-                    pa_memblock_release(mb[i]);
-                    pa_memblock_unref(mb[i]);
+        if (r >= 0 && n < size && iov_idx < MAX_IOVECS)
+            continue;
+
+        if (n > 0) {
+            struct msghdr *m = &msgs[n_msgs].msg_hdr;
+
+            header[n_msgs][0] = htonl(((uint32_t) 2 << 30) | ((uint32_t) c->payload << 16) | ((uint32_t) c->sequence));
+            header[n_msgs][1] = htonl(c->timestamp);
+            header[n_msgs][2] = htonl(c->ssrc);
+
+            iov[n_msgs][0].iov_base = (void*) header[n_msgs];
+            iov[n_msgs][0].iov_len = sizeof(header[n_msgs]);
+
+            m->msg_name = NULL;
+            m->msg_namelen = 0;
+            m->msg_iov = iov[n_msgs];
+            m->msg_iovlen = (size_t) iov_idx;
+            m->msg_control = NULL;
+            m->msg_controllen = 0;
+            m->msg_flags = 0;
+
+            n_msgs++;
+            c->sequence++;
+            c->packet_count++;
+            c->octet_count += (uint32_t) n;
+        }
+
+        c->timestamp += (unsigned) (n/c->frame_size);
+
+        done = r < 0 || pa_memblockq_get_length(q) < size;
+
+        /* Send what we collected in one go */
+        if (n_msgs >= MAX_BATCH || (done && n_msgs > 0)) {
+            unsigned i, sent = 0;
+
+            while (sent < n_msgs) {
+                int k;
+
+                if ((k = send_many(c->fd, msgs + sent, n_msgs - sent)) < 0) {
+                    if (errno != EAGAIN && errno != EINTR) /* If the queue is full, just ignore it */
+                        pa_log("sendmsg() failed: %s", pa_cstrerror(errno));
+
+                    ret = -1;
+                    break;
                 }
 
-                c->sequence++;
-            } else
-                k = 0;
+                sent += (unsigned) k;
+            }
 
-            c->timestamp += (unsigned) (n/c->frame_size);
+            for (i = 0; i < n_msgs; i++) {
+                int j;
 
-            if (k < 0) {
-                if (errno != EAGAIN && errno != EINTR) /* If the queue is full, just ignore it */
-                    pa_log("sendmsg() failed: %s", pa_cstrerror(errno));
-                return -1;
+                for (j = 1; j < (int) msgs[i].msg_hdr.msg_iovlen; j++) {
+                    pa_memblock_release(mb[i][j]);
+                    pa_memblock_unref(mb[i][j]);
+                }
             }
 
-            if (r < 0 || pa_memblockq_get_length(q) < size)
-                break;
+            n_msgs = 0;
 
-            n = 0;
-            iov_idx = 1;
+            if (ret < 0)
+                break;
         }
+
+        if (done)
+            break;
+
+        n = 0;
+        iov_idx = 1;
+    }
+
+    return ret;
+}
+
+int pa_rtp_send_frame(pa_rtp_context *c, const void *data, size_t length, unsigned samples) {
+    uint32_t header[3];
+    struct iovec iov[2];
+    struct msghdr m;
+
+    pa_assert(c);
+    pa_assert(data);
+    pa_assert(length > 0);
+
+    header[0] = htonl(((uint32_t) 2 << 30) | ((uint32_t) c->payload << 16) | ((uint32_t) c->sequence));
+    header[1] = htonl(c->timestamp);
+    header[2] = htonl(c->ssrc);
+
+    iov[0].iov_base = (void*) header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = (void*) data;
+    iov[1].iov_len = length;
+
+    m.msg_name = NULL;
+    m.msg_namelen = 0;
+    m.msg_iov = iov;
+    m.msg_iovlen = 2;
+    m.msg_control = NULL;
+    m.msg_controllen = 0;
+    m.msg_flags = 0;
+
+    /* The packet counts as sent even if it's dropped, so that the
+     * receiver sees the loss */
+    c->sequence++;
+    c->timestamp += samples;
+    c->packet_count++;
+    c->octet_count += (uint32_t) length;
+
+    if (sendmsg(c->fd, &m, MSG_DONTWAIT) < 0) {
+        if (errno != EAGAIN && errno != EINTR) /* If the queue is full, just ignore it */
+            pa_log("sendmsg() failed: %s", pa_cstrerror(errno));
+
+        return -1;
     }
 
     return 0;
 }
 
+int pa_rtcp_send_sender_report(pa_rtp_context *c, int fd, const struct timeval *when, uint32_t timestamp, const char *cname) {
+    uint8_t buf[28 + 12 + 255 + 4];
+    size_t cname_length, sdes_length;
+    uint32_t v;
+
+    pa_assert(c);
+    pa_assert(fd >= 0);
+    pa_assert(when);
+    pa_assert(cname);
+
+    /* A sender report without reception report blocks ... */
+    v = htonl(((uint32_t) 2 << 30) | ((uint32_t) RTCP_SR << 16) | 6U);
+    memcpy(buf, &v, 4);
+    v = htonl(c->ssrc);
+    memcpy(buf + 4, &v, 4);
+    v = htonl((uint32_t) when->tv_sec + NTP_EPOCH_OFFSET);
+    memcpy(buf + 8, &v, 4);
+    v = htonl((uint32_t) (((uint64_t) when->tv_usec << 32) / PA_USEC_PER_SEC));
+    memcpy(buf + 12, &v, 4);
+    v = htonl(timestamp);
+    memcpy(buf + 16, &v, 4);
+    v = htonl(c->packet_count);
+    memcpy(buf + 20, &v, 4);
+    v = htonl(c->octet_count);
+    memcpy(buf + 24, &v, 4);
+
+    /* ... followed by the CNAME, which every compound packet needs to
+     * have. The item list ends with a zero byte and is padded to 32
+     * bits. */
+    cname_length = PA_MIN(strlen(cname), 255U);
+    sdes_length = PA_ROUND_UP(8 + 2 + cname_length + 1, 4U);
+
+    memset(buf + 28, 0, sdes_length);
+    v = htonl(((uint32_t) 2 << 30) | (1U << 24) | ((uint32_t) RTCP_SDES << 16) | (uint32_t) (sdes_length / 4 - 1));
+    memcpy(buf + 28, &v, 4);
+    v = htonl(c->ssrc);
+    memcpy(buf + 32, &v, 4);
+    buf[36] = RTCP_SDES_CNAME;
+    buf[37] = (uint8_t) cname_length;
+    memcpy(buf + 38, cname, cname_length);
+
+    if (send(fd, buf, 28 + sdes_length, MSG_DONTWAIT) < 0) {
+        if (errno != EAGAIN && errno != EINTR)
+            pa_log("send() failed: %s", pa_cstrerror(errno));
+
+        return -1;
+    }
+
+    return 0;
+}
+
+int pa_rtcp_parse_sender_report(const uint8_t *data, size_t length, uint32_t *ssrc, struct timeval *when, uint32_t *timestamp) {
+    pa_assert(data);
+    pa_assert(ssrc);
+    pa_assert(when);
+    pa_assert(timestamp);
+
+    /* Look for the sender report in the compound packet */
+    while (length >= 4) {
+        uint32_t header, v;
+        size_t l;
+
+        memcpy(&header, data, 4);
+        header = ntohl(header);
+        l = ((header & 0xFFFFU) + 1) * 4;
+
+        if ((header >> 30) != 2 || l > length)
+            return -1;
+
+        if (((header >> 16) & 0xFFU) == RTCP_SR && l >= 28) {
+            memcpy(&v, data + 4, 4);
+            *ssrc = ntohl(v);
+            memcpy(&v, data + 8, 4);
+            when->tv_sec = (time_t) (ntohl(v) - NTP_EPOCH_OFFSET);
+            memcpy(&v, data + 12, 4);
+            when->tv_usec = (suseconds_t) (((uint64_t) ntohl(v) * PA_USEC_PER_SEC) >> 32);
+            memcpy(&v, data + 16, 4);
+            *timestamp = ntohl(v);
+            return 0;
+        }
+
+        data += l;
+        length -= l;
+    }
+
+    return -1;
+}
+
 pa_rtp_context* pa_rtp_context_init_recv(pa_rtp_context *c, int fd, size_t frame_size) {
     pa_assert(c);
 
     c->fd = fd;
     c->frame_size = frame_size;
+    c->batch = pa_xnew0(struct pa_rtp_batch, 1);
+    c->salen = 0;
 
     pa_memchunk_reset(&c->memchunk);
     return c;
 }
 
-int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct timeval *tstamp) {
-    int size;
-    struct msghdr m;
-    struct cmsghdr *cm;
-    struct iovec iov;
-    uint32_t header;
-    unsigned cc;
-    ssize_t r;
-    uint8_t aux[1024];
-    pa_bool_t found_tstamp = FALSE;
+/* Returns how many of the messages were received, or -1 if none was */
+static int recv_many(int fd, mmsghdr_t *msgs, unsigned n) {
+#ifdef HAVE_RECVMMSG
+    /* MSG_TRUNC makes msg_len the real size of truncated packets */
+    return recvmmsg(fd, msgs, n, MSG_DONTWAIT|MSG_TRUNC, NULL);
+#else
+    unsigned i;
 
-    pa_assert(c);
-    pa_assert(chunk);
+    for (i = 0; i < n; i++) {
+        ssize_t r;
 
-    pa_memchunk_reset(chunk);
+        if ((r = recvmsg(fd, &msgs[i].msg_hdr, MSG_DONTWAIT|MSG_TRUNC)) < 0)
+            return i > 0 ? (int) i : -1;
 
-    if (ioctl(c->fd, FIONREAD, &size) < 0) {
-        pa_log_warn("FIONREAD failed: %s", pa_cstrerror(errno));
-        goto fail;
+        msgs[i].msg_len = (unsigned) r;
     }
 
-    if (size <= 0)
-        return 0;
+    return (int) n;
+#endif
+}
 
-    if (c->memchunk.length < (unsigned) size) {
-        size_t l;
+/* Reads as many packets as the socket has, up to MAX_BATCH, into
+ * slots of one memblock */
+static int fill_batch(pa_rtp_context *c, pa_mempool *pool) {
+    struct pa_rtp_batch *b = c->batch;
+    unsigned i, n;
+    size_t slot;
+    uint8_t *d;
+    int r;
+
+    if (b->slot_size <= 0) {
+        int size;
+
+        if (ioctl(c->fd, FIONREAD, &size) < 0) {
+            pa_log_warn("FIONREAD failed: %s", pa_cstrerror(errno));
+            return -1;
+        }
+
+        b->slot_size = PA_ALIGN(PA_MAX((size_t) size, (size_t) MIN_SLOT_SIZE));
+    }
+
+    slot = b->slot_size = PA_MIN(b->slot_size, pa_mempool_block_size_max(pool));
 
+    if (c->memchunk.length < slot) {
         if (c->memchunk.memblock)
             pa_memblock_unref(c->memchunk.memblock);
 
-        l = PA_MAX((size_t) size, pa_mempool_block_size_max(pool));
-
-        c->memchunk.memblock = pa_memblock_new(pool, l);
+        c->memchunk.memblock = pa_memblock_new(pool, pa_mempool_block_size_max(pool));
         c->memchunk.index = 0;
         c->memchunk.length = pa_memblock_get_length(c->memchunk.memblock);
     }
 
-    pa_assert(c->memchunk.length >= (size_t) size);
+    n = PA_MIN((unsigned) (c->memchunk.length / slot), (unsigned) MAX_BATCH);
+    pa_assert(n > 0);
 
-    chunk->memblock = pa_memblock_ref(c->memchunk.memblock);
-    chunk->index = c->memchunk.index;
+    d = pa_memblock_acquire(c->memchunk.memblock);
 
-    iov.iov_base = pa_memblock_acquire_chunk(chunk);
-    iov.iov_len = (size_t) size;
+    for (i = 0; i < n; i++) {
+        struct msghdr *m = &b->msgs[i].msg_hdr;
 
-    m.msg_name = NULL;
-    m.msg_namelen = 0;
-    m.msg_iov = &iov;
-    m.msg_iovlen = 1;
-    m.msg_control = aux;
-    m.msg_controllen = sizeof(aux);
-    m.msg_flags = 0;
+        b->iov[i].iov_base = d + c->memchunk.index + i * slot;
+        b->iov[i].iov_len = slot;
 
-    r = recvmsg(c->fd, &m, 0);
-    pa_memblock_release(chunk->memblock);
+        m->msg_name = &b->names[i];
+        m->msg_namelen = sizeof(b->names[i]);
+        m->msg_iov = &b->iov[i];
+        m->msg_iovlen = 1;
+        m->msg_control = &b->aux[i];
+        m->msg_controllen = sizeof(b->aux[i]);
+        m->msg_flags = 0;
+    }
+
+    r = recv_many(c->fd, b->msgs, n);
+    pa_memblock_release(c->memchunk.memblock);
 
-    if (r != size) {
-        if (r < 0 && errno != EAGAIN && errno != EINTR)
-            pa_log_warn("recvmsg() failed: %s", r < 0 ? pa_cstrerror(errno) : "size mismatch");
+    if (r < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return 0;
 
-        goto fail;
+        pa_log_warn("recvmsg() failed: %s", pa_cstrerror(errno));
+        return -1;
     }
 
+    b->n = (unsigned) r;
+    b->index = 0;
+    b->drained = b->n < n;
+
+    for (i = 0; i < b->n; i++) {
+        struct msghdr *m = &b->msgs[i].msg_hdr;
+        struct cmsghdr *cm;
+
+        b->chunks[i].memblock = pa_memblock_ref(c->memchunk.memblock);
+        b->chunks[i].index = c->memchunk.index + i * slot;
+        b->chunks[i].length = b->msgs[i].msg_len;
+
+        if (m->msg_flags & MSG_TRUNC) {
+            pa_log_info("Received RTP packet of %u bytes, growing receive buffers.", b->msgs[i].msg_len);
+            b->slot_size = PA_ALIGN((size_t) b->msgs[i].msg_len);
+            b->chunks[i].length = 0;
+        }
+
+        pa_zero(b->tstamps[i]);
+
+        for (cm = CMSG_FIRSTHDR(m); cm; cm = CMSG_NXTHDR(m, cm)) {
+#ifdef SCM_TIMESTAMPNS
+            if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS) {
+                struct timespec ts;
+
+                memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+                b->tstamps[i].tv_sec = ts.tv_sec;
+                b->tstamps[i].tv_usec = (suseconds_t) (ts.tv_nsec / PA_NSEC_PER_USEC);
+                break;
+            }
+#endif
+            if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMP) {
+                memcpy(&b->tstamps[i], CMSG_DATA(cm), sizeof(struct timeval));
+                break;
+            }
+        }
+    }
+
+    c->memchunk.index += b->n * slot;
+    c->memchunk.length -= b->n * slot;
+
+    if (c->memchunk.length <= 0) {
+        pa_memblock_unref(c->memchunk.memblock);
+        pa_memchunk_reset(&c->memchunk);
+    }
+
+    return (int) b->n;
+}
+
+static int parse_packet(pa_rtp_context *c, pa_memchunk *chunk) {
+    uint8_t *d;
+    uint32_t header;
+    unsigned cc;
+    size_t size = chunk->length;
+
     if (size < 12) {
         pa_log_warn("RTP packet too short.");
-        goto fail;
+        return -1;
     }
 
-    memcpy(&header, iov.iov_base, sizeof(uint32_t));
-    memcpy(&c->timestamp, (uint8_t*) iov.iov_base + 4, sizeof(uint32_t));
-    memcpy(&c->ssrc, (uint8_t*) iov.iov_base + 8, sizeof(uint32_t));
+    d = (uint8_t*) pa_memblock_acquire(chunk->memblock) + chunk->index;
+    memcpy(&header, d, sizeof(uint32_t));
+    memcpy(&c->timestamp, d + 4, sizeof(uint32_t));
+    memcpy(&c->ssrc, d + 8, sizeof(uint32_t));
+    pa_memblock_release(chunk->memblock);
 
     header = ntohl(header);
     c->timestamp = ntohl(c->timestamp);
@@ -239,63 +542,81 @@ int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct
 
     if ((header >> 30) != 2) {
         pa_log_warn("Unsupported RTP version.");
-        goto fail;
+        return -1;
     }
 
     if ((header >> 29) & 1) {
         pa_log_warn("RTP padding not supported.");
-        goto fail;
+        return -1;
     }
 
     if ((header >> 28) & 1) {
         pa_log_warn("RTP header extensions not supported.");
-        goto fail;
+        return -1;
     }
 
     cc = (header >> 24) & 0xF;
     c->payload = (uint8_t) ((header >> 16) & 127U);
     c->sequence = (uint16_t) (header & 0xFFFFU);
 
-    if (12 + cc*4 > (unsigned) size) {
+    if (12 + cc*4 > size) {
         pa_log_warn("RTP packet too short. (CSRC)");
-        goto fail;
+        return -1;
     }
 
     chunk->index += 12 + cc*4;
-    chunk->length = (size_t) size - 12 + cc*4;
+    chunk->length = size - 12 - cc*4;
 
     if (chunk->length % c->frame_size != 0) {
         pa_log_warn("Bad RTP packet size.");
-        goto fail;
+        return -1;
     }
 
-    c->memchunk.index = chunk->index + chunk->length;
-    c->memchunk.length = pa_memblock_get_length(c->memchunk.memblock) - c->memchunk.index;
+    return 0;
+}
+
+int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct timeval *tstamp) {
+    struct pa_rtp_batch *b;
 
-    if (c->memchunk.length <= 0) {
-        pa_memblock_unref(c->memchunk.memblock);
-        pa_memchunk_reset(&c->memchunk);
-    }
+    pa_assert(c);
+    pa_assert(c->batch);
+    pa_assert(chunk);
+    pa_assert(tstamp);
 
-    for (cm = CMSG_FIRSTHDR(&m); cm; cm = CMSG_NXTHDR(&m, cm))
-        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMP) {
-            memcpy(tstamp, CMSG_DATA(cm), sizeof(struct timeval));
-            found_tstamp = TRUE;
-            break;
+    b = c->batch;
+
+    for (;;) {
+        unsigned i;
+
+        if (b->index >= b->n) {
+            int r;
+
+            /* Don't ask the socket again if we know it's empty */
+            if (b->drained) {
+                b->drained = FALSE;
+                return 0;
+            }
+
+            if ((r = fill_batch(c, pool)) <= 0)
+                return r;
         }
 
-    if (!found_tstamp) {
-        pa_log_warn("Couldn't find SCM_TIMESTAMP data in auxiliary recvmsg() data!");
-        pa_zero(*tstamp);
-    }
+        i = b->index++;
+        *chunk = b->chunks[i];
+        pa_memchunk_reset(&b->chunks[i]);
 
-    return 0;
+        if (chunk->length > 0 && parse_packet(c, chunk) >= 0) {
+            *tstamp = b->tstamps[i];
 
-fail:
-    if (chunk->memblock)
-        pa_memblock_unref(chunk->memblock);
+            c->salen = PA_MIN(b->msgs[i].msg_hdr.msg_namelen, (socklen_t) sizeof(c->sa));
+            memcpy(&c->sa, &b->names[i], c->salen);
 
-    return -1;
+            return 1;
+        }
+
+        pa_memblock_unref(chunk->memblock);
+        pa_memchunk_reset(chunk);
+    }
 }
 
 uint8_t pa_rtp_payload_from_sample_spec(const pa_sample_spec *ss) {
@@ -351,6 +672,7 @@ pa_sample_spec *pa_rtp_sample_spec_from_payload(uint8_t payload, pa_sample_spec
 pa_sample_spec *pa_rtp_sample_spec_fixup(pa_sample_spec * ss) {
     pa_assert(ss);
 
+    /* L16 is what every receiver understands, L24 has to be asked for */
     if (!pa_rtp_sample_spec_valid(ss))
         ss->format = PA_SAMPLE_S16BE;
 
@@ -368,7 +690,8 @@ int pa_rtp_sample_spec_valid(const pa_sample_spec *ss) {
         ss->format == PA_SAMPLE_U8 ||
         ss->format == PA_SAMPLE_ALAW ||
         ss->format == PA_SAMPLE_ULAW ||
-        ss->format == PA_SAMPLE_S16BE;
+        ss->format == PA_SAMPLE_S16BE ||
+        ss->format == PA_SAMPLE_S24BE;
 }
 
 void pa_rtp_context_destroy(pa_rtp_context *c) {
@@ -378,12 +701,24 @@ void pa_rtp_context_destroy(pa_rtp_context *c) {
 
     if (c->memchunk.memblock)
         pa_memblock_unref(c->memchunk.memblock);
+
+    if (c->batch) {
+        struct pa_rtp_batch *b = c->batch;
+
+        for (; b->index < b->n; b->index++)
+            if (b->chunks[b->index].memblock)
+                pa_memblock_unref(b->chunks[b->index].memblock);
+
+        pa_xfree(b);
+    }
 }
 
 const char* pa_rtp_format_to_string(pa_sample_format_t f) {
     switch (f) {
         case PA_SAMPLE_S16BE:
             return "L16";
+        case PA_SAMPLE_S24BE:
+            return "L24";
         case PA_SAMPLE_U8:
             return "L8";
         case PA_SAMPLE_ALAW:
@@ -400,6 +735,8 @@ pa_sample_format_t pa_rtp_string_to_format(const char *s) {
 
     if (pa_streq(s, "L16"))
         return PA_SAMPLE_S16BE;
+    else if (pa_streq(s, "L24"))
+        return PA_SAMPLE_S24BE;
     else if (pa_streq(s, "L8"))
         return PA_SAMPLE_U8;
     else if (pa_streq(s, "PCMA"))
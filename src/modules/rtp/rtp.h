@@ -37,15 +37,47 @@ typedef struct pa_rtp_context {
     size_t frame_size;
 
     pa_memchunk memchunk;
+
+    /* What was sent so far, for RTCP sender reports */
+    uint32_t packet_count, octet_count;
+
+    /* Packets received in one go, but not handed out yet */
+    struct pa_rtp_batch *batch;
+
+    /* Where the last packet received came from */
+    struct sockaddr_storage sa;
+    socklen_t salen;
 } pa_rtp_context;
 
 pa_rtp_context* pa_rtp_context_init_send(pa_rtp_context *c, int fd, uint32_t ssrc, uint8_t payload, size_t frame_size);
 
 /* If the memblockq doesn't have a silence memchunk set, then the caller must
- * guarantee that the current read index doesn't point to a hole. */
+ * guarantee that the current read index doesn't point to a hole. Sends all
+ * complete packets in the queue, batched into as few syscalls as possible. */
 int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q);
 
+/* Sends data as a single packet, for payloads that don't split at
+ * arbitrary frames, like compressed audio. samples is how much the
+ * RTP timestamp advances by. */
+int pa_rtp_send_frame(pa_rtp_context *c, const void *data, size_t length, unsigned samples);
+
+/* Sends an RTCP sender report (RFC 3550 6.4.1) on the RTCP socket fd,
+ * saying that the sample with the RTP timestamp timestamp was taken at
+ * the wall clock time when. Receivers use this to play in sync. */
+int pa_rtcp_send_sender_report(pa_rtp_context *c, int fd, const struct timeval *when, uint32_t timestamp, const char *cname);
+
+/* Looks for a sender report in a compound RTCP packet. Returns 0 and
+ * what the report says if there is one, a negative value otherwise. */
+int pa_rtcp_parse_sender_report(const uint8_t *data, size_t length, uint32_t *ssrc, struct timeval *when, uint32_t *timestamp);
+
 pa_rtp_context* pa_rtp_context_init_recv(pa_rtp_context *c, int fd, size_t frame_size);
+
+/* Returns 1 and the payload of the next packet, 0 if there is none left
+ * or a negative value on error. Packets are read from the socket in
+ * batches, so call this until it returns 0. tstamp is the time the
+ * kernel received the packet at, in wall clock time, or zero if the
+ * socket doesn't have SO_TIMESTAMPNS or SO_TIMESTAMP enabled. The
+ * sender's address is left in c->sa. */
 int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct timeval *tstamp);
 
 void pa_rtp_context_destroy(pa_rtp_context *c);
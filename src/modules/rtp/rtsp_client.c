@@ -452,14 +452,16 @@ int pa_rtsp_announce(pa_rtsp_client *c, const char* sdp) {
     return rtsp_exec(c, "ANNOUNCE", "application/sdp", sdp, 1, NULL);
 }
 
-int pa_rtsp_setup(pa_rtsp_client* c) {
+int pa_rtsp_setup(pa_rtsp_client* c, const char* transport) {
     pa_headerlist* headers;
     int rv;
 
     pa_assert(c);
 
     headers = pa_headerlist_new();
-    pa_headerlist_puts(headers, "Transport", "RTP/AVP/TCP;unicast;interleaved=0-1;mode=record");
+    if (!transport)
+        transport = "RTP/AVP/TCP;unicast;interleaved=0-1;mode=record";
+    pa_headerlist_puts(headers, "Transport", transport);
 
     c->state = STATE_SETUP;
     rv = rtsp_exec(c, "SETUP", NULL, NULL, 1, headers);
@@ -61,7 +61,9 @@ void pa_rtsp_remove_header(pa_rtsp_client *c, const char* key);
 
 int pa_rtsp_announce(pa_rtsp_client* c, const char* sdp);
 
-int pa_rtsp_setup(pa_rtsp_client* c);
+/* transport is the Transport header to ask for, or NULL for
+ * interleaved TCP */
+int pa_rtsp_setup(pa_rtsp_client* c, const char* transport);
 int pa_rtsp_record(pa_rtsp_client* c, uint16_t* seq, uint32_t* rtptime);
 int pa_rtsp_teardown(pa_rtsp_client* c);
 
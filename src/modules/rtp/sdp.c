@@ -29,6 +29,7 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <string.h>
+#include <strings.h>
 
 #include <pulse/xmalloc.h>
 #include <pulse/util.h>
@@ -41,10 +42,10 @@
 #include "sdp.h"
 #include "rtp.h"
 
-char *pa_sdp_build(int af, const void *src, const void *dst, const char *name, uint16_t port, uint8_t payload, const pa_sample_spec *ss) {
+char *pa_sdp_build(int af, const void *src, const void *dst, const char *name, uint16_t port, uint8_t payload, pa_encoding_t encoding, const pa_sample_spec *ss) {
     uint32_t ntp;
-    char buf_src[64], buf_dst[64], un[64];
-    const char *u, *f;
+    char buf_src[64], buf_dst[64], un[64], *rtpmap, *r;
+    const char *u;
 
     pa_assert(src);
     pa_assert(dst);
@@ -55,7 +56,22 @@ char *pa_sdp_build(int af, const void *src, const void *dst, const char *name, u
     pa_assert(af == AF_INET);
 #endif
 
-    pa_assert_se(f = pa_rtp_format_to_string(ss->format));
+    if (encoding == PA_ENCODING_OPUS)
+        /* RFC 7587 always has 48 kHz and two channels here, whether the
+         * stream is stereo goes in the format parameters */
+        rtpmap = pa_sprintf_malloc(
+                "a=rtpmap:%i opus/48000/2\n"
+                "a=fmtp:%i sprop-stereo=%i\n",
+                payload,
+                payload, ss->channels > 1 ? 1 : 0);
+    else {
+        const char *f;
+
+        pa_assert(encoding == PA_ENCODING_PCM);
+        pa_assert_se(f = pa_rtp_format_to_string(ss->format));
+
+        rtpmap = pa_sprintf_malloc("a=rtpmap:%i %s/%u/%u\n", payload, f, ss->rate, ss->channels);
+    }
 
     if (!(u = pa_get_user_name(un, sizeof(un))))
         u = "-";
@@ -65,7 +81,7 @@ char *pa_sdp_build(int af, const void *src, const void *dst, const char *name, u
     pa_assert_se(inet_ntop(af, src, buf_src, sizeof(buf_src)));
     pa_assert_se(inet_ntop(af, dst, buf_dst, sizeof(buf_dst)));
 
-    return pa_sprintf_malloc(
+    r = pa_sprintf_malloc(
             PA_SDP_HEADER
             "o=%s %lu 0 IN %s %s\n"
             "s=%s\n"
@@ -73,22 +89,45 @@ char *pa_sdp_build(int af, const void *src, const void *dst, const char *name, u
             "t=%lu 0\n"
             "a=recvonly\n"
             "m=audio %u RTP/AVP %i\n"
-            "a=rtpmap:%i %s/%u/%u\n"
+            "%s"
             "a=type:broadcast\n",
             u, (unsigned long) ntp, af == AF_INET ? "IP4" : "IP6", buf_src,
             name,
             af == AF_INET ? "IP4" : "IP6", buf_dst,
             (unsigned long) ntp,
             port, payload,
-            payload, f, ss->rate, ss->channels);
+            rtpmap);
+
+    pa_xfree(rtpmap);
+
+    return r;
 }
 
-static pa_sample_spec *parse_sdp_sample_spec(pa_sample_spec *ss, char *c) {
+static pa_sample_spec *parse_sdp_sample_spec(pa_sample_spec *ss, pa_encoding_t *encoding, char *c) {
     unsigned rate, channels;
     pa_assert(ss);
+    pa_assert(encoding);
     pa_assert(c);
 
-    if (pa_startswith(c, "L16/")) {
+    *encoding = PA_ENCODING_PCM;
+
+    /* The encoding name is case-insensitive. We decode Opus to whatever
+     * the format parameters say the stream has, stereo by default. */
+    if (strncasecmp(c, "opus/", 5) == 0) {
+        if (sscanf(c + 5, "%u", &rate) != 1 || rate != 48000)
+            return NULL;
+
+        *encoding = PA_ENCODING_OPUS;
+        ss->format = PA_SAMPLE_S16NE;
+        ss->rate = 48000;
+        ss->channels = 2;
+        return ss;
+    }
+
+    if (pa_startswith(c, "L24/")) {
+        ss->format = PA_SAMPLE_S24BE;
+        c += 4;
+    } else if (pa_startswith(c, "L16/")) {
         ss->format = PA_SAMPLE_S16BE;
         c += 4;
     } else if (pa_startswith(c, "L8/")) {
@@ -106,7 +145,7 @@ static pa_sample_spec *parse_sdp_sample_spec(pa_sample_spec *ss, char *c) {
     if (sscanf(c, "%u/%u", &rate, &channels) == 2) {
         ss->rate = (uint32_t) rate;
         ss->channels = (uint8_t) channels;
-    } else if (sscanf(c, "%u", &rate) == 2) {
+    } else if (sscanf(c, "%u", &rate) == 1) {
         ss->rate = (uint32_t) rate;
         ss->channels = 1;
     } else
@@ -118,6 +157,34 @@ static pa_sample_spec *parse_sdp_sample_spec(pa_sample_spec *ss, char *c) {
     return ss;
 }
 
+/* The origin ends in the address of the host that made the session */
+static void parse_origin_address(pa_sdp_info *i) {
+    char type[4], a[64];
+
+    i->origin_salen = 0;
+
+    if (sscanf(i->origin, "%*s %*s %*s IN %3s %63s", type, a) != 2)
+        return;
+
+    if (pa_streq(type, "IP4")) {
+        if (inet_pton(AF_INET, a, &((struct sockaddr_in*) &i->origin_sa)->sin_addr) <= 0)
+            return;
+
+        ((struct sockaddr_in*) &i->origin_sa)->sin_family = AF_INET;
+        ((struct sockaddr_in*) &i->origin_sa)->sin_port = 0;
+        i->origin_salen = sizeof(struct sockaddr_in);
+#ifdef HAVE_IPV6
+    } else if (pa_streq(type, "IP6")) {
+        if (inet_pton(AF_INET6, a, &((struct sockaddr_in6*) &i->origin_sa)->sin6_addr) <= 0)
+            return;
+
+        ((struct sockaddr_in6*) &i->origin_sa)->sin6_family = AF_INET6;
+        ((struct sockaddr_in6*) &i->origin_sa)->sin6_port = 0;
+        i->origin_salen = sizeof(struct sockaddr_in6);
+#endif
+    }
+}
+
 pa_sdp_info *pa_sdp_parse(const char *t, pa_sdp_info *i, int is_goodbye) {
     uint16_t port = 0;
     pa_bool_t ss_valid = FALSE;
@@ -126,8 +193,9 @@ pa_sdp_info *pa_sdp_parse(const char *t, pa_sdp_info *i, int is_goodbye) {
     pa_assert(i);
 
     i->origin = i->session_name = NULL;
-    i->salen = 0;
+    i->salen = i->origin_salen = 0;
     i->payload = 255;
+    i->encoding = PA_ENCODING_PCM;
 
     if (!pa_startswith(t, PA_SDP_HEADER)) {
         pa_log("Failed to parse SDP data: invalid header.");
@@ -216,21 +284,31 @@ pa_sdp_info *pa_sdp_parse(const char *t, pa_sdp_info *i, int is_goodbye) {
                 char c[64];
                 int _payload;
 
-                if (sscanf(t+9, "%i %64c", &_payload, c) == 2) {
+                if (sscanf(t+9, "%i %63[^\n]", &_payload, c) == 2) {
 
                     if (_payload < 0 || _payload > 127) {
                         pa_log("Failed to parse SDP data: invalid payload %i.", _payload);
                         goto fail;
                     }
                     if (_payload == i->payload) {
-
-                        c[strcspn(c, "\n")] = 0;
-
-                        if (parse_sdp_sample_spec(&i->sample_spec, c))
+                        if (parse_sdp_sample_spec(&i->sample_spec, &i->encoding, c))
                             ss_valid = TRUE;
                     }
                 }
             }
+        } else if (pa_startswith(t, "a=fmtp:")) {
+
+            if (i->payload <= 127 && i->encoding == PA_ENCODING_OPUS && ss_valid) {
+                char c[64];
+                int _payload;
+
+                if (sscanf(t+7, "%i %63[^\n]", &_payload, c) == 2 && _payload == i->payload) {
+                    const char *stereo;
+
+                    if ((stereo = strstr(c, "sprop-stereo=")))
+                        i->sample_spec.channels = stereo[13] == '0' ? 1 : 2;
+                }
+            }
         }
 
         t += l;
@@ -244,6 +322,8 @@ pa_sdp_info *pa_sdp_parse(const char *t, pa_sdp_info *i, int is_goodbye) {
         goto fail;
     }
 
+    parse_origin_address(i);
+
     if (((struct sockaddr*) &i->sa)->sa_family == AF_INET)
         ((struct sockaddr_in*) &i->sa)->sin_port = htons(port);
     else
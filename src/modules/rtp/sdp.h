@@ -27,6 +27,7 @@
 #include <sys/types.h>
 
 #include <pulse/sample.h>
+#include <pulse/format.h>
 
 #define PA_SDP_HEADER "v=0\n"
 
@@ -37,11 +38,20 @@ typedef struct pa_sdp_info {
     struct sockaddr_storage sa;
     socklen_t salen;
 
+    /* The address of the sender, from the origin, if it is given as a
+     * numerical address. origin_salen is 0 otherwise. */
+    struct sockaddr_storage origin_sa;
+    socklen_t origin_salen;
+
+    /* For PA_ENCODING_OPUS this is what the stream decodes to */
     pa_sample_spec sample_spec;
+    pa_encoding_t encoding;
     uint8_t payload;
 } pa_sdp_info;
 
-char *pa_sdp_build(int af, const void *src, const void *dst, const char *name, uint16_t port, uint8_t payload, const pa_sample_spec *ss);
+/* encoding is PA_ENCODING_PCM, with the format in ss, or
+ * PA_ENCODING_OPUS */
+char *pa_sdp_build(int af, const void *src, const void *dst, const char *name, uint16_t port, uint8_t payload, pa_encoding_t encoding, const pa_sample_spec *ss);
 
 pa_sdp_info *pa_sdp_parse(const char *t, pa_sdp_info *info, int is_goodbye);
 
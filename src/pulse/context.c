@@ -90,7 +90,8 @@ static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
     [PA_COMMAND_RECORD_STREAM_EVENT] = pa_command_stream_event,
     [PA_COMMAND_CLIENT_EVENT] = pa_command_client_event,
     [PA_COMMAND_PLAYBACK_BUFFER_ATTR_CHANGED] = pa_command_stream_buffer_attr,
-    [PA_COMMAND_RECORD_BUFFER_ATTR_CHANGED] = pa_command_stream_buffer_attr
+    [PA_COMMAND_RECORD_BUFFER_ATTR_CHANGED] = pa_command_stream_buffer_attr,
+    [PA_COMMAND_ENABLE_SRBCHANNEL] = pa_command_enable_srbchannel
 };
 static void context_free(pa_context *c);
 
@@ -110,6 +111,8 @@ static void reset_callbacks(pa_context *c) {
 
     c->subscribe_callback = NULL;
     c->subscribe_userdata = NULL;
+    c->subscribe_delta_callback = NULL;
+    c->subscribe_delta_userdata = NULL;
 
     c->event_callback = NULL;
     c->event_userdata = NULL;
@@ -323,7 +326,7 @@ static void pstream_die_callback(pa_pstream *p, void *userdata) {
     pa_context_fail(c, PA_ERR_CONNECTIONTERMINATED);
 }
 
-static void pstream_packet_callback(pa_pstream *p, pa_packet *packet, const pa_creds *creds, void *userdata) {
+static void pstream_packet_callback(pa_pstream *p, pa_packet *packet, const pa_cmsg_ancil_data *ancil_data, void *userdata) {
     pa_context *c = userdata;
 
     pa_assert(p);
@@ -332,7 +335,7 @@ static void pstream_packet_callback(pa_pstream *p, pa_packet *packet, const pa_c
 
     pa_context_ref(c);
 
-    if (pa_pdispatch_run(c->pdispatch, packet, creds, c) < 0)
+    if (pa_pdispatch_run(c->pdispatch, packet, ancil_data, c) < 0)
         pa_context_fail(c, PA_ERR_PROTOCOL);
 
     pa_context_unref(c);
@@ -1368,6 +1371,52 @@ finish:
     pa_context_unref(c);
 }
 
+void pa_command_enable_srbchannel(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_context *c = userdata;
+    pa_srbchannel *srb;
+    const int *fds;
+    int fds_copy[PA_SRBCHANNEL_N_FDS];
+    int nfd, k;
+
+    pa_assert(pd);
+    pa_assert(command == PA_COMMAND_ENABLE_SRBCHANNEL);
+    pa_assert(t);
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    if (c->version < 30 || !pa_tagstruct_eof(t)) {
+        pa_context_fail(c, PA_ERR_PROTOCOL);
+        return;
+    }
+
+    fds = pa_pdispatch_fds(pd, &nfd);
+
+    /* The server only offers this if we agreed on SHM */
+    if (nfd != PA_SRBCHANNEL_N_FDS || !pa_pstream_get_shm(c->pstream)) {
+        pa_pstream_send_error(c->pstream, tag, PA_ERR_INVALID);
+        return;
+    }
+
+    /* The ones passed to us are closed after this */
+    for (k = 0; k < nfd; k++)
+        if ((fds_copy[k] = pa_dup_cloexec(fds[k])) < 0) {
+            while (k > 0)
+                pa_close(fds_copy[--k]);
+
+            pa_pstream_send_error(c->pstream, tag, PA_ERR_INTERNAL);
+            return;
+        }
+
+    if (!(srb = pa_srbchannel_new_from_fds(c->mainloop, fds_copy))) {
+        pa_pstream_send_error(c->pstream, tag, PA_ERR_NOTSUPPORTED);
+        return;
+    }
+
+    /* The server switches once it got this, and so do we after it */
+    pa_pstream_send_simple_ack(c->pstream, tag);
+    pa_pstream_set_srbchannel(c->pstream, srb);
+}
+
 void pa_command_client_event(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_context *c = userdata;
     pa_proplist *pl = NULL;
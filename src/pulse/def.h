@@ -576,6 +576,30 @@ typedef enum pa_subscription_event_type {
 
 } pa_subscription_event_type_t;
 
+/** What changed about an object, as passed along with subscription
+ * events to the callback set with
+ * pa_context_set_subscribe_delta_callback(). \since 5.0 */
+typedef enum pa_subscription_change_flags {
+    PA_SUBSCRIPTION_CHANGE_UNKNOWN = 0x0000U,
+    /**< Anything might have changed, the object needs to be queried again */
+
+    PA_SUBSCRIPTION_CHANGE_VOLUME = 0x0001U,
+    /**< The volume of a sink, source, sink input or source output */
+
+    PA_SUBSCRIPTION_CHANGE_MUTE = 0x0002U,
+    /**< The mute state of a sink, source, sink input or source output */
+
+    PA_SUBSCRIPTION_CHANGE_STATE = 0x0004U
+    /**< The state of a sink or source, or whether a sink input or source output is corked */
+} pa_subscription_change_flags_t;
+
+/** \cond fulldocs */
+#define PA_SUBSCRIPTION_CHANGE_UNKNOWN PA_SUBSCRIPTION_CHANGE_UNKNOWN
+#define PA_SUBSCRIPTION_CHANGE_VOLUME PA_SUBSCRIPTION_CHANGE_VOLUME
+#define PA_SUBSCRIPTION_CHANGE_MUTE PA_SUBSCRIPTION_CHANGE_MUTE
+#define PA_SUBSCRIPTION_CHANGE_STATE PA_SUBSCRIPTION_CHANGE_STATE
+/** \endcond */
+
 /** Return one if an event type t matches an event mask bitfield */
 #define pa_subscription_match_flags(m, t) (!!((m) & (1 << ((t) & PA_SUBSCRIPTION_EVENT_FACILITY_MASK))))
 
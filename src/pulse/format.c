@@ -48,6 +48,8 @@ static const char* const _encoding_str_table[]= {
     [PA_ENCODING_MPEG_IEC61937] = "mpeg-iec61937",
     [PA_ENCODING_DTS_IEC61937] = "dts-iec61937",
     [PA_ENCODING_MPEG2_AAC_IEC61937] = "mpeg2-aac-iec61937",
+    [PA_ENCODING_OPUS] = "opus",
+    [PA_ENCODING_PCM_LOSSLESS] = "pcm-lossless",
     [PA_ENCODING_ANY] = "any",
 };
 
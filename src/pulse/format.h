@@ -58,6 +58,15 @@ typedef enum pa_encoding {
     PA_ENCODING_MPEG2_AAC_IEC61937,
     /**< MPEG-2 AAC data encapsulated in IEC 61937 header/padding. \since 4.0 */
 
+    PA_ENCODING_OPUS,
+    /**< Opus. Not accepted by any sink, only used to compress streams
+     * on their way over the network. \since 5.0 */
+
+    PA_ENCODING_PCM_LOSSLESS,
+    /**< Losslessly compressed 16 bit PCM. Not accepted by any sink,
+     * only used to compress streams on their way over the
+     * network. \since 5.0 */
+
     PA_ENCODING_MAX,
     /**< Valid encoding types must be less than this value */
 
@@ -73,6 +82,8 @@ typedef enum pa_encoding {
 #define PA_ENCODING_MPEG_IEC61937 PA_ENCODING_MPEG_IEC61937
 #define PA_ENCODING_DTS_IEC61937 PA_ENCODING_DTS_IEC61937
 #define PA_ENCODING_MPEG2_AAC_IEC61937 PA_ENCODING_MPEG2_AAC_IEC61937
+#define PA_ENCODING_OPUS PA_ENCODING_OPUS
+#define PA_ENCODING_PCM_LOSSLESS PA_ENCODING_PCM_LOSSLESS
 #define PA_ENCODING_MAX PA_ENCODING_MAX
 #define PA_ENCODING_INVALID PA_ENCODING_INVALID
 /** \endcond */
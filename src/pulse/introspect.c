@@ -253,6 +253,12 @@ static void context_get_sink_info_callback(pa_pdispatch *pd, uint32_t command, u
                 }
             }
 
+            if (o->context->version >= 29) {
+                if (pa_tagstruct_get_usec(t, &i.render_cost_avg) < 0 ||
+                    pa_tagstruct_get_usec(t, &i.render_cost_max) < 0)
+                    goto fail;
+            }
+
             i.mute = (int) mute;
             i.flags = (pa_sink_flags_t) flags;
             i.state = (pa_sink_state_t) state;
@@ -1196,7 +1202,13 @@ static void context_get_sink_input_info_callback(pa_pdispatch *pd, uint32_t comm
                 (o->context->version >= 19 && pa_tagstruct_get_boolean(t, &corked) < 0) ||
                 (o->context->version >= 20 && (pa_tagstruct_get_boolean(t, &has_volume) < 0 ||
                                                pa_tagstruct_get_boolean(t, &volume_writable) < 0)) ||
-                (o->context->version >= 21 && pa_tagstruct_get_format_info(t, i.format) < 0)) {
+                (o->context->version >= 21 && pa_tagstruct_get_format_info(t, i.format) < 0) ||
+                (o->context->version >= 29 && (pa_tagstruct_get_usec(t, &i.render_cost_avg) < 0 ||
+                                               pa_tagstruct_get_usec(t, &i.render_cost_max) < 0 ||
+                                               pa_tagstruct_get_usec(t, &i.pop_cost_avg) < 0 ||
+                                               pa_tagstruct_get_usec(t, &i.pop_cost_max) < 0 ||
+                                               pa_tagstruct_get_usec(t, &i.resample_cost_avg) < 0 ||
+                                               pa_tagstruct_get_usec(t, &i.resample_cost_max) < 0))) {
 
                 pa_context_fail(o->context, PA_ERR_PROTOCOL);
                 pa_proplist_free(i.proplist);
@@ -233,6 +233,8 @@ typedef struct pa_sink_info {
     pa_sink_port_info* active_port;    /**< Pointer to active port in the array, or NULL. \since 0.9.16 */
     uint8_t n_formats;                 /**< Number of formats supported by the sink. \since 1.0 */
     pa_format_info **formats;          /**< Array of formats supported by the sink. \since 1.0 */
+    pa_usec_t render_cost_avg;         /**< Moving average of the time the server spends rendering one block of audio for this sink, including all its inputs. \since 5.0 */
+    pa_usec_t render_cost_max;         /**< Maximum of the time spent rendering one block during the last few seconds. \since 5.0 */
 } pa_sink_info;
 
 /** Callback prototype for pa_context_get_sink_info_by_name() and friends */
@@ -532,6 +534,12 @@ typedef struct pa_sink_input_info {
     int has_volume;                      /**< Stream has volume. If not set, then the meaning of this struct's volume member is unspecified. \since 1.0 */
     int volume_writable;                 /**< The volume can be set. If not set, the volume can still change even though clients can't control the volume. \since 1.0 */
     pa_format_info *format;              /**< Stream format information. \since 1.0 */
+    pa_usec_t render_cost_avg;           /**< Moving average of the time the sink spends getting one block of audio from this sink input. \since 5.0 */
+    pa_usec_t render_cost_max;           /**< Maximum of the time spent getting one block from this sink input during the last few seconds. \since 5.0 */
+    pa_usec_t pop_cost_avg;              /**< Like render_cost_avg, but only the part spent producing the data, e.g. in a filter. \since 5.0 */
+    pa_usec_t pop_cost_max;              /**< Like render_cost_max, but only the part spent producing the data. \since 5.0 */
+    pa_usec_t resample_cost_avg;         /**< Like render_cost_avg, but only the part spent resampling. \since 5.0 */
+    pa_usec_t resample_cost_max;         /**< Like render_cost_max, but only the part spent resampling. \since 5.0 */
 } pa_sink_input_info;
 
 /** Callback prototype for pa_context_get_sink_input_info() and friends */
@@ -32,6 +32,7 @@
 #include <pulsecore/hashmap.h>
 #include <pulsecore/strbuf.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/proplist-util.h>
 
 #include "proplist.h"
 
@@ -385,6 +386,20 @@ const char *pa_proplist_iterate(pa_proplist *p, void **state) {
     return prop->key;
 }
 
+const char *pa_proplist_iterate_data(pa_proplist *p, void **state, const void **data, size_t *nbytes) {
+    struct property *prop;
+
+    pa_assert(data);
+    pa_assert(nbytes);
+
+    if (!(prop = pa_hashmap_iterate(MAKE_HASHMAP(p), state, NULL)))
+        return NULL;
+
+    *data = prop->value;
+    *nbytes = prop->nbytes;
+    return prop->key;
+}
+
 char *pa_proplist_to_string_sep(pa_proplist *p, const char *sep) {
     const char *key;
     void *state = NULL;
@@ -35,6 +35,7 @@
 #include <pulse/fork-detect.h>
 
 #include <pulsecore/pstream-util.h>
+#include <pulsecore/codec.h>
 #include <pulsecore/log.h>
 #include <pulsecore/hashmap.h>
 #include <pulsecore/macro.h>
@@ -260,6 +261,13 @@ static void stream_unlink(pa_stream *s) {
         pa_pdispatch_unregister_reply(s->context->pdispatch, s);
 
     if (s->channel_valid) {
+        if (s->context->pstream) {
+            if (s->direction == PA_STREAM_RECORD)
+                pa_pstream_set_decoder(s->context->pstream, s->channel, NULL);
+            else
+                pa_pstream_set_encoder(s->context->pstream, s->channel, NULL);
+        }
+
         pa_hashmap_remove((s->direction == PA_STREAM_RECORD) ? s->context->record_streams : s->context->playback_streams, PA_UINT32_TO_PTR(s->channel));
         s->channel = 0;
         s->channel_valid = FALSE;
@@ -1143,6 +1151,28 @@ void pa_create_stream_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag,
         }
     }
 
+    if (s->context->version >= 32 && s->direction != PA_STREAM_UPLOAD) {
+        pa_format_info *codec = pa_format_info_new();
+
+        /* We never offer anything but lossless compression */
+        if (pa_tagstruct_get_format_info(t, codec) < 0 ||
+            (codec->encoding != PA_ENCODING_PCM && codec->encoding != PA_ENCODING_PCM_LOSSLESS) ||
+            (codec->encoding == PA_ENCODING_PCM_LOSSLESS && !pa_codec_supported(codec->encoding, &s->sample_spec))) {
+            pa_format_info_free(codec);
+            pa_context_fail(s->context, PA_ERR_PROTOCOL);
+            goto finish;
+        }
+
+        if (codec->encoding == PA_ENCODING_PCM_LOSSLESS) {
+            if (s->direction == PA_STREAM_PLAYBACK)
+                pa_pstream_set_encoder(s->context->pstream, s->channel, pa_codec_new_encoder(codec->encoding, &s->sample_spec, PA_CODEC_QUALITY_DEFAULT));
+            else
+                pa_pstream_set_decoder(s->context->pstream, s->channel, pa_codec_new_decoder(codec->encoding, &s->sample_spec));
+        }
+
+        pa_format_info_free(codec);
+    }
+
     if (!pa_tagstruct_eof(t)) {
         pa_context_fail(s->context, PA_ERR_PROTOCOL);
         goto finish;
@@ -1373,6 +1403,20 @@ static int create_stream(
         pa_tagstruct_put_boolean(t, flags & (PA_STREAM_PASSTHROUGH));
     }
 
+    if (s->context->version >= 32) {
+        /* Over the network we offer lossless compression, which is
+         * cheap enough to be worth it whenever it's possible */
+        if (!s->context->is_local && pa_codec_supported(PA_ENCODING_PCM_LOSSLESS, &s->sample_spec)) {
+            pa_format_info *codec = pa_format_info_new();
+
+            codec->encoding = PA_ENCODING_PCM_LOSSLESS;
+            pa_tagstruct_putu8(t, 1);
+            pa_tagstruct_put_format_info(t, codec);
+            pa_format_info_free(codec);
+        } else
+            pa_tagstruct_putu8(t, 0);
+    }
+
     pa_pstream_send_tagstruct(s->context->pstream, t);
     pa_pdispatch_register_reply(s->context->pdispatch, tag, DEFAULT_TIMEOUT, pa_create_stream_callback, s, NULL);
 
@@ -1695,6 +1739,8 @@ pa_operation * pa_stream_drain(pa_stream *s, pa_stream_success_cb_t cb, void *us
 
     o = pa_operation_new(s->context, s, (pa_operation_cb_t) cb, userdata);
 
+    pa_pstream_flush_encoder(s->context->pstream, s->channel);
+
     t = pa_tagstruct_command(s->context, PA_COMMAND_DRAIN_PLAYBACK_STREAM, &tag);
     pa_tagstruct_putu32(t, s->channel);
     pa_pstream_send_tagstruct(s->context->pstream, t);
@@ -2041,6 +2087,9 @@ int pa_stream_disconnect(pa_stream *s) {
 
     pa_stream_ref(s);
 
+    if (s->direction == PA_STREAM_PLAYBACK)
+        pa_pstream_flush_encoder(s->context->pstream, s->channel);
+
     t = pa_tagstruct_command(
             s->context,
             (uint32_t) (s->direction == PA_STREAM_PLAYBACK ? PA_COMMAND_DELETE_PLAYBACK_STREAM :
@@ -2260,6 +2309,9 @@ pa_operation* pa_stream_cork(pa_stream *s, int b, pa_stream_success_cb_t cb, voi
 
     o = pa_operation_new(s->context, s, (pa_operation_cb_t) cb, userdata);
 
+    if (s->direction == PA_STREAM_PLAYBACK)
+        pa_pstream_flush_encoder(s->context->pstream, s->channel);
+
     t = pa_tagstruct_command(
             s->context,
             (uint32_t) (s->direction == PA_STREAM_PLAYBACK ? PA_COMMAND_CORK_PLAYBACK_STREAM : PA_COMMAND_CORK_RECORD_STREAM),
@@ -2314,6 +2366,9 @@ pa_operation* pa_stream_flush(pa_stream *s, pa_stream_success_cb_t cb, void *use
      * underflow message and update the smoother status*/
     request_auto_timing_update(s, TRUE);
 
+    if (s->direction == PA_STREAM_PLAYBACK)
+        pa_pstream_flush_encoder(s->context->pstream, s->channel);
+
     if (!(o = stream_send_simple_command(s, (uint32_t) (s->direction == PA_STREAM_PLAYBACK ? PA_COMMAND_FLUSH_PLAYBACK_STREAM : PA_COMMAND_FLUSH_RECORD_STREAM), cb, userdata)))
         return NULL;
 
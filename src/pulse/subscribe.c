@@ -25,6 +25,8 @@
 
 #include <stdio.h>
 
+#include <pulse/xmalloc.h>
+
 #include <pulsecore/macro.h>
 #include <pulsecore/pstream-util.h>
 
@@ -35,6 +37,8 @@ void pa_command_subscribe_event(pa_pdispatch *pd, uint32_t command, uint32_t tag
     pa_context *c = userdata;
     pa_subscription_event_type_t e;
     uint32_t idx;
+    pa_subscription_delta d;
+    pa_bool_t has_delta = FALSE;
 
     pa_assert(pd);
     pa_assert(command == PA_COMMAND_SUBSCRIBE_EVENT);
@@ -44,9 +48,32 @@ void pa_command_subscribe_event(pa_pdispatch *pd, uint32_t command, uint32_t tag
 
     pa_context_ref(c);
 
+    pa_zero(d);
+
     if (pa_tagstruct_getu32(t, &e) < 0 ||
-        pa_tagstruct_getu32(t, &idx) < 0 ||
-        !pa_tagstruct_eof(t)) {
+        pa_tagstruct_getu32(t, &idx) < 0) {
+        pa_context_fail(c, PA_ERR_PROTOCOL);
+        goto finish;
+    }
+
+    /* The server only sends the changes if we asked for them */
+    if (c->version >= 31 && !pa_tagstruct_eof(t)) {
+        pa_bool_t mute = FALSE;
+
+        if (pa_tagstruct_getu64(t, &d.generation) < 0 ||
+            pa_tagstruct_getu32(t, &d.changes) < 0 ||
+            ((d.changes & PA_SUBSCRIPTION_CHANGE_VOLUME) && pa_tagstruct_get_cvolume(t, &d.volume) < 0) ||
+            ((d.changes & PA_SUBSCRIPTION_CHANGE_MUTE) && pa_tagstruct_get_boolean(t, &mute) < 0) ||
+            ((d.changes & PA_SUBSCRIPTION_CHANGE_STATE) && pa_tagstruct_getu32(t, &d.state) < 0)) {
+            pa_context_fail(c, PA_ERR_PROTOCOL);
+            goto finish;
+        }
+
+        d.mute = mute;
+        has_delta = TRUE;
+    }
+
+    if (!pa_tagstruct_eof(t)) {
         pa_context_fail(c, PA_ERR_PROTOCOL);
         goto finish;
     }
@@ -54,6 +81,9 @@ void pa_command_subscribe_event(pa_pdispatch *pd, uint32_t command, uint32_t tag
     if (c->subscribe_callback)
         c->subscribe_callback(c, e, idx, c->subscribe_userdata);
 
+    if (has_delta && c->subscribe_delta_callback)
+        c->subscribe_delta_callback(c, e, idx, &d, c->subscribe_delta_userdata);
+
 finish:
     pa_context_unref(c);
 }
@@ -72,6 +102,8 @@ pa_operation* pa_context_subscribe(pa_context *c, pa_subscription_mask_t m, pa_c
 
     t = pa_tagstruct_command(c, PA_COMMAND_SUBSCRIBE, &tag);
     pa_tagstruct_putu32(t, m);
+    if (c->version >= 31)
+        pa_tagstruct_put_boolean(t, !!c->subscribe_delta_callback);
     pa_pstream_send_tagstruct(c->pstream, t);
     pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, pa_context_simple_ack_callback, pa_operation_ref(o), (pa_free_cb_t) pa_operation_unref);
 
@@ -88,3 +120,102 @@ void pa_context_set_subscribe_callback(pa_context *c, pa_context_subscribe_cb_t
     c->subscribe_callback = cb;
     c->subscribe_userdata = userdata;
 }
+
+void pa_context_set_subscribe_delta_callback(pa_context *c, pa_context_subscribe_delta_cb_t cb, void *userdata) {
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    if (c->state == PA_CONTEXT_TERMINATED || c->state == PA_CONTEXT_FAILED)
+        return;
+
+    c->subscribe_delta_callback = cb;
+    c->subscribe_delta_userdata = userdata;
+}
+
+static void context_get_generations_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_operation *o = userdata;
+    pa_subscription_generations g, *p = &g;
+    pa_subscription_generation_info *changed = NULL;
+    unsigned n_allocated = 0;
+    pa_bool_t complete = FALSE;
+
+    pa_assert(pd);
+    pa_assert(o);
+    pa_assert(PA_REFCNT_VALUE(o) >= 1);
+
+    pa_zero(g);
+
+    if (!o->context)
+        goto finish;
+
+    if (command != PA_COMMAND_REPLY) {
+        if (pa_context_handle_error(o->context, command, t, FALSE) < 0)
+            goto finish;
+
+        p = NULL;
+    } else {
+        if (pa_tagstruct_getu64(t, &g.generation) < 0 ||
+            pa_tagstruct_get_boolean(t, &complete) < 0) {
+            pa_context_fail(o->context, PA_ERR_PROTOCOL);
+            goto finish;
+        }
+
+        g.complete = complete;
+
+        while (!pa_tagstruct_eof(t)) {
+            pa_subscription_generation_info *i;
+
+            if (g.n_changed >= n_allocated) {
+                n_allocated = PA_MAX(16U, n_allocated * 2);
+                changed = pa_xrenew(pa_subscription_generation_info, changed, n_allocated);
+            }
+
+            i = changed + g.n_changed;
+
+            if (pa_tagstruct_getu32(t, &i->t) < 0 ||
+                pa_tagstruct_getu32(t, &i->index) < 0 ||
+                pa_tagstruct_getu64(t, &i->generation) < 0) {
+                pa_context_fail(o->context, PA_ERR_PROTOCOL);
+                goto finish;
+            }
+
+            g.n_changed++;
+        }
+
+        g.changed = changed;
+    }
+
+    if (o->callback) {
+        pa_context_generations_cb_t cb = (pa_context_generations_cb_t) o->callback;
+        cb(o->context, p, o->userdata);
+    }
+
+finish:
+    pa_xfree(changed);
+
+    pa_operation_done(o);
+    pa_operation_unref(o);
+}
+
+pa_operation* pa_context_get_generations(pa_context *c, pa_subscription_mask_t m, uint64_t since, pa_context_generations_cb_t cb, void *userdata) {
+    pa_operation *o;
+    pa_tagstruct *t;
+    uint32_t tag;
+
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->state == PA_CONTEXT_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, (m & ~PA_SUBSCRIPTION_MASK_ALL) == 0, PA_ERR_INVALID);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->version >= 31, PA_ERR_NOTSUPPORTED);
+
+    o = pa_operation_new(c, NULL, (pa_operation_cb_t) cb, userdata);
+
+    t = pa_tagstruct_command(c, PA_COMMAND_GET_GENERATIONS, &tag);
+    pa_tagstruct_putu32(t, m);
+    pa_tagstruct_putu64(t, since);
+    pa_pstream_send_tagstruct(c->pstream, t);
+    pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, context_get_generations_callback, pa_operation_ref(o), (pa_free_cb_t) pa_operation_unref);
+
+    return o;
+}
@@ -26,6 +26,7 @@
 #include <inttypes.h>
 
 #include <pulse/def.h>
+#include <pulse/volume.h>
 #include <pulse/context.h>
 #include <pulse/cdecl.h>
 #include <pulse/version.h>
@@ -61,6 +62,23 @@ void my_subscription_callback(pa_context *c, pa_subscription_event_type_t t,
     }
 }
 @endverbatim
+ *
+ * \section delta_sec Changed Values
+ *
+ * Most change events are about the volume, mute state or state of a
+ * sink, source or stream. Instead of querying the whole object again,
+ * an application may set a callback with
+ * pa_context_set_subscribe_delta_callback() before calling
+ * pa_context_subscribe(). That callback receives the new values along
+ * with the event, as far as the server knows what changed. \since 5.0
+ *
+ * \section generation_sec Generations
+ *
+ * Each event the server generates gets a generation number, and the
+ * server remembers the generation of the last event for each object.
+ * pa_context_get_generations() lists the objects that changed or were
+ * removed since a given generation, so an application that keeps a
+ * copy of the server state only needs to query those. \since 5.0
  */
 
 /** \file
@@ -80,6 +98,49 @@ pa_operation* pa_context_subscribe(pa_context *c, pa_subscription_mask_t m, pa_c
 /** Set the context specific call back function that is called whenever the state of the daemon changes */
 void pa_context_set_subscribe_callback(pa_context *c, pa_context_subscribe_cb_t cb, void *userdata);
 
+/** The new values of a changed object, as passed to the callback set
+ * with pa_context_set_subscribe_delta_callback(). \since 5.0 */
+typedef struct pa_subscription_delta {
+    uint64_t generation;                     /**< The generation of the event, see pa_context_get_generations() */
+    pa_subscription_change_flags_t changes;  /**< Which of the fields below are set. If PA_SUBSCRIPTION_CHANGE_UNKNOWN, none is and the object has to be queried again. */
+    pa_cvolume volume;                       /**< The volume, if changes contains PA_SUBSCRIPTION_CHANGE_VOLUME */
+    int mute;                                /**< The mute state, if changes contains PA_SUBSCRIPTION_CHANGE_MUTE */
+    uint32_t state;                          /**< If changes contains PA_SUBSCRIPTION_CHANGE_STATE, the pa_sink_state_t or pa_source_state_t of a sink or source, or 1 if a stream is corked and 0 otherwise */
+} pa_subscription_delta;
+
+/** Subscription event callback prototype that also gets the new values of the object. \since 5.0 */
+typedef void (*pa_context_subscribe_delta_cb_t)(pa_context *c, pa_subscription_event_type_t t, uint32_t idx, const pa_subscription_delta *d, void *userdata);
+
+/** Set a callback function that is called for each event along with
+ * what changed. It is called in addition to the one set with
+ * pa_context_set_subscribe_callback(). It needs to be set before
+ * pa_context_subscribe() is called, and is never called if the server
+ * doesn't support this. \since 5.0 */
+void pa_context_set_subscribe_delta_callback(pa_context *c, pa_context_subscribe_delta_cb_t cb, void *userdata);
+
+/** An object that changed or was removed, as listed by
+ * pa_context_get_generations(). \since 5.0 */
+typedef struct pa_subscription_generation_info {
+    pa_subscription_event_type_t t;  /**< The facility of the object, and either PA_SUBSCRIPTION_EVENT_CHANGE or PA_SUBSCRIPTION_EVENT_REMOVE */
+    uint32_t index;                  /**< The index of the object */
+    uint64_t generation;             /**< The generation of the last event about the object */
+} pa_subscription_generation_info;
+
+/** The reply of pa_context_get_generations(). \since 5.0 */
+typedef struct pa_subscription_generations {
+    uint64_t generation;                              /**< The current generation of the server */
+    int complete;                                     /**< If 0, objects might have been removed since the requested generation that the server doesn't remember anymore, and everything needs to be queried again */
+    unsigned n_changed;                               /**< Number of entries in changed */
+    const pa_subscription_generation_info *changed;   /**< The objects whose last event is newer than the requested generation */
+} pa_subscription_generations;
+
+/** Callback prototype for pa_context_get_generations(). g is NULL on failure. \since 5.0 */
+typedef void (*pa_context_generations_cb_t)(pa_context *c, const pa_subscription_generations *g, void *userdata);
+
+/** List the objects matching the mask that changed or were removed
+ * since the given generation. With 0, all objects are listed. \since 5.0 */
+pa_operation* pa_context_get_generations(pa_context *c, pa_subscription_mask_t m, uint64_t since, pa_context_generations_cb_t cb, void *userdata);
+
 PA_C_DECL_END
 
 #endif
@@ -58,6 +58,8 @@
 #include <pulsecore/core-error.h>
 #include <pulsecore/modinfo.h>
 #include <pulsecore/dynarray.h>
+#include <pulsecore/pstream.h>
+#include <pulsecore/trace.h>
 
 #include "cli-command.h"
 
@@ -92,6 +94,7 @@ static int pa_cli_command_sources(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, p
 static int pa_cli_command_sink_inputs(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
 static int pa_cli_command_source_outputs(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
 static int pa_cli_command_stat(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
+static int pa_cli_command_threads(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
 static int pa_cli_command_info(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
 static int pa_cli_command_load(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
 static int pa_cli_command_unload(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
@@ -137,6 +140,7 @@ static int pa_cli_command_sink_port(pa_core *c, pa_tokenizer *t, pa_strbuf *buf,
 static int pa_cli_command_source_port(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
 static int pa_cli_command_port_offset(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
 static int pa_cli_command_dump_volumes(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
+static int pa_cli_command_dump_trace(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
 
 /* A method table for all available commands */
 
@@ -149,6 +153,7 @@ static const struct command commands[] = {
     { "list-clients",            pa_cli_command_clients,            "List loaded clients",          1 },
     { "list-sink-inputs",        pa_cli_command_sink_inputs,        "List sink inputs",             1 },
     { "list-source-outputs",     pa_cli_command_source_outputs,     "List source outputs",          1 },
+    { "list-threads",            pa_cli_command_threads,            "List threads and their CPU usage", 1 },
     { "stat",                    pa_cli_command_stat,               "Show memory block statistics", 1 },
     { "info",                    pa_cli_command_info,               "Show comprehensive status",    1 },
     { "ls",                      pa_cli_command_info,               NULL,                           1 },
@@ -196,6 +201,7 @@ static const struct command commands[] = {
     { "play-file",               pa_cli_command_play_file,          "Play a sound file (args: filename, sink|index)", 3},
     { "dump",                    pa_cli_command_dump,               "Dump daemon configuration", 1},
     { "dump-volumes",            pa_cli_command_dump_volumes,       "Debug: Show the state of all volumes", 1 },
+    { "dump-trace",              pa_cli_command_dump_trace,         "Debug: Show the IO thread trace as Chrome trace JSON, or write it to a file (args: [filename])", 2 },
     { "shared",                  pa_cli_command_list_shared_props,  "Debug: Show shared properties", 1},
     { "exit",                    pa_cli_command_exit,               "Terminate the daemon",         1 },
     { "vacuum",                  pa_cli_command_vacuum,             NULL, 1},
@@ -340,11 +346,27 @@ static int pa_cli_command_source_outputs(pa_core *c, pa_tokenizer *t, pa_strbuf
     return 0;
 }
 
+static int pa_cli_command_threads(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail) {
+    char *s;
+
+    pa_core_assert_ref(c);
+    pa_assert(t);
+    pa_assert(buf);
+    pa_assert(fail);
+
+    pa_assert_se(s = pa_thread_list_to_string(c));
+    pa_strbuf_puts(buf, s);
+    pa_xfree(s);
+    return 0;
+}
+
 static int pa_cli_command_stat(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail) {
     char ss[PA_SAMPLE_SPEC_SNPRINT_MAX];
     char cm[PA_CHANNEL_MAP_SNPRINT_MAX];
     char bytes[PA_BYTES_SNPRINT_MAX];
     const pa_mempool_stat *mstat;
+    const pa_pstream_stat *pstat;
+    uint64_t codec_pcm_bytes, codec_encoded_bytes;
     unsigned k;
     pa_sink *def_sink;
     pa_source *def_source;
@@ -381,6 +403,23 @@ static int pa_cli_command_stat(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_b
                      (unsigned) pa_atomic_load(&mstat->n_exported),
                      pa_bytes_snprint(bytes, sizeof(bytes), (unsigned) pa_atomic_load(&mstat->exported_size)));
 
+    pstat = pa_pstream_get_stat();
+
+    pa_strbuf_printf(buf, "Native protocol frames sent: %u in %u system calls, received: %u in %u system calls.\n",
+                     (unsigned) pa_atomic_load(&pstat->n_frames_sent),
+                     (unsigned) pa_atomic_load(&pstat->n_write_calls),
+                     (unsigned) pa_atomic_load(&pstat->n_frames_received),
+                     (unsigned) pa_atomic_load(&pstat->n_read_calls));
+
+    pa_strbuf_printf(buf, "Native protocol memory blocks passed to sinks directly from IO threads: %u.\n",
+                     (unsigned) pa_atomic_load(&pstat->n_memblocks_direct));
+
+    pa_pstream_get_codec_stat(&codec_pcm_bytes, &codec_encoded_bytes);
+
+    pa_strbuf_printf(buf, "Native protocol stream data compressed: %0.1f MiB, size on the network: %0.1f MiB.\n",
+                     (double) codec_pcm_bytes / 1024 / 1024,
+                     (double) codec_encoded_bytes / 1024 / 1024);
+
     pa_strbuf_printf(buf, "Total sample cache size: %s.\n",
                      pa_bytes_snprint(bytes, sizeof(bytes), (unsigned) pa_scache_total_size(c)));
 
@@ -1923,6 +1962,36 @@ static int pa_cli_command_dump_volumes(pa_core *c, pa_tokenizer *t, pa_strbuf *b
     return 0;
 }
 
+static int pa_cli_command_dump_trace(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail) {
+    const char *fn;
+    char *json;
+
+    pa_core_assert_ref(c);
+    pa_assert(t);
+    pa_assert(buf);
+    pa_assert(fail);
+
+    if (pa_trace_get_size() <= 0) {
+        pa_strbuf_puts(buf, "Tracing is disabled, set trace-buffer-size in daemon.conf.\n");
+        return -1;
+    }
+
+    if ((fn = pa_tokenizer_get(t, 1))) {
+        if (pa_trace_dump(fn) < 0) {
+            pa_strbuf_printf(buf, "Failed to write trace to '%s'.\n", fn);
+            return -1;
+        }
+
+        return 0;
+    }
+
+    json = pa_trace_to_json();
+    pa_strbuf_puts(buf, json);
+    pa_xfree(json);
+
+    return 0;
+}
+
 int pa_cli_command_execute_line_stateful(pa_core *c, const char *s, pa_strbuf *buf, pa_bool_t *fail, int *ifstate) {
     const char *cs;
 
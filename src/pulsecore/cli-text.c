@@ -38,6 +38,7 @@
 #include <pulsecore/macro.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/namereg.h>
+#include <pulsecore/thread.h>
 
 #include "cli-text.h"
 
@@ -252,6 +253,8 @@ char *pa_sink_list_to_string(pa_core *c) {
             vdb[PA_SW_VOLUME_SNPRINT_DB_MAX],
             cm[PA_CHANNEL_MAP_SNPRINT_MAX], *t;
         const char *cmn;
+        pa_sink_rewind_stats rewind_stats;
+        pa_cost_meter render_cost;
 
         cmn = pa_channel_map_to_pretty_name(&sink->channel_map);
 
@@ -331,6 +334,22 @@ char *pa_sink_list_to_string(pa_core *c) {
                     "\tfixed latency: %0.2f ms\n",
                     (double) pa_sink_get_fixed_latency(sink) / PA_USEC_PER_MSEC);
 
+        pa_sink_get_rewind_stats(sink, &rewind_stats);
+        pa_strbuf_printf(
+                s,
+                "\trewinds: %llu (%llu requested); %llu KiB rewound, %llu KiB rewritten\n",
+                (unsigned long long) rewind_stats.rewinds,
+                (unsigned long long) rewind_stats.requests,
+                (unsigned long long) rewind_stats.rewound_bytes / 1024,
+                (unsigned long long) rewind_stats.rewritten_bytes / 1024);
+
+        pa_sink_get_render_cost(sink, &render_cost);
+        pa_strbuf_printf(
+                s,
+                "\trender cost: %0.2f ms average, %0.2f ms max\n",
+                (double) pa_cost_meter_get_avg(&render_cost) / PA_USEC_PER_MSEC,
+                (double) pa_cost_meter_get_max(&render_cost) / PA_USEC_PER_MSEC);
+
         if (sink->card)
             pa_strbuf_printf(s, "\tcard: %u <%s>\n", sink->card->index, sink->card->name);
         if (sink->module)
@@ -590,6 +609,7 @@ char *pa_sink_input_list_to_string(pa_core *c) {
         const char *cmn;
         pa_cvolume v;
         char *volume_str = NULL;
+        pa_sink_input_render_cost render_cost;
 
         cmn = pa_channel_map_to_pretty_name(&i->channel_map);
 
@@ -651,6 +671,17 @@ char *pa_sink_input_list_to_string(pa_core *c) {
 
         pa_xfree(volume_str);
 
+        pa_sink_input_get_render_cost(i, &render_cost);
+        pa_strbuf_printf(
+                s,
+                "\trender cost: %0.2f ms average, %0.2f ms max (pop %0.2f/%0.2f ms, resample %0.2f/%0.2f ms)\n",
+                (double) pa_cost_meter_get_avg(&render_cost.peek) / PA_USEC_PER_MSEC,
+                (double) pa_cost_meter_get_max(&render_cost.peek) / PA_USEC_PER_MSEC,
+                (double) pa_cost_meter_get_avg(&render_cost.pop) / PA_USEC_PER_MSEC,
+                (double) pa_cost_meter_get_max(&render_cost.pop) / PA_USEC_PER_MSEC,
+                (double) pa_cost_meter_get_avg(&render_cost.resample) / PA_USEC_PER_MSEC,
+                (double) pa_cost_meter_get_max(&render_cost.resample) / PA_USEC_PER_MSEC);
+
         if (i->module)
             pa_strbuf_printf(s, "\tmodule: %u\n", i->module->index);
         if (i->client)
@@ -725,6 +756,54 @@ char *pa_scache_list_to_string(pa_core *c) {
     return pa_strbuf_tostring_free(s);
 }
 
+static void append_thread(pa_thread *t, void *userdata) {
+    pa_strbuf *s = userdata;
+    pa_thread_stats stats;
+
+    pa_thread_get_stats(t, &stats);
+
+    pa_strbuf_printf(
+        s,
+        "    name: <%s>\n"
+        "\tcpu time: %0.3f s\n"
+        "\tcontext switches: %llu voluntary, %llu involuntary\n",
+        pa_strnull(pa_thread_get_name(t)),
+        (double) stats.cpu_time / PA_USEC_PER_SEC,
+        (unsigned long long) stats.voluntary_switches,
+        (unsigned long long) stats.involuntary_switches);
+
+    if (stats.last_cpu >= 0)
+        pa_strbuf_printf(s, "\tlast cpu: %i\n", stats.last_cpu);
+    else
+        pa_strbuf_puts(s, "\tlast cpu: n/a\n");
+}
+
+char *pa_thread_list_to_string(pa_core *c) {
+    pa_strbuf *s, *threads;
+    char io_cpus[PA_CPU_SET_SNPRINT_MAX], main_cpus[PA_CPU_SET_SNPRINT_MAX];
+    char *t;
+    pa_assert(c);
+
+    s = pa_strbuf_new();
+    threads = pa_strbuf_new();
+
+    /* The main thread was not created with pa_thread_new() and hence
+     * isn't part of the list, so add it first */
+    append_thread(pa_thread_self(), threads);
+    pa_thread_foreach(append_thread, threads);
+
+    pa_strbuf_printf(s, "IO thread CPU affinity: %s\n"
+                     "Main thread CPU affinity: %s\n",
+                     pa_cpu_set_is_empty(&c->io_thread_affinity) ? "n/a" : pa_cpu_set_snprint(io_cpus, sizeof(io_cpus), &c->io_thread_affinity),
+                     pa_cpu_set_is_empty(&c->main_thread_affinity) ? "n/a" : pa_cpu_set_snprint(main_cpus, sizeof(main_cpus), &c->main_thread_affinity));
+
+    t = pa_strbuf_tostring_free(threads);
+    pa_strbuf_puts(s, t);
+    pa_xfree(t);
+
+    return pa_strbuf_tostring_free(s);
+}
+
 char *pa_full_status_string(pa_core *c) {
     pa_strbuf *s;
     int i;
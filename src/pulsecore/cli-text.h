@@ -35,6 +35,7 @@ char *pa_card_list_to_string(pa_core *c);
 char *pa_client_list_to_string(pa_core *c);
 char *pa_module_list_to_string(pa_core *c);
 char *pa_scache_list_to_string(pa_core *c);
+char *pa_thread_list_to_string(pa_core *c);
 
 char *pa_full_status_string(pa_core *c);
 
@@ -0,0 +1,1114 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#ifdef HAVE_OPUS
+#include <opus/opus.h>
+#endif
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "codec.h"
+
+/* A block starts with the length of the PCM it decodes to. For codecs
+ * with fixed frames the rest is a sequence of encoded frames, each
+ * preceded by its length. Only the last frame may hold less PCM than
+ * the frame size, when the encoder was flushed; it is padded with
+ * silence and the padding is dropped again when decoding. Otherwise
+ * it's up to the codec. */
+#define BLOCK_HEADER_SIZE 4
+#define FRAME_HEADER_SIZE 2
+
+/* The encoder is handed no more than a memblock at a time, so this is
+ * the most a block of a codec without fixed frames decodes to. With
+ * fixed frames it may hold one more frame, made up of what was kept
+ * back before. Blocks claiming more are rejected. */
+#define BLOCK_PCM_MAX (64*1024)
+
+struct codec_impl {
+    pa_encoding_t encoding;
+
+    pa_bool_t (*supported)(const pa_sample_spec *ss);
+
+    /* Sets up c->state, and c->frame_size for codecs with fixed
+     * frames */
+    int (*init)(pa_codec *c);
+    void (*done)(pa_codec *c);
+
+    /* For codecs with fixed frames these work on one frame each */
+    size_t (*max_encoded_size)(pa_codec *c, size_t length);
+    size_t (*encode)(pa_codec *c, const uint8_t *src, size_t length, uint8_t *dst, size_t size);
+    int (*decode)(pa_codec *c, const uint8_t *src, size_t length, uint8_t *dst, size_t size);
+
+    /* Optional, for codecs that can decode frames of other sizes than
+     * they encode. Returns 0 if the frame is invalid. */
+    size_t (*frame_decoded_size)(pa_codec *c, const uint8_t *src, size_t length);
+};
+
+struct pa_codec {
+    const struct codec_impl *impl;
+    pa_sample_spec sample_spec;
+    pa_bool_t encoder;
+    unsigned quality;
+
+    /* What the encoder keeps back for the next block. The decoder
+     * decodes a partial last frame here. */
+    size_t frame_size;
+    uint8_t *frame;
+    size_t frame_index;
+
+    uint64_t pcm_bytes, encoded_bytes;
+
+    void *state;
+};
+
+#ifdef HAVE_OPUS
+
+/* Short enough not to add noticeable latency, long enough to keep the
+ * per frame overhead low */
+#define OPUS_FRAME_MSEC 10
+
+/* The largest packet the encoder will produce for a single frame */
+#define OPUS_PACKET_MAX 1275
+
+struct opus_state {
+    OpusEncoder *encoder;
+    OpusDecoder *decoder;
+};
+
+static pa_bool_t opus_supported(const pa_sample_spec *ss) {
+    if (ss->format != PA_SAMPLE_S16NE && ss->format != PA_SAMPLE_FLOAT32NE)
+        return FALSE;
+
+    if (ss->channels > 2)
+        return FALSE;
+
+    return
+        ss->rate == 8000 ||
+        ss->rate == 12000 ||
+        ss->rate == 16000 ||
+        ss->rate == 24000 ||
+        ss->rate == 48000;
+}
+
+static int opus_init(pa_codec *c) {
+    struct opus_state *s;
+    int error;
+
+    s = pa_xnew0(struct opus_state, 1);
+    c->state = s;
+    c->frame_size = pa_frame_size(&c->sample_spec) * (c->sample_spec.rate / (1000 / OPUS_FRAME_MSEC));
+
+    if (c->encoder) {
+        if (!(s->encoder = opus_encoder_create((opus_int32) c->sample_spec.rate, c->sample_spec.channels, OPUS_APPLICATION_RESTRICTED_LOWDELAY, &error))) {
+            pa_log("Failed to create Opus encoder: %s", opus_strerror(error));
+            return -1;
+        }
+
+        /* The quality picks both how hard the encoder tries and how
+         * many bits it may spend: from 24 kbit/s per channel at 0 to
+         * 124 kbit/s at 10 */
+        opus_encoder_ctl(s->encoder, OPUS_SET_COMPLEXITY((opus_int32) c->quality));
+        opus_encoder_ctl(s->encoder, OPUS_SET_BITRATE((opus_int32) (c->sample_spec.channels * (24000 + c->quality * 10000))));
+
+    } else {
+        if (!(s->decoder = opus_decoder_create((opus_int32) c->sample_spec.rate, c->sample_spec.channels, &error))) {
+            pa_log("Failed to create Opus decoder: %s", opus_strerror(error));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void opus_done(pa_codec *c) {
+    struct opus_state *s = c->state;
+
+    if (!s)
+        return;
+
+    if (s->encoder)
+        opus_encoder_destroy(s->encoder);
+
+    if (s->decoder)
+        opus_decoder_destroy(s->decoder);
+
+    pa_xfree(s);
+}
+
+static size_t opus_max_encoded_size(pa_codec *c, size_t length) {
+    return OPUS_PACKET_MAX;
+}
+
+static size_t opus_encode_frame(pa_codec *c, const uint8_t *src, size_t length, uint8_t *dst, size_t size) {
+    struct opus_state *s = c->state;
+    int samples;
+    opus_int32 r;
+
+    samples = (int) (length / pa_frame_size(&c->sample_spec));
+
+    if (c->sample_spec.format == PA_SAMPLE_FLOAT32NE)
+        r = opus_encode_float(s->encoder, (const float*) src, samples, dst, (opus_int32) PA_MIN(size, OPUS_PACKET_MAX));
+    else
+        r = opus_encode(s->encoder, (const opus_int16*) src, samples, dst, (opus_int32) PA_MIN(size, OPUS_PACKET_MAX));
+
+    if (r < 0) {
+        pa_log("Opus encoding failed: %s", opus_strerror(r));
+        return (size_t) -1;
+    }
+
+    return (size_t) r;
+}
+
+static int opus_decode_frame(pa_codec *c, const uint8_t *src, size_t length, uint8_t *dst, size_t size) {
+    struct opus_state *s = c->state;
+    int samples, r;
+
+    samples = (int) (size / pa_frame_size(&c->sample_spec));
+
+    if (c->sample_spec.format == PA_SAMPLE_FLOAT32NE)
+        r = opus_decode_float(s->decoder, src, (opus_int32) length, (float*) dst, samples, 0);
+    else
+        r = opus_decode(s->decoder, src, (opus_int32) length, (opus_int16*) dst, samples, 0);
+
+    if (r != samples) {
+        pa_log_debug("Opus decoding failed: %s", r < 0 ? opus_strerror(r) : "short frame");
+        return -1;
+    }
+
+    return 0;
+}
+
+static size_t opus_frame_decoded_size(pa_codec *c, const uint8_t *src, size_t length) {
+    int samples;
+
+    if ((samples = opus_packet_get_nb_samples(src, (opus_int32) length, (opus_int32) c->sample_spec.rate)) <= 0)
+        return 0;
+
+    return (size_t) samples * pa_frame_size(&c->sample_spec);
+}
+
+#endif
+
+/* Lossless compression of 16 bit PCM. Each channel is predicted with
+ * one of the fixed polynomial predictors FLAC uses and the residual
+ * is Rice coded in partitions, each with its own parameter. For
+ * stereo the second channel may be coded as its difference to the
+ * first. Blocks that wouldn't get smaller are sent verbatim. */
+
+#define LOSSLESS_VERBATIM 0
+#define LOSSLESS_RICE 1
+
+#define LOSSLESS_MAX_ORDER 3
+#define LOSSLESS_PARTITION_FRAMES 256
+
+/* Channel header bits */
+#define LOSSLESS_ORDER_MASK 0x03
+#define LOSSLESS_SIDE 0x80
+
+#define LOSSLESS_WARMUP_BITS 18
+#define LOSSLESS_K_BITS 5
+#define LOSSLESS_K_MAX 24
+
+/* Parameter for partitions without any residual, as in silence */
+#define LOSSLESS_K_ZERO 31
+
+/* Values whose quotient would take this many bits are written as they
+ * are instead, so that outliers don't blow up a partition */
+#define LOSSLESS_ESCAPE 24
+
+struct lossless_state {
+    int32_t *samples, *previous, *residual;
+    size_t n_allocated;
+};
+
+struct bit_writer {
+    uint8_t *data;
+    size_t size, index;
+    uint64_t acc;
+    unsigned bits;
+    pa_bool_t overflow;
+};
+
+struct bit_reader {
+    const uint8_t *data;
+    size_t size, index;
+    uint64_t acc;
+    unsigned bits;
+    pa_bool_t error;
+};
+
+static inline uint32_t zigzag(int32_t v) {
+    return ((uint32_t) v << 1) ^ (uint32_t) (v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t u) {
+    return (int32_t) (u >> 1) ^ -(int32_t) (u & 1);
+}
+
+/* n has to be at most 32 */
+static inline void put_bits(struct bit_writer *w, uint32_t v, unsigned n) {
+    w->acc = (w->acc << n) | v;
+    w->bits += n;
+
+    while (w->bits >= 8) {
+        w->bits -= 8;
+
+        if (w->index >= w->size) {
+            w->overflow = TRUE;
+            w->bits = 0;
+            return;
+        }
+
+        w->data[w->index++] = (uint8_t) (w->acc >> w->bits);
+    }
+}
+
+static void flush_bits(struct bit_writer *w) {
+    if (w->bits > 0)
+        put_bits(w, 0, 8 - w->bits);
+}
+
+static inline pa_bool_t refill_bits(struct bit_reader *r) {
+    if (r->index >= r->size) {
+        r->error = TRUE;
+        return FALSE;
+    }
+
+    r->acc = (r->acc << 8) | r->data[r->index++];
+    r->bits += 8;
+    return TRUE;
+}
+
+/* n has to be at most 32 */
+static inline uint32_t get_bits(struct bit_reader *r, unsigned n) {
+    while (r->bits < n)
+        if (!refill_bits(r))
+            return 0;
+
+    r->bits -= n;
+    return (uint32_t) ((r->acc >> r->bits) & (((uint64_t) 1 << n) - 1));
+}
+
+static inline unsigned get_unary(struct bit_reader *r) {
+    unsigned q;
+
+    for (q = 0; q < LOSSLESS_ESCAPE; q++) {
+        if (r->bits == 0 && !refill_bits(r))
+            return 0;
+
+        r->bits--;
+
+        if ((r->acc >> r->bits) & 1)
+            break;
+    }
+
+    return q;
+}
+
+static inline void put_rice(struct bit_writer *w, uint32_t u, unsigned k) {
+    uint32_t q = u >> k;
+
+    if (q >= LOSSLESS_ESCAPE) {
+        put_bits(w, 0, LOSSLESS_ESCAPE);
+        put_bits(w, u, 32);
+        return;
+    }
+
+    put_bits(w, 1, q + 1);
+
+    if (k > 0)
+        put_bits(w, u & ((1U << k) - 1), k);
+}
+
+static inline uint32_t get_rice(struct bit_reader *r, unsigned k) {
+    unsigned q;
+
+    if ((q = get_unary(r)) >= LOSSLESS_ESCAPE)
+        return get_bits(r, 32);
+
+    return ((uint32_t) q << k) | get_bits(r, k);
+}
+
+static inline int32_t predict(const int32_t *x, size_t i, unsigned order) {
+    switch (order) {
+        case 0:
+            return 0;
+        case 1:
+            return x[i-1];
+        case 2:
+            return 2*x[i-1] - x[i-2];
+        default:
+            return 3*x[i-1] - 3*x[i-2] + x[i-3];
+    }
+}
+
+/* Picks the predictor order that leaves the smallest residual */
+static unsigned choose_order(const int32_t *x, size_t n, unsigned max_order, uint64_t *cost) {
+    uint64_t sum[LOSSLESS_MAX_ORDER + 1] = { 0, 0, 0, 0 };
+    unsigned order, best = 0;
+    size_t i;
+
+    max_order = (unsigned) PA_MIN((size_t) max_order, n);
+
+    for (i = max_order; i < n; i++) {
+        int32_t e0, e1, e2, e3;
+
+        e0 = x[i];
+        sum[0] += (uint64_t) (e0 < 0 ? -(int64_t) e0 : e0);
+
+        if (max_order < 1)
+            continue;
+
+        e1 = e0 - x[i-1];
+        sum[1] += (uint64_t) (e1 < 0 ? -(int64_t) e1 : e1);
+
+        if (max_order < 2)
+            continue;
+
+        e2 = e1 - (x[i-1] - x[i-2]);
+        sum[2] += (uint64_t) (e2 < 0 ? -(int64_t) e2 : e2);
+
+        if (max_order < 3)
+            continue;
+
+        e3 = e2 - (x[i-1] - 2*x[i-2] + x[i-3]);
+        sum[3] += (uint64_t) (e3 < 0 ? -(int64_t) e3 : e3);
+    }
+
+    for (order = 1; order <= max_order; order++)
+        if (sum[order] < sum[best])
+            best = order;
+
+    if (cost)
+        *cost = sum[best];
+
+    return best;
+}
+
+static uint64_t rice_cost(const uint32_t *u, size_t n, unsigned k) {
+    uint64_t bits = (uint64_t) n * (k + 1);
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        bits += u[i] >> k;
+
+    return bits;
+}
+
+/* Estimates the Rice parameter from the mean, and if we're asked to
+ * try harder checks its neighbours too */
+static unsigned rice_parameter(const uint32_t *u, size_t n, pa_bool_t exact) {
+    uint64_t sum = 0, best_cost;
+    unsigned k = 0, best, j;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        sum += u[i];
+
+    if (sum <= 0)
+        return LOSSLESS_K_ZERO;
+
+    while (k < LOSSLESS_K_MAX && ((uint64_t) n << (k + 1)) < sum)
+        k++;
+
+    if (!exact)
+        return k;
+
+    best = k;
+    best_cost = rice_cost(u, n, k);
+
+    for (j = (k > 0 ? k - 1 : 0); j <= PA_MIN(k + 1, (unsigned) LOSSLESS_K_MAX); j++) {
+        uint64_t cost;
+
+        if (j == k)
+            continue;
+
+        if ((cost = rice_cost(u, n, j)) < best_cost) {
+            best = j;
+            best_cost = cost;
+        }
+    }
+
+    return best;
+}
+
+static inline int32_t read_sample(const uint8_t *p, pa_bool_t le) {
+    return le ? (int16_t) (p[0] | (p[1] << 8)) : (int16_t) ((p[0] << 8) | p[1]);
+}
+
+static inline void write_sample(uint8_t *p, int32_t v, pa_bool_t le) {
+    if (le) {
+        p[0] = (uint8_t) v;
+        p[1] = (uint8_t) (v >> 8);
+    } else {
+        p[0] = (uint8_t) (v >> 8);
+        p[1] = (uint8_t) v;
+    }
+}
+
+static pa_bool_t lossless_supported(const pa_sample_spec *ss) {
+    return ss->format == PA_SAMPLE_S16LE || ss->format == PA_SAMPLE_S16BE;
+}
+
+static int lossless_init(pa_codec *c) {
+    c->state = pa_xnew0(struct lossless_state, 1);
+    return 0;
+}
+
+static void lossless_done(pa_codec *c) {
+    struct lossless_state *s = c->state;
+
+    if (!s)
+        return;
+
+    pa_xfree(s->samples);
+    pa_xfree(s->previous);
+    pa_xfree(s->residual);
+    pa_xfree(s);
+}
+
+static void lossless_alloc(struct lossless_state *s, size_t n) {
+    if (n <= s->n_allocated)
+        return;
+
+    s->samples = pa_xrenew(int32_t, s->samples, n);
+    s->previous = pa_xrenew(int32_t, s->previous, n);
+    s->residual = pa_xrenew(int32_t, s->residual, n);
+    s->n_allocated = n;
+}
+
+static size_t lossless_max_encoded_size(pa_codec *c, size_t length) {
+    /* If it doesn't get any smaller it's sent verbatim */
+    return 1 + length;
+}
+
+static void lossless_encode_channel(pa_codec *c, struct bit_writer *w, int32_t *x, size_t n, unsigned header) {
+    struct lossless_state *s = c->state;
+    uint32_t *u = (uint32_t*) s->residual;
+    unsigned order = header & LOSSLESS_ORDER_MASK;
+    size_t i;
+
+    put_bits(w, header, 8);
+
+    for (i = 0; i < order && i < n; i++)
+        put_bits(w, zigzag(x[i]), LOSSLESS_WARMUP_BITS);
+
+    for (; i < n; i++)
+        u[i] = zigzag(x[i] - predict(x, i, order));
+
+    for (i = order; i < n && !w->overflow; i += LOSSLESS_PARTITION_FRAMES) {
+        size_t m = PA_MIN(n - i, (size_t) LOSSLESS_PARTITION_FRAMES), j;
+        unsigned k = rice_parameter(u + i, m, c->quality >= 8);
+
+        put_bits(w, k, LOSSLESS_K_BITS);
+
+        if (k == LOSSLESS_K_ZERO)
+            continue;
+
+        for (j = 0; j < m; j++)
+            put_rice(w, u[i + j], k);
+    }
+}
+
+static size_t lossless_encode(pa_codec *c, const uint8_t *src, size_t length, uint8_t *dst, size_t size) {
+    struct lossless_state *s = c->state;
+    struct bit_writer w;
+    size_t fs, n, i, rest;
+    unsigned ch, max_order;
+    pa_bool_t le;
+
+    if (size < 1 + length)
+        return (size_t) -1;
+
+    fs = pa_frame_size(&c->sample_spec);
+    n = length / fs;
+    rest = length - n * fs;
+    le = c->sample_spec.format == PA_SAMPLE_S16LE;
+
+    /* The quality decides how hard we look for redundancy */
+    max_order = c->quality >= 6 ? 3 : c->quality >= 3 ? 2 : 1;
+
+    memset(&w, 0, sizeof(w));
+    w.data = dst + 1;
+    w.size = length - rest;
+
+    lossless_alloc(s, n);
+
+    for (ch = 0; ch < c->sample_spec.channels && n > 0 && !w.overflow; ch++) {
+        unsigned header;
+        uint64_t cost;
+        int32_t *t;
+
+        for (i = 0; i < n; i++)
+            s->samples[i] = read_sample(src + i * fs + ch * 2, le);
+
+        header = choose_order(s->samples, n, max_order, &cost);
+
+        if (ch == 1 && c->sample_spec.channels == 2 && c->quality >= 5) {
+            uint64_t side_cost;
+            unsigned side_order;
+
+            for (i = 0; i < n; i++)
+                s->residual[i] = s->samples[i] - s->previous[i];
+
+            side_order = choose_order(s->residual, n, max_order, &side_cost);
+
+            if (side_cost < cost) {
+                memcpy(s->samples, s->residual, n * sizeof(int32_t));
+                header = side_order | LOSSLESS_SIDE;
+            }
+        }
+
+        lossless_encode_channel(c, &w, s->samples, n, header);
+
+        /* Keep the first channel around for coding the second one as
+         * difference */
+        t = s->previous;
+        s->previous = s->samples;
+        s->samples = t;
+    }
+
+    flush_bits(&w);
+
+    if (n <= 0 || w.overflow) {
+        dst[0] = LOSSLESS_VERBATIM;
+        memcpy(dst + 1, src, length);
+        return 1 + length;
+    }
+
+    dst[0] = LOSSLESS_RICE;
+    memcpy(dst + 1 + w.index, src + length - rest, rest);
+
+    return 1 + w.index + rest;
+}
+
+static int lossless_decode(pa_codec *c, const uint8_t *src, size_t length, uint8_t *dst, size_t size) {
+    struct lossless_state *s = c->state;
+    struct bit_reader r;
+    size_t fs, n, i, rest;
+    unsigned ch;
+    pa_bool_t le;
+
+    if (length < 1)
+        return -1;
+
+    if (src[0] == LOSSLESS_VERBATIM) {
+        if (length != 1 + size)
+            return -1;
+
+        memcpy(dst, src + 1, size);
+        return 0;
+    }
+
+    if (src[0] != LOSSLESS_RICE)
+        return -1;
+
+    fs = pa_frame_size(&c->sample_spec);
+    n = size / fs;
+    rest = size - n * fs;
+    le = c->sample_spec.format == PA_SAMPLE_S16LE;
+
+    if (n <= 0 || length < 1 + rest)
+        return -1;
+
+    memset(&r, 0, sizeof(r));
+    r.data = src + 1;
+    r.size = length - 1 - rest;
+
+    lossless_alloc(s, n);
+
+    for (ch = 0; ch < c->sample_spec.channels; ch++) {
+        unsigned header, order;
+        pa_bool_t side;
+        int32_t *x = s->samples, *t;
+
+        header = get_bits(&r, 8);
+        order = header & LOSSLESS_ORDER_MASK;
+        side = !!(header & LOSSLESS_SIDE);
+
+        if ((header & ~(LOSSLESS_ORDER_MASK|LOSSLESS_SIDE)) ||
+            (side && (ch != 1 || c->sample_spec.channels != 2)))
+            return -1;
+
+        for (i = 0; i < order && i < n; i++)
+            x[i] = unzigzag(get_bits(&r, LOSSLESS_WARMUP_BITS));
+
+        while (i < n) {
+            size_t m = PA_MIN(n - i, (size_t) LOSSLESS_PARTITION_FRAMES);
+            unsigned k = get_bits(&r, LOSSLESS_K_BITS);
+
+            if (k > LOSSLESS_K_MAX && k != LOSSLESS_K_ZERO)
+                return -1;
+
+            for (; m > 0; m--, i++) {
+                int64_t v = predict(x, i, order);
+
+                if (k != LOSSLESS_K_ZERO)
+                    v += unzigzag(get_rice(&r, k));
+
+                /* Corrupt data could make the prediction overflow */
+                if (v < -0x10000 || v > 0xFFFF)
+                    return -1;
+
+                x[i] = (int32_t) v;
+            }
+
+            if (r.error)
+                return -1;
+        }
+
+        if (r.error)
+            return -1;
+
+        for (i = 0; i < n; i++) {
+            int32_t v = side ? x[i] + s->previous[i] : x[i];
+
+            if (v < -0x8000 || v > 0x7FFF)
+                return -1;
+
+            x[i] = v;
+            write_sample(dst + i * fs + ch * 2, v, le);
+        }
+
+        t = s->previous;
+        s->previous = s->samples;
+        s->samples = t;
+    }
+
+    /* The bit stream is padded to whole bytes */
+    if (r.index != r.size)
+        return -1;
+
+    memcpy(dst + n * fs, src + length - rest, rest);
+
+    return 0;
+}
+
+static const struct codec_impl codec_table[] = {
+#ifdef HAVE_OPUS
+    {
+        .encoding = PA_ENCODING_OPUS,
+        .supported = opus_supported,
+        .init = opus_init,
+        .done = opus_done,
+        .max_encoded_size = opus_max_encoded_size,
+        .encode = opus_encode_frame,
+        .decode = opus_decode_frame,
+        .frame_decoded_size = opus_frame_decoded_size,
+    },
+#endif
+    {
+        .encoding = PA_ENCODING_PCM_LOSSLESS,
+        .supported = lossless_supported,
+        .init = lossless_init,
+        .done = lossless_done,
+        .max_encoded_size = lossless_max_encoded_size,
+        .encode = lossless_encode,
+        .decode = lossless_decode,
+    },
+    { .encoding = PA_ENCODING_INVALID }
+};
+
+static const struct codec_impl *find_impl(pa_encoding_t e) {
+    const struct codec_impl *impl;
+
+    for (impl = codec_table; impl->encoding != PA_ENCODING_INVALID; impl++)
+        if (impl->encoding == e)
+            return impl;
+
+    return NULL;
+}
+
+pa_bool_t pa_codec_supported(pa_encoding_t e, const pa_sample_spec *ss) {
+    const struct codec_impl *impl;
+
+    pa_assert(ss);
+
+    if (!pa_sample_spec_valid(ss))
+        return FALSE;
+
+    if (!(impl = find_impl(e)))
+        return FALSE;
+
+    return impl->supported(ss);
+}
+
+static pa_codec *codec_new(pa_encoding_t e, const pa_sample_spec *ss, pa_bool_t encoder, unsigned quality) {
+    pa_codec *c;
+    char t[PA_SAMPLE_SPEC_SNPRINT_MAX];
+
+    pa_assert(ss);
+
+    if (!pa_codec_supported(e, ss)) {
+        pa_log_debug("No codec for encoding %i and %s.", (int) e, pa_sample_spec_snprint(t, sizeof(t), ss));
+        return NULL;
+    }
+
+    c = pa_xnew0(pa_codec, 1);
+    c->impl = find_impl(e);
+    c->sample_spec = *ss;
+    c->encoder = encoder;
+    c->quality = PA_MIN(quality, PA_CODEC_QUALITY_MAX);
+
+    if (c->impl->init(c) < 0) {
+        pa_codec_free(c);
+        return NULL;
+    }
+
+    if (c->frame_size > 0)
+        c->frame = pa_xmalloc(c->frame_size);
+
+    return c;
+}
+
+pa_codec* pa_codec_new_encoder(pa_encoding_t e, const pa_sample_spec *ss, unsigned quality) {
+    return codec_new(e, ss, TRUE, quality);
+}
+
+pa_codec* pa_codec_new_decoder(pa_encoding_t e, const pa_sample_spec *ss) {
+    return codec_new(e, ss, FALSE, 0);
+}
+
+void pa_codec_free(pa_codec *c) {
+    pa_assert(c);
+
+    c->impl->done(c);
+
+    pa_xfree(c->frame);
+    pa_xfree(c);
+}
+
+pa_encoding_t pa_codec_get_encoding(pa_codec *c) {
+    pa_assert(c);
+
+    return c->impl->encoding;
+}
+
+size_t pa_codec_max_encoded_size(pa_codec *c, size_t length) {
+    pa_assert(c);
+    pa_assert(c->encoder);
+
+    if (c->frame_size == 0)
+        return BLOCK_HEADER_SIZE + c->impl->max_encoded_size(c, length);
+
+    /* Rounded up, so that this is enough for pa_codec_flush() too */
+    return BLOCK_HEADER_SIZE +
+        ((c->frame_index + length + c->frame_size - 1) / c->frame_size) * (FRAME_HEADER_SIZE + c->impl->max_encoded_size(c, c->frame_size));
+}
+
+static void write_u32(uint8_t *d, uint32_t v) {
+    d[0] = (uint8_t) (v >> 24);
+    d[1] = (uint8_t) (v >> 16);
+    d[2] = (uint8_t) (v >> 8);
+    d[3] = (uint8_t) v;
+}
+
+static uint32_t read_u32(const uint8_t *d) {
+    return ((uint32_t) d[0] << 24) | ((uint32_t) d[1] << 16) | ((uint32_t) d[2] << 8) | (uint32_t) d[3];
+}
+
+/* Encodes as many whole frames as there are, keeping the rest */
+static size_t encode_frames(pa_codec *c, const uint8_t *src, size_t length, uint8_t *dst, size_t size) {
+    size_t n_frames, pcm, index;
+
+    n_frames = (c->frame_index + length) / c->frame_size;
+
+    if (n_frames == 0) {
+        memcpy(c->frame + c->frame_index, src, length);
+        c->frame_index += length;
+        return 0;
+    }
+
+    pcm = n_frames * c->frame_size;
+    write_u32(dst, (uint32_t) pcm);
+    index = BLOCK_HEADER_SIZE;
+
+    for (; n_frames > 0; n_frames--) {
+        size_t l, n;
+
+        /* Copied even if it could be encoded in place, since the
+         * codecs want their samples aligned */
+        l = c->frame_size - c->frame_index;
+        memcpy(c->frame + c->frame_index, src, l);
+        src += l;
+        length -= l;
+        c->frame_index = 0;
+
+        if (size < index + FRAME_HEADER_SIZE)
+            return (size_t) -1;
+
+        if ((n = c->impl->encode(c, c->frame, c->frame_size, dst + index + FRAME_HEADER_SIZE, size - index - FRAME_HEADER_SIZE)) == (size_t) -1)
+            return (size_t) -1;
+
+        pa_assert(n <= 0xFFFF);
+        dst[index] = (uint8_t) (n >> 8);
+        dst[index + 1] = (uint8_t) n;
+        index += FRAME_HEADER_SIZE + n;
+    }
+
+    memcpy(c->frame, src, length);
+    c->frame_index = length;
+
+    c->pcm_bytes += pcm;
+    c->encoded_bytes += index;
+
+    return index;
+}
+
+size_t pa_codec_encode(pa_codec *c, const void *src, size_t length, void *dst, size_t size) {
+    size_t n;
+
+    pa_assert(c);
+    pa_assert(c->encoder);
+    pa_assert(src);
+    pa_assert(dst);
+
+    pa_assert(length <= BLOCK_PCM_MAX);
+
+    if (length <= 0)
+        return 0;
+
+    if (c->frame_size > 0)
+        return encode_frames(c, src, length, dst, size);
+
+    if (size < BLOCK_HEADER_SIZE)
+        return (size_t) -1;
+
+    write_u32(dst, (uint32_t) length);
+
+    if ((n = c->impl->encode(c, src, length, (uint8_t*) dst + BLOCK_HEADER_SIZE, size - BLOCK_HEADER_SIZE)) == (size_t) -1)
+        return (size_t) -1;
+
+    c->pcm_bytes += length;
+    c->encoded_bytes += BLOCK_HEADER_SIZE + n;
+
+    return BLOCK_HEADER_SIZE + n;
+}
+
+size_t pa_codec_flush(pa_codec *c, void *dst, size_t size) {
+    uint8_t *d = dst;
+    size_t n;
+
+    pa_assert(c);
+    pa_assert(c->encoder);
+    pa_assert(dst);
+
+    if (c->frame_size == 0 || c->frame_index == 0)
+        return 0;
+
+    if (size < BLOCK_HEADER_SIZE + FRAME_HEADER_SIZE)
+        return (size_t) -1;
+
+    /* Zero bits are silence for all the formats we encode */
+    memset(c->frame + c->frame_index, 0, c->frame_size - c->frame_index);
+
+    if ((n = c->impl->encode(c, c->frame, c->frame_size, d + BLOCK_HEADER_SIZE + FRAME_HEADER_SIZE, size - BLOCK_HEADER_SIZE - FRAME_HEADER_SIZE)) == (size_t) -1)
+        return (size_t) -1;
+
+    /* The block says how much PCM actually went in, so that the
+     * padding never shows up on the other end */
+    write_u32(d, (uint32_t) c->frame_index);
+
+    pa_assert(n <= 0xFFFF);
+    d[BLOCK_HEADER_SIZE] = (uint8_t) (n >> 8);
+    d[BLOCK_HEADER_SIZE + 1] = (uint8_t) n;
+    n += BLOCK_HEADER_SIZE + FRAME_HEADER_SIZE;
+
+    c->pcm_bytes += c->frame_index;
+    c->encoded_bytes += n;
+    c->frame_index = 0;
+
+    return n;
+}
+
+size_t pa_codec_decoded_size(pa_codec *c, const void *src, size_t length) {
+    const uint8_t *s = src;
+    size_t pcm, index, n_frames = 0;
+
+    pa_assert(c);
+    pa_assert(!c->encoder);
+    pa_assert(src);
+
+    if (length < BLOCK_HEADER_SIZE)
+        return 0;
+
+    pcm = read_u32(s);
+
+    if (c->frame_size == 0)
+        return pcm <= BLOCK_PCM_MAX ? pcm : 0;
+
+    /* No frame decodes to more than the frame size, so the frames
+     * that are actually there have to account for all of it */
+    for (index = BLOCK_HEADER_SIZE; index < length; n_frames++) {
+        size_t n;
+
+        if (n_frames >= BLOCK_PCM_MAX / c->frame_size + 1)
+            return 0;
+
+        if (length < index + FRAME_HEADER_SIZE)
+            return 0;
+
+        n = ((size_t) s[index] << 8) | (size_t) s[index + 1];
+        index += FRAME_HEADER_SIZE + n;
+
+        if (n <= 0 || length < index)
+            return 0;
+    }
+
+    if (n_frames != (pcm + c->frame_size - 1) / c->frame_size)
+        return 0;
+
+    return pcm;
+}
+
+int pa_codec_decode(pa_codec *c, const void *src, size_t length, void *dst, size_t size) {
+    const uint8_t *s = src;
+    uint8_t *d = dst;
+    size_t index;
+
+    pa_assert(c);
+    pa_assert(!c->encoder);
+    pa_assert(src);
+    pa_assert(dst);
+    pa_assert(size > 0);
+    pa_assert(size == pa_codec_decoded_size(c, src, length));
+
+    index = BLOCK_HEADER_SIZE;
+
+    if (c->frame_size == 0) {
+        if (c->impl->decode(c, s + index, length - index, d, size) < 0)
+            return -1;
+
+    } else {
+        size_t k;
+
+        for (k = 0; k < size; k += c->frame_size) {
+            size_t n, l;
+
+            if (length < index + FRAME_HEADER_SIZE)
+                return -1;
+
+            n = ((size_t) s[index] << 8) | (size_t) s[index + 1];
+            index += FRAME_HEADER_SIZE;
+
+            if (n <= 0 || length < index + n)
+                return -1;
+
+            l = PA_MIN(size - k, c->frame_size);
+
+            if (l < c->frame_size) {
+                if (c->impl->decode(c, s + index, n, c->frame, c->frame_size) < 0)
+                    return -1;
+
+                memcpy(d + k, c->frame, l);
+
+            } else if (c->impl->decode(c, s + index, n, d + k, c->frame_size) < 0)
+                return -1;
+
+            index += n;
+        }
+
+        if (index != length)
+            return -1;
+    }
+
+    c->pcm_bytes += size;
+    c->encoded_bytes += length;
+
+    return 0;
+}
+
+size_t pa_codec_get_frame_size(pa_codec *c) {
+    pa_assert(c);
+
+    return c->frame_size;
+}
+
+size_t pa_codec_encode_frame(pa_codec *c, const void *src, void *dst, size_t size) {
+    size_t n;
+
+    pa_assert(c);
+    pa_assert(c->encoder);
+    pa_assert(c->frame_size > 0);
+    pa_assert(c->frame_index == 0);
+    pa_assert(src);
+    pa_assert(dst);
+
+    /* Copied for the same reason as in encode_frames() */
+    memcpy(c->frame, src, c->frame_size);
+
+    if ((n = c->impl->encode(c, c->frame, c->frame_size, dst, size)) == (size_t) -1)
+        return (size_t) -1;
+
+    c->pcm_bytes += c->frame_size;
+    c->encoded_bytes += n;
+
+    return n;
+}
+
+size_t pa_codec_frame_decoded_size(pa_codec *c, const void *src, size_t length) {
+    pa_assert(c);
+    pa_assert(!c->encoder);
+    pa_assert(c->frame_size > 0);
+    pa_assert(src);
+
+    if (length <= 0)
+        return 0;
+
+    if (c->impl->frame_decoded_size)
+        return c->impl->frame_decoded_size(c, src, length);
+
+    return c->frame_size;
+}
+
+int pa_codec_decode_frame(pa_codec *c, const void *src, size_t length, void *dst, size_t size) {
+    pa_assert(c);
+    pa_assert(!c->encoder);
+    pa_assert(src);
+    pa_assert(dst);
+    pa_assert(size > 0);
+    pa_assert(size == pa_codec_frame_decoded_size(c, src, length));
+
+    if (c->impl->decode(c, src, length, dst, size) < 0)
+        return -1;
+
+    c->pcm_bytes += size;
+    c->encoded_bytes += length;
+
+    return 0;
+}
+
+void pa_codec_get_stats(pa_codec *c, uint64_t *pcm_bytes, uint64_t *encoded_bytes) {
+    pa_assert(c);
+
+    if (pcm_bytes)
+        *pcm_bytes = c->pcm_bytes;
+
+    if (encoded_bytes)
+        *encoded_bytes = c->encoded_bytes;
+}
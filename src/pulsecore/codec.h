@@ -0,0 +1,105 @@
+#ifndef foocodechfoo
+#define foocodechfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <inttypes.h>
+#include <sys/types.h>
+
+#include <pulse/sample.h>
+#include <pulse/format.h>
+
+#include <pulsecore/macro.h>
+
+/* Compresses the PCM of a single stream on its way over the network,
+ * see pa_pstream_set_encoder(). The encoder turns PCM into blocks that
+ * each say how much PCM they decode to. Codecs that work on frames of
+ * a fixed size keep what doesn't fill a whole frame for the next
+ * block, so a block might decode to less or more than went into it,
+ * but nothing is lost or added over the whole stream. */
+
+typedef struct pa_codec pa_codec;
+
+#define PA_CODEC_QUALITY_MIN 0U
+#define PA_CODEC_QUALITY_MAX 10U
+#define PA_CODEC_QUALITY_DEFAULT 5U
+
+/* Format property carrying the quality the peer shall encode with
+ * when offering a codec */
+#define PA_CODEC_PROP_QUALITY "codec.quality"
+
+/* Whether the encoding can be used as a codec for PCM in that sample
+ * spec */
+pa_bool_t pa_codec_supported(pa_encoding_t e, const pa_sample_spec *ss);
+
+/* The quality trades bandwidth for CPU time and, for lossy codecs,
+ * fidelity. It ranges from PA_CODEC_QUALITY_MIN to _MAX. */
+pa_codec* pa_codec_new_encoder(pa_encoding_t e, const pa_sample_spec *ss, unsigned quality);
+pa_codec* pa_codec_new_decoder(pa_encoding_t e, const pa_sample_spec *ss);
+void pa_codec_free(pa_codec *c);
+
+pa_encoding_t pa_codec_get_encoding(pa_codec *c);
+
+/* Room pa_codec_encode() needs for length bytes of PCM */
+size_t pa_codec_max_encoded_size(pa_codec *c, size_t length);
+
+/* length may be up to 64 KiB, the largest memblock. Returns the size
+ * of the block written to dst, 0 if the data was kept back for the
+ * next block, or (size_t) -1 on failure. */
+size_t pa_codec_encode(pa_codec *c, const void *src, size_t length, void *dst, size_t size);
+
+/* Encodes what pa_codec_encode() kept back, padded to a whole frame,
+ * into a block of its own, e.g. before the stream is drained or data
+ * is written out of sequence. dst needs pa_codec_max_encoded_size(c,
+ * 0) bytes. Returns the size of the block, 0 if nothing was kept back,
+ * or (size_t) -1 on failure. */
+size_t pa_codec_flush(pa_codec *c, void *dst, size_t size);
+
+/* How much PCM the block in src decodes to, or 0 if it is invalid */
+size_t pa_codec_decoded_size(pa_codec *c, const void *src, size_t length);
+
+/* size has to be what pa_codec_decoded_size() returned. Returns a
+ * negative value if the block is corrupt. */
+int pa_codec_decode(pa_codec *c, const void *src, size_t length, void *dst, size_t size);
+
+/* How much PCM a frame holds for codecs that work on frames of a
+ * fixed size, 0 for the others */
+size_t pa_codec_get_frame_size(pa_codec *c);
+
+/* Like pa_codec_encode() and pa_codec_decode(), but for transports
+ * like RTP that carry one frame per packet and do their own framing.
+ * Only for codecs with fixed frames, and pa_codec_encode() must not
+ * have been used on the same encoder. src has to hold exactly one
+ * frame of PCM. Returns the size of the packet written to dst, or
+ * (size_t) -1 on failure. */
+size_t pa_codec_encode_frame(pa_codec *c, const void *src, void *dst, size_t size);
+
+/* How much PCM the packet in src decodes to, which for some codecs
+ * isn't the frame size we encode with, or 0 if it is invalid */
+size_t pa_codec_frame_decoded_size(pa_codec *c, const void *src, size_t length);
+
+/* size has to be what pa_codec_frame_decoded_size() returned */
+int pa_codec_decode_frame(pa_codec *c, const void *src, size_t length, void *dst, size_t size);
+
+/* How much PCM went through the codec so far, and how much encoded
+ * data it came out as or was made from */
+void pa_codec_get_stats(pa_codec *c, uint64_t *pcm_bytes, uint64_t *encoded_bytes);
+
+#endif
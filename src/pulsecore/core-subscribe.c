@@ -29,6 +29,7 @@
 
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/idxset.h>
 
 #include "core-subscribe.h"
 
@@ -37,13 +38,25 @@
  * register a callback function that is called whenever an event
  * matching a subscription mask happens. The execution of the callback
  * function is postponed to the next main loop iteration, i.e. is not
- * called from within the stack frame the entity was created in. */
+ * called from within the stack frame the entity was created in.
+ *
+ * Every event that is posted also bumps a generation counter of the
+ * core, and the generation of the last event is remembered for each
+ * object. That way clients which were disconnected from the events
+ * for a while, or which just want to check whether their copy of the
+ * server state is still current, can ask which objects changed since
+ * a given generation instead of querying everything again. */
+
+/* How many removed objects we remember before we forget them all and
+ * move the horizon of the history forward */
+#define REMOVED_MAX 256
 
 struct pa_subscription {
     pa_core *core;
     pa_bool_t dead;
 
     pa_subscription_cb_t callback;
+    pa_subscription_delta_cb_t delta_callback;
     void *userdata;
     pa_subscription_mask_t mask;
 
@@ -55,24 +68,32 @@ struct pa_subscription_event {
 
     pa_subscription_event_type_t type;
     uint32_t index;
+    pa_subscription_change_flags_t changes;
+    uint64_t generation;
 
     PA_LLIST_FIELDS(pa_subscription_event);
 };
 
+struct generation_entry {
+    pa_subscription_event_type_t facility;
+    uint32_t index;
+    uint64_t generation;
+    pa_bool_t removed;
+};
+
 static void sched_event(pa_core *c);
 
-/* Allocate a new subscription object for the given subscription mask. Use the specified callback function and user data */
-pa_subscription* pa_subscription_new(pa_core *c, pa_subscription_mask_t m, pa_subscription_cb_t callback, void *userdata) {
+static pa_subscription* subscription_new(pa_core *c, pa_subscription_mask_t m, pa_subscription_cb_t callback, pa_subscription_delta_cb_t delta_callback, void *userdata) {
     pa_subscription *s;
 
     pa_assert(c);
     pa_assert(m);
-    pa_assert(callback);
 
     s = pa_xnew(pa_subscription, 1);
     s->core = c;
     s->dead = FALSE;
     s->callback = callback;
+    s->delta_callback = delta_callback;
     s->userdata = userdata;
     s->mask = m;
 
@@ -80,6 +101,20 @@ pa_subscription* pa_subscription_new(pa_core *c, pa_subscription_mask_t m, pa_su
     return s;
 }
 
+/* Allocate a new subscription object for the given subscription mask. Use the specified callback function and user data */
+pa_subscription* pa_subscription_new(pa_core *c, pa_subscription_mask_t m, pa_subscription_cb_t callback, void *userdata) {
+    pa_assert(callback);
+
+    return subscription_new(c, m, callback, NULL, userdata);
+}
+
+/* Like pa_subscription_new(), but the callback is also told what changed and the generation of the event */
+pa_subscription* pa_subscription_new_delta(pa_core *c, pa_subscription_mask_t m, pa_subscription_delta_cb_t callback, void *userdata) {
+    pa_assert(callback);
+
+    return subscription_new(c, m, NULL, callback, userdata);
+}
+
 /* Free a subscription object, effectively marking it for deletion */
 void pa_subscription_free(pa_subscription*s) {
     pa_assert(s);
@@ -122,6 +157,11 @@ void pa_subscription_free_all(pa_core *c) {
         c->mainloop->defer_free(c->subscription_defer_event);
         c->subscription_defer_event = NULL;
     }
+
+    if (c->subscription_generations) {
+        pa_hashmap_free(c->subscription_generations, pa_xfree);
+        c->subscription_generations = NULL;
+    }
 }
 
 #ifdef DEBUG
@@ -170,7 +210,12 @@ static void defer_cb(pa_mainloop_api *m, pa_defer_event *de, void *userdata) {
 
         for (s = c->subscriptions; s; s = s->next) {
 
-            if (!s->dead && pa_subscription_match_flags(s->mask, e->type))
+            if (s->dead || !pa_subscription_match_flags(s->mask, e->type))
+                continue;
+
+            if (s->delta_callback)
+                s->delta_callback(c, e->type, e->index, e->changes, e->generation, s->userdata);
+            else
                 s->callback(c, e->type, e->index, s->userdata);
         }
 
@@ -203,11 +248,118 @@ static void sched_event(pa_core *c) {
     c->mainloop->defer_enable(c->subscription_defer_event, 1);
 }
 
+static unsigned generation_hash_func(const void *p) {
+    const struct generation_entry *e = p;
+
+    return e->index * 31U + (unsigned) e->facility;
+}
+
+static int generation_compare_func(const void *a, const void *b) {
+    const struct generation_entry *x = a, *y = b;
+
+    if (x->facility != y->facility)
+        return x->facility < y->facility ? -1 : 1;
+
+    return x->index < y->index ? -1 : (x->index > y->index ? 1 : 0);
+}
+
+/* Forget all removed objects. Asking for changes since before this
+ * point yields an incomplete answer from now on. */
+static void prune_removed(pa_core *c) {
+    struct generation_entry *e;
+    void *state;
+
+    PA_HASHMAP_FOREACH(e, c->subscription_generations, state)
+        if (e->removed)
+            pa_xfree(pa_hashmap_remove(c->subscription_generations, e));
+
+    c->n_subscription_removed = 0;
+    c->subscription_horizon = c->subscription_generation;
+}
+
+/* Records the current generation for the object an event is about */
+static void update_generation(pa_core *c, pa_subscription_event_type_t t, uint32_t idx) {
+    struct generation_entry k, *e;
+    pa_bool_t removed;
+
+    if (!c->subscription_generations)
+        c->subscription_generations = pa_hashmap_new(generation_hash_func, generation_compare_func);
+
+    k.facility = t & PA_SUBSCRIPTION_EVENT_FACILITY_MASK;
+    k.index = idx;
+    removed = (t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_REMOVE;
+
+    if (!(e = pa_hashmap_get(c->subscription_generations, &k))) {
+        e = pa_xnew(struct generation_entry, 1);
+        *e = k;
+        e->removed = FALSE;
+        pa_assert_se(pa_hashmap_put(c->subscription_generations, e, e) >= 0);
+    }
+
+    if (removed && !e->removed)
+        c->n_subscription_removed++;
+    else if (!removed && e->removed)
+        c->n_subscription_removed--;
+
+    e->removed = removed;
+    e->generation = c->subscription_generation;
+
+    if (c->n_subscription_removed > REMOVED_MAX)
+        prune_removed(c);
+}
+
+uint64_t pa_subscription_get_generation(pa_core *c) {
+    pa_assert(c);
+
+    return c->subscription_generation;
+}
+
+/* Returns FALSE if objects might have been removed after the given
+ * generation that we don't remember anymore */
+pa_bool_t pa_subscription_history_complete(pa_core *c, uint64_t since) {
+    pa_assert(c);
+
+    return since >= c->subscription_horizon;
+}
+
+/* Calls the callback for every object matching the mask whose last
+ * event came after the generation 'since', with either
+ * PA_SUBSCRIPTION_EVENT_CHANGE or PA_SUBSCRIPTION_EVENT_REMOVE as event
+ * type. */
+void pa_subscription_foreach_changed(pa_core *c, pa_subscription_mask_t m, uint64_t since, pa_subscription_generation_cb_t cb, void *userdata) {
+    struct generation_entry *e;
+    void *state;
+
+    pa_assert(c);
+    pa_assert(cb);
+
+    if (c->subscription_generations)
+        PA_HASHMAP_FOREACH(e, c->subscription_generations, state) {
+
+            if (e->generation <= since || !pa_subscription_match_flags(m, e->facility))
+                continue;
+
+            cb(c, e->facility | (e->removed ? PA_SUBSCRIPTION_EVENT_REMOVE : PA_SUBSCRIPTION_EVENT_CHANGE), e->index, e->generation, userdata);
+        }
+}
+
 /* Append a new subscription event to the subscription event queue and schedule a main loop event */
 void pa_subscription_post(pa_core *c, pa_subscription_event_type_t t, uint32_t idx) {
+    pa_subscription_post_change(c, t, idx, PA_SUBSCRIPTION_CHANGE_UNKNOWN);
+}
+
+/* Like pa_subscription_post(), but for the caller that knows which properties of the object changed */
+void pa_subscription_post_change(pa_core *c, pa_subscription_event_type_t t, uint32_t idx, pa_subscription_change_flags_t changes) {
     pa_subscription_event *e;
     pa_assert(c);
 
+    c->subscription_generation++;
+    update_generation(c, t, idx);
+
+    /* The changes are only known for "change" events */
+    if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) != PA_SUBSCRIPTION_EVENT_CHANGE)
+        changes = PA_SUBSCRIPTION_CHANGE_UNKNOWN;
+
     /* No need for queuing subscriptions of no one is listening */
     if (!c->subscriptions)
         return;
@@ -239,7 +391,17 @@ void pa_subscription_post(pa_core *c, pa_subscription_event_type_t t, uint32_t i
 
             if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_CHANGE) {
                 /* This object has changed. If a "new" or "change" event for
-                 * this object is still in the queue we can exit. */
+                 * this object is still in the queue we can exit, after
+                 * merging what changed into it. */
+
+                if ((i->type & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_CHANGE) {
+                    if (i->changes != PA_SUBSCRIPTION_CHANGE_UNKNOWN && changes != PA_SUBSCRIPTION_CHANGE_UNKNOWN)
+                        i->changes |= changes;
+                    else
+                        i->changes = PA_SUBSCRIPTION_CHANGE_UNKNOWN;
+                }
+
+                i->generation = c->subscription_generation;
 
                 pa_log_debug("Dropped redundant event due to change event.");
                 return;
@@ -251,6 +413,8 @@ void pa_subscription_post(pa_core *c, pa_subscription_event_type_t t, uint32_t i
     e->core = c;
     e->type = t;
     e->index = idx;
+    e->changes = changes;
+    e->generation = c->subscription_generation;
 
     PA_LLIST_INSERT_AFTER(pa_subscription_event, c->subscription_event_queue, c->subscription_event_last, e);
     c->subscription_event_last = e;
@@ -29,11 +29,19 @@ typedef struct pa_subscription_event pa_subscription_event;
 #include <pulsecore/native-common.h>
 
 typedef void (*pa_subscription_cb_t)(pa_core *c, pa_subscription_event_type_t t, uint32_t idx, void *userdata);
+typedef void (*pa_subscription_delta_cb_t)(pa_core *c, pa_subscription_event_type_t t, uint32_t idx, pa_subscription_change_flags_t changes, uint64_t generation, void *userdata);
+typedef void (*pa_subscription_generation_cb_t)(pa_core *c, pa_subscription_event_type_t t, uint32_t idx, uint64_t generation, void *userdata);
 
 pa_subscription* pa_subscription_new(pa_core *c, pa_subscription_mask_t m,  pa_subscription_cb_t cb, void *userdata);
+pa_subscription* pa_subscription_new_delta(pa_core *c, pa_subscription_mask_t m, pa_subscription_delta_cb_t cb, void *userdata);
 void pa_subscription_free(pa_subscription*s);
 void pa_subscription_free_all(pa_core *c);
 
 void pa_subscription_post(pa_core *c, pa_subscription_event_type_t t, uint32_t idx);
+void pa_subscription_post_change(pa_core *c, pa_subscription_event_type_t t, uint32_t idx, pa_subscription_change_flags_t changes);
+
+uint64_t pa_subscription_get_generation(pa_core *c);
+pa_bool_t pa_subscription_history_complete(pa_core *c, uint64_t since);
+void pa_subscription_foreach_changed(pa_core *c, pa_subscription_mask_t m, uint64_t since, pa_subscription_generation_cb_t cb, void *userdata);
 
 #endif
@@ -3339,6 +3339,25 @@ finish:
     return 0;
 }
 
+int pa_dup_cloexec(int fd) {
+    int r;
+
+#ifdef F_DUPFD_CLOEXEC
+    if ((r = fcntl(fd, F_DUPFD_CLOEXEC, 0)) >= 0)
+        return r;
+
+    if (errno != EINVAL)
+        return r;
+
+#endif
+
+    if ((r = dup(fd)) < 0)
+        return r;
+
+    pa_make_fd_cloexec(r);
+    return r;
+}
+
 int pa_accept_cloexec(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
     int fd;
 
@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <signal.h>
+#include <errno.h>
 
 #include <pulse/rtclock.h>
 #include <pulse/timeval.h>
@@ -35,11 +36,13 @@
 #include <pulsecore/module.h>
 #include <pulsecore/core-rtclock.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/core-error.h>
 #include <pulsecore/core-scache.h>
 #include <pulsecore/core-subscribe.h>
 #include <pulsecore/random.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/thread.h>
 
 #include "core.h"
 
@@ -123,6 +126,9 @@ pa_core* pa_core_new(pa_mainloop_api *m, pa_bool_t shared, size_t shm_size) {
     PA_LLIST_HEAD_INIT(pa_subscription, c->subscriptions);
     PA_LLIST_HEAD_INIT(pa_subscription_event, c->subscription_event_queue);
     c->subscription_event_last = NULL;
+    c->subscription_generation = c->subscription_horizon = 0;
+    c->subscription_generations = NULL;
+    c->n_subscription_removed = 0;
 
     c->mempool = pool;
     pa_silence_cache_init(&c->silence_cache);
@@ -292,3 +298,30 @@ void pa_core_rttime_restart(pa_core *c, pa_time_event *e, pa_usec_t usec) {
 
     c->mainloop->time_restart(e, pa_timeval_rtstore(&tv, usec, TRUE));
 }
+
+/* Called from IO context */
+void pa_core_set_io_thread_affinity(pa_core *c, const pa_cpu_set *cpus) {
+    char t[PA_CPU_SET_SNPRINT_MAX];
+
+    pa_assert(c);
+
+    if (!cpus || pa_cpu_set_is_empty(cpus))
+        cpus = &c->io_thread_affinity;
+
+    if (pa_cpu_set_is_empty(cpus)) {
+
+        /* Nothing configured. But if the main thread has been confined
+         * we inherited its mask and need to undo that. */
+        if (pa_cpu_set_is_empty(&c->main_thread_affinity))
+            return;
+
+        cpus = NULL;
+    }
+
+    if (pa_thread_set_affinity(pa_thread_self(), cpus) < 0) {
+        pa_log_warn("Failed to set CPU affinity of IO thread: %s", pa_cstrerror(errno));
+        return;
+    }
+
+    pa_log_info("IO thread runs on CPUs %s.", cpus ? pa_cpu_set_snprint(t, sizeof(t), cpus) : "(all)");
+}
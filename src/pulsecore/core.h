@@ -25,6 +25,7 @@
 #include <pulse/mainloop-api.h>
 #include <pulse/sample.h>
 #include <pulsecore/cpu.h>
+#include <pulsecore/cpu-set.h>
 
 typedef struct pa_core pa_core;
 
@@ -162,6 +163,11 @@ struct pa_core {
     PA_LLIST_HEAD(pa_subscription_event, subscription_event_queue);
     pa_subscription_event *subscription_event_last;
 
+    /* Change history of all objects, see pa_subscription_foreach_changed() */
+    uint64_t subscription_generation, subscription_horizon;
+    pa_hashmap *subscription_generations;
+    unsigned n_subscription_removed;
+
     pa_mempool *mempool;
     pa_silence_cache silence_cache;
 
@@ -182,6 +188,11 @@ struct pa_core {
     pa_resample_method_t resample_method;
     int realtime_priority;
 
+    /* CPUs IO threads are pinned to unless a device overrides it, and
+     * the CPUs the main thread was confined to. Empty if unset. */
+    pa_cpu_set io_thread_affinity;
+    pa_cpu_set main_thread_affinity;
+
     pa_server_type_t server_type;
     pa_cpu_info cpu_info;
 
@@ -210,4 +221,8 @@ void pa_core_maybe_vacuum(pa_core *c);
 pa_time_event* pa_core_rttime_new(pa_core *c, pa_usec_t usec, pa_time_event_cb_t cb, void *userdata);
 void pa_core_rttime_restart(pa_core *c, pa_time_event *e, pa_usec_t usec);
 
+/* Called from IO threads when they start up. Pins the calling thread
+ * to cpus, or to the configured default if cpus is NULL or empty. */
+void pa_core_set_io_thread_affinity(pa_core *c, const pa_cpu_set *cpus);
+
 #endif
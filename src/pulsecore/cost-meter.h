@@ -0,0 +1,73 @@
+#ifndef foopulsecorecostmeterhfoo
+#define foopulsecorecostmeterhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulse/sample.h>
+#include <pulse/timeval.h>
+
+#include <pulsecore/macro.h>
+
+/* Keeps track of how long some operation in an IO thread takes: an
+ * exponentially weighted moving average (with a weight of 1/16 for
+ * each new sample) and the maximum seen during the current and the
+ * previous window of PA_COST_METER_WINDOW_USEC. Updating it neither
+ * allocates nor locks, so it can be used from real-time threads; to
+ * read it from other threads copy it out under a pa_seqlock. */
+
+#define PA_COST_METER_WINDOW_USEC (5*PA_USEC_PER_SEC)
+
+typedef struct pa_cost_meter {
+    pa_usec_t avg16;        /* average, multiplied by 16 */
+    pa_usec_t max;          /* maximum in the current window */
+    pa_usec_t prev_max;     /* maximum in the previous window */
+    pa_usec_t window_start;
+} pa_cost_meter;
+
+static inline void pa_cost_meter_reset(pa_cost_meter *m) {
+    m->avg16 = m->max = m->prev_max = m->window_start = 0;
+}
+
+/* Account one run of the operation that took cost usec and finished
+ * at now */
+static inline void pa_cost_meter_add(pa_cost_meter *m, pa_usec_t now, pa_usec_t cost) {
+    if (now >= m->window_start + PA_COST_METER_WINDOW_USEC) {
+        /* If a whole window passed without any sample, the old
+         * maximum is stale as well */
+        m->prev_max = now >= m->window_start + 2*PA_COST_METER_WINDOW_USEC ? 0 : m->max;
+        m->max = 0;
+        m->window_start = now;
+    }
+
+    m->avg16 = m->avg16 - m->avg16/16 + cost;
+
+    if (cost > m->max)
+        m->max = cost;
+}
+
+static inline pa_usec_t pa_cost_meter_get_avg(const pa_cost_meter *m) {
+    return m->avg16 / 16;
+}
+
+static inline pa_usec_t pa_cost_meter_get_max(const pa_cost_meter *m) {
+    return PA_MAX(m->max, m->prev_max);
+}
+
+#endif
@@ -0,0 +1,151 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+
+#include "cpu-set.h"
+
+void pa_cpu_set_clear(pa_cpu_set *s) {
+    pa_assert(s);
+
+    pa_zero(*s);
+}
+
+void pa_cpu_set_add(pa_cpu_set *s, unsigned cpu) {
+    pa_assert(s);
+    pa_assert(cpu < PA_CPU_SET_MAX);
+
+    pa_bitset_set(s->bits, cpu, TRUE);
+}
+
+void pa_cpu_set_remove(pa_cpu_set *s, unsigned cpu) {
+    pa_assert(s);
+    pa_assert(cpu < PA_CPU_SET_MAX);
+
+    pa_bitset_set(s->bits, cpu, FALSE);
+}
+
+pa_bool_t pa_cpu_set_contains(const pa_cpu_set *s, unsigned cpu) {
+    pa_assert(s);
+
+    if (cpu >= PA_CPU_SET_MAX)
+        return FALSE;
+
+    return pa_bitset_get(s->bits, cpu);
+}
+
+pa_bool_t pa_cpu_set_is_empty(const pa_cpu_set *s) {
+    unsigned i;
+
+    pa_assert(s);
+
+    for (i = 0; i < PA_ELEMENTSOF(s->bits); i++)
+        if (s->bits[i])
+            return FALSE;
+
+    return TRUE;
+}
+
+int pa_cpu_set_parse(pa_cpu_set *s, const char *list) {
+    const char *state = NULL;
+    char *k;
+    pa_cpu_set set;
+
+    pa_assert(s);
+    pa_assert(list);
+
+    pa_cpu_set_clear(&set);
+
+    while ((k = pa_split(list, ",", &state))) {
+        char *dash, *first, *last;
+        uint32_t a, b;
+
+        first = pa_strip(k);
+
+        if (!*first) {
+            pa_xfree(k);
+            continue;
+        }
+
+        if ((dash = strchr(first, '-'))) {
+            *dash = 0;
+            last = pa_strip(dash + 1);
+            first = pa_strip(first);
+        } else
+            last = first;
+
+        if (pa_atou(first, &a) < 0 || pa_atou(last, &b) < 0 ||
+            a > b || b >= PA_CPU_SET_MAX) {
+            pa_xfree(k);
+            errno = EINVAL;
+            return -1;
+        }
+
+        for (; a <= b; a++)
+            pa_cpu_set_add(&set, a);
+
+        pa_xfree(k);
+    }
+
+    *s = set;
+    return 0;
+}
+
+char *pa_cpu_set_snprint(char *buf, size_t l, const pa_cpu_set *s) {
+    unsigned cpu;
+    char *e;
+
+    pa_assert(buf);
+    pa_assert(l > 0);
+    pa_assert(s);
+
+    *(e = buf) = 0;
+
+    for (cpu = 0; cpu < PA_CPU_SET_MAX && l > 1; cpu++) {
+        unsigned last;
+        size_t n;
+
+        if (!pa_cpu_set_contains(s, cpu))
+            continue;
+
+        for (last = cpu; last + 1 < PA_CPU_SET_MAX && pa_cpu_set_contains(s, last + 1); last++)
+            ;
+
+        if (last == cpu)
+            n = pa_snprintf(e, l, "%s%u", e == buf ? "" : ",", cpu);
+        else
+            n = pa_snprintf(e, l, "%s%u-%u", e == buf ? "" : ",", cpu, last);
+
+        e += n;
+        l -= n;
+        cpu = last;
+    }
+
+    return buf;
+}
@@ -0,0 +1,53 @@
+#ifndef foocpusethfoo
+#define foocpusethfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <sys/types.h>
+
+#include <pulsecore/macro.h>
+#include <pulsecore/bitset.h>
+
+/* A set of CPUs a thread may be scheduled on. An empty set means "not
+ * configured", i.e. the scheduler is free to pick any CPU. */
+
+#define PA_CPU_SET_MAX 256U
+
+typedef struct pa_cpu_set {
+    pa_bitset_t bits[PA_BITSET_ELEMENTS(PA_CPU_SET_MAX)];
+} pa_cpu_set;
+
+#define PA_CPU_SET_SNPRINT_MAX 1024
+
+void pa_cpu_set_clear(pa_cpu_set *s);
+void pa_cpu_set_add(pa_cpu_set *s, unsigned cpu);
+void pa_cpu_set_remove(pa_cpu_set *s, unsigned cpu);
+pa_bool_t pa_cpu_set_contains(const pa_cpu_set *s, unsigned cpu);
+pa_bool_t pa_cpu_set_is_empty(const pa_cpu_set *s);
+
+/* Parses a list like "0-3,6" (the format used by taskset and
+ * /sys/devices/system/cpu/isolated). An empty string results in an
+ * empty set. */
+int pa_cpu_set_parse(pa_cpu_set *s, const char *list);
+
+/* Prints the set in the same format pa_cpu_set_parse() accepts */
+char *pa_cpu_set_snprint(char *buf, size_t l, const pa_cpu_set *s);
+
+#endif
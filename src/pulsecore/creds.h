@@ -29,8 +29,10 @@
 #endif
 
 #include <pulsecore/socket.h>
+#include <pulsecore/macro.h>
 
 typedef struct pa_creds pa_creds;
+typedef struct pa_cmsg_ancil_data pa_cmsg_ancil_data;
 
 #if defined(SCM_CREDENTIALS)
 
@@ -41,6 +43,19 @@ struct pa_creds {
     uid_t uid;
 };
 
+/* Enough for the shared ring of a pa_srbchannel */
+#define PA_CMSG_ANCIL_DATA_MAX_FDS 3
+
+/* What can be passed along with data on a local socket */
+struct pa_cmsg_ancil_data {
+    pa_creds creds;
+    pa_bool_t creds_valid;
+    int nfd;
+    int fds[PA_CMSG_ANCIL_DATA_MAX_FDS];
+};
+
+void pa_cmsg_ancil_data_close_fds(pa_cmsg_ancil_data *ancil);
+
 #else
 #undef HAVE_CREDS
 #endif
@@ -0,0 +1,421 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-rtclock.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/idxset.h>
+#include <pulsecore/log.h>
+#include <pulsecore/queue.h>
+
+#include "discover-cache.h"
+
+typedef enum service_state {
+    SERVICE_RESOLVING,
+    SERVICE_QUEUED,
+    SERVICE_LOADED,
+    SERVICE_FAILED
+} service_state_t;
+
+struct service {
+    char *key;
+    service_state_t state;
+
+    /* On how many interfaces and protocols it is announced */
+    unsigned n_announced;
+
+    char *module_name, *args;
+    uint32_t module_index;
+
+    /* When a loaded module that is no longer announced is unloaded */
+    pa_usec_t expire;
+
+    /* After a failure, the service is resolved again on the first
+     * announcement from retry on. backoff is how long the wait was,
+     * and doubles with every failure. */
+    pa_usec_t retry, backoff;
+};
+
+struct pa_discover_cache {
+    pa_mainloop_api *mainloop;
+    pa_usec_t ttl, interval;
+    unsigned batch;
+
+    pa_discover_cache_load_cb_t load_cb;
+    pa_discover_cache_unload_cb_t unload_cb;
+    void *userdata;
+
+    pa_hashmap *services;
+
+    /* Keys of the services waiting to be loaded, in order */
+    pa_queue *load_queue;
+    pa_usec_t next_load;
+
+    pa_time_event *time_event;
+    pa_usec_t time_event_usec;
+};
+
+static void service_free(struct service *s) {
+    pa_assert(s);
+
+    pa_xfree(s->key);
+    pa_xfree(s->module_name);
+    pa_xfree(s->args);
+    pa_xfree(s);
+}
+
+static void remove_service(pa_discover_cache *c, struct service *s) {
+    pa_assert_se(pa_hashmap_remove(c->services, s->key) == s);
+    service_free(s);
+}
+
+static void update_timer(pa_discover_cache *c);
+
+/* Called when the last announcement of s is gone */
+static void service_unannounced(pa_discover_cache *c, struct service *s) {
+    pa_assert(s->n_announced == 0);
+
+    /* Nothing has been loaded for it, so there is nothing to keep */
+    if (s->state != SERVICE_LOADED) {
+        pa_log_debug("Forgetting service %s.", s->key);
+        remove_service(c, s);
+        return;
+    }
+
+    s->expire = pa_rtclock_now() + c->ttl;
+}
+
+/* Called when resolving s, or loading or keeping its module, failed */
+static void service_failed(pa_discover_cache *c, struct service *s) {
+    pa_usec_t backoff_max = PA_MAX(c->ttl, c->interval);
+
+    s->state = SERVICE_FAILED;
+    s->module_index = PA_INVALID_INDEX;
+
+    s->backoff = s->backoff > 0 ? PA_MIN(s->backoff * 2, backoff_max) : c->interval;
+    s->retry = pa_rtclock_now() + s->backoff;
+
+    pa_log_debug("Service %s failed, trying again when it is announced in %0.1f s or later.",
+                 s->key, (double) s->backoff / PA_USEC_PER_SEC);
+}
+
+static void load_next(pa_discover_cache *c) {
+    unsigned n = 0;
+    char *key;
+
+    while (n < c->batch && (key = pa_queue_pop(c->load_queue))) {
+        struct service *s;
+
+        /* The service may have been withdrawn, or queued more than
+         * once, since */
+        if (!(s = pa_hashmap_get(c->services, key)) || s->state != SERVICE_QUEUED) {
+            pa_xfree(key);
+            continue;
+        }
+
+        pa_xfree(key);
+
+        s->module_index = c->load_cb(c, s->module_name, s->args, c->userdata);
+
+        if (s->module_index == PA_INVALID_INDEX) {
+            pa_log_debug("Failed to load %s for service %s.", s->module_name, s->key);
+            service_failed(c, s);
+        } else {
+            s->state = SERVICE_LOADED;
+
+            if (s->n_announced == 0)
+                s->expire = pa_rtclock_now() + c->ttl;
+        }
+
+        n++;
+    }
+
+    if (n > 0)
+        c->next_load = pa_rtclock_now() + c->interval;
+}
+
+static void expire_services(pa_discover_cache *c, pa_usec_t now) {
+    struct service *s;
+    void *state = NULL;
+
+    while ((s = pa_hashmap_iterate(c->services, &state, NULL))) {
+
+        if (s->state != SERVICE_LOADED || s->n_announced > 0 || s->expire > now)
+            continue;
+
+        pa_log_debug("Service %s expired, unloading its module.", s->key);
+
+        c->unload_cb(c, s->module_index, c->userdata);
+        remove_service(c, s);
+
+        /* The iteration state doesn't survive the removal */
+        state = NULL;
+    }
+}
+
+static void timeout_cb(pa_mainloop_api *m, pa_time_event *e, const struct timeval *t, void *userdata) {
+    pa_discover_cache *c = userdata;
+
+    pa_assert(c);
+    pa_assert(c->time_event == e);
+
+    c->time_event_usec = 0;
+
+    if (!pa_queue_isempty(c->load_queue) && c->next_load <= pa_rtclock_now())
+        load_next(c);
+
+    expire_services(c, pa_rtclock_now());
+    update_timer(c);
+}
+
+/* Arms the timer for whatever is due next: the next batch of modules
+ * to load, or the first loaded service to expire */
+static void update_timer(pa_discover_cache *c) {
+    struct service *s;
+    void *state = NULL;
+    pa_usec_t next = 0;
+    struct timeval tv;
+
+    if (!pa_queue_isempty(c->load_queue))
+        next = PA_MAX(c->next_load, 1U);
+
+    PA_HASHMAP_FOREACH(s, c->services, state)
+        if (s->state == SERVICE_LOADED && s->n_announced == 0)
+            if (next == 0 || s->expire < next)
+                next = s->expire;
+
+    if (next == c->time_event_usec)
+        return;
+
+    c->time_event_usec = next;
+
+    if (next == 0) {
+        c->mainloop->time_restart(c->time_event, NULL);
+        return;
+    }
+
+    c->mainloop->time_restart(c->time_event, pa_timeval_rtstore(&tv, next, TRUE));
+}
+
+pa_discover_cache* pa_discover_cache_new(
+        pa_mainloop_api *m,
+        pa_usec_t ttl,
+        pa_usec_t interval,
+        unsigned batch,
+        pa_discover_cache_load_cb_t load_cb,
+        pa_discover_cache_unload_cb_t unload_cb,
+        void *userdata) {
+
+    pa_discover_cache *c;
+
+    pa_assert(m);
+    pa_assert(batch > 0);
+    pa_assert(load_cb);
+    pa_assert(unload_cb);
+
+    c = pa_xnew0(pa_discover_cache, 1);
+    c->mainloop = m;
+    c->ttl = ttl;
+    c->interval = interval;
+    c->batch = batch;
+    c->load_cb = load_cb;
+    c->unload_cb = unload_cb;
+    c->userdata = userdata;
+
+    c->services = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+    c->load_queue = pa_queue_new();
+
+    c->time_event = m->time_new(m, NULL, timeout_cb, c);
+
+    return c;
+}
+
+void pa_discover_cache_free(pa_discover_cache *c) {
+    struct service *s;
+
+    pa_assert(c);
+
+    while ((s = pa_hashmap_steal_first(c->services))) {
+        if (s->state == SERVICE_LOADED)
+            c->unload_cb(c, s->module_index, c->userdata);
+
+        service_free(s);
+    }
+
+    pa_hashmap_free(c->services, NULL);
+    pa_queue_free(c->load_queue, pa_xfree);
+
+    c->mainloop->time_free(c->time_event);
+
+    pa_xfree(c);
+}
+
+pa_bool_t pa_discover_cache_announce(pa_discover_cache *c, const char *key) {
+    struct service *s;
+
+    pa_assert(c);
+    pa_assert(key);
+
+    if ((s = pa_hashmap_get(c->services, key))) {
+
+        if (s->n_announced++ == 0 && s->state == SERVICE_LOADED) {
+            pa_log_debug("Service %s is back, keeping its module.", key);
+            update_timer(c);
+        }
+
+        if (s->state == SERVICE_FAILED && pa_rtclock_now() >= s->retry) {
+            pa_log_debug("Resolving service %s again.", key);
+            s->state = SERVICE_RESOLVING;
+            return TRUE;
+        }
+
+        return FALSE;
+    }
+
+    s = pa_xnew0(struct service, 1);
+    s->key = pa_xstrdup(key);
+    s->state = SERVICE_RESOLVING;
+    s->n_announced = 1;
+    s->module_index = PA_INVALID_INDEX;
+
+    pa_assert_se(pa_hashmap_put(c->services, s->key, s) == 0);
+
+    return TRUE;
+}
+
+void pa_discover_cache_withdraw(pa_discover_cache *c, const char *key) {
+    struct service *s;
+
+    pa_assert(c);
+    pa_assert(key);
+
+    if (!(s = pa_hashmap_get(c->services, key)) || s->n_announced == 0)
+        return;
+
+    if (--s->n_announced > 0)
+        return;
+
+    service_unannounced(c, s);
+    update_timer(c);
+}
+
+void pa_discover_cache_withdraw_all(pa_discover_cache *c) {
+    struct service *s;
+    void *state = NULL;
+
+    pa_assert(c);
+
+    while ((s = pa_hashmap_iterate(c->services, &state, NULL))) {
+
+        if (s->n_announced == 0)
+            continue;
+
+        s->n_announced = 0;
+
+        if (s->state != SERVICE_LOADED)
+            state = NULL;
+
+        service_unannounced(c, s);
+    }
+
+    update_timer(c);
+}
+
+void pa_discover_cache_resolved(pa_discover_cache *c, const char *key, const char *module_name, const char *args) {
+    struct service *s;
+
+    pa_assert(c);
+    pa_assert(key);
+    pa_assert(module_name);
+    pa_assert(args);
+
+    /* Withdrawn while we were resolving it */
+    if (!(s = pa_hashmap_get(c->services, key)) || s->state != SERVICE_RESOLVING)
+        return;
+
+    /* It may have been resolved before, and failed since */
+    pa_xfree(s->module_name);
+    pa_xfree(s->args);
+
+    s->module_name = pa_xstrdup(module_name);
+    s->args = pa_xstrdup(args);
+    s->state = SERVICE_QUEUED;
+
+    pa_queue_push(c->load_queue, pa_xstrdup(key));
+    update_timer(c);
+}
+
+void pa_discover_cache_failed(pa_discover_cache *c, const char *key) {
+    struct service *s;
+
+    pa_assert(c);
+    pa_assert(key);
+
+    if (!(s = pa_hashmap_get(c->services, key)) || s->state != SERVICE_RESOLVING)
+        return;
+
+    service_failed(c, s);
+}
+
+void pa_discover_cache_module_unloaded(pa_discover_cache *c, uint32_t module_index) {
+    struct service *s;
+    void *state = NULL;
+
+    pa_assert(c);
+
+    if (module_index == PA_INVALID_INDEX)
+        return;
+
+    PA_HASHMAP_FOREACH(s, c->services, state) {
+
+        if (s->state != SERVICE_LOADED || s->module_index != module_index)
+            continue;
+
+        pa_log_debug("Module of service %s went away.", s->key);
+
+        if (s->n_announced == 0)
+            remove_service(c, s);
+        else
+            service_failed(c, s);
+
+        update_timer(c);
+        return;
+    }
+}
+
+unsigned pa_discover_cache_n_loaded(pa_discover_cache *c) {
+    struct service *s;
+    void *state = NULL;
+    unsigned n = 0;
+
+    pa_assert(c);
+
+    PA_HASHMAP_FOREACH(s, c->services, state)
+        if (s->state == SERVICE_LOADED)
+            n++;
+
+    return n;
+}
@@ -0,0 +1,93 @@
+#ifndef foodiscovercachehfoo
+#define foodiscovercachehfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <inttypes.h>
+
+#include <pulse/def.h>
+#include <pulse/mainloop-api.h>
+#include <pulse/sample.h>
+
+#include <pulsecore/macro.h>
+
+/* Keeps track of the services a discovery module has seen, and of the
+ * modules loaded for them. A service is resolved only once, no matter
+ * on how many interfaces and protocols it is announced, and the
+ * modules are loaded a few at a time from the main loop instead of
+ * from the discovery callbacks. A module stays loaded for ttl after
+ * the last announcement of its service is withdrawn, so that services
+ * that come and go, or a restart of the discovery daemon, don't make
+ * us unload and load it again. Services are identified by a string
+ * key of the caller's choosing. Everything here is called from the
+ * main thread. */
+
+typedef struct pa_discover_cache pa_discover_cache;
+
+/* Loads the module for a service, returning its index or
+ * PA_INVALID_INDEX on failure */
+typedef uint32_t (*pa_discover_cache_load_cb_t)(pa_discover_cache *c, const char *module_name, const char *args, void *userdata);
+
+/* Unloads a module loaded by the load callback */
+typedef void (*pa_discover_cache_unload_cb_t)(pa_discover_cache *c, uint32_t module_index, void *userdata);
+
+/* At most batch modules are loaded every interval */
+pa_discover_cache* pa_discover_cache_new(
+        pa_mainloop_api *m,
+        pa_usec_t ttl,
+        pa_usec_t interval,
+        unsigned batch,
+        pa_discover_cache_load_cb_t load_cb,
+        pa_discover_cache_unload_cb_t unload_cb,
+        void *userdata);
+
+/* Unloads all modules that are still loaded */
+void pa_discover_cache_free(pa_discover_cache *c);
+
+/* A service was announced. Returns TRUE if it has to be resolved, and
+ * FALSE if it is known already. A service that failed is resolved
+ * again on an announcement once a backoff has passed, which starts at
+ * interval and doubles with every failure up to ttl. */
+pa_bool_t pa_discover_cache_announce(pa_discover_cache *c, const char *key);
+
+/* An announcement was withdrawn */
+void pa_discover_cache_withdraw(pa_discover_cache *c, const char *key);
+
+/* All announcements are gone at once, e.g. because the connection to
+ * the discovery daemon was lost */
+void pa_discover_cache_withdraw_all(pa_discover_cache *c);
+
+/* The service was resolved. Its module is loaded with one of the next
+ * batches. */
+void pa_discover_cache_resolved(pa_discover_cache *c, const char *key, const char *module_name, const char *args);
+
+/* The service could not be resolved. It is tried again on a later
+ * announcement, see pa_discover_cache_announce(), or from scratch
+ * once all of its announcements are withdrawn. */
+void pa_discover_cache_failed(pa_discover_cache *c, const char *key);
+
+/* A module went away behind our back, e.g. because it lost its
+ * connection. Its service is treated as if it had failed. */
+void pa_discover_cache_module_unloaded(pa_discover_cache *c, uint32_t module_index);
+
+/* The number of modules currently loaded */
+unsigned pa_discover_cache_n_loaded(pa_discover_cache *c);
+
+#endif
@@ -76,6 +76,9 @@ static void delete_events(pa_iochannel *io) {
 static void enable_events(pa_iochannel *io) {
     pa_assert(io);
 
+    if (!io->mainloop)
+        return;
+
     if (io->hungup) {
         delete_events(io);
         return;
@@ -242,6 +245,68 @@ ssize_t pa_iochannel_write(pa_iochannel*io, const void*data, size_t l) {
     return r;
 }
 
+ssize_t pa_iochannel_writev(pa_iochannel*io, const struct iovec *iov, int iovcnt) {
+#ifdef HAVE_SYS_UIO_H
+    ssize_t r;
+    size_t l = 0;
+    int k;
+
+    pa_assert(io);
+    pa_assert(iov);
+    pa_assert(iovcnt > 0);
+    pa_assert(io->ofd >= 0);
+
+    for (k = 0; k < iovcnt; k++)
+        l += iov[k].iov_len;
+
+    pa_assert(l);
+
+    for (;;) {
+        if (io->ofd_type == 0) {
+            struct msghdr mh;
+
+            /* Like pa_write() we use sendmsg() for sockets, to be able
+             * to pass MSG_NOSIGNAL */
+            pa_zero(mh);
+            mh.msg_iov = (struct iovec*) iov;
+            mh.msg_iovlen = (size_t) iovcnt;
+
+            if ((r = sendmsg(io->ofd, &mh, MSG_NOSIGNAL)) < 0 && errno == ENOTSOCK) {
+                io->ofd_type = 1;
+                continue;
+            }
+        } else
+            r = writev(io->ofd, iov, iovcnt);
+
+        if (r < 0 && errno == EINTR)
+            continue;
+
+        break;
+    }
+
+    if ((size_t) r == l)
+        return r; /* Fast path - we almost always successfully write everything */
+
+    if (r < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            r = 0;
+        else
+            return r;
+    }
+
+    /* Partial write - let's get a notification when we can write more */
+    io->writable = io->hungup = FALSE;
+    enable_events(io);
+
+    return r;
+#else
+    pa_assert(iov);
+    pa_assert(iovcnt > 0);
+
+    return pa_iochannel_write(io, iov[0].iov_base, iov[0].iov_len);
+#endif
+}
+
 ssize_t pa_iochannel_read(pa_iochannel*io, void*data, size_t l) {
     ssize_t r;
 
@@ -300,45 +365,79 @@ int pa_iochannel_creds_enable(pa_iochannel *io) {
 }
 
 ssize_t pa_iochannel_write_with_creds(pa_iochannel*io, const void*data, size_t l, const pa_creds *ucred) {
+    struct iovec iov;
+
+    pa_assert(data);
+    pa_assert(l);
+
+    iov.iov_base = (void*) data;
+    iov.iov_len = l;
+
+    return pa_iochannel_writev_with_creds(io, &iov, 1, ucred);
+}
+
+ssize_t pa_iochannel_writev_with_creds(pa_iochannel*io, const struct iovec *iov, int iovcnt, const pa_creds *ucred) {
+    pa_cmsg_ancil_data ancil;
+
+    pa_zero(ancil);
+
+    if (ucred) {
+        ancil.creds = *ucred;
+        ancil.creds_valid = TRUE;
+    }
+
+    return pa_iochannel_writev_with_ancil_data(io, iov, iovcnt, &ancil);
+}
+
+ssize_t pa_iochannel_writev_with_ancil_data(pa_iochannel*io, const struct iovec *iov, int iovcnt, const pa_cmsg_ancil_data *ancil) {
     ssize_t r;
     struct msghdr mh;
-    struct iovec iov;
     union {
         struct cmsghdr hdr;
-        uint8_t data[CMSG_SPACE(sizeof(struct ucred))];
+        uint8_t data[CMSG_SPACE(sizeof(struct ucred)) + CMSG_SPACE(sizeof(int) * PA_CMSG_ANCIL_DATA_MAX_FDS)];
     } cmsg;
+    struct cmsghdr *cmh;
     struct ucred *u;
 
     pa_assert(io);
-    pa_assert(data);
-    pa_assert(l);
+    pa_assert(iov);
+    pa_assert(iovcnt > 0);
     pa_assert(io->ofd >= 0);
-
-    pa_zero(iov);
-    iov.iov_base = (void*) data;
-    iov.iov_len = l;
+    pa_assert(ancil);
+    pa_assert(ancil->nfd >= 0 && ancil->nfd <= PA_CMSG_ANCIL_DATA_MAX_FDS);
 
     pa_zero(cmsg);
-    cmsg.hdr.cmsg_len = CMSG_LEN(sizeof(struct ucred));
-    cmsg.hdr.cmsg_level = SOL_SOCKET;
-    cmsg.hdr.cmsg_type = SCM_CREDENTIALS;
+    pa_zero(mh);
+    mh.msg_iov = (struct iovec*) iov;
+    mh.msg_iovlen = (size_t) iovcnt;
+    mh.msg_control = &cmsg;
+    mh.msg_controllen = CMSG_SPACE(sizeof(struct ucred)) + (ancil->nfd > 0 ? CMSG_SPACE(sizeof(int) * ancil->nfd) : 0);
 
-    u = (struct ucred*) CMSG_DATA(&cmsg.hdr);
+    /* Credentials are always sent, the real ones unless others were
+     * asked for */
+    cmh = CMSG_FIRSTHDR(&mh);
+    cmh->cmsg_len = CMSG_LEN(sizeof(struct ucred));
+    cmh->cmsg_level = SOL_SOCKET;
+    cmh->cmsg_type = SCM_CREDENTIALS;
+
+    u = (struct ucred*) CMSG_DATA(cmh);
 
     u->pid = getpid();
-    if (ucred) {
-        u->uid = ucred->uid;
-        u->gid = ucred->gid;
+    if (ancil->creds_valid) {
+        u->uid = ancil->creds.uid;
+        u->gid = ancil->creds.gid;
     } else {
         u->uid = getuid();
         u->gid = getgid();
     }
 
-    pa_zero(mh);
-    mh.msg_iov = &iov;
-    mh.msg_iovlen = 1;
-    mh.msg_control = &cmsg;
-    mh.msg_controllen = sizeof(cmsg);
+    if (ancil->nfd > 0) {
+        cmh = CMSG_NXTHDR(&mh, cmh);
+        cmh->cmsg_len = CMSG_LEN(sizeof(int) * ancil->nfd);
+        cmh->cmsg_level = SOL_SOCKET;
+        cmh->cmsg_type = SCM_RIGHTS;
+        memcpy(CMSG_DATA(cmh), ancil->fds, sizeof(int) * ancil->nfd);
+    }
 
     if ((r = sendmsg(io->ofd, &mh, MSG_NOSIGNAL)) >= 0) {
         io->writable = io->hungup = FALSE;
@@ -349,20 +448,36 @@ ssize_t pa_iochannel_write_with_creds(pa_iochannel*io, const void*data, size_t l
 }
 
 ssize_t pa_iochannel_read_with_creds(pa_iochannel*io, void*data, size_t l, pa_creds *creds, pa_bool_t *creds_valid) {
+    pa_cmsg_ancil_data ancil;
+    ssize_t r;
+
+    pa_assert(creds);
+    pa_assert(creds_valid);
+
+    if ((r = pa_iochannel_read_with_ancil_data(io, data, l, &ancil)) >= 0) {
+        pa_cmsg_ancil_data_close_fds(&ancil);
+
+        if ((*creds_valid = ancil.creds_valid))
+            *creds = ancil.creds;
+    }
+
+    return r;
+}
+
+ssize_t pa_iochannel_read_with_ancil_data(pa_iochannel*io, void*data, size_t l, pa_cmsg_ancil_data *ancil) {
     ssize_t r;
     struct msghdr mh;
     struct iovec iov;
     union {
         struct cmsghdr hdr;
-        uint8_t data[CMSG_SPACE(sizeof(struct ucred))];
+        uint8_t data[CMSG_SPACE(sizeof(struct ucred)) + CMSG_SPACE(sizeof(int) * PA_CMSG_ANCIL_DATA_MAX_FDS)];
     } cmsg;
 
     pa_assert(io);
     pa_assert(data);
     pa_assert(l);
     pa_assert(io->ifd >= 0);
-    pa_assert(creds);
-    pa_assert(creds_valid);
+    pa_assert(ancil);
 
     pa_zero(iov);
     iov.iov_base = data;
@@ -375,25 +490,48 @@ ssize_t pa_iochannel_read_with_creds(pa_iochannel*io, void*data, size_t l, pa_cr
     mh.msg_control = &cmsg;
     mh.msg_controllen = sizeof(cmsg);
 
-    if ((r = recvmsg(io->ifd, &mh, 0)) >= 0) {
-        struct cmsghdr *cmh;
+    ancil->creds_valid = FALSE;
+    ancil->nfd = 0;
 
-        *creds_valid = FALSE;
+    if ((r = recvmsg(io->ifd, &mh, MSG_CMSG_CLOEXEC)) >= 0) {
+        struct cmsghdr *cmh;
 
         for (cmh = CMSG_FIRSTHDR(&mh); cmh; cmh = CMSG_NXTHDR(&mh, cmh)) {
 
-            if (cmh->cmsg_level == SOL_SOCKET && cmh->cmsg_type == SCM_CREDENTIALS) {
+            if (cmh->cmsg_level != SOL_SOCKET)
+                continue;
+
+            if (cmh->cmsg_type == SCM_CREDENTIALS) {
                 struct ucred u;
                 pa_assert(cmh->cmsg_len == CMSG_LEN(sizeof(struct ucred)));
                 memcpy(&u, CMSG_DATA(cmh), sizeof(struct ucred));
 
-                creds->gid = u.gid;
-                creds->uid = u.uid;
-                *creds_valid = TRUE;
-                break;
+                ancil->creds.gid = u.gid;
+                ancil->creds.uid = u.uid;
+                ancil->creds_valid = TRUE;
+
+            } else if (cmh->cmsg_type == SCM_RIGHTS) {
+                int n, i;
+
+                n = (int) ((cmh->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+
+                for (i = 0; i < n; i++) {
+                    int fd;
+
+                    memcpy(&fd, CMSG_DATA(cmh) + i * sizeof(int), sizeof(int));
+
+                    /* We can't do anything with more than that */
+                    if (ancil->nfd < PA_CMSG_ANCIL_DATA_MAX_FDS)
+                        ancil->fds[ancil->nfd++] = fd;
+                    else
+                        pa_close(fd);
+                }
             }
         }
 
+        if (mh.msg_flags & MSG_CTRUNC)
+            pa_log_warn("Control data of received message truncated.");
+
         io->readable = io->hungup = FALSE;
         enable_events(io);
     }
@@ -401,6 +539,17 @@ ssize_t pa_iochannel_read_with_creds(pa_iochannel*io, void*data, size_t l, pa_cr
     return r;
 }
 
+void pa_cmsg_ancil_data_close_fds(pa_cmsg_ancil_data *ancil) {
+    int i;
+
+    pa_assert(ancil);
+
+    for (i = 0; i < ancil->nfd; i++)
+        pa_close(ancil->fds[i]);
+
+    ancil->nfd = 0;
+}
+
 #endif /* HAVE_CREDS */
 
 void pa_iochannel_set_callback(pa_iochannel*io, pa_iochannel_cb_t _callback, void *userdata) {
@@ -442,6 +591,14 @@ pa_mainloop_api* pa_iochannel_get_mainloop_api(pa_iochannel *io) {
     return io->mainloop;
 }
 
+void pa_iochannel_set_mainloop_api(pa_iochannel *io, pa_mainloop_api *m) {
+    pa_assert(io);
+
+    delete_events(io);
+    io->mainloop = m;
+    enable_events(io);
+}
+
 int pa_iochannel_get_recv_fd(pa_iochannel *io) {
     pa_assert(io);
 
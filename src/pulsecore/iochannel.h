@@ -29,6 +29,15 @@
 
 #include <sys/types.h>
 
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#else
+struct iovec {
+    void *iov_base;
+    size_t iov_len;
+};
+#endif
+
 #include <pulse/mainloop-api.h>
 #include <pulsecore/creds.h>
 #include <pulsecore/macro.h>
@@ -53,12 +62,23 @@ void pa_iochannel_free(pa_iochannel*io);
 ssize_t pa_iochannel_write(pa_iochannel*io, const void*data, size_t l);
 ssize_t pa_iochannel_read(pa_iochannel*io, void*data, size_t l);
 
+/* Like pa_iochannel_write(), but gathers the data from several
+ * buffers, so that it can be sent in a single system call. On systems
+ * without writev() only the first buffer is written. */
+ssize_t pa_iochannel_writev(pa_iochannel*io, const struct iovec *iov, int iovcnt);
+
 #ifdef HAVE_CREDS
 pa_bool_t pa_iochannel_creds_supported(pa_iochannel *io);
 int pa_iochannel_creds_enable(pa_iochannel *io);
 
 ssize_t pa_iochannel_write_with_creds(pa_iochannel*io, const void*data, size_t l, const pa_creds *ucred);
+ssize_t pa_iochannel_writev_with_creds(pa_iochannel*io, const struct iovec *iov, int iovcnt, const pa_creds *ucred);
 ssize_t pa_iochannel_read_with_creds(pa_iochannel*io, void*data, size_t l, pa_creds *ucred, pa_bool_t *creds_valid);
+
+/* Like the above, but file descriptors are passed as well. Received
+ * ones have to be closed by the caller. */
+ssize_t pa_iochannel_writev_with_ancil_data(pa_iochannel*io, const struct iovec *iov, int iovcnt, const pa_cmsg_ancil_data *ancil);
+ssize_t pa_iochannel_read_with_ancil_data(pa_iochannel*io, void*data, size_t l, pa_cmsg_ancil_data *ancil);
 #endif
 
 pa_bool_t pa_iochannel_is_readable(pa_iochannel*io);
@@ -84,6 +104,13 @@ pa_bool_t pa_iochannel_socket_is_local(pa_iochannel *io);
 
 pa_mainloop_api* pa_iochannel_get_mainloop_api(pa_iochannel *io);
 
+/* Moves the events of the channel to another main loop. Since main
+ * loops are not thread-safe, handing the channel over to a different
+ * thread takes two steps: first pass NULL in the thread of the old
+ * main loop, then the new main loop in its own thread. The channel
+ * must not be used in between. */
+void pa_iochannel_set_mainloop_api(pa_iochannel *io, pa_mainloop_api *m);
+
 int pa_iochannel_get_recv_fd(pa_iochannel *io);
 int pa_iochannel_get_send_fd(pa_iochannel *io);
 
@@ -176,6 +176,13 @@ enum {
     /* Supported since protocol v27 (3.0) */
     PA_COMMAND_SET_PORT_LATENCY_OFFSET,
 
+    /* Supported since protocol v30 (5.0) */
+    /* SERVER->CLIENT */
+    PA_COMMAND_ENABLE_SRBCHANNEL,
+
+    /* Supported since protocol v31 (5.0) */
+    PA_COMMAND_GET_GENERATIONS,
+
     PA_COMMAND_MAX
 };
 
@@ -24,18 +24,31 @@
 #endif
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <pulse/xmalloc.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/flist.h>
 
 #include "packet.h"
 
+/* Packets up to this size come from a free list, with room for this
+ * much data appended */
+#define MAX_APPENDED_SIZE 128
+
+PA_STATIC_FLIST_DECLARE(packets, 0, pa_xfree);
+
 pa_packet* pa_packet_new(size_t length) {
     pa_packet *p;
 
     pa_assert(length > 0);
 
-    p = pa_xmalloc(PA_ALIGN(sizeof(pa_packet)) + length);
+    if (length <= MAX_APPENDED_SIZE) {
+        if (!(p = pa_flist_pop(PA_STATIC_FLIST_GET(packets))))
+            p = pa_xmalloc(PA_ALIGN(sizeof(pa_packet)) + MAX_APPENDED_SIZE);
+    } else
+        p = pa_xmalloc(PA_ALIGN(sizeof(pa_packet)) + length);
+
     PA_REFCNT_INIT(p);
     p->length = length;
     p->data = (uint8_t*) p + PA_ALIGN(sizeof(pa_packet));
@@ -44,6 +57,17 @@ pa_packet* pa_packet_new(size_t length) {
     return p;
 }
 
+pa_packet* pa_packet_new_data(const void* data, size_t length) {
+    pa_packet *p;
+
+    pa_assert(data);
+
+    p = pa_packet_new(length);
+    memcpy(p->data, data, length);
+
+    return p;
+}
+
 pa_packet* pa_packet_new_dynamic(void* data, size_t length) {
     pa_packet *p;
 
@@ -74,6 +98,10 @@ void pa_packet_unref(pa_packet *p) {
     if (PA_REFCNT_DEC(p) <= 0) {
         if (p->type == PA_PACKET_DYNAMIC)
             pa_xfree(p->data);
+        else if (p->length <= MAX_APPENDED_SIZE &&
+                 pa_flist_push(PA_STATIC_FLIST_GET(packets), p) >= 0)
+            return;
+
         pa_xfree(p);
     }
 }
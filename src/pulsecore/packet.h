@@ -34,9 +34,16 @@ typedef struct pa_packet {
     uint8_t *data;
 } pa_packet;
 
+/* Small packets are recycled, so creating one usually doesn't allocate
+ * anything */
 pa_packet* pa_packet_new(size_t length);
+
+/* Takes over data, which has to come from pa_xmalloc() */
 pa_packet* pa_packet_new_dynamic(void* data, size_t length);
 
+/* Copies data */
+pa_packet* pa_packet_new_data(const void* data, size_t length);
+
 pa_packet* pa_packet_ref(pa_packet *p);
 void pa_packet_unref(pa_packet *p);
 
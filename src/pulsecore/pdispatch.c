@@ -38,6 +38,8 @@
 #include <pulsecore/macro.h>
 #include <pulsecore/refcnt.h>
 #include <pulsecore/flist.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/idxset.h>
 #include <pulsecore/core-rtclock.h>
 
 #include "pdispatch.h"
@@ -190,12 +192,24 @@ static const char *command_names[PA_COMMAND_MAX] = {
     [PA_COMMAND_SET_SOURCE_OUTPUT_VOLUME] = "SET_SOURCE_OUTPUT_VOLUME",
     [PA_COMMAND_SET_SOURCE_OUTPUT_MUTE] = "SET_SOURCE_OUTPUT_MUTE",
 
+    /* Supported since protocol v30 (5.0) */
+    /* SERVER->CLIENT */
+    [PA_COMMAND_ENABLE_SRBCHANNEL] = "ENABLE_SRBCHANNEL",
+
+    /* Supported since protocol v31 (5.0) */
+    [PA_COMMAND_GET_GENERATIONS] = "GET_GENERATIONS",
+
 };
 
 #endif
 
 PA_STATIC_FLIST_DECLARE(reply_infos, 0, pa_xfree);
 
+/* Pending replies are looked up by their tag in a hashmap. They are
+ * also kept in a list sorted by their deadline, and a single time event
+ * is armed for the first of them. Since almost all replies are
+ * registered with the same timeout, new ones are usually appended. */
+
 struct reply_info {
     pa_pdispatch *pdispatch;
     PA_LLIST_FIELDS(struct reply_info);
@@ -203,7 +217,7 @@ struct reply_info {
     void *userdata;
     pa_free_cb_t free_cb;
     uint32_t tag;
-    pa_time_event *time_event;
+    pa_usec_t deadline;
 };
 
 struct pa_pdispatch {
@@ -212,26 +226,79 @@ struct pa_pdispatch {
     const pa_pdispatch_cb_t *callback_table;
     unsigned n_commands;
     PA_LLIST_HEAD(struct reply_info, replies);
+    struct reply_info *replies_tail;
+    pa_hashmap *replies_by_tag;
+    pa_time_event *time_event;
+    pa_usec_t time_event_deadline;
     pa_pdispatch_drain_cb_t drain_callback;
     void *drain_userdata;
-    const pa_creds *creds;
+    const pa_cmsg_ancil_data *ancil_data;
     pa_bool_t use_rtclock;
 };
 
 static void reply_info_free(struct reply_info *r) {
+    pa_pdispatch *pd;
+
     pa_assert(r);
-    pa_assert(r->pdispatch);
-    pa_assert(r->pdispatch->mainloop);
+    pa_assert_se(pd = r->pdispatch);
+
+    /* Another reply with the same tag might have taken over the slot */
+    if (pa_hashmap_get(pd->replies_by_tag, PA_UINT32_TO_PTR(r->tag)) == r)
+        pa_hashmap_remove(pd->replies_by_tag, PA_UINT32_TO_PTR(r->tag));
 
-    if (r->time_event)
-        r->pdispatch->mainloop->time_free(r->time_event);
+    if (pd->replies_tail == r)
+        pd->replies_tail = r->prev;
 
-    PA_LLIST_REMOVE(struct reply_info, r->pdispatch->replies, r);
+    PA_LLIST_REMOVE(struct reply_info, pd->replies, r);
+
+    /* The time event is left alone, it will just find nothing to do */
 
     if (pa_flist_push(PA_STATIC_FLIST_GET(reply_infos), r) < 0)
         pa_xfree(r);
 }
 
+static void arm_time_event(pa_pdispatch *pd, pa_usec_t deadline) {
+    struct timeval tv;
+
+    pa_assert(pd);
+    pa_assert(pd->time_event);
+
+    if (pd->time_event_deadline == deadline)
+        return;
+
+    pd->time_event_deadline = deadline;
+
+    if (deadline == PA_USEC_INVALID)
+        pd->mainloop->time_restart(pd->time_event, NULL);
+    else
+        pd->mainloop->time_restart(pd->time_event, pa_timeval_rtstore(&tv, deadline, pd->use_rtclock));
+}
+
+static void run_action(pa_pdispatch *pd, struct reply_info *r, uint32_t command, pa_tagstruct *ts);
+
+static void timeout_callback(pa_mainloop_api*m, pa_time_event*e, const struct timeval *t, void *userdata) {
+    pa_pdispatch *pd = userdata;
+    pa_usec_t now;
+
+    pa_assert(pd);
+    pa_assert(pd->time_event == e);
+    pa_assert(pd->mainloop == m);
+
+    pa_pdispatch_ref(pd);
+
+    pd->time_event_deadline = PA_USEC_INVALID;
+    now = pa_rtclock_now();
+
+    /* The callbacks may add and remove replies, so start over each time */
+    while (pd->replies && pd->replies->deadline <= now)
+        run_action(pd, pd->replies, PA_COMMAND_TIMEOUT, NULL);
+
+    if (pd->time_event)
+        arm_time_event(pd, pd->replies ? pd->replies->deadline : PA_USEC_INVALID);
+
+    pa_pdispatch_unref(pd);
+}
+
 pa_pdispatch* pa_pdispatch_new(pa_mainloop_api *mainloop, pa_bool_t use_rtclock, const pa_pdispatch_cb_t *table, unsigned entries) {
     pa_pdispatch *pd;
 
@@ -244,6 +311,10 @@ pa_pdispatch* pa_pdispatch_new(pa_mainloop_api *mainloop, pa_bool_t use_rtclock,
     pd->callback_table = table;
     pd->n_commands = entries;
     PA_LLIST_HEAD_INIT(struct reply_info, pd->replies);
+    pd->replies_tail = NULL;
+    pd->replies_by_tag = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+    pd->time_event = NULL;
+    pd->time_event_deadline = PA_USEC_INVALID;
     pd->use_rtclock = use_rtclock;
 
     return pd;
@@ -259,6 +330,11 @@ static void pdispatch_free(pa_pdispatch *pd) {
         reply_info_free(pd->replies);
     }
 
+    if (pd->time_event)
+        pd->mainloop->time_free(pd->time_event);
+
+    pa_hashmap_free(pd->replies_by_tag, NULL);
+
     pa_xfree(pd);
 }
 
@@ -284,7 +360,7 @@ static void run_action(pa_pdispatch *pd, struct reply_info *r, uint32_t command,
     pa_pdispatch_unref(pd);
 }
 
-int pa_pdispatch_run(pa_pdispatch *pd, pa_packet*packet, const pa_creds *creds, void *userdata) {
+int pa_pdispatch_run(pa_pdispatch *pd, pa_packet*packet, const pa_cmsg_ancil_data *ancil_data, void *userdata) {
     uint32_t tag, command;
     pa_tagstruct *ts = NULL;
     int ret = -1;
@@ -318,16 +394,12 @@ int pa_pdispatch_run(pa_pdispatch *pd, pa_packet*packet, const pa_creds *creds,
 }
 #endif
 
-    pd->creds = creds;
+    pd->ancil_data = ancil_data;
 
     if (command == PA_COMMAND_ERROR || command == PA_COMMAND_REPLY) {
         struct reply_info *r;
 
-        PA_LLIST_FOREACH(r, pd->replies)
-            if (r->tag == tag)
-                break;
-
-        if (r)
+        if ((r = pa_hashmap_get(pd->replies_by_tag, PA_UINT32_TO_PTR(tag))))
             run_action(pd, r, command, ts);
 
     } else if (pd->callback_table && (command < pd->n_commands) && pd->callback_table[command]) {
@@ -342,7 +414,7 @@ int pa_pdispatch_run(pa_pdispatch *pd, pa_packet*packet, const pa_creds *creds,
     ret = 0;
 
 finish:
-    pd->creds = NULL;
+    pd->ancil_data = NULL;
 
     if (ts)
         pa_tagstruct_free(ts);
@@ -352,21 +424,8 @@ finish:
     return ret;
 }
 
-static void timeout_callback(pa_mainloop_api*m, pa_time_event*e, const struct timeval *t, void *userdata) {
-    struct reply_info*r = userdata;
-
-    pa_assert(r);
-    pa_assert(r->time_event == e);
-    pa_assert(r->pdispatch);
-    pa_assert(r->pdispatch->mainloop == m);
-    pa_assert(r->callback);
-
-    run_action(r->pdispatch, r, PA_COMMAND_TIMEOUT, NULL);
-}
-
 void pa_pdispatch_register_reply(pa_pdispatch *pd, uint32_t tag, int timeout, pa_pdispatch_cb_t cb, void *userdata, pa_free_cb_t free_cb) {
-    struct reply_info *r;
-    struct timeval tv;
+    struct reply_info *r, *after, *old;
 
     pa_assert(pd);
     pa_assert(PA_REFCNT_VALUE(pd) >= 1);
@@ -380,12 +439,32 @@ void pa_pdispatch_register_reply(pa_pdispatch *pd, uint32_t tag, int timeout, pa
     r->userdata = userdata;
     r->free_cb = free_cb;
     r->tag = tag;
+    r->deadline = pa_rtclock_now() + timeout * PA_USEC_PER_SEC;
+
+    /* Like before, the reply registered last wins if a tag is reused */
+    if ((old = pa_hashmap_remove(pd->replies_by_tag, PA_UINT32_TO_PTR(tag))))
+        pa_log_debug("Reply tag %u registered twice.", tag);
+    pa_assert_se(pa_hashmap_put(pd->replies_by_tag, PA_UINT32_TO_PTR(tag), r) >= 0);
 
-    pa_assert_se(r->time_event = pd->mainloop->time_new(pd->mainloop,
-                                                        pa_timeval_rtstore(&tv, pa_rtclock_now() + timeout * PA_USEC_PER_SEC, pd->use_rtclock),
-                                                        timeout_callback, r));
+    /* Keep the list sorted by deadline, searching from the end */
+    for (after = pd->replies_tail; after && after->deadline > r->deadline; after = after->prev)
+        ;
 
-    PA_LLIST_PREPEND(struct reply_info, pd->replies, r);
+    if (after) {
+        PA_LLIST_INSERT_AFTER(struct reply_info, pd->replies, after, r);
+        if (pd->replies_tail == after)
+            pd->replies_tail = r;
+    } else {
+        PA_LLIST_PREPEND(struct reply_info, pd->replies, r);
+        if (!pd->replies_tail)
+            pd->replies_tail = r;
+    }
+
+    if (!pd->time_event)
+        pa_assert_se(pd->time_event = pd->mainloop->time_new(pd->mainloop, NULL, timeout_callback, pd));
+
+    if (pd->time_event_deadline == PA_USEC_INVALID || pd->replies->deadline < pd->time_event_deadline)
+        arm_time_event(pd, pd->replies->deadline);
 }
 
 int pa_pdispatch_is_pending(pa_pdispatch *pd) {
@@ -435,5 +514,26 @@ const pa_creds * pa_pdispatch_creds(pa_pdispatch *pd) {
     pa_assert(pd);
     pa_assert(PA_REFCNT_VALUE(pd) >= 1);
 
-    return pd->creds;
+#ifdef HAVE_CREDS
+    if (pd->ancil_data && pd->ancil_data->creds_valid)
+        return &pd->ancil_data->creds;
+#endif
+
+    return NULL;
+}
+
+const int * pa_pdispatch_fds(pa_pdispatch *pd, int *nfd) {
+    pa_assert(pd);
+    pa_assert(PA_REFCNT_VALUE(pd) >= 1);
+    pa_assert(nfd);
+
+#ifdef HAVE_CREDS
+    if (pd->ancil_data && pd->ancil_data->nfd > 0) {
+        *nfd = pd->ancil_data->nfd;
+        return pd->ancil_data->fds;
+    }
+#endif
+
+    *nfd = 0;
+    return NULL;
 }
@@ -27,4 +27,9 @@
 void pa_init_proplist(pa_proplist *p);
 char *pa_proplist_get_stream_group(pa_proplist *pl, const char *prefix, const char *cache);
 
+/* Like pa_proplist_iterate(), but also returns the data of the entry
+ * without looking it up again. Lives in pulse/proplist.c, since it
+ * needs to look inside, but is not part of the public API. */
+const char *pa_proplist_iterate_data(pa_proplist *p, void **state, const void **data, size_t *nbytes);
+
 #endif
@@ -43,6 +43,7 @@
 #include <pulsecore/source-output.h>
 #include <pulsecore/sink-input.h>
 #include <pulsecore/pstream.h>
+#include <pulsecore/pstream-worker.h>
 #include <pulsecore/tagstruct.h>
 #include <pulsecore/pdispatch.h>
 #include <pulsecore/pstream-util.h>
@@ -56,7 +57,9 @@
 #include <pulsecore/creds.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/ipacl.h>
+#include <pulsecore/mutex.h>
 #include <pulsecore/thread-mq.h>
+#include <pulsecore/codec.h>
 
 #include "protocol-native.h"
 
@@ -68,6 +71,9 @@
 /* Don't accept more connection than this */
 #define MAX_CONNECTIONS 64
 
+/* Don't allow more threads serving client sockets than that */
+#define MAX_WORKER_THREADS 16
+
 #define MAX_MEMBLOCKQ_LENGTH (4*1024*1024) /* 4MB */
 #define DEFAULT_TLENGTH_MSEC 2000 /* 2s */
 #define DEFAULT_PROCESS_MSEC 20   /* 20ms */
@@ -140,11 +146,24 @@ typedef struct playback_stream {
     /* Fixed-up and adjusted buffer attributes */
     pa_buffer_attr buffer_attr;
 
-    /* Only updated after SINK_INPUT_MESSAGE_UPDATE_LATENCY */
+    /* Only updated after SINK_INPUT_MESSAGE_UPDATE_LATENCY or
+     * playback_stream_get_timing_snapshot() */
     int64_t read_index, write_index;
     size_t render_memblockq_length;
     pa_usec_t current_sink_latency;
     uint64_t playing_for, underrun_for;
+
+    /* Published by the IO thread after every render cycle and every
+     * change of the write index, read from the main thread */
+    pa_seqlock timing_lock;
+    struct {
+        pa_bool_t valid;
+        pa_sink *sink;
+        unsigned render_cycle;
+        int64_t read_index, write_index;
+        size_t render_memblockq_length;
+        uint64_t playing_for, underrun_for;
+    } timing;
 } playback_stream;
 
 #define PLAYBACK_STREAM(o) (playback_stream_cast(o))
@@ -181,6 +200,16 @@ struct pa_native_connection {
     uint32_t rrobin_index;
     pa_subscription *subscription;
     pa_time_event *auth_timeout_event;
+
+    /* Only for connections served from a worker thread: the playback
+     * streams, by channel, whose data the thread may post to the sink
+     * directly. A stream is only in here while its sink input is
+     * attached to a sink that is not going to change. */
+    pa_mutex *direct_mutex;
+    pa_hashmap *direct_streams;
+
+    /* Offered to the client, but not taken yet */
+    pa_srbchannel *srbchannel_pending;
 };
 
 #define PA_NATIVE_CONNECTION(o) (pa_native_connection_cast(o))
@@ -196,6 +225,14 @@ struct pa_native_protocol {
     pa_hook hooks[PA_NATIVE_HOOK_MAX];
 
     pa_hashmap *extensions;
+
+    /* Shared by all servers that want their clients served from
+     * threads, and assigned to connections in turn */
+    pa_pstream_worker *workers[MAX_WORKER_THREADS];
+    unsigned n_workers;
+    unsigned next_worker;
+
+    pa_hook_slot *sink_input_move_start_slot, *sink_input_move_finish_slot, *sink_input_move_fail_slot, *sink_input_unlink_slot;
 };
 
 enum {
@@ -237,6 +274,7 @@ static void sink_input_kill_cb(pa_sink_input *i);
 static void sink_input_suspend_cb(pa_sink_input *i, pa_bool_t suspend);
 static void sink_input_moving_cb(pa_sink_input *i, pa_sink *dest);
 static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes);
+static void sink_input_publish_timing_cb(pa_sink_input *i);
 static void sink_input_update_max_rewind_cb(pa_sink_input *i, size_t nbytes);
 static void sink_input_update_max_request_cb(pa_sink_input *i, size_t nbytes);
 static void sink_input_send_event_cb(pa_sink_input *i, const char *event, pa_proplist *pl);
@@ -273,6 +311,7 @@ static void command_get_info(pa_pdispatch *pd, uint32_t command, uint32_t tag, p
 static void command_get_info_list(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_get_server_info(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_subscribe(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+static void command_get_generations(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_set_volume(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_set_mute(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_cork_playback_stream(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
@@ -397,6 +436,8 @@ static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
 
     [PA_COMMAND_SET_PORT_LATENCY_OFFSET] = command_set_port_latency_offset,
 
+    [PA_COMMAND_GET_GENERATIONS] = command_get_generations,
+
     [PA_COMMAND_EXTENSION] = command_extension
 };
 
@@ -478,6 +519,9 @@ static void record_stream_unlink(record_stream *s) {
         s->source_output = NULL;
     }
 
+    pa_pstream_flush_encoder(s->connection->pstream, s->index);
+    pa_pstream_set_encoder(s->connection->pstream, s->index, NULL);
+
     pa_assert_se(pa_idxset_remove_by_data(s->connection->record_streams, s, NULL) == s);
     s->connection = NULL;
     record_stream_unref(s);
@@ -757,6 +801,41 @@ static void record_stream_send_killed(record_stream *r) {
     pa_pstream_send_tagstruct(r->connection->pstream, t);
 }
 
+/* Called from main context */
+static void playback_stream_set_direct(playback_stream *s, pa_bool_t direct) {
+    pa_native_connection *c;
+
+    playback_stream_assert_ref(s);
+
+    if (!(c = s->connection) || !c->direct_streams)
+        return;
+
+    pa_mutex_lock(c->direct_mutex);
+
+    if (direct) {
+        pa_assert(s->sink_input && s->sink_input->sink);
+        pa_hashmap_put(c->direct_streams, PA_UINT32_TO_PTR(s->index), s);
+    } else
+        pa_hashmap_remove(c->direct_streams, PA_UINT32_TO_PTR(s->index));
+
+    pa_mutex_unlock(c->direct_mutex);
+}
+
+/* Called from main context, or from the IO thread of the connection
+ * with direct_mutex held */
+static void playback_stream_post(playback_stream *s, int64_t offset, pa_seek_mode_t seek, const pa_memchunk *chunk) {
+    pa_asyncmsgq *q = s->sink_input->sink->asyncmsgq;
+
+    pa_atomic_inc(&s->seek_or_post_in_queue);
+    if (chunk->memblock) {
+        if (seek != PA_SEEK_RELATIVE || offset != 0)
+            pa_asyncmsgq_post(q, PA_MSGOBJECT(s->sink_input), SINK_INPUT_MESSAGE_SEEK, PA_UINT_TO_PTR(seek), offset, chunk, NULL);
+        else
+            pa_asyncmsgq_post(q, PA_MSGOBJECT(s->sink_input), SINK_INPUT_MESSAGE_POST_DATA, NULL, 0, chunk, NULL);
+    } else
+        pa_asyncmsgq_post(q, PA_MSGOBJECT(s->sink_input), SINK_INPUT_MESSAGE_SEEK, PA_UINT_TO_PTR(seek), offset+chunk->length, NULL, NULL);
+}
+
 /* Called from main context */
 static void playback_stream_unlink(playback_stream *s) {
     pa_assert(s);
@@ -773,6 +852,8 @@ static void playback_stream_unlink(playback_stream *s) {
     if (s->drain_request)
         pa_pstream_send_error(s->connection->pstream, s->drain_tag, PA_ERR_NOENTITY);
 
+    pa_pstream_set_decoder(s->connection->pstream, s->index, NULL);
+
     pa_assert_se(pa_idxset_remove_by_data(s->connection->output_streams, s, NULL) == s);
     s->connection = NULL;
     playback_stream_unref(s);
@@ -1177,11 +1258,14 @@ static playback_stream* playback_stream_new(
     s->early_requests = early_requests;
     pa_atomic_store(&s->seek_or_post_in_queue, 0);
     s->seek_windex = -1;
+    pa_seqlock_init(&s->timing_lock);
+    s->timing.valid = FALSE;
 
     s->sink_input->parent.process_msg = sink_input_process_msg;
     s->sink_input->pop = sink_input_pop_cb;
     s->sink_input->process_underrun = sink_input_process_underrun_cb;
     s->sink_input->process_rewind = sink_input_process_rewind_cb;
+    s->sink_input->publish_timing = sink_input_publish_timing_cb;
     s->sink_input->update_max_rewind = sink_input_update_max_rewind_cb;
     s->sink_input->update_max_request = sink_input_update_max_request_cb;
     s->sink_input->kill = sink_input_kill_cb;
@@ -1229,6 +1313,7 @@ static playback_stream* playback_stream_new(
                 (double) s->configured_sink_latency / PA_USEC_PER_MSEC);
 
     pa_sink_input_put(s->sink_input);
+    playback_stream_set_direct(s, TRUE);
 
 out:
     if (formats)
@@ -1357,6 +1442,14 @@ static void native_connection_free(pa_object *o) {
     pa_pstream_unref(c->pstream);
     pa_client_free(c->client);
 
+    if (c->direct_streams) {
+        pa_hashmap_free(c->direct_streams, NULL);
+        pa_mutex_free(c->direct_mutex);
+    }
+
+    if (c->srbchannel_pending)
+        pa_srbchannel_free(c->srbchannel_pending);
+
     pa_xfree(c);
 }
 
@@ -1395,6 +1488,78 @@ static void native_connection_send_memblock(pa_native_connection *c) {
 
 /*** sink input callbacks ***/
 
+/* Called from thread context */
+static void playback_stream_publish_timing(playback_stream *s) {
+    playback_stream_assert_ref(s);
+
+    pa_seqlock_write_begin(&s->timing_lock);
+    s->timing.valid = TRUE;
+    s->timing.sink = s->sink_input->sink;
+    s->timing.render_cycle = s->sink_input->sink->thread_info.render_cycle;
+    s->timing.read_index = pa_memblockq_get_read_index(s->memblockq);
+    s->timing.write_index = pa_memblockq_get_write_index(s->memblockq);
+    s->timing.render_memblockq_length = pa_memblockq_get_length(s->sink_input->thread_info.render_memblockq);
+    s->timing.underrun_for = s->sink_input->thread_info.underrun_for;
+    s->timing.playing_for = s->sink_input->thread_info.playing_for;
+    pa_seqlock_write_end(&s->timing_lock);
+}
+
+/* Called from main context. Fills in the same fields as
+ * SINK_INPUT_MESSAGE_UPDATE_LATENCY, but from the snapshots the IO
+ * thread published, without waking it up. Returns FALSE if those are
+ * unusable or do not belong to the same render cycle. */
+static pa_bool_t playback_stream_get_timing_snapshot(playback_stream *s) {
+    pa_sink *sink;
+    pa_usec_t sink_latency;
+    unsigned seq, sink_cycle, tries = 0;
+    pa_bool_t valid;
+    pa_sink *timing_sink;
+    unsigned timing_cycle;
+    int64_t read_index, write_index;
+    size_t render_memblockq_length;
+    uint64_t playing_for, underrun_for;
+
+    playback_stream_assert_ref(s);
+
+    /* Data or seeks still on their way to the IO thread would change
+     * the write index */
+    if (pa_atomic_load(&s->seek_or_post_in_queue) > 0)
+        return FALSE;
+
+    if (!(sink = s->sink_input->sink))
+        return FALSE;
+
+    if (!pa_sink_get_latency_snapshot(sink, &sink_latency, &sink_cycle))
+        return FALSE;
+
+    do {
+        if (tries++ >= 3)
+            return FALSE;
+
+        seq = pa_seqlock_read_begin(&s->timing_lock);
+        valid = s->timing.valid;
+        timing_sink = s->timing.sink;
+        timing_cycle = s->timing.render_cycle;
+        read_index = s->timing.read_index;
+        write_index = s->timing.write_index;
+        render_memblockq_length = s->timing.render_memblockq_length;
+        underrun_for = s->timing.underrun_for;
+        playing_for = s->timing.playing_for;
+    } while (pa_seqlock_read_retry(&s->timing_lock, seq));
+
+    if (!valid || timing_sink != sink || timing_cycle != sink_cycle)
+        return FALSE;
+
+    s->read_index = read_index;
+    s->write_index = write_index;
+    s->render_memblockq_length = render_memblockq_length;
+    s->current_sink_latency = sink_latency;
+    s->underrun_for = underrun_for;
+    s->playing_for = playing_for;
+
+    return TRUE;
+}
+
 /* Called from thread context */
 static void handle_seek(playback_stream *s, int64_t indexw) {
     playback_stream_assert_ref(s);
@@ -1432,6 +1597,7 @@ static void handle_seek(playback_stream *s, int64_t indexw) {
     }
 
     playback_stream_request_bytes(s);
+    playback_stream_publish_timing(s);
 }
 
 static void flush_write_no_account(pa_memblockq *q) {
@@ -1671,6 +1837,17 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
     pa_memblockq_rewind(s->memblockq, nbytes);
 }
 
+/* Called from thread context */
+static void sink_input_publish_timing_cb(pa_sink_input *i) {
+    playback_stream *s;
+
+    pa_sink_input_assert_ref(i);
+    s = PLAYBACK_STREAM(i->userdata);
+    playback_stream_assert_ref(s);
+
+    playback_stream_publish_timing(s);
+}
+
 /* Called from thread context */
 static void sink_input_update_max_rewind_cb(pa_sink_input *i, size_t nbytes) {
     playback_stream *s;
@@ -1966,6 +2143,90 @@ static pa_tagstruct *reply_new(uint32_t tag) {
     return reply;
 }
 
+/* Like reply_new(), but builds the reply in the caller's buffer for as
+ * long as it fits */
+static pa_tagstruct *reply_new_buffer(uint32_t tag, uint8_t *buffer, size_t size) {
+    pa_tagstruct *reply;
+
+    reply = pa_tagstruct_new_buffer(buffer, size);
+    pa_tagstruct_putu32(reply, PA_COMMAND_REPLY);
+    pa_tagstruct_putu32(reply, tag);
+    return reply;
+}
+
+/* Since protocol v32 clients may offer codecs to compress the PCM of a
+ * stream with while it's on the network */
+static int get_codec_offers(pa_tagstruct *t, pa_idxset **offers) {
+    uint8_t n;
+    uint32_t i;
+
+    pa_assert(t);
+    pa_assert(offers);
+
+    if (pa_tagstruct_getu8(t, &n) < 0)
+        return -1;
+
+    if (n)
+        *offers = pa_idxset_new(NULL, NULL);
+
+    for (i = 0; i < n; i++) {
+        pa_format_info *f = pa_format_info_new();
+
+        if (pa_tagstruct_get_format_info(t, f) < 0) {
+            pa_format_info_free(f);
+            return -1;
+        }
+
+        pa_idxset_put(*offers, f, NULL);
+    }
+
+    return 0;
+}
+
+/* Picks the first of the offered codecs that works for the stream */
+static pa_codec *pick_codec(pa_native_connection *c, pa_idxset *offers, pa_format_info *format, const pa_sample_spec *ss, pa_bool_t encoder) {
+    pa_format_info *f;
+    uint32_t idx;
+
+    pa_native_connection_assert_ref(c);
+
+    if (!offers || !c->options->compression)
+        return NULL;
+
+    if (format && !pa_format_info_is_pcm(format))
+        return NULL;
+
+    PA_IDXSET_FOREACH(f, offers, idx) {
+        pa_codec *codec;
+        int quality = PA_CODEC_QUALITY_DEFAULT;
+
+        if (encoder) {
+            if (pa_format_info_get_prop_int(f, PA_CODEC_PROP_QUALITY, &quality) < 0)
+                quality = PA_CODEC_QUALITY_DEFAULT;
+
+            codec = pa_codec_new_encoder(f->encoding, ss, (unsigned) PA_CLAMP(quality, (int) PA_CODEC_QUALITY_MIN, (int) PA_CODEC_QUALITY_MAX));
+        } else
+            codec = pa_codec_new_decoder(f->encoding, ss);
+
+        if (codec) {
+            pa_log_debug("Compressing stream with %s.", pa_encoding_to_string(f->encoding));
+            return codec;
+        }
+    }
+
+    return NULL;
+}
+
+/* Tells the client which codec was picked, PCM meaning none */
+static void put_codec(pa_tagstruct *reply, pa_codec *codec) {
+    pa_format_info *f;
+
+    f = pa_format_info_new();
+    f->encoding = codec ? pa_codec_get_encoding(codec) : PA_ENCODING_PCM;
+    pa_tagstruct_put_format_info(reply, f);
+    pa_format_info_free(f);
+}
+
 static void command_create_playback_stream(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
     playback_stream *s;
@@ -2001,7 +2262,8 @@ static void command_create_playback_stream(pa_pdispatch *pd, uint32_t command, u
     int ret = PA_ERR_INVALID;
     uint8_t n_formats = 0;
     pa_format_info *format;
-    pa_idxset *formats = NULL;
+    pa_idxset *formats = NULL, *codecs = NULL;
+    pa_codec *codec = NULL;
     uint32_t i;
 
     pa_native_connection_assert_ref(c);
@@ -2124,6 +2386,11 @@ static void command_create_playback_stream(pa_pdispatch *pd, uint32_t command, u
         }
     }
 
+    if (c->version >= 32 && get_codec_offers(t, &codecs) < 0) {
+        protocol_error(c);
+        goto finish;
+    }
+
     if (n_formats == 0) {
         CHECK_VALIDITY_GOTO(c->pstream, pa_sample_spec_valid(&ss), tag, PA_ERR_INVALID, finish);
         CHECK_VALIDITY_GOTO(c->pstream, map.channels == ss.channels && volume.channels == ss.channels, tag, PA_ERR_INVALID, finish);
@@ -2224,6 +2491,13 @@ static void command_create_playback_stream(pa_pdispatch *pd, uint32_t command, u
         }
     }
 
+    if (c->version >= 32) {
+        /* The client encodes, we decode */
+        codec = pick_codec(c, codecs, s->sink_input->format, &ss, FALSE);
+        put_codec(reply, codec);
+        pa_pstream_set_decoder(c->pstream, s->index, codec);
+    }
+
     pa_pstream_send_tagstruct(c->pstream, reply);
 
 finish:
@@ -2231,6 +2505,8 @@ finish:
         pa_proplist_free(p);
     if (formats)
         pa_idxset_free(formats, (pa_free_cb_t) pa_format_info_free);
+    if (codecs)
+        pa_idxset_free(codecs, (pa_free_cb_t) pa_format_info_free);
 }
 
 static void command_delete_stream(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
@@ -2329,7 +2605,8 @@ static void command_create_record_stream(pa_pdispatch *pd, uint32_t command, uin
     int ret = PA_ERR_INVALID;
     uint8_t n_formats = 0;
     pa_format_info *format;
-    pa_idxset *formats = NULL;
+    pa_idxset *formats = NULL, *codecs = NULL;
+    pa_codec *codec = NULL;
     uint32_t i;
 
     pa_native_connection_assert_ref(c);
@@ -2442,6 +2719,11 @@ static void command_create_record_stream(pa_pdispatch *pd, uint32_t command, uin
         CHECK_VALIDITY_GOTO(c->pstream, pa_cvolume_valid(&volume), tag, PA_ERR_INVALID, finish);
     }
 
+    if (c->version >= 32 && get_codec_offers(t, &codecs) < 0) {
+        protocol_error(c);
+        goto finish;
+    }
+
     if (n_formats == 0) {
         CHECK_VALIDITY_GOTO(c->pstream, pa_sample_spec_valid(&ss), tag, PA_ERR_INVALID, finish);
         CHECK_VALIDITY_GOTO(c->pstream, map.channels == ss.channels, tag, PA_ERR_INVALID, finish);
@@ -2538,6 +2820,13 @@ static void command_create_record_stream(pa_pdispatch *pd, uint32_t command, uin
         }
     }
 
+    if (c->version >= 32) {
+        /* We encode, the client decodes */
+        codec = pick_codec(c, codecs, s->source_output->format, &ss, TRUE);
+        put_codec(reply, codec);
+        pa_pstream_set_encoder(c->pstream, s->index, codec);
+    }
+
     pa_pstream_send_tagstruct(c->pstream, reply);
 
 finish:
@@ -2545,6 +2834,8 @@ finish:
         pa_proplist_free(p);
     if (formats)
         pa_idxset_free(formats, (pa_free_cb_t) pa_format_info_free);
+    if (codecs)
+        pa_idxset_free(codecs, (pa_free_cb_t) pa_format_info_free);
 }
 
 static void command_exit(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
@@ -2568,6 +2859,55 @@ static void command_exit(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_ta
     pa_pstream_send_simple_ack(c->pstream, tag); /* nonsense */
 }
 
+#ifdef HAVE_CREDS
+static void srbchannel_reply_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    pa_srbchannel *srb;
+
+    pa_native_connection_assert_ref(c);
+
+    if (!(srb = c->srbchannel_pending))
+        return;
+
+    c->srbchannel_pending = NULL;
+
+    if (command != PA_COMMAND_REPLY) {
+        pa_log_debug("Client didn't take the shared ring buffer.");
+        pa_pstream_expect_srbchannel(c->pstream, FALSE);
+        pa_srbchannel_free(srb);
+        return;
+    }
+
+    pa_log_debug("Switching to the shared ring buffer.");
+
+    /* Our switch frame goes out after everything we sent before */
+    pa_pstream_set_srbchannel(c->pstream, srb);
+}
+
+/* Offers the client a shared ring buffer to talk through instead of
+ * the socket. Only for local clients that already share memory with
+ * us, since it is passed the same way. */
+static void setup_srbchannel(pa_native_connection *c) {
+    pa_srbchannel *srb;
+    pa_tagstruct *t;
+    int fds[PA_SRBCHANNEL_N_FDS];
+
+    if (!(srb = pa_srbchannel_new(c->protocol->core->mainloop)))
+        return;
+
+    pa_srbchannel_get_fds(srb, fds);
+
+    t = pa_tagstruct_new(NULL, 0);
+    pa_tagstruct_putu32(t, PA_COMMAND_ENABLE_SRBCHANNEL);
+    pa_tagstruct_putu32(t, 0);
+    pa_pstream_send_tagstruct_with_fds(c->pstream, t, PA_SRBCHANNEL_N_FDS, fds);
+
+    c->srbchannel_pending = srb;
+    pa_pstream_expect_srbchannel(c->pstream, TRUE);
+    pa_pdispatch_register_reply(c->pdispatch, 0, DEFAULT_TIMEOUT, srbchannel_reply_callback, c, NULL);
+}
+#endif
+
 static void command_auth(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
     const void*cookie;
@@ -2696,6 +3036,9 @@ static void command_auth(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_ta
 
     pa_pstream_send_tagstruct_with_creds(c->pstream, reply, &ucred);
 }
+
+    if (do_shm && c->version >= 30 && c->options->srbchannel && pa_srbchannel_supported() && !c->srbchannel_pending)
+        setup_srbchannel(c);
 #else
     pa_pstream_send_tagstruct(c->pstream, reply);
 #endif
@@ -2847,8 +3190,10 @@ static void command_get_playback_latency(pa_pdispatch *pd, uint32_t command, uin
     CHECK_VALIDITY(c->pstream, s, tag, PA_ERR_NOENTITY);
     CHECK_VALIDITY(c->pstream, playback_stream_isinstance(s), tag, PA_ERR_NOENTITY);
 
-    /* Get an atomic snapshot of all timing parameters */
-    pa_assert_se(pa_asyncmsgq_send(s->sink_input->sink->asyncmsgq, PA_MSGOBJECT(s->sink_input), SINK_INPUT_MESSAGE_UPDATE_LATENCY, s, 0, NULL) == 0);
+    /* Get an atomic snapshot of all timing parameters, preferably
+     * without a round trip to the IO thread */
+    if (!playback_stream_get_timing_snapshot(s))
+        pa_assert_se(pa_asyncmsgq_send(s->sink_input->sink->asyncmsgq, PA_MSGOBJECT(s->sink_input), SINK_INPUT_MESSAGE_UPDATE_LATENCY, s, 0, NULL) == 0);
 
     reply = reply_new(tag);
     pa_tagstruct_put_usec(reply,
@@ -3181,6 +3526,14 @@ static void sink_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t, pa_sin
 
         pa_idxset_free(formats, (pa_free_cb_t) pa_format_info_free);
     }
+
+    if (c->version >= 29) {
+        pa_cost_meter cost;
+
+        pa_sink_get_render_cost(sink, &cost);
+        pa_tagstruct_put_usec(t, pa_cost_meter_get_avg(&cost));
+        pa_tagstruct_put_usec(t, pa_cost_meter_get_max(&cost));
+    }
 }
 
 static void source_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t, pa_source *source) {
@@ -3374,6 +3727,17 @@ static void sink_input_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t,
     }
     if (c->version >= 21)
         pa_tagstruct_put_format_info(t, s->format);
+    if (c->version >= 29) {
+        pa_sink_input_render_cost cost;
+
+        pa_sink_input_get_render_cost(s, &cost);
+        pa_tagstruct_put_usec(t, pa_cost_meter_get_avg(&cost.peek));
+        pa_tagstruct_put_usec(t, pa_cost_meter_get_max(&cost.peek));
+        pa_tagstruct_put_usec(t, pa_cost_meter_get_avg(&cost.pop));
+        pa_tagstruct_put_usec(t, pa_cost_meter_get_max(&cost.pop));
+        pa_tagstruct_put_usec(t, pa_cost_meter_get_avg(&cost.resample));
+        pa_tagstruct_put_usec(t, pa_cost_meter_get_max(&cost.resample));
+    }
 }
 
 static void source_output_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t, pa_source_output *s) {
@@ -3462,6 +3826,7 @@ static void command_get_info(pa_pdispatch *pd, uint32_t command, uint32_t tag, p
     pa_scache_entry *sce = NULL;
     const char *name = NULL;
     pa_tagstruct *reply;
+    uint8_t buffer[4096];
 
     pa_native_connection_assert_ref(c);
     pa_assert(t);
@@ -3526,7 +3891,9 @@ static void command_get_info(pa_pdispatch *pd, uint32_t command, uint32_t tag, p
         return;
     }
 
-    reply = reply_new(tag);
+    /* A single entry practically always fits on the stack, so the
+     * reply is copied only once, into its packet */
+    reply = reply_new_buffer(tag, buffer, sizeof(buffer));
     if (sink)
         sink_fill_tagstruct(c, reply, sink);
     else if (source)
@@ -3552,6 +3919,8 @@ static void command_get_info_list(pa_pdispatch *pd, uint32_t command, uint32_t t
     uint32_t idx;
     void *p;
     pa_tagstruct *reply;
+    size_t header;
+    pa_bool_t first = TRUE;
 
     pa_native_connection_assert_ref(c);
     pa_assert(t);
@@ -3564,6 +3933,7 @@ static void command_get_info_list(pa_pdispatch *pd, uint32_t command, uint32_t t
     CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
 
     reply = reply_new(tag);
+    pa_tagstruct_data(reply, &header);
 
     if (command == PA_COMMAND_GET_SINK_INFO_LIST)
         i = c->protocol->core->sinks;
@@ -3604,6 +3974,18 @@ static void command_get_info_list(pa_pdispatch *pd, uint32_t command, uint32_t t
                 pa_assert(command == PA_COMMAND_GET_SAMPLE_INFO_LIST);
                 scache_fill_tagstruct(c, reply, p);
             }
+
+            /* Entries of one list tend to be about the same size, so
+             * once we know the first one make room for all the others */
+            if (first) {
+                unsigned n = pa_idxset_size(i);
+                size_t l;
+
+                pa_tagstruct_data(reply, &l);
+                if (n > 1)
+                    pa_tagstruct_reserve(reply, (l - header) * (n - 1));
+                first = FALSE;
+            }
         }
     }
 
@@ -3670,14 +4052,122 @@ static void subscription_cb(pa_core *core, pa_subscription_event_type_t e, uint3
     pa_pstream_send_tagstruct(c->pstream, t);
 }
 
+/* Appends the current values of whatever changed about the object to
+ * a delta subscription event. Returns the changes that are actually
+ * included, which is PA_SUBSCRIPTION_CHANGE_UNKNOWN if the object can't
+ * be looked at anymore. */
+static pa_subscription_change_flags_t put_changes(pa_native_connection *c, pa_tagstruct *t, pa_subscription_event_type_t e, uint32_t idx, pa_subscription_change_flags_t changes) {
+    pa_core *core = c->protocol->core;
+    pa_cvolume v;
+    pa_bool_t mute = FALSE;
+    uint32_t state = 0;
+
+    pa_cvolume_init(&v);
+
+    switch (e & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) {
+
+        case PA_SUBSCRIPTION_EVENT_SINK: {
+            pa_sink *sink;
+
+            if (!(sink = pa_idxset_get_by_index(core->sinks, idx)) || !PA_SINK_IS_LINKED(pa_sink_get_state(sink)))
+                return PA_SUBSCRIPTION_CHANGE_UNKNOWN;
+
+            v = *pa_sink_get_volume(sink, FALSE);
+            mute = pa_sink_get_mute(sink, FALSE);
+            state = pa_sink_get_state(sink);
+            break;
+        }
+
+        case PA_SUBSCRIPTION_EVENT_SOURCE: {
+            pa_source *source;
+
+            if (!(source = pa_idxset_get_by_index(core->sources, idx)) || !PA_SOURCE_IS_LINKED(pa_source_get_state(source)))
+                return PA_SUBSCRIPTION_CHANGE_UNKNOWN;
+
+            v = *pa_source_get_volume(source, FALSE);
+            mute = pa_source_get_mute(source, FALSE);
+            state = pa_source_get_state(source);
+            break;
+        }
+
+        case PA_SUBSCRIPTION_EVENT_SINK_INPUT: {
+            pa_sink_input *i;
+
+            if (!(i = pa_idxset_get_by_index(core->sink_inputs, idx)) || !PA_SINK_INPUT_IS_LINKED(pa_sink_input_get_state(i)))
+                return PA_SUBSCRIPTION_CHANGE_UNKNOWN;
+
+            if (pa_sink_input_is_volume_readable(i))
+                pa_sink_input_get_volume(i, &v, TRUE);
+            else
+                pa_cvolume_reset(&v, i->sample_spec.channels);
+
+            mute = pa_sink_input_get_mute(i);
+            state = pa_sink_input_get_state(i) == PA_SINK_INPUT_CORKED;
+            break;
+        }
+
+        case PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT: {
+            pa_source_output *o;
+
+            if (!(o = pa_idxset_get_by_index(core->source_outputs, idx)) || !PA_SOURCE_OUTPUT_IS_LINKED(pa_source_output_get_state(o)))
+                return PA_SUBSCRIPTION_CHANGE_UNKNOWN;
+
+            if (pa_source_output_is_volume_readable(o))
+                pa_source_output_get_volume(o, &v, TRUE);
+            else
+                pa_cvolume_reset(&v, o->sample_spec.channels);
+
+            mute = pa_source_output_get_mute(o);
+            state = pa_source_output_get_state(o) == PA_SOURCE_OUTPUT_CORKED;
+            break;
+        }
+
+        default:
+            return PA_SUBSCRIPTION_CHANGE_UNKNOWN;
+    }
+
+    pa_tagstruct_putu32(t, changes);
+
+    if (changes & PA_SUBSCRIPTION_CHANGE_VOLUME)
+        pa_tagstruct_put_cvolume(t, &v);
+    if (changes & PA_SUBSCRIPTION_CHANGE_MUTE)
+        pa_tagstruct_put_boolean(t, mute);
+    if (changes & PA_SUBSCRIPTION_CHANGE_STATE)
+        pa_tagstruct_putu32(t, state);
+
+    return changes;
+}
+
+static void subscription_delta_cb(pa_core *core, pa_subscription_event_type_t e, uint32_t idx, pa_subscription_change_flags_t changes, uint64_t generation, void *userdata) {
+    pa_tagstruct *t;
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+
+    pa_native_connection_assert_ref(c);
+
+    t = pa_tagstruct_new(NULL, 0);
+    pa_tagstruct_putu32(t, PA_COMMAND_SUBSCRIBE_EVENT);
+    pa_tagstruct_putu32(t, (uint32_t) -1);
+    pa_tagstruct_putu32(t, e);
+    pa_tagstruct_putu32(t, idx);
+    pa_tagstruct_putu64(t, generation);
+
+    if (changes == PA_SUBSCRIPTION_CHANGE_UNKNOWN ||
+        put_changes(c, t, e, idx, changes) == PA_SUBSCRIPTION_CHANGE_UNKNOWN)
+        pa_tagstruct_putu32(t, PA_SUBSCRIPTION_CHANGE_UNKNOWN);
+
+    pa_pstream_send_tagstruct(c->pstream, t);
+}
+
 static void command_subscribe(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
     pa_subscription_mask_t m;
+    pa_bool_t deltas = FALSE;
 
     pa_native_connection_assert_ref(c);
     pa_assert(t);
 
     if (pa_tagstruct_getu32(t, &m) < 0 ||
+        (c->version >= 31 && pa_tagstruct_get_boolean(t, &deltas) < 0) ||
         !pa_tagstruct_eof(t)) {
         protocol_error(c);
         return;
@@ -3690,7 +4180,10 @@ static void command_subscribe(pa_pdispatch *pd, uint32_t command, uint32_t tag,
         pa_subscription_free(c->subscription);
 
     if (m != 0) {
-        c->subscription = pa_subscription_new(c->protocol->core, m, subscription_cb, c);
+        if (deltas)
+            c->subscription = pa_subscription_new_delta(c->protocol->core, m, subscription_delta_cb, c);
+        else
+            c->subscription = pa_subscription_new(c->protocol->core, m, subscription_cb, c);
         pa_assert(c->subscription);
     } else
         c->subscription = NULL;
@@ -3698,6 +4191,41 @@ static void command_subscribe(pa_pdispatch *pd, uint32_t command, uint32_t tag,
     pa_pstream_send_simple_ack(c->pstream, tag);
 }
 
+static void generation_cb(pa_core *core, pa_subscription_event_type_t e, uint32_t idx, uint64_t generation, void *userdata) {
+    pa_tagstruct *reply = userdata;
+
+    pa_tagstruct_putu32(reply, e);
+    pa_tagstruct_putu32(reply, idx);
+    pa_tagstruct_putu64(reply, generation);
+}
+
+static void command_get_generations(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    pa_subscription_mask_t m;
+    uint64_t since;
+    pa_tagstruct *reply;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (pa_tagstruct_getu32(t, &m) < 0 ||
+        pa_tagstruct_getu64(t, &since) < 0 ||
+        !pa_tagstruct_eof(t)) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+    CHECK_VALIDITY(c->pstream, (m & ~PA_SUBSCRIPTION_MASK_ALL) == 0, tag, PA_ERR_INVALID);
+
+    reply = reply_new(tag);
+    pa_tagstruct_putu64(reply, pa_subscription_get_generation(c->protocol->core));
+    pa_tagstruct_put_boolean(reply, pa_subscription_history_complete(c->protocol->core, since));
+    pa_subscription_foreach_changed(c->protocol->core, m, since, generation_cb, reply);
+
+    pa_pstream_send_tagstruct(c->pstream, reply);
+}
+
 static void command_set_volume(
         pa_pdispatch *pd,
         uint32_t command,
@@ -3977,6 +4505,7 @@ static void command_cork_record_stream(pa_pdispatch *pd, uint32_t command, uint3
 
     pa_source_output_cork(s->source_output, b);
     pa_memblockq_prebuf_force(s->memblockq);
+    pa_pstream_flush_encoder(c->pstream, s->index);
     pa_pstream_send_simple_ack(c->pstream, tag);
 }
 
@@ -3999,6 +4528,7 @@ static void command_flush_record_stream(pa_pdispatch *pd, uint32_t command, uint
     CHECK_VALIDITY(c->pstream, s, tag, PA_ERR_NOENTITY);
 
     pa_memblockq_flush_read(s->memblockq);
+    pa_pstream_flush_encoder(c->pstream, s->index);
     pa_pstream_send_simple_ack(c->pstream, tag);
 }
 
@@ -4809,14 +5339,14 @@ static void command_set_port_latency_offset(pa_pdispatch *pd, uint32_t command,
 
 /*** pstream callbacks ***/
 
-static void pstream_packet_callback(pa_pstream *p, pa_packet *packet, const pa_creds *creds, void *userdata) {
+static void pstream_packet_callback(pa_pstream *p, pa_packet *packet, const pa_cmsg_ancil_data *ancil_data, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
 
     pa_assert(p);
     pa_assert(packet);
     pa_native_connection_assert_ref(c);
 
-    if (pa_pdispatch_run(c->pdispatch, packet, creds, c) < 0) {
+    if (pa_pdispatch_run(c->pdispatch, packet, ancil_data, c) < 0) {
         pa_log("invalid packet.");
         native_connection_unlink(c);
     }
@@ -4840,24 +5370,18 @@ static void pstream_memblock_callback(pa_pstream *p, uint32_t channel, int64_t o
     pa_log("got %lu bytes from client", (unsigned long) chunk->length);
 #endif
 
-    if (playback_stream_isinstance(stream)) {
-        playback_stream *ps = PLAYBACK_STREAM(stream);
+    if (playback_stream_isinstance(stream))
+        playback_stream_post(PLAYBACK_STREAM(stream), offset, seek, chunk);
 
-        pa_atomic_inc(&ps->seek_or_post_in_queue);
-        if (chunk->memblock) {
-            if (seek != PA_SEEK_RELATIVE || offset != 0)
-                pa_asyncmsgq_post(ps->sink_input->sink->asyncmsgq, PA_MSGOBJECT(ps->sink_input), SINK_INPUT_MESSAGE_SEEK, PA_UINT_TO_PTR(seek), offset, chunk, NULL);
-            else
-                pa_asyncmsgq_post(ps->sink_input->sink->asyncmsgq, PA_MSGOBJECT(ps->sink_input), SINK_INPUT_MESSAGE_POST_DATA, NULL, 0, chunk, NULL);
-        } else
-            pa_asyncmsgq_post(ps->sink_input->sink->asyncmsgq, PA_MSGOBJECT(ps->sink_input), SINK_INPUT_MESSAGE_SEEK, PA_UINT_TO_PTR(seek), offset+chunk->length, NULL, NULL);
-
-    } else {
+    else {
         upload_stream *u = UPLOAD_STREAM(stream);
         size_t l;
 
         if (!u->memchunk.memblock) {
-            if (u->length == chunk->length && chunk->memblock) {
+            /* Only keep a reference if that doesn't pin a larger
+             * block, like the pstream's read buffer, in the cache */
+            if (u->length == chunk->length && chunk->memblock &&
+                pa_memblock_get_length(chunk->memblock) == chunk->length) {
                 u->memchunk = *chunk;
                 pa_memblock_ref(u->memchunk.memblock);
                 u->length = 0;
@@ -4896,6 +5420,26 @@ static void pstream_memblock_callback(pa_pstream *p, uint32_t channel, int64_t o
     }
 }
 
+/* Called from the IO thread of the connection. Takes the data of
+ * playback streams straight to the sink, skipping the main loop. */
+static pa_bool_t pstream_memblock_thread_callback(pa_pstream *p, uint32_t channel, int64_t offset, pa_seek_mode_t seek, const pa_memchunk *chunk, void *userdata) {
+    pa_native_connection *c = userdata;
+    playback_stream *s;
+
+    pa_assert(p);
+    pa_assert(chunk);
+    pa_assert(c);
+
+    pa_mutex_lock(c->direct_mutex);
+
+    if ((s = pa_hashmap_get(c->direct_streams, PA_UINT32_TO_PTR(channel))))
+        playback_stream_post(s, offset, seek, chunk);
+
+    pa_mutex_unlock(c->direct_mutex);
+
+    return !!s;
+}
+
 static void pstream_die_callback(pa_pstream *p, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
 
@@ -4976,11 +5520,34 @@ static void auth_timeout(pa_mainloop_api*m, pa_time_event *e, const struct timev
     }
 }
 
+/* Returns one of the first n worker threads, starting them as needed */
+static pa_pstream_worker *get_worker(pa_native_protocol *p, unsigned n) {
+    pa_assert(n > 0 && n <= MAX_WORKER_THREADS);
+
+    while (p->n_workers < n) {
+        char name[16];
+        pa_pstream_worker *w;
+
+        pa_snprintf(name, sizeof(name), "native-io-%u", p->n_workers);
+
+        if (!(w = pa_pstream_worker_new(p->core->mainloop, name)))
+            break;
+
+        p->workers[p->n_workers++] = w;
+    }
+
+    if (p->n_workers <= 0)
+        return NULL;
+
+    return p->workers[p->next_worker++ % PA_MIN(n, p->n_workers)];
+}
+
 void pa_native_protocol_connect(pa_native_protocol *p, pa_iochannel *io, pa_native_options *o) {
     pa_native_connection *c;
     char pname[128];
     pa_client *client;
     pa_client_new_data data;
+    pa_pstream_worker *worker = NULL;
 
     pa_assert(p);
     pa_assert(io);
@@ -5037,7 +5604,17 @@ void pa_native_protocol_connect(pa_native_protocol *p, pa_iochannel *io, pa_nati
     c->client->send_event = client_send_event_cb;
     c->client->userdata = c;
 
-    c->pstream = pa_pstream_new(p->core->mainloop, io, p->core->mempool);
+#ifdef HAVE_CREDS
+    if (pa_iochannel_creds_supported(io))
+        pa_iochannel_creds_enable(io);
+#endif
+
+    /* Either way, packets are still dispatched in the main loop since
+     * pretty much every command touches core objects */
+    if (o->worker_threads > 0 && (worker = get_worker(p, o->worker_threads)))
+        c->pstream = pa_pstream_new_threaded(p->core->mainloop, io, p->core->mempool, pa_pstream_worker_get_thread(worker));
+    else
+        c->pstream = pa_pstream_new(p->core->mainloop, io, p->core->mempool);
     pa_pstream_set_receive_packet_callback(c->pstream, pstream_packet_callback, c);
     pa_pstream_set_receive_memblock_callback(c->pstream, pstream_memblock_callback, c);
     pa_pstream_set_die_callback(c->pstream, pstream_die_callback, c);
@@ -5045,6 +5622,16 @@ void pa_native_protocol_connect(pa_native_protocol *p, pa_iochannel *io, pa_nati
     pa_pstream_set_revoke_callback(c->pstream, pstream_revoke_callback, c);
     pa_pstream_set_release_callback(c->pstream, pstream_release_callback, c);
 
+    c->direct_mutex = NULL;
+    c->direct_streams = NULL;
+    c->srbchannel_pending = NULL;
+
+    if (worker && o->direct_playback) {
+        c->direct_mutex = pa_mutex_new(FALSE, FALSE);
+        c->direct_streams = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+        pa_pstream_set_receive_memblock_thread_callback(c->pstream, pstream_memblock_thread_callback, c);
+    }
+
     c->pdispatch = pa_pdispatch_new(p->core->mainloop, TRUE, command_table, PA_COMMAND_MAX);
 
     c->record_streams = pa_idxset_new(NULL, NULL);
@@ -5055,11 +5642,6 @@ void pa_native_protocol_connect(pa_native_protocol *p, pa_iochannel *io, pa_nati
 
     pa_idxset_put(p->connections, c, NULL);
 
-#ifdef HAVE_CREDS
-    if (pa_iochannel_creds_supported(io))
-        pa_iochannel_creds_enable(io);
-#endif
-
     pa_hook_fire(&p->hooks[PA_NATIVE_HOOK_CONNECTION_PUT], c);
 }
 
@@ -5075,6 +5657,43 @@ void pa_native_protocol_disconnect(pa_native_protocol *p, pa_module *m) {
             native_connection_unlink(c);
 }
 
+/* While a sink input is being moved, or once it is going away, the
+ * data of its stream has to take the way through the main loop, which
+ * knows about its current sink. */
+static pa_bool_t is_playback_sink_input(pa_sink_input *i) {
+    return i->parent.process_msg == sink_input_process_msg;
+}
+
+static pa_hook_result_t sink_input_detach_hook_cb(pa_core *core, pa_sink_input *i, pa_native_protocol *p) {
+    pa_sink_input_assert_ref(i);
+
+    if (is_playback_sink_input(i))
+        playback_stream_set_direct(PLAYBACK_STREAM(i->userdata), FALSE);
+
+    return PA_HOOK_OK;
+}
+
+static pa_hook_result_t sink_input_move_finish_hook_cb(pa_core *core, pa_sink_input *i, pa_native_protocol *p) {
+    pa_sink_input_assert_ref(i);
+
+    if (is_playback_sink_input(i))
+        playback_stream_set_direct(PLAYBACK_STREAM(i->userdata), TRUE);
+
+    return PA_HOOK_OK;
+}
+
+/* Whoever rescues a stream after a failed move usually does that with
+ * pa_sink_input_finish_move(), which lets us know. In case it ended up
+ * on a sink some other way, pick it up here. */
+static pa_hook_result_t sink_input_move_fail_hook_cb(pa_core *core, pa_sink_input *i, pa_native_protocol *p) {
+    pa_sink_input_assert_ref(i);
+
+    if (i->sink && is_playback_sink_input(i))
+        playback_stream_set_direct(PLAYBACK_STREAM(i->userdata), TRUE);
+
+    return PA_HOOK_OK;
+}
+
 static pa_native_protocol* native_protocol_new(pa_core *c) {
     pa_native_protocol *p;
     pa_native_hook_t h;
@@ -5090,9 +5709,18 @@ static pa_native_protocol* native_protocol_new(pa_core *c) {
 
     p->extensions = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
 
+    p->n_workers = p->next_worker = 0;
+
     for (h = 0; h < PA_NATIVE_HOOK_MAX; h++)
         pa_hook_init(&p->hooks[h], p);
 
+    /* Late, so that moves that are vetoed don't bother us */
+    p->sink_input_move_start_slot = pa_hook_connect(&c->hooks[PA_CORE_HOOK_SINK_INPUT_MOVE_START], PA_HOOK_LATE, (pa_hook_cb_t) sink_input_detach_hook_cb, p);
+    p->sink_input_move_finish_slot = pa_hook_connect(&c->hooks[PA_CORE_HOOK_SINK_INPUT_MOVE_FINISH], PA_HOOK_EARLY, (pa_hook_cb_t) sink_input_move_finish_hook_cb, p);
+    /* After module-rescue-streams and friends */
+    p->sink_input_move_fail_slot = pa_hook_connect(&c->hooks[PA_CORE_HOOK_SINK_INPUT_MOVE_FAIL], PA_HOOK_LATE+30, (pa_hook_cb_t) sink_input_move_fail_hook_cb, p);
+    p->sink_input_unlink_slot = pa_hook_connect(&c->hooks[PA_CORE_HOOK_SINK_INPUT_UNLINK], PA_HOOK_EARLY, (pa_hook_cb_t) sink_input_detach_hook_cb, p);
+
     pa_assert_se(pa_shared_set(c, "native-protocol", p) >= 0);
 
     return p;
@@ -5119,6 +5747,7 @@ pa_native_protocol* pa_native_protocol_ref(pa_native_protocol *p) {
 void pa_native_protocol_unref(pa_native_protocol *p) {
     pa_native_connection *c;
     pa_native_hook_t h;
+    unsigned i;
 
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) >= 1);
@@ -5131,6 +5760,14 @@ void pa_native_protocol_unref(pa_native_protocol *p) {
 
     pa_idxset_free(p->connections, NULL);
 
+    for (i = 0; i < p->n_workers; i++)
+        pa_pstream_worker_free(p->workers[i]);
+
+    pa_hook_slot_free(p->sink_input_move_start_slot);
+    pa_hook_slot_free(p->sink_input_move_finish_slot);
+    pa_hook_slot_free(p->sink_input_move_fail_slot);
+    pa_hook_slot_free(p->sink_input_unlink_slot);
+
     pa_strlist_free(p->servers);
 
     for (h = 0; h < PA_NATIVE_HOOK_MAX; h++)
@@ -5309,6 +5946,31 @@ int pa_native_options_parse(pa_native_options *o, pa_core *c, pa_modargs *ma) {
     } else
           o->auth_cookie = NULL;
 
+    o->worker_threads = 0;
+    if (pa_modargs_get_value_u32(ma, "worker-threads", &o->worker_threads) < 0 ||
+        o->worker_threads > MAX_WORKER_THREADS) {
+        pa_log("worker-threads= expects a number between 0 and %u.", MAX_WORKER_THREADS);
+        return -1;
+    }
+
+    o->direct_playback = TRUE;
+    if (pa_modargs_get_value_boolean(ma, "direct-playback", &o->direct_playback) < 0) {
+        pa_log("direct-playback= expects a boolean argument.");
+        return -1;
+    }
+
+    o->srbchannel = TRUE;
+    if (pa_modargs_get_value_boolean(ma, "srbchannel", &o->srbchannel) < 0) {
+        pa_log("srbchannel= expects a boolean argument.");
+        return -1;
+    }
+
+    o->compression = TRUE;
+    if (pa_modargs_get_value_boolean(ma, "compression", &o->compression) < 0) {
+        pa_log("compression= expects a boolean argument.");
+        return -1;
+    }
+
     return 0;
 }
 
@@ -47,6 +47,20 @@ typedef struct pa_native_options {
     char *auth_group;
     pa_ip_acl *auth_ip_acl;
     pa_auth_cookie *auth_cookie;
+
+    /* Serve the sockets of the clients from that many threads instead
+     * of the main loop */
+    uint32_t worker_threads;
+
+    /* Let those threads pass playback data to the sinks themselves */
+    pa_bool_t direct_playback;
+
+    /* Offer local clients a shared ring buffer instead of the socket */
+    pa_bool_t srbchannel;
+
+    /* Let clients compress their streams with one of the codecs they
+     * offer */
+    pa_bool_t compression;
 } pa_native_options;
 
 typedef enum pa_native_hook {
@@ -23,12 +23,14 @@
 #include <config.h>
 #endif
 
+#include <string.h>
+
 #include <pulsecore/native-common.h>
 #include <pulsecore/macro.h>
 
 #include "pstream-util.h"
 
-void pa_pstream_send_tagstruct_with_creds(pa_pstream *p, pa_tagstruct *t, const pa_creds *creds) {
+static void send_tagstruct(pa_pstream *p, pa_tagstruct *t, const pa_cmsg_ancil_data *ancil_data) {
     size_t length;
     uint8_t *data;
     pa_packet *packet;
@@ -36,12 +38,57 @@ void pa_pstream_send_tagstruct_with_creds(pa_pstream *p, pa_tagstruct *t, const
     pa_assert(p);
     pa_assert(t);
 
-    pa_assert_se(data = pa_tagstruct_free_data(t, &length));
-    pa_assert_se(packet = pa_packet_new_dynamic(data, length));
-    pa_pstream_send_packet(p, packet, creds);
+    /* Large tagstructs hand over their memory, small ones are copied
+     * from their own or the caller's buffer into a recycled packet */
+    if (pa_tagstruct_is_dynamic(t)) {
+        pa_assert_se(data = pa_tagstruct_free_data(t, &length));
+        pa_assert_se(packet = pa_packet_new_dynamic(data, length));
+    } else {
+        const uint8_t *d;
+
+        pa_assert_se(d = pa_tagstruct_data(t, &length));
+        pa_assert_se(packet = pa_packet_new_data(d, length));
+        pa_tagstruct_free(t);
+    }
+
+    pa_pstream_send_packet(p, packet, ancil_data);
     pa_packet_unref(packet);
 }
 
+void pa_pstream_send_tagstruct_with_creds(pa_pstream *p, pa_tagstruct *t, const pa_creds *creds) {
+#ifdef HAVE_CREDS
+    if (creds) {
+        pa_cmsg_ancil_data a;
+
+        a.creds = *creds;
+        a.creds_valid = TRUE;
+        a.nfd = 0;
+
+        send_tagstruct(p, t, &a);
+        return;
+    }
+#endif
+
+    send_tagstruct(p, t, NULL);
+}
+
+void pa_pstream_send_tagstruct_with_fds(pa_pstream *p, pa_tagstruct *t, int nfd, const int *fds) {
+#ifdef HAVE_CREDS
+    pa_cmsg_ancil_data a;
+
+    pa_assert(nfd > 0 && nfd <= PA_CMSG_ANCIL_DATA_MAX_FDS);
+    pa_assert(fds);
+
+    a.creds_valid = FALSE;
+    a.nfd = nfd;
+    memcpy(a.fds, fds, sizeof(int) * nfd);
+
+    send_tagstruct(p, t, &a);
+#else
+    pa_assert_not_reached();
+#endif
+}
+
 void pa_pstream_send_error(pa_pstream *p, uint32_t tag, uint32_t error) {
     pa_tagstruct *t;
 
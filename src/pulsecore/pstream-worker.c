@@ -0,0 +1,198 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/mainloop.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/flist.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/msgobject.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/thread-mq.h>
+
+#include "pstream-worker.h"
+
+typedef struct worker_object {
+    pa_msgobject parent;
+    pa_pstream_worker *worker;
+} worker_object;
+
+PA_DEFINE_PRIVATE_CLASS(worker_object, pa_msgobject);
+#define WORKER_OBJECT(o) (worker_object_cast(o))
+
+enum {
+    WORKER_MESSAGE_RUN
+};
+
+struct closure {
+    pa_pstream_thread_cb_t cb;
+    void *userdata;
+};
+
+PA_STATIC_FLIST_DECLARE(closures, 0, pa_xfree);
+
+struct pa_pstream_worker {
+    /* Has to be first, pa_pstream only knows about this */
+    pa_pstream_thread parent;
+
+    char *name;
+    pa_mainloop *mainloop;
+    pa_thread *thread;
+    pa_thread_mq thread_mq;
+    worker_object *object;
+};
+
+static void closure_free(void *p) {
+    if (pa_flist_push(PA_STATIC_FLIST_GET(closures), p) < 0)
+        pa_xfree(p);
+}
+
+static struct closure *closure_new(pa_pstream_thread_cb_t cb, void *userdata) {
+    struct closure *c;
+
+    if (!(c = pa_flist_pop(PA_STATIC_FLIST_GET(closures))))
+        c = pa_xnew(struct closure, 1);
+
+    c->cb = cb;
+    c->userdata = userdata;
+
+    return c;
+}
+
+/* Called from either side, depending on the queue */
+static int worker_object_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offset, pa_memchunk *chunk) {
+    worker_object *wo = WORKER_OBJECT(o);
+
+    worker_object_assert_ref(wo);
+
+    switch (code) {
+
+        case WORKER_MESSAGE_RUN: {
+            struct closure *c = userdata;
+
+            c->cb(c->userdata);
+            return 0;
+        }
+
+        case PA_MESSAGE_SHUTDOWN:
+            pa_mainloop_quit(wo->worker->mainloop, 0);
+            return 0;
+    }
+
+    return -1;
+}
+
+static void worker_run(pa_pstream_thread *t, pa_pstream_thread_cb_t cb, void *userdata, pa_bool_t wait) {
+    pa_pstream_worker *w = (pa_pstream_worker*) t;
+
+    pa_assert(w);
+    pa_assert(cb);
+
+    if (wait) {
+        struct closure c;
+
+        c.cb = cb;
+        c.userdata = userdata;
+        pa_asyncmsgq_send(w->thread_mq.inq, PA_MSGOBJECT(w->object), WORKER_MESSAGE_RUN, &c, 0, NULL);
+    } else
+        pa_asyncmsgq_post(w->thread_mq.inq, PA_MSGOBJECT(w->object), WORKER_MESSAGE_RUN, closure_new(cb, userdata), 0, NULL, closure_free);
+}
+
+/* Called from the worker thread */
+static void worker_run_main(pa_pstream_thread *t, pa_pstream_thread_cb_t cb, void *userdata) {
+    pa_pstream_worker *w = (pa_pstream_worker*) t;
+
+    pa_assert(w);
+    pa_assert(cb);
+
+    pa_asyncmsgq_post(w->thread_mq.outq, PA_MSGOBJECT(w->object), WORKER_MESSAGE_RUN, closure_new(cb, userdata), 0, NULL, closure_free);
+}
+
+static void thread_func(void *userdata) {
+    pa_pstream_worker *w = userdata;
+
+    pa_assert(w);
+
+    pa_log_debug("Thread %s starting up", w->name);
+
+    pa_thread_mq_install(&w->thread_mq);
+
+    if (pa_mainloop_run(w->mainloop, NULL) < 0)
+        pa_log_error("Main loop of thread %s failed.", w->name);
+
+    pa_log_debug("Thread %s shutting down", w->name);
+}
+
+pa_pstream_worker *pa_pstream_worker_new(pa_mainloop_api *m, const char *name) {
+    pa_pstream_worker *w;
+
+    pa_assert(m);
+    pa_assert(name);
+
+    w = pa_xnew0(pa_pstream_worker, 1);
+    w->name = pa_xstrdup(name);
+    w->mainloop = pa_mainloop_new();
+
+    w->parent.mainloop = pa_mainloop_get_api(w->mainloop);
+    w->parent.run = worker_run;
+    w->parent.run_main = worker_run_main;
+
+    w->object = pa_msgobject_new(worker_object);
+    w->object->parent.process_msg = worker_object_process_msg;
+    w->object->worker = w;
+
+    pa_thread_mq_init_thread_mainloop(&w->thread_mq, m, w->parent.mainloop);
+
+    if (!(w->thread = pa_thread_new(name, thread_func, w))) {
+        pa_log("Failed to create thread %s.", name);
+        pa_pstream_worker_free(w);
+        return NULL;
+    }
+
+    return w;
+}
+
+void pa_pstream_worker_free(pa_pstream_worker *w) {
+    pa_assert(w);
+
+    if (w->thread) {
+        pa_asyncmsgq_send(w->thread_mq.inq, PA_MSGOBJECT(w->object), PA_MESSAGE_SHUTDOWN, NULL, 0, NULL);
+        pa_thread_free(w->thread);
+    }
+
+    /* This also runs whatever the thread left for us */
+    pa_thread_mq_done(&w->thread_mq);
+
+    pa_mainloop_free(w->mainloop);
+    worker_object_unref(w->object);
+
+    pa_xfree(w->name);
+    pa_xfree(w);
+}
+
+pa_pstream_thread *pa_pstream_worker_get_thread(pa_pstream_worker *w) {
+    pa_assert(w);
+
+    return &w->parent;
+}
@@ -0,0 +1,40 @@
+#ifndef foopulsepstreamworkerhfoo
+#define foopulsepstreamworkerhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulse/mainloop-api.h>
+
+#include <pulsecore/pstream.h>
+
+/* A thread running a main loop of its own, which does the socket IO
+ * of any number of pstreams created with pa_pstream_new_threaded() and
+ * passes what it received on to the main loop. */
+
+typedef struct pa_pstream_worker pa_pstream_worker;
+
+pa_pstream_worker *pa_pstream_worker_new(pa_mainloop_api *m, const char *name);
+
+/* All pstreams using the worker have to be unlinked before */
+void pa_pstream_worker_free(pa_pstream_worker *w);
+
+pa_pstream_thread *pa_pstream_worker_get_thread(pa_pstream_worker *w);
+
+#endif
@@ -26,7 +26,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <errno.h>
 
 #ifdef HAVE_NETINET_IN_H
 #include <netinet/in.h>
@@ -36,11 +38,17 @@
 
 #include <pulsecore/socket.h>
 #include <pulsecore/queue.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/idxset.h>
 #include <pulsecore/log.h>
 #include <pulsecore/creds.h>
 #include <pulsecore/refcnt.h>
 #include <pulsecore/flist.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/atomic.h>
+#include <pulsecore/mutex.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/core-error.h>
 
 #include "pstream.h"
 
@@ -49,8 +57,16 @@
 #define PA_FLAG_SHMRELEASE 0x40000000LU
 #define PA_FLAG_SHMREVOKE  0xC0000000LU
 #define PA_FLAG_SHMMASK    0xFF000000LU
+
+/* A frame without payload, after which the sender writes to the
+ * shared ring instead of the socket */
+#define PA_FLAG_SRBSWITCH  0x20000000LU
 #define PA_FLAG_SEEKMASK   0x000000FFLU
 
+/* The payload of a memblock frame is a block made by the encoder of
+ * the channel, see pa_pstream_set_encoder() */
+#define PA_FLAG_CODEC      0x00010000LU
+
 /* The sequence descriptor header consists of 5 32bit integers: */
 enum {
     PA_PSTREAM_DESCRIPTOR_LENGTH,
@@ -74,7 +90,9 @@ typedef uint32_t pa_pstream_descriptor[PA_PSTREAM_DESCRIPTOR_MAX];
 
 #define PA_PSTREAM_DESCRIPTOR_SIZE (PA_PSTREAM_DESCRIPTOR_MAX*sizeof(uint32_t))
 
-#define MINIBUF_SIZE (256)
+/* How many queued items do_write() tries to send with a single
+ * writev(). Each of them needs up to two struct iovec. */
+#define WRITE_BATCH_MAX (16)
 
 /* To allow uploading a single sample in one frame, this value should be the
  * same size (16 MB) as PA_SCACHE_ENTRY_SIZE_MAX from pulsecore/core-scache.h.
@@ -88,14 +106,19 @@ struct item_info {
         PA_PSTREAM_ITEM_PACKET,
         PA_PSTREAM_ITEM_MEMBLOCK,
         PA_PSTREAM_ITEM_SHMRELEASE,
-        PA_PSTREAM_ITEM_SHMREVOKE
+        PA_PSTREAM_ITEM_SHMREVOKE,
+        PA_PSTREAM_ITEM_SRBSWITCH,
+
+        /* Only passed from the IO thread to the main loop */
+        PA_PSTREAM_ITEM_DRAIN,
+        PA_PSTREAM_ITEM_DIE
     } type;
 
     /* packet info */
     pa_packet *packet;
 #ifdef HAVE_CREDS
-    pa_bool_t with_creds;
-    pa_creds creds;
+    pa_bool_t with_ancil_data;
+    pa_cmsg_ancil_data ancil_data; /* the item owns the fds */
 #endif
 
     /* memblock info */
@@ -103,15 +126,22 @@ struct item_info {
     uint32_t channel;
     int64_t offset;
     pa_seek_mode_t seek_mode;
+    pa_bool_t encoded;
 
     /* release/revoke info */
     uint32_t block_id;
+
+    /* Filled in when the item is taken off the send queue */
+    pa_pstream_descriptor descriptor;
+    uint32_t shm_info[PA_PSTREAM_SHM_MAX];
+    pa_bool_t shm_payload; /* the payload is shm_info instead of chunk */
 };
 
 struct pa_pstream {
     PA_REFCNT_DECLARE;
 
-    pa_mainloop_api *mainloop;
+    pa_mainloop_api *mainloop;    /* the callbacks are called from here */
+    pa_mainloop_api *io_mainloop; /* and the socket is served from here */
     pa_defer_event *defer_event;
     pa_iochannel *io;
 
@@ -119,37 +149,87 @@ struct pa_pstream {
 
     pa_bool_t dead;
 
+    /* Only for threaded pstreams. The thread owns io, defer_event and
+     * the read and write state, and leaves what it received for the
+     * main loop in receive_queue. The mutex protects both queues and
+     * the thread memblock callback. n_received counts the items in
+     * receive_queue plus the one being dispatched. */
+    pa_pstream_thread *thread;
+    pa_mutex *mutex;
+    pa_queue *receive_queue;
+    pa_atomic_t n_received;
+    pa_atomic_t n_pending;
+    pa_atomic_t kick_pending;
+    pa_atomic_t dispatch_pending;
+    pa_bool_t shm_request;
+
     struct {
-        union {
-            uint8_t minibuf[MINIBUF_SIZE];
-            pa_pstream_descriptor descriptor;
-        };
-        struct item_info* current;
-        void *data;
+        /* Items taken off send_queue, in order. Only the first one
+         * may have been sent partially, index bytes of it so far. */
+        struct item_info *batch[WRITE_BATCH_MAX];
+        unsigned n_batch;
         size_t index;
-        int minibuf_validsize;
-        pa_memchunk memchunk;
     } write;
 
     struct {
         pa_pstream_descriptor descriptor;
-        pa_memblock *memblock;
         pa_packet *packet;
         uint32_t shm_info[PA_PSTREAM_SHM_MAX];
-        void *data;
-        size_t index;
+        size_t index; /* of the current frame, including the descriptor */
+
+        /* Everything is read from the socket into this pool block,
+         * as much as fits at once, and parsed from there. Memblock
+         * frames are handed out as chunks pointing into it. */
+        pa_memblock *buffer;
+        size_t buffer_index, buffer_length;
+#ifdef HAVE_CREDS
+        pa_bool_t buffer_creds_valid;
+
+        /* File descriptors that came in with the data between
+         * fds_begin and fds_end. They belong to the last frame that
+         * starts in there. All positions count from the beginning of
+         * the stream. */
+        int nfd;
+        int fds[PA_CMSG_ANCIL_DATA_MAX_FDS];
+        uint64_t fds_begin, fds_end;
+#endif
+        uint64_t received;
+        uint64_t frame_start;
     } read;
 
+    /* Once our switch frame is out, everything is written to srb, and
+     * once the one of the peer came in, everything is read from it */
+    pa_srbchannel *srb;
+    pa_bool_t write_srb, read_srb;
+
+    /* The main loop hands the ring over here, and attach_srb_cb()
+     * publishes it as srb from the IO thread */
+    pa_srbchannel *srb_request;
+    pa_bool_t srb_requested;
+
+    /* Set from the main loop, read by the IO thread when the switch
+     * frame of the peer comes in */
+    pa_atomic_t srb_expected;
+
     pa_bool_t use_shm;
     pa_memimport *import;
     pa_memexport *export;
 
+    /* Codecs by channel. The decoders are used from the thread that
+     * parses the frames, so codec_mutex protects both tables. */
+    pa_mutex *codec_mutex;
+    pa_hashmap *encoders;
+    pa_hashmap *decoders;
+
     pa_pstream_packet_cb_t receive_packet_callback;
     void *receive_packet_callback_userdata;
 
     pa_pstream_memblock_cb_t receive_memblock_callback;
     void *receive_memblock_callback_userdata;
 
+    pa_pstream_memblock_thread_cb_t receive_memblock_thread_callback;
+    void *receive_memblock_thread_callback_userdata;
+
     pa_pstream_notify_cb_t drain_callback;
     void *drain_callback_userdata;
 
@@ -165,13 +245,30 @@ struct pa_pstream {
     pa_mempool *mempool;
 
 #ifdef HAVE_CREDS
-    pa_creds read_creds, write_creds;
-    pa_bool_t read_creds_valid, send_creds_now;
+    pa_creds read_creds;
+    pa_bool_t read_creds_valid;
 #endif
 };
 
+static pa_pstream_stat pstream_stat;
+
+/* Too wide for atomics, so these take a lock */
+static pa_static_mutex codec_stat_mutex = PA_STATIC_MUTEX_INIT;
+static uint64_t codec_stat_pcm_bytes, codec_stat_encoded_bytes;
+
+static void codec_stat_add(size_t pcm_bytes, size_t encoded_bytes) {
+    pa_mutex *m = pa_static_mutex_get(&codec_stat_mutex, FALSE, FALSE);
+
+    pa_mutex_lock(m);
+    codec_stat_pcm_bytes += pcm_bytes;
+    codec_stat_encoded_bytes += encoded_bytes;
+    pa_mutex_unlock(m);
+}
+
 static int do_write(pa_pstream *p);
 static int do_read(pa_pstream *p);
+static void stop_io(pa_pstream *p);
+static void deliver_notify(pa_pstream *p, int type);
 
 static void do_pstream_read_write(pa_pstream *p) {
     pa_assert(p);
@@ -179,15 +276,26 @@ static void do_pstream_read_write(pa_pstream *p) {
 
     pa_pstream_ref(p);
 
-    p->mainloop->defer_enable(p->defer_event, 0);
+    p->io_mainloop->defer_enable(p->defer_event, 0);
 
-    if (!p->dead && pa_iochannel_is_readable(p->io)) {
-        if (do_read(p) < 0)
+    if (!p->read_srb) {
+        if (p->io && pa_iochannel_is_readable(p->io)) {
+            if (do_read(p) < 0)
+                goto fail;
+        } else if (p->io && pa_iochannel_is_hungup(p->io))
             goto fail;
-    } else if (!p->dead && pa_iochannel_is_hungup(p->io))
+
+    } else if (p->io && pa_iochannel_is_readable(p->io))
+        /* The peer only uses the ring now, so this means it went away
+         * or misbehaves */
         goto fail;
 
-    while (!p->dead && pa_iochannel_is_writable(p->io)) {
+    /* Also right after the switch frame came in over the socket */
+    if (p->io && p->read_srb && p->srb)
+        if (do_read(p) < 0)
+            goto fail;
+
+    while (p->io && (p->write_srb || pa_iochannel_is_writable(p->io))) {
         int r = do_write(p);
         if (r < 0)
             goto fail;
@@ -200,10 +308,17 @@ static void do_pstream_read_write(pa_pstream *p) {
 
 fail:
 
-    if (p->die_callback)
-        p->die_callback(p, p->die_callback_userdata);
+    if (p->thread) {
+        /* The main loop is told after everything received before */
+        stop_io(p);
+        deliver_notify(p, PA_PSTREAM_ITEM_DIE);
+    } else {
+        if (p->die_callback)
+            p->die_callback(p, p->die_callback_userdata);
+
+        pa_pstream_unlink(p);
+    }
 
-    pa_pstream_unlink(p);
     pa_pstream_unref(p);
 }
 
@@ -217,20 +332,30 @@ static void io_callback(pa_iochannel*io, void *userdata) {
     do_pstream_read_write(p);
 }
 
+static void srb_callback(pa_srbchannel *srb, void *userdata) {
+    pa_pstream *p = userdata;
+
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(p->srb == srb);
+
+    do_pstream_read_write(p);
+}
+
 static void defer_callback(pa_mainloop_api *m, pa_defer_event *e, void*userdata) {
     pa_pstream *p = userdata;
 
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
     pa_assert(p->defer_event == e);
-    pa_assert(p->mainloop == m);
+    pa_assert(p->io_mainloop == m);
 
     do_pstream_read_write(p);
 }
 
 static void memimport_release_cb(pa_memimport *i, uint32_t block_id, void *userdata);
 
-pa_pstream *pa_pstream_new(pa_mainloop_api *m, pa_iochannel *io, pa_mempool *pool) {
+static pa_pstream *pstream_new(pa_mainloop_api *m, pa_iochannel *io, pa_mempool *pool, pa_pstream_thread *t) {
     pa_pstream *p;
 
     pa_assert(m);
@@ -244,22 +369,52 @@ pa_pstream *pa_pstream_new(pa_mainloop_api *m, pa_iochannel *io, pa_mempool *poo
     p->dead = FALSE;
 
     p->mainloop = m;
-    p->defer_event = m->defer_new(m, defer_callback, p);
-    m->defer_enable(p->defer_event, 0);
+    p->thread = t;
+
+    if (t) {
+        /* The thread sets up its side of things itself */
+        p->io_mainloop = t->mainloop;
+        p->defer_event = NULL;
+        pa_iochannel_set_mainloop_api(io, NULL);
+
+        p->mutex = pa_mutex_new(FALSE, FALSE);
+        p->receive_queue = pa_queue_new();
+    } else {
+        p->io_mainloop = m;
+        p->defer_event = m->defer_new(m, defer_callback, p);
+        m->defer_enable(p->defer_event, 0);
+
+        p->mutex = NULL;
+        p->receive_queue = NULL;
+    }
+
+    pa_atomic_store(&p->n_received, 0);
+    pa_atomic_store(&p->n_pending, 0);
+    pa_atomic_store(&p->kick_pending, 0);
+    pa_atomic_store(&p->dispatch_pending, 0);
 
     p->send_queue = pa_queue_new();
 
-    p->write.current = NULL;
+    p->write.n_batch = 0;
     p->write.index = 0;
-    pa_memchunk_reset(&p->write.memchunk);
-    p->read.memblock = NULL;
     p->read.packet = NULL;
     p->read.index = 0;
+    p->read.buffer = NULL;
+    p->read.buffer_index = p->read.buffer_length = 0;
+    p->read.received = p->read.frame_start = 0;
+
+    p->srb = NULL;
+    p->write_srb = p->read_srb = FALSE;
+    p->srb_request = NULL;
+    p->srb_requested = FALSE;
+    pa_atomic_store(&p->srb_expected, 0);
 
     p->receive_packet_callback = NULL;
     p->receive_packet_callback_userdata = NULL;
     p->receive_memblock_callback = NULL;
     p->receive_memblock_callback_userdata = NULL;
+    p->receive_memblock_thread_callback = NULL;
+    p->receive_memblock_thread_callback_userdata = NULL;
     p->drain_callback = NULL;
     p->drain_callback_userdata = NULL;
     p->die_callback = NULL;
@@ -271,32 +426,116 @@ pa_pstream *pa_pstream_new(pa_mainloop_api *m, pa_iochannel *io, pa_mempool *poo
 
     p->mempool = pool;
 
-    p->use_shm = FALSE;
+    p->use_shm = p->shm_request = FALSE;
     p->export = NULL;
 
     /* We do importing unconditionally */
     p->import = pa_memimport_new(p->mempool, memimport_release_cb, p);
 
+    p->codec_mutex = pa_mutex_new(FALSE, FALSE);
+    p->encoders = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+    p->decoders = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+
     pa_iochannel_socket_set_rcvbuf(io, pa_mempool_block_size_max(p->mempool));
     pa_iochannel_socket_set_sndbuf(io, pa_mempool_block_size_max(p->mempool));
 
 #ifdef HAVE_CREDS
-    p->send_creds_now = FALSE;
     p->read_creds_valid = FALSE;
+    p->read.buffer_creds_valid = FALSE;
+    p->read.nfd = 0;
 #endif
     return p;
 }
 
+pa_pstream *pa_pstream_new(pa_mainloop_api *m, pa_iochannel *io, pa_mempool *pool) {
+    return pstream_new(m, io, pool, NULL);
+}
+
+/* Called from the IO thread */
+static void attach_cb(void *userdata) {
+    pa_pstream *p = userdata;
+
+    pa_assert(p);
+    pa_assert(p->io);
+
+    pa_iochannel_set_mainloop_api(p->io, p->io_mainloop);
+
+    /* Enabled right away, since the socket might have become readable
+     * before the events were moved over */
+    p->defer_event = p->io_mainloop->defer_new(p->io_mainloop, defer_callback, p);
+}
+
+static void free_shm(pa_pstream *p) {
+
+    if (p->import) {
+        pa_memimport_free(p->import);
+        p->import = NULL;
+    }
+
+    if (p->export) {
+        pa_memexport_free(p->export);
+        p->export = NULL;
+    }
+}
+
+/* Called from main context, once the thread has let go of the
+ * pstream */
+static void detach_done_cb(void *userdata) {
+    pa_pstream *p = userdata;
+
+    pa_assert(p);
+    pa_assert(p->dead);
+
+    free_shm(p);
+
+    /* Drops the thread's reference */
+    pa_pstream_unref(p);
+}
+
+/* Called from the IO thread */
+static void detach_cb(void *userdata) {
+    pa_pstream *p = userdata;
+
+    pa_assert(p);
+
+    stop_io(p);
+
+    /* Queued behind anything the thread delivered before */
+    p->thread->run_main(p->thread, detach_done_cb, p);
+}
+
+pa_pstream *pa_pstream_new_threaded(pa_mainloop_api *m, pa_iochannel *io, pa_mempool *pool, pa_pstream_thread *t) {
+    pa_pstream *p;
+
+    pa_assert(t);
+    pa_assert(t->mainloop);
+
+    p = pstream_new(m, io, pool, t);
+
+    /* This reference belongs to the thread and is dropped when the
+     * pstream is unlinked */
+    pa_pstream_ref(p);
+    t->run(t, attach_cb, p, FALSE);
+
+    return p;
+}
+
 static void item_free(void *item) {
     struct item_info *i = item;
     pa_assert(i);
 
     if (i->type == PA_PSTREAM_ITEM_MEMBLOCK) {
-        pa_assert(i->chunk.memblock);
-        pa_memblock_unref(i->chunk.memblock);
+        /* Received SHM blocks that failed to import have none */
+        if (i->chunk.memblock)
+            pa_memblock_unref(i->chunk.memblock);
     } else if (i->type == PA_PSTREAM_ITEM_PACKET) {
         pa_assert(i->packet);
         pa_packet_unref(i->packet);
+
+#ifdef HAVE_CREDS
+        if (i->with_ancil_data)
+            pa_cmsg_ancil_data_close_fds(&i->ancil_data);
+#endif
     }
 
     if (pa_flist_push(PA_STATIC_FLIST_GET(items), i) < 0)
@@ -304,28 +543,96 @@ static void item_free(void *item) {
 }
 
 static void pstream_free(pa_pstream *p) {
+    unsigned k;
+
     pa_assert(p);
 
     pa_pstream_unlink(p);
 
     pa_queue_free(p->send_queue, item_free);
 
-    if (p->write.current)
-        item_free(p->write.current);
+    if (p->receive_queue)
+        pa_queue_free(p->receive_queue, item_free);
+
+    if (p->mutex)
+        pa_mutex_free(p->mutex);
 
-    if (p->write.memchunk.memblock)
-        pa_memblock_unref(p->write.memchunk.memblock);
+    pa_hashmap_free(p->encoders, (pa_free_cb_t) pa_codec_free);
+    pa_hashmap_free(p->decoders, (pa_free_cb_t) pa_codec_free);
+    pa_mutex_free(p->codec_mutex);
 
-    if (p->read.memblock)
-        pa_memblock_unref(p->read.memblock);
+    for (k = 0; k < p->write.n_batch; k++)
+        item_free(p->write.batch[k]);
+
+    if (p->read.buffer)
+        pa_memblock_unref(p->read.buffer);
 
     if (p->read.packet)
         pa_packet_unref(p->read.packet);
 
+#ifdef HAVE_CREDS
+    while (p->read.nfd > 0)
+        pa_close(p->read.fds[--p->read.nfd]);
+#endif
+
     pa_xfree(p);
 }
 
-void pa_pstream_send_packet(pa_pstream*p, pa_packet *packet, const pa_creds *creds) {
+static void push_item(pa_pstream *p, struct item_info *i) {
+
+    if (!p->thread) {
+        pa_queue_push(p->send_queue, i);
+        return;
+    }
+
+    /* Counted before the thread can possibly retire it */
+    pa_atomic_inc(&p->n_pending);
+
+    pa_mutex_lock(p->mutex);
+    pa_queue_push(p->send_queue, i);
+    pa_mutex_unlock(p->mutex);
+}
+
+/* Called from the IO thread */
+static struct item_info *pop_item(pa_pstream *p) {
+    struct item_info *i;
+
+    if (!p->thread)
+        return pa_queue_pop(p->send_queue);
+
+    pa_mutex_lock(p->mutex);
+    i = pa_queue_pop(p->send_queue);
+    pa_mutex_unlock(p->mutex);
+
+    return i;
+}
+
+/* Called from the IO thread */
+static void kick_cb(void *userdata) {
+    pa_pstream *p = userdata;
+
+    pa_assert(p);
+
+    /* Everything pushed after this will cause another kick */
+    pa_atomic_store(&p->kick_pending, 0);
+
+    if (p->defer_event)
+        p->io_mainloop->defer_enable(p->defer_event, 1);
+}
+
+/* Makes sure the socket is looked at again after items were pushed */
+static void wakeup_io(pa_pstream *p) {
+
+    if (!p->thread) {
+        p->mainloop->defer_enable(p->defer_event, 1);
+        return;
+    }
+
+    if (pa_atomic_cmpxchg(&p->kick_pending, 0, 1))
+        p->thread->run(p->thread, kick_cb, p, FALSE);
+}
+
+void pa_pstream_send_packet(pa_pstream*p, pa_packet *packet, const pa_cmsg_ancil_data *ancil_data) {
     struct item_info *i;
 
     pa_assert(p);
@@ -342,18 +649,108 @@ void pa_pstream_send_packet(pa_pstream*p, pa_packet *packet, const pa_creds *cre
     i->packet = pa_packet_ref(packet);
 
 #ifdef HAVE_CREDS
-    if ((i->with_creds = !!creds))
-        i->creds = *creds;
+    if ((i->with_ancil_data = !!ancil_data)) {
+        int k;
+
+        i->ancil_data = *ancil_data;
+
+        /* We may be sending them long after the caller closed them */
+        for (k = 0; k < ancil_data->nfd; k++)
+            if ((i->ancil_data.fds[k] = pa_dup_cloexec(ancil_data->fds[k])) < 0) {
+                pa_log_warn("Failed to duplicate file descriptor: %s", pa_cstrerror(errno));
+                i->ancil_data.nfd = k;
+                break;
+            }
+    }
 #endif
 
-    pa_queue_push(p->send_queue, i);
+    push_item(p, i);
+    wakeup_io(p);
+}
+
+static void push_memblock_item(pa_pstream *p, uint32_t channel, int64_t offset, pa_seek_mode_t seek_mode, const pa_memchunk *chunk, pa_bool_t encoded) {
+    struct item_info *i;
+
+    if (!(i = pa_flist_pop(PA_STATIC_FLIST_GET(items))))
+        i = pa_xnew(struct item_info, 1);
+    i->type = PA_PSTREAM_ITEM_MEMBLOCK;
+
+    i->chunk = *chunk;
+    pa_memblock_ref(i->chunk.memblock);
+
+    i->channel = channel;
+    i->offset = offset;
+    i->seek_mode = seek_mode;
+    i->encoded = encoded;
+#ifdef HAVE_CREDS
+    i->with_ancil_data = FALSE;
+#endif
+
+    push_item(p, i);
+}
+
+/* Returns FALSE if the piece couldn't be encoded and has to be sent as
+ * it is */
+static pa_bool_t send_encoded(pa_pstream *p, uint32_t channel, pa_codec *encoder, const pa_memchunk *piece) {
+    pa_memchunk block;
+    size_t size;
+    void *src, *dst;
+
+    size = pa_codec_max_encoded_size(encoder, piece->length);
+
+    block.memblock = pa_memblock_new(p->mempool, PA_MAX(size, 1U));
+    block.index = 0;
+
+    src = pa_memblock_acquire(piece->memblock);
+    dst = pa_memblock_acquire(block.memblock);
+    block.length = pa_codec_encode(encoder, (uint8_t*) src + piece->index, piece->length, dst, size);
+    pa_memblock_release(block.memblock);
+    pa_memblock_release(piece->memblock);
+
+    if (block.length == (size_t) -1) {
+        pa_memblock_unref(block.memblock);
+        return FALSE;
+    }
+
+    codec_stat_add(piece->length, block.length);
+
+    /* Otherwise the encoder kept it for the next block */
+    if (block.length > 0)
+        push_memblock_item(p, channel, 0, PA_SEEK_RELATIVE, &block, TRUE);
+
+    pa_memblock_unref(block.memblock);
+    return TRUE;
+}
+
+/* Sends what the encoder kept back as a block of its own */
+static void flush_encoder(pa_pstream *p, uint32_t channel, pa_codec *encoder) {
+    pa_memchunk block;
+    size_t size;
+    void *dst;
+
+    size = pa_codec_max_encoded_size(encoder, 0);
+
+    block.memblock = pa_memblock_new(p->mempool, size);
+    block.index = 0;
 
-    p->mainloop->defer_enable(p->defer_event, 1);
+    dst = pa_memblock_acquire(block.memblock);
+    block.length = pa_codec_flush(encoder, dst, size);
+    pa_memblock_release(block.memblock);
+
+    if (block.length == (size_t) -1)
+        pa_log_warn("Failed to flush the encoder of channel %u.", channel);
+    else if (block.length > 0) {
+        codec_stat_add(0, block.length);
+        push_memblock_item(p, channel, 0, PA_SEEK_RELATIVE, &block, TRUE);
+    }
+
+    pa_memblock_unref(block.memblock);
 }
 
 void pa_pstream_send_memblock(pa_pstream*p, uint32_t channel, int64_t offset, pa_seek_mode_t seek_mode, const pa_memchunk *chunk) {
     size_t length, idx;
     size_t bsm;
+    pa_codec *encoder;
 
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
@@ -368,33 +765,32 @@ void pa_pstream_send_memblock(pa_pstream*p, uint32_t channel, int64_t offset, pa
 
     bsm = pa_mempool_block_size_max(p->mempool);
 
-    while (length > 0) {
-        struct item_info *i;
-        size_t n;
+    /* Only the main loop touches the encoders, so no need to lock.
+     * Encoding blocks are decoded as a whole, so seeking in the middle
+     * of what the encoder kept back isn't possible. What it kept back
+     * has to go out first, though, or it would end up after this. */
+    encoder = pa_hashmap_get(p->encoders, PA_UINT32_TO_PTR(channel));
 
-        if (!(i = pa_flist_pop(PA_STATIC_FLIST_GET(items))))
-            i = pa_xnew(struct item_info, 1);
-        i->type = PA_PSTREAM_ITEM_MEMBLOCK;
+    if (encoder && (p->use_shm || offset != 0 || seek_mode != PA_SEEK_RELATIVE)) {
+        flush_encoder(p, channel, encoder);
+        encoder = NULL;
+    }
 
-        n = PA_MIN(length, bsm);
-        i->chunk.index = chunk->index + idx;
-        i->chunk.length = n;
-        i->chunk.memblock = pa_memblock_ref(chunk->memblock);
+    while (length > 0) {
+        pa_memchunk piece;
 
-        i->channel = channel;
-        i->offset = offset;
-        i->seek_mode = seek_mode;
-#ifdef HAVE_CREDS
-        i->with_creds = FALSE;
-#endif
+        piece.memblock = chunk->memblock;
+        piece.index = chunk->index + idx;
+        piece.length = PA_MIN(length, bsm);
 
-        pa_queue_push(p->send_queue, i);
+        if (!encoder || !send_encoded(p, channel, encoder, &piece))
+            push_memblock_item(p, channel, offset, seek_mode, &piece, FALSE);
 
-        idx += n;
-        length -= n;
+        idx += piece.length;
+        length -= piece.length;
     }
 
-    p->mainloop->defer_enable(p->defer_event, 1);
+    wakeup_io(p);
 }
 
 void pa_pstream_send_release(pa_pstream *p, uint32_t block_id) {
@@ -412,11 +808,11 @@ void pa_pstream_send_release(pa_pstream *p, uint32_t block_id) {
     item->type = PA_PSTREAM_ITEM_SHMRELEASE;
     item->block_id = block_id;
 #ifdef HAVE_CREDS
-    item->with_creds = FALSE;
+    item->with_ancil_data = FALSE;
 #endif
 
-    pa_queue_push(p->send_queue, item);
-    p->mainloop->defer_enable(p->defer_event, 1);
+    push_item(p, item);
+    wakeup_io(p);
 }
 
 /* might be called from thread context */
@@ -449,11 +845,11 @@ void pa_pstream_send_revoke(pa_pstream *p, uint32_t block_id) {
     item->type = PA_PSTREAM_ITEM_SHMREVOKE;
     item->block_id = block_id;
 #ifdef HAVE_CREDS
-    item->with_creds = FALSE;
+    item->with_ancil_data = FALSE;
 #endif
 
-    pa_queue_push(p->send_queue, item);
-    p->mainloop->defer_enable(p->defer_event, 1);
+    push_item(p, item);
+    wakeup_io(p);
 }
 
 /* might be called from thread context */
@@ -469,435 +865,894 @@ static void memexport_revoke_cb(pa_memexport *e, uint32_t block_id, void *userda
         pa_pstream_send_revoke(p, block_id);
 }
 
-static void prepare_next_write_item(pa_pstream *p) {
+static void prepare_write_item(pa_pstream *p, struct item_info *i) {
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(i);
 
-    p->write.current = pa_queue_pop(p->send_queue);
+    i->shm_payload = FALSE;
 
-    if (!p->write.current)
-        return;
-    p->write.index = 0;
-    p->write.data = NULL;
-    p->write.minibuf_validsize = 0;
-    pa_memchunk_reset(&p->write.memchunk);
+    i->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = 0;
+    i->descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL] = htonl((uint32_t) -1);
+    i->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = 0;
+    i->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = 0;
+    i->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = 0;
 
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = 0;
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL] = htonl((uint32_t) -1);
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = 0;
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = 0;
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = 0;
+    if (i->type == PA_PSTREAM_ITEM_PACKET) {
 
-    if (p->write.current->type == PA_PSTREAM_ITEM_PACKET) {
+        pa_assert(i->packet);
+        i->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl((uint32_t) i->packet->length);
 
-        pa_assert(p->write.current->packet);
-        p->write.data = p->write.current->packet->data;
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl((uint32_t) p->write.current->packet->length);
+    } else if (i->type == PA_PSTREAM_ITEM_SHMRELEASE) {
 
-        if (p->write.current->packet->length <= MINIBUF_SIZE - PA_PSTREAM_DESCRIPTOR_SIZE) {
-            memcpy(&p->write.minibuf[PA_PSTREAM_DESCRIPTOR_SIZE], p->write.data, p->write.current->packet->length);
-            p->write.minibuf_validsize = PA_PSTREAM_DESCRIPTOR_SIZE + p->write.current->packet->length;
-        }
+        i->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SHMRELEASE);
+        i->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl(i->block_id);
 
-    } else if (p->write.current->type == PA_PSTREAM_ITEM_SHMRELEASE) {
+    } else if (i->type == PA_PSTREAM_ITEM_SHMREVOKE) {
 
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SHMRELEASE);
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl(p->write.current->block_id);
+        i->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SHMREVOKE);
+        i->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl(i->block_id);
 
-    } else if (p->write.current->type == PA_PSTREAM_ITEM_SHMREVOKE) {
+    } else if (i->type == PA_PSTREAM_ITEM_SRBSWITCH) {
 
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SHMREVOKE);
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl(p->write.current->block_id);
+        i->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SRBSWITCH);
 
     } else {
         uint32_t flags;
-        pa_bool_t send_payload = TRUE;
 
-        pa_assert(p->write.current->type == PA_PSTREAM_ITEM_MEMBLOCK);
-        pa_assert(p->write.current->chunk.memblock);
+        pa_assert(i->type == PA_PSTREAM_ITEM_MEMBLOCK);
+        pa_assert(i->chunk.memblock);
+
+        i->descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL] = htonl(i->channel);
+        i->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl((uint32_t) (((uint64_t) i->offset) >> 32));
+        i->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = htonl((uint32_t) ((uint64_t) i->offset));
 
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL] = htonl(p->write.current->channel);
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl((uint32_t) (((uint64_t) p->write.current->offset) >> 32));
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = htonl((uint32_t) ((uint64_t) p->write.current->offset));
+        flags = (uint32_t) (i->seek_mode & PA_FLAG_SEEKMASK);
 
-        flags = (uint32_t) (p->write.current->seek_mode & PA_FLAG_SEEKMASK);
+        if (i->encoded)
+            flags |= PA_FLAG_CODEC;
 
-        if (p->use_shm) {
+        else if (p->use_shm) {
             uint32_t block_id, shm_id;
             size_t offset, length;
-            uint32_t *shm_info = (uint32_t *) &p->write.minibuf[PA_PSTREAM_DESCRIPTOR_SIZE];
-            size_t shm_size = sizeof(uint32_t) * PA_PSTREAM_SHM_MAX;
 
             pa_assert(p->export);
 
             if (pa_memexport_put(p->export,
-                                 p->write.current->chunk.memblock,
+                                 i->chunk.memblock,
                                  &block_id,
                                  &shm_id,
                                  &offset,
                                  &length) >= 0) {
 
                 flags |= PA_FLAG_SHMDATA;
-                send_payload = FALSE;
+                i->shm_payload = TRUE;
 
-                shm_info[PA_PSTREAM_SHM_BLOCKID] = htonl(block_id);
-                shm_info[PA_PSTREAM_SHM_SHMID] = htonl(shm_id);
-                shm_info[PA_PSTREAM_SHM_INDEX] = htonl((uint32_t) (offset + p->write.current->chunk.index));
-                shm_info[PA_PSTREAM_SHM_LENGTH] = htonl((uint32_t) p->write.current->chunk.length);
+                i->shm_info[PA_PSTREAM_SHM_BLOCKID] = htonl(block_id);
+                i->shm_info[PA_PSTREAM_SHM_SHMID] = htonl(shm_id);
+                i->shm_info[PA_PSTREAM_SHM_INDEX] = htonl((uint32_t) (offset + i->chunk.index));
+                i->shm_info[PA_PSTREAM_SHM_LENGTH] = htonl((uint32_t) i->chunk.length);
 
-                p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl(shm_size);
-                p->write.minibuf_validsize = PA_PSTREAM_DESCRIPTOR_SIZE + shm_size;
+                i->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl(sizeof(i->shm_info));
             }
 /*             else */
 /*                 pa_log_warn("Failed to export memory block."); */
         }
 
-        if (send_payload) {
-            p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl((uint32_t) p->write.current->chunk.length);
-            p->write.memchunk = p->write.current->chunk;
-            pa_memblock_ref(p->write.memchunk.memblock);
-            p->write.data = NULL;
-        }
+        if (!i->shm_payload)
+            i->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl((uint32_t) i->chunk.length);
 
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(flags);
+        i->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(flags);
     }
+}
 
-#ifdef HAVE_CREDS
-    if ((p->send_creds_now = p->write.current->with_creds))
-        p->write_creds = p->write.current->creds;
-#endif
+static size_t write_item_size(struct item_info *i) {
+    return PA_PSTREAM_DESCRIPTOR_SIZE + ntohl(i->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]);
 }
 
+/* Sends as many of the queued items as possible, descriptors and
+ * payloads alike, with a single writev(). Returns 1 if everything that
+ * was tried could be written, 0 if the socket is full or there is
+ * nothing to write, and -1 on error. */
 static int do_write(pa_pstream *p) {
-    void *d;
-    size_t l;
+    struct iovec iov[WRITE_BATCH_MAX * 2];
+    pa_memblock *acquired[WRITE_BATCH_MAX];
+    unsigned n_iov = 0, n_acquired = 0, n_done = 0, k;
+    size_t l = 0, skip;
     ssize_t r;
-    pa_memblock *release_memblock = NULL;
 
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
 
-    if (!p->write.current)
-        prepare_next_write_item(p);
+    while (p->write.n_batch < WRITE_BATCH_MAX) {
+        struct item_info *i;
 
-    if (!p->write.current)
-        return 0;
+        if (!(i = pop_item(p)))
+            break;
 
-    if (p->write.minibuf_validsize > 0) {
-        d = p->write.minibuf + p->write.index;
-        l = p->write.minibuf_validsize - p->write.index;
-    } else if (p->write.index < PA_PSTREAM_DESCRIPTOR_SIZE) {
-        d = (uint8_t*) p->write.descriptor + p->write.index;
-        l = PA_PSTREAM_DESCRIPTOR_SIZE - p->write.index;
-    } else {
-        pa_assert(p->write.data || p->write.memchunk.memblock);
+        prepare_write_item(p, i);
+        p->write.batch[p->write.n_batch++] = i;
+    }
 
-        if (p->write.data)
-            d = p->write.data;
-        else {
-            d = pa_memblock_acquire_chunk(&p->write.memchunk);
-            release_memblock = p->write.memchunk.memblock;
-        }
+    if (p->write.n_batch <= 0)
+        return 0;
 
-        d = (uint8_t*) d + p->write.index - PA_PSTREAM_DESCRIPTOR_SIZE;
-        l = ntohl(p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]) - (p->write.index - PA_PSTREAM_DESCRIPTOR_SIZE);
-    }
+    skip = p->write.index;
 
-    pa_assert(l > 0);
+    for (k = 0; k < p->write.n_batch; k++) {
+        struct item_info *i = p->write.batch[k];
+        size_t length;
 
 #ifdef HAVE_CREDS
-    if (p->send_creds_now) {
+        /* Ancillary data is attached to a whole sendmsg(), so an item
+         * carrying it has to start a new one */
+        if (k > 0 && i->with_ancil_data && !p->write_srb)
+            break;
 
-        if ((r = pa_iochannel_write_with_creds(p->io, d, l, &p->write_creds)) < 0)
-            goto fail;
+        /* And one carrying file descriptors has to end it, so that the
+         * receiver can tell which frame they came with */
+        if (k > 0 && p->write.batch[k-1]->with_ancil_data && p->write.batch[k-1]->ancil_data.nfd > 0 && !p->write_srb)
+            break;
 
-        p->send_creds_now = FALSE;
-    } else
+        if (p->write_srb && i->with_ancil_data && i->ancil_data.nfd > 0) {
+            pa_log_warn("Dropping file descriptors sent after the switch to the shared ring.");
+            pa_cmsg_ancil_data_close_fds(&i->ancil_data);
+        }
 #endif
 
-    if ((r = pa_iochannel_write(p->io, d, l)) < 0)
-        goto fail;
+        /* Nothing after the switch may go out on the socket */
+        if (k > 0 && p->write.batch[k-1]->type == PA_PSTREAM_ITEM_SRBSWITCH)
+            break;
 
-    if (release_memblock)
-        pa_memblock_release(release_memblock);
+        if (skip < PA_PSTREAM_DESCRIPTOR_SIZE) {
+            iov[n_iov].iov_base = (uint8_t*) i->descriptor + skip;
+            iov[n_iov].iov_len = PA_PSTREAM_DESCRIPTOR_SIZE - skip;
+            l += iov[n_iov++].iov_len;
+            skip = 0;
+        } else
+            skip -= PA_PSTREAM_DESCRIPTOR_SIZE;
 
-    p->write.index += (size_t) r;
+        length = ntohl(i->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]);
 
-    if (p->write.index >= PA_PSTREAM_DESCRIPTOR_SIZE + ntohl(p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH])) {
-        pa_assert(p->write.current);
-        item_free(p->write.current);
-        p->write.current = NULL;
+        if (length > 0) {
+            void *d;
 
-        if (p->write.memchunk.memblock)
-            pa_memblock_unref(p->write.memchunk.memblock);
+            if (i->type == PA_PSTREAM_ITEM_PACKET)
+                d = i->packet->data;
+            else if (i->shm_payload)
+                d = i->shm_info;
+            else {
+                pa_assert(i->type == PA_PSTREAM_ITEM_MEMBLOCK);
 
-        pa_memchunk_reset(&p->write.memchunk);
+                d = pa_memblock_acquire_chunk(&i->chunk);
+                acquired[n_acquired++] = i->chunk.memblock;
+            }
 
-        if (p->drain_callback && !pa_pstream_is_pending(p))
-            p->drain_callback(p, p->drain_callback_userdata);
+            pa_assert(skip < length);
+
+            iov[n_iov].iov_base = (uint8_t*) d + skip;
+            iov[n_iov].iov_len = length - skip;
+            l += iov[n_iov++].iov_len;
+            skip = 0;
+        }
     }
 
-    return (size_t) r == l ? 1 : 0;
+    pa_assert(n_iov > 0);
+    pa_assert(l > 0);
 
-fail:
+    if (p->write_srb)
+        r = pa_srbchannel_writev(p->srb, iov, (int) n_iov);
+    else {
 
-    if (release_memblock)
-        pa_memblock_release(release_memblock);
+#ifdef HAVE_CREDS
+        if (p->write.batch[0]->with_ancil_data && p->write.index == 0)
+            r = pa_iochannel_writev_with_ancil_data(p->io, iov, (int) n_iov, &p->write.batch[0]->ancil_data);
+        else
+#endif
+            r = pa_iochannel_writev(p->io, iov, (int) n_iov);
 
-    return -1;
-}
+        if (r >= 0)
+            pa_atomic_inc(&pstream_stat.n_write_calls);
+    }
 
-static int do_read(pa_pstream *p) {
-    void *d;
-    size_t l;
-    ssize_t r;
-    pa_memblock *release_memblock = NULL;
-    pa_assert(p);
-    pa_assert(PA_REFCNT_VALUE(p) > 0);
+    for (k = 0; k < n_acquired; k++)
+        pa_memblock_release(acquired[k]);
 
-    if (p->read.index < PA_PSTREAM_DESCRIPTOR_SIZE) {
-        d = (uint8_t*) p->read.descriptor + p->read.index;
-        l = PA_PSTREAM_DESCRIPTOR_SIZE - p->read.index;
-    } else {
-        pa_assert(p->read.data || p->read.memblock);
+    if (r < 0)
+        return -1;
 
-        if (p->read.data)
-            d = p->read.data;
-        else {
-            d = pa_memblock_acquire(p->read.memblock);
-            release_memblock = p->read.memblock;
-        }
+    /* Retire everything that went out completely */
+    p->write.index += (size_t) r;
 
-        d = (uint8_t*) d + p->read.index - PA_PSTREAM_DESCRIPTOR_SIZE;
-        l = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]) - (p->read.index - PA_PSTREAM_DESCRIPTOR_SIZE);
-    }
+    while (n_done < p->write.n_batch && p->write.index >= write_item_size(p->write.batch[n_done])) {
+        p->write.index -= write_item_size(p->write.batch[n_done]);
 
-#ifdef HAVE_CREDS
-    {
-        pa_bool_t b = 0;
+        if (p->write.batch[n_done]->type == PA_PSTREAM_ITEM_SRBSWITCH) {
+            pa_assert(p->srb);
+            p->write_srb = TRUE;
+        }
 
-        if ((r = pa_iochannel_read_with_creds(p->io, d, l, &p->read_creds, &b)) <= 0)
-            goto fail;
+        item_free(p->write.batch[n_done]);
+        n_done++;
 
-        p->read_creds_valid = p->read_creds_valid || b;
+        if (p->thread && pa_atomic_dec(&p->n_pending) <= 1)
+            deliver_notify(p, PA_PSTREAM_ITEM_DRAIN);
     }
-#else
-    if ((r = pa_iochannel_read(p->io, d, l)) <= 0)
-        goto fail;
-#endif
 
-    if (release_memblock)
-        pa_memblock_release(release_memblock);
+    if (n_done > 0) {
+        p->write.n_batch -= n_done;
+        memmove(p->write.batch, p->write.batch + n_done, p->write.n_batch * sizeof(struct item_info*));
 
-    p->read.index += (size_t) r;
+        pa_atomic_add(&pstream_stat.n_frames_sent, (int) n_done);
 
-    if (p->read.index == PA_PSTREAM_DESCRIPTOR_SIZE) {
-        uint32_t flags, length, channel;
-        /* Reading of frame descriptor complete */
+        if (!p->thread && p->drain_callback && !pa_pstream_is_pending(p))
+            p->drain_callback(p, p->drain_callback_userdata);
+    }
 
-        flags = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]);
+    return (size_t) r == l ? 1 : 0;
+}
 
-        if (!p->use_shm && (flags & PA_FLAG_SHMMASK) != 0) {
-            pa_log_warn("Received SHM frame on a socket where SHM is disabled.");
-            return -1;
-        }
+/* Called from the main loop */
+static void dispatch_cb(void *userdata) {
+    pa_pstream *p = userdata;
+    struct item_info *i;
 
-        if (flags == PA_FLAG_SHMRELEASE) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
 
-            /* This is a SHM memblock release frame with no payload */
+    /* Everything pushed after this will cause another dispatch */
+    pa_atomic_store(&p->dispatch_pending, 0);
 
-/*             pa_log("Got release frame for %u", ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])); */
+    while (!p->dead) {
 
-            pa_assert(p->export);
-            pa_memexport_process_release(p->export, ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI]));
+        pa_mutex_lock(p->mutex);
+        i = pa_queue_pop(p->receive_queue);
+        pa_mutex_unlock(p->mutex);
 
-            goto frame_done;
+        if (!i)
+            break;
 
-        } else if (flags == PA_FLAG_SHMREVOKE) {
+        switch (i->type) {
 
-            /* This is a SHM memblock revoke frame with no payload */
+            case PA_PSTREAM_ITEM_PACKET:
+                if (p->receive_packet_callback)
+#ifdef HAVE_CREDS
+                    p->receive_packet_callback(p, i->packet, i->with_ancil_data ? &i->ancil_data : NULL, p->receive_packet_callback_userdata);
+#else
+                    p->receive_packet_callback(p, i->packet, NULL, p->receive_packet_callback_userdata);
+#endif
+                break;
 
-/*             pa_log("Got revoke frame for %u", ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])); */
+            case PA_PSTREAM_ITEM_MEMBLOCK:
+                if (p->receive_memblock_callback)
+                    p->receive_memblock_callback(p, i->channel, i->offset, i->seek_mode, &i->chunk, p->receive_memblock_callback_userdata);
+                break;
 
-            pa_assert(p->import);
-            pa_memimport_process_revoke(p->import, ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI]));
+            case PA_PSTREAM_ITEM_DRAIN:
+                if (p->drain_callback && !pa_pstream_is_pending(p))
+                    p->drain_callback(p, p->drain_callback_userdata);
+                break;
 
-            goto frame_done;
-        }
+            case PA_PSTREAM_ITEM_DIE:
+                if (p->die_callback)
+                    p->die_callback(p, p->die_callback_userdata);
 
-        length = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]);
+                pa_pstream_unlink(p);
+                break;
 
-        if (length > FRAME_SIZE_MAX_ALLOW || length <= 0) {
-            pa_log_warn("Received invalid frame size: %lu", (unsigned long) length);
-            return -1;
+            default:
+                pa_assert_not_reached();
         }
 
-        pa_assert(!p->read.packet && !p->read.memblock);
+        item_free(i);
+        pa_atomic_dec(&p->n_received);
+    }
 
-        channel = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]);
+    pa_pstream_unref(p);
+}
 
-        if (channel == (uint32_t) -1) {
+/* Called from the IO thread */
+static void push_received(pa_pstream *p, struct item_info *i) {
 
-            if (flags != 0) {
-                pa_log_warn("Received packet frame with invalid flags value.");
-                return -1;
-            }
+    pa_atomic_inc(&p->n_received);
 
-            /* Frame is a packet frame */
-            p->read.packet = pa_packet_new(length);
-            p->read.data = p->read.packet->data;
+    pa_mutex_lock(p->mutex);
+    pa_queue_push(p->receive_queue, i);
+    pa_mutex_unlock(p->mutex);
 
-        } else {
+    if (pa_atomic_cmpxchg(&p->dispatch_pending, 0, 1)) {
+        /* Dropped in the main loop; we can't be holding the last
+         * reference since the thread's own is only dropped after the
+         * pstream has been detached from us */
+        pa_pstream_ref(p);
+        p->thread->run_main(p->thread, dispatch_cb, p);
+    }
+}
 
-            if ((flags & PA_FLAG_SEEKMASK) > PA_SEEK_RELATIVE_END) {
-                pa_log_warn("Received memblock frame with invalid seek mode.");
-                return -1;
-            }
+static struct item_info *item_new(int type) {
+    struct item_info *i;
 
-            if ((flags & PA_FLAG_SHMMASK) == PA_FLAG_SHMDATA) {
+    if (!(i = pa_flist_pop(PA_STATIC_FLIST_GET(items))))
+        i = pa_xnew(struct item_info, 1);
 
-                if (length != sizeof(p->read.shm_info)) {
-                    pa_log_warn("Received SHM memblock frame with invalid frame length.");
-                    return -1;
-                }
+    i->type = type;
+    i->encoded = FALSE;
+#ifdef HAVE_CREDS
+    i->with_ancil_data = FALSE;
+#endif
 
-                /* Frame is a memblock frame referencing an SHM memblock */
-                p->read.data = p->read.shm_info;
+    return i;
+}
 
-            } else if ((flags & PA_FLAG_SHMMASK) == 0) {
+static void deliver_notify(pa_pstream *p, int type) {
+    pa_assert(p->thread);
 
-                /* Frame is a memblock frame */
+    push_received(p, item_new(type));
+}
 
-                p->read.memblock = pa_memblock_new(p->mempool, length);
-                p->read.data = NULL;
-            } else {
+/* Takes over the file descriptors in ancil_data */
+static void deliver_packet(pa_pstream *p, pa_packet *packet, pa_cmsg_ancil_data *ancil_data) {
+    struct item_info *i;
 
-                pa_log_warn("Received memblock frame with invalid flags value.");
-                return -1;
-            }
+    if (!p->thread) {
+        if (p->receive_packet_callback)
+            p->receive_packet_callback(p, packet, ancil_data, p->receive_packet_callback_userdata);
+
+#ifdef HAVE_CREDS
+        if (ancil_data)
+            pa_cmsg_ancil_data_close_fds(ancil_data);
+#endif
+        return;
+    }
+
+    i = item_new(PA_PSTREAM_ITEM_PACKET);
+    i->packet = pa_packet_ref(packet);
+#ifdef HAVE_CREDS
+    if ((i->with_ancil_data = !!ancil_data))
+        i->ancil_data = *ancil_data;
+#endif
+
+    push_received(p, i);
+}
+
+static void deliver_memblock(pa_pstream *p, uint32_t channel, int64_t offset, pa_seek_mode_t seek_mode, const pa_memchunk *chunk) {
+    struct item_info *i;
+
+    if (!p->thread) {
+        if (p->receive_memblock_callback)
+            p->receive_memblock_callback(p, channel, offset, seek_mode, chunk, p->receive_memblock_callback_userdata);
+        return;
+    }
+
+    /* Nothing that came in before this frame is still waiting for the
+     * main loop, so the frame may bypass it. */
+    if (pa_atomic_load(&p->n_received) == 0) {
+        pa_bool_t taken;
+
+        /* Held across the call, so that pa_pstream_unlink() can be
+         * sure the callback isn't running anymore */
+        pa_mutex_lock(p->mutex);
+        taken = p->receive_memblock_thread_callback &&
+            p->receive_memblock_thread_callback(p, channel, offset, seek_mode, chunk, p->receive_memblock_thread_callback_userdata);
+        pa_mutex_unlock(p->mutex);
+
+        if (taken) {
+            pa_atomic_inc(&pstream_stat.n_memblocks_direct);
+            return;
         }
+    }
 
-    } else if (p->read.index > PA_PSTREAM_DESCRIPTOR_SIZE) {
-        /* Frame payload available */
+    i = item_new(PA_PSTREAM_ITEM_MEMBLOCK);
+    i->channel = channel;
+    i->offset = offset;
+    i->seek_mode = seek_mode;
+    i->chunk = *chunk;
 
-        if (p->read.memblock && p->receive_memblock_callback) {
+    if (i->chunk.memblock)
+        pa_memblock_ref(i->chunk.memblock);
 
-            /* Is this memblock data? Than pass it to the user */
-            l = (p->read.index - (size_t) r) < PA_PSTREAM_DESCRIPTOR_SIZE ? (size_t) (p->read.index - PA_PSTREAM_DESCRIPTOR_SIZE) : (size_t) r;
+    push_received(p, i);
+}
 
-            if (l > 0) {
-                pa_memchunk chunk;
+/* Where in the stream the parser currently is */
+static uint64_t read_position(pa_pstream *p) {
+    return p->read.received - (p->read.buffer_length - p->read.buffer_index);
+}
 
-                chunk.memblock = p->read.memblock;
-                chunk.index = p->read.index - PA_PSTREAM_DESCRIPTOR_SIZE - l;
-                chunk.length = l;
+#ifdef HAVE_CREDS
+/* The sender gives a frame with file descriptors a write of its own,
+ * and the kernel ends a read right after the data they came with. So
+ * they belong to the frame that starts in the data of that read and
+ * doesn't end before it. */
+static pa_bool_t frame_owns_fds(pa_pstream *p) {
+    return p->read.nfd > 0 &&
+        p->read.frame_start >= p->read.fds_begin &&
+        read_position(p) >= p->read.fds_end;
+}
+#endif
 
-                if (p->receive_memblock_callback) {
-                    int64_t offset;
+static void frame_done(pa_pstream *p) {
+    pa_assert(p);
 
-                    offset = (int64_t) (
-                            (((uint64_t) ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])) << 32) |
-                            (((uint64_t) ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO]))));
+    pa_atomic_inc(&pstream_stat.n_frames_received);
 
-                    p->receive_memblock_callback(
-                        p,
-                        ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]),
-                        offset,
-                        ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SEEKMASK,
-                        &chunk,
-                        p->receive_memblock_callback_userdata);
-                }
+#ifdef HAVE_CREDS
+    /* They were sent with something that isn't a packet */
+    if (frame_owns_fds(p)) {
+        pa_log_warn("Dropping file descriptors received with a non-packet frame.");
+
+        while (p->read.nfd > 0)
+            pa_close(p->read.fds[--p->read.nfd]);
+    }
+#endif
+
+    if (p->read.packet)
+        pa_packet_unref(p->read.packet);
+
+    p->read.packet = NULL;
+    p->read.index = 0;
+
+#ifdef HAVE_CREDS
+    /* The rest of the buffer came with the same credentials */
+    p->read_creds_valid = p->read.buffer_creds_valid && p->read.buffer_index < p->read.buffer_length;
+#endif
+}
+
+static int64_t read_offset(pa_pstream *p) {
+    return (int64_t) (
+        (((uint64_t) ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])) << 32) |
+        (((uint64_t) ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO]))));
+}
+
+static pa_bool_t read_is_shm_frame(pa_pstream *p) {
+    return (ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SHMMASK) == PA_FLAG_SHMDATA;
+}
+
+static pa_bool_t read_is_codec_frame(pa_pstream *p) {
+    return
+        ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]) != (uint32_t) -1 &&
+        (ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_CODEC);
+}
+
+/* Called once the descriptor of a frame is complete */
+static int handle_descriptor(pa_pstream *p) {
+    uint32_t flags, length, channel;
+
+    flags = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]);
+
+    if (flags == PA_FLAG_SRBSWITCH) {
+
+        /* The peer writes to the shared ring from now on, so there
+         * mustn't be anything left from the socket, and it needs to
+         * have been offered a ring. If it was only just taken the
+         * ring is attached in a moment and reading waits for that. */
+        if (p->read_srb || (!p->srb && !pa_atomic_load(&p->srb_expected)) ||
+            p->read.buffer_index < p->read.buffer_length ||
+            ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]) != (uint32_t) -1 ||
+            ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]) != 0) {
+            pa_log_warn("Received invalid ring switch frame.");
+            return -1;
+        }
+
+        p->read_srb = TRUE;
+
+        frame_done(p);
+        return 0;
+    }
+
+    if (!p->use_shm && (flags & PA_FLAG_SHMMASK) != 0) {
+        pa_log_warn("Received SHM frame on a socket where SHM is disabled.");
+        return -1;
+    }
+
+    if (flags == PA_FLAG_SHMRELEASE) {
+
+        /* This is a SHM memblock release frame with no payload */
+
+/*         pa_log("Got release frame for %u", ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])); */
+
+        pa_assert(p->export);
+        pa_memexport_process_release(p->export, ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI]));
+
+        frame_done(p);
+        return 0;
+
+    } else if (flags == PA_FLAG_SHMREVOKE) {
+
+        /* This is a SHM memblock revoke frame with no payload */
+
+/*         pa_log("Got revoke frame for %u", ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])); */
+
+        pa_assert(p->import);
+        pa_memimport_process_revoke(p->import, ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI]));
+
+        frame_done(p);
+        return 0;
+    }
+
+    length = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]);
+
+    if (length > FRAME_SIZE_MAX_ALLOW || length <= 0) {
+        pa_log_warn("Received invalid frame size: %lu", (unsigned long) length);
+        return -1;
+    }
+
+    pa_assert(!p->read.packet);
+
+    channel = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]);
+
+    if (channel == (uint32_t) -1) {
+
+        if (flags != 0) {
+            pa_log_warn("Received packet frame with invalid flags value.");
+            return -1;
+        }
 
-                /* Drop seek info for following callbacks */
-                p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] =
-                    p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] =
-                    p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = 0;
+        /* Frame is a packet frame */
+        p->read.packet = pa_packet_new(length);
+
+    } else {
+
+        if ((flags & PA_FLAG_SEEKMASK) > PA_SEEK_RELATIVE_END) {
+            pa_log_warn("Received memblock frame with invalid seek mode.");
+            return -1;
+        }
+
+        if ((flags & PA_FLAG_SHMMASK) == PA_FLAG_SHMDATA) {
+
+            /* Frame is a memblock frame referencing an SHM memblock */
+
+            if (length != sizeof(p->read.shm_info)) {
+                pa_log_warn("Received SHM memblock frame with invalid frame length.");
+                return -1;
+            }
+
+            if (flags & PA_FLAG_CODEC) {
+                pa_log_warn("Received encoded SHM memblock frame.");
+                return -1;
             }
+
+        } else if ((flags & PA_FLAG_SHMMASK) != 0) {
+
+            pa_log_warn("Received memblock frame with invalid flags value.");
+            return -1;
+
+        } else if (flags & PA_FLAG_CODEC) {
+
+            /* Encoded blocks can only be decoded as a whole, so they
+             * are collected first */
+            p->read.packet = pa_packet_new(length);
         }
 
-        /* Frame complete */
-        if (p->read.index >= ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]) + PA_PSTREAM_DESCRIPTOR_SIZE) {
+        /* Otherwise this is a memblock frame, which is passed on
+         * piece by piece straight out of the read buffer */
+    }
 
-            if (p->read.memblock) {
+    return 0;
+}
 
-                /* This was a memblock frame. We can unref the memblock now */
-                pa_memblock_unref(p->read.memblock);
+static int handle_codec_frame(pa_pstream *p) {
+    uint32_t channel;
+    pa_codec *decoder;
+    pa_memchunk chunk;
+    void *d;
+    int r;
 
-            } else if (p->read.packet) {
+    channel = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]);
+
+    pa_mutex_lock(p->codec_mutex);
+
+    /* The stream might have gone away while the data was on its way */
+    if (!(decoder = pa_hashmap_get(p->decoders, PA_UINT32_TO_PTR(channel)))) {
+        pa_mutex_unlock(p->codec_mutex);
+        pa_log_debug("Dropping encoded data for channel %u without decoder.", channel);
+        return 0;
+    }
+
+    if ((chunk.length = pa_codec_decoded_size(decoder, p->read.packet->data, p->read.packet->length)) <= 0) {
+        pa_mutex_unlock(p->codec_mutex);
+        pa_log_warn("Received invalid encoded memblock frame.");
+        return -1;
+    }
+
+    chunk.memblock = pa_memblock_new(p->mempool, chunk.length);
+    chunk.index = 0;
+
+    d = pa_memblock_acquire(chunk.memblock);
+    r = pa_codec_decode(decoder, p->read.packet->data, p->read.packet->length, d, chunk.length);
+    pa_memblock_release(chunk.memblock);
+
+    pa_mutex_unlock(p->codec_mutex);
+
+    if (r < 0) {
+        pa_memblock_unref(chunk.memblock);
+        pa_log_warn("Failed to decode memblock frame.");
+        return -1;
+    }
+
+    codec_stat_add(chunk.length, p->read.packet->length);
+
+    deliver_memblock(
+            p,
+            channel,
+            read_offset(p),
+            ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SEEKMASK,
+            &chunk);
+
+    pa_memblock_unref(chunk.memblock);
+    return 0;
+}
+
+static void handle_shm_frame(pa_pstream *p) {
+    pa_memblock *b;
+    pa_memchunk chunk;
+
+    pa_assert(p->import);
+
+    if (!(b = pa_memimport_get(p->import,
+                              ntohl(p->read.shm_info[PA_PSTREAM_SHM_BLOCKID]),
+                              ntohl(p->read.shm_info[PA_PSTREAM_SHM_SHMID]),
+                              ntohl(p->read.shm_info[PA_PSTREAM_SHM_INDEX]),
+                              ntohl(p->read.shm_info[PA_PSTREAM_SHM_LENGTH])))) {
+
+        if (pa_log_ratelimit(PA_LOG_DEBUG))
+            pa_log_debug("Failed to import memory block.");
+    }
+
+    chunk.memblock = b;
+    chunk.index = 0;
+    chunk.length = b ? pa_memblock_get_length(b) : ntohl(p->read.shm_info[PA_PSTREAM_SHM_LENGTH]);
+
+    deliver_memblock(
+            p,
+            ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]),
+            read_offset(p),
+            ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SEEKMASK,
+            &chunk);
+
+    if (b)
+        pa_memblock_unref(b);
+}
+
+/* Consumes as much of the read buffer as belongs to the current frame
+ * and dispatches the frame if it is complete then. */
+static int parse_frame(pa_pstream *p) {
+    uint8_t *d;
+    size_t avail, l, length;
+
+    pa_assert(p->read.buffer_index < p->read.buffer_length);
+
+    avail = p->read.buffer_length - p->read.buffer_index;
+
+    if (p->read.index == 0)
+        p->read.frame_start = read_position(p);
+
+    if (p->read.index < PA_PSTREAM_DESCRIPTOR_SIZE) {
+        l = PA_MIN(avail, PA_PSTREAM_DESCRIPTOR_SIZE - p->read.index);
+
+        d = pa_memblock_acquire(p->read.buffer);
+        memcpy((uint8_t*) p->read.descriptor + p->read.index, d + p->read.buffer_index, l);
+        pa_memblock_release(p->read.buffer);
+
+        p->read.index += l;
+        p->read.buffer_index += l;
+
+        if (p->read.index < PA_PSTREAM_DESCRIPTOR_SIZE)
+            return 0;
+
+        /* Reading of frame descriptor complete */
+        return handle_descriptor(p);
+    }
+
+    /* Frame payload available */
+    length = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]);
+    l = PA_MIN(avail, PA_PSTREAM_DESCRIPTOR_SIZE + length - p->read.index);
+
+    if (p->read.packet || read_is_shm_frame(p)) {
+        uint8_t *target = p->read.packet ? p->read.packet->data : (uint8_t*) p->read.shm_info;
+
+        d = pa_memblock_acquire(p->read.buffer);
+        memcpy(target + p->read.index - PA_PSTREAM_DESCRIPTOR_SIZE, d + p->read.buffer_index, l);
+        pa_memblock_release(p->read.buffer);
+
+    } else {
+        pa_memchunk chunk;
+
+        /* This is memblock data, so pass it to the user without
+         * copying it */
+        chunk.memblock = p->read.buffer;
+        chunk.index = p->read.buffer_index;
+        chunk.length = l;
+
+        deliver_memblock(
+            p,
+            ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]),
+            read_offset(p),
+            ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SEEKMASK,
+            &chunk);
+
+        /* Drop seek info for following callbacks */
+        p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] =
+            p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] =
+            p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = 0;
+    }
+
+    p->read.index += l;
+    p->read.buffer_index += l;
+
+    if (p->read.index < PA_PSTREAM_DESCRIPTOR_SIZE + length)
+        return 0;
+
+    /* Frame complete */
+    if (read_is_codec_frame(p)) {
+
+        if (handle_codec_frame(p) < 0)
+            return -1;
+
+    } else if (p->read.packet) {
 
-                if (p->receive_packet_callback)
 #ifdef HAVE_CREDS
-                    p->receive_packet_callback(p, p->read.packet, p->read_creds_valid ? &p->read_creds : NULL, p->receive_packet_callback_userdata);
+        pa_cmsg_ancil_data ancil_data;
+
+        ancil_data.creds_valid = p->read_creds_valid;
+        if (p->read_creds_valid)
+            ancil_data.creds = p->read_creds;
+
+        ancil_data.nfd = 0;
+        if (frame_owns_fds(p)) {
+            memcpy(ancil_data.fds, p->read.fds, p->read.nfd * sizeof(int));
+            ancil_data.nfd = p->read.nfd;
+            p->read.nfd = 0;
+        }
+
+        deliver_packet(p, p->read.packet, ancil_data.creds_valid || ancil_data.nfd > 0 ? &ancil_data : NULL);
 #else
-                    p->receive_packet_callback(p, p->read.packet, NULL, p->receive_packet_callback_userdata);
+        deliver_packet(p, p->read.packet, NULL);
 #endif
 
-                pa_packet_unref(p->read.packet);
-            } else {
-                pa_memblock *b;
+    } else if (read_is_shm_frame(p))
+        handle_shm_frame(p);
 
-                pa_assert((ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SHMMASK) == PA_FLAG_SHMDATA);
+    frame_done(p);
+    return 0;
+}
 
-                pa_assert(p->import);
+/* Makes sure there is a reasonable amount of room at the end of the
+ * read buffer */
+static void prepare_read_buffer(pa_pstream *p) {
+    size_t size, left;
+    pa_memblock *n;
+    uint8_t *s, *d;
 
-                if (!(b = pa_memimport_get(p->import,
-                                          ntohl(p->read.shm_info[PA_PSTREAM_SHM_BLOCKID]),
-                                          ntohl(p->read.shm_info[PA_PSTREAM_SHM_SHMID]),
-                                          ntohl(p->read.shm_info[PA_PSTREAM_SHM_INDEX]),
-                                          ntohl(p->read.shm_info[PA_PSTREAM_SHM_LENGTH])))) {
+    if (!p->read.buffer) {
+        p->read.buffer = pa_memblock_new(p->mempool, pa_mempool_block_size_max(p->mempool));
+        p->read.buffer_index = p->read.buffer_length = 0;
+        return;
+    }
 
-                    if (pa_log_ratelimit(PA_LOG_DEBUG))
-                        pa_log_debug("Failed to import memory block.");
-                }
+    size = pa_memblock_get_length(p->read.buffer);
+    left = p->read.buffer_length - p->read.buffer_index;
 
-                if (p->receive_memblock_callback) {
-                    int64_t offset;
-                    pa_memchunk chunk;
-
-                    chunk.memblock = b;
-                    chunk.index = 0;
-                    chunk.length = b ? pa_memblock_get_length(b) : ntohl(p->read.shm_info[PA_PSTREAM_SHM_LENGTH]);
-
-                    offset = (int64_t) (
-                            (((uint64_t) ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])) << 32) |
-                            (((uint64_t) ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO]))));
-
-                    p->receive_memblock_callback(
-                            p,
-                            ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]),
-                            offset,
-                            ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SEEKMASK,
-                            &chunk,
-                            p->receive_memblock_callback_userdata);
-                }
+    if (pa_memblock_ref_is_one(p->read.buffer)) {
+
+        /* Nobody else is looking at the block, so we can move what is
+         * left of a partial frame to the front and reuse the rest */
+        if (p->read.buffer_index > 0 && (left == 0 || p->read.buffer_length > size / 2)) {
 
-                if (b)
-                    pa_memblock_unref(b);
+            if (left > 0) {
+                d = pa_memblock_acquire(p->read.buffer);
+                memmove(d, d + p->read.buffer_index, left);
+                pa_memblock_release(p->read.buffer);
             }
 
-            goto frame_done;
+            p->read.buffer_index = 0;
+            p->read.buffer_length = left;
         }
+
+        return;
     }
 
-    return 0;
+    /* The front of the block is still referenced by the chunks we
+     * handed out, but we may keep reading into the rest of it as long
+     * as there is enough of that. */
+    if (p->read.buffer_length <= size - size / 4)
+        return;
 
-frame_done:
-    p->read.memblock = NULL;
-    p->read.packet = NULL;
-    p->read.index = 0;
-    p->read.data = NULL;
+    n = pa_memblock_new(p->mempool, pa_mempool_block_size_max(p->mempool));
+
+    if (left > 0) {
+        d = pa_memblock_acquire(n);
+        s = pa_memblock_acquire(p->read.buffer);
+        memcpy(d, s + p->read.buffer_index, left);
+        pa_memblock_release(p->read.buffer);
+        pa_memblock_release(n);
+    }
+
+    pa_memblock_unref(p->read.buffer);
+    p->read.buffer = n;
+    p->read.buffer_index = 0;
+    p->read.buffer_length = left;
+}
+
+static int do_read(pa_pstream *p) {
+    uint8_t *d;
+    size_t l;
+    ssize_t r;
+
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+
+    prepare_read_buffer(p);
+
+    l = pa_memblock_get_length(p->read.buffer) - p->read.buffer_length;
+    pa_assert(l > 0);
+
+    d = pa_memblock_acquire(p->read.buffer);
+
+    if (p->read_srb) {
+
+        r = pa_srbchannel_read(p->srb, d + p->read.buffer_length, l);
 
 #ifdef HAVE_CREDS
-    p->read_creds_valid = FALSE;
+        p->read.buffer_creds_valid = FALSE;
 #endif
 
-    return 0;
+        pa_memblock_release(p->read.buffer);
 
-fail:
-    if (release_memblock)
-        pa_memblock_release(release_memblock);
+        if (r <= 0)
+            return r < 0 ? -1 : 0;
 
-    return -1;
+    } else {
+
+#ifdef HAVE_CREDS
+        pa_cmsg_ancil_data ancil_data;
+
+        r = pa_iochannel_read_with_ancil_data(p->io, d + p->read.buffer_length, l, &ancil_data);
+
+        if (r > 0) {
+            p->read.buffer_creds_valid = ancil_data.creds_valid;
+
+            if (ancil_data.creds_valid) {
+                p->read_creds = ancil_data.creds;
+                p->read_creds_valid = TRUE;
+            }
+
+            if (ancil_data.nfd > 0) {
+                if (p->read.nfd > 0) {
+                    pa_log_warn("Dropping unclaimed file descriptors.");
+
+                    while (p->read.nfd > 0)
+                        pa_close(p->read.fds[--p->read.nfd]);
+                }
+
+                memcpy(p->read.fds, ancil_data.fds, ancil_data.nfd * sizeof(int));
+                p->read.nfd = ancil_data.nfd;
+                p->read.fds_begin = p->read.received;
+                p->read.fds_end = p->read.received + (uint64_t) r;
+            }
+        }
+#else
+        r = pa_iochannel_read(p->io, d + p->read.buffer_length, l);
+#endif
+
+        pa_memblock_release(p->read.buffer);
+
+        if (r <= 0)
+            return -1;
+
+        pa_atomic_inc(&pstream_stat.n_read_calls);
+    }
+
+    p->read.buffer_length += (size_t) r;
+    p->read.received += (uint64_t) r;
+
+    /* Dispatch every frame that is complete now. The callbacks might
+     * unlink us in between. */
+    while (p->io && p->read.buffer_index < p->read.buffer_length)
+        if (parse_frame(p) < 0)
+            return -1;
+
+    return 0;
 }
 
 void pa_pstream_set_die_callback(pa_pstream *p, pa_pstream_notify_cb_t cb, void *userdata) {
@@ -932,6 +1787,17 @@ void pa_pstream_set_receive_memblock_callback(pa_pstream *p, pa_pstream_memblock
     p->receive_memblock_callback_userdata = userdata;
 }
 
+void pa_pstream_set_receive_memblock_thread_callback(pa_pstream *p, pa_pstream_memblock_thread_cb_t cb, void *userdata) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(p->thread);
+
+    pa_mutex_lock(p->mutex);
+    p->receive_memblock_thread_callback = cb;
+    p->receive_memblock_thread_callback_userdata = userdata;
+    pa_mutex_unlock(p->mutex);
+}
+
 void pa_pstream_set_release_callback(pa_pstream *p, pa_pstream_block_id_cb_t cb, void *userdata) {
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
@@ -956,8 +1822,10 @@ pa_bool_t pa_pstream_is_pending(pa_pstream *p) {
 
     if (p->dead)
         b = FALSE;
+    else if (p->thread)
+        b = pa_atomic_load(&p->n_pending) > 0;
     else
-        b = p->write.current || !pa_queue_isempty(p->send_queue);
+        b = p->write.n_batch > 0 || !pa_queue_isempty(p->send_queue);
 
     return b;
 }
@@ -978,23 +1846,8 @@ pa_pstream* pa_pstream_ref(pa_pstream*p) {
     return p;
 }
 
-void pa_pstream_unlink(pa_pstream *p) {
-    pa_assert(p);
-
-    if (p->dead)
-        return;
-
-    p->dead = TRUE;
-
-    if (p->import) {
-        pa_memimport_free(p->import);
-        p->import = NULL;
-    }
-
-    if (p->export) {
-        pa_memexport_free(p->export);
-        p->export = NULL;
-    }
+/* Called from the IO thread, if there is one */
+static void stop_io(pa_pstream *p) {
 
     if (p->io) {
         pa_iochannel_free(p->io);
@@ -1002,19 +1855,50 @@ void pa_pstream_unlink(pa_pstream *p) {
     }
 
     if (p->defer_event) {
-        p->mainloop->defer_free(p->defer_event);
+        p->io_mainloop->defer_free(p->defer_event);
         p->defer_event = NULL;
     }
 
+    if (p->srb) {
+        pa_srbchannel_free(p->srb);
+        p->srb = NULL;
+    }
+}
+
+void pa_pstream_unlink(pa_pstream *p) {
+    pa_assert(p);
+
+    if (p->dead)
+        return;
+
+    p->dead = TRUE;
+
     p->die_callback = NULL;
     p->drain_callback = NULL;
     p->receive_packet_callback = NULL;
     p->receive_memblock_callback = NULL;
+
+    if (p->thread) {
+        /* Once this returns the thread won't call into our user
+         * anymore */
+        pa_mutex_lock(p->mutex);
+        p->receive_memblock_thread_callback = NULL;
+        pa_mutex_unlock(p->mutex);
+
+        /* Waiting for the thread here could deadlock, so the rest of
+         * the teardown happens in detach_done_cb() */
+        p->thread->run(p->thread, detach_cb, p, FALSE);
+        return;
+    }
+
+    free_shm(p);
+    stop_io(p);
 }
 
-void pa_pstream_enable_shm(pa_pstream *p, pa_bool_t enable) {
-    pa_assert(p);
-    pa_assert(PA_REFCNT_VALUE(p) > 0);
+/* Called from the IO thread, if there is one */
+static void set_shm_cb(void *userdata) {
+    pa_pstream *p = userdata;
+    pa_bool_t enable = p->shm_request;
 
     p->use_shm = enable;
 
@@ -1032,9 +1916,191 @@ void pa_pstream_enable_shm(pa_pstream *p, pa_bool_t enable) {
     }
 }
 
+void pa_pstream_enable_shm(pa_pstream *p, pa_bool_t enable) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+
+    p->shm_request = enable;
+
+    if (p->thread) {
+        /* After unlinking, the thread may still be using the export
+         * until detach_done_cb() frees it */
+        if (!p->dead)
+            p->thread->run(p->thread, set_shm_cb, p, TRUE);
+    } else
+        set_shm_cb(p);
+}
+
 pa_bool_t pa_pstream_get_shm(pa_pstream *p) {
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
 
     return p->use_shm;
 }
+
+void pa_pstream_set_encoder(pa_pstream *p, uint32_t channel, pa_codec *c) {
+    pa_codec *old;
+
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(channel != (uint32_t) -1);
+
+    pa_mutex_lock(p->codec_mutex);
+
+    old = pa_hashmap_remove(p->encoders, PA_UINT32_TO_PTR(channel));
+
+    if (c)
+        pa_assert_se(pa_hashmap_put(p->encoders, PA_UINT32_TO_PTR(channel), c) >= 0);
+
+    pa_mutex_unlock(p->codec_mutex);
+
+    if (old)
+        pa_codec_free(old);
+}
+
+void pa_pstream_flush_encoder(pa_pstream *p, uint32_t channel) {
+    pa_codec *encoder;
+
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(channel != (uint32_t) -1);
+
+    if (p->dead)
+        return;
+
+    if (!(encoder = pa_hashmap_get(p->encoders, PA_UINT32_TO_PTR(channel))))
+        return;
+
+    flush_encoder(p, channel, encoder);
+    wakeup_io(p);
+}
+
+void pa_pstream_set_decoder(pa_pstream *p, uint32_t channel, pa_codec *c) {
+    pa_codec *old;
+
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(channel != (uint32_t) -1);
+
+    pa_mutex_lock(p->codec_mutex);
+
+    old = pa_hashmap_remove(p->decoders, PA_UINT32_TO_PTR(channel));
+
+    if (c)
+        pa_assert_se(pa_hashmap_put(p->decoders, PA_UINT32_TO_PTR(channel), c) >= 0);
+
+    pa_mutex_unlock(p->codec_mutex);
+
+    if (old)
+        pa_codec_free(old);
+}
+
+pa_bool_t pa_pstream_get_codec_stats(pa_pstream *p, uint32_t channel, uint64_t *pcm_bytes, uint64_t *encoded_bytes) {
+    pa_codec *encoder, *decoder;
+    uint64_t pcm, encoded;
+
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(pcm_bytes);
+    pa_assert(encoded_bytes);
+
+    *pcm_bytes = *encoded_bytes = 0;
+
+    pa_mutex_lock(p->codec_mutex);
+
+    if ((encoder = pa_hashmap_get(p->encoders, PA_UINT32_TO_PTR(channel)))) {
+        pa_codec_get_stats(encoder, &pcm, &encoded);
+        *pcm_bytes += pcm;
+        *encoded_bytes += encoded;
+    }
+
+    if ((decoder = pa_hashmap_get(p->decoders, PA_UINT32_TO_PTR(channel)))) {
+        pa_codec_get_stats(decoder, &pcm, &encoded);
+        *pcm_bytes += pcm;
+        *encoded_bytes += encoded;
+    }
+
+    pa_mutex_unlock(p->codec_mutex);
+
+    return encoder || decoder;
+}
+
+const pa_pstream_stat *pa_pstream_get_stat(void) {
+    return &pstream_stat;
+}
+
+void pa_pstream_get_codec_stat(uint64_t *pcm_bytes, uint64_t *encoded_bytes) {
+    pa_mutex *m = pa_static_mutex_get(&codec_stat_mutex, FALSE, FALSE);
+
+    pa_assert(pcm_bytes);
+    pa_assert(encoded_bytes);
+
+    pa_mutex_lock(m);
+    *pcm_bytes = codec_stat_pcm_bytes;
+    *encoded_bytes = codec_stat_encoded_bytes;
+    pa_mutex_unlock(m);
+}
+
+/* Called from the IO thread, if there is one */
+static void attach_srb_cb(void *userdata) {
+    pa_pstream *p = userdata;
+
+    pa_assert(p->srb_request);
+    pa_assert(!p->srb);
+
+    /* The IO side failed already, and stop_io() won't run again */
+    if (!p->io) {
+        pa_srbchannel_free(p->srb_request);
+        p->srb_request = NULL;
+        return;
+    }
+
+    p->srb = p->srb_request;
+    p->srb_request = NULL;
+
+    if (p->thread)
+        pa_srbchannel_set_mainloop_api(p->srb, p->io_mainloop);
+
+    pa_srbchannel_set_callback(p->srb, srb_callback, p);
+
+    /* The switch frame of the peer might have come in already */
+    if (p->defer_event)
+        p->io_mainloop->defer_enable(p->defer_event, 1);
+}
+
+void pa_pstream_set_srbchannel(pa_pstream *p, pa_srbchannel *srb) {
+    struct item_info *i;
+
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(srb);
+
+    if (p->dead || p->srb_requested) {
+        pa_srbchannel_free(srb);
+        return;
+    }
+
+    p->srb_request = srb;
+    p->srb_requested = TRUE;
+    pa_atomic_store(&p->srb_expected, 1);
+
+    if (p->thread) {
+        pa_srbchannel_set_mainloop_api(srb, NULL);
+        p->thread->run(p->thread, attach_srb_cb, p, TRUE);
+    } else
+        attach_srb_cb(p);
+
+    /* Everything queued before goes out on the socket, everything
+     * after through the ring */
+    i = item_new(PA_PSTREAM_ITEM_SRBSWITCH);
+    push_item(p, i);
+
+    wakeup_io(p);
+}
+
+void pa_pstream_expect_srbchannel(pa_pstream *p, pa_bool_t expect) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+
+    pa_atomic_store(&p->srb_expected, !!expect);
+}
@@ -34,28 +34,82 @@
 #include <pulsecore/memchunk.h>
 #include <pulsecore/creds.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/atomic.h>
+#include <pulsecore/srbchannel.h>
+#include <pulsecore/codec.h>
 
 typedef struct pa_pstream pa_pstream;
 
-typedef void (*pa_pstream_packet_cb_t)(pa_pstream *p, pa_packet *packet, const pa_creds *creds, void *userdata);
+/* Process wide counters over all pstreams, for statistical purposes
+ * only. Like pa_mempool_stat they are updated without locking and
+ * wrap around eventually. */
+typedef struct pa_pstream_stat {
+    pa_atomic_t n_frames_sent;
+    pa_atomic_t n_write_calls;
+    pa_atomic_t n_frames_received;
+    pa_atomic_t n_read_calls;
+    pa_atomic_t n_memblocks_direct;
+} pa_pstream_stat;
+
+/* Received file descriptors are closed after the callback returned */
+typedef void (*pa_pstream_packet_cb_t)(pa_pstream *p, pa_packet *packet, const pa_cmsg_ancil_data *ancil_data, void *userdata);
 typedef void (*pa_pstream_memblock_cb_t)(pa_pstream *p, uint32_t channel, int64_t offset, pa_seek_mode_t seek, const pa_memchunk *chunk, void *userdata);
+typedef pa_bool_t (*pa_pstream_memblock_thread_cb_t)(pa_pstream *p, uint32_t channel, int64_t offset, pa_seek_mode_t seek, const pa_memchunk *chunk, void *userdata);
 typedef void (*pa_pstream_notify_cb_t)(pa_pstream *p, void *userdata);
 typedef void (*pa_pstream_block_id_cb_t)(pa_pstream *p, uint32_t block_id, void *userdata);
 
+typedef struct pa_pstream_thread pa_pstream_thread;
+typedef void (*pa_pstream_thread_cb_t)(void *userdata);
+
+/* A thread with a main loop of its own that can take over the socket
+ * IO of pstreams, see pa_pstream_new_threaded(). The thread itself is
+ * provided by the user; the daemon uses pa_pstream_worker. */
+struct pa_pstream_thread {
+    /* The main loop running in the thread */
+    pa_mainloop_api *mainloop;
+
+    /* Runs cb in the thread, asynchronously unless wait is TRUE. The
+     * calls are executed in the order they were made. */
+    void (*run)(pa_pstream_thread *t, pa_pstream_thread_cb_t cb, void *userdata, pa_bool_t wait);
+
+    /* Called from the thread. Runs cb asynchronously in the thread of
+     * the main loop the pstream was created with, in order. */
+    void (*run_main)(pa_pstream_thread *t, pa_pstream_thread_cb_t cb, void *userdata);
+};
+
 pa_pstream* pa_pstream_new(pa_mainloop_api *m, pa_iochannel *io, pa_mempool *p);
 
+/* Like pa_pstream_new(), but reading and writing the socket, parsing
+ * frames and importing SHM blocks happen in the thread t. All
+ * callbacks are still called from m, and all functions have to be
+ * called from there, too. The pstream is not freed before it has been
+ * unlinked and the thread has let go of it, which happens
+ * asynchronously. */
+pa_pstream* pa_pstream_new_threaded(pa_mainloop_api *m, pa_iochannel *io, pa_mempool *p, pa_pstream_thread *t);
+
 pa_pstream* pa_pstream_ref(pa_pstream*p);
 void pa_pstream_unref(pa_pstream*p);
 
 void pa_pstream_unlink(pa_pstream *p);
 
-void pa_pstream_send_packet(pa_pstream*p, pa_packet *packet, const pa_creds *creds);
+/* The file descriptors in ancil_data are duplicated */
+void pa_pstream_send_packet(pa_pstream*p, pa_packet *packet, const pa_cmsg_ancil_data *ancil_data);
 void pa_pstream_send_memblock(pa_pstream*p, uint32_t channel, int64_t offset, pa_seek_mode_t seek, const pa_memchunk *chunk);
 void pa_pstream_send_release(pa_pstream *p, uint32_t block_id);
 void pa_pstream_send_revoke(pa_pstream *p, uint32_t block_id);
 
 void pa_pstream_set_receive_packet_callback(pa_pstream *p, pa_pstream_packet_cb_t cb, void *userdata);
 void pa_pstream_set_receive_memblock_callback(pa_pstream *p, pa_pstream_memblock_cb_t cb, void *userdata);
+
+/* Only for threaded pstreams. cb is called from the thread for memblock
+ * frames as long as everything received before has been dispatched in
+ * the main loop already, so that the order relative to packets is
+ * kept. If it returns TRUE it took care of the frame, otherwise the
+ * frame is passed on to the memblock callback in the main loop as
+ * usual. May be called at any time from the main loop, but userdata
+ * has to stay valid until the pstream is unlinked. */
+void pa_pstream_set_receive_memblock_thread_callback(pa_pstream *p, pa_pstream_memblock_thread_cb_t cb, void *userdata);
+
 void pa_pstream_set_drain_callback(pa_pstream *p, pa_pstream_notify_cb_t cb, void *userdata);
 void pa_pstream_set_die_callback(pa_pstream *p, pa_pstream_notify_cb_t cb, void *userdata);
 void pa_pstream_set_release_callback(pa_pstream *p, pa_pstream_block_id_cb_t cb, void *userdata);
@@ -66,4 +120,45 @@ pa_bool_t pa_pstream_is_pending(pa_pstream *p);
 void pa_pstream_enable_shm(pa_pstream *p, pa_bool_t enable);
 pa_bool_t pa_pstream_get_shm(pa_pstream *p);
 
+/* Hands over the shared ring. Everything queued up to now is still
+ * written to the socket, followed by a frame telling the peer to
+ * switch over, and everything after that is written to the ring.
+ * Likewise the ring is read from once such a frame came in from the
+ * peer. Packets with credentials or file descriptors can't be sent
+ * after this. */
+void pa_pstream_set_srbchannel(pa_pstream *p, pa_srbchannel *srb);
+
+/* Tells the pstream that a ring was offered to the peer, so that its
+ * switch frame is accepted even if it comes in before
+ * pa_pstream_set_srbchannel() was called. Any other switch frame is a
+ * protocol error. */
+void pa_pstream_expect_srbchannel(pa_pstream *p, pa_bool_t expect);
+
+/* Memblocks sent on the channel are encoded with c, which the pstream
+ * takes over, unless SHM is in use or they are written with a seek.
+ * Pass NULL to go back to sending PCM. */
+void pa_pstream_set_encoder(pa_pstream *p, uint32_t channel, pa_codec *c);
+
+/* Sends what the encoder of the channel kept back of the last
+ * memblock, padded to a whole frame. Call this before anything that
+ * relies on all data written so far having arrived, like draining or
+ * corking, and before the channel goes away. */
+void pa_pstream_flush_encoder(pa_pstream *p, uint32_t channel);
+
+/* Encoded memblocks received on the channel are decoded with c, which
+ * the pstream takes over, before they are passed to the callbacks.
+ * Those that come in for channels without decoder are dropped. */
+void pa_pstream_set_decoder(pa_pstream *p, uint32_t channel, pa_codec *c);
+
+/* Sums up pa_codec_get_stats() of the encoder and decoder of the
+ * channel. Returns FALSE if there are none. */
+pa_bool_t pa_pstream_get_codec_stats(pa_pstream *p, uint32_t channel, uint64_t *pcm_bytes, uint64_t *encoded_bytes);
+
+const pa_pstream_stat *pa_pstream_get_stat(void);
+
+/* Process wide, how much PCM went through codecs and how much
+ * encoded data it came out as or was made from. Unlike the counters
+ * above these don't wrap. */
+void pa_pstream_get_codec_stat(uint64_t *pcm_bytes, uint64_t *encoded_bytes);
+
 #endif
@@ -40,12 +40,17 @@
 #include <pulsecore/flist.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/ratelimit.h>
+#include <pulsecore/trace.h>
 #include <pulse/rtclock.h>
 
 #include "rtpoll.h"
 
 /* #define DEBUG_TIMING */
 
+/* Maximum number of messages dispatched in one go, so that a flood of
+ * messages cannot starve the rest of the thread loop */
+#define ASYNCMSGQ_BATCH_MAX 32U
+
 struct pa_rtpoll {
     struct pollfd *pollfd, *pollfd2;
     unsigned n_pollfd_alloc, n_pollfd_used;
@@ -58,6 +63,7 @@ struct pa_rtpoll {
     pa_bool_t rebuild_needed:1;
     pa_bool_t quit:1;
     pa_bool_t timer_elapsed:1;
+    pa_bool_t yield:1;
 
 #ifdef DEBUG_TIMING
     pa_usec_t timestamp;
@@ -305,6 +311,8 @@ int pa_rtpoll_run(pa_rtpoll *p, pa_bool_t wait_op) {
     }
 #endif
 
+    pa_trace_record(PA_TRACE_SLEEP, (!wait_op || p->quit || p->timer_enabled) ? (int64_t) pa_timeval_load(&timeout) : -1);
+
     /* OK, now let's sleep */
 #ifdef HAVE_PPOLL
     {
@@ -317,6 +325,8 @@ int pa_rtpoll_run(pa_rtpoll *p, pa_bool_t wait_op) {
     r = pa_poll(p->pollfd, p->n_pollfd_used, (!wait_op || p->quit || p->timer_enabled) ? (int) ((timeout.tv_sec*1000) + (timeout.tv_usec / 1000)) : -1);
 #endif
 
+    pa_trace_record(PA_TRACE_WAKEUP, r);
+
     p->timer_elapsed = r == 0;
 
 #ifdef DEBUG_TIMING
@@ -549,10 +559,20 @@ static int asyncmsgq_read_work(pa_rtpoll_item *i) {
     void *data;
     pa_memchunk chunk;
     int64_t offset;
+    unsigned n = 0;
 
     pa_assert(i);
 
-    if (pa_asyncmsgq_get(i->userdata, &object, &code, &data, &offset, &chunk, 0) == 0) {
+    /* Dispatch what is queued right now in one go, so that the rewinds
+     * requested by a burst of messages, e.g. volume changes or stream
+     * moves, are merged into a single one that the thread loop
+     * processes before it renders again. A handler whose rewind has to
+     * be processed before the next message is dispatched calls
+     * pa_rtpoll_yield(). */
+    i->rtpoll->yield = FALSE;
+
+    while (n < ASYNCMSGQ_BATCH_MAX &&
+           pa_asyncmsgq_get(i->userdata, &object, &code, &data, &offset, &chunk, 0) == 0) {
         int ret;
 
         if (!object && code == PA_MESSAGE_SHUTDOWN) {
@@ -563,10 +583,14 @@ static int asyncmsgq_read_work(pa_rtpoll_item *i) {
 
         ret = pa_asyncmsgq_dispatch(object, code, data, offset, &chunk);
         pa_asyncmsgq_done(i->userdata, ret);
-        return 1;
+        n++;
+
+        /* The message handler might have removed this item */
+        if (i->dead || i->rtpoll->quit || i->rtpoll->yield)
+            break;
     }
 
-    return 0;
+    return n > 0;
 }
 
 pa_rtpoll_item *pa_rtpoll_item_new_asyncmsgq_read(pa_rtpoll *p, pa_rtpoll_priority_t prio, pa_asyncmsgq *q) {
@@ -625,6 +649,12 @@ pa_rtpoll_item *pa_rtpoll_item_new_asyncmsgq_write(pa_rtpoll *p, pa_rtpoll_prior
     return i;
 }
 
+void pa_rtpoll_yield(pa_rtpoll *p) {
+    pa_assert(p);
+
+    p->yield = TRUE;
+}
+
 void pa_rtpoll_quit(pa_rtpoll *p) {
     pa_assert(p);
 
@@ -101,6 +101,11 @@ pa_rtpoll_item *pa_rtpoll_item_new_fdsem(pa_rtpoll *p, pa_rtpoll_priority_t prio
 pa_rtpoll_item *pa_rtpoll_item_new_asyncmsgq_read(pa_rtpoll *p, pa_rtpoll_priority_t prio, pa_asyncmsgq *q);
 pa_rtpoll_item *pa_rtpoll_item_new_asyncmsgq_write(pa_rtpoll *p, pa_rtpoll_priority_t prio, pa_asyncmsgq *q);
 
+/* Makes the asyncmsgq read items stop dispatching after the message
+ * that is being dispatched, so that the thread loop runs before the
+ * next one, e.g. to process a rewind that the next one must not miss */
+void pa_rtpoll_yield(pa_rtpoll *p);
+
 /* Requests the loop to exit. Will cause the next iteration of
  * pa_rtpoll_run() to return 0 */
 void pa_rtpoll_quit(pa_rtpoll *p);
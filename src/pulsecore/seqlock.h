@@ -0,0 +1,101 @@
+#ifndef foopulsecoreseqlockhfoo
+#define foopulsecoreseqlockhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/macro.h>
+
+/*
+ * A sequence lock for publishing small, plain-old-data snapshots from
+ * exactly one writer (usually an IO thread) to any number of
+ * readers. The writer never blocks and never waits for readers;
+ * readers never block the writer but may have to retry if they raced
+ * with an update.
+ *
+ * Unlike pa_aupdate the writer side takes no lock, so it may be used
+ * from real-time threads.
+ *
+ * Usage is like this:
+ *
+ * static struct foo bar;
+ * static pa_seqlock l = PA_SEQLOCK_INIT;
+ *
+ * writer() {
+ *     pa_seqlock_write_begin(&l);
+ *
+ *     ... update bar ...
+ *
+ *     pa_seqlock_write_end(&l);
+ * }
+ *
+ * reader() {
+ *     struct foo copy;
+ *     unsigned seq;
+ *
+ *     do {
+ *         seq = pa_seqlock_read_begin(&l);
+ *         copy = bar;
+ *     } while (pa_seqlock_read_retry(&l, seq));
+ * }
+ *
+ * Readers must only copy the data inside the loop and may not follow
+ * pointers stored in it, since the copy may be torn until
+ * pa_seqlock_read_retry() returned FALSE. Readers that must not spin
+ * (because the writer might be descheduled in the middle of an
+ * update) should limit the number of retries and fall back to some
+ * slower, synchronous path.
+ */
+
+typedef struct pa_seqlock {
+    pa_atomic_t sequence;
+} pa_seqlock;
+
+#define PA_SEQLOCK_INIT { PA_ATOMIC_INIT(0) }
+
+static inline void pa_seqlock_init(pa_seqlock *l) {
+    pa_atomic_store(&l->sequence, 0);
+}
+
+static inline void pa_seqlock_write_begin(pa_seqlock *l) {
+    /* Makes the sequence odd; full barrier */
+    pa_atomic_inc(&l->sequence);
+}
+
+static inline void pa_seqlock_write_end(pa_seqlock *l) {
+    /* Makes the sequence even again; full barrier */
+    pa_atomic_inc(&l->sequence);
+}
+
+static inline unsigned pa_seqlock_read_begin(pa_seqlock *l) {
+    /* We need a barrier after loading the sequence, so that the data
+     * reads cannot be moved before it. pa_atomic_load() only gives us
+     * one before, hence the add. */
+    return (unsigned) pa_atomic_add(&l->sequence, 0);
+}
+
+/* Returns TRUE if the data read since pa_seqlock_read_begin() might
+ * be inconsistent, i.e. a write was in progress or happened in
+ * between. */
+static inline pa_bool_t pa_seqlock_read_retry(pa_seqlock *l, unsigned seq) {
+    return (seq & 1U) || (unsigned) pa_atomic_load(&l->sequence) != seq;
+}
+
+#endif
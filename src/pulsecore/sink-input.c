@@ -30,6 +30,7 @@
 #include <pulse/utf8.h>
 #include <pulse/xmalloc.h>
 #include <pulse/util.h>
+#include <pulse/rtclock.h>
 #include <pulse/internal.h>
 
 #include <pulsecore/mix.h>
@@ -256,6 +257,7 @@ static void reset_callbacks(pa_sink_input *i) {
     i->pop = NULL;
     i->process_underrun = NULL;
     i->process_rewind = NULL;
+    i->publish_timing = NULL;
     i->update_max_rewind = NULL;
     i->update_max_request = NULL;
     i->update_sink_requested_latency = NULL;
@@ -559,6 +561,11 @@ int pa_sink_input_new(
     i->thread_info.underrun_for_sink = 0;
     i->thread_info.playing_for = 0;
     i->thread_info.direct_outputs = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+    pa_cost_meter_reset(&i->thread_info.render_cost.peek);
+    pa_cost_meter_reset(&i->thread_info.render_cost.pop);
+    pa_cost_meter_reset(&i->thread_info.render_cost.resample);
+    i->render_cost = i->render_cost_last = i->thread_info.render_cost;
+    pa_seqlock_init(&i->render_cost_lock);
 
     pa_assert_se(pa_idxset_put(core->sink_inputs, i, &i->index) == 0);
     pa_assert_se(pa_idxset_put(i->sink->inputs, pa_sink_input_ref(i), NULL) == 0);
@@ -652,7 +659,7 @@ static void sink_input_set_state(pa_sink_input *i, pa_sink_input_state_t state)
             pa_hook_fire(&i->core->hooks[PA_CORE_HOOK_SINK_INPUT_STATE_CHANGED], ssync);
 
         if (PA_SINK_INPUT_IS_LINKED(state))
-            pa_subscription_post(i->core, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_CHANGE, i->index);
+            pa_subscription_post_change(i->core, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_CHANGE, i->index, PA_SUBSCRIPTION_CHANGE_STATE);
     }
 
     pa_sink_update_status(i->sink);
@@ -851,6 +858,43 @@ pa_usec_t pa_sink_input_get_latency(pa_sink_input *i, pa_usec_t *sink_latency) {
     return r[0];
 }
 
+/* Called from main context */
+void pa_sink_input_get_render_cost(pa_sink_input *i, pa_sink_input_render_cost *cost) {
+    pa_sink_input_render_cost copy;
+    unsigned seq, tries = 0;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_ctl_context();
+    pa_assert(cost);
+
+    do {
+        /* The IO thread might have been preempted half way through an
+         * update, don't spin on it but return what we read last */
+        if (tries++ >= 3) {
+            *cost = i->render_cost_last;
+            return;
+        }
+
+        seq = pa_seqlock_read_begin(&i->render_cost_lock);
+        copy = i->render_cost;
+    } while (pa_seqlock_read_retry(&i->render_cost_lock, seq));
+
+    *cost = i->render_cost_last = copy;
+}
+
+/* Called from thread context */
+static void publish_render_cost(pa_sink_input *i, pa_usec_t begin, pa_usec_t pop_usec, pa_usec_t resample_usec) {
+    pa_usec_t now = pa_rtclock_now();
+
+    pa_cost_meter_add(&i->thread_info.render_cost.peek, now, now - begin);
+    pa_cost_meter_add(&i->thread_info.render_cost.pop, now, pop_usec);
+    pa_cost_meter_add(&i->thread_info.render_cost.resample, now, resample_usec);
+
+    pa_seqlock_write_begin(&i->render_cost_lock);
+    i->render_cost = i->thread_info.render_cost;
+    pa_seqlock_write_end(&i->render_cost_lock);
+}
+
 /* Called from thread context */
 void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa_memchunk *chunk, pa_cvolume *volume) {
     pa_bool_t do_volume_adj_here, need_volume_factor_sink;
@@ -858,6 +902,7 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
     size_t block_size_max_sink, block_size_max_sink_input;
     size_t ilength;
     size_t ilength_full;
+    pa_usec_t begin, t, pop_usec = 0, resample_usec = 0;
 
     pa_sink_input_assert_ref(i);
     pa_sink_input_assert_io_context(i);
@@ -870,6 +915,8 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
     pa_log_debug("peek");
 #endif
 
+    begin = pa_rtclock_now();
+
     block_size_max_sink_input = i->thread_info.resampler ?
         pa_resampler_max_block_size(i->thread_info.resampler) :
         pa_frame_align(pa_mempool_block_size_max(i->core->mempool), &i->sample_spec);
@@ -908,12 +955,20 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
 
     while (!pa_memblockq_is_readable(i->thread_info.render_memblockq)) {
         pa_memchunk tchunk;
+        int r;
 
         /* There's nothing in our render queue. We need to fill it up
          * with data from the implementor. */
 
-        if (i->thread_info.state == PA_SINK_INPUT_CORKED ||
-            i->pop(i, ilength, &tchunk) < 0) {
+        if (i->thread_info.state == PA_SINK_INPUT_CORKED) {
+            r = -1;
+        } else {
+            t = pa_rtclock_now();
+            r = i->pop(i, ilength, &tchunk);
+            pop_usec += pa_rtclock_now() - t;
+        }
+
+        if (r < 0) {
 
             /* OK, we're corked or the implementor didn't give us any
              * data, so let's just hand out silence */
@@ -979,7 +1034,10 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
                 pa_memblockq_push_align(i->thread_info.render_memblockq, &wchunk);
             } else {
                 pa_memchunk rchunk;
+
+                t = pa_rtclock_now();
                 pa_resampler_run(i->thread_info.resampler, &wchunk, &rchunk);
+                resample_usec += pa_rtclock_now() - t;
 
 #ifdef SINK_INPUT_DEBUG
                 pa_log_debug("pushing %lu", (unsigned long) rchunk.length);
@@ -1029,6 +1087,8 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
         pa_cvolume_mute(volume, i->sink->sample_spec.channels);
     else
         *volume = i->thread_info.soft_volume;
+
+    publish_render_cost(i, begin, pop_usec, resample_usec);
 }
 
 /* Called from thread context */
@@ -1045,6 +1105,9 @@ void pa_sink_input_drop(pa_sink_input *i, size_t nbytes /* in sink sample spec *
 #endif
 
     pa_memblockq_drop(i->thread_info.render_memblockq, nbytes);
+
+    if (i->publish_timing)
+        i->publish_timing(i);
 }
 
 /* Called from thread context */
@@ -1089,6 +1152,7 @@ void pa_sink_input_process_rewind(pa_sink_input *i, size_t nbytes /* in sink sam
         /* We were asked to drop all buffered data, and rerequest new
          * data from implementor the next time peek() is called */
 
+        i->sink->thread_info.rewind_stats.rewritten_bytes += pa_memblockq_get_length(i->thread_info.render_memblockq);
         pa_memblockq_flush_write(i->thread_info.render_memblockq, TRUE);
 
     } else if (i->thread_info.rewrite_nbytes > 0) {
@@ -1120,6 +1184,8 @@ void pa_sink_input_process_rewind(pa_sink_input *i, size_t nbytes /* in sink sam
                 /* Ok, now update the write pointer */
                 pa_memblockq_seek(i->thread_info.render_memblockq, - ((int64_t) amount), PA_SEEK_RELATIVE, TRUE);
 
+            i->sink->thread_info.rewind_stats.rewritten_bytes += amount;
+
             if (i->thread_info.rewrite_flush)
                 pa_memblockq_silence(i->thread_info.render_memblockq);
 
@@ -1299,7 +1365,7 @@ void pa_sink_input_set_volume(pa_sink_input *i, const pa_cvolume *volume, pa_boo
         i->volume_changed(i);
 
     /* The virtual volume changed, let's tell people so */
-    pa_subscription_post(i->core, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_CHANGE, i->index);
+    pa_subscription_post_change(i->core, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_CHANGE, i->index, PA_SUBSCRIPTION_CHANGE_VOLUME);
 }
 
 void pa_sink_input_add_volume_factor(pa_sink_input *i, const char *key, const pa_cvolume *volume_factor) {
@@ -1435,7 +1501,7 @@ void pa_sink_input_set_mute(pa_sink_input *i, pa_bool_t mute, pa_bool_t save) {
     if (i->mute_changed)
         i->mute_changed(i);
 
-    pa_subscription_post(i->core, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_CHANGE, i->index);
+    pa_subscription_post_change(i->core, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_CHANGE, i->index, PA_SUBSCRIPTION_CHANGE_MUTE);
 }
 
 /* Called from main context */
@@ -2128,6 +2194,12 @@ void pa_sink_input_request_rewind(
         i->thread_info.dont_rewind_render ||
         dont_rewind_render;
 
+    /* A flush throws away what the input rendered so far, which the
+     * messages queued after this one must not see, so the thread loop
+     * has to process the rewind before they are dispatched */
+    if (flush && i->sink->thread_info.rtpoll)
+        pa_rtpoll_yield(i->sink->thread_info.rtpoll);
+
     /* nbytes is -1 if some earlier rewind request had rewrite == false. */
     if (nbytes != (size_t) -1) {
 
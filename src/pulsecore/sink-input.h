@@ -35,6 +35,8 @@ typedef struct pa_sink_input pa_sink_input;
 #include <pulsecore/client.h>
 #include <pulsecore/sink.h>
 #include <pulsecore/core.h>
+#include <pulsecore/cost-meter.h>
+#include <pulsecore/seqlock.h>
 
 typedef enum pa_sink_input_state {
     PA_SINK_INPUT_INIT,         /*< The stream is not active yet, because pa_sink_input_put() has not been called yet */
@@ -64,6 +66,14 @@ typedef enum pa_sink_input_flags {
     PA_SINK_INPUT_PASSTHROUGH = 2048
 } pa_sink_input_flags_t;
 
+/* Where the IO thread spends its time on behalf of a sink input,
+ * measured per pa_sink_input_peek() call */
+typedef struct pa_sink_input_render_cost {
+    pa_cost_meter peek;     /* All of pa_sink_input_peek(), including the two below */
+    pa_cost_meter pop;      /* The pop() callback, i.e. the client queue or the filter behind it */
+    pa_cost_meter resample;
+} pa_sink_input_render_cost;
+
 struct pa_sink_input {
     pa_msgobject parent;
 
@@ -146,6 +156,12 @@ struct pa_sink_input {
      * pa_sink_input_request_rewind(). Called from IO context. */
     void (*process_rewind) (pa_sink_input *i, size_t nbytes);     /* may NOT be NULL */
 
+    /* Called after the sink consumed data from this input, i.e. once
+     * per render cycle, when the timing state of the input is
+     * consistent with what the sink will publish in its latency
+     * snapshot. Called from IO context. */
+    void (*publish_timing) (pa_sink_input *i); /* may be NULL */
+
     /* Called whenever the maximum rewindable size of the sink
      * changes. Called from IO context. */
     void (*update_max_rewind) (pa_sink_input *i, size_t nbytes); /* may be NULL */
@@ -252,8 +268,15 @@ struct pa_sink_input {
         pa_usec_t requested_sink_latency;
 
         pa_hashmap *direct_outputs;
+
+        pa_sink_input_render_cost render_cost;
     } thread_info;
 
+    /* Copy of thread_info.render_cost, published by the IO thread,
+     * and the last consistent copy the main thread read from it */
+    pa_seqlock render_cost_lock;
+    pa_sink_input_render_cost render_cost, render_cost_last;
+
     void *userdata;
 };
 
@@ -366,6 +389,7 @@ size_t pa_sink_input_get_max_request(pa_sink_input *i);
 void pa_sink_input_kill(pa_sink_input*i);
 
 pa_usec_t pa_sink_input_get_latency(pa_sink_input *i, pa_usec_t *sink_latency);
+void pa_sink_input_get_render_cost(pa_sink_input *i, pa_sink_input_render_cost *cost);
 
 pa_bool_t pa_sink_input_is_passthrough(pa_sink_input *i);
 pa_bool_t pa_sink_input_is_volume_readable(pa_sink_input *i);
@@ -48,6 +48,8 @@
 #include <pulsecore/macro.h>
 #include <pulsecore/play-memblockq.h>
 #include <pulsecore/flist.h>
+#include <pulsecore/seqlock.h>
+#include <pulsecore/trace.h>
 
 #include "sink.h"
 
@@ -345,6 +347,15 @@ pa_sink* pa_sink_new(
     s->thread_info.volume_change_safety_margin = core->deferred_volume_safety_margin_usec;
     s->thread_info.volume_change_extra_delay = core->deferred_volume_extra_delay_usec;
     s->thread_info.latency_offset = s->latency_offset;
+    s->thread_info.render_cycle = 0;
+
+    pa_seqlock_init(&s->latency_snapshot_lock);
+    s->latency_snapshot.valid = FALSE;
+    pa_seqlock_init(&s->rewind_stats_lock);
+    pa_cost_meter_reset(&s->thread_info.render_cost);
+    pa_cost_meter_reset(&s->render_cost);
+    s->render_cost_last = s->render_cost;
+    pa_seqlock_init(&s->render_cost_lock);
 
     /* FIXME: This should probably be moved to pa_sink_put() */
     pa_assert_se(pa_idxset_put(core->sinks, s, &s->index) >= 0);
@@ -430,7 +441,7 @@ static int sink_set_state(pa_sink *s, pa_sink_state_t state) {
 
     if (state != PA_SINK_UNLINKED) { /* if we enter UNLINKED state pa_sink_unlink() will fire the appropriate events */
         pa_hook_fire(&s->core->hooks[PA_CORE_HOOK_SINK_STATE_CHANGED], s);
-        pa_subscription_post(s->core, PA_SUBSCRIPTION_EVENT_SINK | PA_SUBSCRIPTION_EVENT_CHANGE, s->index);
+        pa_subscription_post_change(s->core, PA_SUBSCRIPTION_EVENT_SINK | PA_SUBSCRIPTION_EVENT_CHANGE, s->index, PA_SUBSCRIPTION_CHANGE_STATE);
     }
 
     if (suspend_change) {
@@ -960,6 +971,20 @@ size_t pa_sink_process_input_underruns(pa_sink *s, size_t left_to_play) {
     return left_to_play - result;
 }
 
+/* Called from IO thread context */
+static void invalidate_latency_snapshot(pa_sink *s) {
+    pa_seqlock_write_begin(&s->latency_snapshot_lock);
+    s->latency_snapshot.valid = FALSE;
+    pa_seqlock_write_end(&s->latency_snapshot_lock);
+}
+
+/* Called from IO thread context */
+static void publish_rewind_stats(pa_sink *s) {
+    pa_seqlock_write_begin(&s->rewind_stats_lock);
+    s->rewind_stats = s->thread_info.rewind_stats;
+    pa_seqlock_write_end(&s->rewind_stats_lock);
+}
+
 /* Called from IO thread context */
 void pa_sink_process_rewind(pa_sink *s, size_t nbytes) {
     pa_sink_input *i;
@@ -983,6 +1008,12 @@ void pa_sink_process_rewind(pa_sink *s, size_t nbytes) {
         pa_log_debug("Processing rewind...");
         if (s->flags & PA_SINK_DEFERRED_VOLUME)
             pa_sink_volume_change_rewind(s, nbytes);
+
+        invalidate_latency_snapshot(s);
+        pa_trace_record(PA_TRACE_REWIND, (int64_t) nbytes);
+
+        s->thread_info.rewind_stats.rewinds++;
+        s->thread_info.rewind_stats.rewound_bytes += nbytes;
     }
 
     PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
@@ -994,6 +1025,8 @@ void pa_sink_process_rewind(pa_sink *s, size_t nbytes) {
         if (s->monitor_source && PA_SOURCE_IS_LINKED(s->monitor_source->thread_info.state))
             pa_source_process_rewind(s->monitor_source, nbytes);
     }
+
+    publish_rewind_stats(s);
 }
 
 /* Called from IO thread context */
@@ -1133,8 +1166,41 @@ static void inputs_drop(pa_sink *s, pa_mix_info *info, unsigned n, pa_memchunk *
         pa_source_post(s->monitor_source, result);
 }
 
+/* Called from IO thread context, right after length bytes have been
+ * rendered and before they are handed to the device */
+static void publish_latency_snapshot(pa_sink *s, size_t length) {
+    pa_usec_t usec = 0, block_usec, now;
+    pa_msgobject *o;
+
+    if (!(s->flags & PA_SINK_LATENCY))
+        return;
+
+    if (s->thread_info.state == PA_SINK_SUSPENDED || length <= 0) {
+        invalidate_latency_snapshot(s);
+        return;
+    }
+
+    o = PA_MSGOBJECT(s);
+
+    if (o->process_msg(o, PA_SINK_MESSAGE_GET_LATENCY, &usec, 0, NULL) < 0) {
+        invalidate_latency_snapshot(s);
+        return;
+    }
+
+    block_usec = pa_bytes_to_usec(length, &s->sample_spec);
+    now = pa_rtclock_now();
+
+    pa_seqlock_write_begin(&s->latency_snapshot_lock);
+    s->latency_snapshot.valid = TRUE;
+    s->latency_snapshot.latency = usec + block_usec;
+    s->latency_snapshot.timestamp = now;
+    s->latency_snapshot.max_age = block_usec;
+    s->latency_snapshot.render_cycle = s->thread_info.render_cycle;
+    pa_seqlock_write_end(&s->latency_snapshot_lock);
+}
+
 /* Called from IO thread context */
-void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
+static void sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
     pa_mix_info info[MAX_MIX_CHANNELS];
     unsigned n;
     size_t block_size_max;
@@ -1219,7 +1285,7 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
 }
 
 /* Called from IO thread context */
-void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
+static void sink_render_into(pa_sink*s, pa_memchunk *target) {
     pa_mix_info info[MAX_MIX_CHANNELS];
     unsigned n;
     size_t length, block_size_max;
@@ -1304,7 +1370,7 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
 }
 
 /* Called from IO thread context */
-void pa_sink_render_into_full(pa_sink *s, pa_memchunk *target) {
+static void sink_render_into_full(pa_sink *s, pa_memchunk *target) {
     pa_memchunk chunk;
     size_t l, d;
 
@@ -1333,7 +1399,7 @@ void pa_sink_render_into_full(pa_sink *s, pa_memchunk *target) {
         chunk.index += d;
         chunk.length -= d;
 
-        pa_sink_render_into(s, &chunk);
+        sink_render_into(s, &chunk);
 
         d += chunk.length;
         l -= chunk.length;
@@ -1343,7 +1409,7 @@ void pa_sink_render_into_full(pa_sink *s, pa_memchunk *target) {
 }
 
 /* Called from IO thread context */
-void pa_sink_render_full(pa_sink *s, size_t length, pa_memchunk *result) {
+static void sink_render_full(pa_sink *s, size_t length, pa_memchunk *result) {
     pa_sink_assert_ref(s);
     pa_sink_assert_io_context(s);
     pa_assert(PA_SINK_IS_LINKED(s->thread_info.state));
@@ -1356,7 +1422,7 @@ void pa_sink_render_full(pa_sink *s, size_t length, pa_memchunk *result) {
 
     pa_sink_ref(s);
 
-    pa_sink_render(s, length, result);
+    sink_render(s, length, result);
 
     if (result->length < length) {
         pa_memchunk chunk;
@@ -1367,7 +1433,7 @@ void pa_sink_render_full(pa_sink *s, size_t length, pa_memchunk *result) {
         chunk.index = result->index + result->length;
         chunk.length = length - result->length;
 
-        pa_sink_render_into_full(s, &chunk);
+        sink_render_into_full(s, &chunk);
 
         result->length = length;
     }
@@ -1375,6 +1441,69 @@ void pa_sink_render_full(pa_sink *s, size_t length, pa_memchunk *result) {
     pa_sink_unref(s);
 }
 
+/* Called from IO thread context */
+static void publish_render_cost(pa_sink *s, pa_usec_t begin) {
+    pa_usec_t now = pa_rtclock_now();
+
+    pa_cost_meter_add(&s->thread_info.render_cost, now, now - begin);
+
+    pa_seqlock_write_begin(&s->render_cost_lock);
+    s->render_cost = s->thread_info.render_cost;
+    pa_seqlock_write_end(&s->render_cost_lock);
+}
+
+/* Called from IO thread context */
+void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
+    pa_usec_t begin;
+
+    s->thread_info.render_cycle++;
+    pa_trace_record(PA_TRACE_RENDER_BEGIN, (int64_t) length);
+    begin = pa_rtclock_now();
+    sink_render(s, length, result);
+    publish_render_cost(s, begin);
+    publish_latency_snapshot(s, result->length);
+    pa_trace_record(PA_TRACE_RENDER_END, (int64_t) result->length);
+}
+
+/* Called from IO thread context */
+void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
+    pa_usec_t begin;
+
+    s->thread_info.render_cycle++;
+    pa_trace_record(PA_TRACE_RENDER_BEGIN, (int64_t) target->length);
+    begin = pa_rtclock_now();
+    sink_render_into(s, target);
+    publish_render_cost(s, begin);
+    publish_latency_snapshot(s, target->length);
+    pa_trace_record(PA_TRACE_RENDER_END, (int64_t) target->length);
+}
+
+/* Called from IO thread context */
+void pa_sink_render_into_full(pa_sink *s, pa_memchunk *target) {
+    pa_usec_t begin;
+
+    s->thread_info.render_cycle++;
+    pa_trace_record(PA_TRACE_RENDER_BEGIN, (int64_t) target->length);
+    begin = pa_rtclock_now();
+    sink_render_into_full(s, target);
+    publish_render_cost(s, begin);
+    publish_latency_snapshot(s, target->length);
+    pa_trace_record(PA_TRACE_RENDER_END, (int64_t) target->length);
+}
+
+/* Called from IO thread context */
+void pa_sink_render_full(pa_sink *s, size_t length, pa_memchunk *result) {
+    pa_usec_t begin;
+
+    s->thread_info.render_cycle++;
+    pa_trace_record(PA_TRACE_RENDER_BEGIN, (int64_t) length);
+    begin = pa_rtclock_now();
+    sink_render_full(s, length, result);
+    publish_render_cost(s, begin);
+    publish_latency_snapshot(s, result->length);
+    pa_trace_record(PA_TRACE_RENDER_END, (int64_t) result->length);
+}
+
 /* Called from main thread */
 pa_bool_t pa_sink_update_rate(pa_sink *s, uint32_t rate, pa_bool_t passthrough) {
     pa_bool_t ret = FALSE;
@@ -1476,6 +1605,9 @@ pa_usec_t pa_sink_get_latency(pa_sink *s) {
     if (!(s->flags & PA_SINK_LATENCY))
         return 0;
 
+    if (pa_sink_get_latency_snapshot(s, &usec, NULL))
+        return usec;
+
     pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SINK_MESSAGE_GET_LATENCY, &usec, 0, NULL) == 0);
 
     /* usec is unsigned, so check that the offset can be added to usec without
@@ -1488,6 +1620,108 @@ pa_usec_t pa_sink_get_latency(pa_sink *s) {
     return usec;
 }
 
+/* Called from main thread */
+void pa_sink_get_rewind_stats(pa_sink *s, pa_sink_rewind_stats *stats) {
+    pa_sink_rewind_stats copy;
+    unsigned seq, tries = 0;
+
+    pa_sink_assert_ref(s);
+    pa_assert_ctl_context();
+    pa_assert(stats);
+
+    do {
+        /* The IO thread might have been preempted half way through an
+         * update, don't spin on it but return what we read last */
+        if (tries++ >= 3) {
+            *stats = s->rewind_stats_last;
+            return;
+        }
+
+        seq = pa_seqlock_read_begin(&s->rewind_stats_lock);
+        copy = s->rewind_stats;
+    } while (pa_seqlock_read_retry(&s->rewind_stats_lock, seq));
+
+    *stats = s->rewind_stats_last = copy;
+}
+
+/* Called from main thread */
+void pa_sink_get_render_cost(pa_sink *s, pa_cost_meter *cost) {
+    pa_cost_meter copy;
+    unsigned seq, tries = 0;
+
+    pa_sink_assert_ref(s);
+    pa_assert_ctl_context();
+    pa_assert(cost);
+
+    do {
+        /* Same as in pa_sink_get_rewind_stats() */
+        if (tries++ >= 3) {
+            *cost = s->render_cost_last;
+            return;
+        }
+
+        seq = pa_seqlock_read_begin(&s->render_cost_lock);
+        copy = s->render_cost;
+    } while (pa_seqlock_read_retry(&s->render_cost_lock, seq));
+
+    *cost = s->render_cost_last = copy;
+}
+
+/* Called from main thread. Extrapolates the latency from what the IO
+ * thread published after its last render cycle, without talking to
+ * it. Returns FALSE if there is no usable snapshot, in which case the
+ * caller needs to fall back to PA_SINK_MESSAGE_GET_LATENCY. */
+pa_bool_t pa_sink_get_latency_snapshot(pa_sink *s, pa_usec_t *usec, unsigned *render_cycle) {
+    pa_bool_t valid;
+    pa_usec_t latency, timestamp, max_age, now, age;
+    unsigned seq, cycle, tries = 0;
+
+    pa_sink_assert_ref(s);
+    pa_assert_ctl_context();
+    pa_assert(usec);
+
+    if (!PA_SINK_IS_OPENED(s->state) || !(s->flags & PA_SINK_LATENCY))
+        return FALSE;
+
+    do {
+        /* The IO thread might have been preempted half way through an
+         * update, don't spin on it */
+        if (tries++ >= 3)
+            return FALSE;
+
+        seq = pa_seqlock_read_begin(&s->latency_snapshot_lock);
+        valid = s->latency_snapshot.valid;
+        latency = s->latency_snapshot.latency;
+        timestamp = s->latency_snapshot.timestamp;
+        max_age = s->latency_snapshot.max_age;
+        cycle = s->latency_snapshot.render_cycle;
+    } while (pa_seqlock_read_retry(&s->latency_snapshot_lock, seq));
+
+    if (!valid)
+        return FALSE;
+
+    /* If the IO thread did not render again within the length of the
+     * last block something unusual is going on (underrun, state
+     * change, ...) and extrapolating would be wrong. */
+    now = pa_rtclock_now();
+    if (now < timestamp || (age = now - timestamp) > max_age)
+        return FALSE;
+
+    latency = latency > age ? latency - age : 0;
+
+    if (-s->latency_offset <= (int64_t) latency)
+        latency += s->latency_offset;
+    else
+        latency = 0;
+
+    *usec = latency;
+
+    if (render_cycle)
+        *render_cycle = cycle;
+
+    return TRUE;
+}
+
 /* Called from IO thread */
 pa_usec_t pa_sink_get_latency_within_thread(pa_sink *s) {
     pa_usec_t usec = 0;
@@ -1842,7 +2076,7 @@ static void update_real_volume(pa_sink *s, const pa_cvolume *new_volume, pa_chan
                     if (i->volume_changed)
                         i->volume_changed(i);
 
-                    pa_subscription_post(i->core, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_CHANGE, i->index);
+                    pa_subscription_post_change(i->core, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_CHANGE, i->index, PA_SUBSCRIPTION_CHANGE_VOLUME);
                 }
             }
 
@@ -1925,7 +2159,7 @@ static void propagate_reference_volume(pa_sink *s) {
             if (i->volume_changed)
                 i->volume_changed(i);
 
-            pa_subscription_post(i->core, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_CHANGE, i->index);
+            pa_subscription_post_change(i->core, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_CHANGE, i->index, PA_SUBSCRIPTION_CHANGE_VOLUME);
         }
     }
 }
@@ -1954,7 +2188,7 @@ static pa_bool_t update_reference_volume(pa_sink *s, const pa_cvolume *v, const
     s->save_volume = (!reference_volume_changed && s->save_volume) || save;
 
     if (reference_volume_changed)
-        pa_subscription_post(s->core, PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_CHANGE, s->index);
+        pa_subscription_post_change(s->core, PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_CHANGE, s->index, PA_SUBSCRIPTION_CHANGE_VOLUME);
     else if (!(s->flags & PA_SINK_SHARE_VOLUME_WITH_MASTER))
         /* If the root sink's volume doesn't change, then there can't be any
          * changes in the other sinks in the sink tree either.
@@ -2147,7 +2381,7 @@ static void propagate_real_volume(pa_sink *s, const pa_cvolume *old_real_volume)
                 if (i->volume_changed)
                     i->volume_changed(i);
 
-                pa_subscription_post(i->core, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_CHANGE, i->index);
+                pa_subscription_post_change(i->core, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_CHANGE, i->index, PA_SUBSCRIPTION_CHANGE_VOLUME);
             }
 
             if (i->origin_sink && (i->origin_sink->flags & PA_SINK_SHARE_VOLUME_WITH_MASTER))
@@ -2230,7 +2464,7 @@ void pa_sink_set_mute(pa_sink *s, pa_bool_t mute, pa_bool_t save) {
     pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SINK_MESSAGE_SET_MUTE, NULL, 0, NULL) == 0);
 
     if (old_muted != s->muted)
-        pa_subscription_post(s->core, PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_CHANGE, s->index);
+        pa_subscription_post_change(s->core, PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_CHANGE, s->index, PA_SUBSCRIPTION_CHANGE_MUTE);
 }
 
 /* Called from main thread */
@@ -2251,7 +2485,7 @@ pa_bool_t pa_sink_get_mute(pa_sink *s, pa_bool_t force_refresh) {
         if (old_muted != s->muted) {
             s->save_muted = TRUE;
 
-            pa_subscription_post(s->core, PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_CHANGE, s->index);
+            pa_subscription_post_change(s->core, PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_CHANGE, s->index, PA_SUBSCRIPTION_CHANGE_MUTE);
 
             /* Make sure the soft mute status stays in sync */
             pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SINK_MESSAGE_SET_MUTE, NULL, 0, NULL) == 0);
@@ -2275,7 +2509,7 @@ void pa_sink_mute_changed(pa_sink *s, pa_bool_t new_muted) {
     s->muted = new_muted;
     s->save_muted = TRUE;
 
-    pa_subscription_post(s->core, PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_CHANGE, s->index);
+    pa_subscription_post_change(s->core, PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_CHANGE, s->index, PA_SUBSCRIPTION_CHANGE_MUTE);
 }
 
 /* Called from main thread */
@@ -2774,6 +3008,7 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
                 (PA_SINK_IS_OPENED(s->thread_info.state) && PA_PTR_TO_UINT(userdata) == PA_SINK_SUSPENDED);
 
             s->thread_info.state = PA_PTR_TO_UINT(userdata);
+            invalidate_latency_snapshot(s);
 
             if (s->thread_info.state == PA_SINK_SUSPENDED) {
                 s->thread_info.rewind_nbytes = 0;
@@ -2976,6 +3211,8 @@ void pa_sink_request_rewind(pa_sink*s, size_t nbytes) {
     pa_sink_assert_io_context(s);
     pa_assert(PA_SINK_IS_LINKED(s->thread_info.state));
 
+    s->thread_info.rewind_stats.requests++;
+
     if (nbytes == (size_t) -1)
         nbytes = s->thread_info.max_rewind;
 
@@ -2985,6 +3222,9 @@ void pa_sink_request_rewind(pa_sink*s, size_t nbytes) {
         nbytes <= s->thread_info.rewind_nbytes)
         return;
 
+    /* Requests are only collected here, the actual rewind is done
+     * once by the implementor for the maximum of everything that was
+     * requested since the last one was processed. */
     s->thread_info.rewind_nbytes = nbytes;
     s->thread_info.rewind_requested = TRUE;
 
@@ -45,6 +45,8 @@ typedef struct pa_sink_volume_change pa_sink_volume_change;
 #include <pulsecore/device-port.h>
 #include <pulsecore/card.h>
 #include <pulsecore/queue.h>
+#include <pulsecore/seqlock.h>
+#include <pulsecore/cost-meter.h>
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/sink-input.h>
 
@@ -58,6 +60,13 @@ static inline pa_bool_t PA_SINK_IS_LINKED(pa_sink_state_t x) {
 /* A generic definition for void callback functions */
 typedef void(*pa_sink_cb_t)(pa_sink *s);
 
+typedef struct pa_sink_rewind_stats {
+    uint64_t requests;        /* calls to pa_sink_request_rewind() */
+    uint64_t rewinds;         /* rewinds actually processed */
+    uint64_t rewound_bytes;   /* total amount the sink was rewound by */
+    uint64_t rewritten_bytes; /* total amount handed back to sink input implementors, in sink bytes */
+} pa_sink_rewind_stats;
+
 struct pa_sink {
     pa_msgobject parent;
 
@@ -116,6 +125,29 @@ struct pa_sink {
     /* The latency offset is inherited from the currently active port */
     int64_t latency_offset;
 
+    /* Published by the IO thread after each render cycle so that
+     * pa_sink_get_latency() can usually be answered from the main
+     * thread without a round trip through the asyncmsgq. Readers must
+     * go through latency_snapshot_lock. */
+    pa_seqlock latency_snapshot_lock;
+    struct {
+        pa_bool_t valid;
+        pa_usec_t latency;    /* without latency_offset, including the block just rendered */
+        pa_usec_t timestamp;  /* pa_rtclock_now() when the latency was queried */
+        pa_usec_t max_age;    /* length of the block just rendered */
+        unsigned render_cycle;
+    } latency_snapshot;
+
+    /* Copy of thread_info.rewind_stats, published by the IO thread,
+     * and the last consistent copy the main thread read from it */
+    pa_seqlock rewind_stats_lock;
+    pa_sink_rewind_stats rewind_stats, rewind_stats_last;
+
+    /* Copy of thread_info.render_cost, published by the IO thread,
+     * and the last consistent copy the main thread read from it */
+    pa_seqlock render_cost_lock;
+    pa_cost_meter render_cost, render_cost_last;
+
     unsigned priority;
 
     /* Called when the main loop requests a state change. Called from
@@ -260,6 +292,10 @@ struct pa_sink {
         /* Maximum of what clients requested to rewind in this cycle */
         size_t rewind_nbytes;
         pa_bool_t rewind_requested;
+        pa_sink_rewind_stats rewind_stats;
+
+        /* Time spent in the pa_sink_render*() functions */
+        pa_cost_meter render_cost;
 
         /* Both dynamic and fixed latencies will be clamped to this
          * range. */
@@ -274,6 +310,11 @@ struct pa_sink {
         /* This latency offset is a direct copy from s->latency_offset */
         int64_t latency_offset;
 
+        /* Incremented each time one of the pa_sink_render*() functions
+         * is entered. Sink inputs may tag their own lock-free timing
+         * snapshots with it to match them up with latency_snapshot. */
+        unsigned render_cycle;
+
         /* Delayed volume change events are queued here. The events
          * are stored in expiration order. The one expiring next is in
          * the head of the list. */
@@ -416,6 +457,9 @@ void pa_sink_set_latency_offset(pa_sink *s, int64_t offset);
 
 /* The returned value is supposed to be in the time domain of the sound card! */
 pa_usec_t pa_sink_get_latency(pa_sink *s);
+pa_bool_t pa_sink_get_latency_snapshot(pa_sink *s, pa_usec_t *usec, unsigned *render_cycle);
+void pa_sink_get_rewind_stats(pa_sink *s, pa_sink_rewind_stats *stats);
+void pa_sink_get_render_cost(pa_sink *s, pa_cost_meter *cost);
 pa_usec_t pa_sink_get_requested_latency(pa_sink *s);
 void pa_sink_get_latency_range(pa_sink *s, pa_usec_t *min_latency, pa_usec_t *max_latency);
 pa_usec_t pa_sink_get_fixed_latency(pa_sink *s);
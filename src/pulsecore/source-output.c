@@ -543,7 +543,7 @@ static void source_output_set_state(pa_source_output *o, pa_source_output_state_
         pa_hook_fire(&o->core->hooks[PA_CORE_HOOK_SOURCE_OUTPUT_STATE_CHANGED], o);
 
         if (PA_SOURCE_OUTPUT_IS_LINKED(state))
-            pa_subscription_post(o->core, PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT|PA_SUBSCRIPTION_EVENT_CHANGE, o->index);
+            pa_subscription_post_change(o->core, PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT|PA_SUBSCRIPTION_EVENT_CHANGE, o->index, PA_SUBSCRIPTION_CHANGE_STATE);
     }
 
     pa_source_update_status(o->source);
@@ -997,7 +997,7 @@ void pa_source_output_set_volume(pa_source_output *o, const pa_cvolume *volume,
         o->volume_changed(o);
 
     /* The virtual volume changed, let's tell people so */
-    pa_subscription_post(o->core, PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT|PA_SUBSCRIPTION_EVENT_CHANGE, o->index);
+    pa_subscription_post_change(o->core, PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT|PA_SUBSCRIPTION_EVENT_CHANGE, o->index, PA_SUBSCRIPTION_CHANGE_VOLUME);
 }
 
 /* Called from main context */
@@ -1077,7 +1077,7 @@ void pa_source_output_set_mute(pa_source_output *o, pa_bool_t mute, pa_bool_t sa
     if (o->mute_changed)
         o->mute_changed(o);
 
-    pa_subscription_post(o->core, PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT|PA_SUBSCRIPTION_EVENT_CHANGE, o->index);
+    pa_subscription_post_change(o->core, PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT|PA_SUBSCRIPTION_EVENT_CHANGE, o->index, PA_SUBSCRIPTION_CHANGE_MUTE);
 }
 
 /* Called from main context */
@@ -384,7 +384,7 @@ static int source_set_state(pa_source *s, pa_source_state_t state) {
 
     if (state != PA_SOURCE_UNLINKED) { /* if we enter UNLINKED state pa_source_unlink() will fire the appropriate events */
         pa_hook_fire(&s->core->hooks[PA_CORE_HOOK_SOURCE_STATE_CHANGED], s);
-        pa_subscription_post(s->core, PA_SUBSCRIPTION_EVENT_SOURCE | PA_SUBSCRIPTION_EVENT_CHANGE, s->index);
+        pa_subscription_post_change(s->core, PA_SUBSCRIPTION_EVENT_SOURCE | PA_SUBSCRIPTION_EVENT_CHANGE, s->index, PA_SUBSCRIPTION_CHANGE_STATE);
     }
 
     if (suspend_change) {
@@ -1399,7 +1399,7 @@ static void update_real_volume(pa_source *s, const pa_cvolume *new_volume, pa_ch
                     if (o->volume_changed)
                         o->volume_changed(o);
 
-                    pa_subscription_post(o->core, PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT|PA_SUBSCRIPTION_EVENT_CHANGE, o->index);
+                    pa_subscription_post_change(o->core, PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT|PA_SUBSCRIPTION_EVENT_CHANGE, o->index, PA_SUBSCRIPTION_CHANGE_VOLUME);
                 }
             }
 
@@ -1482,7 +1482,7 @@ static void propagate_reference_volume(pa_source *s) {
             if (o->volume_changed)
                 o->volume_changed(o);
 
-            pa_subscription_post(o->core, PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT|PA_SUBSCRIPTION_EVENT_CHANGE, o->index);
+            pa_subscription_post_change(o->core, PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT|PA_SUBSCRIPTION_EVENT_CHANGE, o->index, PA_SUBSCRIPTION_CHANGE_VOLUME);
         }
     }
 }
@@ -1511,7 +1511,7 @@ static pa_bool_t update_reference_volume(pa_source *s, const pa_cvolume *v, cons
     s->save_volume = (!reference_volume_changed && s->save_volume) || save;
 
     if (reference_volume_changed)
-        pa_subscription_post(s->core, PA_SUBSCRIPTION_EVENT_SOURCE|PA_SUBSCRIPTION_EVENT_CHANGE, s->index);
+        pa_subscription_post_change(s->core, PA_SUBSCRIPTION_EVENT_SOURCE|PA_SUBSCRIPTION_EVENT_CHANGE, s->index, PA_SUBSCRIPTION_CHANGE_VOLUME);
     else if (!(s->flags & PA_SOURCE_SHARE_VOLUME_WITH_MASTER))
         /* If the root source's volume doesn't change, then there can't be any
          * changes in the other source in the source tree either.
@@ -1704,7 +1704,7 @@ static void propagate_real_volume(pa_source *s, const pa_cvolume *old_real_volum
                 if (o->volume_changed)
                     o->volume_changed(o);
 
-                pa_subscription_post(o->core, PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT|PA_SUBSCRIPTION_EVENT_CHANGE, o->index);
+                pa_subscription_post_change(o->core, PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT|PA_SUBSCRIPTION_EVENT_CHANGE, o->index, PA_SUBSCRIPTION_CHANGE_VOLUME);
             }
 
             if (o->destination_source && (o->destination_source->flags & PA_SOURCE_SHARE_VOLUME_WITH_MASTER))
@@ -1787,7 +1787,7 @@ void pa_source_set_mute(pa_source *s, pa_bool_t mute, pa_bool_t save) {
     pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SOURCE_MESSAGE_SET_MUTE, NULL, 0, NULL) == 0);
 
     if (old_muted != s->muted)
-        pa_subscription_post(s->core, PA_SUBSCRIPTION_EVENT_SOURCE|PA_SUBSCRIPTION_EVENT_CHANGE, s->index);
+        pa_subscription_post_change(s->core, PA_SUBSCRIPTION_EVENT_SOURCE|PA_SUBSCRIPTION_EVENT_CHANGE, s->index, PA_SUBSCRIPTION_CHANGE_MUTE);
 }
 
 /* Called from main thread */
@@ -1808,7 +1808,7 @@ pa_bool_t pa_source_get_mute(pa_source *s, pa_bool_t force_refresh) {
         if (old_muted != s->muted) {
             s->save_muted = TRUE;
 
-            pa_subscription_post(s->core, PA_SUBSCRIPTION_EVENT_SOURCE|PA_SUBSCRIPTION_EVENT_CHANGE, s->index);
+            pa_subscription_post_change(s->core, PA_SUBSCRIPTION_EVENT_SOURCE|PA_SUBSCRIPTION_EVENT_CHANGE, s->index, PA_SUBSCRIPTION_CHANGE_MUTE);
 
             /* Make sure the soft mute status stays in sync */
             pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SOURCE_MESSAGE_SET_MUTE, NULL, 0, NULL) == 0);
@@ -1832,7 +1832,7 @@ void pa_source_mute_changed(pa_source *s, pa_bool_t new_muted) {
     s->muted = new_muted;
     s->save_muted = TRUE;
 
-    pa_subscription_post(s->core, PA_SUBSCRIPTION_EVENT_SOURCE|PA_SUBSCRIPTION_EVENT_CHANGE, s->index);
+    pa_subscription_post_change(s->core, PA_SUBSCRIPTION_EVENT_SOURCE|PA_SUBSCRIPTION_EVENT_CHANGE, s->index, PA_SUBSCRIPTION_CHANGE_MUTE);
 }
 
 /* Called from main thread */
@@ -0,0 +1,553 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+
+#include "srbchannel.h"
+
+/* The peer gets a writable descriptor of the segment, so it has to be
+ * sealed against shrinking it under our feet */
+#if defined(HAVE_SYS_EVENTFD_H) && defined(MFD_ALLOW_SEALING) && defined(F_SEAL_SHRINK)
+#define USE_SRBCHANNEL 1
+#endif
+
+/* Of each of the two rings */
+#define SRB_CAPACITY (64*1024)
+
+/* Where the ring data starts in the segment */
+#define SRB_DATA_OFFSET (256)
+
+/* The side that created the channel is 0, the other one 1 */
+struct srb_ring {
+    /* Both are running counters, modulo 2^32. Each is only written by
+     * one side. */
+    pa_atomic_t write_index;
+    pa_atomic_t read_index;
+};
+
+struct srb_shared {
+    uint32_t capacity;
+
+    /* Set by a side before it goes to sleep, and cleared by the other
+     * one when it wakes it up */
+    pa_atomic_t sleeping[2];
+
+    /* Ring i is written by side i */
+    struct srb_ring ring[2];
+};
+
+struct pa_srbchannel {
+    pa_mainloop_api *mainloop;
+    pa_io_event *io_event;
+    pa_defer_event *defer_event;
+
+    unsigned side;
+    int fds[PA_SRBCHANNEL_N_FDS];
+
+    void *map;
+    size_t map_size;
+    struct srb_shared *shared;
+
+    /* Our own copies, since we can't trust the segment */
+    uint32_t capacity;
+    uint32_t read_index, write_index;
+    uint8_t *read_data, *write_data;
+
+    pa_bool_t write_blocked;
+
+    /* The callback may free us, which is then done once it returns */
+    pa_bool_t dispatching, freed;
+
+    /* Whether the callback read or wrote anything */
+    pa_bool_t progress;
+
+    pa_srbchannel_cb_t callback;
+    void *userdata;
+};
+
+#define SEGMENT_FD 0
+
+pa_bool_t pa_srbchannel_supported(void) {
+#ifdef USE_SRBCHANNEL
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+#ifdef USE_SRBCHANNEL
+
+static size_t segment_size(uint32_t capacity) {
+    return PA_PAGE_ALIGN(SRB_DATA_OFFSET + 2 * (size_t) capacity);
+}
+
+static void wakeup_peer(pa_srbchannel *sr) {
+    uint64_t u = 1;
+
+    /* Only if it is asleep, and only once per nap */
+    if (!pa_atomic_cmpxchg(&sr->shared->sleeping[!sr->side], 1, 0))
+        return;
+
+    /* The counter can't overflow in practice, and if the peer went
+     * away there's nobody to wake up */
+    if (write(sr->fds[2 - sr->side], &u, sizeof(u)) < 0 && errno != EAGAIN)
+        pa_log_debug("Failed to wake up peer: %s", pa_cstrerror(errno));
+}
+
+static pa_bool_t can_read(pa_srbchannel *sr) {
+    return (uint32_t) pa_atomic_load(&sr->shared->ring[!sr->side].write_index) != sr->read_index;
+}
+
+static pa_bool_t can_write(pa_srbchannel *sr) {
+    return sr->write_index - (uint32_t) pa_atomic_load(&sr->shared->ring[sr->side].read_index) != sr->capacity;
+}
+
+/* Called after each dispatch. Tells the peer to wake us up unless
+ * there's still something to do. If the callback didn't do anything
+ * the last time, we wait for the peer though, since the user might
+ * just not be interested in what is there yet. */
+static void arm(pa_srbchannel *sr) {
+    pa_atomic_store(&sr->shared->sleeping[sr->side], 1);
+
+    /* The store above is a full barrier, so either we see what the
+     * peer did now, or it sees that we're sleeping */
+    if (sr->progress && (can_read(sr) || (sr->write_blocked && can_write(sr)))) {
+        pa_atomic_store(&sr->shared->sleeping[sr->side], 0);
+
+        if (sr->defer_event)
+            sr->mainloop->defer_enable(sr->defer_event, 1);
+    }
+}
+
+static void srbchannel_free(pa_srbchannel *sr);
+
+static void dispatch(pa_srbchannel *sr) {
+    sr->mainloop->defer_enable(sr->defer_event, 0);
+
+    sr->dispatching = TRUE;
+    sr->progress = FALSE;
+
+    if (sr->callback)
+        sr->callback(sr, sr->userdata);
+
+    sr->dispatching = FALSE;
+
+    if (sr->freed) {
+        srbchannel_free(sr);
+        return;
+    }
+
+    /* The callback may move us to another main loop */
+    if (sr->mainloop)
+        arm(sr);
+}
+
+static void io_callback(pa_mainloop_api *m, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    pa_srbchannel *sr = userdata;
+    uint64_t u;
+
+    pa_assert(sr);
+    pa_assert(sr->io_event == e);
+
+    /* The eventfd is non-blocking, so this might just as well fail */
+    if (read(fd, &u, sizeof(u)) < 0 && errno != EAGAIN)
+        pa_log_debug("Failed to read from eventfd: %s", pa_cstrerror(errno));
+
+    dispatch(sr);
+}
+
+static void defer_callback(pa_mainloop_api *m, pa_defer_event *e, void *userdata) {
+    pa_srbchannel *sr = userdata;
+
+    pa_assert(sr);
+    pa_assert(sr->defer_event == e);
+
+    dispatch(sr);
+}
+
+static void enable_events(pa_srbchannel *sr) {
+    pa_assert(sr->mainloop);
+
+    sr->io_event = sr->mainloop->io_new(sr->mainloop, sr->fds[1 + sr->side], PA_IO_EVENT_INPUT, io_callback, sr);
+
+    /* Look at the rings right away, since we might have missed a
+     * wakeup while we had no events */
+    sr->defer_event = sr->mainloop->defer_new(sr->mainloop, defer_callback, sr);
+}
+
+static void disable_events(pa_srbchannel *sr) {
+    if (sr->io_event) {
+        sr->mainloop->io_free(sr->io_event);
+        sr->io_event = NULL;
+    }
+
+    if (sr->defer_event) {
+        sr->mainloop->defer_free(sr->defer_event);
+        sr->defer_event = NULL;
+    }
+}
+
+static pa_srbchannel *srbchannel_new(pa_mainloop_api *m, unsigned side, const int fds[PA_SRBCHANNEL_N_FDS], void *map, size_t map_size, uint32_t capacity) {
+    pa_srbchannel *sr;
+    uint8_t *data = (uint8_t*) map + SRB_DATA_OFFSET;
+
+    sr = pa_xnew0(pa_srbchannel, 1);
+    sr->side = side;
+    memcpy(sr->fds, fds, sizeof(sr->fds));
+    sr->map = map;
+    sr->map_size = map_size;
+    sr->shared = map;
+    sr->capacity = capacity;
+
+    sr->write_data = data + side * capacity;
+    sr->read_data = data + (!side) * capacity;
+
+    /* Both rings start out empty, whatever the segment says */
+    sr->read_index = (uint32_t) pa_atomic_load(&sr->shared->ring[!side].read_index);
+    sr->write_index = (uint32_t) pa_atomic_load(&sr->shared->ring[side].write_index);
+
+    if ((sr->mainloop = m))
+        enable_events(sr);
+
+    return sr;
+}
+
+pa_srbchannel* pa_srbchannel_new(pa_mainloop_api *m) {
+    int fds[PA_SRBCHANNEL_N_FDS] = { -1, -1, -1 };
+    struct srb_shared *shared;
+    void *map;
+    size_t size;
+    unsigned k;
+
+    pa_assert(m);
+
+    if ((fds[SEGMENT_FD] = memfd_create("pulseaudio-srb", MFD_CLOEXEC|MFD_ALLOW_SEALING)) < 0) {
+        pa_log("memfd_create() failed: %s", pa_cstrerror(errno));
+        return NULL;
+    }
+
+    size = segment_size(SRB_CAPACITY);
+
+    if (ftruncate(fds[SEGMENT_FD], (off_t) size) < 0) {
+        pa_log("ftruncate() failed: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    if (fcntl(fds[SEGMENT_FD], F_ADD_SEALS, F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_SEAL) < 0) {
+        pa_log("Failed to seal shared ring segment: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    if ((map = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fds[SEGMENT_FD], (off_t) 0)) == MAP_FAILED) {
+        pa_log("mmap() failed: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    for (k = 1; k < PA_SRBCHANNEL_N_FDS; k++)
+        if ((fds[k] = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK)) < 0) {
+            pa_log("eventfd() failed: %s", pa_cstrerror(errno));
+            munmap(map, size);
+            goto fail;
+        }
+
+    /* The segment is zeroed by ftruncate() */
+    shared = map;
+    shared->capacity = SRB_CAPACITY;
+
+    return srbchannel_new(m, 0, fds, map, size, SRB_CAPACITY);
+
+fail:
+    for (k = 0; k < PA_SRBCHANNEL_N_FDS; k++)
+        if (fds[k] >= 0)
+            pa_close(fds[k]);
+
+    return NULL;
+}
+
+pa_srbchannel* pa_srbchannel_new_from_fds(pa_mainloop_api *m, const int fds[PA_SRBCHANNEL_N_FDS]) {
+    struct stat st;
+    uint32_t capacity;
+    void *map = MAP_FAILED;
+    size_t size = 0;
+    unsigned k;
+    int seals;
+
+    pa_assert(m);
+    pa_assert(fds);
+
+    for (k = 1; k < PA_SRBCHANNEL_N_FDS; k++) {
+        pa_make_fd_nonblock(fds[k]);
+        pa_make_fd_cloexec(fds[k]);
+    }
+
+    /* Otherwise the creator could make us crash by shrinking it */
+    if ((seals = fcntl(fds[SEGMENT_FD], F_GET_SEALS)) < 0 || !(seals & F_SEAL_SHRINK)) {
+        pa_log("Shared ring segment is not sealed.");
+        goto fail;
+    }
+
+    if (fstat(fds[SEGMENT_FD], &st) < 0) {
+        pa_log("fstat() failed: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    if (st.st_size < (off_t) segment_size(0) || st.st_size > (off_t) segment_size(SRB_CAPACITY * 16)) {
+        pa_log("Shared ring segment has invalid size.");
+        goto fail;
+    }
+
+    size = (size_t) st.st_size;
+
+    if ((map = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fds[SEGMENT_FD], (off_t) 0)) == MAP_FAILED) {
+        pa_log("mmap() failed: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    /* Read exactly once, and only trusted if it fits */
+    capacity = ((volatile struct srb_shared*) map)->capacity;
+
+    if (capacity <= 0 || capacity != (uint32_t) pa_make_power_of_two(capacity) || segment_size(capacity) != size) {
+        pa_log("Shared ring segment has invalid capacity.");
+        goto fail;
+    }
+
+    return srbchannel_new(m, 1, fds, map, size, capacity);
+
+fail:
+    if (map != MAP_FAILED)
+        munmap(map, size);
+
+    for (k = 0; k < PA_SRBCHANNEL_N_FDS; k++)
+        pa_close(fds[k]);
+
+    return NULL;
+}
+
+static void srbchannel_free(pa_srbchannel *sr) {
+    unsigned k;
+
+    if (sr->mainloop)
+        disable_events(sr);
+
+    munmap(sr->map, sr->map_size);
+
+    for (k = 0; k < PA_SRBCHANNEL_N_FDS; k++)
+        pa_close(sr->fds[k]);
+
+    pa_xfree(sr);
+}
+
+void pa_srbchannel_free(pa_srbchannel *sr) {
+    pa_assert(sr);
+    pa_assert(!sr->freed);
+
+    if (sr->dispatching) {
+        sr->callback = NULL;
+        sr->freed = TRUE;
+        return;
+    }
+
+    srbchannel_free(sr);
+}
+
+void pa_srbchannel_get_fds(pa_srbchannel *sr, int fds[PA_SRBCHANNEL_N_FDS]) {
+    pa_assert(sr);
+    pa_assert(fds);
+
+    memcpy(fds, sr->fds, sizeof(sr->fds));
+}
+
+ssize_t pa_srbchannel_writev(pa_srbchannel *sr, const struct iovec *iov, int iovcnt) {
+    uint32_t used, space;
+    size_t done = 0;
+    int k;
+
+    pa_assert(sr);
+    pa_assert(iov);
+    pa_assert(iovcnt > 0);
+
+    used = sr->write_index - (uint32_t) pa_atomic_load(&sr->shared->ring[sr->side].read_index);
+
+    if (used > sr->capacity) {
+        pa_log_warn("Peer corrupted the shared ring.");
+        return -1;
+    }
+
+    space = sr->capacity - used;
+
+    for (k = 0; k < iovcnt && space > 0; k++) {
+        const uint8_t *s = iov[k].iov_base;
+        size_t l = PA_MIN(iov[k].iov_len, (size_t) space);
+
+        while (l > 0) {
+            uint32_t idx = sr->write_index & (sr->capacity - 1);
+            size_t n = PA_MIN(l, (size_t) (sr->capacity - idx));
+
+            memcpy(sr->write_data + idx, s, n);
+
+            s += n;
+            l -= n;
+            done += n;
+            space -= (uint32_t) n;
+            sr->write_index += (uint32_t) n;
+        }
+    }
+
+    sr->write_blocked = space <= 0;
+
+    if (done > 0) {
+        sr->progress = TRUE;
+
+        /* Publishes the data */
+        pa_atomic_store(&sr->shared->ring[sr->side].write_index, (int) sr->write_index);
+        wakeup_peer(sr);
+    }
+
+    return (ssize_t) done;
+}
+
+ssize_t pa_srbchannel_read(pa_srbchannel *sr, void *data, size_t l) {
+    uint32_t avail;
+    uint8_t *d = data;
+    size_t done = 0;
+
+    pa_assert(sr);
+    pa_assert(data);
+    pa_assert(l > 0);
+
+    avail = (uint32_t) pa_atomic_load(&sr->shared->ring[!sr->side].write_index) - sr->read_index;
+
+    if (avail > sr->capacity) {
+        pa_log_warn("Peer corrupted the shared ring.");
+        return -1;
+    }
+
+    l = PA_MIN(l, (size_t) avail);
+
+    while (l > 0) {
+        uint32_t idx = sr->read_index & (sr->capacity - 1);
+        size_t n = PA_MIN(l, (size_t) (sr->capacity - idx));
+
+        memcpy(d, sr->read_data + idx, n);
+
+        d += n;
+        l -= n;
+        done += n;
+        sr->read_index += (uint32_t) n;
+    }
+
+    if (done > 0) {
+        sr->progress = TRUE;
+
+        /* Hands the space back */
+        pa_atomic_store(&sr->shared->ring[!sr->side].read_index, (int) sr->read_index);
+        wakeup_peer(sr);
+
+        /* Outside of the callback nobody would come back for the rest */
+        if (!sr->dispatching && sr->defer_event && can_read(sr))
+            sr->mainloop->defer_enable(sr->defer_event, 1);
+    }
+
+    return (ssize_t) done;
+}
+
+void pa_srbchannel_set_callback(pa_srbchannel *sr, pa_srbchannel_cb_t cb, void *userdata) {
+    pa_assert(sr);
+
+    sr->callback = cb;
+    sr->userdata = userdata;
+}
+
+void pa_srbchannel_set_mainloop_api(pa_srbchannel *sr, pa_mainloop_api *m) {
+    pa_assert(sr);
+
+    if (sr->mainloop == m)
+        return;
+
+    if (sr->mainloop)
+        disable_events(sr);
+
+    if ((sr->mainloop = m))
+        enable_events(sr);
+}
+
+#else /* USE_SRBCHANNEL */
+
+pa_srbchannel* pa_srbchannel_new(pa_mainloop_api *m) {
+    return NULL;
+}
+
+pa_srbchannel* pa_srbchannel_new_from_fds(pa_mainloop_api *m, const int fds[PA_SRBCHANNEL_N_FDS]) {
+    unsigned k;
+
+    for (k = 0; k < PA_SRBCHANNEL_N_FDS; k++)
+        pa_close(fds[k]);
+
+    return NULL;
+}
+
+void pa_srbchannel_free(pa_srbchannel *sr) {
+    pa_assert_not_reached();
+}
+
+void pa_srbchannel_get_fds(pa_srbchannel *sr, int fds[PA_SRBCHANNEL_N_FDS]) {
+    pa_assert_not_reached();
+}
+
+ssize_t pa_srbchannel_writev(pa_srbchannel *sr, const struct iovec *iov, int iovcnt) {
+    pa_assert_not_reached();
+}
+
+ssize_t pa_srbchannel_read(pa_srbchannel *sr, void *data, size_t l) {
+    pa_assert_not_reached();
+}
+
+void pa_srbchannel_set_callback(pa_srbchannel *sr, pa_srbchannel_cb_t cb, void *userdata) {
+    pa_assert_not_reached();
+}
+
+void pa_srbchannel_set_mainloop_api(pa_srbchannel *sr, pa_mainloop_api *m) {
+    pa_assert_not_reached();
+}
+
+#endif /* USE_SRBCHANNEL */
@@ -0,0 +1,79 @@
+#ifndef foopulsesrbchannelhfoo
+#define foopulsesrbchannelhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <sys/types.h>
+
+#include <pulse/mainloop-api.h>
+
+#include <pulsecore/macro.h>
+#include <pulsecore/socket.h>
+
+/* A bidirectional byte channel between two processes on the same
+ * machine, made of two single producer, single consumer rings in a
+ * shared memory segment. The read and write indexes live in the
+ * segment, too, so data is passed without any system calls. An eventfd
+ * per side is only written to while that side is (about to go)
+ * sleeping.
+ *
+ * One side creates the channel and passes the file descriptors to the
+ * other one, usually over a local socket. Neither side trusts what the
+ * other one puts into the segment. */
+
+typedef struct pa_srbchannel pa_srbchannel;
+
+/* The segment, the eventfd of the creator and the one of the peer */
+#define PA_SRBCHANNEL_N_FDS 3
+
+/* Called when there might be something to read, or room to write
+ * after a write came up short. If it neither reads nor writes
+ * anything, it is only called again once the peer did. */
+typedef void (*pa_srbchannel_cb_t)(pa_srbchannel *sr, void *userdata);
+
+pa_bool_t pa_srbchannel_supported(void);
+
+pa_srbchannel* pa_srbchannel_new(pa_mainloop_api *m);
+
+/* Takes over the file descriptors, also on failure */
+pa_srbchannel* pa_srbchannel_new_from_fds(pa_mainloop_api *m, const int fds[PA_SRBCHANNEL_N_FDS]);
+
+void pa_srbchannel_free(pa_srbchannel *sr);
+
+/* The file descriptors to pass to the peer. They still belong to the
+ * channel. */
+void pa_srbchannel_get_fds(pa_srbchannel *sr, int fds[PA_SRBCHANNEL_N_FDS]);
+
+/* Returns how much was written, which might be less than requested or
+ * 0 if the ring is full, or negative if the peer corrupted the ring */
+ssize_t pa_srbchannel_writev(pa_srbchannel *sr, const struct iovec *iov, int iovcnt);
+
+/* Returns how much was read, 0 if there is nothing to read, or
+ * negative if the peer corrupted the ring */
+ssize_t pa_srbchannel_read(pa_srbchannel *sr, void *data, size_t l);
+
+void pa_srbchannel_set_callback(pa_srbchannel *sr, pa_srbchannel_cb_t cb, void *userdata);
+
+/* Moves the events to another main loop. Like
+ * pa_iochannel_set_mainloop_api(), pass NULL in the old thread first
+ * and the new main loop in the new one then. */
+void pa_srbchannel_set_mainloop_api(pa_srbchannel *sr, pa_mainloop_api *m);
+
+#endif
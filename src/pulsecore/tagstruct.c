@@ -37,29 +37,76 @@
 
 #include <pulsecore/socket.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/flist.h>
+#include <pulsecore/proplist-util.h>
 
 #include "tagstruct.h"
 
 #define MAX_TAG_SIZE (64*1024)
 
+/* Most commands and replies fit into this, so they are built right in
+ * the tagstruct, which is recycled through a free list */
+#define MAX_APPENDED_SIZE 128
+
 struct pa_tagstruct {
     uint8_t *data;
     size_t length, allocated;
     size_t rindex;
 
-    pa_bool_t dynamic;
+    enum {
+        PA_TAGSTRUCT_FIXED,     /* read only data of the caller */
+        PA_TAGSTRUCT_BUFFER,    /* writable buffer of the caller, until it is full */
+        PA_TAGSTRUCT_APPENDED,  /* the buffer below, until it is full */
+        PA_TAGSTRUCT_DYNAMIC    /* our own memory */
+    } type;
+
+    uint8_t appended[MAX_APPENDED_SIZE];
 };
 
+PA_STATIC_FLIST_DECLARE(tagstructs, 0, pa_xfree);
+
+static pa_tagstruct *tagstruct_new(void) {
+    pa_tagstruct *t;
+
+    if (!(t = pa_flist_pop(PA_STATIC_FLIST_GET(tagstructs))))
+        t = pa_xnew(pa_tagstruct, 1);
+
+    t->length = 0;
+    t->rindex = 0;
+
+    return t;
+}
+
 pa_tagstruct *pa_tagstruct_new(const uint8_t* data, size_t length) {
     pa_tagstruct*t;
 
     pa_assert(!data || (data && length));
 
-    t = pa_xnew(pa_tagstruct, 1);
-    t->data = (uint8_t*) data;
-    t->allocated = t->length = data ? length : 0;
-    t->rindex = 0;
-    t->dynamic = !data;
+    t = tagstruct_new();
+
+    if (data) {
+        t->data = (uint8_t*) data;
+        t->allocated = t->length = length;
+        t->type = PA_TAGSTRUCT_FIXED;
+    } else {
+        t->data = t->appended;
+        t->allocated = MAX_APPENDED_SIZE;
+        t->type = PA_TAGSTRUCT_APPENDED;
+    }
+
+    return t;
+}
+
+pa_tagstruct *pa_tagstruct_new_buffer(uint8_t *buffer, size_t size) {
+    pa_tagstruct *t;
+
+    pa_assert(buffer);
+    pa_assert(size > 0);
+
+    t = tagstruct_new();
+    t->data = buffer;
+    t->allocated = size;
+    t->type = PA_TAGSTRUCT_BUFFER;
 
     return t;
 }
@@ -67,32 +114,67 @@ pa_tagstruct *pa_tagstruct_new(const uint8_t* data, size_t length) {
 void pa_tagstruct_free(pa_tagstruct*t) {
     pa_assert(t);
 
-    if (t->dynamic)
+    if (t->type == PA_TAGSTRUCT_DYNAMIC)
         pa_xfree(t->data);
-    pa_xfree(t);
+
+    if (pa_flist_push(PA_STATIC_FLIST_GET(tagstructs), t) < 0)
+        pa_xfree(t);
+}
+
+pa_bool_t pa_tagstruct_is_dynamic(pa_tagstruct *t) {
+    pa_assert(t);
+
+    return t->type == PA_TAGSTRUCT_DYNAMIC;
 }
 
 uint8_t* pa_tagstruct_free_data(pa_tagstruct*t, size_t *l) {
     uint8_t *p;
 
     pa_assert(t);
-    pa_assert(t->dynamic);
+    pa_assert(t->type != PA_TAGSTRUCT_FIXED);
     pa_assert(l);
 
-    p = t->data;
+    if (t->type == PA_TAGSTRUCT_DYNAMIC) {
+        p = t->data;
+        t->type = PA_TAGSTRUCT_APPENDED;
+    } else
+        p = pa_xmemdup(t->data, t->length);
+
     *l = t->length;
-    pa_xfree(t);
+    pa_tagstruct_free(t);
     return p;
 }
 
-static void extend(pa_tagstruct*t, size_t l) {
+void pa_tagstruct_reserve(pa_tagstruct *t, size_t l) {
+    uint8_t *d;
+
     pa_assert(t);
-    pa_assert(t->dynamic);
+    pa_assert(t->type != PA_TAGSTRUCT_FIXED);
 
     if (t->length+l <= t->allocated)
         return;
 
-    t->data = pa_xrealloc(t->data, t->allocated = t->length+l+100);
+    if (t->type == PA_TAGSTRUCT_DYNAMIC) {
+        t->data = pa_xrealloc(t->data, t->allocated = t->length+l);
+        return;
+    }
+
+    /* Move out of the buffer we were given or came with */
+    d = pa_xmalloc(t->allocated = t->length+l);
+    memcpy(d, t->data, t->length);
+    t->data = d;
+    t->type = PA_TAGSTRUCT_DYNAMIC;
+}
+
+static void extend(pa_tagstruct*t, size_t l) {
+    pa_assert(t);
+
+    if (PA_LIKELY(t->length+l <= t->allocated))
+        return;
+
+    /* Grow exponentially, so that building a long list of entries is
+     * not quadratic */
+    pa_tagstruct_reserve(t, PA_MAX(l, t->allocated));
 }
 
 void pa_tagstruct_puts(pa_tagstruct*t, const char *s) {
@@ -269,6 +351,10 @@ void pa_tagstruct_put_volume(pa_tagstruct *t, pa_volume_t vol) {
 
 void pa_tagstruct_put_proplist(pa_tagstruct *t, pa_proplist *p) {
     void *state = NULL;
+    const char *k;
+    const void *v;
+    size_t l;
+
     pa_assert(t);
     pa_assert(p);
 
@@ -276,18 +362,34 @@ void pa_tagstruct_put_proplist(pa_tagstruct *t, pa_proplist *p) {
 
     t->data[t->length++] = PA_TAG_PROPLIST;
 
-    for (;;) {
-        const char *k;
-        const void *d;
-        size_t l;
+    /* Each entry is a string, its length as u32 and the data as
+     * arbitrary, written in one go after checking for room once */
+    while ((k = pa_proplist_iterate_data(p, &state, &v, &l))) {
+        size_t kl;
+        uint32_t tmp;
+        uint8_t *d;
 
-        if (!(k = pa_proplist_iterate(p, &state)))
-            break;
+        kl = strlen(k) + 1;
+        extend(t, 1 + kl + 5 + 5 + l);
+        d = t->data + t->length;
+
+        *(d++) = PA_TAG_STRING;
+        memcpy(d, k, kl);
+        d += kl;
+
+        tmp = htonl((uint32_t) l);
+        *(d++) = PA_TAG_U32;
+        memcpy(d, &tmp, 4);
+        d += 4;
+
+        *(d++) = PA_TAG_ARBITRARY;
+        memcpy(d, &tmp, 4);
+        d += 4;
+
+        if (l)
+            memcpy(d, v, l);
 
-        pa_tagstruct_puts(t, k);
-        pa_assert_se(pa_proplist_get(p, k, &d, &l) >= 0);
-        pa_tagstruct_putu32(t, (uint32_t) l);
-        pa_tagstruct_put_arbitrary(t, d, l);
+        t->length += 1 + kl + 5 + 5 + l;
     }
 
     pa_tagstruct_puts(t, NULL);
@@ -422,7 +524,7 @@ int pa_tagstruct_eof(pa_tagstruct*t) {
 
 const uint8_t* pa_tagstruct_data(pa_tagstruct*t, size_t *l) {
     pa_assert(t);
-    pa_assert(t->dynamic);
+    pa_assert(t->type != PA_TAGSTRUCT_FIXED);
     pa_assert(l);
 
     *l = t->length;
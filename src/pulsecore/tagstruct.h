@@ -62,10 +62,25 @@ enum {
     PA_TAG_FORMAT_INFO = 'f',
 };
 
+/* With data, the tagstruct reads from it without copying it. Otherwise
+ * it starts out with a small buffer of its own for writing. Tagstructs
+ * are recycled, so creating one usually doesn't allocate anything. */
 pa_tagstruct *pa_tagstruct_new(const uint8_t* data, size_t length);
+
+/* Writes into the given buffer until it is full. Then the data is moved
+ * to memory of the tagstruct. */
+pa_tagstruct *pa_tagstruct_new_buffer(uint8_t *buffer, size_t size);
+
 void pa_tagstruct_free(pa_tagstruct*t);
 uint8_t* pa_tagstruct_free_data(pa_tagstruct*t, size_t *l);
 
+/* Whether the data lives in memory the tagstruct allocated, so that
+ * pa_tagstruct_free_data() hands it over without copying */
+pa_bool_t pa_tagstruct_is_dynamic(pa_tagstruct *t);
+
+/* Makes sure that l more bytes can be written without reallocating */
+void pa_tagstruct_reserve(pa_tagstruct *t, size_t l);
+
 int pa_tagstruct_eof(pa_tagstruct*t);
 const uint8_t* pa_tagstruct_data(pa_tagstruct*t, size_t *l);
 
@@ -35,13 +35,12 @@
 PA_STATIC_TLS_DECLARE_NO_FREE(thread_mq);
 
 static void asyncmsgq_read_cb(pa_mainloop_api*api, pa_io_event* e, int fd, pa_io_event_flags_t events, void *userdata) {
-    pa_thread_mq *q = userdata;
-    pa_asyncmsgq *aq;
+    pa_asyncmsgq *aq = userdata;
 
-    pa_assert(pa_asyncmsgq_read_fd(q->outq) == fd);
+    pa_assert(pa_asyncmsgq_read_fd(aq) == fd);
     pa_assert(events == PA_IO_EVENT_INPUT);
 
-    pa_asyncmsgq_ref(aq = q->outq);
+    pa_asyncmsgq_ref(aq);
     pa_asyncmsgq_read_after_poll(aq);
 
     for (;;) {
@@ -67,13 +66,13 @@ static void asyncmsgq_read_cb(pa_mainloop_api*api, pa_io_event* e, int fd, pa_io
 }
 
 static void asyncmsgq_write_cb(pa_mainloop_api*api, pa_io_event* e, int fd, pa_io_event_flags_t events, void *userdata) {
-    pa_thread_mq *q = userdata;
+    pa_asyncmsgq *aq = userdata;
 
-    pa_assert(pa_asyncmsgq_write_fd(q->inq) == fd);
+    pa_assert(pa_asyncmsgq_write_fd(aq) == fd);
     pa_assert(events == PA_IO_EVENT_INPUT);
 
-    pa_asyncmsgq_write_after_poll(q->inq);
-    pa_asyncmsgq_write_before_poll(q->inq);
+    pa_asyncmsgq_write_after_poll(aq);
+    pa_asyncmsgq_write_before_poll(aq);
 }
 
 void pa_thread_mq_init(pa_thread_mq *q, pa_mainloop_api *mainloop, pa_rtpoll *rtpoll) {
@@ -85,15 +84,43 @@ void pa_thread_mq_init(pa_thread_mq *q, pa_mainloop_api *mainloop, pa_rtpoll *rt
     pa_assert_se(q->outq = pa_asyncmsgq_new(0));
 
     pa_assert_se(pa_asyncmsgq_read_before_poll(q->outq) == 0);
-    pa_assert_se(q->read_event = mainloop->io_new(mainloop, pa_asyncmsgq_read_fd(q->outq), PA_IO_EVENT_INPUT, asyncmsgq_read_cb, q));
+    pa_assert_se(q->read_event = mainloop->io_new(mainloop, pa_asyncmsgq_read_fd(q->outq), PA_IO_EVENT_INPUT, asyncmsgq_read_cb, q->outq));
 
     pa_asyncmsgq_write_before_poll(q->inq);
-    pa_assert_se(q->write_event = mainloop->io_new(mainloop, pa_asyncmsgq_write_fd(q->inq), PA_IO_EVENT_INPUT, asyncmsgq_write_cb, q));
+    pa_assert_se(q->write_event = mainloop->io_new(mainloop, pa_asyncmsgq_write_fd(q->inq), PA_IO_EVENT_INPUT, asyncmsgq_write_cb, q->inq));
+
+    q->thread_mainloop = NULL;
+    q->read_thread_event = q->write_thread_event = NULL;
 
     pa_rtpoll_item_new_asyncmsgq_read(rtpoll, PA_RTPOLL_EARLY, q->inq);
     pa_rtpoll_item_new_asyncmsgq_write(rtpoll, PA_RTPOLL_LATE, q->outq);
 }
 
+void pa_thread_mq_init_thread_mainloop(pa_thread_mq *q, pa_mainloop_api *mainloop, pa_mainloop_api *thread_mainloop) {
+    pa_assert(q);
+    pa_assert(mainloop);
+    pa_assert(thread_mainloop);
+
+    q->mainloop = mainloop;
+    pa_assert_se(q->inq = pa_asyncmsgq_new(0));
+    pa_assert_se(q->outq = pa_asyncmsgq_new(0));
+
+    pa_assert_se(pa_asyncmsgq_read_before_poll(q->outq) == 0);
+    pa_assert_se(q->read_event = mainloop->io_new(mainloop, pa_asyncmsgq_read_fd(q->outq), PA_IO_EVENT_INPUT, asyncmsgq_read_cb, q->outq));
+
+    pa_asyncmsgq_write_before_poll(q->inq);
+    pa_assert_se(q->write_event = mainloop->io_new(mainloop, pa_asyncmsgq_write_fd(q->inq), PA_IO_EVENT_INPUT, asyncmsgq_write_cb, q->inq));
+
+    /* The same the other way round, for the thread */
+    q->thread_mainloop = thread_mainloop;
+
+    pa_assert_se(pa_asyncmsgq_read_before_poll(q->inq) == 0);
+    pa_assert_se(q->read_thread_event = thread_mainloop->io_new(thread_mainloop, pa_asyncmsgq_read_fd(q->inq), PA_IO_EVENT_INPUT, asyncmsgq_read_cb, q->inq));
+
+    pa_asyncmsgq_write_before_poll(q->outq);
+    pa_assert_se(q->write_thread_event = thread_mainloop->io_new(thread_mainloop, pa_asyncmsgq_write_fd(q->outq), PA_IO_EVENT_INPUT, asyncmsgq_write_cb, q->outq));
+}
+
 void pa_thread_mq_done(pa_thread_mq *q) {
     pa_assert(q);
 
@@ -110,6 +137,14 @@ void pa_thread_mq_done(pa_thread_mq *q) {
     q->mainloop->io_free(q->write_event);
     q->read_event = q->write_event = NULL;
 
+    /* The thread is gone by now, so we may touch its main loop */
+    if (q->thread_mainloop) {
+        q->thread_mainloop->io_free(q->read_thread_event);
+        q->thread_mainloop->io_free(q->write_thread_event);
+        q->read_thread_event = q->write_thread_event = NULL;
+        q->thread_mainloop = NULL;
+    }
+
     pa_asyncmsgq_unref(q->inq);
     pa_asyncmsgq_unref(q->outq);
     q->inq = q->outq = NULL;
@@ -34,9 +34,18 @@ typedef struct pa_thread_mq {
     pa_mainloop_api *mainloop;
     pa_asyncmsgq *inq, *outq;
     pa_io_event *read_event, *write_event;
+
+    /* Only if the thread runs a main loop instead of an rtpoll */
+    pa_mainloop_api *thread_mainloop;
+    pa_io_event *read_thread_event, *write_thread_event;
 } pa_thread_mq;
 
 void pa_thread_mq_init(pa_thread_mq *q, pa_mainloop_api *mainloop, pa_rtpoll *rtpoll);
+
+/* Like pa_thread_mq_init(), but for threads that run a pa_mainloop
+ * rather than a pa_rtpoll. Has to be called before the thread starts
+ * running thread_mainloop. */
+void pa_thread_mq_init_thread_mainloop(pa_thread_mq *q, pa_mainloop_api *mainloop, pa_mainloop_api *thread_mainloop);
 void pa_thread_mq_done(pa_thread_mq *q);
 
 /* Install the specified pa_thread_mq object for the current thread */
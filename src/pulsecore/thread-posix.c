@@ -27,14 +27,26 @@
 #include <pthread.h>
 #include <sched.h>
 #include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 
 #ifdef __linux__
 #include <sys/prctl.h>
 #endif
 
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+
 #include <pulse/xmalloc.h>
 #include <pulsecore/atomic.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/llist.h>
+#include <pulsecore/mutex.h>
+#include <pulsecore/core-rtclock.h>
 
 #include "thread.h"
 
@@ -45,6 +57,11 @@ struct pa_thread {
     pa_atomic_t running;
     pa_bool_t joined;
     char *name;
+
+    /* The kernel's id for this thread, 0 until the thread has started */
+    pa_atomic_t tid;
+
+    PA_LLIST_FIELDS(pa_thread);
 };
 
 struct pa_tls {
@@ -65,6 +82,16 @@ static void thread_free_cb(void *p) {
 
 PA_STATIC_TLS_DECLARE(current_thread, thread_free_cb);
 
+/* All threads created with pa_thread_new(), for pa_thread_foreach() */
+static pa_static_mutex threads_mutex = PA_STATIC_MUTEX_INIT;
+static PA_LLIST_HEAD(pa_thread, threads) = NULL;
+
+static void store_tid(pa_thread *t) {
+#if defined(__linux__) && defined(HAVE_SYS_SYSCALL_H) && defined(SYS_gettid)
+    pa_atomic_store(&t->tid, (int) syscall(SYS_gettid));
+#endif
+}
+
 static void* internal_thread_func(void *userdata) {
     pa_thread *t = userdata;
     pa_assert(t);
@@ -76,6 +103,7 @@ static void* internal_thread_func(void *userdata) {
 #endif
 
     t->id = pthread_self();
+    store_tid(t);
 
     PA_STATIC_TLS_SET(current_thread, t);
 
@@ -88,6 +116,7 @@ static void* internal_thread_func(void *userdata) {
 
 pa_thread* pa_thread_new(const char *name, pa_thread_func_t thread_func, void *userdata) {
     pa_thread *t;
+    pa_mutex *m;
 
     pa_assert(thread_func);
 
@@ -96,13 +125,20 @@ pa_thread* pa_thread_new(const char *name, pa_thread_func_t thread_func, void *u
     t->thread_func = thread_func;
     t->userdata = userdata;
 
+    m = pa_static_mutex_get(&threads_mutex, FALSE, FALSE);
+    pa_mutex_lock(m);
+
     if (pthread_create(&t->id, NULL, internal_thread_func, t) < 0) {
+        pa_mutex_unlock(m);
         pa_xfree(t);
         return NULL;
     }
 
     pa_atomic_inc(&t->running);
 
+    PA_LLIST_PREPEND(pa_thread, threads, t);
+    pa_mutex_unlock(m);
+
     return t;
 }
 
@@ -119,10 +155,17 @@ int pa_thread_is_running(pa_thread *t) {
 }
 
 void pa_thread_free(pa_thread *t) {
+    pa_mutex *m;
+
     pa_assert(t);
 
     pa_thread_join(t);
 
+    m = pa_static_mutex_get(&threads_mutex, FALSE, FALSE);
+    pa_mutex_lock(m);
+    PA_LLIST_REMOVE(pa_thread, threads, t);
+    pa_mutex_unlock(m);
+
     pa_xfree(t->name);
     pa_xfree(t);
 }
@@ -151,6 +194,7 @@ pa_thread* pa_thread_self(void) {
     t->id = pthread_self();
     t->joined = TRUE;
     pa_atomic_store(&t->running, 2);
+    store_tid(t);
 
     PA_STATIC_TLS_SET(current_thread, t);
 
@@ -206,6 +250,129 @@ const char *pa_thread_get_name(pa_thread *t) {
     return t->name;
 }
 
+int pa_thread_set_affinity(pa_thread *t, const pa_cpu_set *cpus) {
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    cpu_set_t mask;
+    unsigned i;
+    int r;
+
+    pa_assert(t);
+
+    CPU_ZERO(&mask);
+
+    for (i = 0; i < PA_CPU_SET_MAX && i < CPU_SETSIZE; i++)
+        if (!cpus || pa_cpu_set_contains(cpus, i))
+            CPU_SET(i, &mask);
+
+    if ((r = pthread_setaffinity_np(t->id, sizeof(mask), &mask)) != 0) {
+        errno = r;
+        return -1;
+    }
+
+    return 0;
+#else
+    pa_assert(t);
+
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+#ifdef __linux__
+static void read_proc_stats(int tid, pa_thread_stats *stats) {
+    char fn[64], line[512];
+    FILE *f;
+
+    pa_snprintf(fn, sizeof(fn), "/proc/self/task/%i/status", tid);
+
+    if ((f = pa_fopen_cloexec(fn, "r"))) {
+        while (fgets(line, sizeof(line), f)) {
+            if (pa_startswith(line, "voluntary_ctxt_switches:"))
+                stats->voluntary_switches = strtoull(line + 24, NULL, 10);
+            else if (pa_startswith(line, "nonvoluntary_ctxt_switches:"))
+                stats->involuntary_switches = strtoull(line + 27, NULL, 10);
+        }
+
+        fclose(f);
+    }
+
+    pa_snprintf(fn, sizeof(fn), "/proc/self/task/%i/stat", tid);
+
+    if ((f = pa_fopen_cloexec(fn, "r"))) {
+        char *p;
+
+        /* The thread name may contain spaces and parentheses, so
+         * start counting fields after the last ')'. The processor
+         * the thread last ran on is field 39, i.e. the 37th one after
+         * the name. */
+        if (fgets(line, sizeof(line), f) && (p = strrchr(line, ')'))) {
+            const char *state = NULL;
+            char *k;
+            unsigned n = 0;
+
+            while ((k = pa_split_spaces(p + 1, &state))) {
+                int32_t cpu;
+
+                if (++n == 37) {
+                    if (pa_atoi(k, &cpu) >= 0)
+                        stats->last_cpu = cpu;
+
+                    pa_xfree(k);
+                    break;
+                }
+
+                pa_xfree(k);
+            }
+        }
+
+        fclose(f);
+    }
+}
+#endif
+
+int pa_thread_get_stats(pa_thread *t, pa_thread_stats *stats) {
+#ifdef __linux__
+    int tid;
+#endif
+#if defined(_POSIX_THREAD_CPUTIME) && _POSIX_THREAD_CPUTIME >= 0
+    clockid_t cid;
+    struct timespec ts;
+#endif
+
+    pa_assert(t);
+    pa_assert(stats);
+
+    pa_zero(*stats);
+    stats->last_cpu = -1;
+
+#if defined(_POSIX_THREAD_CPUTIME) && _POSIX_THREAD_CPUTIME >= 0
+    if (pthread_getcpuclockid(t->id, &cid) == 0 && clock_gettime(cid, &ts) == 0)
+        stats->cpu_time = pa_timespec_load(&ts);
+#endif
+
+#ifdef __linux__
+    if ((tid = pa_atomic_load(&t->tid)) > 0)
+        read_proc_stats(tid, stats);
+#endif
+
+    return 0;
+}
+
+void pa_thread_foreach(pa_thread_foreach_cb_t cb, void *userdata) {
+    pa_thread *t;
+    pa_mutex *m;
+
+    pa_assert(cb);
+
+    m = pa_static_mutex_get(&threads_mutex, FALSE, FALSE);
+    pa_mutex_lock(m);
+
+    PA_LLIST_FOREACH(t, threads)
+        cb(t, userdata);
+
+    pa_mutex_unlock(m);
+}
+
 void pa_thread_yield(void) {
 #ifdef HAVE_PTHREAD_YIELD
     pthread_yield();
@@ -24,6 +24,7 @@
 #endif
 
 #include <stdio.h>
+#include <errno.h>
 
 #include <windows.h>
 
@@ -144,6 +145,23 @@ const char *pa_thread_get_name(pa_thread *t) {
     return NULL;
 }
 
+int pa_thread_set_affinity(pa_thread *t, const pa_cpu_set *cpus) {
+    /* Not implemented */
+    errno = ENOTSUP;
+    return -1;
+}
+
+int pa_thread_get_stats(pa_thread *t, pa_thread_stats *stats) {
+    /* Not implemented */
+    pa_zero(*stats);
+    stats->last_cpu = -1;
+    return 0;
+}
+
+void pa_thread_foreach(pa_thread_foreach_cb_t cb, void *userdata) {
+    /* Not implemented */
+}
+
 void pa_thread_yield(void) {
     Sleep(0);
 }
@@ -26,8 +26,11 @@
 #include <pulse/def.h>
 #include <pulse/gccmacro.h>
 
+#include <pulse/sample.h>
+
 #include <pulsecore/once.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/cpu-set.h>
 
 #ifndef PACKAGE
 #error "Please include config.h before including this file!"
@@ -50,6 +53,27 @@ void pa_thread_set_data(pa_thread *t, void *userdata);
 const char *pa_thread_get_name(pa_thread *t);
 void pa_thread_set_name(pa_thread *t, const char *name);
 
+/* Restrict the thread to the CPUs in the set. Passing NULL allows all
+ * CPUs again, which is useful for threads that inherited a narrower
+ * mask from their creator. */
+int pa_thread_set_affinity(pa_thread *t, const pa_cpu_set *cpus);
+
+typedef struct pa_thread_stats {
+    pa_usec_t cpu_time;
+    uint64_t voluntary_switches;
+    uint64_t involuntary_switches;
+    int last_cpu; /* -1 if unknown */
+} pa_thread_stats;
+
+/* Fields that cannot be determined on this platform are left zero */
+int pa_thread_get_stats(pa_thread *t, pa_thread_stats *stats);
+
+/* Iterate through all threads created with pa_thread_new() that
+ * haven't been freed yet. The callback must not create or free
+ * threads. */
+typedef void (*pa_thread_foreach_cb_t) (pa_thread *t, void *userdata);
+void pa_thread_foreach(pa_thread_foreach_cb_t cb, void *userdata);
+
 typedef struct pa_tls pa_tls;
 
 pa_tls* pa_tls_new(pa_free_cb_t free_cb);
@@ -0,0 +1,280 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/llist.h>
+#include <pulsecore/log.h>
+#include <pulsecore/mutex.h>
+#include <pulsecore/strbuf.h>
+#include <pulsecore/thread.h>
+
+#include "trace.h"
+
+typedef struct pa_trace_event {
+    pa_usec_t timestamp;
+    int64_t arg;
+    pa_trace_event_type_t type;
+} pa_trace_event;
+
+typedef struct pa_trace_ring pa_trace_ring;
+
+struct pa_trace_ring {
+    PA_LLIST_FIELDS(pa_trace_ring);
+
+    unsigned id;
+    char *thread_name;
+
+    /* Only ever incremented by the owning thread, after the slot
+     * it refers to has been filled in */
+    pa_atomic_t write_index;
+
+    unsigned n_events; /* power of two */
+    pa_trace_event events[];
+};
+
+static pa_atomic_t size = PA_ATOMIC_INIT(0);
+static pa_atomic_t next_id = PA_ATOMIC_INIT(0);
+
+static pa_static_mutex rings_mutex = PA_STATIC_MUTEX_INIT;
+static PA_LLIST_HEAD(pa_trace_ring, rings) = NULL;
+
+static void ring_free(void *userdata);
+
+PA_STATIC_TLS_DECLARE(trace_ring, ring_free);
+
+static const char * const event_names[PA_TRACE_EVENT_MAX] = {
+    [PA_TRACE_SLEEP] = "poll",
+    [PA_TRACE_WAKEUP] = "poll",
+    [PA_TRACE_RENDER_BEGIN] = "render",
+    [PA_TRACE_RENDER_END] = "render",
+    [PA_TRACE_WRITE] = "write",
+    [PA_TRACE_READ] = "read",
+    [PA_TRACE_XRUN] = "xrun",
+    [PA_TRACE_REWIND] = "rewind"
+};
+
+/* Chrome trace event phases: begin and end of a span, or an instant */
+static const char event_phases[PA_TRACE_EVENT_MAX] = {
+    [PA_TRACE_SLEEP] = 'B',
+    [PA_TRACE_WAKEUP] = 'E',
+    [PA_TRACE_RENDER_BEGIN] = 'B',
+    [PA_TRACE_RENDER_END] = 'E',
+    [PA_TRACE_WRITE] = 'i',
+    [PA_TRACE_READ] = 'i',
+    [PA_TRACE_XRUN] = 'i',
+    [PA_TRACE_REWIND] = 'i'
+};
+
+void pa_trace_set_size(unsigned n_events) {
+    pa_atomic_store(&size, n_events > 0 ? (int) pa_make_power_of_two(n_events) : 0);
+}
+
+unsigned pa_trace_get_size(void) {
+    return (unsigned) pa_atomic_load(&size);
+}
+
+static pa_trace_ring *ring_new(unsigned n_events) {
+    pa_trace_ring *r;
+    pa_thread *t;
+    pa_mutex *m;
+
+    r = pa_xmalloc0(sizeof(pa_trace_ring) + n_events * sizeof(pa_trace_event));
+    r->id = (unsigned) pa_atomic_inc(&next_id);
+    r->n_events = n_events;
+    pa_atomic_store(&r->write_index, 0);
+
+    if ((t = pa_thread_self()) && pa_thread_get_name(t))
+        r->thread_name = pa_xstrdup(pa_thread_get_name(t));
+    else
+        r->thread_name = pa_sprintf_malloc("thread-%u", r->id);
+
+    m = pa_static_mutex_get(&rings_mutex, FALSE, FALSE);
+    pa_mutex_lock(m);
+    PA_LLIST_PREPEND(pa_trace_ring, rings, r);
+    pa_mutex_unlock(m);
+
+    return r;
+}
+
+/* Called when the owning thread exits */
+static void ring_free(void *userdata) {
+    pa_trace_ring *r = userdata;
+    pa_mutex *m;
+
+    pa_assert(r);
+
+    m = pa_static_mutex_get(&rings_mutex, FALSE, FALSE);
+    pa_mutex_lock(m);
+    PA_LLIST_REMOVE(pa_trace_ring, rings, r);
+    pa_mutex_unlock(m);
+
+    pa_xfree(r->thread_name);
+    pa_xfree(r);
+}
+
+void pa_trace_record(pa_trace_event_type_t type, int64_t arg) {
+    pa_trace_ring *r;
+    pa_trace_event *e;
+    unsigned n, idx;
+
+    if (PA_LIKELY((n = pa_trace_get_size()) == 0))
+        return;
+
+    pa_assert(type < PA_TRACE_EVENT_MAX);
+
+    if (PA_UNLIKELY(!(r = PA_STATIC_TLS_GET(trace_ring)))) {
+        /* This is the only allocation, done once per thread */
+        r = ring_new(n);
+        PA_STATIC_TLS_SET(trace_ring, r);
+    }
+
+    /* We are the only writer, so there's no need for anything fancy
+     * here; the increment below is a full barrier and publishes the
+     * slot. */
+    idx = (unsigned) pa_atomic_load(&r->write_index);
+    e = r->events + (idx & (r->n_events - 1));
+    e->timestamp = pa_rtclock_now();
+    e->arg = arg;
+    e->type = type;
+    pa_atomic_inc(&r->write_index);
+}
+
+static void append_escaped(pa_strbuf *buf, const char *s) {
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            pa_strbuf_putc(buf, '\\');
+
+        if ((unsigned char) *s < 0x20)
+            pa_strbuf_printf(buf, "\\u%04x", (unsigned) *s);
+        else
+            pa_strbuf_putc(buf, *s);
+    }
+}
+
+/* Called with rings_mutex held */
+static void ring_to_json(pa_trace_ring *r, pa_strbuf *buf, unsigned pid, pa_bool_t *first) {
+    pa_trace_event *copy;
+    unsigned begin, end, valid_begin, i;
+
+    copy = pa_xnew(pa_trace_event, r->n_events);
+
+    /* The owner keeps writing while we copy. Whatever was published
+     * before we started is in [end - n_events, end), but slots the
+     * owner reused while we were copying have to be dropped. The add
+     * gives us a barrier after reading the index. */
+    end = (unsigned) pa_atomic_add(&r->write_index, 0);
+    memcpy(copy, r->events, r->n_events * sizeof(pa_trace_event));
+    valid_begin = (unsigned) pa_atomic_load(&r->write_index) + 1;
+
+    begin = end > r->n_events ? end - r->n_events : 0;
+    if (valid_begin > r->n_events && valid_begin - r->n_events > begin)
+        begin = valid_begin - r->n_events;
+
+    pa_strbuf_printf(buf, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"",
+                     *first ? "" : ",", pid, r->id);
+    append_escaped(buf, r->thread_name);
+    pa_strbuf_puts(buf, "\"}}");
+    *first = FALSE;
+
+    for (i = begin; (int) (end - i) > 0; i++) {
+        pa_trace_event *e = copy + (i & (r->n_events - 1));
+
+        if (e->type >= PA_TRACE_EVENT_MAX)
+            continue;
+
+        pa_strbuf_printf(buf, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu,\"pid\":%u,\"tid\":%u",
+                         event_names[e->type], event_phases[e->type],
+                         (unsigned long long) e->timestamp, pid, r->id);
+
+        if (event_phases[e->type] == 'i')
+            pa_strbuf_puts(buf, ",\"s\":\"t\"");
+
+        pa_strbuf_printf(buf, ",\"args\":{\"arg\":%lld}}", (long long) e->arg);
+    }
+
+    pa_xfree(copy);
+}
+
+char *pa_trace_to_json(void) {
+    pa_strbuf *buf;
+    pa_trace_ring *r;
+    pa_mutex *m;
+    pa_bool_t first = TRUE;
+    unsigned pid;
+
+    buf = pa_strbuf_new();
+    pid = (unsigned) getpid();
+
+    pa_strbuf_puts(buf, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    m = pa_static_mutex_get(&rings_mutex, FALSE, FALSE);
+    pa_mutex_lock(m);
+
+    PA_LLIST_FOREACH(r, rings)
+        ring_to_json(r, buf, pid, &first);
+
+    pa_mutex_unlock(m);
+
+    pa_strbuf_puts(buf, "\n]}\n");
+
+    return pa_strbuf_tostring_free(buf);
+}
+
+int pa_trace_dump(const char *fn) {
+    FILE *f;
+    char *json;
+    int r = 0;
+
+    pa_assert(fn);
+
+    if (!(f = pa_fopen_cloexec(fn, "w"))) {
+        pa_log("Failed to open trace file '%s': %s", fn, pa_cstrerror(errno));
+        return -1;
+    }
+
+    json = pa_trace_to_json();
+
+    if (fputs(json, f) == EOF) {
+        pa_log("Failed to write trace file '%s': %s", fn, pa_cstrerror(errno));
+        r = -1;
+    }
+
+    pa_xfree(json);
+
+    if (fclose(f) != 0 && r == 0) {
+        pa_log("Failed to write trace file '%s': %s", fn, pa_cstrerror(errno));
+        r = -1;
+    }
+
+    return r;
+}
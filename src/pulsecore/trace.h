@@ -0,0 +1,67 @@
+#ifndef foopulsecoretracehfoo
+#define foopulsecoretracehfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <inttypes.h>
+
+#include <pulsecore/macro.h>
+
+/* A per-thread binary trace of fixed size events, meant for the IO
+ * threads where pa_log() is too expensive and not real-time safe.
+ *
+ * Recording an event neither formats anything nor takes a lock; each
+ * thread gets its own ring buffer (allocated the first time the thread
+ * records something) and the oldest events are overwritten once it is
+ * full. The rings can be converted to the Chrome trace event JSON
+ * format (which Perfetto and chrome://tracing understand) at any time
+ * from any thread. */
+
+typedef enum pa_trace_event_type {
+    PA_TRACE_SLEEP,         /* about to poll, arg: timeout in usec or -1 */
+    PA_TRACE_WAKEUP,        /* poll returned, arg: poll() result */
+    PA_TRACE_RENDER_BEGIN,  /* arg: bytes requested */
+    PA_TRACE_RENDER_END,    /* arg: bytes rendered */
+    PA_TRACE_WRITE,         /* arg: bytes written to the device */
+    PA_TRACE_READ,          /* arg: bytes read from the device */
+    PA_TRACE_XRUN,          /* arg: error code */
+    PA_TRACE_REWIND,        /* arg: bytes rewound */
+    PA_TRACE_EVENT_MAX
+} pa_trace_event_type_t;
+
+/* Number of slots in the ring of each thread, rounded up to a power
+ * of two. One of them is reserved for the event that might be in the
+ * middle of being written while the ring is read, so at most n - 1
+ * events can be retrieved. 0 (the default) disables tracing. Rings
+ * that already exist keep their size. */
+void pa_trace_set_size(unsigned n_events);
+unsigned pa_trace_get_size(void);
+
+void pa_trace_record(pa_trace_event_type_t type, int64_t arg);
+
+/* Returns a newly allocated string with the contents of all rings in
+ * Chrome trace event format. */
+char *pa_trace_to_json(void);
+
+/* Writes pa_trace_to_json() to the given file. Returns negative on
+ * error. Not to be used in IO threads. */
+int pa_trace_dump(const char *fn);
+
+#endif
@@ -0,0 +1,615 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/codec.h>
+#include <pulsecore/iochannel.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/pstream.h>
+#include <pulsecore/socket.h>
+
+enum {
+    SIGNAL_SILENCE,
+    SIGNAL_TONE,
+    SIGNAL_MUSIC,
+    SIGNAL_NOISE
+};
+
+/* Writes length bytes of the signal as 16 bit samples in the byte
+ * order of the sample spec, including a partial frame at the end if
+ * length isn't a multiple of the frame size */
+static void generate(uint8_t *d, size_t length, const pa_sample_spec *ss, int signal) {
+    size_t i;
+
+    for (i = 0; i < length / 2; i++) {
+        unsigned frame = (unsigned) (i / ss->channels), ch = (unsigned) (i % ss->channels);
+        double t = (double) frame / ss->rate;
+        int16_t v;
+
+        switch (signal) {
+            case SIGNAL_SILENCE:
+                v = 0;
+                break;
+
+            case SIGNAL_TONE:
+                v = (int16_t) (12000.0 * sin(2.0 * M_PI * 440.0 * t + ch));
+                break;
+
+            case SIGNAL_MUSIC:
+                /* A few harmonics, a slow envelope and a bit of noise */
+                v = (int16_t) ((0.5 + 0.5 * sin(2.0 * M_PI * 2.0 * t)) *
+                               (6000.0 * sin(2.0 * M_PI * 220.0 * t) +
+                                3000.0 * sin(2.0 * M_PI * 440.0 * t + ch) +
+                                1500.0 * sin(2.0 * M_PI * 1320.0 * t)) +
+                               (rand() % 64) - 32);
+                break;
+
+            default:
+                v = (int16_t) rand();
+                break;
+        }
+
+        if (ss->format == PA_SAMPLE_S16LE) {
+            d[2*i] = (uint8_t) v;
+            d[2*i+1] = (uint8_t) (v >> 8);
+        } else {
+            d[2*i] = (uint8_t) (v >> 8);
+            d[2*i+1] = (uint8_t) v;
+        }
+    }
+
+    if (length % 2)
+        d[length - 1] = 0x5A;
+}
+
+/* Encodes and decodes the signal and returns the ratio of encoded to
+ * PCM size */
+static double round_trip(const pa_sample_spec *ss, int signal, size_t length, unsigned quality) {
+    pa_codec *encoder, *decoder;
+    uint8_t *pcm, *block, *out;
+    size_t size, n;
+
+    encoder = pa_codec_new_encoder(PA_ENCODING_PCM_LOSSLESS, ss, quality);
+    decoder = pa_codec_new_decoder(PA_ENCODING_PCM_LOSSLESS, ss);
+    fail_unless(encoder && decoder);
+
+    pcm = pa_xmalloc(length);
+    generate(pcm, length, ss, signal);
+
+    size = pa_codec_max_encoded_size(encoder, length);
+    block = pa_xmalloc(size);
+
+    n = pa_codec_encode(encoder, pcm, length, block, size);
+    fail_unless(n > 0 && n <= size);
+
+    fail_unless(pa_codec_decoded_size(decoder, block, n) == length);
+    out = pa_xmalloc(length);
+    fail_unless(pa_codec_decode(decoder, block, n, out, length) == 0);
+    fail_unless(memcmp(pcm, out, length) == 0);
+
+    /* Anything cut off has to be noticed */
+    fail_unless(pa_codec_decode(decoder, block, n - 1, out, length) < 0);
+
+    pa_xfree(pcm);
+    pa_xfree(block);
+    pa_xfree(out);
+
+    pa_codec_free(encoder);
+    pa_codec_free(decoder);
+
+    return (double) n / length;
+}
+
+START_TEST (lossless_test) {
+    pa_sample_spec ss;
+    unsigned quality;
+
+    ss.rate = 44100;
+
+    for (quality = PA_CODEC_QUALITY_MIN; quality <= PA_CODEC_QUALITY_MAX; quality += 5) {
+        /* The lowest quality only looks at the difference to the last
+         * sample */
+        double expected = quality >= PA_CODEC_QUALITY_DEFAULT ? 0.6 : 0.8;
+
+        ss.format = PA_SAMPLE_S16LE;
+        ss.channels = 2;
+        fail_unless(pa_codec_supported(PA_ENCODING_PCM_LOSSLESS, &ss));
+
+        fail_unless(round_trip(&ss, SIGNAL_SILENCE, 4096, quality) < 0.05);
+        fail_unless(round_trip(&ss, SIGNAL_TONE, 4096, quality) < expected);
+        fail_unless(round_trip(&ss, SIGNAL_MUSIC, 8192, quality) < expected);
+
+        /* Noise can't be compressed, but mustn't grow much either */
+        fail_unless(round_trip(&ss, SIGNAL_NOISE, 4096, quality) < 1.01);
+
+        /* Partial frames and blocks shorter than the predictor */
+        round_trip(&ss, SIGNAL_TONE, 4095, quality);
+        round_trip(&ss, SIGNAL_TONE, 4, quality);
+        round_trip(&ss, SIGNAL_TONE, 3, quality);
+
+        ss.format = PA_SAMPLE_S16BE;
+        ss.channels = 1;
+        fail_unless(round_trip(&ss, SIGNAL_TONE, 4096, quality) < expected);
+
+        ss.channels = 6;
+        fail_unless(round_trip(&ss, SIGNAL_MUSIC, 6000, quality) < expected);
+    }
+
+    ss.format = PA_SAMPLE_FLOAT32NE;
+    ss.channels = 2;
+    fail_unless(!pa_codec_supported(PA_ENCODING_PCM_LOSSLESS, &ss));
+    fail_unless(!pa_codec_new_encoder(PA_ENCODING_PCM_LOSSLESS, &ss, PA_CODEC_QUALITY_DEFAULT));
+}
+END_TEST
+
+START_TEST (corrupt_test) {
+    pa_sample_spec ss;
+    pa_codec *encoder, *decoder;
+    uint8_t pcm[4096], block[4096 + 64], broken[4096 + 64], out[4096];
+    size_t n;
+    unsigned i;
+
+    ss.format = PA_SAMPLE_S16LE;
+    ss.rate = 44100;
+    ss.channels = 2;
+
+    encoder = pa_codec_new_encoder(PA_ENCODING_PCM_LOSSLESS, &ss, PA_CODEC_QUALITY_MAX);
+    decoder = pa_codec_new_decoder(PA_ENCODING_PCM_LOSSLESS, &ss);
+
+    generate(pcm, sizeof(pcm), &ss, SIGNAL_MUSIC);
+    n = pa_codec_encode(encoder, pcm, sizeof(pcm), block, sizeof(block));
+    fail_unless(n > 0 && n < sizeof(pcm));
+
+    /* Whatever we flip, decoding has to either fail or stay within the
+     * buffer */
+    for (i = 0; i < 2000; i++) {
+        size_t size;
+
+        memcpy(broken, block, n);
+        broken[4 + rand() % (n - 4)] ^= (uint8_t) (1 + rand() % 255);
+
+        if ((size = pa_codec_decoded_size(decoder, broken, n)) != sizeof(out))
+            continue;
+
+        pa_codec_decode(decoder, broken, n, out, size);
+    }
+
+    /* A block claiming to be longer than it can be */
+    memcpy(broken, block, n);
+    broken[0] = 0xFF;
+    fail_unless(pa_codec_decoded_size(decoder, broken, n) == 0);
+
+    /* Just over what a memblock can hold */
+    broken[0] = 0;
+    broken[1] = 1;
+    broken[2] = 0;
+    broken[3] = 2;
+    fail_unless(pa_codec_decoded_size(decoder, broken, n) == 0);
+
+    pa_codec_free(encoder);
+    pa_codec_free(decoder);
+}
+END_TEST
+
+#define THROUGHPUT_SECONDS 10
+#define THROUGHPUT_CHUNK 4096
+
+START_TEST (throughput_test) {
+    pa_sample_spec ss;
+    pa_codec *encoder, *decoder;
+    uint8_t *pcm, *block, *out;
+    size_t length, size, encoded = 0, i;
+    pa_usec_t start, encode_usec, decode_usec;
+    size_t *lengths;
+    unsigned n, k;
+
+    ss.format = PA_SAMPLE_S16LE;
+    ss.rate = 44100;
+    ss.channels = 2;
+
+    length = pa_usec_to_bytes(THROUGHPUT_SECONDS * PA_USEC_PER_SEC, &ss);
+    length -= length % THROUGHPUT_CHUNK;
+    n = (unsigned) (length / THROUGHPUT_CHUNK);
+
+    encoder = pa_codec_new_encoder(PA_ENCODING_PCM_LOSSLESS, &ss, PA_CODEC_QUALITY_DEFAULT);
+    decoder = pa_codec_new_decoder(PA_ENCODING_PCM_LOSSLESS, &ss);
+
+    pcm = pa_xmalloc(length);
+    generate(pcm, length, &ss, SIGNAL_MUSIC);
+
+    size = pa_codec_max_encoded_size(encoder, THROUGHPUT_CHUNK);
+    block = pa_xmalloc(size * n);
+    lengths = pa_xnew(size_t, n);
+    out = pa_xmalloc(length);
+
+    start = pa_rtclock_now();
+    for (k = 0, i = 0; k < n; k++, i += THROUGHPUT_CHUNK) {
+        lengths[k] = pa_codec_encode(encoder, pcm + i, THROUGHPUT_CHUNK, block + k * size, size);
+        fail_unless(lengths[k] > 0 && lengths[k] <= size);
+        encoded += lengths[k];
+    }
+    encode_usec = pa_rtclock_now() - start;
+
+    start = pa_rtclock_now();
+    for (k = 0, i = 0; k < n; k++, i += THROUGHPUT_CHUNK)
+        fail_unless(pa_codec_decode(decoder, block + k * size, lengths[k], out + i, THROUGHPUT_CHUNK) == 0);
+    decode_usec = pa_rtclock_now() - start;
+
+    fail_unless(memcmp(pcm, out, length) == 0);
+
+    pa_log_info("%u s of audio compressed to %0.1f%%, encoding took %llu usec, decoding %llu usec",
+                THROUGHPUT_SECONDS, (double) encoded * 100.0 / length,
+                (unsigned long long) encode_usec, (unsigned long long) decode_usec);
+
+    /* Has to be a lot faster than real time */
+    fail_unless(encode_usec < THROUGHPUT_SECONDS * PA_USEC_PER_SEC / 10);
+    fail_unless(decode_usec < THROUGHPUT_SECONDS * PA_USEC_PER_SEC / 10);
+
+    pa_xfree(pcm);
+    pa_xfree(block);
+    pa_xfree(lengths);
+    pa_xfree(out);
+
+    pa_codec_free(encoder);
+    pa_codec_free(decoder);
+}
+END_TEST
+
+#define N_BLOCKS 50
+#define BLOCK_SIZE 4000
+
+static uint8_t *received;
+static size_t n_received;
+
+/* How many chunks came in with a seek, and where the first of them
+ * started */
+static unsigned n_seeks;
+static size_t seek_index;
+
+static void memblock_cb(pa_pstream *p, uint32_t channel, int64_t offset, pa_seek_mode_t seek, const pa_memchunk *chunk, void *userdata) {
+    fail_unless(channel == 1);
+    fail_unless(n_received + chunk->length <= N_BLOCKS * BLOCK_SIZE);
+
+    if (offset != 0 || seek != PA_SEEK_RELATIVE) {
+        if (n_seeks++ == 0)
+            seek_index = n_received;
+    }
+
+    memcpy(received + n_received, pa_memblock_acquire_chunk(chunk), chunk->length);
+    pa_memblock_release(chunk->memblock);
+
+    n_received += chunk->length;
+}
+
+START_TEST (pstream_test) {
+    pa_mainloop *m;
+    pa_mainloop_api *api;
+    pa_mempool *pool;
+    pa_pstream *a, *b;
+    pa_sample_spec ss;
+    uint8_t *sent;
+    uint64_t pcm_bytes, encoded_bytes;
+    int fds[2];
+    unsigned i;
+
+    fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+    m = pa_mainloop_new();
+    api = pa_mainloop_get_api(m);
+    pool = pa_mempool_new(FALSE, 0);
+
+    a = pa_pstream_new(api, pa_iochannel_new(api, fds[0], fds[0]), pool);
+    b = pa_pstream_new(api, pa_iochannel_new(api, fds[1], fds[1]), pool);
+    pa_pstream_set_receive_memblock_callback(b, memblock_cb, NULL);
+
+    ss.format = PA_SAMPLE_S16LE;
+    ss.rate = 44100;
+    ss.channels = 2;
+
+    pa_pstream_set_encoder(a, 1, pa_codec_new_encoder(PA_ENCODING_PCM_LOSSLESS, &ss, PA_CODEC_QUALITY_DEFAULT));
+    pa_pstream_set_decoder(b, 1, pa_codec_new_decoder(PA_ENCODING_PCM_LOSSLESS, &ss));
+
+    sent = pa_xmalloc(N_BLOCKS * BLOCK_SIZE);
+    received = pa_xmalloc(N_BLOCKS * BLOCK_SIZE);
+    n_received = 0;
+    n_seeks = 0;
+
+    generate(sent, N_BLOCKS * BLOCK_SIZE, &ss, SIGNAL_MUSIC);
+
+    for (i = 0; i < N_BLOCKS; i++) {
+        pa_memchunk chunk;
+
+        chunk.memblock = pa_memblock_new_fixed(pool, sent + i * BLOCK_SIZE, BLOCK_SIZE, TRUE);
+        chunk.index = 0;
+        chunk.length = BLOCK_SIZE;
+
+        pa_pstream_send_memblock(a, 1, 0, PA_SEEK_RELATIVE, &chunk);
+        pa_memblock_unref_fixed(chunk.memblock);
+    }
+
+    while (n_received < N_BLOCKS * BLOCK_SIZE)
+        fail_unless(pa_mainloop_iterate(m, TRUE, NULL) >= 0);
+
+    fail_unless(memcmp(sent, received, N_BLOCKS * BLOCK_SIZE) == 0);
+    fail_unless(n_seeks == 0);
+
+    fail_unless(pa_pstream_get_codec_stats(a, 1, &pcm_bytes, &encoded_bytes));
+    fail_unless(pcm_bytes == N_BLOCKS * BLOCK_SIZE);
+    fail_unless(encoded_bytes < pcm_bytes * 6 / 10);
+
+    fail_unless(pa_pstream_get_codec_stats(b, 1, &pcm_bytes, &encoded_bytes));
+    fail_unless(pcm_bytes == N_BLOCKS * BLOCK_SIZE);
+
+    fail_unless(!pa_pstream_get_codec_stats(a, 2, &pcm_bytes, &encoded_bytes));
+
+    pa_pstream_unlink(a);
+    pa_pstream_unref(a);
+    pa_pstream_unlink(b);
+    pa_pstream_unref(b);
+
+    pa_xfree(sent);
+    pa_xfree(received);
+
+    pa_mempool_free(pool);
+    pa_mainloop_free(m);
+}
+END_TEST
+
+#ifdef HAVE_OPUS
+
+#define OPUS_RATE 48000
+#define OPUS_CHANNELS 2
+
+/* 200 ms, fed to the encoder in chunks that don't line up with its
+ * 10 ms frames */
+#define OPUS_FRAMES (OPUS_RATE / 5)
+#define OPUS_CHUNK 1000
+
+static double rms(const int16_t *d, size_t n) {
+    double sum = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        sum += (double) d[i] * d[i];
+
+    return sqrt(sum / n);
+}
+
+/* Opus is lossy, so all we can ask of the round trip is that nothing
+ * is lost or added, and that the tone still comes out */
+START_TEST (opus_test) {
+    pa_sample_spec ss;
+    pa_codec *encoder, *decoder;
+    int16_t *pcm, *out;
+    size_t length, offset, decoded = 0;
+    uint64_t pcm_bytes, encoded_bytes;
+    unsigned i;
+
+    ss.format = PA_SAMPLE_S16NE;
+    ss.rate = OPUS_RATE;
+    ss.channels = OPUS_CHANNELS;
+
+    fail_unless(pa_codec_supported(PA_ENCODING_OPUS, &ss));
+
+    encoder = pa_codec_new_encoder(PA_ENCODING_OPUS, &ss, PA_CODEC_QUALITY_DEFAULT);
+    decoder = pa_codec_new_decoder(PA_ENCODING_OPUS, &ss);
+    fail_unless(encoder && decoder);
+
+    length = OPUS_FRAMES * pa_frame_size(&ss);
+    pcm = pa_xmalloc(length);
+    out = pa_xmalloc0(length);
+
+    for (i = 0; i < OPUS_FRAMES * OPUS_CHANNELS; i++)
+        pcm[i] = (int16_t) (12000.0 * sin(2.0 * M_PI * 440.0 * (i / OPUS_CHANNELS) / OPUS_RATE));
+
+    for (offset = 0; offset < length; offset += OPUS_CHUNK) {
+        size_t l = PA_MIN((size_t) OPUS_CHUNK, length - offset), size, n, d;
+        uint8_t *block;
+
+        size = pa_codec_max_encoded_size(encoder, l);
+        block = pa_xmalloc(size);
+
+        n = pa_codec_encode(encoder, (uint8_t*) pcm + offset, l, block, size);
+        fail_unless(n != (size_t) -1 && n <= size);
+
+        if (n > 0) {
+            d = pa_codec_decoded_size(decoder, block, n);
+            fail_unless(d > 0 && decoded + d <= length);
+
+            /* A block cut short has to be noticed */
+            fail_unless(pa_codec_decoded_size(decoder, block, n - 1) == 0);
+
+            /* As does one claiming more PCM than its frames hold */
+            block[2] = (uint8_t) ((d + pa_codec_get_frame_size(decoder)) >> 8);
+            block[3] = (uint8_t) (d + pa_codec_get_frame_size(decoder));
+            fail_unless(pa_codec_decoded_size(decoder, block, n) == 0);
+            block[2] = (uint8_t) (d >> 8);
+            block[3] = (uint8_t) d;
+
+            fail_unless(pa_codec_decode(decoder, block, n, (uint8_t*) out + decoded, d) == 0);
+            decoded += d;
+        }
+
+        pa_xfree(block);
+    }
+
+    /* 200 ms are exactly 20 frames, so nothing is kept back */
+    fail_unless(decoded == length);
+
+    pa_codec_get_stats(encoder, &pcm_bytes, &encoded_bytes);
+    fail_unless(pcm_bytes == length);
+    fail_unless(encoded_bytes > 0 && encoded_bytes < length / 4);
+
+    /* Past the codec delay the level has to match */
+    fail_unless(fabs(rms(out + OPUS_FRAMES, OPUS_FRAMES) / rms(pcm + OPUS_FRAMES, OPUS_FRAMES) - 1.0) < 0.2);
+
+    pa_xfree(pcm);
+    pa_xfree(out);
+
+    pa_codec_free(encoder);
+    pa_codec_free(decoder);
+}
+END_TEST
+
+/* What the encoder keeps back of a partial frame comes out when it is
+ * flushed, with the padding dropped, and before anything written out
+ * of sequence */
+START_TEST (opus_flush_test) {
+    pa_mainloop *m;
+    pa_mainloop_api *api;
+    pa_mempool *pool;
+    pa_pstream *a, *b;
+    pa_sample_spec ss;
+    pa_codec *encoder, *decoder;
+    uint8_t *pcm, *block, *out;
+    size_t frame_size, size, n;
+    pa_memchunk chunk;
+    int fds[2];
+
+    ss.format = PA_SAMPLE_S16NE;
+    ss.rate = OPUS_RATE;
+    ss.channels = OPUS_CHANNELS;
+
+    encoder = pa_codec_new_encoder(PA_ENCODING_OPUS, &ss, PA_CODEC_QUALITY_DEFAULT);
+    decoder = pa_codec_new_decoder(PA_ENCODING_OPUS, &ss);
+    fail_unless(encoder && decoder);
+
+    frame_size = pa_codec_get_frame_size(encoder);
+    pcm = pa_xmalloc0(frame_size * 3 / 2);
+    out = pa_xmalloc(frame_size);
+
+    /* Nothing kept back, nothing to flush */
+    block = pa_xmalloc(pa_codec_max_encoded_size(encoder, 0));
+    fail_unless(pa_codec_flush(encoder, block, pa_codec_max_encoded_size(encoder, 0)) == 0);
+    pa_xfree(block);
+
+    size = pa_codec_max_encoded_size(encoder, frame_size * 3 / 2);
+    block = pa_xmalloc(size);
+
+    n = pa_codec_encode(encoder, pcm, frame_size * 3 / 2, block, size);
+    fail_unless(n != (size_t) -1 && n > 0);
+    fail_unless(pa_codec_decoded_size(decoder, block, n) == frame_size);
+    fail_unless(pa_codec_decode(decoder, block, n, out, frame_size) == 0);
+
+    size = pa_codec_max_encoded_size(encoder, 0);
+    n = pa_codec_flush(encoder, block, size);
+    fail_unless(n != (size_t) -1 && n > 0 && n <= size);
+    fail_unless(pa_codec_decoded_size(decoder, block, n) == frame_size / 2);
+    fail_unless(pa_codec_decode(decoder, block, n, out, frame_size / 2) == 0);
+
+    fail_unless(pa_codec_flush(encoder, block, size) == 0);
+
+    pa_xfree(block);
+    pa_codec_free(encoder);
+    pa_codec_free(decoder);
+
+    /* The same through a pstream, ending with a write with a seek */
+    fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+    m = pa_mainloop_new();
+    api = pa_mainloop_get_api(m);
+    pool = pa_mempool_new(FALSE, 0);
+
+    a = pa_pstream_new(api, pa_iochannel_new(api, fds[0], fds[0]), pool);
+    b = pa_pstream_new(api, pa_iochannel_new(api, fds[1], fds[1]), pool);
+    pa_pstream_set_receive_memblock_callback(b, memblock_cb, NULL);
+
+    pa_pstream_set_encoder(a, 1, pa_codec_new_encoder(PA_ENCODING_OPUS, &ss, PA_CODEC_QUALITY_DEFAULT));
+    pa_pstream_set_decoder(b, 1, pa_codec_new_decoder(PA_ENCODING_OPUS, &ss));
+
+    received = pa_xmalloc(N_BLOCKS * BLOCK_SIZE);
+    n_received = 0;
+    n_seeks = 0;
+
+    chunk.memblock = pa_memblock_new_fixed(pool, pcm, frame_size * 3 / 2, TRUE);
+    chunk.index = 0;
+    chunk.length = frame_size * 3 / 2;
+    pa_pstream_send_memblock(a, 1, 0, PA_SEEK_RELATIVE, &chunk);
+
+    chunk.length = frame_size / 2;
+    pa_pstream_send_memblock(a, 1, (int64_t) frame_size, PA_SEEK_RELATIVE, &chunk);
+    pa_memblock_unref_fixed(chunk.memblock);
+
+    while (n_received < frame_size * 2)
+        fail_unless(pa_mainloop_iterate(m, TRUE, NULL) >= 0);
+
+    fail_unless(n_seeks == 1);
+    fail_unless(seek_index == frame_size * 3 / 2);
+
+    pa_pstream_unlink(a);
+    pa_pstream_unref(a);
+    pa_pstream_unlink(b);
+    pa_pstream_unref(b);
+
+    pa_xfree(received);
+    pa_xfree(pcm);
+    pa_xfree(out);
+
+    pa_mempool_free(pool);
+    pa_mainloop_free(m);
+}
+END_TEST
+
+#endif
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Codec");
+    tc = tcase_create("codec");
+    tcase_add_test(tc, lossless_test);
+    tcase_add_test(tc, corrupt_test);
+    tcase_add_test(tc, throughput_test);
+    tcase_add_test(tc, pstream_test);
+#ifdef HAVE_OPUS
+    tcase_add_test(tc, opus_test);
+    tcase_add_test(tc, opus_flush_test);
+#endif
+    tcase_set_timeout(tc, 60);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,187 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+
+#include <pulsecore/core.h>
+#include <pulsecore/core-subscribe.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+static unsigned n_events;
+static pa_subscription_event_type_t last_type;
+static uint32_t last_index;
+static pa_subscription_change_flags_t last_changes;
+static uint64_t last_generation;
+
+static void delta_cb(pa_core *c, pa_subscription_event_type_t t, uint32_t idx, pa_subscription_change_flags_t changes, uint64_t generation, void *userdata) {
+    n_events++;
+    last_type = t;
+    last_index = idx;
+    last_changes = changes;
+    last_generation = generation;
+}
+
+static void dispatch(pa_mainloop *m) {
+    n_events = 0;
+
+    while (pa_mainloop_iterate(m, 0, NULL) > 0)
+        ;
+}
+
+START_TEST (delta_test) {
+    pa_mainloop *m;
+    pa_core *c;
+    pa_subscription *s;
+
+    m = pa_mainloop_new();
+    c = pa_core_new(pa_mainloop_get_api(m), FALSE, 0);
+    fail_unless(c != NULL);
+
+    s = pa_subscription_new_delta(c, PA_SUBSCRIPTION_MASK_SINK, delta_cb, NULL);
+
+    pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_NEW, 7);
+    dispatch(m);
+    fail_unless(n_events == 1);
+    fail_unless(last_type == (PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_NEW));
+    fail_unless(last_index == 7);
+    fail_unless(last_changes == PA_SUBSCRIPTION_CHANGE_UNKNOWN);
+
+    /* Changes of the same object are merged into one event */
+    pa_subscription_post_change(c, PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_CHANGE, 7, PA_SUBSCRIPTION_CHANGE_VOLUME);
+    pa_subscription_post_change(c, PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_CHANGE, 7, PA_SUBSCRIPTION_CHANGE_MUTE);
+    dispatch(m);
+    fail_unless(n_events == 1);
+    fail_unless(last_changes == (PA_SUBSCRIPTION_CHANGE_VOLUME|PA_SUBSCRIPTION_CHANGE_MUTE));
+    fail_unless(last_generation == pa_subscription_get_generation(c));
+
+    /* ... unless one of them doesn't say what changed */
+    pa_subscription_post_change(c, PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_CHANGE, 7, PA_SUBSCRIPTION_CHANGE_VOLUME);
+    pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_CHANGE, 7);
+    dispatch(m);
+    fail_unless(n_events == 1);
+    fail_unless(last_changes == PA_SUBSCRIPTION_CHANGE_UNKNOWN);
+
+    /* Not subscribed to */
+    pa_subscription_post_change(c, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_CHANGE, 7, PA_SUBSCRIPTION_CHANGE_VOLUME);
+    dispatch(m);
+    fail_unless(n_events == 0);
+
+    pa_subscription_free(s);
+    dispatch(m);
+
+    pa_core_unref(c);
+    pa_mainloop_free(m);
+}
+END_TEST
+
+static unsigned n_changed;
+static pa_subscription_event_type_t changed_type;
+static uint32_t changed_index;
+
+static void generation_cb(pa_core *c, pa_subscription_event_type_t t, uint32_t idx, uint64_t generation, void *userdata) {
+    n_changed++;
+    changed_type = t;
+    changed_index = idx;
+}
+
+static unsigned foreach_changed(pa_core *c, pa_subscription_mask_t mask, uint64_t since) {
+    n_changed = 0;
+    pa_subscription_foreach_changed(c, mask, since, generation_cb, NULL);
+    return n_changed;
+}
+
+START_TEST (generation_test) {
+    pa_mainloop *m;
+    pa_core *c;
+    uint64_t g;
+    uint32_t i;
+
+    m = pa_mainloop_new();
+    c = pa_core_new(pa_mainloop_get_api(m), FALSE, 0);
+    fail_unless(c != NULL);
+
+    /* Generations are counted even if nobody is subscribed */
+    pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_NEW, 1);
+    pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_NEW, 2);
+    pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SOURCE|PA_SUBSCRIPTION_EVENT_NEW, 1);
+    g = pa_subscription_get_generation(c);
+    fail_unless(g == 3);
+
+    fail_unless(foreach_changed(c, PA_SUBSCRIPTION_MASK_ALL, 0) == 3);
+    fail_unless(foreach_changed(c, PA_SUBSCRIPTION_MASK_SINK, 0) == 2);
+    fail_unless(foreach_changed(c, PA_SUBSCRIPTION_MASK_ALL, g) == 0);
+
+    pa_subscription_post_change(c, PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_CHANGE, 2, PA_SUBSCRIPTION_CHANGE_VOLUME);
+    fail_unless(foreach_changed(c, PA_SUBSCRIPTION_MASK_ALL, g) == 1);
+    fail_unless(changed_type == (PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_CHANGE));
+    fail_unless(changed_index == 2);
+
+    pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SOURCE|PA_SUBSCRIPTION_EVENT_REMOVE, 1);
+    fail_unless(foreach_changed(c, PA_SUBSCRIPTION_MASK_SOURCE, g) == 1);
+    fail_unless(changed_type == (PA_SUBSCRIPTION_EVENT_SOURCE|PA_SUBSCRIPTION_EVENT_REMOVE));
+    fail_unless(pa_subscription_history_complete(c, g));
+
+    /* Eventually removed objects are forgotten */
+    for (i = 100; i < 1100; i++) {
+        pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_NEW, i);
+        pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_REMOVE, i);
+    }
+
+    fail_unless(!pa_subscription_history_complete(c, g));
+    fail_unless(foreach_changed(c, PA_SUBSCRIPTION_MASK_SINK_INPUT, 0) < 1000);
+
+    /* ... but live ones are not */
+    fail_unless(foreach_changed(c, PA_SUBSCRIPTION_MASK_SINK, 0) == 2);
+
+    dispatch(m);
+
+    pa_core_unref(c);
+    pa_mainloop_free(m);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Core Subscribe");
+    tc = tcase_create("core-subscribe");
+    tcase_add_test(tc, delta_test);
+    tcase_add_test(tc, generation_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,300 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/discover-cache.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+/* Stands in for the discovery module: modules are "loaded" by handing
+ * out indexes, and we remember what was loaded and unloaded */
+
+#define TTL (100*PA_USEC_PER_MSEC)
+#define INTERVAL (20*PA_USEC_PER_MSEC)
+#define BATCH 4
+
+static uint32_t next_index;
+static unsigned n_loads, n_unloads;
+static uint32_t last_unloaded;
+static pa_bool_t fail_loads;
+
+static uint32_t load_cb(pa_discover_cache *c, const char *module_name, const char *args, void *userdata) {
+    fail_unless(pa_streq(module_name, "module-tunnel-sink"));
+    fail_unless(pa_startswith(args, "server="));
+
+    if (fail_loads)
+        return PA_INVALID_INDEX;
+
+    n_loads++;
+    return next_index++;
+}
+
+static void unload_cb(pa_discover_cache *c, uint32_t module_index, void *userdata) {
+    n_unloads++;
+    last_unloaded = module_index;
+}
+
+static pa_discover_cache *setup(pa_mainloop **m) {
+    next_index = 100;
+    n_loads = n_unloads = 0;
+    last_unloaded = PA_INVALID_INDEX;
+    fail_loads = FALSE;
+
+    *m = pa_mainloop_new();
+    return pa_discover_cache_new(pa_mainloop_get_api(*m), TTL, INTERVAL, BATCH, load_cb, unload_cb, NULL);
+}
+
+/* Runs the main loop for usec */
+static void run(pa_mainloop *m, pa_usec_t usec) {
+    pa_usec_t end = pa_rtclock_now() + usec;
+
+    while (pa_rtclock_now() < end)
+        pa_mainloop_iterate(m, 0, NULL);
+}
+
+static void resolve(pa_discover_cache *c, const char *key) {
+    pa_discover_cache_resolved(c, key, "module-tunnel-sink", "server=[192.168.0.1]:4713");
+}
+
+START_TEST (announce_test) {
+    pa_mainloop *m;
+    pa_discover_cache *c;
+
+    c = setup(&m);
+
+    /* The same service on two interfaces is resolved and loaded once */
+    fail_unless(pa_discover_cache_announce(c, "a"));
+    fail_unless(!pa_discover_cache_announce(c, "a"));
+
+    /* Loading doesn't happen from the resolver callback */
+    resolve(c, "a");
+    fail_unless(n_loads == 0);
+
+    run(m, INTERVAL);
+    fail_unless(n_loads == 1);
+    fail_unless(pa_discover_cache_n_loaded(c) == 1);
+
+    /* Withdrawn on one interface, it is still there on the other */
+    pa_discover_cache_withdraw(c, "a");
+    run(m, TTL + INTERVAL);
+    fail_unless(n_unloads == 0);
+
+    /* Withdrawn everywhere, it goes after the TTL */
+    pa_discover_cache_withdraw(c, "a");
+    run(m, TTL / 2);
+    fail_unless(n_unloads == 0);
+    run(m, TTL);
+    fail_unless(n_unloads == 1);
+    fail_unless(last_unloaded == 100);
+    fail_unless(pa_discover_cache_n_loaded(c) == 0);
+
+    /* It is resolved again when it comes back after that */
+    fail_unless(pa_discover_cache_announce(c, "a"));
+
+    pa_discover_cache_free(c);
+    pa_mainloop_free(m);
+}
+END_TEST
+
+START_TEST (flap_test) {
+    pa_mainloop *m;
+    pa_discover_cache *c;
+
+    c = setup(&m);
+
+    fail_unless(pa_discover_cache_announce(c, "a"));
+    resolve(c, "a");
+    run(m, INTERVAL);
+    fail_unless(n_loads == 1);
+
+    /* Coming back within the TTL keeps the module, even when the
+     * daemon went away in between */
+    pa_discover_cache_withdraw(c, "a");
+    run(m, TTL / 2);
+    fail_unless(!pa_discover_cache_announce(c, "a"));
+
+    pa_discover_cache_withdraw_all(c);
+    run(m, TTL / 2);
+    fail_unless(!pa_discover_cache_announce(c, "a"));
+
+    run(m, TTL + INTERVAL);
+    fail_unless(n_loads == 1);
+    fail_unless(n_unloads == 0);
+
+    /* Withdrawn before it was loaded, it never is */
+    fail_unless(pa_discover_cache_announce(c, "b"));
+    resolve(c, "b");
+    pa_discover_cache_withdraw(c, "b");
+    run(m, INTERVAL * 2);
+    fail_unless(n_loads == 1);
+
+    /* Withdrawn while resolving, the result is dropped */
+    fail_unless(pa_discover_cache_announce(c, "c"));
+    pa_discover_cache_withdraw(c, "c");
+    resolve(c, "c");
+    run(m, INTERVAL * 2);
+    fail_unless(n_loads == 1);
+
+    /* Whatever is still loaded goes with the cache */
+    pa_discover_cache_free(c);
+    fail_unless(n_unloads == 1);
+
+    pa_mainloop_free(m);
+}
+END_TEST
+
+START_TEST (batch_test) {
+    pa_mainloop *m;
+    pa_discover_cache *c;
+    unsigned i;
+    pa_usec_t start;
+
+    c = setup(&m);
+
+    for (i = 0; i < 3 * BATCH + 1; i++) {
+        char key[16];
+
+        pa_snprintf(key, sizeof(key), "s%u", i);
+        fail_unless(pa_discover_cache_announce(c, key));
+        resolve(c, key);
+    }
+
+    fail_unless(n_loads == 0);
+
+    /* One batch right away, then one per interval */
+    start = pa_rtclock_now();
+
+    while (n_loads < BATCH)
+        pa_mainloop_iterate(m, 1, NULL);
+    fail_unless(n_loads == BATCH);
+
+    while (n_loads < 3 * BATCH + 1)
+        pa_mainloop_iterate(m, 1, NULL);
+
+    fail_unless(pa_rtclock_now() - start >= 3 * INTERVAL);
+    fail_unless(pa_discover_cache_n_loaded(c) == 3 * BATCH + 1);
+
+    pa_discover_cache_free(c);
+    fail_unless(n_unloads == 3 * BATCH + 1);
+
+    pa_mainloop_free(m);
+}
+END_TEST
+
+START_TEST (failure_test) {
+    pa_mainloop *m;
+    pa_discover_cache *c;
+
+    c = setup(&m);
+
+    /* A service that fails is tried again on a later announcement, but
+     * only after a backoff that grows with every failure */
+    fail_unless(pa_discover_cache_announce(c, "a"));
+    pa_discover_cache_failed(c, "a");
+    fail_unless(!pa_discover_cache_announce(c, "a"));
+
+    run(m, INTERVAL);
+    fail_unless(pa_discover_cache_announce(c, "a"));
+    pa_discover_cache_failed(c, "a");
+
+    run(m, INTERVAL);
+    fail_unless(!pa_discover_cache_announce(c, "a"));
+    run(m, INTERVAL);
+    fail_unless(pa_discover_cache_announce(c, "a"));
+
+    resolve(c, "a");
+    run(m, INTERVAL);
+    fail_unless(n_loads == 1);
+
+    /* So is one whose module fails to load */
+    fail_loads = TRUE;
+    fail_unless(pa_discover_cache_announce(c, "b"));
+    resolve(c, "b");
+    run(m, INTERVAL / 2);
+    fail_unless(pa_discover_cache_n_loaded(c) == 1);
+    fail_unless(!pa_discover_cache_announce(c, "b"));
+
+    fail_loads = FALSE;
+    run(m, INTERVAL);
+    fail_unless(pa_discover_cache_announce(c, "b"));
+    resolve(c, "b");
+    run(m, INTERVAL);
+    fail_unless(n_loads == 2);
+
+    /* A module going away by itself counts as failure too */
+    fail_unless(pa_discover_cache_announce(c, "c"));
+    resolve(c, "c");
+    run(m, INTERVAL);
+    fail_unless(n_loads == 3);
+
+    pa_discover_cache_module_unloaded(c, 102);
+    fail_unless(pa_discover_cache_n_loaded(c) == 2);
+    fail_unless(!pa_discover_cache_announce(c, "c"));
+
+    run(m, INTERVAL);
+    fail_unless(pa_discover_cache_announce(c, "c"));
+    pa_discover_cache_failed(c, "c");
+
+    /* Withdrawn everywhere, it is forgotten, backoff and all */
+    pa_discover_cache_withdraw_all(c);
+    fail_unless(pa_discover_cache_announce(c, "c"));
+
+    pa_discover_cache_free(c);
+    fail_unless(n_unloads == 2);
+
+    pa_mainloop_free(m);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Discovery cache");
+    tc = tcase_create("discover-cache");
+    tcase_add_test(tc, announce_test);
+    tcase_add_test(tc, flap_test);
+    tcase_add_test(tc, batch_test);
+    tcase_add_test(tc, failure_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
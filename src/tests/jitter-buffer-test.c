@@ -0,0 +1,337 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <pulse/timeval.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/memblock.h>
+
+#include "jitter-buffer.h"
+
+#define RATE 8000
+#define PACKET_FRAMES 160
+#define PACKET_USEC (20*PA_USEC_PER_MSEC)
+#define N_PACKETS 50
+#define N_FRAMES (N_PACKETS*PACKET_FRAMES)
+
+static const pa_sample_spec ss = {
+    .format = PA_SAMPLE_S16NE,
+    .rate = RATE,
+    .channels = 1
+};
+
+static pa_mempool *pool;
+static int16_t tone[N_FRAMES], output[2*N_FRAMES];
+
+static void generate(void) {
+    unsigned i;
+
+    for (i = 0; i < N_FRAMES; i++)
+        tone[i] = (int16_t) lrint(8000.0 * sin(2.0 * M_PI * 220.0 * i / RATE));
+}
+
+static pa_jitter_buffer *new_buffer(pa_usec_t max_latency) {
+    return pa_jitter_buffer_new(&ss, 20*PA_USEC_PER_MSEC, max_latency, pool);
+}
+
+/* Sends packet n of the tone, with sequence numbers and timestamps
+ * starting at the given values */
+static void push(pa_jitter_buffer *jb, unsigned n, uint16_t seq, uint32_t ts, pa_usec_t arrival) {
+    pa_memchunk chunk;
+
+    chunk.memblock = pa_memblock_new(pool, PACKET_FRAMES * sizeof(int16_t));
+    chunk.index = 0;
+    chunk.length = PACKET_FRAMES * sizeof(int16_t);
+
+    memcpy(pa_memblock_acquire(chunk.memblock), tone + n * PACKET_FRAMES, chunk.length);
+    pa_memblock_release(chunk.memblock);
+
+    pa_jitter_buffer_push(jb, (uint16_t) (seq + n), ts + n * PACKET_FRAMES, arrival, &chunk);
+    pa_memblock_unref(chunk.memblock);
+}
+
+/* Plays whatever the buffer is willing to give */
+static size_t play(pa_jitter_buffer *jb) {
+    pa_memchunk chunk;
+    size_t n = 0;
+
+    while (n < PA_ELEMENTSOF(output) && pa_jitter_buffer_peek(jb, 256, &chunk) >= 0) {
+        size_t l = PA_MIN(chunk.length, (PA_ELEMENTSOF(output) - n) * sizeof(int16_t));
+
+        memcpy(output + n, (uint8_t*) pa_memblock_acquire(chunk.memblock) + chunk.index, l);
+        pa_memblock_release(chunk.memblock);
+        pa_memblock_unref(chunk.memblock);
+
+        pa_jitter_buffer_drop(jb, l);
+        n += l / sizeof(int16_t);
+    }
+
+    return n;
+}
+
+/* Energy of the difference relative to the energy of the tone */
+static double error(const int16_t *a, const int16_t *b, size_t n) {
+    double e = 0, s = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        e += ((double) a[i] - b[i]) * ((double) a[i] - b[i]);
+        s += (double) b[i] * b[i];
+    }
+
+    return e / s;
+}
+
+START_TEST (in_order_test) {
+    pa_jitter_buffer *jb;
+    pa_jitter_buffer_stats stats;
+    uint32_t ts;
+    unsigned i;
+
+    jb = new_buffer(2*PA_USEC_PER_SEC);
+    fail_unless(!pa_jitter_buffer_get_read_timestamp(jb, &ts));
+
+    for (i = 0; i < N_PACKETS; i++)
+        push(jb, i, 4711, 815, i * PACKET_USEC);
+
+    fail_unless(pa_jitter_buffer_get_read_timestamp(jb, &ts));
+    fail_unless(ts == 815);
+
+    fail_unless(pa_jitter_buffer_get_length(jb) == N_FRAMES * sizeof(int16_t));
+    fail_unless(pa_jitter_buffer_get_target(jb) == 2 * PACKET_USEC);
+    fail_unless(play(jb) == N_FRAMES);
+    fail_unless(memcmp(output, tone, sizeof(tone)) == 0);
+
+    fail_unless(pa_jitter_buffer_get_read_timestamp(jb, &ts));
+    fail_unless(ts == 815 + N_FRAMES);
+
+    pa_jitter_buffer_get_stats(jb, &stats);
+    fail_unless(stats.received == N_PACKETS);
+    fail_unless(stats.lost == 0);
+    fail_unless(stats.late == 0);
+    fail_unless(stats.concealed == 0);
+    fail_unless(stats.jitter == 0);
+
+    /* Running dry at the end counts as underrun */
+    fail_unless(stats.underruns == 1);
+    fail_unless(stats.target > 2 * PACKET_USEC);
+
+    pa_jitter_buffer_free(jb);
+}
+END_TEST
+
+START_TEST (reorder_test) {
+    pa_jitter_buffer *jb;
+    pa_jitter_buffer_stats stats;
+    unsigned i;
+
+    jb = new_buffer(2*PA_USEC_PER_SEC);
+
+    /* Pairwise swapped after the first one, and some twice */
+    push(jb, 0, 0, 0, 0);
+
+    for (i = 1; i < N_PACKETS - 1; i += 2) {
+        push(jb, i + 1, 0, 0, i * PACKET_USEC);
+        push(jb, i, 0, 0, i * PACKET_USEC);
+        push(jb, i + 1, 0, 0, i * PACKET_USEC);
+    }
+
+    push(jb, N_PACKETS - 1, 0, 0, N_PACKETS * PACKET_USEC);
+
+    fail_unless(play(jb) == N_FRAMES);
+    fail_unless(memcmp(output, tone, sizeof(tone)) == 0);
+
+    pa_jitter_buffer_get_stats(jb, &stats);
+    fail_unless(stats.received == N_PACKETS);
+    fail_unless(stats.duplicates == N_PACKETS / 2 - 1);
+    fail_unless(stats.lost == 0);
+    fail_unless(stats.late == 0);
+
+    pa_jitter_buffer_free(jb);
+}
+END_TEST
+
+START_TEST (wrap_test) {
+    pa_jitter_buffer *jb;
+    pa_jitter_buffer_stats stats;
+    unsigned i;
+
+    jb = new_buffer(500*PA_USEC_PER_MSEC);
+
+    /* Both sequence numbers and timestamps wrap around. Since more
+     * than max_latency is queued behind the gap, it is concealed
+     * right away. */
+    for (i = 0; i < N_PACKETS; i++)
+        if (i != 25)
+            push(jb, i, 65520, 0xFFFFF000U, i * PACKET_USEC);
+
+    fail_unless(play(jb) == N_FRAMES);
+    fail_unless(memcmp(output, tone, 25 * PACKET_FRAMES * sizeof(int16_t)) == 0);
+
+    pa_jitter_buffer_get_stats(jb, &stats);
+    fail_unless(stats.received == N_PACKETS - 1);
+    fail_unless(stats.lost == 1);
+    fail_unless(stats.concealed == PACKET_USEC);
+
+    /* A sender restart is followed once it is confirmed */
+    push(jb, 0, 30000, 0, N_PACKETS * PACKET_USEC);
+    fail_unless(pa_jitter_buffer_get_length(jb) == 0);
+    push(jb, 1, 30000, 0, N_PACKETS * PACKET_USEC);
+    fail_unless(pa_jitter_buffer_get_length(jb) == PACKET_FRAMES * sizeof(int16_t));
+
+    pa_jitter_buffer_free(jb);
+}
+END_TEST
+
+START_TEST (loss_test) {
+    pa_jitter_buffer *jb;
+    pa_jitter_buffer_stats stats;
+    size_t gap = 10 * PACKET_FRAMES, full = RATE / 100, fade = RATE / 200;
+    unsigned i;
+
+    jb = new_buffer(2*PA_USEC_PER_SEC);
+
+    for (i = 0; i < N_PACKETS; i++)
+        if (i != 10)
+            push(jb, i, 0, 0, i * PACKET_USEC);
+
+    fail_unless(play(jb) == N_FRAMES);
+
+    pa_jitter_buffer_get_stats(jb, &stats);
+    fail_unless(stats.received == N_PACKETS - 1);
+    fail_unless(stats.lost == 1);
+    fail_unless(stats.concealed == PACKET_USEC);
+
+    /* Everything but the lost packet is unchanged */
+    fail_unless(memcmp(output, tone, gap * sizeof(int16_t)) == 0);
+    fail_unless(memcmp(output + gap + PACKET_FRAMES + fade, tone + gap + PACKET_FRAMES + fade,
+                       (N_FRAMES - gap - PACKET_FRAMES - fade) * sizeof(int16_t)) == 0);
+
+    /* The concealment continues the tone, where silence would be an
+     * error of 1 */
+    pa_log_debug("Concealment error %0.4f", error(output + gap, tone + gap, full));
+    fail_unless(error(output + gap, tone + gap, full) < 0.05);
+
+    /* The second half is faded out, but the crossfade back in is
+     * smooth */
+    for (i = gap; i < gap + PACKET_FRAMES + fade; i++)
+        fail_unless(abs(output[i] - output[i - 1]) < 2000);
+
+    pa_jitter_buffer_free(jb);
+}
+END_TEST
+
+START_TEST (late_test) {
+    pa_jitter_buffer *jb;
+    pa_jitter_buffer_stats stats;
+    pa_usec_t target;
+    unsigned i;
+
+    jb = new_buffer(2*PA_USEC_PER_SEC);
+
+    for (i = 0; i < 20; i++)
+        if (i != 10)
+            push(jb, i, 0, 0, i * PACKET_USEC);
+
+    fail_unless(play(jb) == 20 * PACKET_FRAMES);
+    target = pa_jitter_buffer_get_target(jb);
+
+    /* Too late to be played */
+    push(jb, 10, 0, 0, 20 * PACKET_USEC);
+    fail_unless(pa_jitter_buffer_get_length(jb) == 0);
+
+    pa_jitter_buffer_get_stats(jb, &stats);
+    fail_unless(stats.received == 20);
+    fail_unless(stats.late == 1);
+    fail_unless(stats.lost == 0);
+    fail_unless(pa_jitter_buffer_get_target(jb) > target);
+
+    pa_jitter_buffer_free(jb);
+}
+END_TEST
+
+START_TEST (jitter_test) {
+    pa_jitter_buffer *clean, *jittery;
+    pa_jitter_buffer_stats stats;
+    unsigned i;
+
+    clean = new_buffer(2*PA_USEC_PER_SEC);
+    jittery = new_buffer(2*PA_USEC_PER_SEC);
+
+    srand(4711);
+
+    for (i = 0; i < N_PACKETS; i++) {
+        push(clean, i, 0, 0, i * PACKET_USEC);
+        push(jittery, i, 0, 0, i * PACKET_USEC + (pa_usec_t) (rand() % 30) * PA_USEC_PER_MSEC);
+    }
+
+    pa_jitter_buffer_get_stats(jittery, &stats);
+    pa_log_debug("Jitter %llu usec, target %llu usec", (unsigned long long) stats.jitter, (unsigned long long) stats.target);
+
+    fail_unless(stats.jitter > 5 * PA_USEC_PER_MSEC);
+    fail_unless(pa_jitter_buffer_get_target(clean) == 2 * PACKET_USEC);
+    fail_unless(pa_jitter_buffer_get_target(jittery) > pa_jitter_buffer_get_target(clean) + 20 * PA_USEC_PER_MSEC);
+
+    pa_jitter_buffer_free(clean);
+    pa_jitter_buffer_free(jittery);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    generate();
+    pool = pa_mempool_new(FALSE, 0);
+
+    s = suite_create("Jitter Buffer");
+    tc = tcase_create("jitterbuffer");
+    tcase_add_test(tc, in_order_test);
+    tcase_add_test(tc, reorder_test);
+    tcase_add_test(tc, wrap_test);
+    tcase_add_test(tc, loss_test);
+    tcase_add_test(tc, late_test);
+    tcase_add_test(tc, jitter_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    pa_mempool_free(pool);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,196 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/rtclock.h>
+
+#include <pulsecore/pdispatch.h>
+#include <pulsecore/native-common.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#define N_REPLIES 10000
+
+static unsigned n_replies, n_timeouts, n_drained, n_freed;
+static uint32_t last_tag;
+static pa_bool_t in_order;
+
+static void reply_cb(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    fail_unless(PA_PTR_TO_UINT(userdata) == tag);
+
+    if (command == PA_COMMAND_TIMEOUT) {
+        fail_unless(t == NULL);
+
+        if (n_timeouts > 0 && tag < last_tag)
+            in_order = FALSE;
+
+        n_timeouts++;
+    } else {
+        fail_unless(command == PA_COMMAND_REPLY);
+        fail_unless(t != NULL);
+        n_replies++;
+    }
+
+    last_tag = tag;
+}
+
+static void drain_cb(pa_pdispatch *pd, void *userdata) {
+    n_drained++;
+}
+
+static void free_cb(void *userdata) {
+    n_freed++;
+}
+
+static void reply(pa_pdispatch *pd, uint32_t tag) {
+    pa_tagstruct *t;
+    pa_packet *packet;
+    const uint8_t *data;
+    size_t length;
+
+    t = pa_tagstruct_new(NULL, 0);
+    pa_tagstruct_putu32(t, PA_COMMAND_REPLY);
+    pa_tagstruct_putu32(t, tag);
+    pa_tagstruct_puts(t, "data");
+
+    data = pa_tagstruct_data(t, &length);
+    packet = pa_packet_new_data(data, length);
+    pa_tagstruct_free(t);
+
+    fail_unless(pa_pdispatch_run(pd, packet, NULL, NULL) == 0);
+    pa_packet_unref(packet);
+}
+
+START_TEST (reply_test) {
+    pa_mainloop *m;
+    pa_pdispatch *pd;
+    uint32_t tag;
+    pa_usec_t start;
+
+    m = pa_mainloop_new();
+    pd = pa_pdispatch_new(pa_mainloop_get_api(m), TRUE, NULL, 0);
+
+    n_replies = n_drained = 0;
+    start = pa_rtclock_now();
+
+    for (tag = 0; tag < N_REPLIES; tag++)
+        pa_pdispatch_register_reply(pd, tag, 30, reply_cb, PA_UINT_TO_PTR(tag), NULL);
+
+    fail_unless(pa_pdispatch_is_pending(pd));
+    pa_pdispatch_set_drain_callback(pd, drain_cb, NULL);
+
+    /* Every other one first, the rest backwards */
+    for (tag = 0; tag < N_REPLIES; tag += 2)
+        reply(pd, tag);
+    for (tag = N_REPLIES - 1; tag < N_REPLIES; tag -= 2)
+        reply(pd, tag);
+
+    pa_log_debug("%u replies took %llu usec", N_REPLIES, (unsigned long long) (pa_rtclock_now() - start));
+
+    fail_unless(n_replies == N_REPLIES);
+    fail_unless(n_drained == 1);
+    fail_unless(!pa_pdispatch_is_pending(pd));
+
+    /* Unknown tags are ignored */
+    reply(pd, 4711);
+    fail_unless(n_replies == N_REPLIES);
+
+    pa_pdispatch_unref(pd);
+    pa_mainloop_free(m);
+}
+END_TEST
+
+START_TEST (timeout_test) {
+    pa_mainloop *m;
+    pa_pdispatch *pd;
+    uint32_t tag;
+
+    m = pa_mainloop_new();
+    pd = pa_pdispatch_new(pa_mainloop_get_api(m), TRUE, NULL, 0);
+
+    n_replies = n_timeouts = n_freed = 0;
+    in_order = TRUE;
+
+    /* Registered out of order, but they should time out sorted by
+     * their deadline */
+    pa_pdispatch_register_reply(pd, 3, 1, reply_cb, PA_UINT_TO_PTR(3), NULL);
+    for (tag = 0; tag < 3; tag++)
+        pa_pdispatch_register_reply(pd, tag, 0, reply_cb, PA_UINT_TO_PTR(tag), NULL);
+    pa_pdispatch_register_reply(pd, 4, 1, reply_cb, PA_UINT_TO_PTR(4), NULL);
+
+    /* Answered in time */
+    reply(pd, 1);
+
+    /* Unregistered, which doesn't call the free callback */
+    pa_pdispatch_register_reply(pd, 5, 0, reply_cb, PA_UINT_TO_PTR(5), free_cb);
+    pa_pdispatch_unregister_reply(pd, PA_UINT_TO_PTR(5));
+    fail_unless(n_freed == 0);
+
+    while (n_timeouts < 2)
+        fail_unless(pa_mainloop_iterate(m, 1, NULL) >= 0);
+
+    fail_unless(n_timeouts == 2);
+    fail_unless(last_tag == 2);
+    fail_unless(pa_pdispatch_is_pending(pd));
+
+    while (pa_pdispatch_is_pending(pd))
+        fail_unless(pa_mainloop_iterate(m, 1, NULL) >= 0);
+
+    fail_unless(n_timeouts == 4);
+    fail_unless(n_replies == 1);
+    fail_unless(in_order);
+
+    /* Pending ones are freed with the dispatcher */
+    pa_pdispatch_register_reply(pd, 6, 30, reply_cb, PA_UINT_TO_PTR(6), free_cb);
+    pa_pdispatch_unref(pd);
+    fail_unless(n_freed == 1);
+
+    pa_mainloop_free(m);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("PDispatch");
+    tc = tcase_create("pdispatch");
+    tcase_add_test(tc, reply_test);
+    tcase_add_test(tc, timeout_test);
+    tcase_set_timeout(tc, 10);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
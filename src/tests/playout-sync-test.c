@@ -0,0 +1,213 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <check.h>
+
+#include <pulse/timeval.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "playout-sync.h"
+
+#define RATE 48000
+#define PLAYOUT_DELAY (200*PA_USEC_PER_MSEC)
+#define SINK_DELAY (50*PA_USEC_PER_MSEC)
+
+/* The sink asks for audio this often, the sender reports and the
+ * controller runs once a second */
+#define STEP_USEC (10*PA_USEC_PER_MSEC)
+#define STEP_FRAMES (RATE / 100)
+#define REPORT_STEPS 100
+
+static const pa_sample_spec ss = {
+    .format = PA_SAMPLE_S16NE,
+    .rate = RATE,
+    .channels = 1
+};
+
+/* A receiver whose sink runs on the wall clock, playing a sender whose
+ * sample clock runs skew too fast. pos is the sample played next, in
+ * the sender's clock, and the sender started capturing at time zero. */
+struct receiver {
+    pa_playout_sync *ps;
+    double sender_rate;
+    pa_usec_t now;
+    double pos;
+    uint32_t rate;
+    int64_t offset;
+};
+
+/* How late the sample played next really is */
+static int64_t true_offset(struct receiver *r) {
+    pa_usec_t play_time, capture_time;
+
+    play_time = r->now + SINK_DELAY + pa_bytes_to_usec(pa_playout_sync_get_hold(r->ps), &ss);
+    capture_time = (pa_usec_t) (r->pos / r->sender_rate * PA_USEC_PER_SEC);
+
+    return (int64_t) play_time - (int64_t) (capture_time + PLAYOUT_DELAY);
+}
+
+/* Plays for usec, with the sender reporting and the controller running
+ * every REPORT_STEPS steps */
+static void run(struct receiver *r, pa_usec_t usec) {
+    pa_usec_t end = r->now + usec;
+
+    while (r->now < end) {
+        size_t hold, drop;
+
+        if ((r->now / STEP_USEC) % REPORT_STEPS == 0) {
+            pa_playout_sync_report(r->ps, r->now, (uint32_t) (r->now * r->sender_rate / PA_USEC_PER_SEC));
+            r->offset = pa_playout_sync_update(r->ps, r->now + SINK_DELAY, (uint32_t) r->pos, &drop, &r->rate);
+            r->pos += (double) (drop / pa_frame_size(&ss));
+        }
+
+        /* Silence first, then the stream, resampled from r->rate */
+        hold = pa_playout_sync_hold(r->ps, STEP_FRAMES * pa_frame_size(&ss));
+        r->pos += (double) (STEP_FRAMES - hold / pa_frame_size(&ss)) * r->rate / RATE;
+
+        r->now += STEP_USEC;
+    }
+}
+
+static void converge(double skew, int64_t start_offset) {
+    struct receiver r;
+
+    r.ps = pa_playout_sync_new(&ss, PLAYOUT_DELAY);
+    r.sender_rate = RATE * (1.0 + skew);
+    r.now = 10 * PA_USEC_PER_SEC;
+    r.rate = RATE;
+    r.offset = 0;
+
+    /* Start with the sample that is start_offset late */
+    r.pos = ((double) (r.now + SINK_DELAY) - (double) PLAYOUT_DELAY - (double) start_offset) * r.sender_rate / PA_USEC_PER_SEC;
+    fail_unless(llabs(true_offset(&r) - start_offset) < 100);
+
+    /* The step is taken right away... */
+    run(&r, STEP_USEC);
+    pa_log_debug("Skew %0.0f ppm, starting %0.1f ms late: %0.3f ms after the step",
+                 skew * 1e6, (double) start_offset / PA_USEC_PER_MSEC, (double) true_offset(&r) / PA_USEC_PER_MSEC);
+    fail_unless(llabs(true_offset(&r)) < 20 * PA_USEC_PER_MSEC);
+
+    /* ...and the rest is steered away, while the rate follows the
+     * sender's clock */
+    run(&r, 120 * PA_USEC_PER_SEC);
+    pa_log_debug("After 2 minutes: %0.3f ms, reported %0.3f ms, rate %u Hz for %0.2f Hz",
+                 (double) true_offset(&r) / PA_USEC_PER_MSEC, (double) r.offset / PA_USEC_PER_MSEC, r.rate, r.sender_rate);
+
+    fail_unless(llabs(true_offset(&r)) < PA_USEC_PER_MSEC);
+    fail_unless(llabs(r.offset) < PA_USEC_PER_MSEC);
+    fail_unless(fabs(r.rate - r.sender_rate) < 2);
+
+    pa_playout_sync_free(r.ps);
+}
+
+START_TEST (early_test) {
+    converge(100e-6, -100 * PA_USEC_PER_MSEC);
+    converge(-300e-6, -100 * PA_USEC_PER_MSEC);
+}
+END_TEST
+
+START_TEST (late_test) {
+    converge(100e-6, 100 * PA_USEC_PER_MSEC);
+    converge(-300e-6, 100 * PA_USEC_PER_MSEC);
+}
+END_TEST
+
+/* Within the step threshold only resampling is used */
+START_TEST (steer_test) {
+    converge(500e-6, 10 * PA_USEC_PER_MSEC);
+    converge(-500e-6, -10 * PA_USEC_PER_MSEC);
+}
+END_TEST
+
+/* Silence that is rewound is held back again, only the audio is
+ * rewound in the stream */
+START_TEST (rewind_test) {
+    pa_playout_sync *ps;
+    size_t drop;
+    uint32_t rate;
+    const size_t fs = sizeof(int16_t);
+
+    ps = pa_playout_sync_new(&ss, PLAYOUT_DELAY);
+    pa_playout_sync_set_maxrewind(ps, 1000 * fs);
+
+    /* 100 ms early, so 4800 frames are held back */
+    pa_playout_sync_report(ps, 0, 0);
+    pa_playout_sync_update(ps, PLAYOUT_DELAY - 100 * PA_USEC_PER_MSEC, 0, &drop, &rate);
+    fail_unless(drop == 0);
+    fail_unless(pa_playout_sync_get_hold(ps) == 4800 * fs);
+
+    fail_unless(pa_playout_sync_hold(ps, 5000 * fs) == 4800 * fs);
+    pa_playout_sync_played(ps, 200 * fs);
+    fail_unless(pa_playout_sync_get_hold(ps) == 0);
+
+    fail_unless(pa_playout_sync_rewind(ps, 100 * fs) == 100 * fs);
+    fail_unless(pa_playout_sync_get_hold(ps) == 0);
+
+    fail_unless(pa_playout_sync_rewind(ps, 400 * fs) == 100 * fs);
+    fail_unless(pa_playout_sync_get_hold(ps) == 300 * fs);
+
+    /* Only max_rewind is remembered, anything before counts as audio */
+    fail_unless(pa_playout_sync_hold(ps, 300 * fs) == 300 * fs);
+    pa_playout_sync_played(ps, 900 * fs);
+    fail_unless(pa_playout_sync_rewind(ps, 1500 * fs) == 1400 * fs);
+    fail_unless(pa_playout_sync_get_hold(ps) == 100 * fs);
+
+    /* A reset forgets it all */
+    pa_playout_sync_played(ps, 100 * fs);
+    pa_playout_sync_reset(ps);
+    fail_unless(pa_playout_sync_get_hold(ps) == 0);
+    fail_unless(pa_playout_sync_rewind(ps, 100 * fs) == 100 * fs);
+
+    pa_playout_sync_free(ps);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Playout Sync");
+    tc = tcase_create("playoutsync");
+    tcase_add_test(tc, early_test);
+    tcase_add_test(tc, late_test);
+    tcase_add_test(tc, steer_test);
+    tcase_add_test(tc, rewind_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
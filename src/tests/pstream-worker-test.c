@@ -0,0 +1,379 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/iochannel.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/packet.h>
+#include <pulsecore/pstream.h>
+#include <pulsecore/pstream-worker.h>
+#include <pulsecore/socket.h>
+#include <pulsecore/thread-mq.h>
+
+#define N_FRAMES 100
+#define BLOCK_SIZE 3000
+
+static unsigned n_packets, n_drained, n_died;
+static size_t n_bytes;
+static unsigned long sum;
+
+static void packet_cb(pa_pstream *p, pa_packet *packet, const pa_cmsg_ancil_data *ancil_data, void *userdata) {
+    /* Callbacks are always called from the main loop */
+    fail_unless(!pa_thread_mq_get());
+
+    fail_unless(packet->length == n_packets + 1);
+    sum += packet->data[0];
+    n_packets++;
+}
+
+static void memblock_cb(pa_pstream *p, uint32_t channel, int64_t offset, pa_seek_mode_t seek, const pa_memchunk *chunk, void *userdata) {
+    uint8_t *d;
+    size_t i;
+
+    fail_unless(!pa_thread_mq_get());
+    fail_unless(channel == 1);
+
+    d = pa_memblock_acquire_chunk(chunk);
+    for (i = 0; i < chunk->length; i++)
+        sum += d[i];
+    pa_memblock_release(chunk->memblock);
+
+    n_bytes += chunk->length;
+}
+
+static pa_atomic_t n_dispatched = PA_ATOMIC_INIT(0);
+static pa_atomic_t n_direct = PA_ATOMIC_INIT(0);
+static size_t n_indirect;
+
+static void direct_packet_cb(pa_pstream *p, pa_packet *packet, const pa_cmsg_ancil_data *ancil_data, void *userdata) {
+    fail_unless(!pa_thread_mq_get());
+
+    pa_atomic_inc(&n_dispatched);
+}
+
+static void direct_memblock_cb(pa_pstream *p, uint32_t channel, int64_t offset, pa_seek_mode_t seek, const pa_memchunk *chunk, void *userdata) {
+    fail_unless(!pa_thread_mq_get());
+
+    /* Blocks for channel 2 only come here while packets before them
+     * haven't been dispatched yet */
+    if (channel == 2)
+        n_indirect += chunk->length;
+    else
+        n_bytes += chunk->length;
+}
+
+static pa_bool_t memblock_thread_cb(pa_pstream *p, uint32_t channel, int64_t offset, pa_seek_mode_t seek, const pa_memchunk *chunk, void *userdata) {
+    uint8_t *d;
+    int i;
+
+    /* Called from the worker, and only for channel 2 we take care of
+     * the data ourselves */
+    fail_unless(pa_thread_mq_get() != NULL);
+
+    if (channel != 2)
+        return FALSE;
+
+    d = pa_memblock_acquire_chunk(chunk);
+    i = d[0];
+    pa_memblock_release(chunk->memblock);
+
+    /* Block i was sent after packet i, which has to have been
+     * dispatched by now */
+    fail_unless(pa_atomic_load(&n_dispatched) > i);
+
+    pa_atomic_add(&n_direct, (int) chunk->length);
+    return TRUE;
+}
+
+static void drain_cb(pa_pstream *p, void *userdata) {
+    n_drained++;
+}
+
+static void die_cb(pa_pstream *p, void *userdata) {
+    n_died++;
+}
+
+START_TEST (pstream_worker_test) {
+    pa_mainloop *m;
+    pa_mainloop_api *api;
+    pa_mempool *pool;
+    pa_pstream_worker *w1, *w2;
+    pa_pstream *a, *b;
+    unsigned long expected = 0;
+    int fds[2];
+    unsigned i, j;
+
+    fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+    m = pa_mainloop_new();
+    api = pa_mainloop_get_api(m);
+    pool = pa_mempool_new(FALSE, 0);
+
+    /* One thread for each end */
+    w1 = pa_pstream_worker_new(api, "worker-1");
+    w2 = pa_pstream_worker_new(api, "worker-2");
+    fail_unless(w1 && w2);
+
+    a = pa_pstream_new_threaded(api, pa_iochannel_new(api, fds[0], fds[0]), pool, pa_pstream_worker_get_thread(w1));
+    b = pa_pstream_new_threaded(api, pa_iochannel_new(api, fds[1], fds[1]), pool, pa_pstream_worker_get_thread(w2));
+
+    pa_pstream_set_drain_callback(a, drain_cb, NULL);
+    pa_pstream_set_receive_packet_callback(b, packet_cb, NULL);
+    pa_pstream_set_receive_memblock_callback(b, memblock_cb, NULL);
+    pa_pstream_set_die_callback(b, die_cb, NULL);
+
+    for (i = 0; i < N_FRAMES; i++) {
+        pa_packet *packet;
+        pa_memchunk chunk;
+        uint8_t *d;
+
+        packet = pa_packet_new(i + 1);
+        memset(packet->data, (int) i, i + 1);
+        expected += i;
+        pa_pstream_send_packet(a, packet, NULL);
+        pa_packet_unref(packet);
+
+        chunk.memblock = pa_memblock_new(pool, BLOCK_SIZE);
+        chunk.index = 0;
+        chunk.length = BLOCK_SIZE;
+
+        d = pa_memblock_acquire(chunk.memblock);
+        for (j = 0; j < BLOCK_SIZE; j++) {
+            d[j] = (uint8_t) (i + j);
+            expected += d[j];
+        }
+        pa_memblock_release(chunk.memblock);
+
+        pa_pstream_send_memblock(a, 1, 0, PA_SEEK_RELATIVE, &chunk);
+        pa_memblock_unref(chunk.memblock);
+    }
+
+    while (n_packets < N_FRAMES || n_bytes < N_FRAMES * BLOCK_SIZE || pa_pstream_is_pending(a))
+        pa_mainloop_iterate(m, TRUE, NULL);
+
+    fail_unless(n_packets == N_FRAMES);
+    fail_unless(n_bytes == N_FRAMES * BLOCK_SIZE);
+    fail_unless(sum == expected);
+    fail_unless(n_drained >= 1);
+
+    /* Closing one end has to be noticed on the other one */
+    pa_pstream_unlink(a);
+    pa_pstream_unref(a);
+
+    while (n_died < 1)
+        pa_mainloop_iterate(m, TRUE, NULL);
+
+    pa_pstream_unref(b);
+
+    pa_pstream_worker_free(w1);
+    pa_pstream_worker_free(w2);
+
+    pa_mempool_free(pool);
+    pa_mainloop_free(m);
+}
+END_TEST
+
+START_TEST (pstream_worker_direct_test) {
+    pa_mainloop *m;
+    pa_mainloop_api *api;
+    pa_mempool *pool;
+    pa_pstream_worker *w1, *w2;
+    pa_pstream *a, *b;
+    int fds[2];
+    unsigned i;
+
+    fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+    m = pa_mainloop_new();
+    api = pa_mainloop_get_api(m);
+    pool = pa_mempool_new(FALSE, 0);
+
+    w1 = pa_pstream_worker_new(api, "worker-1");
+    w2 = pa_pstream_worker_new(api, "worker-2");
+    fail_unless(w1 && w2);
+
+    a = pa_pstream_new_threaded(api, pa_iochannel_new(api, fds[0], fds[0]), pool, pa_pstream_worker_get_thread(w1));
+    b = pa_pstream_new_threaded(api, pa_iochannel_new(api, fds[1], fds[1]), pool, pa_pstream_worker_get_thread(w2));
+
+    n_bytes = 0;
+    pa_pstream_set_receive_packet_callback(b, direct_packet_cb, NULL);
+    pa_pstream_set_receive_memblock_callback(b, direct_memblock_cb, NULL);
+    pa_pstream_set_receive_memblock_thread_callback(b, memblock_thread_cb, NULL);
+
+    /* Packets and blocks for channel 2 alternate, and the blocks for
+     * channel 1 are passed on to the main loop */
+    for (i = 0; i < N_FRAMES; i++) {
+        pa_packet *packet;
+        pa_memchunk chunk;
+        uint8_t *d;
+
+        packet = pa_packet_new(1);
+        pa_pstream_send_packet(a, packet, NULL);
+        pa_packet_unref(packet);
+
+        chunk.memblock = pa_memblock_new(pool, BLOCK_SIZE);
+        chunk.index = 0;
+        chunk.length = BLOCK_SIZE;
+
+        d = pa_memblock_acquire(chunk.memblock);
+        memset(d, (int) i, BLOCK_SIZE);
+        pa_memblock_release(chunk.memblock);
+
+        pa_pstream_send_memblock(a, 2, 0, PA_SEEK_RELATIVE, &chunk);
+        pa_pstream_send_memblock(a, 1, 0, PA_SEEK_RELATIVE, &chunk);
+        pa_memblock_unref(chunk.memblock);
+    }
+
+    while (pa_atomic_load(&n_dispatched) < N_FRAMES ||
+           n_bytes < N_FRAMES * BLOCK_SIZE ||
+           n_indirect + (size_t) pa_atomic_load(&n_direct) < N_FRAMES * BLOCK_SIZE)
+        pa_mainloop_iterate(m, TRUE, NULL);
+
+    fail_unless(n_bytes == N_FRAMES * BLOCK_SIZE);
+    fail_unless(n_indirect + (size_t) pa_atomic_load(&n_direct) == N_FRAMES * BLOCK_SIZE);
+
+    pa_pstream_unlink(a);
+    pa_pstream_unref(a);
+    pa_pstream_unlink(b);
+    pa_pstream_unref(b);
+
+    pa_pstream_worker_free(w1);
+    pa_pstream_worker_free(w2);
+
+    pa_mempool_free(pool);
+    pa_mainloop_free(m);
+}
+END_TEST
+
+static pa_atomic_t unlinked = PA_ATOMIC_INIT(0);
+
+static void unlink_packet_cb(pa_pstream *p, pa_packet *packet, const pa_cmsg_ancil_data *ancil_data, void *userdata) {
+    /* Doesn't wait for the thread, which is busy handing us what
+     * keeps coming in */
+    pa_pstream_unlink(p);
+    pa_atomic_store(&unlinked, 1);
+}
+
+static pa_bool_t unlink_thread_cb(pa_pstream *p, uint32_t channel, int64_t offset, pa_seek_mode_t seek, const pa_memchunk *chunk, void *userdata) {
+    /* Once unlinked, the thread mustn't call us anymore */
+    fail_unless(!pa_atomic_load(&unlinked));
+
+    return FALSE;
+}
+
+START_TEST (pstream_worker_unlink_test) {
+    pa_mainloop *m;
+    pa_mainloop_api *api;
+    pa_mempool *pool;
+    pa_pstream_worker *w1, *w2;
+    pa_pstream *a, *b;
+    int fds[2];
+    unsigned i;
+
+    fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+    m = pa_mainloop_new();
+    api = pa_mainloop_get_api(m);
+    pool = pa_mempool_new(FALSE, 0);
+
+    w1 = pa_pstream_worker_new(api, "worker-1");
+    w2 = pa_pstream_worker_new(api, "worker-2");
+    fail_unless(w1 && w2);
+
+    a = pa_pstream_new_threaded(api, pa_iochannel_new(api, fds[0], fds[0]), pool, pa_pstream_worker_get_thread(w1));
+    b = pa_pstream_new_threaded(api, pa_iochannel_new(api, fds[1], fds[1]), pool, pa_pstream_worker_get_thread(w2));
+
+    pa_pstream_set_receive_packet_callback(b, unlink_packet_cb, NULL);
+    pa_pstream_set_receive_memblock_thread_callback(b, unlink_thread_cb, NULL);
+
+    for (i = 0; i < N_FRAMES; i++) {
+        pa_packet *packet;
+        pa_memchunk chunk;
+
+        packet = pa_packet_new(1);
+        packet->data[0] = 0;
+        pa_pstream_send_packet(a, packet, NULL);
+        pa_packet_unref(packet);
+
+        chunk.memblock = pa_memblock_new(pool, BLOCK_SIZE);
+        chunk.index = 0;
+        chunk.length = BLOCK_SIZE;
+        pa_memblock_acquire(chunk.memblock);
+        pa_memblock_release(chunk.memblock);
+
+        pa_pstream_send_memblock(a, 1, 0, PA_SEEK_RELATIVE, &chunk);
+        pa_memblock_unref(chunk.memblock);
+    }
+
+    while (!pa_atomic_load(&unlinked))
+        pa_mainloop_iterate(m, TRUE, NULL);
+
+    /* Let the thread finish the teardown while data is still
+     * arriving */
+    for (i = 0; i < 10; i++)
+        pa_mainloop_iterate(m, FALSE, NULL);
+
+    pa_pstream_unref(b);
+    pa_pstream_unlink(a);
+    pa_pstream_unref(a);
+
+    pa_pstream_worker_free(w1);
+    pa_pstream_worker_free(w2);
+
+    pa_mempool_free(pool);
+    pa_mainloop_free(m);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Pstream Worker");
+    tc = tcase_create("pstream-worker");
+    tcase_add_test(tc, pstream_worker_test);
+    tcase_add_test(tc, pstream_worker_direct_test);
+    tcase_add_test(tc, pstream_worker_unlink_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,567 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <check.h>
+
+#include <openssl/evp.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+
+#include <pulsecore/arpa-inet.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/thread.h>
+
+#include "raop_encoder.h"
+#include "raop_udp.h"
+
+/* The interleaved RTSP channel header and a dummy RTP header, as
+ * raop_client.c puts them in front of each frame */
+#define TCP_HEADER_SIZE 16
+
+/* 50 ms of 44.1 kHz stereo, as module-raop-sink renders it */
+#define BLOCK_SIZE (2205*4)
+#define N_BLOCKS 4000
+
+static const uint8_t key[PA_RAOP_AES_KEY_SIZE] = {
+    0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+    0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff
+};
+
+static const uint8_t iv[PA_RAOP_AES_KEY_SIZE] = {
+    0x0f, 0x0e, 0x0d, 0x0c, 0x0b, 0x0a, 0x09, 0x08,
+    0x07, 0x06, 0x05, 0x04, 0x03, 0x02, 0x01, 0x00
+};
+
+struct receiver {
+    int fd;
+    size_t frames;
+    size_t bytes;
+    pa_bool_t failed;
+};
+
+static void write_tcp_header(uint8_t *d, size_t length) {
+    memset(d, 0, TCP_HEADER_SIZE);
+    d[0] = 0x24;
+    d[2] = (uint8_t) ((length - 4) >> 8);
+    d[3] = (uint8_t) (length - 4);
+    d[4] = 0xF0;
+    d[5] = 0xFF;
+}
+
+static uint8_t sample_byte(size_t i) {
+    return (uint8_t) (i * 7 + (i >> 9));
+}
+
+static void fill(pa_memchunk *c, size_t length) {
+    uint8_t *d;
+    size_t i;
+
+    d = (uint8_t*) pa_memblock_acquire(c->memblock) + c->index;
+    for (i = 0; i < length; i++)
+        d[i] = sample_byte(i);
+    pa_memblock_release(c->memblock);
+}
+
+/* Does what a RAOP receiver would: decrypts the whole blocks of an
+ * ALAC frame and unpacks the samples, checking them against fill() */
+static pa_bool_t decode_frame(EVP_CIPHER_CTX *cipher, uint8_t *d, size_t size) {
+    size_t aligned, n, i;
+    int l;
+
+    aligned = size - size % PA_RAOP_AES_KEY_SIZE;
+
+    if (!EVP_DecryptInit_ex(cipher, NULL, NULL, NULL, iv) ||
+        !EVP_DecryptUpdate(cipher, d, &l, d, (int) aligned))
+        return FALSE;
+
+    /* Stereo, has size, not compressed */
+    if (d[0] != 0x20 || d[1] != 0x00 || (d[2] & 0xfe) != 0x12)
+        return FALSE;
+
+    n = size - 7;
+    if ((((size_t) (d[2] & 1) << 31) | ((size_t) d[3] << 23) | ((size_t) d[4] << 15) | ((size_t) d[5] << 7) | (d[6] >> 1)) != n / 4)
+        return FALSE;
+
+    for (i = 0; i < n; i++) {
+        uint8_t s = (uint8_t) ((d[6 + i] << 7) | (d[7 + i] >> 1));
+
+        /* The samples are sent big endian */
+        if (s != sample_byte(i ^ 1))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void receiver_thread(void *userdata) {
+    struct receiver *r = userdata;
+    EVP_CIPHER_CTX *cipher;
+    uint8_t buf[4 + 0xffff];
+
+    pa_assert_se(cipher = EVP_CIPHER_CTX_new());
+    pa_assert_se(EVP_DecryptInit_ex(cipher, EVP_aes_128_cbc(), NULL, key, iv));
+    EVP_CIPHER_CTX_set_padding(cipher, 0);
+
+    for (;;) {
+        size_t len;
+
+        if (pa_loop_read(r->fd, buf, 4, NULL) != 4)
+            break;
+
+        if (buf[0] != 0x24) {
+            r->failed = TRUE;
+            break;
+        }
+
+        len = ((size_t) buf[2] << 8) | buf[3];
+        if ((size_t) pa_loop_read(r->fd, buf + 4, len, NULL) != len) {
+            r->failed = TRUE;
+            break;
+        }
+
+        if (len < 12 || buf[4] != 0xF0 || buf[5] != 0xFF || !decode_frame(cipher, buf + 16, len - 12)) {
+            r->failed = TRUE;
+            break;
+        }
+
+        r->frames++;
+        r->bytes += 4 + len;
+    }
+
+    EVP_CIPHER_CTX_free(cipher);
+}
+
+START_TEST (encode_test) {
+    pa_mempool *pool;
+    pa_raop_encoder *e;
+    pa_memchunk raw, encoded;
+    EVP_CIPHER_CTX *cipher;
+    uint8_t *d;
+
+    pool = pa_mempool_new(FALSE, 0);
+    fail_unless((e = pa_raop_encoder_new(pool)) != NULL);
+    fail_unless(pa_raop_encoder_set_key(e, key, iv) == 0);
+
+    /* Trailing bytes that don't make up a whole frame are kept back */
+    raw.memblock = pa_memblock_new(pool, BLOCK_SIZE + 8);
+    raw.index = 3;
+    raw.length = BLOCK_SIZE + 2;
+    fill(&raw, raw.length);
+
+    fail_unless(pa_raop_encoder_encode(e, &raw, (size_t) -1, TCP_HEADER_SIZE, &encoded) == 0);
+    fail_unless(raw.index == 3 + BLOCK_SIZE);
+    fail_unless(raw.length == 2);
+    fail_unless(encoded.length == TCP_HEADER_SIZE + 7 + BLOCK_SIZE);
+
+    fail_unless((cipher = EVP_CIPHER_CTX_new()) != NULL);
+    fail_unless(EVP_DecryptInit_ex(cipher, EVP_aes_128_cbc(), NULL, key, iv) == 1);
+    EVP_CIPHER_CTX_set_padding(cipher, 0);
+
+    d = (uint8_t*) pa_memblock_acquire(encoded.memblock) + encoded.index;
+    fail_unless(decode_frame(cipher, d + TCP_HEADER_SIZE, encoded.length - TCP_HEADER_SIZE));
+    pa_memblock_release(encoded.memblock);
+    pa_memblock_unref(encoded.memblock);
+
+    /* UDP packets are limited in length */
+    raw.index = 0;
+    raw.length = BLOCK_SIZE;
+    fill(&raw, raw.length);
+
+    fail_unless(pa_raop_encoder_encode(e, &raw, PA_RAOP_UDP_FRAMES_PER_PACKET * 4, PA_RAOP_UDP_HEADER_SIZE, &encoded) == 0);
+    fail_unless(raw.length == BLOCK_SIZE - PA_RAOP_UDP_FRAMES_PER_PACKET * 4);
+    fail_unless(encoded.length == PA_RAOP_UDP_HEADER_SIZE + 7 + PA_RAOP_UDP_FRAMES_PER_PACKET * 4);
+
+    d = (uint8_t*) pa_memblock_acquire(encoded.memblock) + encoded.index;
+    fail_unless(decode_frame(cipher, d + PA_RAOP_UDP_HEADER_SIZE, encoded.length - PA_RAOP_UDP_HEADER_SIZE));
+    pa_memblock_release(encoded.memblock);
+    pa_memblock_unref(encoded.memblock);
+
+    /* A new key, as for a new connection, is used from the next frame
+     * on. decode_frame() goes by the same IV. */
+    fail_unless(pa_raop_encoder_set_key(e, iv, iv) == 0);
+
+    raw.index = 0;
+    raw.length = BLOCK_SIZE;
+    fill(&raw, raw.length);
+
+    fail_unless(pa_raop_encoder_encode(e, &raw, (size_t) -1, TCP_HEADER_SIZE, &encoded) == 0);
+    fail_unless(EVP_DecryptInit_ex(cipher, EVP_aes_128_cbc(), NULL, iv, iv) == 1);
+    EVP_CIPHER_CTX_set_padding(cipher, 0);
+
+    d = (uint8_t*) pa_memblock_acquire(encoded.memblock) + encoded.index;
+    fail_unless(decode_frame(cipher, d + TCP_HEADER_SIZE, encoded.length - TCP_HEADER_SIZE));
+    pa_memblock_release(encoded.memblock);
+    pa_memblock_unref(encoded.memblock);
+
+    EVP_CIPHER_CTX_free(cipher);
+    pa_memblock_unref(raw.memblock);
+
+    pa_raop_encoder_free(e);
+    pa_mempool_free(pool);
+}
+END_TEST
+
+/* Encodes and sends audio as fast as it goes to a fake receiver on
+ * loopback, which decrypts and checks all of it */
+START_TEST (throughput_test) {
+    pa_mempool *pool;
+    pa_raop_encoder *e;
+    pa_memchunk block;
+    struct receiver r;
+    struct sockaddr_in sa;
+    socklen_t salen = sizeof(sa);
+    pa_thread *thread;
+    pa_usec_t start, elapsed, audio;
+    int lfd, fd;
+    unsigned i;
+
+    pool = pa_mempool_new(FALSE, 0);
+    fail_unless((e = pa_raop_encoder_new(pool)) != NULL);
+    fail_unless(pa_raop_encoder_set_key(e, key, iv) == 0);
+
+    fail_unless((lfd = socket(AF_INET, SOCK_STREAM, 0)) >= 0);
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fail_unless(bind(lfd, (struct sockaddr*) &sa, salen) == 0);
+    fail_unless(getsockname(lfd, (struct sockaddr*) &sa, &salen) == 0);
+    fail_unless(listen(lfd, 1) == 0);
+
+    fail_unless((fd = socket(AF_INET, SOCK_STREAM, 0)) >= 0);
+    fail_unless(connect(fd, (struct sockaddr*) &sa, salen) == 0);
+
+    memset(&r, 0, sizeof(r));
+    fail_unless((r.fd = accept(lfd, NULL, NULL)) >= 0);
+    fail_unless((thread = pa_thread_new("raop-receiver", receiver_thread, &r)) != NULL);
+
+    block.memblock = pa_memblock_new(pool, BLOCK_SIZE);
+    block.index = 0;
+    block.length = BLOCK_SIZE;
+    fill(&block, BLOCK_SIZE);
+
+    start = pa_rtclock_now();
+
+    for (i = 0; i < N_BLOCKS; i++) {
+        pa_memchunk raw = block, encoded;
+        void *p;
+
+        fail_unless(pa_raop_encoder_encode(e, &raw, (size_t) -1, TCP_HEADER_SIZE, &encoded) == 0);
+
+        p = pa_memblock_acquire(encoded.memblock);
+        write_tcp_header(p, encoded.length);
+        fail_unless(pa_loop_write(fd, (uint8_t*) p + encoded.index, encoded.length, NULL) == (ssize_t) encoded.length);
+        pa_memblock_release(encoded.memblock);
+        pa_memblock_unref(encoded.memblock);
+    }
+
+    shutdown(fd, SHUT_WR);
+    pa_thread_free(thread);
+
+    elapsed = pa_rtclock_now() - start;
+    audio = (pa_usec_t) N_BLOCKS * PA_USEC_PER_SEC / 20;
+
+    fail_unless(!r.failed);
+    fail_unless(r.frames == N_BLOCKS);
+
+    pa_log_info("%0.1f s of audio, %zu bytes encoded, encrypted and received in %0.3f s, %0.0f times real time",
+                (double) audio / PA_USEC_PER_SEC, r.bytes, (double) elapsed / PA_USEC_PER_SEC,
+                elapsed > 0 ? (double) audio / elapsed : 0.0);
+
+    pa_memblock_unref(block.memblock);
+    pa_close(r.fd);
+    pa_close(fd);
+    pa_close(lfd);
+
+    pa_raop_encoder_free(e);
+    pa_mempool_free(pool);
+}
+END_TEST
+
+/* Binds two UDP sockets on loopback and connects them to each other,
+ * one for us and one for the fake receiver */
+static void udp_pair(int fds[2]) {
+    struct sockaddr_in sa[2];
+    socklen_t salen = sizeof(sa[0]);
+    unsigned i;
+
+    for (i = 0; i < 2; i++) {
+        fail_unless((fds[i] = socket(AF_INET, SOCK_DGRAM, 0)) >= 0);
+        memset(&sa[i], 0, sizeof(sa[i]));
+        sa[i].sin_family = AF_INET;
+        sa[i].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fail_unless(bind(fds[i], (struct sockaddr*) &sa[i], salen) == 0);
+        fail_unless(getsockname(fds[i], (struct sockaddr*) &sa[i], &salen) == 0);
+    }
+
+    fail_unless(connect(fds[0], (struct sockaddr*) &sa[1], salen) == 0);
+    fail_unless(connect(fds[1], (struct sockaddr*) &sa[0], salen) == 0);
+
+    pa_make_fd_nonblock(fds[0]);
+}
+
+static uint32_t read_uint32(const uint8_t *b) {
+    return ((uint32_t) b[0] << 24) | ((uint32_t) b[1] << 16) | ((uint32_t) b[2] << 8) | b[3];
+}
+
+START_TEST (udp_test) {
+    pa_mempool *pool;
+    pa_raop_packet_buffer *buffer;
+    int control[2], timing[2];
+    uint8_t b[64], *d;
+    unsigned i;
+
+    pool = pa_mempool_new(FALSE, 0);
+    udp_pair(control);
+    udp_pair(timing);
+
+    /* Sync */
+    fail_unless(pa_raop_udp_send_sync(control[0], 44100, 22050, TRUE) == 0);
+    fail_unless(recv(control[1], b, sizeof(b), 0) == 20);
+    fail_unless(b[0] == 0x90 && b[1] == 0xD4);
+    fail_unless(b[2] == 0 && b[3] == 7);
+    fail_unless(read_uint32(b + 4) == 44100 - 22050);
+    fail_unless(read_uint32(b + 16) == 44100);
+
+    fail_unless(pa_raop_udp_send_sync(control[0], 44100, 22050, FALSE) == 0);
+    fail_unless(recv(control[1], b, sizeof(b), 0) == 20);
+    fail_unless(b[0] == 0x80);
+
+    /* Retransmission, across the wrap of the sequence number. Only the
+     * last 8 packets are still there. */
+    buffer = pa_raop_packet_buffer_new(8);
+
+    for (i = 0; i < 10; i++) {
+        pa_memchunk packet;
+
+        packet.memblock = pa_memblock_new(pool, PA_RAOP_UDP_HEADER_SIZE + 1);
+        packet.index = 0;
+        packet.length = PA_RAOP_UDP_HEADER_SIZE + 1;
+
+        d = pa_memblock_acquire(packet.memblock);
+        pa_raop_udp_write_header(d, (uint16_t) (65530 + i), 352 * i, 0x12345678, i == 0);
+        d[PA_RAOP_UDP_HEADER_SIZE] = (uint8_t) i;
+        pa_memblock_release(packet.memblock);
+
+        pa_raop_packet_buffer_write(buffer, &packet);
+        pa_memblock_unref(packet.memblock);
+    }
+
+    fail_unless(pa_raop_packet_buffer_read(buffer, 65530) == NULL);
+    fail_unless(pa_raop_packet_buffer_read(buffer, 65531) == NULL);
+    fail_unless(pa_raop_packet_buffer_read(buffer, 65532) != NULL);
+    fail_unless(pa_raop_packet_buffer_read(buffer, 3) != NULL);
+    fail_unless(pa_raop_packet_buffer_read(buffer, 4) == NULL);
+
+    memset(b, 0, 8);
+    b[0] = 0x80;
+    b[1] = 0xD5;
+    b[3] = 1;
+    b[4] = 65530 >> 8;
+    b[5] = 65530 & 0xff;
+    b[7] = 10;
+    fail_unless(send(control[1], b, 8, 0) == 8);
+    fail_unless(pa_raop_udp_handle_control(control[0], buffer) == 6);
+
+    /* The count is clamped to the size of the buffer, so 65530 up to
+     * 65537, of which the first two are gone */
+    for (i = 2; i < 8; i++) {
+        uint16_t seq = (uint16_t) (65530 + i);
+
+        fail_unless(recv(control[1], b, sizeof(b), MSG_DONTWAIT) == 4 + PA_RAOP_UDP_HEADER_SIZE + 1);
+        fail_unless(b[0] == 0x80 && b[1] == 0xD6);
+        fail_unless(((b[2] << 8) | b[3]) == seq);
+        fail_unless(b[4] == 0x80 && b[5] == 0x60);
+        fail_unless(((b[6] << 8) | b[7]) == seq);
+        fail_unless(read_uint32(b + 12) == 0x12345678);
+        fail_unless(b[4 + PA_RAOP_UDP_HEADER_SIZE] == i);
+    }
+
+    fail_unless(recv(control[1], b, sizeof(b), MSG_DONTWAIT) < 0);
+
+    /* Nothing waiting, and garbage, are both ignored */
+    fail_unless(pa_raop_udp_handle_control(control[0], buffer) == 0);
+    fail_unless(send(control[1], "junk", 4, 0) == 4);
+    fail_unless(pa_raop_udp_handle_control(control[0], buffer) == 0);
+
+    pa_raop_packet_buffer_free(buffer);
+
+    /* Timing */
+    memset(b, 0, 32);
+    b[0] = 0x80;
+    b[1] = 0xD2;
+    b[3] = 7;
+    for (i = 24; i < 32; i++)
+        b[i] = (uint8_t) i;
+    fail_unless(send(timing[1], b, 32, 0) == 32);
+    fail_unless(pa_raop_udp_handle_timing(timing[0]) == 1);
+
+    fail_unless(recv(timing[1], b, sizeof(b), 0) == 32);
+    fail_unless(b[0] == 0x80 && b[1] == 0xD3);
+    for (i = 0; i < 8; i++)
+        fail_unless(b[8 + i] == 24 + i);
+    fail_unless(memcmp(b + 16, b + 24, 8) == 0);
+    fail_unless(read_uint32(b + 16) != 0);
+
+    fail_unless(pa_raop_udp_handle_timing(timing[0]) == 0);
+    fail_unless(send(timing[1], "junk", 4, 0) == 4);
+    fail_unless(pa_raop_udp_handle_timing(timing[0]) == 0);
+
+    for (i = 0; i < 2; i++) {
+        pa_close(control[i]);
+        pa_close(timing[i]);
+    }
+
+    pa_mempool_free(pool);
+}
+END_TEST
+
+START_TEST (transport_test) {
+    uint16_t port = 0;
+    const char *transport = "RTP/AVP/UDP;unicast;mode=record;server_port=6000;control_port=6001;timing_port=6002";
+
+    fail_unless(pa_raop_udp_parse_transport_port(transport, "server_port", &port) == 0);
+    fail_unless(port == 6000);
+    fail_unless(pa_raop_udp_parse_transport_port(transport, "control_port", &port) == 0);
+    fail_unless(port == 6001);
+    fail_unless(pa_raop_udp_parse_transport_port(transport, "timing_port", &port) == 0);
+    fail_unless(port == 6002);
+
+    /* Only whole names count, and only valid ports */
+    port = 0;
+    fail_unless(pa_raop_udp_parse_transport_port(transport, "port", &port) < 0);
+    fail_unless(pa_raop_udp_parse_transport_port(transport, "control", &port) < 0);
+    fail_unless(pa_raop_udp_parse_transport_port(transport, "mode_port", &port) < 0);
+    fail_unless(pa_raop_udp_parse_transport_port("control_port=0", "control_port", &port) < 0);
+    fail_unless(pa_raop_udp_parse_transport_port("control_port=65536", "control_port", &port) < 0);
+    fail_unless(pa_raop_udp_parse_transport_port("control_port=", "control_port", &port) < 0);
+    fail_unless(pa_raop_udp_parse_transport_port("control_port=12ab", "control_port", &port) < 0);
+    fail_unless(pa_raop_udp_parse_transport_port("", "control_port", &port) < 0);
+    fail_unless(port == 0);
+
+    /* A bad one doesn't hide a good one further on */
+    fail_unless(pa_raop_udp_parse_transport_port("timing_port=x;timing_port=65535", "timing_port", &port) == 0);
+    fail_unless(port == 65535);
+}
+END_TEST
+
+START_TEST (pacer_test) {
+    static const pa_sample_spec ss = {
+        .format = PA_SAMPLE_S16NE,
+        .rate = 44100,
+        .channels = 2
+    };
+    const int64_t packet = PA_RAOP_UDP_FRAMES_PER_PACKET * 4;
+    const pa_usec_t packet_usec = PA_RAOP_UDP_FRAMES_PER_PACKET * PA_USEC_PER_SEC / 44100;
+    pa_raop_udp_pacer *p;
+    pa_usec_t now = 1000 * PA_USEC_PER_SEC;
+    int64_t offset = 10 * packet;
+    pa_bool_t first;
+    unsigned i, syncs;
+
+    p = pa_raop_udp_pacer_new(&ss, 200 * PA_USEC_PER_MSEC, PA_USEC_PER_SEC);
+
+    /* The first packet goes right away, with the first sync */
+    fail_unless(pa_raop_udp_pacer_due(p, now, offset) == now);
+    fail_unless(pa_raop_udp_pacer_sync(p, now, &first));
+    fail_unless(first);
+    offset += packet;
+
+    /* The next ones at the rate they are played, with a sync a
+     * second */
+    fail_unless(pa_raop_udp_pacer_due(p, now, offset) == now + packet_usec);
+    fail_unless(!pa_raop_udp_pacer_sync(p, now, &first));
+
+    for (i = 0, syncs = 0; i < 260; i++) {
+        now = pa_raop_udp_pacer_due(p, now, offset);
+
+        if (pa_raop_udp_pacer_sync(p, now, &first)) {
+            fail_unless(!first);
+            syncs++;
+        }
+
+        offset += packet;
+    }
+
+    /* The last of them goes 2.075 s after the first */
+    fail_unless(syncs == 2);
+
+    /* Being a bit late is caught up with... */
+    now = pa_raop_udp_pacer_due(p, now, offset) + 100 * PA_USEC_PER_MSEC;
+    fail_unless(pa_raop_udp_pacer_due(p, now, offset) < now);
+
+    /* ...but not falling behind for good, which starts over from the
+     * packet at hand, without the first sync */
+    now += 200 * PA_USEC_PER_MSEC;
+    fail_unless(pa_raop_udp_pacer_due(p, now, offset) == now);
+    fail_unless(pa_raop_udp_pacer_sync(p, now, &first));
+    fail_unless(!first);
+    offset += packet;
+    fail_unless(pa_raop_udp_pacer_due(p, now, offset) == now + packet_usec);
+
+    /* After a reset it does, e.g. after a flush */
+    pa_raop_udp_pacer_reset(p);
+    now += 5 * PA_USEC_PER_SEC;
+    offset += 100 * packet;
+    fail_unless(pa_raop_udp_pacer_due(p, now, offset) == now);
+    fail_unless(pa_raop_udp_pacer_sync(p, now, &first));
+    fail_unless(first);
+
+    pa_raop_udp_pacer_free(p);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("RAOP");
+    tc = tcase_create("raop");
+    tcase_add_test(tc, encode_test);
+    tcase_add_test(tc, throughput_test);
+    tcase_add_test(tc, udp_test);
+    tcase_add_test(tc, transport_test);
+    tcase_add_test(tc, pacer_test);
+    tcase_set_timeout(tc, 60);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
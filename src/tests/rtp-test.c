@@ -0,0 +1,310 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <check.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/arpa-inet.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/memblockq.h>
+#include <pulsecore/poll.h>
+
+#include "rtp.h"
+#include "sdp.h"
+
+#define PAYLOAD_SIZE 1280
+#define BURST 32
+#define N_PACKETS (BURST*2000)
+
+static const pa_sample_spec ss = {
+    .format = PA_SAMPLE_S16BE,
+    .rate = 44100,
+    .channels = 2
+};
+
+static int receive_socket(struct sockaddr_in *sa) {
+    socklen_t salen = sizeof(*sa);
+    int fd, one = 1, rcvbuf = 4*1024*1024;
+
+    fail_unless((fd = socket(AF_INET, SOCK_DGRAM, 0)) >= 0);
+
+#if defined(SO_TIMESTAMPNS)
+    fail_unless(setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one)) == 0);
+#elif defined(SO_TIMESTAMP)
+    fail_unless(setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, &one, sizeof(one)) == 0);
+#endif
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    memset(sa, 0, sizeof(*sa));
+    sa->sin_family = AF_INET;
+    sa->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sa->sin_port = 0;
+
+    fail_unless(bind(fd, (struct sockaddr*) sa, salen) == 0);
+    fail_unless(getsockname(fd, (struct sockaddr*) sa, &salen) == 0);
+
+    return fd;
+}
+
+/* Sends and receives over loopback in bursts, like a sender with a
+ * large MTU and a receiver with many sessions would see them */
+START_TEST (loopback_test) {
+    pa_mempool *pool;
+    pa_memblockq *q;
+    pa_memchunk data;
+    pa_rtp_context sender, receiver;
+    struct sockaddr_in sa;
+    int rfd, sfd;
+    unsigned sent, received = 0, i;
+    uint16_t sequence;
+    uint32_t timestamp;
+    uint8_t *d;
+    clock_t start;
+    double cpu;
+
+    pool = pa_mempool_new(FALSE, 0);
+
+    rfd = receive_socket(&sa);
+    fail_unless((sfd = socket(AF_INET, SOCK_DGRAM, 0)) >= 0);
+    fail_unless(connect(sfd, (struct sockaddr*) &sa, sizeof(sa)) == 0);
+
+    pa_rtp_context_init_send(&sender, sfd, 4711, pa_rtp_payload_from_sample_spec(&ss), pa_frame_size(&ss));
+    pa_rtp_context_init_recv(&receiver, rfd, pa_frame_size(&ss));
+
+    sequence = sender.sequence;
+    timestamp = sender.timestamp;
+
+    q = pa_memblockq_new("rtp-test memblockq", 0, 4*1024*1024, 0, &ss, 0, 0, 0, NULL);
+
+    /* Each packet of a burst is filled with its number */
+    data.memblock = pa_memblock_new(pool, PAYLOAD_SIZE * BURST);
+    data.index = 0;
+    data.length = PAYLOAD_SIZE * BURST;
+
+    d = pa_memblock_acquire(data.memblock);
+    for (i = 0; i < BURST; i++)
+        memset(d + i * PAYLOAD_SIZE, (int) i, PAYLOAD_SIZE);
+    pa_memblock_release(data.memblock);
+
+    start = clock();
+
+    for (sent = 0; sent < N_PACKETS; sent += BURST) {
+
+        fail_unless(pa_memblockq_push(q, &data) == 0);
+        fail_unless(pa_rtp_send(&sender, PAYLOAD_SIZE, q) == 0);
+        fail_unless(pa_memblockq_get_length(q) == 0);
+
+        while (received < sent + BURST) {
+            pa_memchunk chunk;
+            struct timeval tstamp;
+            struct pollfd p;
+            int r;
+
+            fail_unless((r = pa_rtp_recv(&receiver, &chunk, pool, &tstamp)) >= 0);
+
+            if (r == 0) {
+                /* Loopback packets might not have arrived yet */
+                p.fd = rfd;
+                p.events = POLLIN;
+                p.revents = 0;
+                fail_unless(pa_poll(&p, 1, 1000) == 1);
+                continue;
+            }
+
+            fail_unless(receiver.ssrc == 4711);
+            fail_unless(receiver.sequence == (uint16_t) (sequence + received));
+            fail_unless(receiver.timestamp == timestamp + received * (PAYLOAD_SIZE / pa_frame_size(&ss)));
+            fail_unless(tstamp.tv_sec != 0);
+            fail_unless(chunk.length == PAYLOAD_SIZE);
+            fail_unless(receiver.salen == sizeof(struct sockaddr_in));
+            fail_unless(((struct sockaddr_in*) &receiver.sa)->sin_addr.s_addr == htonl(INADDR_LOOPBACK));
+
+            d = (uint8_t*) pa_memblock_acquire(chunk.memblock) + chunk.index;
+            fail_unless(d[0] == received % BURST);
+            fail_unless(d[PAYLOAD_SIZE - 1] == received % BURST);
+            pa_memblock_release(chunk.memblock);
+
+            pa_memblock_unref(chunk.memblock);
+            received++;
+        }
+    }
+
+    cpu = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+    pa_log_info("%u packets of %u bytes sent and received in %0.3f s of CPU time, %0.0f packets/s per core",
+                N_PACKETS, PAYLOAD_SIZE, cpu, cpu > 0 ? N_PACKETS / cpu : 0.0);
+
+    pa_memblock_unref(data.memblock);
+    pa_memblockq_free(q);
+
+    pa_rtp_context_destroy(&sender);
+    pa_rtp_context_destroy(&receiver);
+
+    pa_mempool_free(pool);
+}
+END_TEST
+
+static void check_sdp(const char *t, uint8_t payload, pa_encoding_t encoding, const pa_sample_spec *expected) {
+    pa_sdp_info info;
+
+    pa_log_debug("Parsing:\n%s", t);
+
+    fail_unless(pa_sdp_parse(t, &info, 0) != NULL);
+    fail_unless(info.payload == payload);
+    fail_unless(info.encoding == encoding);
+    fail_unless(pa_sample_spec_equal(&info.sample_spec, expected));
+    fail_unless(((struct sockaddr_in*) &info.sa)->sin_port == htons(46000));
+
+    /* All of them come from the same sender */
+    fail_unless(info.origin_salen == sizeof(struct sockaddr_in));
+    fail_unless(((struct sockaddr_in*) &info.origin_sa)->sin_addr.s_addr == htonl(0xC0A80001));
+
+    pa_sdp_info_destroy(&info);
+}
+
+START_TEST (sdp_test) {
+    const pa_sample_spec l24 = { PA_SAMPLE_S24BE, 48000, 2 };
+    const pa_sample_spec opus = { PA_SAMPLE_S16NE, 48000, 1 };
+    const pa_sample_spec l24_mono = { PA_SAMPLE_S24BE, 96000, 1 };
+    pa_sample_spec ss2 = { PA_SAMPLE_FLOAT32NE, 96000, 2 };
+    pa_sdp_info info;
+    struct in_addr src, dst;
+    char *t;
+
+    fail_unless(inet_pton(AF_INET, "192.168.0.1", &src) > 0);
+    fail_unless(inet_pton(AF_INET, "224.0.0.56", &dst) > 0);
+
+    fail_unless(pa_rtp_sample_spec_valid(&l24));
+    fail_unless(pa_rtp_payload_from_sample_spec(&l24) == 127);
+
+    t = pa_sdp_build(AF_INET, &src, &dst, "L24 test", 46000, 127, PA_ENCODING_PCM, &l24);
+    fail_unless(strstr(t, "a=rtpmap:127 L24/48000/2\n") != NULL);
+    check_sdp(t, 127, PA_ENCODING_PCM, &l24);
+    pa_xfree(t);
+
+    t = pa_sdp_build(AF_INET, &src, &dst, "Opus test", 46000, 127, PA_ENCODING_OPUS, &opus);
+    fail_unless(strstr(t, "a=rtpmap:127 opus/48000/2\n") != NULL);
+    check_sdp(t, 127, PA_ENCODING_OPUS, &opus);
+    pa_xfree(t);
+
+    /* From other senders: the channel count may be left out, and the
+     * rtpmap may be the last line */
+    check_sdp("v=0\n"
+              "o=- 1 0 IN IP4 192.168.0.1\n"
+              "s=Other\n"
+              "c=IN IP4 224.0.0.56\n"
+              "t=1 0\n"
+              "m=audio 46000 RTP/AVP 97\n"
+              "a=rtpmap:97 L24/96000\n",
+              97, PA_ENCODING_PCM, &l24_mono);
+
+    /* An origin that is a host name can't be matched against the
+     * packets */
+    fail_unless(pa_sdp_parse("v=0\n"
+                             "o=- 1 0 IN IP4 sender.example.com\n"
+                             "s=Other\n"
+                             "c=IN IP4 224.0.0.56\n"
+                             "m=audio 46000 RTP/AVP 10\n", &info, 0) != NULL);
+    fail_unless(info.origin_salen == 0);
+    pa_sdp_info_destroy(&info);
+
+    /* Formats RTP can't carry are sent as L16, even if they have more
+     * resolution; L24 is only sent when asked for */
+    pa_rtp_sample_spec_fixup(&ss2);
+    fail_unless(ss2.format == PA_SAMPLE_S16BE);
+}
+END_TEST
+
+START_TEST (rtcp_test) {
+    pa_rtp_context sender;
+    struct timeval when, parsed_when;
+    uint8_t buf[1500];
+    uint32_t ssrc, timestamp;
+    ssize_t r;
+    int fds[2];
+
+    fail_unless(socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) == 0);
+
+    pa_rtp_context_init_send(&sender, fds[0], 4711, pa_rtp_payload_from_sample_spec(&ss), pa_frame_size(&ss));
+
+    when.tv_sec = 1234567890;
+    when.tv_usec = 250000;
+
+    fail_unless(pa_rtcp_send_sender_report(&sender, fds[0], &when, 815, "user@host") == 0);
+    fail_unless((r = recv(fds[1], buf, sizeof(buf), 0)) > 0);
+
+    /* A sender report and the CNAME, padded to 32 bits */
+    fail_unless(r == 28 + 20);
+    fail_unless(buf[1] == 200);
+    fail_unless(buf[29] == 202);
+    fail_unless(memcmp(buf + 38, "user@host", 9) == 0);
+
+    fail_unless(pa_rtcp_parse_sender_report(buf, (size_t) r, &ssrc, &parsed_when, &timestamp) == 0);
+    fail_unless(ssrc == 4711);
+    fail_unless(timestamp == 815);
+    fail_unless(parsed_when.tv_sec == when.tv_sec);
+    fail_unless(parsed_when.tv_usec >= when.tv_usec - 1 && parsed_when.tv_usec <= when.tv_usec);
+
+    /* Truncated packets are refused */
+    fail_unless(pa_rtcp_parse_sender_report(buf, 20, &ssrc, &parsed_when, &timestamp) < 0);
+
+    pa_rtp_context_destroy(&sender);
+    pa_close(fds[1]);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("RTP");
+    tc = tcase_create("rtp");
+    tcase_add_test(tc, loopback_test);
+    tcase_add_test(tc, sdp_test);
+    tcase_add_test(tc, rtcp_test);
+    tcase_set_timeout(tc, 60);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -24,6 +24,8 @@
 #include <check.h>
 #include <signal.h>
 
+#include <pulsecore/asyncmsgq.h>
+#include <pulsecore/msgobject.h>
 #include <pulsecore/poll.h>
 #include <pulsecore/log.h>
 #include <pulsecore/rtpoll.h>
@@ -84,6 +86,63 @@ START_TEST (rtpoll_test) {
 }
 END_TEST
 
+static pa_rtpoll *batch_rtpoll;
+static unsigned n_dispatched;
+
+/* Message 1 wants the loop to run before the next one is dispatched */
+static int batch_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    n_dispatched++;
+
+    if (code == 1)
+        pa_rtpoll_yield(batch_rtpoll);
+
+    return 0;
+}
+
+START_TEST (asyncmsgq_batch_test) {
+    pa_asyncmsgq *q;
+    pa_rtpoll_item *i;
+    pa_msgobject *o;
+    unsigned k;
+
+    batch_rtpoll = pa_rtpoll_new();
+    fail_unless((q = pa_asyncmsgq_new(0)) != NULL);
+    i = pa_rtpoll_item_new_asyncmsgq_read(batch_rtpoll, PA_RTPOLL_EARLY, q);
+
+    o = pa_msgobject_new(pa_msgobject);
+    o->process_msg = batch_process_msg;
+
+    /* What is queued is dispatched in one iteration... */
+    for (k = 0; k < 3; k++)
+        pa_asyncmsgq_post(q, o, 0, NULL, 0, NULL, NULL);
+    pa_asyncmsgq_post(q, o, 1, NULL, 0, NULL, NULL);
+    pa_asyncmsgq_post(q, o, 0, NULL, 0, NULL, NULL);
+
+    n_dispatched = 0;
+    fail_unless(pa_rtpoll_run(batch_rtpoll, FALSE) > 0);
+    fail_unless(n_dispatched == 4);
+
+    /* ...up to the one that yields */
+    fail_unless(pa_rtpoll_run(batch_rtpoll, FALSE) > 0);
+    fail_unless(n_dispatched == 5);
+
+    /* A flood is cut into batches */
+    for (k = 0; k < 40; k++)
+        pa_asyncmsgq_post(q, o, 0, NULL, 0, NULL, NULL);
+
+    n_dispatched = 0;
+    fail_unless(pa_rtpoll_run(batch_rtpoll, FALSE) > 0);
+    fail_unless(n_dispatched == 32);
+    fail_unless(pa_rtpoll_run(batch_rtpoll, FALSE) > 0);
+    fail_unless(n_dispatched == 40);
+
+    pa_rtpoll_item_free(i);
+    pa_msgobject_unref(o);
+    pa_asyncmsgq_unref(q);
+    pa_rtpoll_free(batch_rtpoll);
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -93,6 +152,7 @@ int main(int argc, char *argv[]) {
     s = suite_create("RT Poll");
     tc = tcase_create("rtpoll");
     tcase_add_test(tc, rtpoll_test);
+    tcase_add_test(tc, asyncmsgq_batch_test);
     /* the default timeout is too small,
      * set it to a reasonable large one.
      */
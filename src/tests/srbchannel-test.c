@@ -0,0 +1,441 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/creds.h>
+#include <pulsecore/iochannel.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/packet.h>
+#include <pulsecore/pstream.h>
+#include <pulsecore/pstream-worker.h>
+#include <pulsecore/socket.h>
+#include <pulsecore/srbchannel.h>
+
+#define N_PACKETS 500
+#define TOTAL_BYTES (1024*1024)
+
+static pa_srbchannel *dup_srbchannel(pa_mainloop_api *api, pa_srbchannel *srb) {
+    int fds[PA_SRBCHANNEL_N_FDS];
+    unsigned k;
+
+    pa_srbchannel_get_fds(srb, fds);
+
+    for (k = 0; k < PA_SRBCHANNEL_N_FDS; k++)
+        fail_unless((fds[k] = dup(fds[k])) >= 0);
+
+    return pa_srbchannel_new_from_fds(api, fds);
+}
+
+static size_t n_written, n_read;
+static pa_bool_t corrupt;
+
+static void reader_cb(pa_srbchannel *srb, void *userdata) {
+    uint8_t buf[5000];
+    ssize_t r;
+    size_t k;
+
+    while ((r = pa_srbchannel_read(srb, buf, sizeof(buf))) > 0) {
+        for (k = 0; k < (size_t) r; k++)
+            if (buf[k] != (uint8_t) ((n_read + k) % 251))
+                corrupt = TRUE;
+
+        n_read += (size_t) r;
+    }
+
+    fail_unless(r == 0);
+}
+
+static void writer_cb(pa_srbchannel *srb, void *userdata) {
+    uint8_t buf[3000];
+    struct iovec iov[2];
+    ssize_t r;
+    size_t k;
+
+    do {
+        if (n_written >= TOTAL_BYTES)
+            return;
+
+        for (k = 0; k < sizeof(buf); k++)
+            buf[k] = (uint8_t) ((n_written + k) % 251);
+
+        /* Uneven pieces so that they wrap around at odd places */
+        iov[0].iov_base = buf;
+        iov[0].iov_len = 1000;
+        iov[1].iov_base = buf + 1000;
+        iov[1].iov_len = PA_MIN(sizeof(buf), TOTAL_BYTES - n_written) - 1000;
+
+        r = pa_srbchannel_writev(srb, iov, 2);
+        fail_unless(r >= 0);
+
+        n_written += (size_t) r;
+    } while (r > 0);
+}
+
+START_TEST (srbchannel_test) {
+    pa_mainloop *m;
+    pa_mainloop_api *api;
+    pa_srbchannel *a, *b;
+
+    if (!pa_srbchannel_supported())
+        return;
+
+    m = pa_mainloop_new();
+    api = pa_mainloop_get_api(m);
+
+    fail_unless((a = pa_srbchannel_new(api)) != NULL);
+    fail_unless((b = dup_srbchannel(api, a)) != NULL);
+
+    n_written = n_read = 0;
+    corrupt = FALSE;
+
+    pa_srbchannel_set_callback(a, writer_cb, NULL);
+    pa_srbchannel_set_callback(b, reader_cb, NULL);
+
+    /* Fills the ring, the rest is written whenever the reader made
+     * room */
+    writer_cb(a, NULL);
+    fail_unless(n_written < TOTAL_BYTES);
+
+    while (n_read < TOTAL_BYTES)
+        pa_mainloop_iterate(m, TRUE, NULL);
+
+    fail_unless(n_written == TOTAL_BYTES);
+    fail_unless(!corrupt);
+
+    pa_srbchannel_free(a);
+    pa_srbchannel_free(b);
+    pa_mainloop_free(m);
+}
+END_TEST
+
+START_TEST (srbchannel_corrupt_test) {
+    pa_mainloop *m;
+    pa_mainloop_api *api;
+    pa_srbchannel *a;
+    int fds[PA_SRBCHANNEL_N_FDS];
+    uint8_t buf[16];
+    uint32_t *shared;
+    struct iovec iov;
+
+    if (!pa_srbchannel_supported())
+        return;
+
+    m = pa_mainloop_new();
+    api = pa_mainloop_get_api(m);
+
+    fail_unless((a = pa_srbchannel_new(api)) != NULL);
+    pa_srbchannel_get_fds(a, fds);
+
+    /* Pretend to be a peer that scribbles over the indexes */
+    shared = mmap(NULL, 4096, PROT_READ|PROT_WRITE, MAP_SHARED, fds[0], 0);
+    fail_unless(shared != MAP_FAILED);
+
+    memset(buf, 0, sizeof(buf));
+    iov.iov_base = buf;
+    iov.iov_len = sizeof(buf);
+
+    fail_unless(pa_srbchannel_writev(a, &iov, 1) == sizeof(buf));
+
+    /* The read index of our ring and the write index of the peer's,
+     * which claim that more is in them than fits */
+    shared[4] = shared[5] = 0x80000000U;
+
+    fail_unless(pa_srbchannel_writev(a, &iov, 1) < 0);
+    fail_unless(pa_srbchannel_read(a, buf, sizeof(buf)) < 0);
+
+    munmap(shared, 4096);
+
+    pa_srbchannel_free(a);
+    pa_mainloop_free(m);
+}
+END_TEST
+
+static unsigned n_received[2], n_fds;
+static pa_bool_t out_of_order;
+
+static void packet_cb(pa_pstream *p, pa_packet *packet, const pa_cmsg_ancil_data *ancil_data, void *userdata) {
+    unsigned *n = userdata;
+    uint32_t seq;
+
+    fail_unless(packet->length >= sizeof(seq));
+    memcpy(&seq, packet->data, sizeof(seq));
+
+    if (seq != *n)
+        out_of_order = TRUE;
+
+    (*n)++;
+
+#ifdef HAVE_CREDS
+    if (ancil_data && ancil_data->nfd > 0) {
+        struct stat st;
+
+        fail_unless(ancil_data->nfd == 1);
+        fail_unless(fstat(ancil_data->fds[0], &st) == 0);
+        n_fds++;
+    }
+#endif
+}
+
+static void send_packets(pa_pstream *p, unsigned first, unsigned n) {
+    unsigned i;
+
+    for (i = first; i < first + n; i++) {
+        pa_packet *packet;
+        uint32_t seq = i;
+
+        /* Some of them larger than the ring */
+        packet = pa_packet_new(i % 50 == 0 ? 100000 : sizeof(seq) + i % 1000);
+        memset(packet->data, 0, packet->length);
+        memcpy(packet->data, &seq, sizeof(seq));
+
+        pa_pstream_send_packet(p, packet, NULL);
+        pa_packet_unref(packet);
+    }
+}
+
+static void run_pstream_test(pa_bool_t threaded) {
+    pa_mainloop *m;
+    pa_mainloop_api *api;
+    pa_mempool *pool;
+    pa_pstream_worker *w1 = NULL, *w2 = NULL;
+    pa_srbchannel *srb_a, *srb_b;
+    pa_pstream *a, *b;
+    const pa_pstream_stat *stat = pa_pstream_get_stat();
+    unsigned write_calls;
+    int fds[2];
+
+    if (!pa_srbchannel_supported())
+        return;
+
+    fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+    m = pa_mainloop_new();
+    api = pa_mainloop_get_api(m);
+    pool = pa_mempool_new(FALSE, 0);
+
+    if (threaded) {
+        fail_unless((w1 = pa_pstream_worker_new(api, "worker-1")) != NULL);
+        fail_unless((w2 = pa_pstream_worker_new(api, "worker-2")) != NULL);
+
+        a = pa_pstream_new_threaded(api, pa_iochannel_new(api, fds[0], fds[0]), pool, pa_pstream_worker_get_thread(w1));
+        b = pa_pstream_new_threaded(api, pa_iochannel_new(api, fds[1], fds[1]), pool, pa_pstream_worker_get_thread(w2));
+    } else {
+        a = pa_pstream_new(api, pa_iochannel_new(api, fds[0], fds[0]), pool);
+        b = pa_pstream_new(api, pa_iochannel_new(api, fds[1], fds[1]), pool);
+    }
+
+    n_received[0] = n_received[1] = n_fds = 0;
+    out_of_order = FALSE;
+
+    pa_pstream_set_receive_packet_callback(a, packet_cb, &n_received[0]);
+    pa_pstream_set_receive_packet_callback(b, packet_cb, &n_received[1]);
+
+#ifdef HAVE_CREDS
+    {
+        pa_cmsg_ancil_data ancil;
+        pa_packet *packet;
+        uint32_t seq = 0;
+
+        /* A file descriptor passed along with a packet, in between
+         * others that are batched up with it */
+        send_packets(a, 0, 10);
+
+        pa_zero(ancil);
+        ancil.nfd = 1;
+        ancil.fds[0] = fds[0];
+
+        seq = 10;
+        packet = pa_packet_new(sizeof(seq));
+        memcpy(packet->data, &seq, sizeof(seq));
+        pa_pstream_send_packet(a, packet, &ancil);
+        pa_packet_unref(packet);
+
+        send_packets(a, 11, 9);
+
+        while (n_received[1] < 20)
+            pa_mainloop_iterate(m, TRUE, NULL);
+
+        fail_unless(n_fds == 1);
+    }
+#else
+    send_packets(a, 0, 20);
+#endif
+
+    fail_unless((srb_a = pa_srbchannel_new(api)) != NULL);
+    fail_unless((srb_b = dup_srbchannel(api, srb_a)) != NULL);
+
+    /* b learns about the ring before a switches, as with the offer
+     * in the native protocol */
+    pa_pstream_expect_srbchannel(b, TRUE);
+
+    /* Packets queued before the switch have to arrive in order with
+     * the ones after it */
+    send_packets(a, 20, N_PACKETS / 2);
+    pa_pstream_set_srbchannel(a, srb_a);
+    send_packets(a, 20 + N_PACKETS / 2, N_PACKETS / 2);
+
+    pa_pstream_set_srbchannel(b, srb_b);
+    send_packets(b, 0, N_PACKETS);
+
+    while (n_received[1] < 20 + N_PACKETS || n_received[0] < N_PACKETS || pa_pstream_is_pending(a) || pa_pstream_is_pending(b))
+        pa_mainloop_iterate(m, TRUE, NULL);
+
+    fail_unless(!out_of_order);
+
+    /* Now the socket isn't used anymore */
+    write_calls = pa_atomic_load(&stat->n_write_calls);
+    send_packets(a, 20 + N_PACKETS, N_PACKETS);
+    send_packets(b, N_PACKETS, N_PACKETS);
+
+    while (n_received[1] < 20 + 2 * N_PACKETS || n_received[0] < 2 * N_PACKETS)
+        pa_mainloop_iterate(m, TRUE, NULL);
+
+    fail_unless(!out_of_order);
+    fail_unless((unsigned) pa_atomic_load(&stat->n_write_calls) == write_calls);
+
+    pa_pstream_unlink(a);
+    pa_pstream_unref(a);
+    pa_pstream_unlink(b);
+    pa_pstream_unref(b);
+
+    if (threaded) {
+        pa_pstream_worker_free(w1);
+        pa_pstream_worker_free(w2);
+    }
+
+    pa_mempool_free(pool);
+    pa_mainloop_free(m);
+}
+
+START_TEST (srbchannel_pstream_test) {
+    run_pstream_test(FALSE);
+}
+END_TEST
+
+START_TEST (srbchannel_pstream_worker_test) {
+    run_pstream_test(TRUE);
+}
+END_TEST
+
+static void die_cb(pa_pstream *p, void *userdata) {
+    pa_bool_t *died = userdata;
+
+    *died = TRUE;
+}
+
+/* A switch frame that wasn't asked for is a protocol error */
+static void run_unexpected_switch_test(pa_bool_t threaded) {
+    pa_mainloop *m;
+    pa_mainloop_api *api;
+    pa_mempool *pool;
+    pa_pstream_worker *w1 = NULL, *w2 = NULL;
+    pa_srbchannel *srb;
+    pa_pstream *a, *b;
+    pa_bool_t died = FALSE;
+    int fds[2];
+
+    if (!pa_srbchannel_supported())
+        return;
+
+    fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+    m = pa_mainloop_new();
+    api = pa_mainloop_get_api(m);
+    pool = pa_mempool_new(FALSE, 0);
+
+    if (threaded) {
+        fail_unless((w1 = pa_pstream_worker_new(api, "worker-1")) != NULL);
+        fail_unless((w2 = pa_pstream_worker_new(api, "worker-2")) != NULL);
+
+        a = pa_pstream_new_threaded(api, pa_iochannel_new(api, fds[0], fds[0]), pool, pa_pstream_worker_get_thread(w1));
+        b = pa_pstream_new_threaded(api, pa_iochannel_new(api, fds[1], fds[1]), pool, pa_pstream_worker_get_thread(w2));
+    } else {
+        a = pa_pstream_new(api, pa_iochannel_new(api, fds[0], fds[0]), pool);
+        b = pa_pstream_new(api, pa_iochannel_new(api, fds[1], fds[1]), pool);
+    }
+
+    pa_pstream_set_die_callback(b, die_cb, &died);
+
+    fail_unless((srb = pa_srbchannel_new(api)) != NULL);
+    pa_pstream_set_srbchannel(a, srb);
+
+    while (!died)
+        pa_mainloop_iterate(m, TRUE, NULL);
+
+    pa_pstream_unlink(a);
+    pa_pstream_unref(a);
+    pa_pstream_unlink(b);
+    pa_pstream_unref(b);
+
+    if (threaded) {
+        pa_pstream_worker_free(w1);
+        pa_pstream_worker_free(w2);
+    }
+
+    pa_mempool_free(pool);
+    pa_mainloop_free(m);
+}
+
+START_TEST (srbchannel_unexpected_switch_test) {
+    run_unexpected_switch_test(FALSE);
+    run_unexpected_switch_test(TRUE);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Shared Ring Buffer Channel");
+    tc = tcase_create("srbchannel");
+    tcase_add_test(tc, srbchannel_test);
+    tcase_add_test(tc, srbchannel_corrupt_test);
+    tcase_add_test(tc, srbchannel_pstream_test);
+    tcase_add_test(tc, srbchannel_pstream_worker_test);
+    tcase_add_test(tc, srbchannel_unexpected_switch_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,335 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <check.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/tagstruct.h>
+#include <pulsecore/packet.h>
+#include <pulsecore/native-common.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+/* Something like what a media player puts into its streams */
+static pa_proplist *make_proplist(void) {
+    pa_proplist *p;
+
+    p = pa_proplist_new();
+    pa_proplist_sets(p, PA_PROP_MEDIA_NAME, "Symphony No. 9 in D minor, Op. 125 - IV. Presto");
+    pa_proplist_sets(p, PA_PROP_MEDIA_ROLE, "music");
+    pa_proplist_sets(p, PA_PROP_APPLICATION_NAME, "Some Music Player");
+    pa_proplist_sets(p, PA_PROP_APPLICATION_ID, "org.example.Player");
+    pa_proplist_sets(p, PA_PROP_APPLICATION_ICON_NAME, "multimedia-player");
+    pa_proplist_sets(p, PA_PROP_APPLICATION_PROCESS_ID, "4711");
+    pa_proplist_sets(p, PA_PROP_APPLICATION_PROCESS_BINARY, "player");
+    pa_proplist_sets(p, PA_PROP_APPLICATION_PROCESS_USER, "lennart");
+    pa_proplist_sets(p, PA_PROP_APPLICATION_PROCESS_HOST, "localhost");
+    pa_proplist_sets(p, PA_PROP_APPLICATION_LANGUAGE, "de_DE.UTF-8");
+    pa_proplist_sets(p, "module-stream-restore.id", "sink-input-by-application-id:org.example.Player");
+
+    return p;
+}
+
+/* The same as protocol-native does for a sink input of a client with
+ * the current protocol version */
+static void put_sink_input_info(pa_tagstruct *t, pa_proplist *p, pa_format_info *f) {
+    pa_sample_spec ss;
+    pa_channel_map map;
+    pa_cvolume v;
+
+    ss.format = PA_SAMPLE_FLOAT32LE;
+    ss.rate = 44100;
+    ss.channels = 2;
+    pa_channel_map_init_stereo(&map);
+    pa_cvolume_set(&v, 2, PA_VOLUME_NORM / 2);
+
+    pa_tagstruct_putu32(t, PA_COMMAND_REPLY);
+    pa_tagstruct_putu32(t, 4711);
+    pa_tagstruct_putu32(t, 17);
+    pa_tagstruct_puts(t, pa_proplist_gets(p, PA_PROP_MEDIA_NAME));
+    pa_tagstruct_putu32(t, PA_INVALID_INDEX);
+    pa_tagstruct_putu32(t, 3);
+    pa_tagstruct_putu32(t, 0);
+    pa_tagstruct_put_sample_spec(t, &ss);
+    pa_tagstruct_put_channel_map(t, &map);
+    pa_tagstruct_put_cvolume(t, &v);
+    pa_tagstruct_put_usec(t, 23220);
+    pa_tagstruct_put_usec(t, 40000);
+    pa_tagstruct_puts(t, "speex-float-1");
+    pa_tagstruct_puts(t, "protocol-native.c");
+    pa_tagstruct_put_boolean(t, FALSE);
+    pa_tagstruct_put_proplist(t, p);
+    pa_tagstruct_put_boolean(t, FALSE);
+    pa_tagstruct_put_boolean(t, TRUE);
+    pa_tagstruct_put_boolean(t, TRUE);
+    pa_tagstruct_put_format_info(t, f);
+    pa_tagstruct_put_usec(t, 12);
+    pa_tagstruct_put_usec(t, 80);
+    pa_tagstruct_put_usec(t, 3);
+    pa_tagstruct_put_usec(t, 20);
+    pa_tagstruct_put_usec(t, 7);
+    pa_tagstruct_put_usec(t, 40);
+}
+
+/* What pa_tagstruct_put_proplist() used to do after the tag */
+static void put_proplist_by_key(pa_tagstruct *t, pa_proplist *p) {
+    void *state = NULL;
+    const char *k;
+
+    while ((k = pa_proplist_iterate(p, &state))) {
+        const void *v;
+        size_t l;
+
+        pa_assert_se(pa_proplist_get(p, k, &v, &l) >= 0);
+        pa_tagstruct_puts(t, k);
+        pa_tagstruct_putu32(t, (uint32_t) l);
+        pa_tagstruct_put_arbitrary(t, v, l);
+    }
+
+    pa_tagstruct_puts(t, NULL);
+}
+
+START_TEST (proplist_test) {
+    pa_proplist *p, *q;
+    pa_tagstruct *t, *r;
+    const uint8_t *d, *e;
+    size_t l, m;
+
+    p = make_proplist();
+
+    t = pa_tagstruct_new(NULL, 0);
+    pa_tagstruct_put_proplist(t, p);
+    d = pa_tagstruct_data(t, &l);
+
+    /* Same layout as if it was written key by key */
+    r = pa_tagstruct_new(NULL, 0);
+    put_proplist_by_key(r, p);
+    e = pa_tagstruct_data(r, &m);
+    fail_unless(d[0] == PA_TAG_PROPLIST);
+    fail_unless(m == l - 1);
+    fail_unless(memcmp(d + 1, e, m) == 0);
+    pa_tagstruct_free(r);
+
+    r = pa_tagstruct_new(d, l);
+    q = pa_proplist_new();
+    fail_unless(pa_tagstruct_get_proplist(r, q) >= 0);
+    fail_unless(pa_tagstruct_eof(r));
+    fail_unless(pa_proplist_equal(p, q));
+    pa_tagstruct_free(r);
+
+    pa_proplist_free(q);
+    pa_tagstruct_free(t);
+    pa_proplist_free(p);
+}
+END_TEST
+
+START_TEST (buffer_test) {
+    uint8_t buffer[64];
+    pa_tagstruct *t, *r;
+    const uint8_t *d;
+    const char *s;
+    uint32_t u;
+    size_t l;
+    unsigned i;
+
+    /* Stays in the buffer as long as it fits */
+    t = pa_tagstruct_new_buffer(buffer, sizeof(buffer));
+    pa_tagstruct_putu32(t, 1);
+    pa_tagstruct_puts(t, "foo");
+    d = pa_tagstruct_data(t, &l);
+    fail_unless(d == buffer);
+    fail_unless(l == 5 + 5);
+    fail_unless(!pa_tagstruct_is_dynamic(t));
+
+    /* ... and moves out afterwards */
+    for (i = 0; i < 100; i++)
+        pa_tagstruct_putu32(t, i);
+
+    d = pa_tagstruct_data(t, &l);
+    fail_unless(d != buffer);
+    fail_unless(l == 5 + 5 + 100 * 5);
+    fail_unless(pa_tagstruct_is_dynamic(t));
+
+    r = pa_tagstruct_new(d, l);
+    fail_unless(pa_tagstruct_getu32(r, &u) >= 0 && u == 1);
+    fail_unless(pa_tagstruct_gets(r, &s) >= 0 && pa_streq(s, "foo"));
+
+    /* Strings are not copied */
+    fail_unless(s == (const char*) d + 6);
+
+    for (i = 0; i < 100; i++)
+        fail_unless(pa_tagstruct_getu32(r, &u) >= 0 && u == i);
+
+    fail_unless(pa_tagstruct_eof(r));
+    pa_tagstruct_free(r);
+    pa_tagstruct_free(t);
+
+    /* Reserving the room up front moves it out right away */
+    t = pa_tagstruct_new(NULL, 0);
+    pa_tagstruct_reserve(t, 1000);
+    d = pa_tagstruct_data(t, &l);
+    for (i = 0; i < 200; i++)
+        pa_tagstruct_putu32(t, i);
+    fail_unless(pa_tagstruct_data(t, &l) == d);
+    pa_tagstruct_free(t);
+}
+END_TEST
+
+START_TEST (packet_test) {
+    pa_packet *p;
+    pa_tagstruct *t;
+    const uint8_t *d;
+    size_t l;
+    unsigned i;
+
+    for (i = 0; i < 2; i++) {
+        uint8_t *data;
+
+        t = pa_tagstruct_new(NULL, 0);
+        pa_tagstruct_putu32(t, PA_COMMAND_REPLY);
+        pa_tagstruct_putu32(t, i);
+
+        d = pa_tagstruct_data(t, &l);
+        p = pa_packet_new_data(d, l);
+        fail_unless(p->length == l);
+        fail_unless(memcmp(p->data, d, l) == 0);
+        pa_packet_unref(p);
+
+        data = pa_tagstruct_free_data(t, &l);
+        fail_unless(l == 10);
+        pa_xfree(data);
+    }
+
+    p = pa_packet_new(100000);
+    fail_unless(p->length == 100000);
+    memset(p->data, 0, p->length);
+    pa_packet_unref(p);
+}
+END_TEST
+
+#define RUNS 1000000
+#define RUNS_MAKE_CHECK 10000
+
+static unsigned n_runs(void) {
+    return getenv("MAKE_CHECK") ? RUNS_MAKE_CHECK : RUNS;
+}
+
+START_TEST (sink_input_info_benchmark) {
+    pa_proplist *p;
+    pa_format_info *f;
+    pa_tagstruct *t;
+    pa_usec_t start, stop;
+    uint8_t buffer[2048];
+    const uint8_t *d;
+    size_t l, expected;
+    unsigned i, n;
+
+    p = make_proplist();
+    f = pa_format_info_new();
+    f->encoding = PA_ENCODING_PCM;
+    n = n_runs();
+
+    t = pa_tagstruct_new(NULL, 0);
+    put_sink_input_info(t, p, f);
+    pa_tagstruct_data(t, &expected);
+    pa_tagstruct_free(t);
+    fail_unless(expected <= sizeof(buffer));
+
+    start = pa_rtclock_now();
+    for (i = 0; i < n; i++) {
+        pa_packet *packet;
+        uint8_t *data;
+
+        t = pa_tagstruct_new(NULL, 0);
+        put_sink_input_info(t, p, f);
+        data = pa_tagstruct_free_data(t, &l);
+        packet = pa_packet_new_dynamic(data, l);
+        pa_packet_unref(packet);
+    }
+    stop = pa_rtclock_now();
+    pa_log_debug("%u GET_SINK_INPUT_INFO replies of %lu bytes into tagstructs: %llu usec",
+                 n, (unsigned long) expected, (unsigned long long) (stop - start));
+
+    start = pa_rtclock_now();
+    for (i = 0; i < n; i++) {
+        t = pa_tagstruct_new_buffer(buffer, sizeof(buffer));
+        put_sink_input_info(t, p, f);
+        d = pa_tagstruct_data(t, &l);
+        fail_unless(d == buffer && l == expected);
+        pa_tagstruct_free(t);
+    }
+    stop = pa_rtclock_now();
+    pa_log_debug("%u GET_SINK_INPUT_INFO replies into a buffer: %llu usec",
+                 n, (unsigned long long) (stop - start));
+
+    start = pa_rtclock_now();
+    for (i = 0; i < n; i++) {
+        pa_tagstruct *r;
+        uint32_t u;
+        const char *s;
+
+        r = pa_tagstruct_new(buffer, expected);
+        fail_unless(pa_tagstruct_getu32(r, &u) >= 0 && u == PA_COMMAND_REPLY);
+        fail_unless(pa_tagstruct_getu32(r, &u) >= 0 && u == 4711);
+        fail_unless(pa_tagstruct_getu32(r, &u) >= 0 && u == 17);
+        fail_unless(pa_tagstruct_gets(r, &s) >= 0 && s);
+        pa_tagstruct_free(r);
+    }
+    stop = pa_rtclock_now();
+    pa_log_debug("%u decoder setups: %llu usec", n, (unsigned long long) (stop - start));
+
+    pa_format_info_free(f);
+    pa_proplist_free(p);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Tagstruct");
+    tc = tcase_create("tagstruct");
+    tcase_add_test(tc, proplist_test);
+    tcase_add_test(tc, buffer_test);
+    tcase_add_test(tc, packet_test);
+    tcase_add_test(tc, sink_input_info_benchmark);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,97 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/trace.h>
+
+START_TEST (trace_test) {
+    char *json;
+    int64_t i;
+
+    /* Disabled by default, nothing is recorded */
+    fail_unless(pa_trace_get_size() == 0);
+    pa_trace_record(PA_TRACE_WRITE, 4711);
+    json = pa_trace_to_json();
+    fail_unless(strstr(json, "\"traceEvents\":[") != NULL);
+    fail_unless(strstr(json, "4711") == NULL);
+    pa_xfree(json);
+
+    /* Rounded up to a power of two */
+    pa_trace_set_size(3);
+    fail_unless(pa_trace_get_size() == 4);
+
+    pa_trace_record(PA_TRACE_RENDER_BEGIN, 1);
+    for (i = 2; i <= 6; i++)
+        pa_trace_record(PA_TRACE_WRITE, i);
+
+    json = pa_trace_to_json();
+    pa_log_debug("%s", json);
+
+    /* Only the three most recent events survive */
+    fail_unless(strstr(json, "\"name\":\"render\"") == NULL);
+    fail_unless(strstr(json, "\"arg\":3}") == NULL);
+    for (i = 4; i <= 6; i++) {
+        char t[32];
+
+        pa_snprintf(t, sizeof(t), "\"arg\":%lld}", (long long) i);
+        fail_unless(strstr(json, t) != NULL);
+    }
+
+    fail_unless(strstr(json, "\"ph\":\"M\"") != NULL);
+    fail_unless(strstr(json, "\"name\":\"write\",\"ph\":\"i\"") != NULL);
+    pa_xfree(json);
+
+    pa_trace_set_size(0);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Trace");
+    tc = tcase_create("trace");
+    tcase_add_test(tc, trace_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -291,6 +291,7 @@ static void get_sink_info_callback(pa_context *c, const pa_sink_info *i, int is_
              "\tBase Volume: %s%s%s\n"
              "\tMonitor Source: %s\n"
              "\tLatency: %0.0f usec, configured %0.0f usec\n"
+             "\tRender Cost: %0.0f usec average, %0.0f usec max\n"
              "\tFlags: %s%s%s%s%s%s%s\n"
              "\tProperties:\n\t\t%s\n"),
            i->index,
@@ -311,6 +312,7 @@ static void get_sink_info_callback(pa_context *c, const pa_sink_info *i, int is_
            i->flags & PA_SINK_DECIBEL_VOLUME ? pa_sw_volume_snprint_dB(vdb, sizeof(vdb), i->base_volume) : "",
            pa_strnull(i->monitor_source_name),
            (double) i->latency, (double) i->configured_latency,
+           (double) i->render_cost_avg, (double) i->render_cost_max,
            i->flags & PA_SINK_HARDWARE ? "HARDWARE " : "",
            i->flags & PA_SINK_NETWORK ? "NETWORK " : "",
            i->flags & PA_SINK_HW_MUTE_CTRL ? "HW_MUTE_CTRL " : "",
@@ -672,6 +674,9 @@ static void get_sink_input_info_callback(pa_context *c, const pa_sink_input_info
              "\tBuffer Latency: %0.0f usec\n"
              "\tSink Latency: %0.0f usec\n"
              "\tResample method: %s\n"
+             "\tRender Cost: %0.0f usec average, %0.0f usec max\n"
+             "\t             pop %0.0f usec average, %0.0f usec max\n"
+             "\t             resample %0.0f usec average, %0.0f usec max\n"
              "\tProperties:\n\t\t%s\n"),
            i->index,
            pa_strnull(i->driver),
@@ -689,6 +694,9 @@ static void get_sink_input_info_callback(pa_context *c, const pa_sink_input_info
            (double) i->buffer_usec,
            (double) i->sink_usec,
            i->resample_method ? i->resample_method : _("n/a"),
+           (double) i->render_cost_avg, (double) i->render_cost_max,
+           (double) i->pop_cost_avg, (double) i->pop_cost_max,
+           (double) i->resample_cost_avg, (double) i->resample_cost_max,
            pl = pa_proplist_to_string_sep(i->proplist, "\n\t\t"));
 
     pa_xfree(pl);